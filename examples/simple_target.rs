@@ -1,82 +1,56 @@
 //! Simple iSCSI target example with in-memory storage
 //!
 //! This example demonstrates how to create an iSCSI target backed by
-//! a simple in-memory storage device.
-
-use iscsi_target::{IscsiError, IscsiTarget, ScsiBlockDevice, ScsiResult};
-
-/// Simple in-memory storage backend
-struct MemoryStorage {
-    data: Vec<u8>,
-    block_size: u32,
-}
-
-impl MemoryStorage {
-    fn new(size_mb: usize, block_size: u32) -> Self {
-        let size_bytes = size_mb * 1024 * 1024;
-        Self {
-            data: vec![0u8; size_bytes],
-            block_size,
-        }
-    }
-}
-
-impl ScsiBlockDevice for MemoryStorage {
-    fn read(&self, lba: u64, blocks: u32, block_size: u32) -> ScsiResult<Vec<u8>> {
-        if block_size != self.block_size {
-            return Err(IscsiError::Scsi(format!(
-                "block size mismatch: expected {}, got {}",
-                self.block_size, block_size
-            )));
-        }
-
-        let offset = (lba * block_size as u64) as usize;
-        let len = (blocks * block_size) as usize;
-
-        if offset + len > self.data.len() {
-            return Err(IscsiError::Scsi(format!(
-                "read beyond device capacity: LBA {}, blocks {}",
-                lba, blocks
-            )));
-        }
-
-        Ok(self.data[offset..offset + len].to_vec())
-    }
-
-    fn write(&mut self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
-        if block_size != self.block_size {
-            return Err(IscsiError::Scsi(format!(
-                "block size mismatch: expected {}, got {}",
-                self.block_size, block_size
-            )));
-        }
-
-        let offset = (lba * block_size as u64) as usize;
-
-        if offset + data.len() > self.data.len() {
-            return Err(IscsiError::Scsi(format!(
-                "write beyond device capacity: LBA {}, bytes {}",
-                lba,
-                data.len()
-            )));
-        }
-
-        self.data[offset..offset + data.len()].copy_from_slice(data);
-        Ok(())
-    }
-
-    fn capacity(&self) -> u64 {
-        (self.data.len() / self.block_size as usize) as u64
-    }
-
-    fn block_size(&self) -> u32 {
-        self.block_size
-    }
-
-    fn flush(&mut self) -> ScsiResult<()> {
-        // No-op for memory storage
-        Ok(())
-    }
+//! the library's stripe-locked `MemoryDevice`, which lets sessions read and
+//! write in parallel.
+//!
+//! Usage: `simple_target [bind_addr] [workers] [cache_mb]`. With a worker
+//! count the target serves connections event-driven from that many
+//! threads (0 keeps a thread per connection). With a cache size, writes go
+//! through a write-back cache of that many megabytes and MODE SENSE reports
+//! WCE=1.
+//!
+//! Set `ISCSI_TRACE_FILE` to record the last million PDUs and save them to
+//! that file every few seconds, for the test suite's `--replay` option.
+//! Set `ISCSI_METRICS_ADDR` (e.g. `127.0.0.1:9100`) to serve Prometheus
+//! metrics at `/metrics`; the suite's bench category can scrape them.
+//!
+//! `ISCSI_BACKEND` picks the storage: `memory` (the default), `mmap:PATH`
+//! for a memory-mapped file or `direct:PATH` for O_DIRECT I/O. A missing
+//! or smaller file is created or grown to 100 MB. `sparse` is a
+//! thin-provisioned RAM disk that supports UNMAP; `sparse:GB` makes it
+//! that many gigabytes, and memory is only used for data written.
+//!
+//! `ISCSI_LUNS=N` exports N LUNs, numbered from 0, each with its own
+//! device of that backend and its own lock. File backends use PATH for
+//! LUN 0 and PATH.1, PATH.2, ... for the others.
+
+use iscsi_target::{
+    ConnectionModel, DirectDevice, IscsiError, IscsiTarget, MemoryDevice, MmapDevice,
+    ScsiBlockDevice, ScsiResult, SparseDevice, WriteBackCache,
+};
+use std::fs::File;
+use std::io::BufWriter;
+use std::sync::Arc;
+use std::thread;
+use std::time::Duration;
+
+/// PDUs kept in the trace ring when `ISCSI_TRACE_FILE` is set
+const TRACE_RECORDS: usize = 1 << 20;
+
+/// How often the trace is saved
+const TRACE_SAVE_INTERVAL: Duration = Duration::from_secs(2);
+
+/// Device size in bytes, and the size file backends create or grow to
+const STORAGE_SIZE: usize = 100 * 1024 * 1024;
+
+/// Everything `run` needs besides the storage
+struct Options {
+    bind_addr: String,
+    workers: Option<usize>,
+    cache_mb: Option<usize>,
+    trace_file: Option<String>,
+    metrics_addr: Option<String>,
 }
 
 fn main() -> Result<(), Box<dyn std::error::Error>> {
@@ -88,25 +62,49 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         .nth(1)
         .unwrap_or_else(|| "0.0.0.0:3260".to_string());
 
-    // Create 100 MB in-memory storage with 512-byte blocks
-    let storage = MemoryStorage::new(100, 512);
-
-    println!("Creating iSCSI target with {} MB in-memory storage", 100);
-    println!(
-        "Capacity: {} blocks of {} bytes",
-        storage.capacity(),
-        storage.block_size()
-    );
-
-    // Build and configure the target
-    let target = IscsiTarget::builder()
-        .bind_addr(&bind_addr)
-        .target_name("iqn.2025-12.local:storage.memory-disk")
-        .build(storage)?;
+    // Optional worker count: serve connections event-driven from a fixed
+    // pool instead of one thread each, and allow many more of them
+    let workers: Option<usize> = std::env::args()
+        .nth(2)
+        .and_then(|w| w.parse().ok())
+        .filter(|&w| w > 0);
+
+    // Optional write-back cache size in megabytes
+    let cache_mb: Option<usize> = std::env::args().nth(3).and_then(|c| c.parse().ok());
+
+    // Optional PDU trace file, metrics endpoint and storage backend
+    let trace_file = std::env::var("ISCSI_TRACE_FILE").ok();
+    let metrics_addr = std::env::var("ISCSI_METRICS_ADDR").ok();
+    let backend = std::env::var("ISCSI_BACKEND").unwrap_or_else(|_| "memory".to_string());
+    let lun_count: u16 = match std::env::var("ISCSI_LUNS") {
+        Ok(n) => match n.parse() {
+            Ok(n) if n > 0 => n,
+            _ => {
+                eprintln!("Bad ISCSI_LUNS {:?}; give a LUN count of at least 1", n);
+                std::process::exit(2);
+            }
+        },
+        Err(_) => 1,
+    };
 
     println!("\niSCSI target configured:");
     println!("  Target name: iqn.2025-12.local:storage.memory-disk");
     println!("  Listen address: {}", bind_addr);
+    if let Some(workers) = workers {
+        println!("  Connections: event-driven, {} workers", workers);
+    }
+    if lun_count > 1 {
+        println!("  LUNs: 0-{}", lun_count - 1);
+    }
+    if let Some(cache_mb) = cache_mb {
+        println!("  Write-back cache: {} MB", cache_mb);
+    }
+    if let Some(trace_file) = &trace_file {
+        println!("  PDU trace: {}", trace_file);
+    }
+    if let Some(metrics_addr) = &metrics_addr {
+        println!("  Metrics: http://{}/metrics", metrics_addr);
+    }
     // Extract port for help text
     let port = bind_addr.split(':').nth(1).unwrap_or("3260");
 
@@ -117,8 +115,19 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     println!("  sudo iscsiadm -m node -T iqn.2025-12.local:storage.memory-disk -p 127.0.0.1:{} --logout", port);
     println!("\nStarting iSCSI target server...\n");
 
-    // Run the target
-    match target.run() {
+    // Create the storage, with 512-byte blocks, and run the target
+    let options = Options {
+        bind_addr,
+        workers,
+        cache_mb,
+        trace_file,
+        metrics_addr,
+    };
+    let result = (0..lun_count)
+        .map(|lun| open_storage(&backend, lun))
+        .collect::<ScsiResult<Vec<_>>>()
+        .and_then(|luns| serve(&options, luns));
+    match result {
         Ok(_) => {
             println!("Target stopped gracefully");
             Ok(())
@@ -129,3 +138,110 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         }
     }
 }
+
+/// Create the `ISCSI_BACKEND` storage for one LUN, with 512-byte blocks
+fn open_storage(backend: &str, lun: u16) -> ScsiResult<Box<dyn ScsiBlockDevice>> {
+    let size = STORAGE_SIZE as u64;
+    let path_for = |path: &str| if lun == 0 { path.to_string() } else { format!("{}.{}", path, lun) };
+    let storage: Box<dyn ScsiBlockDevice> = match backend.split_once(':') {
+        None if backend == "memory" => {
+            println!("LUN {}: {} MB in memory", lun, STORAGE_SIZE >> 20);
+            Box::new(MemoryDevice::new(STORAGE_SIZE, 512))
+        }
+        None if backend == "sparse" => {
+            println!("LUN {}: {} MB sparse", lun, STORAGE_SIZE >> 20);
+            Box::new(SparseDevice::new(size, 512))
+        }
+        Some(("sparse", gb)) => match gb.parse::<u64>() {
+            Ok(gb) if gb > 0 => {
+                println!("LUN {}: {} GB sparse", lun, gb);
+                Box::new(SparseDevice::new(gb << 30, 512))
+            }
+            _ => {
+                return Err(IscsiError::Config(format!("Bad sparse size {:?}; give whole gigabytes", gb)));
+            }
+        },
+        Some(("mmap", path)) => {
+            let path = path_for(path);
+            println!("LUN {}: {} memory-mapped", lun, path);
+            Box::new(MmapDevice::create(&path, size, 512)?)
+        }
+        Some(("direct", path)) => {
+            let path = path_for(path);
+            println!("LUN {}: {} with O_DIRECT", lun, path);
+            Box::new(DirectDevice::create(&path, size, 512)?)
+        }
+        _ => {
+            return Err(IscsiError::Config(format!(
+                "Unknown ISCSI_BACKEND {:?}; use memory, sparse[:GB], mmap:PATH or direct:PATH",
+                backend
+            )));
+        }
+    };
+    Ok(storage)
+}
+
+/// Put the optional write-back cache in front of each LUN's storage and run the target
+fn serve(options: &Options, luns: Vec<Box<dyn ScsiBlockDevice>>) -> ScsiResult<()> {
+    println!(
+        "Capacity: {} blocks of {} bytes per LUN\n",
+        luns[0].capacity(),
+        luns[0].block_size()
+    );
+    let luns = match options.cache_mb {
+        Some(cache_mb) => luns
+            .into_iter()
+            .map(|storage| Box::new(WriteBackCache::new(storage, cache_mb * 1024 * 1024)) as Box<dyn ScsiBlockDevice>)
+            .collect(),
+        None => luns,
+    };
+    run(options, luns)
+}
+
+/// Build and configure the target around the LUNs' storage, then serve until it stops
+fn run(options: &Options, luns: Vec<Box<dyn ScsiBlockDevice>>) -> ScsiResult<()> {
+    let mut builder = IscsiTarget::builder()
+        .bind_addr(&options.bind_addr)
+        .target_name("iqn.2025-12.local:storage.memory-disk");
+    if let Some(workers) = options.workers {
+        builder = builder
+            .connection_model(ConnectionModel::EventDriven { workers })
+            .max_connections(4096)
+            .max_sessions(4096);
+    }
+    if options.trace_file.is_some() {
+        builder = builder.pdu_trace(TRACE_RECORDS);
+    }
+    if let Some(metrics_addr) = &options.metrics_addr {
+        builder = builder.metrics_addr(metrics_addr);
+    }
+    let mut luns = luns.into_iter();
+    let first = luns.next().expect("at least one LUN");
+    for (lun, storage) in (1..).zip(luns) {
+        builder = builder.lun(lun, storage);
+    }
+    let target = Arc::new(builder.build(first)?);
+
+    if let Some(path) = options.trace_file.clone() {
+        let target = Arc::clone(&target);
+        thread::spawn(move || loop {
+            thread::sleep(TRACE_SAVE_INTERVAL);
+            if let Err(e) = save_trace(&target, &path) {
+                eprintln!("Failed to save PDU trace to {}: {}", path, e);
+            }
+        });
+    }
+    target.run()
+}
+
+/// Save the PDU trace, replacing `path` only once the new copy is complete
+fn save_trace<D: ScsiBlockDevice + 'static>(target: &IscsiTarget<D>, path: &str) -> ScsiResult<()> {
+    let Some(trace) = target.pdu_trace() else {
+        return Ok(());
+    };
+    let partial = format!("{}.partial", path);
+    let file = File::create(&partial)?;
+    trace.write_to(BufWriter::new(file))?;
+    std::fs::rename(&partial, path)?;
+    Ok(())
+}
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE             /* MAP_HUGETLB, MADV_HUGEPAGE */
+#include "buffer_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define POOL_MIN_SIZE 4096
+#define POOL_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+#define POOL_MAX_CHUNKS 4096
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    int in_use;
+} pool_chunk_t;
+
+static pool_chunk_t chunks[POOL_MAX_CHUNKS];
+static int chunk_count = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Round up to the pool's size classes: powers of two, at least one page */
+static size_t size_class(size_t size) {
+    size_t cls = POOL_MIN_SIZE;
+
+    while (cls < size) {
+        cls <<= 1;
+    }
+    return cls;
+}
+
+/* Map and pre-fault a new buffer. NULL on failure. */
+static uint8_t* map_buffer(size_t size) {
+    long page = sysconf(_SC_PAGESIZE);
+    uint8_t *buf;
+
+    if (page <= 0) {
+        page = POOL_MIN_SIZE;
+    }
+
+    if (size >= POOL_HUGE_PAGE_SIZE) {
+        /* Reserved hugetlbfs pages first; MAP_POPULATE faults them in here */
+        buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (buf != MAP_FAILED) {
+            return buf;
+        }
+    }
+
+    buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (size >= POOL_HUGE_PAGE_SIZE) {
+        madvise(buf, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    /* Touch every page now so the first I/O does not take the faults */
+    for (size_t off = 0; off < size; off += (size_t)page) {
+        buf[off] = 0;
+    }
+    return buf;
+}
+
+uint8_t* buffer_pool_get(size_t size) {
+    size_t cls = size_class(size);
+    uint8_t *buf;
+    void *fallback = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < chunk_count; i++) {
+        if (!chunks[i].in_use && chunks[i].size == cls) {
+            chunks[i].in_use = 1;
+            pthread_mutex_unlock(&pool_lock);
+            return chunks[i].base;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    /* Map outside the lock: pre-faulting large buffers takes a while */
+    buf = map_buffer(cls);
+    if (!buf) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (chunk_count < POOL_MAX_CHUNKS) {
+        chunks[chunk_count].base = buf;
+        chunks[chunk_count].size = cls;
+        chunks[chunk_count].in_use = 1;
+        chunk_count++;
+        pthread_mutex_unlock(&pool_lock);
+        return buf;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    /* Table full: hand out an untracked, page-aligned heap buffer instead */
+    munmap(buf, cls);
+    if (posix_memalign(&fallback, POOL_MIN_SIZE, cls) != 0) {
+        return NULL;
+    }
+    return fallback;
+}
+
+void buffer_pool_put(uint8_t *buffer) {
+    if (!buffer) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < chunk_count; i++) {
+        if (chunks[i].base == buffer) {
+            chunks[i].in_use = 0;
+            pthread_mutex_unlock(&pool_lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    /* Not one of ours: it came from the posix_memalign fallback */
+    free(buffer);
+}
+
+void buffer_pool_destroy(void) {
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < chunk_count; i++) {
+        munmap(chunks[i].base, chunks[i].size);
+    }
+    chunk_count = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,29 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Framework-owned pool of I/O buffers.
+ *
+ * Buffers are page aligned, pre-faulted when first mapped and reused for
+ * the rest of the run, so a test or benchmark loop that checks buffers out
+ * never calls into malloc or takes a page fault on them. Sizes are rounded
+ * up to a power of two (at least one page); buffers of 2 MiB and up are
+ * backed by hugetlbfs pages when the system has them reserved, and by
+ * transparent huge pages otherwise.
+ *
+ * Contents are not cleared between checkouts. All calls are thread-safe.
+ */
+
+/* Check out a buffer of at least size bytes. NULL on failure. */
+uint8_t* buffer_pool_get(size_t size);
+
+/* Return a buffer to the pool. NULL is ignored. */
+void buffer_pool_put(uint8_t *buffer);
+
+/* Unmap every pooled buffer; none may be checked out */
+void buffer_pool_destroy(void);
+
+#endif /* BUFFER_POOL_H */
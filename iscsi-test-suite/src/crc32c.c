@@ -0,0 +1,129 @@
+#include "crc32c.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#define CRC32C_POLY 0x82F63B78U     /* Bit-reflected Castagnoli polynomial */
+
+typedef uint32_t (*crc32c_update_fn)(uint32_t state, const uint8_t *p, size_t len);
+
+/* Slicing-by-8 tables: tables[k][b] = CRC of byte b followed by k zero bytes */
+static uint32_t tables[8][256];
+static crc32c_update_fn update_fn;
+static int hardware;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static uint64_t load_le64(const uint8_t *p) {
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static uint32_t update_table(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len >= 8) {
+        uint64_t word = load_le64(p) ^ crc;
+
+        crc = tables[7][word & 0xFF] ^
+              tables[6][(word >> 8) & 0xFF] ^
+              tables[5][(word >> 16) & 0xFF] ^
+              tables[4][(word >> 24) & 0xFF] ^
+              tables[3][(word >> 32) & 0xFF] ^
+              tables[2][(word >> 40) & 0xFF] ^
+              tables[1][(word >> 48) & 0xFF] ^
+              tables[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t update_hw(uint32_t state, const uint8_t *p, size_t len) {
+    uint64_t crc = state;
+
+    while (len >= 8) {
+        crc = _mm_crc32_u64(crc, load_le64(p));
+        p += 8;
+        len -= 8;
+    }
+    state = (uint32_t)crc;
+    while (len--) {
+        state = _mm_crc32_u8(state, *p++);
+    }
+    return state;
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc")))
+static uint32_t update_hw(uint32_t state, const uint8_t *p, size_t len) {
+    while (len >= 8) {
+        state = __crc32cd(state, load_le64(p));
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        state = __crc32cb(state, *p++);
+    }
+    return state;
+}
+#endif
+
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        tables[0][i] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int i = 0; i < 256; i++) {
+            tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+        }
+    }
+
+    update_fn = update_table;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        update_fn = update_hw;
+        hardware = 1;
+    }
+#elif defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        update_fn = update_hw;
+        hardware = 1;
+    }
+#endif
+}
+
+uint32_t crc32c_append(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&init_once, crc32c_init);
+    return ~update_fn(~crc, data, len);
+}
+
+uint32_t crc32c(const void *data, size_t len) {
+    return crc32c_append(0, data, len);
+}
+
+int crc32c_hardware(void) {
+    pthread_once(&init_once, crc32c_init);
+    return hardware;
+}
@@ -0,0 +1,26 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli) for iSCSI header and data digests.
+ *
+ * Uses the SSE4.2 crc32 instruction on x86_64 or the ARMv8 CRC extension
+ * on aarch64 when the CPU has them, and a slicing-by-8 table otherwise.
+ * Digests go on the wire least significant byte first.
+ */
+
+#define CRC32C_DIGEST_SIZE 4
+
+/* CRC32C of a buffer */
+uint32_t crc32c(const void *data, size_t len);
+
+/* Continue a CRC: crc32c_append(crc32c(a), b) == crc32c(a followed by b) */
+uint32_t crc32c_append(uint32_t crc, const void *data, size_t len);
+
+/* 1 if the hardware path is in use, 0 for the table */
+int crc32c_hardware(void);
+
+#endif /* CRC32C_H */
@@ -0,0 +1,268 @@
+#include "data_pattern.h"
+#include <stdio.h>
+#include <string.h>
+
+#define WORD_SIZE sizeof(uint64_t)
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ULL
+
+/* splitmix64 finalizer: a cheap, well-mixed hash of one word */
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t load_word(const uint8_t *p) {
+    uint64_t w;
+    memcpy(&w, p, WORD_SIZE);
+    return w;
+}
+
+static inline void store_word(uint8_t *p, uint64_t w) {
+    memcpy(p, &w, WORD_SIZE);
+}
+
+/* Word holding bytes b0, b1, ... b7 in memory order */
+static uint64_t word_from_bytes(const uint8_t bytes[WORD_SIZE]) {
+    return load_word(bytes);
+}
+
+/*
+ * Expected contents of word i of a plain pattern. The sequential pattern
+ * repeats every 256 bytes, i.e. every 32 words, so it is a table lookup.
+ */
+typedef struct {
+    pattern_type_t type;
+    uint64_t constant;              /* zero, ones, alternating */
+    uint64_t key;                   /* random */
+    uint64_t sequential[32];
+} plain_pattern_t;
+
+static void plain_pattern_init(plain_pattern_t *pat, pattern_type_t type, uint32_t seed) {
+    uint8_t bytes[WORD_SIZE];
+
+    pat->type = type;
+    pat->constant = 0;
+    pat->key = mix64((uint64_t)seed + GOLDEN_GAMMA);
+
+    switch (type) {
+        case PATTERN_ONES:
+            pat->constant = ~0ULL;
+            break;
+        case PATTERN_ALTERNATING:
+            for (size_t k = 0; k < WORD_SIZE; k++) {
+                bytes[k] = (k % 2) ? 0xAA : 0x55;
+            }
+            pat->constant = word_from_bytes(bytes);
+            break;
+        case PATTERN_SEQUENTIAL:
+            for (size_t w = 0; w < 32; w++) {
+                for (size_t k = 0; k < WORD_SIZE; k++) {
+                    bytes[k] = (uint8_t)(w * WORD_SIZE + k);
+                }
+                pat->sequential[w] = word_from_bytes(bytes);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static inline uint64_t plain_pattern_word(const plain_pattern_t *pat, size_t i) {
+    switch (pat->type) {
+        case PATTERN_SEQUENTIAL: return pat->sequential[i & 31];
+        case PATTERN_RANDOM:     return mix64(pat->key + i * GOLDEN_GAMMA);
+        default:                 return pat->constant;
+    }
+}
+
+/* Payload key for one block: every (seed, lba, generation) gets its own stream */
+static inline uint64_t block_key(uint64_t lba, uint64_t generation, uint64_t seed) {
+    return mix64(seed + mix64(lba * GOLDEN_GAMMA + mix64(generation)));
+}
+
+static inline uint64_t block_word(uint64_t key, size_t i) {
+    return mix64(key + i * GOLDEN_GAMMA);
+}
+
+/* Index of the first differing byte between two words */
+static size_t first_diff_byte(uint64_t a, uint64_t b) {
+    uint8_t ab[WORD_SIZE], bb[WORD_SIZE];
+    size_t k;
+
+    memcpy(ab, &a, WORD_SIZE);
+    memcpy(bb, &b, WORD_SIZE);
+    for (k = 0; k < WORD_SIZE - 1 && ab[k] == bb[k]; k++) {
+    }
+    return k;
+}
+
+static void set_mismatch(pattern_mismatch_t *mismatch, size_t offset,
+                         uint64_t expected_word, uint64_t actual_word) {
+    size_t k = first_diff_byte(expected_word, actual_word);
+    uint8_t eb[WORD_SIZE], ab[WORD_SIZE];
+
+    memcpy(eb, &expected_word, WORD_SIZE);
+    memcpy(ab, &actual_word, WORD_SIZE);
+    mismatch->offset = offset + k;
+    mismatch->expected = eb[k];
+    mismatch->actual = ab[k];
+}
+
+pattern_type_t pattern_type_from_name(const char *name) {
+    if (strcmp(name, "zero") == 0) return PATTERN_ZERO;
+    if (strcmp(name, "ones") == 0) return PATTERN_ONES;
+    if (strcmp(name, "alternating") == 0) return PATTERN_ALTERNATING;
+    if (strcmp(name, "random") == 0) return PATTERN_RANDOM;
+    return PATTERN_SEQUENTIAL;
+}
+
+void pattern_fill(uint8_t *buffer, size_t size, pattern_type_t type, uint32_t seed) {
+    plain_pattern_t pat;
+    size_t words = size / WORD_SIZE;
+    size_t tail = size % WORD_SIZE;
+
+    if (type == PATTERN_ZERO || type == PATTERN_ONES) {
+        memset(buffer, type == PATTERN_ZERO ? 0x00 : 0xFF, size);
+        return;
+    }
+
+    plain_pattern_init(&pat, type, seed);
+    for (size_t i = 0; i < words; i++) {
+        store_word(buffer + i * WORD_SIZE, plain_pattern_word(&pat, i));
+    }
+    if (tail) {
+        uint64_t w = plain_pattern_word(&pat, words);
+        memcpy(buffer + words * WORD_SIZE, &w, tail);
+    }
+}
+
+int pattern_check(const uint8_t *buffer, size_t size, pattern_type_t type, uint32_t seed,
+                  pattern_mismatch_t *mismatch) {
+    plain_pattern_t pat;
+    size_t words = size / WORD_SIZE;
+    size_t tail = size % WORD_SIZE;
+
+    plain_pattern_init(&pat, type, seed);
+    for (size_t i = 0; i < words; i++) {
+        uint64_t expected = plain_pattern_word(&pat, i);
+        uint64_t actual = load_word(buffer + i * WORD_SIZE);
+        if (actual != expected) {
+            if (mismatch) {
+                memset(mismatch, 0, sizeof(*mismatch));
+                set_mismatch(mismatch, i * WORD_SIZE, expected, actual);
+            }
+            return -1;
+        }
+    }
+    if (tail) {
+        uint64_t expected = plain_pattern_word(&pat, words);
+        uint64_t actual = expected;
+        memcpy(&actual, buffer + words * WORD_SIZE, tail);
+        if (actual != expected) {
+            if (mismatch) {
+                memset(mismatch, 0, sizeof(*mismatch));
+                set_mismatch(mismatch, words * WORD_SIZE, expected, actual);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void pattern_fill_blocks(uint8_t *buffer, uint64_t lba, uint32_t num_blocks, uint32_t block_size,
+                         uint64_t generation, uint64_t seed) {
+    size_t words = block_size / WORD_SIZE;
+
+    for (uint32_t b = 0; b < num_blocks; b++) {
+        uint8_t *block = buffer + (size_t)b * block_size;
+        pattern_block_header_t hdr = {
+            .magic = PATTERN_BLOCK_MAGIC,
+            .lba = lba + b,
+            .generation = generation,
+            .seed = seed
+        };
+        uint64_t key = block_key(hdr.lba, generation, seed);
+
+        memcpy(block, &hdr, sizeof(hdr));
+        for (size_t i = sizeof(hdr) / WORD_SIZE; i < words; i++) {
+            store_word(block + i * WORD_SIZE, block_word(key, i));
+        }
+    }
+}
+
+int pattern_verify_blocks(const uint8_t *buffer, uint64_t lba, uint32_t num_blocks,
+                          uint32_t block_size, uint64_t generation, uint64_t seed,
+                          pattern_mismatch_t *mismatch) {
+    size_t words = block_size / WORD_SIZE;
+    const size_t lba_offset = offsetof(pattern_block_header_t, lba);
+    const size_t gen_offset = offsetof(pattern_block_header_t, generation);
+
+    for (uint32_t b = 0; b < num_blocks; b++) {
+        const uint8_t *block = buffer + (size_t)b * block_size;
+        uint64_t block_lba = lba + b;
+        uint64_t key = block_key(block_lba, generation, seed);
+        pattern_block_header_t hdr;
+        size_t i;
+
+        memcpy(&hdr, block, sizeof(hdr));
+
+        /* Header first: it tells a misdirected or stale block from a corrupted one */
+        if (hdr.magic == PATTERN_BLOCK_MAGIC && hdr.lba == block_lba &&
+            hdr.generation == generation && hdr.seed == seed) {
+            for (i = sizeof(hdr) / WORD_SIZE; i < words; i++) {
+                uint64_t expected = block_word(key, i);
+                uint64_t actual = load_word(block + i * WORD_SIZE);
+                if (actual != expected) {
+                    break;
+                }
+            }
+            if (i == words) {
+                continue;
+            }
+        } else {
+            i = 0;
+        }
+
+        if (mismatch) {
+            memset(mismatch, 0, sizeof(*mismatch));
+            mismatch->lba = block_lba;
+            mismatch->generation = generation;
+            mismatch->header_valid = hdr.magic == PATTERN_BLOCK_MAGIC;
+            mismatch->found_lba = hdr.lba;
+            mismatch->found_generation = hdr.generation;
+
+            if (i > 0) {
+                set_mismatch(mismatch, i * WORD_SIZE, block_word(key, i),
+                             load_word(block + i * WORD_SIZE));
+            } else if (!mismatch->header_valid) {
+                set_mismatch(mismatch, 0, PATTERN_BLOCK_MAGIC, hdr.magic);
+            } else if (hdr.lba != block_lba) {
+                set_mismatch(mismatch, lba_offset, block_lba, hdr.lba);
+            } else if (hdr.generation != generation) {
+                set_mismatch(mismatch, gen_offset, generation, hdr.generation);
+            } else {
+                set_mismatch(mismatch, offsetof(pattern_block_header_t, seed), seed, hdr.seed);
+            }
+        }
+        return -1;
+    }
+    return 0;
+}
+
+void pattern_format_mismatch(const pattern_mismatch_t *mismatch, char *buf, size_t size) {
+    if (mismatch->header_valid && mismatch->found_lba != mismatch->lba) {
+        snprintf(buf, size, "LBA %llu holds data written for LBA %llu (misdirected write)",
+                 (unsigned long long)mismatch->lba, (unsigned long long)mismatch->found_lba);
+    } else if (mismatch->header_valid && mismatch->found_generation != mismatch->generation) {
+        snprintf(buf, size, "LBA %llu holds generation %llu, expected %llu (stale data)",
+                 (unsigned long long)mismatch->lba,
+                 (unsigned long long)mismatch->found_generation,
+                 (unsigned long long)mismatch->generation);
+    } else {
+        snprintf(buf, size, "LBA %llu offset %zu: expected 0x%02x, got 0x%02x%s",
+                 (unsigned long long)mismatch->lba, mismatch->offset,
+                 mismatch->expected, mismatch->actual,
+                 mismatch->header_valid ? "" : " (no block header)");
+    }
+}
@@ -1,14 +1,23 @@
 #include "iscsi_pdu_helper.h"
+#include "crc32c.h"
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
-#include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 /* iSCSI PDU Opcodes */
 #define ISCSI_OPCODE_LOGIN_REQUEST 0x03
 #define ISCSI_OPCODE_LOGIN_RESPONSE 0x23
@@ -310,68 +319,6 @@ uint8_t* build_login_pdu_invalid_param_combo(size_t *pdu_size) {
     return pdu;
 }
 
-/**
- * Send PDU to target and receive response
- */
-uint8_t* send_pdu_and_recv_response(const char *host, int port,
-                                     const uint8_t *pdu, size_t pdu_size,
-                                     size_t *response_size) {
-    struct sockaddr_in server_addr;
-    struct hostent *server;
-    int sock;
-    uint8_t *response_buf;
-    int bytes_recv;
-
-    /* Create socket */
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        return NULL;
-    }
-
-    /* Resolve hostname */
-    server = gethostbyname(host);
-    if (!server) {
-        close(sock);
-        return NULL;
-    }
-
-    /* Connect to server */
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    memcpy(&server_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-
-    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        close(sock);
-        return NULL;
-    }
-
-    /* Send PDU */
-    if (send(sock, pdu, pdu_size, 0) < 0) {
-        close(sock);
-        return NULL;
-    }
-
-    /* Allocate response buffer (max iSCSI PDU + data) */
-    response_buf = (uint8_t *)malloc(65536);
-    if (!response_buf) {
-        close(sock);
-        return NULL;
-    }
-
-    /* Receive response */
-    bytes_recv = recv(sock, response_buf, 65536, 0);
-    close(sock);
-
-    if (bytes_recv <= 0) {
-        free(response_buf);
-        return NULL;
-    }
-
-    *response_size = bytes_recv;
-    return response_buf;
-}
-
 /**
  * Parse login response status
  * Returns: 0 if rejected, 1 if accepted, -1 on error
@@ -400,3 +347,937 @@ int parse_login_response_status(const uint8_t *response, size_t response_size) {
     /* Any other status = rejected/error */
     return 0;  /* Rejected */
 }
+
+/* Raw full-feature session: PDU opcodes and flags */
+#define ISCSI_BHS_SIZE 48
+
+#define ISCSI_OPCODE_NOP_OUT 0x00
+#define ISCSI_OPCODE_SCSI_COMMAND 0x01
+#define ISCSI_OPCODE_TASK_MGMT_REQUEST 0x02
+#define ISCSI_OPCODE_DATA_OUT 0x05
+#define ISCSI_OPCODE_LOGOUT_REQUEST 0x06
+#define ISCSI_OPCODE_NOP_IN 0x20
+#define ISCSI_OPCODE_SCSI_RESPONSE 0x21
+#define ISCSI_OPCODE_TASK_MGMT_RESPONSE 0x22
+#define ISCSI_OPCODE_DATA_IN 0x25
+#define ISCSI_OPCODE_LOGOUT_RESPONSE 0x26
+#define ISCSI_OPCODE_R2T 0x31
+#define ISCSI_OPCODE_REJECT 0x3f
+
+#define ISCSI_OPCODE_IMMEDIATE 0x40
+#define ISCSI_FLAG_FINAL 0x80
+
+/* SCSI Command flags */
+#define ISCSI_CMD_FLAG_READ 0x40
+#define ISCSI_CMD_FLAG_WRITE 0x20
+#define ISCSI_CMD_ATTR_SIMPLE 0x01
+
+/* Data-In flags */
+#define ISCSI_DATAIN_FLAG_UNDERFLOW 0x02
+#define ISCSI_DATAIN_FLAG_STATUS 0x01
+
+#define ISCSI_RESERVED_TAG 0xFFFFFFFFU
+
+/* On the wire FullFeaturePhase is stage 3 (2 is reserved) */
+#define ISCSI_STAGE_FULL_FEATURE 3
+
+static uint32_t decode_24bit(const uint8_t *buf) {
+    return ((uint32_t)buf[0] << 16) | ((uint32_t)buf[1] << 8) | buf[2];
+}
+
+static uint32_t decode_32bit(const uint8_t *buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+           ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+/* Digests go on the wire least significant byte first */
+static void encode_crc32c(uint8_t *buf, uint32_t crc) {
+    buf[0] = (uint8_t)crc;
+    buf[1] = (uint8_t)(crc >> 8);
+    buf[2] = (uint8_t)(crc >> 16);
+    buf[3] = (uint8_t)(crc >> 24);
+}
+
+static uint32_t decode_crc32c(const uint8_t *buf) {
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+           ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+/* Single-level LUN, peripheral device addressing */
+static void encode_lun(uint8_t *buf, int lun) {
+    memset(buf, 0, 8);
+    buf[1] = (uint8_t)lun;
+}
+
+/* Read exactly len bytes */
+static int recv_all(int sock, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(sock, buf, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Write an iovec array completely, resuming after short writes */
+static int writev_all(int sock, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(sock, iov, iovcnt);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+/* Track StatSN from any PDU that carries a valid one */
+static void raw_update_stat_sn(iscsi_raw_conn_t *conn, const uint8_t *bhs) {
+    conn->exp_stat_sn = decode_32bit(bhs + 24) + 1;
+}
+
+int iscsi_raw_connect(iscsi_raw_conn_t *conn, const char *portal) {
+    char host[256];
+    const char *port = "3260";
+    char *colon;
+    struct addrinfo hints, *res, *ai;
+    int one = 1;
+
+    memset(conn, 0, sizeof(*conn));
+    conn->sock = -1;
+    conn->itt = 1;
+    conn->cmd_sn = 1;
+    conn->exp_cmd_sn = 1;
+    conn->max_cmd_sn = 1;
+    conn->immediate_data = 1;
+    conn->initial_r2t = 1;
+    conn->first_burst_length = 65536;
+    conn->max_burst_length = 262144;
+    conn->max_xmit_data_segment_length = 8192;
+    conn->max_recv_data_segment_length = 8192;
+    conn->max_connections = 1;
+
+    strncpy(host, portal, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    colon = strrchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        port = colon + 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        return -1;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        conn->sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (conn->sock < 0) {
+            continue;
+        }
+        if (connect(conn->sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(conn->sock);
+        conn->sock = -1;
+    }
+    freeaddrinfo(res);
+
+    if (conn->sock < 0) {
+        return -1;
+    }
+    setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 0;
+}
+
+void iscsi_raw_set_timeout(iscsi_raw_conn_t *conn, int seconds) {
+    struct timeval tv = { seconds, 0 };
+
+    setsockopt(conn->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(conn->sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* BHS, header digest, data, padding and data digest: at most 5 iovecs per PDU */
+#define RAW_IOV_PER_PDU 5
+#define RAW_PDUS_PER_WRITEV (IOV_MAX / RAW_IOV_PER_PDU)
+
+int iscsi_raw_send_pdus(iscsi_raw_conn_t *conn, const iscsi_raw_pdu_t *pdus, int count) {
+    static const uint8_t pad[4] = {0, 0, 0, 0};
+    uint8_t digests[RAW_PDUS_PER_WRITEV][2][CRC32C_DIGEST_SIZE];
+    struct iovec iov[RAW_PDUS_PER_WRITEV * RAW_IOV_PER_PDU];
+    int header_digest = conn->full_feature && conn->header_digest;
+    int data_digest = conn->full_feature && conn->data_digest;
+
+    while (count > 0) {
+        int batch = count < RAW_PDUS_PER_WRITEV ? count : RAW_PDUS_PER_WRITEV;
+        int iovcnt = 0;
+
+        for (int i = 0; i < batch; i++) {
+            const iscsi_raw_pdu_t *pdu = &pdus[i];
+            uint32_t pad_len = (4 - pdu->data_len % 4) % 4;
+
+            iov[iovcnt].iov_base = (void *)pdu->bhs;
+            iov[iovcnt].iov_len = ISCSI_BHS_SIZE;
+            iovcnt++;
+            if (header_digest) {
+                encode_crc32c(digests[i][0], crc32c(pdu->bhs, ISCSI_BHS_SIZE));
+                if (conn->corrupt_next_header_digest) {
+                    digests[i][0][0] ^= 0xFF;
+                    conn->corrupt_next_header_digest = 0;
+                }
+                iov[iovcnt].iov_base = digests[i][0];
+                iov[iovcnt].iov_len = CRC32C_DIGEST_SIZE;
+                iovcnt++;
+            }
+            if (pdu->data_len > 0) {
+                iov[iovcnt].iov_base = (void *)pdu->data;
+                iov[iovcnt].iov_len = pdu->data_len;
+                iovcnt++;
+                if (pad_len) {
+                    iov[iovcnt].iov_base = (void *)pad;
+                    iov[iovcnt].iov_len = pad_len;
+                    iovcnt++;
+                }
+                if (data_digest) {
+                    /* Covers the padding as well */
+                    encode_crc32c(digests[i][1], crc32c_append(crc32c(pdu->data, pdu->data_len),
+                                                               pad, pad_len));
+                    if (conn->corrupt_next_data_digest) {
+                        digests[i][1][0] ^= 0xFF;
+                        conn->corrupt_next_data_digest = 0;
+                    }
+                    iov[iovcnt].iov_base = digests[i][1];
+                    iov[iovcnt].iov_len = CRC32C_DIGEST_SIZE;
+                    iovcnt++;
+                }
+            }
+        }
+
+        if (writev_all(conn->sock, iov, iovcnt) != 0) {
+            return -1;
+        }
+        conn->pdus_sent += (uint64_t)batch;
+        pdus += batch;
+        count -= batch;
+    }
+    return 0;
+}
+
+int iscsi_raw_send_pdu(iscsi_raw_conn_t *conn, const uint8_t *bhs,
+                       const uint8_t *data, uint32_t data_len) {
+    iscsi_raw_pdu_t pdu = { bhs, data, data_len };
+
+    return iscsi_raw_send_pdus(conn, &pdu, 1);
+}
+
+int iscsi_raw_send_bytes(iscsi_raw_conn_t *conn, const uint8_t *buf, size_t len) {
+    struct iovec iov = { (void *)buf, len };
+
+    return writev_all(conn->sock, &iov, 1);
+}
+
+int iscsi_raw_recv_pdu(iscsi_raw_conn_t *conn, uint8_t *bhs,
+                       const uint8_t **data, uint32_t *data_len) {
+    int header_digest = conn->full_feature && conn->header_digest;
+    int data_digest = conn->full_feature && conn->data_digest;
+    uint8_t digest[CRC32C_DIGEST_SIZE];
+    uint32_t ahs_len, dsl, padded;
+    size_t total;
+
+    if (recv_all(conn->sock, bhs, ISCSI_BHS_SIZE) != 0) {
+        return -1;
+    }
+
+    /* AHS (in 4-byte words) and the padded data segment follow the BHS */
+    ahs_len = (uint32_t)bhs[4] * 4;
+    dsl = decode_24bit(bhs + 5);
+    padded = (dsl + 3) & ~3U;
+    total = ahs_len + padded;
+
+    if (total > conn->rx_cap) {
+        uint8_t *buf = realloc(conn->rx_buf, total);
+        if (!buf) {
+            return -1;
+        }
+        conn->rx_buf = buf;
+        conn->rx_cap = total;
+    }
+    if (ahs_len > 0 && recv_all(conn->sock, conn->rx_buf, ahs_len) != 0) {
+        return -1;
+    }
+    if (header_digest) {
+        if (recv_all(conn->sock, digest, sizeof(digest)) != 0) {
+            return -1;
+        }
+        if (decode_crc32c(digest) != crc32c_append(crc32c(bhs, ISCSI_BHS_SIZE),
+                                                   conn->rx_buf, ahs_len)) {
+            conn->digest_errors++;
+            return -1;
+        }
+    }
+    if (padded > 0) {
+        if (recv_all(conn->sock, conn->rx_buf + ahs_len, padded) != 0) {
+            return -1;
+        }
+        if (data_digest) {
+            if (recv_all(conn->sock, digest, sizeof(digest)) != 0) {
+                return -1;
+            }
+            if (decode_crc32c(digest) != crc32c(conn->rx_buf + ahs_len, padded)) {
+                conn->digest_errors++;
+                return -1;
+            }
+        }
+    }
+
+    /* Every target PDU carries the command window */
+    if (bhs[0] & 0x20) {
+        conn->exp_cmd_sn = decode_32bit(bhs + 28);
+        conn->max_cmd_sn = decode_32bit(bhs + 32);
+    }
+
+    conn->pdus_received++;
+    *data = conn->rx_buf + ahs_len;
+    *data_len = dsl;
+    return 0;
+}
+
+/* Answer a target-initiated NOP-In ping; others need no reply */
+static int raw_handle_nop_in(iscsi_raw_conn_t *conn, const uint8_t *in) {
+    uint8_t bhs[ISCSI_BHS_SIZE];
+
+    if (decode_32bit(in + 20) == ISCSI_RESERVED_TAG) {
+        return 0;
+    }
+
+    memset(bhs, 0, sizeof(bhs));
+    bhs[0] = ISCSI_OPCODE_NOP_OUT | ISCSI_OPCODE_IMMEDIATE;
+    bhs[1] = ISCSI_FLAG_FINAL;
+    memcpy(bhs + 8, in + 8, 8);                 /* LUN */
+    encode_32bit(bhs + 16, ISCSI_RESERVED_TAG); /* ITT */
+    memcpy(bhs + 20, in + 20, 4);               /* TTT */
+    encode_32bit(bhs + 24, conn->cmd_sn);
+    encode_32bit(bhs + 28, conn->exp_stat_sn);
+    return iscsi_raw_send_pdu(conn, bhs, NULL, 0);
+}
+
+/* Apply one negotiated key from a login response */
+static void raw_apply_key(iscsi_raw_conn_t *conn, const char *key, const char *value) {
+    if (strcmp(key, "ImmediateData") == 0) {
+        conn->immediate_data = strcmp(value, "Yes") == 0;
+    } else if (strcmp(key, "InitialR2T") == 0) {
+        conn->initial_r2t = strcmp(value, "Yes") == 0;
+    } else if (strcmp(key, "FirstBurstLength") == 0) {
+        conn->first_burst_length = (uint32_t)strtoul(value, NULL, 10);
+    } else if (strcmp(key, "MaxBurstLength") == 0) {
+        conn->max_burst_length = (uint32_t)strtoul(value, NULL, 10);
+    } else if (strcmp(key, "MaxRecvDataSegmentLength") == 0) {
+        conn->max_xmit_data_segment_length = (uint32_t)strtoul(value, NULL, 10);
+    } else if (strcmp(key, "HeaderDigest") == 0) {
+        conn->header_digest = strcmp(value, "CRC32C") == 0;
+    } else if (strcmp(key, "DataDigest") == 0) {
+        conn->data_digest = strcmp(value, "CRC32C") == 0;
+    } else if (strcmp(key, "MaxConnections") == 0) {
+        conn->max_connections = (uint32_t)strtoul(value, NULL, 10);
+    }
+}
+
+int iscsi_raw_login(iscsi_raw_conn_t *conn, const char *initiator_name,
+                    const char *target_name, const iscsi_raw_params_t *params) {
+    iscsi_kv_pair_t pairs[13];
+    int num_pairs = 0;
+    uint8_t segment[4096];
+    uint8_t bhs[ISCSI_BHS_SIZE];
+    int data_size;
+
+#define RAW_ADD_KEY(k, fmt, v) do { \
+        snprintf(pairs[num_pairs].key, sizeof(pairs[num_pairs].key), "%s", k); \
+        snprintf(pairs[num_pairs].value, sizeof(pairs[num_pairs].value), fmt, v); \
+        num_pairs++; \
+    } while (0)
+
+    RAW_ADD_KEY("InitiatorName", "%s", initiator_name);
+    RAW_ADD_KEY("TargetName", "%s", target_name);
+    RAW_ADD_KEY("SessionType", "%s", "Normal");
+    RAW_ADD_KEY("HeaderDigest", "%s", params && params->header_digest ? "CRC32C" : "None");
+    RAW_ADD_KEY("DataDigest", "%s", params && params->data_digest ? "CRC32C" : "None");
+    if (params && params->immediate_data >= 0) {
+        RAW_ADD_KEY("ImmediateData", "%s", params->immediate_data ? "Yes" : "No");
+    }
+    if (params && params->initial_r2t >= 0) {
+        RAW_ADD_KEY("InitialR2T", "%s", params->initial_r2t ? "Yes" : "No");
+    }
+    if (params && params->first_burst_length > 0) {
+        RAW_ADD_KEY("FirstBurstLength", "%u", params->first_burst_length);
+    }
+    if (params && params->max_burst_length > 0) {
+        RAW_ADD_KEY("MaxBurstLength", "%u", params->max_burst_length);
+    }
+    if (params && params->max_connections > 0) {
+        RAW_ADD_KEY("MaxConnections", "%u", params->max_connections);
+    }
+    if (params && params->max_recv_data_segment_length > 0) {
+        conn->max_recv_data_segment_length = params->max_recv_data_segment_length;
+    }
+    RAW_ADD_KEY("MaxRecvDataSegmentLength", "%u", conn->max_recv_data_segment_length);
+#undef RAW_ADD_KEY
+
+    data_size = build_kv_segment(segment, sizeof(segment), pairs, num_pairs);
+    if (data_size < 0) {
+        return -1;
+    }
+
+    /*
+     * Operational negotiation straight to full feature phase. Keys go in the
+     * first request; follow-up requests are empty until the target agrees
+     * to transit.
+     */
+    for (int round = 0; round < 8; round++) {
+        const uint8_t *data;
+        uint32_t data_len;
+
+        memset(bhs, 0, sizeof(bhs));
+        bhs[0] = ISCSI_OPCODE_LOGIN_REQUEST | ISCSI_OPCODE_IMMEDIATE;
+        bhs[1] = ISCSI_LOGIN_FLAG_TRANSIT | (ISCSI_NSG_OPERATIONAL << 2) | ISCSI_STAGE_FULL_FEATURE;
+        encode_24bit(bhs + 5, round == 0 ? (uint32_t)data_size : 0);
+        bhs[8] = 0x80;                          /* ISID: random qualifier format */
+        bhs[12] = 0x52;
+        bhs[13] = 0x41;
+        bhs[14] = (uint8_t)(conn->tsih >> 8);
+        bhs[15] = (uint8_t)conn->tsih;
+        encode_32bit(bhs + 16, conn->itt);
+        bhs[20] = (uint8_t)(conn->cid >> 8);
+        bhs[21] = (uint8_t)conn->cid;
+        encode_32bit(bhs + 24, conn->cmd_sn);
+        encode_32bit(bhs + 28, conn->exp_stat_sn);
+
+        if (iscsi_raw_send_pdu(conn, bhs, segment, round == 0 ? (uint32_t)data_size : 0) != 0 ||
+            iscsi_raw_recv_pdu(conn, bhs, &data, &data_len) != 0) {
+            return -1;
+        }
+        if ((bhs[0] & 0x3F) != ISCSI_OPCODE_LOGIN_RESPONSE || bhs[36] != 0) {
+            return -1;
+        }
+        raw_update_stat_sn(conn, bhs);
+        conn->tsih = (uint16_t)((bhs[14] << 8) | bhs[15]);
+
+        /* Response keys: "Key=Value\0" ... */
+        for (uint32_t off = 0; off < data_len;) {
+            const char *kv = (const char *)data + off;
+            size_t len = strnlen(kv, data_len - off);
+            char pair[512];
+            char *eq;
+
+            if (len > 0 && len < sizeof(pair)) {
+                memcpy(pair, kv, len);
+                pair[len] = '\0';
+                eq = strchr(pair, '=');
+                if (eq) {
+                    *eq = '\0';
+                    raw_apply_key(conn, pair, eq + 1);
+                }
+            }
+            off += (uint32_t)len + 1;
+        }
+
+        if ((bhs[1] & ISCSI_LOGIN_FLAG_TRANSIT) && (bhs[1] & ISCSI_LOGIN_FLAG_NSG_MASK) == ISCSI_STAGE_FULL_FEATURE) {
+            conn->itt++;
+            conn->full_feature = 1;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void iscsi_raw_join_session(iscsi_raw_conn_t *conn, iscsi_raw_conn_t *leading, uint16_t cid) {
+    if (!leading->session_cmd_sn) {
+        leading->next_session_cmd_sn = leading->cmd_sn;
+        leading->session_cmd_sn = &leading->next_session_cmd_sn;
+    }
+    conn->tsih = leading->tsih;
+    conn->cid = cid;
+    conn->session_cmd_sn = leading->session_cmd_sn;
+    /* Login is immediate: it carries the next CmdSN without using it */
+    conn->cmd_sn = __atomic_load_n(conn->session_cmd_sn, __ATOMIC_SEQ_CST);
+}
+
+void iscsi_raw_reset_counters(iscsi_raw_conn_t *conn) {
+    conn->pdus_sent = 0;
+    conn->pdus_received = 0;
+    conn->r2t_received = 0;
+    conn->data_in_received = 0;
+    conn->data_out_sent = 0;
+}
+
+/* Build a SCSI Command BHS for a 10-byte CDB */
+static void raw_build_command(iscsi_raw_conn_t *conn, uint8_t *bhs, int lun, uint8_t flags,
+                              uint32_t edtl, uint32_t imm_len, const uint8_t *cdb) {
+    if (conn->session_cmd_sn) {
+        /* Shared with the session's other connections; the caller's
+         * cmd_sn++ afterwards only touches this connection's copy */
+        conn->cmd_sn = __atomic_fetch_add(conn->session_cmd_sn, 1, __ATOMIC_SEQ_CST);
+    }
+
+    memset(bhs, 0, ISCSI_BHS_SIZE);
+    bhs[0] = ISCSI_OPCODE_SCSI_COMMAND;
+    bhs[1] = flags | ISCSI_CMD_ATTR_SIMPLE;
+    encode_24bit(bhs + 5, imm_len);
+    encode_lun(bhs + 8, lun);
+    encode_32bit(bhs + 16, conn->itt);
+    encode_32bit(bhs + 20, edtl);
+    encode_32bit(bhs + 24, conn->cmd_sn);
+    encode_32bit(bhs + 28, conn->exp_stat_sn);
+    memcpy(bhs + 32, cdb, 10);
+}
+
+static void raw_build_cdb10(uint8_t *cdb, uint8_t opcode, uint32_t lba, uint32_t num_blocks) {
+    memset(cdb, 0, 10);
+    cdb[0] = opcode;
+    encode_32bit(cdb + 2, lba);
+    cdb[7] = (uint8_t)(num_blocks >> 8);
+    cdb[8] = (uint8_t)num_blocks;
+}
+
+int iscsi_raw_send_data_out(iscsi_raw_conn_t *conn, int lun, uint32_t itt, uint32_t ttt,
+                            const uint8_t *buffer, uint32_t offset, uint32_t len) {
+    uint32_t seg_max = conn->max_xmit_data_segment_length ? conn->max_xmit_data_segment_length : 8192;
+    uint32_t data_sn = 0;
+    uint8_t bhs[ISCSI_BHS_SIZE];
+
+    while (len > 0) {
+        uint32_t seg = len < seg_max ? len : seg_max;
+
+        memset(bhs, 0, sizeof(bhs));
+        bhs[0] = ISCSI_OPCODE_DATA_OUT;
+        bhs[1] = seg == len ? ISCSI_FLAG_FINAL : 0;
+        encode_24bit(bhs + 5, seg);
+        encode_lun(bhs + 8, lun);
+        encode_32bit(bhs + 16, itt);
+        encode_32bit(bhs + 20, ttt);
+        encode_32bit(bhs + 28, conn->exp_stat_sn);
+        encode_32bit(bhs + 36, data_sn++);
+        encode_32bit(bhs + 40, offset);
+
+        if (iscsi_raw_send_pdu(conn, bhs, buffer + offset, seg) != 0) {
+            return -1;
+        }
+        conn->data_out_sent++;
+        offset += seg;
+        len -= seg;
+    }
+    return 0;
+}
+
+int iscsi_raw_read10(iscsi_raw_conn_t *conn, int lun, uint32_t lba, uint32_t num_blocks,
+                     uint32_t block_size, uint8_t *buffer) {
+    uint32_t len = num_blocks * block_size;
+    uint32_t itt = conn->itt++;
+    uint8_t cdb[10];
+    uint8_t bhs[ISCSI_BHS_SIZE];
+
+    conn->last_reject_reason = 0;
+
+    raw_build_cdb10(cdb, 0x28, lba, num_blocks);
+    raw_build_command(conn, bhs, lun, ISCSI_FLAG_FINAL | ISCSI_CMD_FLAG_READ, len, 0, cdb);
+    encode_32bit(bhs + 16, itt);
+    if (iscsi_raw_send_pdu(conn, bhs, NULL, 0) != 0) {
+        return -1;
+    }
+    conn->cmd_sn++;
+
+    for (;;) {
+        const uint8_t *data;
+        uint32_t data_len;
+        uint8_t opcode;
+
+        if (iscsi_raw_recv_pdu(conn, bhs, &data, &data_len) != 0) {
+            return -1;
+        }
+        opcode = bhs[0] & 0x3F;
+
+        if (opcode == ISCSI_OPCODE_NOP_IN) {
+            raw_update_stat_sn(conn, bhs);
+            if (raw_handle_nop_in(conn, bhs) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (opcode == ISCSI_OPCODE_REJECT) {
+            conn->last_reject_reason = bhs[2];
+            return -1;
+        }
+        if (decode_32bit(bhs + 16) != itt) {
+            return -1;
+        }
+
+        if (opcode == ISCSI_OPCODE_DATA_IN) {
+            uint32_t offset = decode_32bit(bhs + 40);
+
+            conn->data_in_received++;
+            if ((uint64_t)offset + data_len > len) {
+                return -1;
+            }
+            memcpy(buffer + offset, data, data_len);
+            if (bhs[1] & ISCSI_DATAIN_FLAG_STATUS) {
+                raw_update_stat_sn(conn, bhs);
+                conn->last_scsi_status = bhs[3];
+                return (bhs[3] == 0 && !(bhs[1] & ISCSI_DATAIN_FLAG_UNDERFLOW)) ? 0 : -1;
+            }
+        } else if (opcode == ISCSI_OPCODE_SCSI_RESPONSE) {
+            raw_update_stat_sn(conn, bhs);
+            conn->last_scsi_status = bhs[3];
+            return (bhs[2] == 0 && bhs[3] == 0) ? 0 : -1;
+        } else {
+            return -1;
+        }
+    }
+}
+
+int iscsi_raw_write10(iscsi_raw_conn_t *conn, int lun, uint32_t lba, uint32_t num_blocks,
+                      uint32_t block_size, const uint8_t *buffer) {
+    uint32_t len = num_blocks * block_size;
+    uint32_t itt = conn->itt++;
+    uint32_t imm = 0, unsolicited = 0;
+    uint8_t cdb[10];
+    uint8_t bhs[ISCSI_BHS_SIZE];
+
+    conn->last_reject_reason = 0;
+
+    /* Immediate data, then unsolicited Data-Out, together at most FirstBurstLength */
+    if (conn->immediate_data) {
+        imm = len;
+        if (imm > conn->first_burst_length) imm = conn->first_burst_length;
+        if (imm > conn->max_xmit_data_segment_length) imm = conn->max_xmit_data_segment_length;
+    }
+    if (!conn->initial_r2t) {
+        uint32_t burst = len < conn->first_burst_length ? len : conn->first_burst_length;
+        unsolicited = burst > imm ? burst - imm : 0;
+    }
+
+    raw_build_cdb10(cdb, 0x2a, lba, num_blocks);
+    raw_build_command(conn, bhs, lun,
+                      (unsolicited ? 0 : ISCSI_FLAG_FINAL) | ISCSI_CMD_FLAG_WRITE,
+                      len, imm, cdb);
+    encode_32bit(bhs + 16, itt);
+    if (iscsi_raw_send_pdu(conn, bhs, buffer, imm) != 0) {
+        return -1;
+    }
+    conn->cmd_sn++;
+
+    if (unsolicited &&
+        iscsi_raw_send_data_out(conn, lun, itt, ISCSI_RESERVED_TAG, buffer, imm, unsolicited) != 0) {
+        return -1;
+    }
+
+    for (;;) {
+        const uint8_t *data;
+        uint32_t data_len;
+        uint8_t opcode;
+
+        if (iscsi_raw_recv_pdu(conn, bhs, &data, &data_len) != 0) {
+            return -1;
+        }
+        opcode = bhs[0] & 0x3F;
+
+        if (opcode == ISCSI_OPCODE_NOP_IN) {
+            raw_update_stat_sn(conn, bhs);
+            if (raw_handle_nop_in(conn, bhs) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (opcode == ISCSI_OPCODE_REJECT) {
+            conn->last_reject_reason = bhs[2];
+            return -1;
+        }
+        if (decode_32bit(bhs + 16) != itt) {
+            return -1;
+        }
+
+        if (opcode == ISCSI_OPCODE_R2T) {
+            uint32_t offset = decode_32bit(bhs + 40);
+            uint32_t desired = decode_32bit(bhs + 44);
+
+            conn->r2t_received++;
+            if ((uint64_t)offset + desired > len ||
+                iscsi_raw_send_data_out(conn, lun, itt, decode_32bit(bhs + 20),
+                                        buffer, offset, desired) != 0) {
+                return -1;
+            }
+        } else if (opcode == ISCSI_OPCODE_SCSI_RESPONSE) {
+            raw_update_stat_sn(conn, bhs);
+            conn->last_scsi_status = bhs[3];
+            return (bhs[2] == 0 && bhs[3] == 0) ? 0 : -1;
+        } else {
+            return -1;
+        }
+    }
+}
+
+uint32_t iscsi_raw_build_nop_out(iscsi_raw_conn_t *conn, uint8_t *bhs) {
+    uint32_t itt = conn->itt++;
+
+    memset(bhs, 0, ISCSI_BHS_SIZE);
+    bhs[0] = ISCSI_OPCODE_NOP_OUT | ISCSI_OPCODE_IMMEDIATE;
+    bhs[1] = ISCSI_FLAG_FINAL;
+    encode_32bit(bhs + 16, itt);
+    encode_32bit(bhs + 20, ISCSI_RESERVED_TAG);
+    encode_32bit(bhs + 24, conn->cmd_sn);
+    encode_32bit(bhs + 28, conn->exp_stat_sn);
+    return itt;
+}
+
+int iscsi_raw_nop_ping(iscsi_raw_conn_t *conn) {
+    uint8_t bhs[ISCSI_BHS_SIZE];
+    uint32_t itt = iscsi_raw_build_nop_out(conn, bhs);
+
+    conn->last_reject_reason = 0;
+    if (iscsi_raw_send_pdu(conn, bhs, NULL, 0) != 0) {
+        return -1;
+    }
+
+    for (;;) {
+        const uint8_t *data;
+        uint32_t data_len;
+        uint8_t opcode;
+
+        if (iscsi_raw_recv_pdu(conn, bhs, &data, &data_len) != 0) {
+            return -1;
+        }
+        opcode = bhs[0] & 0x3F;
+        if (opcode == ISCSI_OPCODE_REJECT) {
+            /* The rejected PDU's header is the data segment */
+            conn->last_reject_reason = bhs[2];
+            if (data_len >= ISCSI_BHS_SIZE && decode_32bit(data + 16) == itt) {
+                return -1;
+            }
+            continue;
+        }
+        if (opcode != ISCSI_OPCODE_NOP_IN) {
+            continue;   /* Left over from an earlier PDU */
+        }
+        raw_update_stat_sn(conn, bhs);
+        if (decode_32bit(bhs + 16) == itt) {
+            return 0;
+        }
+        if (raw_handle_nop_in(conn, bhs) != 0) {
+            return -1;
+        }
+    }
+}
+
+uint32_t iscsi_raw_build_read10(iscsi_raw_conn_t *conn, uint8_t *bhs, int lun, uint32_t lba,
+                                uint32_t num_blocks, uint32_t block_size) {
+    uint32_t itt = conn->itt++;
+    uint8_t cdb[10];
+
+    raw_build_cdb10(cdb, 0x28, lba, num_blocks);
+    raw_build_command(conn, bhs, lun, ISCSI_FLAG_FINAL | ISCSI_CMD_FLAG_READ,
+                      num_blocks * block_size, 0, cdb);
+    encode_32bit(bhs + 16, itt);
+    conn->cmd_sn++;
+    return itt;
+}
+
+uint32_t iscsi_raw_build_write10(iscsi_raw_conn_t *conn, uint8_t *bhs, int lun, uint32_t lba,
+                                 uint32_t num_blocks, uint32_t block_size) {
+    uint32_t itt = conn->itt++;
+    uint8_t cdb[10];
+
+    raw_build_cdb10(cdb, 0x2a, lba, num_blocks);
+    raw_build_command(conn, bhs, lun, ISCSI_FLAG_FINAL | ISCSI_CMD_FLAG_WRITE,
+                      num_blocks * block_size, 0, cdb);
+    encode_32bit(bhs + 16, itt);
+    conn->cmd_sn++;
+    return itt;
+}
+
+uint32_t iscsi_raw_window_available(const iscsi_raw_conn_t *conn) {
+    /* Serial arithmetic: MaxCmdSN = CmdSN - 1 means a full window */
+    int32_t diff = (int32_t)(conn->max_cmd_sn - conn->cmd_sn);
+
+    return diff < 0 ? 0 : (uint32_t)diff + 1;
+}
+
+int iscsi_raw_recv_status(iscsi_raw_conn_t *conn, uint32_t *itt, uint32_t *stat_sn) {
+    uint8_t bhs[ISCSI_BHS_SIZE];
+
+    conn->last_reject_reason = 0;
+    for (;;) {
+        const uint8_t *data;
+        uint32_t data_len;
+        uint8_t opcode;
+
+        if (iscsi_raw_recv_pdu(conn, bhs, &data, &data_len) != 0) {
+            return -1;
+        }
+        opcode = bhs[0] & 0x3F;
+
+        if (opcode == ISCSI_OPCODE_NOP_IN) {
+            raw_update_stat_sn(conn, bhs);
+            if (raw_handle_nop_in(conn, bhs) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (opcode == ISCSI_OPCODE_REJECT) {
+            conn->last_reject_reason = bhs[2];
+            return -1;
+        }
+        if (opcode == ISCSI_OPCODE_DATA_IN) {
+            conn->data_in_received++;
+            if (!(bhs[1] & ISCSI_DATAIN_FLAG_STATUS)) {
+                continue;
+            }
+        } else if (opcode != ISCSI_OPCODE_SCSI_RESPONSE) {
+            return -1;
+        }
+
+        raw_update_stat_sn(conn, bhs);
+        conn->last_scsi_status = bhs[3];
+        *itt = decode_32bit(bhs + 16);
+        *stat_sn = decode_32bit(bhs + 24);
+        return 0;
+    }
+}
+
+int iscsi_raw_recv_r2t(iscsi_raw_conn_t *conn, uint32_t *itt, uint32_t *ttt,
+                       uint32_t *offset, uint32_t *length) {
+    uint8_t bhs[ISCSI_BHS_SIZE];
+
+    conn->last_reject_reason = 0;
+    for (;;) {
+        const uint8_t *data;
+        uint32_t data_len;
+        uint8_t opcode;
+
+        if (iscsi_raw_recv_pdu(conn, bhs, &data, &data_len) != 0) {
+            return -1;
+        }
+        opcode = bhs[0] & 0x3F;
+
+        if (opcode == ISCSI_OPCODE_NOP_IN) {
+            raw_update_stat_sn(conn, bhs);
+            if (raw_handle_nop_in(conn, bhs) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (opcode == ISCSI_OPCODE_REJECT) {
+            conn->last_reject_reason = bhs[2];
+            return -1;
+        }
+        if (opcode != ISCSI_OPCODE_R2T) {
+            return -1;
+        }
+
+        conn->r2t_received++;
+        *itt = decode_32bit(bhs + 16);
+        *ttt = decode_32bit(bhs + 20);
+        *offset = decode_32bit(bhs + 40);
+        *length = decode_32bit(bhs + 44);
+        return 0;
+    }
+}
+
+int iscsi_raw_task_mgmt(iscsi_raw_conn_t *conn, int function, int lun,
+                        uint32_t ref_itt, uint32_t ref_cmd_sn) {
+    uint8_t bhs[ISCSI_BHS_SIZE];
+    uint32_t itt = conn->itt++;
+
+    conn->last_reject_reason = 0;
+
+    /* Immediate, so it carries the next CmdSN without taking it */
+    memset(bhs, 0, sizeof(bhs));
+    bhs[0] = ISCSI_OPCODE_TASK_MGMT_REQUEST | ISCSI_OPCODE_IMMEDIATE;
+    bhs[1] = ISCSI_FLAG_FINAL | (uint8_t)function;
+    encode_lun(bhs + 8, lun);
+    encode_32bit(bhs + 16, itt);
+    encode_32bit(bhs + 20, function == ISCSI_TMF_ABORT_TASK ? ref_itt : ISCSI_RESERVED_TAG);
+    encode_32bit(bhs + 24, conn->session_cmd_sn ?
+                 __atomic_load_n(conn->session_cmd_sn, __ATOMIC_SEQ_CST) : conn->cmd_sn);
+    encode_32bit(bhs + 28, conn->exp_stat_sn);
+    encode_32bit(bhs + 32, ref_cmd_sn);
+    if (iscsi_raw_send_pdu(conn, bhs, NULL, 0) != 0) {
+        return -1;
+    }
+
+    for (;;) {
+        const uint8_t *data;
+        uint32_t data_len;
+        uint8_t opcode;
+
+        if (iscsi_raw_recv_pdu(conn, bhs, &data, &data_len) != 0) {
+            return -1;
+        }
+        opcode = bhs[0] & 0x3F;
+
+        if (opcode == ISCSI_OPCODE_NOP_IN) {
+            raw_update_stat_sn(conn, bhs);
+            if (raw_handle_nop_in(conn, bhs) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (opcode == ISCSI_OPCODE_REJECT) {
+            conn->last_reject_reason = bhs[2];
+            return -1;
+        }
+        if (opcode == ISCSI_OPCODE_R2T) {
+            /* Sent for a task being aborted before the request arrived */
+            conn->r2t_received++;
+            continue;
+        }
+        if (opcode != ISCSI_OPCODE_TASK_MGMT_RESPONSE || decode_32bit(bhs + 16) != itt) {
+            return -1;
+        }
+
+        raw_update_stat_sn(conn, bhs);
+        return bhs[2];
+    }
+}
+
+void iscsi_raw_close(iscsi_raw_conn_t *conn) {
+    if (conn->sock >= 0) {
+        uint8_t bhs[ISCSI_BHS_SIZE];
+        const uint8_t *data;
+        uint32_t data_len;
+
+        /* Logout closes the session; a connection still in login is just dropped */
+        memset(bhs, 0, sizeof(bhs));
+        bhs[0] = ISCSI_OPCODE_LOGOUT_REQUEST | ISCSI_OPCODE_IMMEDIATE;
+        bhs[1] = ISCSI_FLAG_FINAL;
+        encode_32bit(bhs + 16, conn->itt++);
+        encode_32bit(bhs + 24, conn->cmd_sn);
+        encode_32bit(bhs + 28, conn->exp_stat_sn);
+        if (conn->full_feature && iscsi_raw_send_pdu(conn, bhs, NULL, 0) == 0) {
+            iscsi_raw_recv_pdu(conn, bhs, &data, &data_len);
+        }
+
+        close(conn->sock);
+        conn->sock = -1;
+    }
+    free(conn->rx_buf);
+    conn->rx_buf = NULL;
+    conn->rx_cap = 0;
+}
@@ -36,19 +36,256 @@ uint8_t* build_login_pdu_invalid_maxrecvdatasize(size_t *pdu_size);
 uint8_t* build_login_pdu_invalid_maxconnections(size_t *pdu_size);
 uint8_t* build_login_pdu_invalid_param_combo(size_t *pdu_size);
 
-/**
- * Send PDU to target and receive response
- * Returns allocated buffer with response PDU, caller must free()
- * Returns NULL on error
- */
-uint8_t* send_pdu_and_recv_response(const char *host, int port,
-                                     const uint8_t *pdu, size_t pdu_size,
-                                     size_t *response_size);
-
 /**
  * Parse login response status
  * Returns 0 if login was rejected, 1 if accepted, -1 on parse error
  */
 int parse_login_response_status(const uint8_t *response, size_t response_size);
 
+/*
+ * Raw full-feature session
+ *
+ * A minimal initiator that logs in over its own socket and runs SCSI
+ * commands PDU by PDU, bypassing libiscsi. It negotiates exactly the keys
+ * it is given and counts every PDU it sends and receives, so protocol
+ * behaviour that libiscsi hides (R2T sequences, Data-In splitting, the
+ * effect of burst settings) can be measured directly.
+ *
+ * The socket stays open for the whole session and every PDU is framed
+ * from its BHS (AHS and DataSegmentLength), so responses of any size come
+ * back whole and several PDUs can be pipelined in one writev.
+ *
+ * Only AuthMethod=None is supported. A session may span several
+ * connections (see iscsi_raw_join_session). The READ/WRITE
+ * helpers keep one command outstanding; the pipelined command helpers
+ * below keep as many as the CmdSN window allows. CRC32C header and data digests
+ * are generated and checked once the session reaches full feature phase.
+ */
+
+/* Login keys to offer; 0 (or -1 for booleans) leaves a key at its default */
+typedef struct {
+    int immediate_data;                 /* 1 = Yes, 0 = No, -1 = don't offer */
+    int initial_r2t;                    /* 1 = Yes, 0 = No, -1 = don't offer */
+    uint32_t first_burst_length;
+    uint32_t max_burst_length;
+    uint32_t max_recv_data_segment_length;
+    int header_digest;                  /* 1 = offer CRC32C, 0 = None */
+    int data_digest;                    /* 1 = offer CRC32C, 0 = None */
+    uint32_t max_connections;           /* MaxConnections to offer, 0 = don't */
+} iscsi_raw_params_t;
+
+typedef struct {
+    int sock;
+    uint32_t itt;
+    uint32_t cmd_sn;
+    uint32_t exp_stat_sn;
+    uint32_t exp_cmd_sn;                /* Command window from the last target PDU */
+    uint32_t max_cmd_sn;
+    uint16_t tsih;
+    uint16_t cid;
+
+    /* Multiple connections per session: every connection takes CmdSNs
+     * from the same counter, which the leading connection owns */
+    uint32_t *session_cmd_sn;           /* NULL = this connection's cmd_sn */
+    uint32_t next_session_cmd_sn;
+
+    /* Operational values in effect (RFC 3720 defaults until login completes) */
+    int immediate_data;
+    int initial_r2t;
+    uint32_t first_burst_length;
+    uint32_t max_burst_length;
+    uint32_t max_xmit_data_segment_length;  /* Target's MaxRecvDataSegmentLength */
+    uint32_t max_recv_data_segment_length;  /* Ours */
+    int header_digest;                  /* 1 = CRC32C negotiated */
+    int data_digest;
+    int full_feature;                   /* Digests apply from here on */
+    uint32_t max_connections;           /* Negotiated MaxConnections */
+
+    /* PDU counters */
+    uint64_t pdus_sent;
+    uint64_t pdus_received;
+    uint64_t r2t_received;
+    uint64_t data_in_received;
+    uint64_t data_out_sent;
+    uint64_t digest_errors;             /* Received PDUs that failed a digest */
+
+    /* Fault injection: corrupt the digest of the next PDU sent */
+    int corrupt_next_header_digest;
+    int corrupt_next_data_digest;
+
+    uint8_t last_scsi_status;           /* Status of the last SCSI command */
+    uint8_t last_reject_reason;         /* Reason of the last Reject received, 0 if none */
+
+    uint8_t *rx_buf;                    /* Data segment of the last received PDU */
+    size_t rx_cap;
+} iscsi_raw_conn_t;
+
+/**
+ * Connect to "host[:port]" (default port 3260)
+ * Returns 0 on success, -1 on error
+ */
+int iscsi_raw_connect(iscsi_raw_conn_t *conn, const char *portal);
+
+/**
+ * Log in to a Normal session, going straight to operational negotiation
+ * Returns 0 once in full feature phase, -1 on error or rejection
+ */
+int iscsi_raw_login(iscsi_raw_conn_t *conn, const char *initiator_name,
+                    const char *target_name, const iscsi_raw_params_t *params);
+
+/**
+ * Make conn, freshly connected, a further connection of leading's
+ * session: it logs in with leading's TSIH and the given CID, and from then
+ * on both take CmdSNs from one session-wide counter. Call before
+ * iscsi_raw_login(). The connections may then be driven from different
+ * threads with the one-outstanding READ/WRITE helpers; leading must stay
+ * open while any of them is in use.
+ */
+void iscsi_raw_join_session(iscsi_raw_conn_t *conn, iscsi_raw_conn_t *leading, uint16_t cid);
+
+/* Fail socket reads and writes that block for longer than seconds (0 = never) */
+void iscsi_raw_set_timeout(iscsi_raw_conn_t *conn, int seconds);
+
+/**
+ * Send one PDU: a 48-byte BHS plus an optional data segment (padded here)
+ * Returns 0 on success, -1 on error
+ */
+int iscsi_raw_send_pdu(iscsi_raw_conn_t *conn, const uint8_t *bhs,
+                       const uint8_t *data, uint32_t data_len);
+
+/* One PDU of a pipelined batch; data may be NULL when data_len is 0 */
+typedef struct {
+    const uint8_t *bhs;
+    const uint8_t *data;
+    uint32_t data_len;
+} iscsi_raw_pdu_t;
+
+/**
+ * Send count PDUs back to back, coalescing them into as few writev calls
+ * as IOV_MAX allows. Nothing is read in between, so responses queue up
+ * until the caller receives them.
+ * Returns 0 on success, -1 on error
+ */
+int iscsi_raw_send_pdus(iscsi_raw_conn_t *conn, const iscsi_raw_pdu_t *pdus, int count);
+
+/**
+ * Write bytes to the socket as they are, with no framing, padding or
+ * digests: for prebuilt login PDUs and deliberately malformed input
+ * Returns 0 on success, -1 on error
+ */
+int iscsi_raw_send_bytes(iscsi_raw_conn_t *conn, const uint8_t *buf, size_t len);
+
+/**
+ * Receive one PDU. The BHS is copied to bhs; *data points into the
+ * connection's receive buffer and stays valid until the next receive.
+ * Returns 0 on success, -1 on error (including a digest mismatch)
+ */
+int iscsi_raw_recv_pdu(iscsi_raw_conn_t *conn, uint8_t *bhs,
+                       const uint8_t **data, uint32_t *data_len);
+
+/**
+ * READ(10)/WRITE(10) through the raw session
+ * Returns 0 on GOOD status, -1 otherwise (SCSI status in last_scsi_status)
+ */
+int iscsi_raw_read10(iscsi_raw_conn_t *conn, int lun, uint32_t lba, uint32_t num_blocks,
+                     uint32_t block_size, uint8_t *buffer);
+int iscsi_raw_write10(iscsi_raw_conn_t *conn, int lun, uint32_t lba, uint32_t num_blocks,
+                      uint32_t block_size, const uint8_t *buffer);
+
+/**
+ * Build an immediate NOP-Out ping BHS (no data) with the next free ITT
+ * Returns the ITT the matching NOP-In will carry
+ */
+uint32_t iscsi_raw_build_nop_out(iscsi_raw_conn_t *conn, uint8_t *bhs);
+
+/**
+ * Immediate NOP-Out ping; waits for the matching NOP-In. PDUs left over
+ * from earlier traffic are skipped and a Reject of one of them only sets
+ * last_reject_reason, so a ping also resynchronises after bad input.
+ * Returns 0 on success, -1 on error or if the ping itself is rejected
+ */
+int iscsi_raw_nop_ping(iscsi_raw_conn_t *conn);
+
+/*
+ * Pipelined commands
+ *
+ * For keeping several commands in flight: build CmdSN-ordered commands,
+ * send them with iscsi_raw_send_pdus() while the window allows, and
+ * collect each one's status with iscsi_raw_recv_status().
+ */
+
+/**
+ * Build a READ(10) SCSI Command BHS with the next ITT and CmdSN
+ * Returns the ITT its status will carry
+ */
+uint32_t iscsi_raw_build_read10(iscsi_raw_conn_t *conn, uint8_t *bhs, int lun, uint32_t lba,
+                                uint32_t num_blocks, uint32_t block_size);
+
+/**
+ * Build a WRITE(10) SCSI Command BHS with the next ITT and CmdSN. It
+ * carries no immediate data and has the F bit set, so the target asks for
+ * all of it with R2Ts (see iscsi_raw_recv_r2t()).
+ * Returns the ITT its R2Ts and status will carry
+ */
+uint32_t iscsi_raw_build_write10(iscsi_raw_conn_t *conn, uint8_t *bhs, int lun, uint32_t lba,
+                                 uint32_t num_blocks, uint32_t block_size);
+
+/**
+ * Send [offset, offset + len) of buffer as Data-Out PDUs of at most
+ * MaxXmitDataSegmentLength, answering the R2T with target transfer tag ttt
+ * (ISCSI_RESERVED_TAG for unsolicited data)
+ * Returns 0 on success, -1 on error
+ */
+int iscsi_raw_send_data_out(iscsi_raw_conn_t *conn, int lun, uint32_t itt, uint32_t ttt,
+                            const uint8_t *buffer, uint32_t offset, uint32_t len);
+
+/* CmdSNs the target will still accept before MaxCmdSN, 0 when the window is full */
+uint32_t iscsi_raw_window_available(const iscsi_raw_conn_t *conn);
+
+/**
+ * Receive PDUs until one carries SCSI status (a SCSI Response, or Data-In
+ * with the S bit). Data-In payloads are discarded; NOP-In pings are
+ * answered. The status goes in last_scsi_status.
+ * Returns 0 with the command's ITT and StatSN, -1 on error or Reject
+ */
+int iscsi_raw_recv_status(iscsi_raw_conn_t *conn, uint32_t *itt, uint32_t *stat_sn);
+
+/**
+ * Receive PDUs until an R2T, answering NOP-In pings
+ * Returns 0 with the R2T's ITT, target transfer tag, buffer offset and
+ * desired length, -1 on error, Reject or any other PDU
+ */
+int iscsi_raw_recv_r2t(iscsi_raw_conn_t *conn, uint32_t *itt, uint32_t *ttt,
+                       uint32_t *offset, uint32_t *length);
+
+/*
+ * Task management
+ */
+
+#define ISCSI_TMF_ABORT_TASK 1
+#define ISCSI_TMF_ABORT_TASK_SET 2
+#define ISCSI_TMF_LUN_RESET 5
+
+#define ISCSI_TMF_FUNCTION_COMPLETE 0
+#define ISCSI_TMF_TASK_DOES_NOT_EXIST 1
+
+/**
+ * Send an immediate Task Management Function Request and wait for its
+ * response. ref_itt and ref_cmd_sn name the task for ABORT TASK and are
+ * ignored otherwise. R2Ts still arriving for the tasks being aborted are
+ * skipped and NOP-In pings answered; anything else, such as the status of
+ * a task the target should have aborted, is an error. Call it with no
+ * commands outstanding but the ones it aborts.
+ * Returns the TMF response code (ISCSI_TMF_FUNCTION_COMPLETE, ...), -1 on
+ * error or Reject
+ */
+int iscsi_raw_task_mgmt(iscsi_raw_conn_t *conn, int function, int lun,
+                        uint32_t ref_itt, uint32_t ref_cmd_sn);
+
+/* Zero the PDU counters */
+void iscsi_raw_reset_counters(iscsi_raw_conn_t *conn);
+
+/* Log out (best effort, full feature phase only) and close the socket */
+void iscsi_raw_close(iscsi_raw_conn_t *conn);
+
 #endif /* ISCSI_PDU_HELPER_H */
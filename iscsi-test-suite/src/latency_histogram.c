@@ -0,0 +1,114 @@
+#include "latency_histogram.h"
+#include <string.h>
+#include <time.h>
+
+#define LATENCY_MAX_VALUE ((1ULL << LATENCY_MAX_VALUE_BITS) - 1)
+
+/*
+ * Bucket layout: group 0 holds values 0..31 exactly. Group g >= 1 holds
+ * [32 << (g-1), 32 << g) in 32 sub-buckets of width 1 << (g-1).
+ */
+static inline int bucket_index(uint64_t value) {
+    int msb, group;
+
+    if (value < LATENCY_SUB_BUCKETS) {
+        return (int)value;
+    }
+    msb = 63 - __builtin_clzll(value);
+    group = msb - LATENCY_SUB_BUCKET_BITS + 1;
+    return group * LATENCY_SUB_BUCKETS +
+           (int)((value >> (group - 1)) - LATENCY_SUB_BUCKETS);
+}
+
+/* Largest value that maps to the given bucket */
+static uint64_t bucket_highest_value(int index) {
+    int group = index / LATENCY_SUB_BUCKETS;
+    uint64_t sub = (uint64_t)(index % LATENCY_SUB_BUCKETS);
+
+    if (group == 0) {
+        return sub;
+    }
+    return ((LATENCY_SUB_BUCKETS + sub) << (group - 1)) + (1ULL << (group - 1)) - 1;
+}
+
+uint64_t latency_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void latency_hist_reset(latency_hist_t *hist) {
+    memset(hist, 0, sizeof(*hist));
+}
+
+void latency_hist_record(latency_hist_t *hist, uint64_t start_ns, uint64_t end_ns) {
+    uint64_t value = end_ns > start_ns ? end_ns - start_ns : 0;
+
+    if (hist->total == 0 || value < hist->min_ns) hist->min_ns = value;
+    if (value > hist->max_ns) hist->max_ns = value;
+    if (hist->total == 0 || start_ns < hist->first_start_ns) hist->first_start_ns = start_ns;
+    if (end_ns > hist->last_end_ns) hist->last_end_ns = end_ns;
+
+    if (value > LATENCY_MAX_VALUE) {
+        value = LATENCY_MAX_VALUE;
+    }
+    hist->counts[bucket_index(value)]++;
+    hist->total++;
+    hist->sum_ns += value;
+}
+
+void latency_hist_merge(latency_hist_t *dst, const latency_hist_t *src) {
+    if (src->total == 0) {
+        return;
+    }
+
+    if (dst->total == 0 || src->min_ns < dst->min_ns) dst->min_ns = src->min_ns;
+    if (src->max_ns > dst->max_ns) dst->max_ns = src->max_ns;
+    if (dst->total == 0 || src->first_start_ns < dst->first_start_ns) {
+        dst->first_start_ns = src->first_start_ns;
+    }
+    if (src->last_end_ns > dst->last_end_ns) dst->last_end_ns = src->last_end_ns;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum_ns += src->sum_ns;
+}
+
+uint64_t latency_hist_percentile(const latency_hist_t *hist, double p) {
+    uint64_t rank, seen = 0;
+
+    if (hist->total == 0) {
+        return 0;
+    }
+    if (p <= 0.0) return hist->min_ns;
+    if (p >= 1.0) return hist->max_ns;
+
+    /* Nearest rank: the smallest value with at least p of samples at or below it */
+    rank = (uint64_t)(p * hist->total);
+    if ((double)rank < p * hist->total) rank++;
+    if (rank < 1) rank = 1;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_highest_value(i);
+            if (value < hist->min_ns) value = hist->min_ns;
+            if (value > hist->max_ns) value = hist->max_ns;
+            return value;
+        }
+    }
+
+    return hist->max_ns;
+}
+
+double latency_hist_ops_per_sec(const latency_hist_t *hist) {
+    uint64_t span;
+
+    if (hist->total == 0 || hist->last_end_ns <= hist->first_start_ns) {
+        return 0.0;
+    }
+    span = hist->last_end_ns - hist->first_start_ns;
+    return hist->total / (span / 1000000000.0);
+}
@@ -0,0 +1,48 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * HDR-style log-bucketed latency histogram.
+ *
+ * Values are nanoseconds. Each power-of-two range is split into
+ * LATENCY_SUB_BUCKETS linear sub-buckets, so any recorded value is kept
+ * to within 1/32 (~3%) of its true value. Memory is fixed and recording
+ * is O(1) with no allocation, so it is safe to call from I/O hot loops
+ * and completion callbacks.
+ */
+
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_VALUE_BITS 40       /* ~18 minutes in ns; larger values clamp */
+#define LATENCY_BUCKETS ((LATENCY_MAX_VALUE_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t sum_ns;
+    uint64_t first_start_ns;            /* Earliest operation start */
+    uint64_t last_end_ns;               /* Latest operation end */
+} latency_hist_t;
+
+/* Monotonic clock in nanoseconds */
+uint64_t latency_now_ns(void);
+
+void latency_hist_reset(latency_hist_t *hist);
+
+/* Record one operation that ran from start_ns to end_ns */
+void latency_hist_record(latency_hist_t *hist, uint64_t start_ns, uint64_t end_ns);
+
+/* Add all samples from src into dst */
+void latency_hist_merge(latency_hist_t *dst, const latency_hist_t *src);
+
+/* Value at percentile p (0.0..1.0), in nanoseconds */
+uint64_t latency_hist_percentile(const latency_hist_t *hist, double p);
+
+/* Completed operations per second over the span the operations covered */
+double latency_hist_ops_per_sec(const latency_hist_t *hist);
+
+#endif /* LATENCY_HISTOGRAM_H */
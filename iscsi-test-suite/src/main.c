@@ -1,7 +1,4 @@
 #include "test_framework.h"
-#include "test_discovery.h"
-#include "test_commands.h"
-#include "test_io.h"
 #include "utils.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,24 +7,38 @@
 
 static void print_usage(const char *progname) {
     printf("Usage: %s [options] <config_file>\n", progname);
+    printf("       %s --list [-c CAT] [-t PATTERNS]\n", progname);
     printf("\nOptions:\n");
     printf("  -v, --verbose      Verbose output\n");
     printf("  -q, --quiet        Quiet mode (only show failures)\n");
     printf("  -f, --fail-fast    Stop on first failure\n");
     printf("  -c, --category CAT Run specific test category\n");
+    printf("  -t, --filter PATS  Run tests whose IDs match comma-separated globs (TC-011,TP-01*);\n");
+    printf("                     without -c this searches every category\n");
+    printf("  -l, --list         List the selected tests and exit; no config file needed\n");
+    printf("  -j, --jobs N       Run parallel-safe tests on N concurrent workers\n");
+    printf("  -p, --pool N       Share N logged-in sessions across I/O and command tests\n");
+    printf("  -F, --format FMTS  Report formats: text,json,csv or all (default text)\n");
+    printf("  -B, --compare FILE Compare against a baseline JSON report\n");
+    printf("  -T, --tolerance P  Regression tolerance in percent (default 10)\n");
+    printf("  -R, --replay FILE  Replay a PDU trace captured on the target (category replay)\n");
     printf("  -h, --help         Show this help message\n");
     printf("\nAvailable categories:\n");
-    printf("  discovery          Discovery and login tests\n");
-    printf("  commands           SCSI command tests\n");
-    printf("  io                 I/O operation tests\n");
-    printf("  all                All tests (default)\n");
+    for (size_t i = 0; i < test_group_count; i++) {
+        printf("  %-18s %s%s\n", test_groups[i]->name, test_groups[i]->description,
+               test_groups[i]->in_all ? "" : " (not part of 'all')");
+    }
+    printf("  %-18s %s\n", "all", "All tests (default)");
 }
 
 int main(int argc, char *argv[]) {
     test_config_t config;
     int ret;
     const char *config_file = NULL;
-    const char *category = "all";
+    const char *category = NULL;
+    const char *filter = NULL;
+    bool list = false;
+    int selected;
     int opt;
 
     static struct option long_options[] = {
@@ -35,12 +46,20 @@ int main(int argc, char *argv[]) {
         {"quiet",     no_argument,       0, 'q'},
         {"fail-fast", no_argument,       0, 'f'},
         {"category",  required_argument, 0, 'c'},
+        {"filter",    required_argument, 0, 't'},
+        {"list",      no_argument,       0, 'l'},
+        {"jobs",      required_argument, 0, 'j'},
+        {"pool",      required_argument, 0, 'p'},
+        {"format",    required_argument, 0, 'F'},
+        {"compare",   required_argument, 0, 'B'},
+        {"tolerance", required_argument, 0, 'T'},
+        {"replay",    required_argument, 0, 'R'},
         {"help",      no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     /* Parse command line options */
-    while ((opt = getopt_long(argc, argv, "vqfc:h", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "vqfc:t:lj:p:F:B:T:R:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 'v':
                 /* Verbose mode - set after config loaded */
@@ -54,6 +73,22 @@ int main(int argc, char *argv[]) {
             case 'c':
                 category = optarg;
                 break;
+            case 't':
+                filter = optarg;
+                break;
+            case 'l':
+                list = true;
+                break;
+            case 'R':
+                category = "replay";
+                break;
+            case 'j':
+            case 'p':
+            case 'F':
+            case 'B':
+            case 'T':
+                /* Report options - set after config loaded */
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -63,6 +98,23 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    /* Pick tests straight from the generated table; nothing else is set up yet */
+    framework_init();
+    selected = framework_select_tests(category, filter);
+    if (selected < 0) {
+        fprintf(stderr, "Error: Unknown category '%s'\n\n", category);
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (list) {
+        framework_list_tests();
+        return 0;
+    }
+    if (selected == 0) {
+        fprintf(stderr, "Error: No tests match '%s'\n", filter ? filter : "");
+        return 2;
+    }
+
     /* Get config file */
     if (optind >= argc) {
         fprintf(stderr, "Error: Config file required\n\n");
@@ -79,7 +131,7 @@ int main(int argc, char *argv[]) {
 
     /* Apply command line overrides */
     optind = 1; /* Reset for second pass */
-    while ((opt = getopt_long(argc, argv, "vqfc:h", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "vqfc:t:lj:p:F:B:T:R:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 'v':
                 config.verbosity = 2;
@@ -90,23 +142,32 @@ int main(int argc, char *argv[]) {
             case 'f':
                 config.stop_on_fail = true;
                 break;
+            case 'j':
+                config.jobs = atoi(optarg);
+                break;
+            case 'p':
+                config.session_pool = atoi(optarg);
+                break;
+            case 'F':
+                if (config_set_report_format(&config, optarg) != 0) {
+                    config_free(&config);
+                    return 2;
+                }
+                break;
+            case 'B':
+                free(config.compare_baseline);
+                config.compare_baseline = strdup(optarg);
+                break;
+            case 'T':
+                config.compare_tolerance = atof(optarg);
+                break;
+            case 'R':
+                free(config.replay_file);
+                config.replay_file = strdup(optarg);
+                break;
         }
     }
 
-    /* Initialize framework */
-    framework_init();
-
-    /* Register tests based on category */
-    if (strcmp(category, "all") == 0 || strcmp(category, "discovery") == 0) {
-        register_discovery_tests();
-    }
-    if (strcmp(category, "all") == 0 || strcmp(category, "commands") == 0) {
-        register_command_tests();
-    }
-    if (strcmp(category, "all") == 0 || strcmp(category, "io") == 0) {
-        register_io_tests();
-    }
-
     /* Run tests */
     ret = framework_run_tests(&config);
 
@@ -0,0 +1,201 @@
+#include "target_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define SCRAPE_MAX_RESPONSE (1024 * 1024)
+
+/* Where each unlabelled sample lands in target_metrics_t */
+typedef struct {
+    const char *name;
+    size_t offset;
+    int is_double;
+} metric_field_t;
+
+#define TIMER_FIELDS(prefix, member)                                                     \
+    {prefix "_sum", offsetof(target_metrics_t, member.sum_s), 1},                       \
+    {prefix "_count", offsetof(target_metrics_t, member.count), 0}
+
+static const metric_field_t metric_fields[] = {
+    TIMER_FIELDS("iscsi_target_device_read_seconds", device_read),
+    TIMER_FIELDS("iscsi_target_device_write_seconds", device_write),
+    TIMER_FIELDS("iscsi_target_device_flush_seconds", device_flush),
+    TIMER_FIELDS("iscsi_target_lock_wait_seconds", lock_wait),
+    TIMER_FIELDS("iscsi_target_queue_wait_seconds", queue_wait),
+    {"iscsi_target_r2t_total", offsetof(target_metrics_t, r2t), 0},
+    {"iscsi_target_data_received_bytes_total", offsetof(target_metrics_t, bytes_received), 0},
+    {"iscsi_target_data_sent_bytes_total", offsetof(target_metrics_t, bytes_sent), 0},
+};
+
+/* Connect to host:port with send/receive timeouts. Returns the socket or -1. */
+static int scrape_connect(const char *endpoint, int timeout_s) {
+    char host[256];
+    const char *colon = strrchr(endpoint, ':');
+    struct addrinfo hints, *res, *ai;
+    struct timeval tv = { timeout_s > 0 ? timeout_s : 5, 0 };
+    int fd = -1;
+
+    if (!colon || colon == endpoint || (size_t)(colon - endpoint) >= sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, endpoint, colon - endpoint);
+    host[colon - endpoint] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0) {
+        return -1;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        /* On Linux the send timeout also bounds connect() */
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/* Pick the samples we track out of a Prometheus text body */
+static void scrape_parse(char *body, target_metrics_t *out) {
+    char *save = NULL;
+
+    for (char *line = strtok_r(body, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char *space;
+
+        if (line[0] == '#' || strchr(line, '{')) {
+            continue;
+        }
+        space = strchr(line, ' ');
+        if (!space) {
+            continue;
+        }
+        *space = '\0';
+
+        for (size_t i = 0; i < sizeof(metric_fields) / sizeof(metric_fields[0]); i++) {
+            char *field;
+
+            if (strcmp(line, metric_fields[i].name) != 0) {
+                continue;
+            }
+            field = (char *)out + metric_fields[i].offset;
+            if (metric_fields[i].is_double) {
+                *(double *)field = strtod(space + 1, NULL);
+            } else {
+                *(uint64_t *)field = strtoull(space + 1, NULL, 10);
+            }
+            break;
+        }
+    }
+}
+
+int target_metrics_scrape(const char *endpoint, int timeout_s, target_metrics_t *out) {
+    char request[512];
+    char *response = NULL, *body;
+    size_t len = 0, cap = 0;
+    int fd, ret = -1;
+
+    memset(out, 0, sizeof(*out));
+    if (!endpoint || endpoint[0] == '\0') {
+        return -1;
+    }
+
+    fd = scrape_connect(endpoint, timeout_s);
+    if (fd < 0) {
+        return -1;
+    }
+
+    snprintf(request, sizeof(request),
+             "GET /metrics HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", endpoint);
+    if (send(fd, request, strlen(request), 0) != (ssize_t)strlen(request)) {
+        goto out;
+    }
+
+    /* The target closes the connection after the body */
+    for (;;) {
+        ssize_t n;
+
+        if (cap - len < 4096) {
+            char *grown;
+
+            if (cap >= SCRAPE_MAX_RESPONSE) {
+                goto out;
+            }
+            cap = cap ? cap * 2 : 16384;
+            grown = realloc(response, cap + 1);
+            if (!grown) {
+                goto out;
+            }
+            response = grown;
+        }
+        n = recv(fd, response + len, cap - len, 0);
+        if (n < 0) {
+            goto out;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    response[len] = '\0';
+
+    body = strstr(response, "\r\n\r\n");
+    if (strncmp(response, "HTTP/1.1 200", 12) != 0 || !body) {
+        goto out;
+    }
+    scrape_parse(body + 4, out);
+    ret = 0;
+
+out:
+    free(response);
+    close(fd);
+    return ret;
+}
+
+static void timer_delta(const target_timer_t *before, const target_timer_t *after,
+                        target_timer_t *delta) {
+    delta->sum_s = after->sum_s - before->sum_s;
+    delta->count = after->count - before->count;
+}
+
+void target_metrics_delta(const target_metrics_t *before, const target_metrics_t *after,
+                          target_metrics_t *delta) {
+    timer_delta(&before->device_read, &after->device_read, &delta->device_read);
+    timer_delta(&before->device_write, &after->device_write, &delta->device_write);
+    timer_delta(&before->device_flush, &after->device_flush, &delta->device_flush);
+    timer_delta(&before->lock_wait, &after->lock_wait, &delta->lock_wait);
+    timer_delta(&before->queue_wait, &after->queue_wait, &delta->queue_wait);
+    delta->r2t = after->r2t - before->r2t;
+    delta->bytes_received = after->bytes_received - before->bytes_received;
+    delta->bytes_sent = after->bytes_sent - before->bytes_sent;
+}
+
+/* Mean of a timer in milliseconds */
+static double timer_mean_ms(const target_timer_t *timer) {
+    return timer->count ? timer->sum_s * 1e3 / timer->count : 0.0;
+}
+
+void target_metrics_format(const target_metrics_t *delta, char *buf, size_t size) {
+    snprintf(buf, size,
+             "target: read %.3fms x%llu  write %.3fms x%llu  flush %.3fms x%llu  "
+             "lock wait %.3fms  queue wait %.3fms  R2T %llu",
+             timer_mean_ms(&delta->device_read), (unsigned long long)delta->device_read.count,
+             timer_mean_ms(&delta->device_write), (unsigned long long)delta->device_write.count,
+             timer_mean_ms(&delta->device_flush), (unsigned long long)delta->device_flush.count,
+             timer_mean_ms(&delta->lock_wait), timer_mean_ms(&delta->queue_wait),
+             (unsigned long long)delta->r2t);
+}
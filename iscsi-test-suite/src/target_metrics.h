@@ -0,0 +1,48 @@
+#ifndef TARGET_METRICS_H
+#define TARGET_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Server-side metrics scraped from the target.
+ *
+ * The Rust target serves Prometheus text at http://<endpoint>/metrics when
+ * IscsiTargetBuilder::metrics_addr is set. Benchmarks scrape it before and
+ * after a step and report the difference, which puts the target's own
+ * device service time and lock/queue waits next to the latency the
+ * initiator saw.
+ */
+
+/* One histogram's running totals */
+typedef struct {
+    double sum_s;
+    uint64_t count;
+} target_timer_t;
+
+typedef struct {
+    target_timer_t device_read;
+    target_timer_t device_write;
+    target_timer_t device_flush;
+    target_timer_t lock_wait;
+    target_timer_t queue_wait;
+    uint64_t r2t;
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+} target_metrics_t;
+
+/*
+ * Fetch the target's metrics from endpoint ("host:port"), waiting at most
+ * timeout_s seconds. Returns 0 on success, -1 if the endpoint could not be
+ * reached or did not answer with metrics.
+ */
+int target_metrics_scrape(const char *endpoint, int timeout_s, target_metrics_t *out);
+
+/* delta = after - before */
+void target_metrics_delta(const target_metrics_t *before, const target_metrics_t *after,
+                          target_metrics_t *delta);
+
+/* One-line summary of a delta: mean device times and waits, R2Ts */
+void target_metrics_format(const target_metrics_t *delta, char *buf, size_t size);
+
+#endif /* TARGET_METRICS_H */
@@ -0,0 +1,3288 @@
+#define _GNU_SOURCE             /* pthread_setaffinity_np */
+#include "test_bench.h"
+#include "utils.h"
+#include "iscsi_pdu_helper.h"
+#include "crc32c.h"
+#include "target_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <iscsi/iscsi.h>
+#include <iscsi/scsi-lowlevel.h>
+
+/*
+ * Async queue-depth benchmarks.
+ *
+ * The helpers in utils.c are synchronous, so they can only ever measure
+ * QD=1. These tests drive libiscsi's task API from a poll() loop and keep
+ * a fixed number of commands outstanding: every completion immediately
+ * resubmits into the same slot until the run's deadline expires. One
+ * thread can drive several sessions at once; each session is a bench_run_t
+ * confined to its own LBA window.
+ */
+
+#define BENCH_MAX_QUEUE_DEPTH 256
+#define BENCH_MAX_SESSIONS_PER_THREAD 64
+#define BENCH_MAX_LOAD_THREADS 64
+#define BENCH_MAX_LOAD_STEPS 8
+
+typedef struct bench_run bench_run_t;
+
+/* One outstanding command */
+typedef struct {
+    bench_run_t *run;
+    uint8_t *buffer;        /* Data-In lands here; Data-Out is sent from here */
+    struct scsi_iovec iov;  /* Binds buffer to the slot's task */
+    uint64_t submit_ns;
+} bench_slot_t;
+
+/* State for one session's workload */
+struct bench_run {
+    struct iscsi_context *iscsi;
+    int lun;
+    int read_percent;       /* 100 = all reads, 0 = all writes */
+    uint32_t block_size;
+    uint32_t io_blocks;
+    uint64_t lba_base;      /* First block of this run's LBA window */
+    uint64_t lba_slots;     /* Number of io_blocks-aligned start positions */
+    unsigned int seed;
+
+    bench_slot_t *slots;
+    uint8_t *buffers;       /* One pooled buffer carved into per-slot regions */
+    int max_depth;
+
+    int in_flight;
+    int stopping;
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t last_progress_ns;
+
+    latency_hist_t *hist;
+};
+
+/* Result of one measurement step */
+typedef struct {
+    int queue_depth;
+    int sessions;
+    double iops;
+    double mb_per_sec;
+    uint64_t bytes;
+    double p50_ms;
+    double p99_ms;
+    double p999_ms;
+    target_metrics_t server;    /* Target-side delta over the step */
+    int has_server;
+} bench_result_t;
+
+/*
+ * Set up a run over [lba_base, lba_base + lba_blocks) with room for
+ * max_depth outstanding commands. Returns 0 on success, -1 on allocation
+ * failure.
+ */
+static int bench_run_init(bench_run_t *run, struct iscsi_context *iscsi, int lun,
+                          uint32_t block_size, uint32_t io_blocks,
+                          uint64_t lba_base, uint64_t lba_blocks,
+                          int read_percent, int max_depth, unsigned int seed) {
+    memset(run, 0, sizeof(*run));
+    run->iscsi = iscsi;
+    run->lun = lun;
+    run->read_percent = read_percent;
+    run->block_size = block_size;
+    run->io_blocks = io_blocks;
+    run->lba_base = lba_base;
+    run->lba_slots = lba_blocks / io_blocks;
+    run->seed = seed;
+    run->max_depth = max_depth;
+
+    run->hist = calloc(1, sizeof(latency_hist_t));
+    run->slots = calloc(max_depth, sizeof(bench_slot_t));
+    run->buffers = buffer_pool_get((size_t)max_depth * io_blocks * block_size);
+    if (!run->hist || !run->slots || !run->buffers) {
+        return -1;
+    }
+    for (int i = 0; i < max_depth; i++) {
+        size_t len = (size_t)io_blocks * block_size;
+
+        run->slots[i].run = run;
+        run->slots[i].buffer = run->buffers + i * len;
+        generate_pattern(run->slots[i].buffer, len, "random", seed + i);
+        run->slots[i].iov.iov_base = run->slots[i].buffer;
+        run->slots[i].iov.iov_len = len;
+    }
+
+    return 0;
+}
+
+/* Release a run's buffers. The owning context must already be destroyed. */
+static void bench_run_free(bench_run_t *run) {
+    free(run->slots);
+    run->slots = NULL;
+    buffer_pool_put(run->buffers);
+    run->buffers = NULL;
+    free(run->hist);
+    run->hist = NULL;
+}
+
+static void bench_io_cb(struct iscsi_context *iscsi, int status,
+                        void *command_data, void *private_data);
+
+/* 62 random bits, enough to spread I/O over any LUN */
+static uint64_t bench_rand64(bench_run_t *run) {
+    return ((uint64_t)rand_r(&run->seed) << 31) ^ (uint64_t)rand_r(&run->seed);
+}
+
+/*
+ * Issue one READ/WRITE for the given slot at a random aligned LBA, with a
+ * 16-byte CDB where the 10-byte one does not reach. The data phase uses the
+ * slot's own buffer through an iovec, so reads are not copied out of a
+ * libiscsi-allocated datain buffer.
+ */
+static int bench_submit(bench_slot_t *slot) {
+    bench_run_t *run = slot->run;
+    uint64_t lba = run->lba_base + (bench_rand64(run) % run->lba_slots) * run->io_blocks;
+    uint32_t datalen = run->io_blocks * run->block_size;
+    int cdb16 = scsi_use_cdb16(lba, run->io_blocks);
+    int is_read;
+    struct scsi_task *task;
+
+    if (run->read_percent >= 100) {
+        is_read = 1;
+    } else if (run->read_percent <= 0) {
+        is_read = 0;
+    } else {
+        is_read = (rand_r(&run->seed) % 100) < run->read_percent;
+    }
+
+    slot->submit_ns = latency_now_ns();
+    if (is_read) {
+        task = cdb16 ? scsi_cdb_read16(lba, datalen, run->block_size, 0, 0, 0, 0, 0)
+                     : scsi_cdb_read10((uint32_t)lba, datalen, run->block_size, 0, 0, 0, 0, 0);
+    } else {
+        task = cdb16 ? scsi_cdb_write16(lba, datalen, run->block_size, 0, 0, 0, 0, 0)
+                     : scsi_cdb_write10((uint32_t)lba, datalen, run->block_size, 0, 0, 0, 0, 0);
+    }
+    if (!task) {
+        return -1;
+    }
+    if (is_read) {
+        scsi_task_set_iov_in(task, &slot->iov, 1);
+    } else {
+        scsi_task_set_iov_out(task, &slot->iov, 1);
+    }
+    if (iscsi_scsi_command_async(run->iscsi, run->lun, task, bench_io_cb, NULL, slot) != 0) {
+        scsi_free_scsi_task(task);
+        return -1;
+    }
+
+    run->in_flight++;
+    return 0;
+}
+
+/* Completion callback: record latency and keep the slot busy */
+static void bench_io_cb(struct iscsi_context *iscsi, int status,
+                        void *command_data, void *private_data) {
+    bench_slot_t *slot = private_data;
+    bench_run_t *run = slot->run;
+    struct scsi_task *task = command_data;
+    uint64_t now = latency_now_ns();
+
+    (void)iscsi;
+
+    run->in_flight--;
+    run->last_progress_ns = now;
+
+    if (status == SCSI_STATUS_GOOD) {
+        run->completed++;
+        latency_hist_record(run->hist, slot->submit_ns, now);
+    } else {
+        run->errors++;
+    }
+
+    if (task) {
+        scsi_free_scsi_task(task);
+    }
+
+    if (!run->stopping && bench_submit(slot) != 0) {
+        run->errors++;
+        run->stopping = 1;
+    }
+}
+
+/* Reset counters and fill the first depth slots */
+static void bench_start(bench_run_t *run, int depth) {
+    run->in_flight = 0;
+    run->stopping = 0;
+    run->completed = 0;
+    run->errors = 0;
+    latency_hist_reset(run->hist);
+    run->last_progress_ns = latency_now_ns();
+
+    if (depth > run->max_depth) {
+        depth = run->max_depth;
+    }
+    for (int i = 0; i < depth; i++) {
+        if (bench_submit(&run->slots[i]) != 0) {
+            run->errors++;
+            run->stopping = 1;
+            break;
+        }
+    }
+}
+
+/*
+ * Service a set of runs until end_ns, then drain them. Returns 0 when all
+ * commands completed; -1 on a transport error or when a run made no
+ * progress for stall_ns, with *failed set to the offending run.
+ */
+static int bench_poll(bench_run_t **runs, int count, uint64_t end_ns, uint64_t stall_ns,
+                      bench_run_t **failed) {
+    struct pollfd pfds[BENCH_MAX_SESSIONS_PER_THREAD];
+
+    for (;;) {
+        uint64_t now = latency_now_ns();
+        int active = 0;
+
+        for (int i = 0; i < count; i++) {
+            bench_run_t *run = runs[i];
+
+            if (!run->stopping && now >= end_ns) {
+                run->stopping = 1;
+            }
+            if (run->in_flight == 0) {
+                pfds[i].fd = -1;
+                pfds[i].revents = 0;
+                continue;
+            }
+            if (now - run->last_progress_ns > stall_ns) {
+                *failed = run;
+                goto fail;
+            }
+            pfds[i].fd = iscsi_get_fd(run->iscsi);
+            pfds[i].events = iscsi_which_events(run->iscsi);
+            pfds[i].revents = 0;
+            active++;
+        }
+        if (active == 0) {
+            return 0;
+        }
+
+        if (poll(pfds, count, 100) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *failed = runs[0];
+            goto fail;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (pfds[i].fd < 0) {
+                continue;
+            }
+            if (iscsi_service(runs[i]->iscsi, pfds[i].revents) < 0) {
+                *failed = runs[i];
+                goto fail;
+            }
+        }
+    }
+
+fail:
+    for (int i = 0; i < count; i++) {
+        runs[i]->stopping = 1;
+    }
+    return -1;
+}
+
+/* Merge histograms from all runs and compute throughput/percentiles */
+static void bench_summarize(bench_run_t **runs, int count, uint64_t elapsed_ns,
+                            latency_hist_t *merged, bench_result_t *result) {
+    double elapsed_s = elapsed_ns / 1e9;
+    double bytes = 0.0;
+
+    latency_hist_reset(merged);
+    for (int i = 0; i < count; i++) {
+        latency_hist_merge(merged, runs[i]->hist);
+        bytes += (double)runs[i]->completed * runs[i]->io_blocks * runs[i]->block_size;
+    }
+
+    result->bytes = (uint64_t)bytes;
+    result->iops = elapsed_s > 0 ? merged->total / elapsed_s : 0.0;
+    result->mb_per_sec = elapsed_s > 0 ? bytes / elapsed_s / 1000000.0 : 0.0;
+    result->p50_ms = latency_hist_percentile(merged, 0.50) / 1e6;
+    result->p99_ms = latency_hist_percentile(merged, 0.99) / 1e6;
+    result->p999_ms = latency_hist_percentile(merged, 0.999) / 1e6;
+}
+
+/* Scrape the target's metrics when metrics_endpoint is set. Returns 0 on success. */
+static int bench_scrape_target(const test_config_t *config, target_metrics_t *out) {
+    if (!config->metrics_endpoint) {
+        return -1;
+    }
+    return target_metrics_scrape(config->metrics_endpoint, config->timeout, out);
+}
+
+/* Record the target-side delta of a step whose "before" scrape succeeded */
+static void bench_finish_scrape(const test_config_t *config, int have_before,
+                                const target_metrics_t *before, bench_result_t *result) {
+    target_metrics_t after;
+
+    result->has_server = have_before && bench_scrape_target(config, &after) == 0;
+    if (result->has_server) {
+        target_metrics_delta(before, &after, &result->server);
+    }
+}
+
+/* Append the target-side line for a step, if it has one */
+static size_t bench_append_server(char *msg, size_t size, size_t off,
+                                  const bench_result_t *result) {
+    char line[256];
+
+    if (!result->has_server || off >= size) {
+        return off;
+    }
+    target_metrics_format(&result->server, line, sizeof(line));
+    return off + snprintf(msg + off, size - off, "\n              %s", line);
+}
+
+/* Sweep the configured queue depths with random reads or writes */
+static test_result_t run_queue_depth_sweep(test_config_t *config, test_report_t *report,
+                                           int read_percent) {
+    struct iscsi_context *iscsi;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    bench_run_t run;
+    bench_run_t *runs[1] = { &run };
+    latency_hist_t merged;
+    bench_result_t results[MAX_BENCH_QUEUE_DEPTHS];
+    int result_count = 0;
+    int max_depth = 0;
+    char msg[4096];
+    size_t off;
+    int best = 0;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    if (config->bench_queue_depth_count == 0 || config->bench_io_blocks <= 0 ||
+        config->bench_duration <= 0) {
+        report_set_result(report, TEST_SKIP, "Benchmark parameters not configured");
+        return TEST_SKIP;
+    }
+
+    for (int i = 0; i < config->bench_queue_depth_count; i++) {
+        if (config->bench_queue_depths[i] > max_depth) {
+            max_depth = config->bench_queue_depths[i];
+        }
+    }
+    if (max_depth > BENCH_MAX_QUEUE_DEPTH) {
+        max_depth = BENCH_MAX_QUEUE_DEPTH;
+    }
+
+    iscsi = create_iscsi_context_for_test(config);
+    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        if (iscsi) iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+
+    /* Get capacity */
+    if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        iscsi_disconnect_target(iscsi);
+        iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+
+    if (num_blocks < (uint64_t)config->bench_io_blocks) {
+        report_set_result(report, TEST_SKIP, "Device too small for benchmark I/O size");
+        iscsi_disconnect_target(iscsi);
+        iscsi_destroy_context(iscsi);
+        return TEST_SKIP;
+    }
+
+    if (bench_run_init(&run, iscsi, config->lun, block_size, (uint32_t)config->bench_io_blocks,
+                       0, num_blocks, read_percent, max_depth, 12345) != 0) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        bench_run_free(&run);
+        iscsi_disconnect_target(iscsi);
+        iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+
+    for (int i = 0; i < config->bench_queue_depth_count; i++) {
+        int depth = config->bench_queue_depths[i];
+        bench_run_t *failed = NULL;
+        target_metrics_t before;
+        int have_before;
+        uint64_t start;
+
+        if (depth > max_depth) {
+            depth = max_depth;
+        }
+
+        have_before = bench_scrape_target(config, &before) == 0;
+        start = latency_now_ns();
+        bench_start(&run, depth);
+        if (bench_poll(runs, 1, start + config->bench_duration * 1000000000ULL,
+                       config->timeout * 1000000000ULL, &failed) != 0) {
+            snprintf(msg, sizeof(msg), "Event loop failed at QD %d: %s",
+                     depth, iscsi_get_error(iscsi));
+            report_set_result(report, TEST_FAIL, msg);
+            /* Destroy the context first: it completes outstanding tasks into our slots */
+            iscsi_disconnect(iscsi);
+            iscsi_destroy_context(iscsi);
+            bench_run_free(&run);
+            return TEST_FAIL;
+        }
+
+        if (run.errors > 0) {
+            snprintf(msg, sizeof(msg), "%llu of %llu commands failed at QD %d",
+                     (unsigned long long)run.errors,
+                     (unsigned long long)(run.errors + run.completed), depth);
+            report_set_result(report, TEST_FAIL, msg);
+            iscsi_disconnect_target(iscsi);
+            iscsi_destroy_context(iscsi);
+            bench_run_free(&run);
+            return TEST_FAIL;
+        }
+
+        bench_summarize(runs, 1, latency_now_ns() - start, &merged, &results[result_count]);
+        latency_hist_merge(report->latency, &merged);
+        report->bytes += results[result_count].bytes;
+        results[result_count].queue_depth = depth;
+        results[result_count].sessions = 1;
+        bench_finish_scrape(config, have_before, &before, &results[result_count]);
+        if (results[result_count].iops > results[best].iops) {
+            best = result_count;
+        }
+        result_count++;
+    }
+
+    iscsi_disconnect_target(iscsi);
+    iscsi_destroy_context(iscsi);
+    bench_run_free(&run);
+
+    /* Peak first, then one line per depth */
+    off = snprintf(msg, sizeof(msg), "%u KiB random %s, peak %.0f IOPS at QD %d",
+                   (run.io_blocks * block_size) / 1024, read_percent ? "read" : "write",
+                   results[best].iops, results[best].queue_depth);
+    for (int i = 0; i < result_count && off < sizeof(msg); i++) {
+        off += snprintf(msg + off, sizeof(msg) - off,
+                        "\n       QD %3d: %9.0f IOPS %9.2f MB/s  p50 %.3fms  p99 %.3fms  p999 %.3fms",
+                        results[i].queue_depth, results[i].iops, results[i].mb_per_sec,
+                        results[i].p50_ms, results[i].p99_ms, results[i].p999_ms);
+        off = bench_append_server(msg, sizeof(msg), off, &results[i]);
+    }
+
+    report_set_result(report, TEST_PASS, msg);
+    return TEST_PASS;
+}
+
+/* TP-001: Async Random Read Queue-Depth Sweep */
+static test_result_t test_qd_sweep_read(struct iscsi_context *unused_iscsi,
+                                        test_config_t *config,
+                                        test_report_t *report) {
+    (void)unused_iscsi;
+    return run_queue_depth_sweep(config, report, 100);
+}
+
+/* TP-002: Async Random Write Queue-Depth Sweep */
+static test_result_t test_qd_sweep_write(struct iscsi_context *unused_iscsi,
+                                         test_config_t *config,
+                                         test_report_t *report) {
+    (void)unused_iscsi;
+    return run_queue_depth_sweep(config, report, 0);
+}
+
+/* Start gate: load threads log in, then wait until all are ready */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int ready;
+    int go;                     /* 0 = wait, 1 = run, -1 = abort */
+} load_gate_t;
+
+/* Thread data structure for the multi-session load generator */
+typedef struct {
+    test_config_t *config;
+    int thread_id;
+    int sessions;               /* Sessions this thread opens */
+    int first_window;           /* Index of this thread's first LBA window */
+    uint64_t window_blocks;
+    uint32_t block_size;
+    int cpu;                    /* CPU to pin to, -1 for none */
+    load_gate_t *gate;
+
+    bench_run_t runs[BENCH_MAX_SESSIONS_PER_THREAD];
+    int connected;
+    int login_failed;
+    int result;
+    uint64_t elapsed_ns;
+    char error_msg[256];
+} load_thread_data_t;
+
+/* Thread function: log in all sessions, wait for the others, then run mixed I/O */
+static void* load_thread_func(void *arg) {
+    load_thread_data_t *data = (load_thread_data_t *)arg;
+    test_config_t *config = data->config;
+    bench_run_t *runs[BENCH_MAX_SESSIONS_PER_THREAD];
+    int loop_failed = 0;
+    int go;
+    int s;
+
+    data->result = 0;
+
+    if (data->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(data->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            snprintf(data->error_msg, sizeof(data->error_msg),
+                     "Thread %d: Failed to pin to CPU %d", data->thread_id, data->cpu);
+            data->result = -1;
+        }
+    }
+
+    for (s = 0; data->result == 0 && s < data->sessions; s++) {
+        struct iscsi_context *iscsi = create_iscsi_context_for_test(config);
+
+        if (!iscsi) {
+            snprintf(data->error_msg, sizeof(data->error_msg),
+                     "Thread %d: Failed to create iSCSI context", data->thread_id);
+            data->result = -1;
+            break;
+        }
+        if (iscsi_connect_target(iscsi, config) != 0) {
+            snprintf(data->error_msg, sizeof(data->error_msg),
+                     "Thread %d session %d: Login failed: %s",
+                     data->thread_id, s + 1, iscsi_get_error(iscsi));
+            data->login_failed = 1;
+            data->result = -1;
+            iscsi_destroy_context(iscsi);
+            break;
+        }
+        if (bench_run_init(&data->runs[s], iscsi, config->lun, data->block_size,
+                           (uint32_t)config->bench_io_blocks,
+                           (uint64_t)(data->first_window + s) * data->window_blocks,
+                           data->window_blocks, config->load_read_percent,
+                           config->load_queue_depth,
+                           (unsigned int)(data->thread_id * 1000 + s)) != 0) {
+            snprintf(data->error_msg, sizeof(data->error_msg),
+                     "Thread %d: Memory allocation failed", data->thread_id);
+            data->result = -1;
+            data->connected = s + 1;
+            break;
+        }
+        runs[s] = &data->runs[s];
+        data->connected = s + 1;
+    }
+
+    /* Every thread must reach the gate, even after a failed login */
+    pthread_mutex_lock(&data->gate->lock);
+    data->gate->ready++;
+    pthread_cond_broadcast(&data->gate->cond);
+    while (data->gate->go == 0) {
+        pthread_cond_wait(&data->gate->cond, &data->gate->lock);
+    }
+    go = data->gate->go;
+    pthread_mutex_unlock(&data->gate->lock);
+
+    if (data->result == 0 && go > 0) {
+        bench_run_t *failed = NULL;
+        uint64_t start = latency_now_ns();
+
+        for (s = 0; s < data->connected; s++) {
+            bench_start(runs[s], config->load_queue_depth);
+        }
+        if (bench_poll(runs, data->connected, start + config->bench_duration * 1000000000ULL,
+                       config->timeout * 1000000000ULL, &failed) != 0) {
+            snprintf(data->error_msg, sizeof(data->error_msg),
+                     "Thread %d: Event loop failed: %s",
+                     data->thread_id, iscsi_get_error(failed->iscsi));
+            data->result = -1;
+            loop_failed = 1;
+        }
+        data->elapsed_ns = latency_now_ns() - start;
+    }
+
+    /* Tear down sessions; buffers and samples stay until the stats are merged */
+    for (s = 0; s < data->connected; s++) {
+        if (loop_failed) {
+            iscsi_disconnect(data->runs[s].iscsi);
+        } else {
+            iscsi_disconnect_target(data->runs[s].iscsi);
+        }
+        iscsi_destroy_context(data->runs[s].iscsi);
+        data->runs[s].iscsi = NULL;
+    }
+
+    return NULL;
+}
+
+/*
+ * Run one load step: threads x sessions_per_thread sessions for one
+ * duration. Returns 0 when every thread ran, -1 if threads could not be
+ * created. Per-thread state is left in thread_data for merging.
+ */
+static int run_load_step(test_config_t *config, load_thread_data_t *thread_data,
+                         int num_threads, int sessions_per_thread, int max_sessions_per_thread,
+                         uint64_t window_blocks, uint32_t block_size) {
+    pthread_t threads[BENCH_MAX_LOAD_THREADS];
+    load_gate_t gate;
+    int created = 0;
+
+    pthread_mutex_init(&gate.lock, NULL);
+    pthread_cond_init(&gate.cond, NULL);
+    gate.ready = 0;
+    gate.go = 0;
+
+    for (int i = 0; i < num_threads; i++) {
+        memset(&thread_data[i], 0, sizeof(thread_data[i]));
+        thread_data[i].config = config;
+        thread_data[i].thread_id = i + 1;
+        thread_data[i].sessions = sessions_per_thread;
+        thread_data[i].first_window = i * max_sessions_per_thread;
+        thread_data[i].window_blocks = window_blocks;
+        thread_data[i].block_size = block_size;
+        thread_data[i].cpu = config->load_cpu_count > 0 ?
+                             config->load_cpus[i % config->load_cpu_count] : -1;
+        thread_data[i].gate = &gate;
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, load_thread_func, &thread_data[i]) != 0) {
+            break;
+        }
+        created++;
+    }
+
+    /* Release everyone at once; abort the step if a thread is missing */
+    pthread_mutex_lock(&gate.lock);
+    while (gate.ready < created) {
+        pthread_cond_wait(&gate.cond, &gate.lock);
+    }
+    gate.go = (created == num_threads) ? 1 : -1;
+    pthread_cond_broadcast(&gate.cond);
+    pthread_mutex_unlock(&gate.lock);
+
+    for (int i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&gate.cond);
+    pthread_mutex_destroy(&gate.lock);
+
+    return (created == num_threads) ? 0 : -1;
+}
+
+static void free_load_step(load_thread_data_t *thread_data, int num_threads) {
+    for (int i = 0; i < num_threads; i++) {
+        for (int s = 0; s < thread_data[i].connected; s++) {
+            bench_run_free(&thread_data[i].runs[s]);
+        }
+        thread_data[i].connected = 0;
+    }
+}
+
+/* TP-003: Multi-Session Load Scaling */
+static test_result_t test_multi_session_load(struct iscsi_context *unused_iscsi,
+                                             test_config_t *config,
+                                             test_report_t *report) {
+    struct iscsi_context *iscsi;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    int num_threads = config->load_threads;
+    int max_spt = config->load_sessions_per_thread;
+    uint64_t window_blocks;
+    load_thread_data_t *thread_data;
+    latency_hist_t merged;
+    bench_result_t results[BENCH_MAX_LOAD_STEPS];
+    int steps[BENCH_MAX_LOAD_STEPS];
+    int step_count = 0;
+    int result_count = 0;
+    int best = 0;
+    int knee = -1;
+    char limit_msg[320] = "";
+    char msg[4096];
+    size_t off;
+
+    (void)unused_iscsi;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    if (num_threads < 1 || num_threads > BENCH_MAX_LOAD_THREADS ||
+        max_spt < 1 || max_spt > BENCH_MAX_SESSIONS_PER_THREAD ||
+        config->load_queue_depth < 1 || config->load_queue_depth > BENCH_MAX_QUEUE_DEPTH ||
+        config->bench_io_blocks <= 0 || config->bench_duration <= 0) {
+        report_set_result(report, TEST_SKIP, "Load generator parameters out of range");
+        return TEST_SKIP;
+    }
+
+    /* Size the LBA windows from a short-lived session */
+    iscsi = create_iscsi_context_for_test(config);
+    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        if (iscsi) iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+    if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        iscsi_disconnect_target(iscsi);
+        iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+    iscsi_disconnect_target(iscsi);
+    iscsi_destroy_context(iscsi);
+
+    /* Disjoint windows sized for the largest step, so windows never move */
+    window_blocks = num_blocks / ((uint64_t)num_threads * max_spt);
+    window_blocks -= window_blocks % config->bench_io_blocks;
+    if (window_blocks < (uint64_t)config->bench_io_blocks) {
+        report_set_result(report, TEST_SKIP, "Device too small for one LBA window per session");
+        return TEST_SKIP;
+    }
+
+    thread_data = calloc(num_threads, sizeof(load_thread_data_t));
+    if (!thread_data) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        return TEST_ERROR;
+    }
+
+    /* Double sessions per thread each step: 1, 2, 4, ... max */
+    for (int spt = 1; spt < max_spt; spt *= 2) {
+        steps[step_count++] = spt;
+    }
+    steps[step_count++] = max_spt;
+
+    for (int step = 0; step < step_count; step++) {
+        int spt = steps[step];
+        int sessions = num_threads * spt;
+        int login_failures = 0;
+        int io_failures = 0;
+        const char *first_error = NULL;
+        bench_run_t *runs[BENCH_MAX_LOAD_THREADS * BENCH_MAX_SESSIONS_PER_THREAD];
+        int run_count = 0;
+        uint64_t elapsed_ns = 0;
+        target_metrics_t before;
+        int have_before = bench_scrape_target(config, &before) == 0;
+
+        if (run_load_step(config, thread_data, num_threads, spt, max_spt,
+                          window_blocks, block_size) != 0) {
+            report_set_result(report, TEST_ERROR, "Failed to create load threads");
+            free_load_step(thread_data, num_threads);
+            free(thread_data);
+            return TEST_ERROR;
+        }
+
+        for (int i = 0; i < num_threads; i++) {
+            if (thread_data[i].result != 0) {
+                if (thread_data[i].login_failed) {
+                    login_failures++;
+                } else {
+                    io_failures++;
+                }
+                if (!first_error) {
+                    first_error = thread_data[i].error_msg;
+                }
+            }
+            for (int s = 0; s < thread_data[i].connected; s++) {
+                runs[run_count++] = &thread_data[i].runs[s];
+                if (thread_data[i].runs[s].errors > 0) {
+                    io_failures++;
+                }
+            }
+            if (thread_data[i].elapsed_ns > elapsed_ns) {
+                elapsed_ns = thread_data[i].elapsed_ns;
+            }
+        }
+
+        if (io_failures > 0) {
+            snprintf(msg, sizeof(msg), "I/O failed with %d sessions: %s", sessions,
+                     first_error ? first_error : "SCSI command errors");
+            report_set_result(report, TEST_FAIL, msg);
+            free_load_step(thread_data, num_threads);
+            free(thread_data);
+            return TEST_FAIL;
+        }
+
+        if (login_failures > 0) {
+            /* The target refused more sessions; report the limit rather than fail */
+            snprintf(limit_msg, sizeof(limit_msg),
+                     "\n       %d sessions: login rejected (%s)", sessions, first_error);
+            free_load_step(thread_data, num_threads);
+            break;
+        }
+
+        bench_summarize(runs, run_count, elapsed_ns, &merged, &results[result_count]);
+        latency_hist_merge(report->latency, &merged);
+        report->bytes += results[result_count].bytes;
+        results[result_count].queue_depth = config->load_queue_depth;
+        results[result_count].sessions = sessions;
+        free_load_step(thread_data, num_threads);
+        bench_finish_scrape(config, have_before, &before, &results[result_count]);
+
+        if (results[result_count].iops > results[best].iops) {
+            best = result_count;
+        }
+        /* First step that adds less than 10% over the previous one */
+        if (knee < 0 && result_count > 0 &&
+            results[result_count].iops < results[result_count - 1].iops * 1.10) {
+            knee = result_count - 1;
+        }
+        result_count++;
+    }
+
+    free(thread_data);
+
+    if (result_count == 0) {
+        snprintf(msg, sizeof(msg), "No load step completed%s", limit_msg);
+        report_set_result(report, TEST_FAIL, msg);
+        return TEST_FAIL;
+    }
+
+    off = snprintf(msg, sizeof(msg),
+                   "%d threads, %d%% reads, QD %d/session, peak %.0f IOPS at %d sessions",
+                   num_threads, config->load_read_percent, config->load_queue_depth,
+                   results[best].iops, results[best].sessions);
+    if (knee >= 0 && off < sizeof(msg)) {
+        off += snprintf(msg + off, sizeof(msg) - off, "; scaling flattens beyond %d sessions",
+                        results[knee].sessions);
+    }
+    for (int i = 0; i < result_count && off < sizeof(msg); i++) {
+        off += snprintf(msg + off, sizeof(msg) - off,
+                        "\n       %3d sessions: %9.0f IOPS %9.2f MB/s  p50 %.3fms  p99 %.3fms  p999 %.3fms",
+                        results[i].sessions, results[i].iops, results[i].mb_per_sec,
+                        results[i].p50_ms, results[i].p99_ms, results[i].p999_ms);
+        off = bench_append_server(msg, sizeof(msg), off, &results[i]);
+    }
+    if (off < sizeof(msg)) {
+        snprintf(msg + off, sizeof(msg) - off, "%s", limit_msg);
+    }
+
+    report_set_result(report, TEST_PASS, msg);
+    return TEST_PASS;
+}
+
+#define SWEEP_MAX_SIZES 32
+#define SWEEP_MAX_BLOCKS 65535      /* READ(10)/WRITE(10) transfer length limit */
+
+/* One row of the transfer-size sweep */
+typedef struct {
+    uint32_t blocks;
+    double write_mb_per_sec;
+    double read_mb_per_sec;
+    double r2t_per_op;
+    double data_out_per_op;
+    double data_in_per_op;
+} sweep_result_t;
+
+static void sweep_add_size(uint32_t *sizes, int *count, uint32_t blocks, uint32_t max_blocks) {
+    if (blocks == 0 || blocks > max_blocks || *count >= SWEEP_MAX_SIZES) {
+        return;
+    }
+    for (int i = 0; i < *count; i++) {
+        if (sizes[i] == blocks) {
+            return;
+        }
+    }
+    sizes[(*count)++] = blocks;
+}
+
+static int sweep_cmp_size(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Checks and capacity lookup shared by the raw-session benchmarks. Returns
+ * TEST_PASS when the benchmark can go ahead, otherwise the result already
+ * set on the report.
+ */
+static test_result_t raw_bench_prepare(test_config_t *config, test_report_t *report,
+                                       uint64_t *num_blocks, uint32_t *block_size) {
+    struct iscsi_context *iscsi;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    /* The raw session negotiates operational keys itself and has no CHAP */
+    if (config->auth_method && strcmp(config->auth_method, "none") != 0) {
+        report_set_result(report, TEST_SKIP, "Raw-session benchmarks require auth_method = none");
+        return TEST_SKIP;
+    }
+
+    if (config->bench_duration <= 0) {
+        report_set_result(report, TEST_SKIP, "Benchmark parameters not configured");
+        return TEST_SKIP;
+    }
+
+    iscsi = create_iscsi_context_for_test(config);
+    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        if (iscsi) iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+    if (scsi_read_capacity(iscsi, config->lun, num_blocks, block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        iscsi_disconnect_target(iscsi);
+        iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+    iscsi_disconnect_target(iscsi);
+    iscsi_destroy_context(iscsi);
+
+    /* READ(10)/WRITE(10) can only address the first 2^32 blocks */
+    if (*num_blocks > 0xFFFFFFFFULL) {
+        *num_blocks = 0xFFFFFFFFULL;
+    }
+    return TEST_PASS;
+}
+
+/* Open a raw session, offering params (NULL = target defaults) */
+static int raw_bench_login(iscsi_raw_conn_t *conn, test_config_t *config,
+                           const iscsi_raw_params_t *params) {
+    if (iscsi_raw_connect(conn, config->portal) != 0 ||
+        iscsi_raw_login(conn, "iqn.2024-12.com.test:initiator", config->iqn, params) != 0) {
+        iscsi_raw_close(conn);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Run sequential writes or reads of blocks-sized transfers for duration_ns,
+ * wrapping at the end of the device, and record each one in hist. Returns
+ * the number of operations completed, or -1 on failure.
+ */
+static int64_t raw_run_phase(iscsi_raw_conn_t *conn, int lun, latency_hist_t *hist,
+                             uint32_t blocks, uint32_t block_size, uint64_t num_blocks,
+                             uint8_t *buffer, int write, uint64_t duration_ns,
+                             uint64_t *elapsed_ns) {
+    uint64_t start = latency_now_ns();
+    uint64_t end = start + duration_ns;
+    uint64_t now = start;
+    uint64_t lba = 0;
+    int64_t ops = 0;
+
+    while (now < end || ops == 0) {
+        uint64_t op_start = now;
+        int ret;
+
+        if (lba + blocks > num_blocks) {
+            lba = 0;
+        }
+        if (write) {
+            ret = iscsi_raw_write10(conn, lun, (uint32_t)lba, blocks, block_size, buffer);
+        } else {
+            ret = iscsi_raw_read10(conn, lun, (uint32_t)lba, blocks, block_size, buffer);
+        }
+        if (ret != 0) {
+            return -1;
+        }
+
+        now = latency_now_ns();
+        latency_hist_record(hist, op_start, now);
+        lba += blocks;
+        ops++;
+    }
+
+    *elapsed_ns = now - start;
+    return ops;
+}
+
+/* TP-004: Transfer Size Sweep */
+static test_result_t test_transfer_size_sweep(struct iscsi_context *unused_iscsi,
+                                              test_config_t *config,
+                                              test_report_t *report) {
+    iscsi_raw_conn_t conn;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    uint32_t sizes[SWEEP_MAX_SIZES];
+    int size_count = 0;
+    sweep_result_t results[SWEEP_MAX_SIZES];
+    uint32_t max_blocks, fb_blocks, mb_blocks;
+    uint8_t *write_buf = NULL;
+    uint8_t *read_buf = NULL;
+    uint64_t phase_ns;
+    test_result_t ret;
+    char msg[4096];
+    size_t off;
+
+    (void)unused_iscsi;
+
+    ret = raw_bench_prepare(config, report, &num_blocks, &block_size);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+
+    /* Raw session: counts every R2T, Data-Out and Data-In PDU per command */
+    if (raw_bench_login(&conn, config, NULL) != 0) {
+        report_set_result(report, TEST_ERROR, "Raw session login failed");
+        return TEST_ERROR;
+    }
+
+    /*
+     * Powers of two from one block to past 4 * MaxBurstLength, plus one
+     * block either side of FirstBurstLength and MaxBurstLength.
+     */
+    max_blocks = num_blocks < SWEEP_MAX_BLOCKS ? (uint32_t)num_blocks : SWEEP_MAX_BLOCKS;
+    fb_blocks = conn.first_burst_length / block_size;
+    mb_blocks = conn.max_burst_length / block_size;
+    for (uint32_t b = 1; b <= max_blocks; b *= 2) {
+        sweep_add_size(sizes, &size_count, b, max_blocks);
+        if ((uint64_t)b * block_size > 4ULL * conn.max_burst_length) {
+            break;
+        }
+    }
+    for (int d = -1; d <= 1; d++) {
+        sweep_add_size(sizes, &size_count, fb_blocks + d, max_blocks);
+        sweep_add_size(sizes, &size_count, mb_blocks + d, max_blocks);
+    }
+    qsort(sizes, size_count, sizeof(sizes[0]), sweep_cmp_size);
+
+    write_buf = buffer_pool_get((size_t)sizes[size_count - 1] * block_size);
+    read_buf = buffer_pool_get((size_t)sizes[size_count - 1] * block_size);
+    if (!write_buf || !read_buf) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        iscsi_raw_close(&conn);
+        return TEST_ERROR;
+    }
+
+    /* Each size gets duration seconds, half writing and half reading */
+    phase_ns = config->bench_duration * 1000000000ULL / 2;
+
+    for (int i = 0; i < size_count; i++) {
+        uint32_t blocks = sizes[i];
+        uint64_t bytes = (uint64_t)blocks * block_size;
+        uint64_t write_ns = 0, read_ns = 0;
+        int64_t write_ops, read_ops;
+        pattern_mismatch_t mismatch;
+
+        /* One verified round trip at LBA 0 before timing this size */
+        pattern_fill_blocks(write_buf, 0, blocks, block_size, i + 1, 0x5eed);
+        if (iscsi_raw_write10(&conn, config->lun, 0, blocks, block_size, write_buf) != 0 ||
+            iscsi_raw_read10(&conn, config->lun, 0, blocks, block_size, read_buf) != 0) {
+            snprintf(msg, sizeof(msg), "Verify I/O failed at %u blocks (SCSI status 0x%02x)",
+                     blocks, conn.last_scsi_status);
+            report_set_result(report, TEST_FAIL, msg);
+            goto fail;
+        }
+        if (pattern_verify_blocks(read_buf, 0, blocks, block_size, i + 1, 0x5eed, &mismatch) != 0) {
+            char detail[256];
+
+            pattern_format_mismatch(&mismatch, detail, sizeof(detail));
+            snprintf(msg, sizeof(msg), "Data mismatch at %u blocks: %s", blocks, detail);
+            report_set_result(report, TEST_FAIL, msg);
+            goto fail;
+        }
+
+        iscsi_raw_reset_counters(&conn);
+        write_ops = raw_run_phase(&conn, config->lun, report->latency, blocks, block_size,
+                                  num_blocks, write_buf, 1, phase_ns, &write_ns);
+        results[i].r2t_per_op = write_ops > 0 ? (double)conn.r2t_received / write_ops : 0.0;
+        results[i].data_out_per_op = write_ops > 0 ? (double)conn.data_out_sent / write_ops : 0.0;
+
+        iscsi_raw_reset_counters(&conn);
+        read_ops = write_ops < 0 ? -1 :
+                   raw_run_phase(&conn, config->lun, report->latency, blocks, block_size,
+                                 num_blocks, read_buf, 0, phase_ns, &read_ns);
+        results[i].data_in_per_op = read_ops > 0 ? (double)conn.data_in_received / read_ops : 0.0;
+
+        if (write_ops < 0 || read_ops < 0) {
+            snprintf(msg, sizeof(msg), "%s failed at %u blocks (SCSI status 0x%02x)",
+                     write_ops < 0 ? "Write" : "Read", blocks, conn.last_scsi_status);
+            report_set_result(report, TEST_FAIL, msg);
+            goto fail;
+        }
+
+        report->bytes += bytes * (uint64_t)(write_ops + read_ops);
+        results[i].blocks = blocks;
+        results[i].write_mb_per_sec = write_ns ? bytes * write_ops / (write_ns / 1e9) / 1000000.0 : 0.0;
+        results[i].read_mb_per_sec = read_ns ? bytes * read_ops / (read_ns / 1e9) / 1000000.0 : 0.0;
+    }
+
+    off = snprintf(msg, sizeof(msg),
+                   "ImmediateData=%s InitialR2T=%s FirstBurst=%u MaxBurst=%u MaxXmitDSL=%u",
+                   conn.immediate_data ? "Yes" : "No", conn.initial_r2t ? "Yes" : "No",
+                   conn.first_burst_length, conn.max_burst_length,
+                   conn.max_xmit_data_segment_length);
+    for (int i = 0; i < size_count && off < sizeof(msg); i++) {
+        off += snprintf(msg + off, sizeof(msg) - off,
+                        "\n       %5u blk %8.1f KiB: write %9.2f MB/s  R2T %5.1f  Data-Out %6.1f"
+                        "  | read %9.2f MB/s  Data-In %6.1f",
+                        results[i].blocks, results[i].blocks * (double)block_size / 1024.0,
+                        results[i].write_mb_per_sec, results[i].r2t_per_op,
+                        results[i].data_out_per_op, results[i].read_mb_per_sec,
+                        results[i].data_in_per_op);
+    }
+
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    iscsi_raw_close(&conn);
+    report_set_result(report, TEST_PASS, msg);
+    return TEST_PASS;
+
+fail:
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    iscsi_raw_close(&conn);
+    return TEST_FAIL;
+}
+
+#define NEG_MAX_COMBINATIONS (4 * MAX_NEGOTIATION_VALUES * MAX_NEGOTIATION_VALUES * MAX_NEGOTIATION_VALUES)
+
+/* One row of the negotiation matrix */
+typedef struct {
+    iscsi_raw_params_t offered;
+    int login_failed;
+    uint32_t first_burst_length;    /* As negotiated */
+    uint32_t max_burst_length;
+    double write_mb_per_sec;
+    double write_p50_ms;
+    double write_p99_ms;
+    double read_mb_per_sec;
+    double read_p50_ms;
+    double read_p99_ms;
+} neg_result_t;
+
+/* TP-005: Negotiation Parameter Matrix */
+static test_result_t test_negotiation_matrix(struct iscsi_context *unused_iscsi,
+                                             test_config_t *config,
+                                             test_report_t *report) {
+    uint64_t num_blocks;
+    uint32_t block_size;
+    uint32_t blocks;
+    uint64_t bytes;
+    uint64_t phase_ns;
+    neg_result_t *results;
+    int result_count = 0;
+    int best_write = -1, best_read = -1;
+    uint8_t *buffer;
+    test_result_t ret;
+    char *msg;
+    size_t msg_size;
+    size_t off;
+
+    (void)unused_iscsi;
+
+    ret = raw_bench_prepare(config, report, &num_blocks, &block_size);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+
+    if (config->neg_io_blocks <= 0 || config->neg_io_blocks > SWEEP_MAX_BLOCKS ||
+        config->neg_first_burst_count == 0 || config->neg_max_burst_count == 0 ||
+        config->neg_max_recv_dsl_count == 0) {
+        report_set_result(report, TEST_SKIP, "Negotiation matrix parameters not configured");
+        return TEST_SKIP;
+    }
+    blocks = (uint32_t)config->neg_io_blocks;
+    bytes = (uint64_t)blocks * block_size;
+    if (num_blocks < blocks) {
+        report_set_result(report, TEST_SKIP, "Device too small for negotiation_io_blocks");
+        return TEST_SKIP;
+    }
+
+    results = calloc(NEG_MAX_COMBINATIONS, sizeof(neg_result_t));
+    buffer = buffer_pool_get(bytes);
+    if (!results || !buffer) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        free(results);
+        buffer_pool_put(buffer);
+        return TEST_ERROR;
+    }
+    pattern_fill_blocks(buffer, 0, blocks, block_size, 1, 0x5eed);
+
+    /* Same budget per combination as the other benchmarks: half write, half read */
+    phase_ns = config->bench_duration * 1000000000ULL / 2;
+
+    for (int imm = 1; imm >= 0; imm--) {
+        for (int r2t = 1; r2t >= 0; r2t--) {
+            for (int f = 0; f < config->neg_first_burst_count; f++) {
+                for (int m = 0; m < config->neg_max_burst_count; m++) {
+                    for (int d = 0; d < config->neg_max_recv_dsl_count; d++) {
+                        neg_result_t *r = &results[result_count];
+                        iscsi_raw_conn_t conn;
+                        latency_hist_t write_hist, read_hist;
+                        uint64_t write_ns = 0, read_ns = 0;
+                        int64_t write_ops, read_ops = -1;
+
+                        /* RFC 7143: FirstBurstLength may not exceed MaxBurstLength */
+                        if (config->neg_first_burst_lengths[f] > config->neg_max_burst_lengths[m]) {
+                            continue;
+                        }
+
+                        r->offered.immediate_data = imm;
+                        r->offered.initial_r2t = r2t;
+                        r->offered.first_burst_length = (uint32_t)config->neg_first_burst_lengths[f];
+                        r->offered.max_burst_length = (uint32_t)config->neg_max_burst_lengths[m];
+                        r->offered.max_recv_data_segment_length = (uint32_t)config->neg_max_recv_dsls[d];
+                        result_count++;
+
+                        if (raw_bench_login(&conn, config, &r->offered) != 0) {
+                            r->login_failed = 1;
+                            continue;
+                        }
+                        r->first_burst_length = conn.first_burst_length;
+                        r->max_burst_length = conn.max_burst_length;
+
+                        latency_hist_reset(&write_hist);
+                        latency_hist_reset(&read_hist);
+                        write_ops = raw_run_phase(&conn, config->lun, &write_hist, blocks, block_size,
+                                                  num_blocks, buffer, 1, phase_ns, &write_ns);
+                        if (write_ops >= 0) {
+                            read_ops = raw_run_phase(&conn, config->lun, &read_hist, blocks, block_size,
+                                                     num_blocks, buffer, 0, phase_ns, &read_ns);
+                        }
+                        iscsi_raw_close(&conn);
+
+                        if (write_ops < 0 || read_ops < 0) {
+                            char err[256];
+
+                            snprintf(err, sizeof(err),
+                                     "%s failed with ImmediateData=%s InitialR2T=%s FirstBurst=%u "
+                                     "MaxBurst=%u MaxRecvDSL=%u",
+                                     write_ops < 0 ? "Write" : "Read", imm ? "Yes" : "No",
+                                     r2t ? "Yes" : "No", r->offered.first_burst_length,
+                                     r->offered.max_burst_length,
+                                     r->offered.max_recv_data_segment_length);
+                            report_set_result(report, TEST_FAIL, err);
+                            free(results);
+                            buffer_pool_put(buffer);
+                            return TEST_FAIL;
+                        }
+
+                        latency_hist_merge(report->latency, &write_hist);
+                        latency_hist_merge(report->latency, &read_hist);
+                        report->bytes += bytes * (uint64_t)(write_ops + read_ops);
+
+                        r->write_mb_per_sec = write_ns ? bytes * write_ops / (write_ns / 1e9) / 1000000.0 : 0.0;
+                        r->write_p50_ms = latency_hist_percentile(&write_hist, 0.50) / 1e6;
+                        r->write_p99_ms = latency_hist_percentile(&write_hist, 0.99) / 1e6;
+                        r->read_mb_per_sec = read_ns ? bytes * read_ops / (read_ns / 1e9) / 1000000.0 : 0.0;
+                        r->read_p50_ms = latency_hist_percentile(&read_hist, 0.50) / 1e6;
+                        r->read_p99_ms = latency_hist_percentile(&read_hist, 0.99) / 1e6;
+
+                        if (best_write < 0 || r->write_mb_per_sec > results[best_write].write_mb_per_sec) {
+                            best_write = result_count - 1;
+                        }
+                        if (best_read < 0 || r->read_mb_per_sec > results[best_read].read_mb_per_sec) {
+                            best_read = result_count - 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    buffer_pool_put(buffer);
+
+    if (best_write < 0) {
+        report_set_result(report, TEST_FAIL, "Target rejected every parameter combination");
+        free(results);
+        return TEST_FAIL;
+    }
+
+    msg_size = 256 + (size_t)result_count * 192;
+    msg = malloc(msg_size);
+    if (!msg) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        free(results);
+        return TEST_ERROR;
+    }
+
+    /* Best combinations first, then one line per combination as offered */
+    off = snprintf(msg, msg_size,
+                   "%u KiB sequential, %d combinations; best write %.2f MB/s (#%d), best read %.2f MB/s (#%d)"
+                   "\n         #  Imm R2T  FirstBurst   MaxBurst  MaxRecvDSL |"
+                   "     write MB/s   p50 ms   p99 ms |      read MB/s   p50 ms   p99 ms",
+                   (unsigned)(bytes / 1024), result_count,
+                   results[best_write].write_mb_per_sec, best_write + 1,
+                   results[best_read].read_mb_per_sec, best_read + 1);
+    for (int i = 0; i < result_count && off < msg_size; i++) {
+        neg_result_t *r = &results[i];
+
+        off += snprintf(msg + off, msg_size - off, "\n       %3d  %-3s %-3s  %10u %10u  %10u |",
+                        i + 1, r->offered.immediate_data ? "Yes" : "No",
+                        r->offered.initial_r2t ? "Yes" : "No", r->offered.first_burst_length,
+                        r->offered.max_burst_length, r->offered.max_recv_data_segment_length);
+        if (off >= msg_size) {
+            break;
+        }
+        if (r->login_failed) {
+            off += snprintf(msg + off, msg_size - off, " login rejected");
+            continue;
+        }
+        off += snprintf(msg + off, msg_size - off,
+                        " %14.2f %8.3f %8.3f | %14.2f %8.3f %8.3f",
+                        r->write_mb_per_sec, r->write_p50_ms, r->write_p99_ms,
+                        r->read_mb_per_sec, r->read_p50_ms, r->read_p99_ms);
+        /* The target may answer with smaller bursts than offered */
+        if (off < msg_size && (r->first_burst_length != r->offered.first_burst_length ||
+                               r->max_burst_length != r->offered.max_burst_length)) {
+            off += snprintf(msg + off, msg_size - off, "  (negotiated %u/%u)",
+                            r->first_burst_length, r->max_burst_length);
+        }
+    }
+
+    report_set_result(report, TEST_PASS, msg);
+    free(msg);
+    free(results);
+    return TEST_PASS;
+}
+
+#define DIGEST_MODES 3
+
+/* TP-006: Digest Overhead */
+static test_result_t test_digest_overhead(struct iscsi_context *unused_iscsi,
+                                          test_config_t *config,
+                                          test_report_t *report) {
+    static const uint32_t sizes[] = { 1, 8, 64, 256, 1024, 4096 };
+    static const char *mode_names[DIGEST_MODES] = { "None", "Header", "Header+Data" };
+    enum { SIZE_COUNT = sizeof(sizes) / sizeof(sizes[0]) };
+    double write_mbps[DIGEST_MODES][SIZE_COUNT];
+    double read_mbps[DIGEST_MODES][SIZE_COUNT];
+    uint64_t num_blocks;
+    uint32_t block_size;
+    int size_count = 0;
+    uint8_t *buffer;
+    uint64_t phase_ns;
+    uint64_t crc_bytes = 0, crc_start, crc_ns;
+    volatile uint32_t crc_sink = 0;
+    test_result_t ret;
+    char msg[2048];
+    size_t off;
+
+    (void)unused_iscsi;
+
+    ret = raw_bench_prepare(config, report, &num_blocks, &block_size);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+
+    while (size_count < SIZE_COUNT && sizes[size_count] <= num_blocks) {
+        size_count++;
+    }
+    if (size_count == 0) {
+        report_set_result(report, TEST_SKIP, "Device too small");
+        return TEST_SKIP;
+    }
+
+    buffer = buffer_pool_get((size_t)sizes[size_count - 1] * block_size);
+    if (!buffer) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        return TEST_ERROR;
+    }
+    pattern_fill_blocks(buffer, 0, sizes[size_count - 1], block_size, 1, 0x5eed);
+
+    /* Local CRC32C throughput over the largest transfer, for scale */
+    crc_start = latency_now_ns();
+    do {
+        crc_sink ^= crc32c(buffer, (size_t)sizes[size_count - 1] * block_size);
+        crc_bytes += (uint64_t)sizes[size_count - 1] * block_size;
+        crc_ns = latency_now_ns() - crc_start;
+    } while (crc_ns < 100000000ULL);
+    (void)crc_sink;
+
+    phase_ns = config->bench_duration * 1000000000ULL / 2;
+
+    for (int mode = 0; mode < DIGEST_MODES; mode++) {
+        iscsi_raw_params_t params = { -1, -1, 0, 0, 0, mode >= 1, mode >= 2, 0 };
+        iscsi_raw_conn_t conn;
+
+        if (raw_bench_login(&conn, config, &params) != 0) {
+            snprintf(msg, sizeof(msg), "Login with %s digests failed", mode_names[mode]);
+            report_set_result(report, TEST_FAIL, msg);
+            buffer_pool_put(buffer);
+            return TEST_FAIL;
+        }
+        if (conn.header_digest != (mode >= 1) || conn.data_digest != (mode >= 2)) {
+            snprintf(msg, sizeof(msg), "Target did not negotiate %s digests", mode_names[mode]);
+            report_set_result(report, TEST_FAIL, msg);
+            iscsi_raw_close(&conn);
+            buffer_pool_put(buffer);
+            return TEST_FAIL;
+        }
+
+        for (int i = 0; i < size_count; i++) {
+            uint64_t bytes = (uint64_t)sizes[i] * block_size;
+            uint64_t write_ns = 0, read_ns = 0;
+            int64_t write_ops, read_ops = -1;
+
+            write_ops = raw_run_phase(&conn, config->lun, report->latency, sizes[i], block_size,
+                                      num_blocks, buffer, 1, phase_ns, &write_ns);
+            if (write_ops >= 0) {
+                read_ops = raw_run_phase(&conn, config->lun, report->latency, sizes[i], block_size,
+                                         num_blocks, buffer, 0, phase_ns, &read_ns);
+            }
+            if (write_ops < 0 || read_ops < 0) {
+                snprintf(msg, sizeof(msg), "%s failed at %u blocks with %s digests (%llu digest errors)",
+                         write_ops < 0 ? "Write" : "Read", sizes[i], mode_names[mode],
+                         (unsigned long long)conn.digest_errors);
+                report_set_result(report, TEST_FAIL, msg);
+                iscsi_raw_close(&conn);
+                buffer_pool_put(buffer);
+                return TEST_FAIL;
+            }
+
+            report->bytes += bytes * (uint64_t)(write_ops + read_ops);
+            write_mbps[mode][i] = write_ns ? bytes * write_ops / (write_ns / 1e9) / 1000000.0 : 0.0;
+            read_mbps[mode][i] = read_ns ? bytes * read_ops / (read_ns / 1e9) / 1000000.0 : 0.0;
+        }
+        iscsi_raw_close(&conn);
+    }
+    buffer_pool_put(buffer);
+
+    /* Overhead is the throughput lost relative to no digests at the same size */
+    off = snprintf(msg, sizeof(msg), "CRC32C (%s) %.2f GB/s locally; MB/s write/read and %% overhead vs None",
+                   crc32c_hardware() ? "hardware" : "table", crc_bytes / (crc_ns / 1e9) / 1e9);
+    for (int i = 0; i < size_count && off < sizeof(msg); i++) {
+        off += snprintf(msg + off, sizeof(msg) - off, "\n       %5u blk:", sizes[i]);
+        for (int mode = 0; mode < DIGEST_MODES && off < sizeof(msg); mode++) {
+            double w = write_mbps[0][i] > 0 ? 100.0 * (1.0 - write_mbps[mode][i] / write_mbps[0][i]) : 0.0;
+            double r = read_mbps[0][i] > 0 ? 100.0 * (1.0 - read_mbps[mode][i] / read_mbps[0][i]) : 0.0;
+
+            if (mode == 0) {
+                off += snprintf(msg + off, sizeof(msg) - off, "  %s %8.2f/%8.2f",
+                                mode_names[mode], write_mbps[mode][i], read_mbps[mode][i]);
+            } else {
+                off += snprintf(msg + off, sizeof(msg) - off, "  %s %8.2f/%8.2f (%+.1f%%/%+.1f%%)",
+                                mode_names[mode], write_mbps[mode][i], read_mbps[mode][i], w, r);
+            }
+        }
+    }
+
+    report_set_result(report, TEST_PASS, msg);
+    return TEST_PASS;
+}
+
+#define PIPELINE_MAX_DEPTH BENCH_MAX_QUEUE_DEPTH
+
+static uint32_t bench_be32(const uint8_t *buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+           ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+/*
+ * Send depth NOP-Out pings in one batch, then collect the NOP-Ins, which
+ * must come back in the order sent. Each ping's latency runs from the
+ * batch send to its own NOP-In. Returns 0 on success, -1 on error.
+ */
+static int raw_ping_batch(iscsi_raw_conn_t *conn, int depth, uint8_t (*bhs)[48],
+                          iscsi_raw_pdu_t *pdus, latency_hist_t *hist) {
+    uint32_t first_itt = 0;
+    uint64_t start;
+
+    for (int i = 0; i < depth; i++) {
+        uint32_t itt = iscsi_raw_build_nop_out(conn, bhs[i]);
+
+        if (i == 0) {
+            first_itt = itt;
+        }
+        pdus[i].bhs = bhs[i];
+        pdus[i].data = NULL;
+        pdus[i].data_len = 0;
+    }
+
+    start = latency_now_ns();
+    if (iscsi_raw_send_pdus(conn, pdus, depth) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < depth; i++) {
+        uint8_t in[48];
+        const uint8_t *data;
+        uint32_t data_len;
+
+        if (iscsi_raw_recv_pdu(conn, in, &data, &data_len) != 0 ||
+            (in[0] & 0x3F) != 0x20 || bench_be32(in + 16) != first_itt + (uint32_t)i) {
+            return -1;
+        }
+        conn->exp_stat_sn = bench_be32(in + 24) + 1;
+        latency_hist_record(hist, start, latency_now_ns());
+    }
+    return 0;
+}
+
+/* TP-007: Pipelined NOP-Out Throughput */
+static test_result_t test_pipelined_nop(struct iscsi_context *unused_iscsi,
+                                        test_config_t *config,
+                                        test_report_t *report) {
+    uint8_t bhs[PIPELINE_MAX_DEPTH][48];
+    iscsi_raw_pdu_t pdus[PIPELINE_MAX_DEPTH];
+    latency_hist_t hist;
+    iscsi_raw_conn_t conn;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    double rate[MAX_BENCH_QUEUE_DEPTHS];
+    double p50_us[MAX_BENCH_QUEUE_DEPTHS];
+    double p99_us[MAX_BENCH_QUEUE_DEPTHS];
+    int depths[MAX_BENCH_QUEUE_DEPTHS];
+    int depth_count = 0;
+    test_result_t ret;
+    char msg[2048];
+    size_t off;
+
+    (void)unused_iscsi;
+
+    if (config->bench_queue_depth_count == 0) {
+        report_set_result(report, TEST_SKIP, "Benchmark parameters not configured");
+        return TEST_SKIP;
+    }
+    ret = raw_bench_prepare(config, report, &num_blocks, &block_size);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+    if (raw_bench_login(&conn, config, NULL) != 0) {
+        report_set_result(report, TEST_FAIL, "Raw session login failed");
+        return TEST_FAIL;
+    }
+    iscsi_raw_set_timeout(&conn, config->timeout);
+
+    /*
+     * Immediate NOP-Outs take no CmdSN, so the batch size is limited only
+     * by the socket buffers and how fast the target turns PDUs around.
+     */
+    for (int i = 0; i < config->bench_queue_depth_count; i++) {
+        int depth = config->bench_queue_depths[i];
+        uint64_t end;
+
+        if (depth < 1) {
+            depth = 1;
+        }
+        if (depth > PIPELINE_MAX_DEPTH) {
+            depth = PIPELINE_MAX_DEPTH;
+        }
+
+        latency_hist_reset(&hist);
+        end = latency_now_ns() + config->bench_duration * 1000000000ULL;
+        do {
+            if (raw_ping_batch(&conn, depth, bhs, pdus, &hist) != 0) {
+                snprintf(msg, sizeof(msg), "Pipelined ping failed at depth %d after %llu NOP-Ins",
+                         depth, (unsigned long long)hist.total);
+                report_set_result(report, TEST_FAIL, msg);
+                iscsi_raw_close(&conn);
+                return TEST_FAIL;
+            }
+        } while (latency_now_ns() < end);
+
+        latency_hist_merge(report->latency, &hist);
+        depths[depth_count] = depth;
+        rate[depth_count] = latency_hist_ops_per_sec(&hist);
+        p50_us[depth_count] = latency_hist_percentile(&hist, 0.50) / 1e3;
+        p99_us[depth_count] = latency_hist_percentile(&hist, 0.99) / 1e3;
+        depth_count++;
+    }
+    iscsi_raw_close(&conn);
+
+    off = snprintf(msg, sizeof(msg), "NOP-Out/NOP-In round trips per second by batch depth");
+    for (int i = 0; i < depth_count && off < sizeof(msg); i++) {
+        off += snprintf(msg + off, sizeof(msg) - off,
+                        "\n       depth %3d: %10.0f PDUs/s (x%.2f vs depth %d)  p50 %.1fus  p99 %.1fus",
+                        depths[i], rate[i], rate[0] > 0 ? rate[i] / rate[0] : 0.0, depths[0],
+                        p50_us[i], p99_us[i]);
+    }
+
+    report_set_result(report, TEST_PASS, msg);
+    return TEST_PASS;
+}
+
+#define WINDOW_MAX_INFLIGHT BENCH_MAX_QUEUE_DEPTH
+#define WINDOW_OVERRUN 4
+
+/* TP-008: CmdSN Window Saturation */
+static test_result_t test_cmdsn_window(struct iscsi_context *unused_iscsi,
+                                       test_config_t *config,
+                                       test_report_t *report) {
+    uint8_t bhs[WINDOW_MAX_INFLIGHT][48];
+    iscsi_raw_pdu_t pdus[WINDOW_MAX_INFLIGHT];
+    uint64_t sent_ns[WINDOW_MAX_INFLIGHT];
+    uint8_t inflight[WINDOW_MAX_INFLIGHT];
+    latency_hist_t base_hist, hist;
+    iscsi_raw_conn_t conn;
+    uint64_t num_blocks;
+    uint32_t block_size, io_blocks;
+    uint8_t *buffer;
+    uint64_t phase_ns, base_ns = 0, sat_start, sat_ns, now, end;
+    uint64_t lba = 0, ops = 0, window_full = 0, stat_sn_gaps = 0;
+    int64_t base_ops;
+    uint32_t first_itt, next_stat_sn, outstanding = 0, max_outstanding = 0;
+    uint32_t login_window, min_window = UINT32_MAX, max_window = 0;
+    uint32_t overrun_sent = 0, overrun_done = 0;
+    test_result_t ret;
+    char msg[1024];
+
+    (void)unused_iscsi;
+
+    ret = raw_bench_prepare(config, report, &num_blocks, &block_size);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+    if (config->bench_io_blocks <= 0 || num_blocks < (uint64_t)config->bench_io_blocks) {
+        report_set_result(report, TEST_SKIP, "Device too small for benchmark I/O size");
+        return TEST_SKIP;
+    }
+    io_blocks = (uint32_t)config->bench_io_blocks;
+
+    buffer = buffer_pool_get((size_t)io_blocks * block_size);
+    if (!buffer) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        return TEST_ERROR;
+    }
+    if (raw_bench_login(&conn, config, NULL) != 0) {
+        report_set_result(report, TEST_FAIL, "Raw session login failed");
+        buffer_pool_put(buffer);
+        return TEST_FAIL;
+    }
+    iscsi_raw_set_timeout(&conn, config->timeout);
+    login_window = iscsi_raw_window_available(&conn);
+    phase_ns = config->bench_duration * 1000000000ULL / 2;
+
+    /* Baseline: one READ(10) at a time */
+    latency_hist_reset(&base_hist);
+    base_ops = raw_run_phase(&conn, config->lun, &base_hist, io_blocks, block_size,
+                             num_blocks, buffer, 0, phase_ns, &base_ns);
+    buffer_pool_put(buffer);
+    if (base_ops < 0) {
+        report_set_result(report, TEST_FAIL, "Baseline READ(10) failed");
+        iscsi_raw_close(&conn);
+        return TEST_FAIL;
+    }
+
+    /*
+     * Saturated: after every status, refill with as many READ(10)s as
+     * MaxCmdSN allows, all in one writev. Statuses may complete out of
+     * order, but their StatSNs must still count up by one.
+     */
+    latency_hist_reset(&hist);
+    memset(inflight, 0, sizeof(inflight));
+    first_itt = conn.itt;
+    next_stat_sn = conn.exp_stat_sn;
+    sat_start = now = latency_now_ns();
+    end = sat_start + phase_ns;
+
+    while (now < end || outstanding > 0) {
+        uint32_t itt, stat_sn, slot;
+
+        if (now < end) {
+            uint32_t room = iscsi_raw_window_available(&conn);
+            int batch = 0;
+
+            if (room > WINDOW_MAX_INFLIGHT - outstanding) {
+                room = WINDOW_MAX_INFLIGHT - outstanding;
+            }
+            while ((uint32_t)batch < room) {
+                slot = (conn.itt - first_itt) % WINDOW_MAX_INFLIGHT;
+                if (inflight[slot]) {
+                    break;      /* An older command still holds this slot */
+                }
+                if (lba + io_blocks > num_blocks) {
+                    lba = 0;
+                }
+                iscsi_raw_build_read10(&conn, bhs[slot], config->lun, (uint32_t)lba,
+                                       io_blocks, block_size);
+                inflight[slot] = 1;
+                sent_ns[slot] = now;
+                pdus[batch].bhs = bhs[slot];
+                pdus[batch].data = NULL;
+                pdus[batch].data_len = 0;
+                batch++;
+                lba += io_blocks;
+            }
+            if (batch == 0) {
+                window_full++;
+            } else if (iscsi_raw_send_pdus(&conn, pdus, batch) != 0) {
+                report_set_result(report, TEST_FAIL, "Sending pipelined commands failed");
+                iscsi_raw_close(&conn);
+                return TEST_FAIL;
+            }
+            outstanding += (uint32_t)batch;
+            if (outstanding > max_outstanding) {
+                max_outstanding = outstanding;
+            }
+        }
+        if (outstanding == 0) {
+            if (now < end) {
+                report_set_result(report, TEST_FAIL, "Target closed the CmdSN window with no commands outstanding");
+                iscsi_raw_close(&conn);
+                return TEST_FAIL;
+            }
+            break;
+        }
+
+        if (iscsi_raw_recv_status(&conn, &itt, &stat_sn) != 0) {
+            snprintf(msg, sizeof(msg), "Lost the session with %u commands outstanding (reject 0x%02x)",
+                     outstanding, conn.last_reject_reason);
+            report_set_result(report, TEST_FAIL, msg);
+            iscsi_raw_close(&conn);
+            return TEST_FAIL;
+        }
+        now = latency_now_ns();
+
+        slot = (itt - first_itt) % WINDOW_MAX_INFLIGHT;
+        if (itt - first_itt >= conn.itt - first_itt || !inflight[slot]) {
+            snprintf(msg, sizeof(msg), "Status for ITT 0x%08x, which is not outstanding", itt);
+            report_set_result(report, TEST_FAIL, msg);
+            iscsi_raw_close(&conn);
+            return TEST_FAIL;
+        }
+        if (conn.last_scsi_status != 0) {
+            snprintf(msg, sizeof(msg), "READ(10) failed with SCSI status 0x%02x at %u outstanding",
+                     conn.last_scsi_status, outstanding);
+            report_set_result(report, TEST_FAIL, msg);
+            iscsi_raw_close(&conn);
+            return TEST_FAIL;
+        }
+        if (stat_sn != next_stat_sn) {
+            stat_sn_gaps++;
+        }
+        next_stat_sn = stat_sn + 1;
+
+        {
+            uint32_t window = conn.max_cmd_sn - conn.exp_cmd_sn + 1;
+
+            if (window < min_window) min_window = window;
+            if (window > max_window) max_window = window;
+        }
+
+        latency_hist_record(&hist, sent_ns[slot], now);
+        inflight[slot] = 0;
+        outstanding--;
+        ops++;
+    }
+    sat_ns = now - sat_start;
+    latency_hist_merge(report->latency, &base_hist);
+    latency_hist_merge(report->latency, &hist);
+    report->bytes += (uint64_t)(base_ops + (int64_t)ops) * io_blocks * block_size;
+
+    if (stat_sn_gaps > 0 || conn.exp_cmd_sn != conn.cmd_sn) {
+        snprintf(msg, sizeof(msg), "%llu StatSN gaps; ExpCmdSN %u after the run, expected %u",
+                 (unsigned long long)stat_sn_gaps, conn.exp_cmd_sn, conn.cmd_sn);
+        report_set_result(report, TEST_FAIL, msg);
+        iscsi_raw_close(&conn);
+        return TEST_FAIL;
+    }
+
+    /*
+     * Overrun: RFC 3720 Section 3.2.2.1 has the target silently ignore
+     * commands beyond MaxCmdSN. Push a few past it and count how many are
+     * executed anyway. This leaves the CmdSN stream broken, so the
+     * connection is dropped afterwards.
+     */
+    iscsi_raw_set_timeout(&conn, config->timeout > 2 ? 2 : config->timeout);
+    overrun_sent = iscsi_raw_window_available(&conn) + WINDOW_OVERRUN;
+    if (overrun_sent > WINDOW_MAX_INFLIGHT) {
+        overrun_sent = WINDOW_MAX_INFLIGHT;
+    }
+    for (uint32_t i = 0; i < overrun_sent; i++) {
+        iscsi_raw_build_read10(&conn, bhs[i], config->lun, 0, 1, block_size);
+        pdus[i].bhs = bhs[i];
+        pdus[i].data = NULL;
+        pdus[i].data_len = 0;
+    }
+    if (iscsi_raw_send_pdus(&conn, pdus, (int)overrun_sent) == 0) {
+        uint32_t itt, stat_sn;
+
+        while (overrun_done < overrun_sent && iscsi_raw_recv_status(&conn, &itt, &stat_sn) == 0) {
+            overrun_done++;
+        }
+    }
+    conn.full_feature = 0;
+    iscsi_raw_close(&conn);
+
+    snprintf(msg, sizeof(msg),
+             "window %u at login, %u-%u while saturated; up to %u in flight, full %llu times\n"
+             "       QD1:       %9.0f IOPS  p50 %.3fms  p99 %.3fms\n"
+             "       saturated: %9.0f IOPS  p50 %.3fms  p99 %.3fms  (x%.2f), StatSN in order\n"
+             "       %u of %u commands sent past MaxCmdSN were executed%s",
+             login_window, min_window == UINT32_MAX ? 0 : min_window, max_window,
+             max_outstanding, (unsigned long long)window_full,
+             base_ns ? base_ops / (base_ns / 1e9) : 0.0,
+             latency_hist_percentile(&base_hist, 0.50) / 1e6,
+             latency_hist_percentile(&base_hist, 0.99) / 1e6,
+             sat_ns ? ops / (sat_ns / 1e9) : 0.0,
+             latency_hist_percentile(&hist, 0.50) / 1e6,
+             latency_hist_percentile(&hist, 0.99) / 1e6,
+             base_ns && base_ops && sat_ns ? (ops / (sat_ns / 1e9)) / (base_ops / (base_ns / 1e9)) : 0.0,
+             overrun_done > overrun_sent - WINDOW_OVERRUN ? overrun_done - (overrun_sent - WINDOW_OVERRUN) : 0,
+             WINDOW_OVERRUN,
+             overrun_done > overrun_sent - WINDOW_OVERRUN ? " (should be ignored)" : "");
+
+    report_set_result(report, TEST_PASS, msg);
+    return TEST_PASS;
+}
+
+#define MCS_MAX_CONNECTIONS 4
+
+/* One connection of the TP-009 session and the load it drives */
+typedef struct {
+    iscsi_raw_conn_t conn;
+    int open;
+    test_config_t *config;
+    uint8_t *buffer;
+    uint32_t io_blocks;
+    uint32_t block_size;
+    uint64_t num_blocks;
+    int write;
+    uint64_t duration_ns;
+    latency_hist_t hist;
+    int64_t ops;
+    uint64_t elapsed_ns;
+} mcs_conn_t;
+
+static void* mcs_thread_func(void *arg) {
+    mcs_conn_t *c = (mcs_conn_t *)arg;
+
+    c->ops = raw_run_phase(&c->conn, c->config->lun, &c->hist, c->io_blocks, c->block_size,
+                           c->num_blocks, c->buffer, c->write, c->duration_ns, &c->elapsed_ns);
+    return NULL;
+}
+
+/*
+ * Run the same phase on the first count connections at once. Returns the
+ * aggregate MB/s, or -1 if a connection failed (its index in *failed).
+ */
+static double mcs_run_phase(mcs_conn_t *conns, int count, int write, uint64_t duration_ns,
+                            latency_hist_t *merged, uint64_t *total_bytes, int *failed) {
+    pthread_t threads[MCS_MAX_CONNECTIONS];
+    uint64_t bytes = 0, elapsed = 0;
+    int created = 0;
+
+    for (int i = 0; i < count; i++) {
+        conns[i].write = write;
+        conns[i].duration_ns = duration_ns;
+        conns[i].ops = -1;
+        latency_hist_reset(&conns[i].hist);
+        if (pthread_create(&threads[i], NULL, mcs_thread_func, &conns[i]) != 0) {
+            break;
+        }
+        created++;
+    }
+    for (int i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (conns[i].ops < 0) {
+            *failed = i;
+            return -1;
+        }
+        latency_hist_merge(merged, &conns[i].hist);
+        bytes += (uint64_t)conns[i].ops * conns[i].io_blocks * conns[i].block_size;
+        if (conns[i].elapsed_ns > elapsed) {
+            elapsed = conns[i].elapsed_ns;
+        }
+    }
+    *total_bytes += bytes;
+    return elapsed ? bytes / (elapsed / 1e9) / 1000000.0 : 0.0;
+}
+
+static void mcs_close_all(mcs_conn_t *conns) {
+    /* Joined connections first: they share the leading one's CmdSN counter */
+    for (int i = MCS_MAX_CONNECTIONS - 1; i >= 0; i--) {
+        if (conns[i].open) {
+            iscsi_raw_close(&conns[i].conn);
+            conns[i].open = 0;
+        }
+    }
+}
+
+/* TP-009: Multi-Connection Session Throughput */
+static test_result_t test_mcs_throughput(struct iscsi_context *unused_iscsi,
+                                         test_config_t *config,
+                                         test_report_t *report) {
+    static const int steps[] = { 1, 2, MCS_MAX_CONNECTIONS };
+    enum { STEP_COUNT = sizeof(steps) / sizeof(steps[0]) };
+    iscsi_raw_params_t params = { -1, -1, 0, 0, 0, 0, 0, MCS_MAX_CONNECTIONS };
+    mcs_conn_t *conns;
+    double write_mbps[STEP_COUNT], read_mbps[STEP_COUNT];
+    uint64_t num_blocks, phase_ns;
+    uint32_t block_size, io_blocks, negotiated;
+    int step_count = 0, failed = 0;
+    test_result_t ret;
+    char msg[1024];
+    size_t off;
+
+    (void)unused_iscsi;
+
+    ret = raw_bench_prepare(config, report, &num_blocks, &block_size);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+    if (config->bench_io_blocks <= 0 || num_blocks < (uint64_t)config->bench_io_blocks) {
+        report_set_result(report, TEST_SKIP, "Device too small for benchmark I/O size");
+        return TEST_SKIP;
+    }
+    io_blocks = (uint32_t)config->bench_io_blocks;
+
+    conns = calloc(MCS_MAX_CONNECTIONS, sizeof(*conns));
+    if (!conns) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        return TEST_ERROR;
+    }
+    for (int i = 0; i < MCS_MAX_CONNECTIONS; i++) {
+        conns[i].config = config;
+        conns[i].io_blocks = io_blocks;
+        conns[i].block_size = block_size;
+        conns[i].num_blocks = num_blocks;
+        conns[i].buffer = buffer_pool_get((size_t)io_blocks * block_size);
+        if (!conns[i].buffer) {
+            report_set_result(report, TEST_ERROR, "Memory allocation failed");
+            ret = TEST_ERROR;
+            goto out;
+        }
+        pattern_fill_blocks(conns[i].buffer, 0, io_blocks, block_size, i + 1, 0x5eed);
+    }
+
+    /* The leading connection asks for room to add the others */
+    if (raw_bench_login(&conns[0].conn, config, &params) != 0) {
+        report_set_result(report, TEST_ERROR, "Raw session login failed");
+        ret = TEST_ERROR;
+        goto out;
+    }
+    conns[0].open = 1;
+    negotiated = conns[0].conn.max_connections;
+    if (negotiated < 2) {
+        snprintf(msg, sizeof(msg), "Target does not allow multiple connections per session "
+                 "(MaxConnections=%u)", negotiated);
+        report_set_result(report, TEST_SKIP, msg);
+        ret = TEST_SKIP;
+        goto out;
+    }
+
+    /* The session's duration is split evenly between steps, half writing */
+    phase_ns = config->bench_duration * 1000000000ULL / (2 * STEP_COUNT);
+
+    for (int s = 0; s < STEP_COUNT && (uint32_t)steps[s] <= negotiated; s++) {
+        int count = steps[s];
+
+        /* Grow the session to count connections, all sharing its TSIH */
+        for (int i = 1; i < count; i++) {
+            if (conns[i].open) {
+                continue;
+            }
+            if (iscsi_raw_connect(&conns[i].conn, config->portal) != 0) {
+                snprintf(msg, sizeof(msg), "Connection %d could not connect", i + 1);
+                report_set_result(report, TEST_ERROR, msg);
+                ret = TEST_ERROR;
+                goto out;
+            }
+            conns[i].open = 1;
+            iscsi_raw_join_session(&conns[i].conn, &conns[0].conn, (uint16_t)i);
+            if (iscsi_raw_login(&conns[i].conn, "iqn.2024-12.com.test:initiator",
+                                config->iqn, &params) != 0) {
+                snprintf(msg, sizeof(msg), "Connection %d could not join session TSIH 0x%04x",
+                         i + 1, conns[0].conn.tsih);
+                report_set_result(report, TEST_FAIL, msg);
+                ret = TEST_FAIL;
+                goto out;
+            }
+            if (conns[i].conn.tsih != conns[0].conn.tsih) {
+                snprintf(msg, sizeof(msg), "Connection %d got TSIH 0x%04x, session has 0x%04x",
+                         i + 1, conns[i].conn.tsih, conns[0].conn.tsih);
+                report_set_result(report, TEST_FAIL, msg);
+                ret = TEST_FAIL;
+                goto out;
+            }
+        }
+
+        write_mbps[s] = mcs_run_phase(conns, count, 1, phase_ns, report->latency,
+                                      &report->bytes, &failed);
+        read_mbps[s] = write_mbps[s] < 0 ? -1 :
+                       mcs_run_phase(conns, count, 0, phase_ns, report->latency,
+                                     &report->bytes, &failed);
+        if (write_mbps[s] < 0 || read_mbps[s] < 0) {
+            snprintf(msg, sizeof(msg), "%s failed on connection %d of %d (SCSI status 0x%02x)",
+                     write_mbps[s] < 0 ? "Write" : "Read", failed + 1, count,
+                     conns[failed].conn.last_scsi_status);
+            report_set_result(report, TEST_FAIL, msg);
+            ret = TEST_FAIL;
+            goto out;
+        }
+        step_count++;
+    }
+
+    off = snprintf(msg, sizeof(msg), "MaxConnections=%u, %u-block I/O, MB/s write/read per session",
+                   negotiated, io_blocks);
+    for (int s = 0; s < step_count && off < sizeof(msg); s++) {
+        off += snprintf(msg + off, sizeof(msg) - off,
+                        "\n       %d conn: %9.2f / %9.2f  (x%.2f / x%.2f vs 1)",
+                        steps[s], write_mbps[s], read_mbps[s],
+                        write_mbps[0] > 0 ? write_mbps[s] / write_mbps[0] : 0.0,
+                        read_mbps[0] > 0 ? read_mbps[s] / read_mbps[0] : 0.0);
+    }
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    mcs_close_all(conns);
+    for (int i = 0; i < MCS_MAX_CONNECTIONS; i++) {
+        buffer_pool_put(conns[i].buffer);
+    }
+    free(conns);
+    return ret;
+}
+
+#define CACHE_SIZES 4
+
+/*
+ * Sequential blocks-sized writes, with or without FUA, for duration_ns,
+ * wrapping at the end of the device. Returns the number of writes, or -1.
+ */
+static int64_t cache_write_phase(struct iscsi_context *iscsi, int lun, uint32_t blocks,
+                                 uint32_t block_size, uint64_t num_blocks, const uint8_t *buffer,
+                                 int fua, uint64_t duration_ns, uint64_t *elapsed_ns) {
+    uint64_t start = latency_now_ns();
+    uint64_t end = start + duration_ns;
+    uint64_t now = start;
+    uint64_t lba = 0;
+    int64_t ops = 0;
+
+    while (now < end || ops == 0) {
+        int ret;
+
+        if (lba + blocks > num_blocks) {
+            lba = 0;
+        }
+        ret = fua ? scsi_write_blocks_fua(iscsi, lun, lba, blocks, block_size, buffer)
+                  : scsi_write_blocks(iscsi, lun, lba, blocks, block_size, buffer);
+        if (ret != 0) {
+            return -1;
+        }
+        lba += blocks;
+        ops++;
+        now = latency_now_ns();
+    }
+
+    *elapsed_ns = now - start;
+    return ops;
+}
+
+/* WCE bit of the Caching mode page: 1, 0, or -1 if the target has no such page */
+static int bench_write_cache_enabled(struct iscsi_context *iscsi, int lun) {
+    struct scsi_task *task;
+    const uint8_t *data;
+    size_t off;
+    int wce = -1;
+
+    task = iscsi_modesense6_sync(iscsi, lun, 1, SCSI_MODESENSE_PC_CURRENT,
+                                 SCSI_MODEPAGE_CACHING, 0, 255);
+    if (task && task->status == SCSI_STATUS_GOOD && task->datain.size >= 4) {
+        data = task->datain.data;
+        off = 4 + data[3];
+        if (off + 3 <= (size_t)task->datain.size && (data[off] & 0x3F) == SCSI_MODEPAGE_CACHING) {
+            wce = (data[off + 2] >> 2) & 1;
+        }
+    }
+    if (task) scsi_free_scsi_task(task);
+    return wce;
+}
+
+/*
+ * TP-010: Small Sequential Write Cache
+ *
+ * For 1, 2, 4 and 8 block transfers, runs sequential writes without FUA
+ * and then SYNCHRONIZE CACHE, and the same writes with FUA set. The plain
+ * rate is charged for the flush that makes its writes durable, so the gain
+ * is what a write-back cache saves over writing through. With WCE=0 both
+ * rates should match.
+ */
+static test_result_t test_write_cache_gain(struct iscsi_context *unused_iscsi,
+                                           test_config_t *config,
+                                           test_report_t *report) {
+    static const uint32_t sizes[CACHE_SIZES] = {1, 2, 4, 8};
+    struct iscsi_context *iscsi;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    uint8_t *buffer = NULL;
+    double plain_iops[CACHE_SIZES], fua_iops[CACHE_SIZES], flush_ms[CACHE_SIZES];
+    uint64_t phase_ns;
+    test_result_t ret = TEST_ERROR;
+    char msg[2048];
+    size_t off;
+    int wce;
+
+    (void)unused_iscsi;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+    if (config->bench_duration <= 0) {
+        report_set_result(report, TEST_SKIP, "Benchmark parameters not configured");
+        return TEST_SKIP;
+    }
+
+    iscsi = create_iscsi_context_for_test(config);
+    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        if (iscsi) iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+    if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        goto out;
+    }
+    if (num_blocks < sizes[CACHE_SIZES - 1]) {
+        report_set_result(report, TEST_SKIP, "Device too small for benchmark I/O size");
+        ret = TEST_SKIP;
+        goto out;
+    }
+
+    buffer = buffer_pool_get((size_t)sizes[CACHE_SIZES - 1] * block_size);
+    if (!buffer) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        goto out;
+    }
+    memset(buffer, 0xA5, (size_t)sizes[CACHE_SIZES - 1] * block_size);
+
+    wce = bench_write_cache_enabled(iscsi, config->lun);
+    phase_ns = config->bench_duration * 1000000000ULL / (2 * CACHE_SIZES);
+
+    for (int i = 0; i < CACHE_SIZES; i++) {
+        uint64_t plain_ns = 0, fua_ns = 0, flush_start, flush_ns;
+        int64_t plain_ops, fua_ops;
+
+        plain_ops = cache_write_phase(iscsi, config->lun, sizes[i], block_size, num_blocks,
+                                      buffer, 0, phase_ns, &plain_ns);
+        if (plain_ops < 0) {
+            snprintf(msg, sizeof(msg), "%u-block write failed", sizes[i]);
+            report_set_result(report, TEST_FAIL, msg);
+            ret = TEST_FAIL;
+            goto out;
+        }
+        flush_start = latency_now_ns();
+        if (scsi_sync_cache(iscsi, config->lun, 0, 0) != 0) {
+            report_set_result(report, TEST_FAIL, "SYNCHRONIZE CACHE(10) failed");
+            ret = TEST_FAIL;
+            goto out;
+        }
+        flush_ns = latency_now_ns() - flush_start;
+
+        fua_ops = cache_write_phase(iscsi, config->lun, sizes[i], block_size, num_blocks,
+                                    buffer, 1, phase_ns, &fua_ns);
+        if (fua_ops < 0) {
+            snprintf(msg, sizeof(msg), "%u-block write with FUA failed", sizes[i]);
+            report_set_result(report, TEST_FAIL, msg);
+            ret = TEST_FAIL;
+            goto out;
+        }
+
+        plain_iops[i] = plain_ops * 1e9 / (double)(plain_ns + flush_ns);
+        fua_iops[i] = fua_ops * 1e9 / (double)fua_ns;
+        flush_ms[i] = flush_ns / 1e6;
+    }
+
+    off = snprintf(msg, sizeof(msg), "WCE=%s, IOPS without FUA (incl. flush) / with FUA",
+                   wce < 0 ? "n/a" : wce ? "1" : "0");
+    for (int i = 0; i < CACHE_SIZES && off < sizeof(msg); i++) {
+        off += snprintf(msg + off, sizeof(msg) - off,
+                        "\n       %u blk: %10.0f / %10.0f  (x%.2f, flush %.2f ms)",
+                        sizes[i], plain_iops[i], fua_iops[i],
+                        fua_iops[i] > 0 ? plain_iops[i] / fua_iops[i] : 0.0, flush_ms[i]);
+    }
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    buffer_pool_put(buffer);
+    iscsi_disconnect_target(iscsi);
+    iscsi_destroy_context(iscsi);
+    return ret;
+}
+
+/*
+ * Run count sessions' workloads together, each at depth, for duration
+ * seconds into *result, scraping the target around them when
+ * metrics_endpoint is set. Returns 0, or -1 with the report failed (what
+ * names the phase). After a failure the contexts must be torn down with
+ * iscsi_disconnect, as commands may still be outstanding.
+ */
+static int bench_phase_runs(test_config_t *config, test_report_t *report, bench_run_t **runs,
+                            int count, int depth, const char *what, bench_result_t *result) {
+    bench_run_t *failed = NULL;
+    latency_hist_t merged;
+    target_metrics_t before;
+    int have_before = bench_scrape_target(config, &before) == 0;
+    uint64_t start = latency_now_ns();
+    uint64_t errors = 0, completed = 0;
+    char msg[512];
+
+    for (int i = 0; i < count; i++) {
+        bench_start(runs[i], depth);
+    }
+    if (bench_poll(runs, count, start + config->bench_duration * 1000000000ULL,
+                   config->timeout * 1000000000ULL, &failed) != 0) {
+        snprintf(msg, sizeof(msg), "Event loop failed in %s QD %d: %s",
+                 what, depth, iscsi_get_error(failed->iscsi));
+        report_set_result(report, TEST_FAIL, msg);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        errors += runs[i]->errors;
+        completed += runs[i]->completed;
+    }
+    if (errors > 0) {
+        snprintf(msg, sizeof(msg), "%llu of %llu commands failed in %s QD %d",
+                 (unsigned long long)errors,
+                 (unsigned long long)(errors + completed), what, depth);
+        report_set_result(report, TEST_FAIL, msg);
+        return -1;
+    }
+
+    bench_summarize(runs, count, latency_now_ns() - start, &merged, result);
+    latency_hist_merge(report->latency, &merged);
+    report->bytes += result->bytes;
+    result->queue_depth = depth;
+    result->sessions = count;
+    bench_finish_scrape(config, have_before, &before, result);
+    return 0;
+}
+
+/* bench_phase_runs for a single session */
+static int bench_phase(test_config_t *config, test_report_t *report, bench_run_t *run,
+                       int depth, const char *what, bench_result_t *result) {
+    bench_run_t *runs[1] = { run };
+
+    return bench_phase_runs(config, report, runs, 1, depth, what, result);
+}
+
+#define PROFILE_PHASES 4
+#define PROFILE_MAX_DEPTH 32
+
+/* One workload of the backend profile */
+typedef struct {
+    const char *name;
+    int read_percent;
+    int depth;
+} profile_phase_t;
+
+/*
+ * TP-011: Storage Backend Profile
+ *
+ * A fixed set of random-I/O workloads meant to be run once per backend
+ * (for example simple_target with ISCSI_BACKEND=memory, mmap:PATH and
+ * direct:PATH) and compared: QD1 reads show per-command service time,
+ * QD32 reads and writes show how far the backend overlaps commands, and
+ * the closing SYNCHRONIZE CACHE shows what it costs to make the writes
+ * durable. With metrics_endpoint set, each phase also shows the target's
+ * own device time, which separates the backend from the network path.
+ */
+static test_result_t test_backend_profile(struct iscsi_context *unused_iscsi,
+                                          test_config_t *config,
+                                          test_report_t *report) {
+    static const profile_phase_t phases[PROFILE_PHASES] = {
+        {"random read", 100, 1},
+        {"random read", 100, PROFILE_MAX_DEPTH},
+        {"random write", 0, PROFILE_MAX_DEPTH},
+        {"70/30 mixed", 70, PROFILE_MAX_DEPTH / 2},
+    };
+    struct iscsi_context *iscsi;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    bench_run_t run;
+    bench_result_t results[PROFILE_PHASES];
+    uint64_t flush_start, flush_ns;
+    test_result_t ret = TEST_ERROR;
+    char msg[4096];
+    size_t off;
+
+    (void)unused_iscsi;
+    memset(&run, 0, sizeof(run));
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+    if (config->bench_io_blocks <= 0 || config->bench_duration <= 0) {
+        report_set_result(report, TEST_SKIP, "Benchmark parameters not configured");
+        return TEST_SKIP;
+    }
+
+    iscsi = create_iscsi_context_for_test(config);
+    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        if (iscsi) iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+    if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        goto out;
+    }
+    if (num_blocks < (uint64_t)config->bench_io_blocks) {
+        report_set_result(report, TEST_SKIP, "Device too small for benchmark I/O size");
+        ret = TEST_SKIP;
+        goto out;
+    }
+    if (bench_run_init(&run, iscsi, config->lun, block_size, (uint32_t)config->bench_io_blocks,
+                       0, num_blocks, 100, PROFILE_MAX_DEPTH, 12345) != 0) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        goto out;
+    }
+
+    for (int i = 0; i < PROFILE_PHASES; i++) {
+        run.read_percent = phases[i].read_percent;
+        if (bench_phase(config, report, &run, phases[i].depth, phases[i].name, &results[i]) != 0) {
+            ret = TEST_FAIL;
+            goto out;
+        }
+    }
+
+    flush_start = latency_now_ns();
+    if (scsi_sync_cache(iscsi, config->lun, 0, 0) != 0) {
+        report_set_result(report, TEST_FAIL, "SYNCHRONIZE CACHE(10) failed");
+        ret = TEST_FAIL;
+        goto out;
+    }
+    flush_ns = latency_now_ns() - flush_start;
+
+    off = snprintf(msg, sizeof(msg), "%u KiB I/O, SYNCHRONIZE CACHE after the writes %.2f ms",
+                   (run.io_blocks * block_size) / 1024, flush_ns / 1e6);
+    for (int i = 0; i < PROFILE_PHASES && off < sizeof(msg); i++) {
+        off += snprintf(msg + off, sizeof(msg) - off,
+                        "\n       %-12s QD %2d: %9.0f IOPS %9.2f MB/s  p50 %.3fms  p99 %.3fms  p999 %.3fms",
+                        phases[i].name, results[i].queue_depth, results[i].iops,
+                        results[i].mb_per_sec, results[i].p50_ms, results[i].p99_ms,
+                        results[i].p999_ms);
+        off = bench_append_server(msg, sizeof(msg), off, &results[i]);
+    }
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    /* Destroy the context first: it completes outstanding tasks into our slots */
+    if (ret == TEST_FAIL) {
+        iscsi_disconnect(iscsi);
+    } else {
+        iscsi_disconnect_target(iscsi);
+    }
+    iscsi_destroy_context(iscsi);
+    bench_run_free(&run);
+    return ret;
+}
+
+#define HIGH_LBA_PHASES 3
+#define HIGH_LBA_DEPTH 32
+#define LBA_32BIT_LIMIT 0x100000000ULL
+
+/*
+ * TP-012: High-LBA Random I/O
+ *
+ * Compares random reads over the first 2^32 blocks, addressed with
+ * READ(10), against random reads and writes over the rest of the LUN,
+ * which need READ(16)/WRITE(16). A target whose lookup cost grows with the
+ * LBA (sparse maps, extent trees, thin provisioning) shows it as a gap
+ * between the first two lines. Skipped on LUNs of 2^32 blocks or fewer.
+ */
+static test_result_t test_high_lba_random(struct iscsi_context *unused_iscsi,
+                                          test_config_t *config,
+                                          test_report_t *report) {
+    static const char *names[HIGH_LBA_PHASES] = {"low read", "high read", "high write"};
+    struct iscsi_context *iscsi;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    bench_run_t low, high;
+    bench_run_t *phase_runs[HIGH_LBA_PHASES] = { &low, &high, &high };
+    bench_result_t results[HIGH_LBA_PHASES];
+    test_result_t ret = TEST_ERROR;
+    char msg[4096];
+    size_t off;
+
+    (void)unused_iscsi;
+    memset(&low, 0, sizeof(low));
+    memset(&high, 0, sizeof(high));
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+    if (config->bench_io_blocks <= 0 || config->bench_duration <= 0) {
+        report_set_result(report, TEST_SKIP, "Benchmark parameters not configured");
+        return TEST_SKIP;
+    }
+
+    iscsi = create_iscsi_context_for_test(config);
+    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        if (iscsi) iscsi_destroy_context(iscsi);
+        return TEST_ERROR;
+    }
+    if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        goto out;
+    }
+    if (num_blocks < LBA_32BIT_LIMIT + (uint64_t)config->bench_io_blocks) {
+        snprintf(msg, sizeof(msg), "LUN has %llu blocks; high-LBA I/O needs more than 2^32",
+                 (unsigned long long)num_blocks);
+        report_set_result(report, TEST_SKIP, msg);
+        ret = TEST_SKIP;
+        goto out;
+    }
+    if (bench_run_init(&low, iscsi, config->lun, block_size, (uint32_t)config->bench_io_blocks,
+                       0, LBA_32BIT_LIMIT, 100, HIGH_LBA_DEPTH, 12345) != 0 ||
+        bench_run_init(&high, iscsi, config->lun, block_size, (uint32_t)config->bench_io_blocks,
+                       LBA_32BIT_LIMIT, num_blocks - LBA_32BIT_LIMIT, 100, HIGH_LBA_DEPTH,
+                       54321) != 0) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        goto out;
+    }
+
+    for (int i = 0; i < HIGH_LBA_PHASES; i++) {
+        phase_runs[i]->read_percent = i < 2 ? 100 : 0;
+        if (bench_phase(config, report, phase_runs[i], HIGH_LBA_DEPTH, names[i],
+                        &results[i]) != 0) {
+            ret = TEST_FAIL;
+            goto out;
+        }
+    }
+
+    off = snprintf(msg, sizeof(msg),
+                   "%.2f TiB LUN, %u KiB I/O, high/low read IOPS %.2f",
+                   (double)num_blocks * block_size / (1024.0 * 1024 * 1024 * 1024),
+                   (low.io_blocks * block_size) / 1024,
+                   results[0].iops > 0 ? results[1].iops / results[0].iops : 0.0);
+    for (int i = 0; i < HIGH_LBA_PHASES && off < sizeof(msg); i++) {
+        off += snprintf(msg + off, sizeof(msg) - off,
+                        "\n       %-10s QD %2d: %9.0f IOPS %9.2f MB/s  p50 %.3fms  p99 %.3fms  p999 %.3fms",
+                        names[i], results[i].queue_depth, results[i].iops,
+                        results[i].mb_per_sec, results[i].p50_ms, results[i].p99_ms,
+                        results[i].p999_ms);
+        off = bench_append_server(msg, sizeof(msg), off, &results[i]);
+    }
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    /* Destroy the context first: it completes outstanding tasks into our slots */
+    if (ret == TEST_FAIL) {
+        iscsi_disconnect(iscsi);
+    } else {
+        iscsi_disconnect_target(iscsi);
+    }
+    iscsi_destroy_context(iscsi);
+    bench_run_free(&low);
+    bench_run_free(&high);
+    return ret;
+}
+
+#define MULTI_LUN_MAX_LUNS 16
+#define MULTI_LUN_DEPTH 8
+
+/*
+ * TP-013: Multi-LUN Parallel I/O
+ *
+ * One session per reported LUN (up to 16) runs random writes at QD 8, in
+ * two phases: first every session writes its own window of the LUN under
+ * test, then each writes its own LUN, all at once. The working set and
+ * command mix are the same, so the IOPS ratio between them shows how much
+ * the LUNs contend inside the target: near 1 when LUNs share a lock or a
+ * backend, higher when each LUN is an independent lock domain on a device
+ * that serialises writes. Skipped on targets with fewer than two LUNs.
+ */
+static test_result_t test_multi_lun_parallel(struct iscsi_context *unused_iscsi,
+                                             test_config_t *config,
+                                             test_report_t *report) {
+    static const char *names[2] = {"one LUN", "all LUNs"};
+    struct iscsi_context *sessions[MULTI_LUN_MAX_LUNS] = { NULL };
+    bench_run_t shared[MULTI_LUN_MAX_LUNS], spread[MULTI_LUN_MAX_LUNS];
+    bench_run_t *phase_runs[2][MULTI_LUN_MAX_LUNS];
+    bench_result_t results[2];
+    int luns[MULTI_LUN_MAX_LUNS];
+    uint64_t num_blocks, window_blocks = UINT64_MAX;
+    uint32_t block_size = 0;
+    uint64_t spread_completed = 0;
+    int count;
+    test_result_t ret = TEST_ERROR;
+    char msg[4096];
+    size_t off;
+
+    (void)unused_iscsi;
+    memset(shared, 0, sizeof(shared));
+    memset(spread, 0, sizeof(spread));
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+    if (config->bench_io_blocks <= 0 || config->bench_duration <= 0) {
+        report_set_result(report, TEST_SKIP, "Benchmark parameters not configured");
+        return TEST_SKIP;
+    }
+
+    sessions[0] = create_iscsi_context_for_test(config);
+    if (!sessions[0] || iscsi_connect_target(sessions[0], config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        if (sessions[0]) iscsi_destroy_context(sessions[0]);
+        return TEST_ERROR;
+    }
+    count = scsi_report_luns(sessions[0], luns, MULTI_LUN_MAX_LUNS);
+    if (count < 0) {
+        report_set_result(report, TEST_ERROR, "REPORT LUNS failed");
+        iscsi_disconnect_target(sessions[0]);
+        iscsi_destroy_context(sessions[0]);
+        return TEST_ERROR;
+    }
+    if (count < 2) {
+        snprintf(msg, sizeof(msg), "Target reports %d LUN; multi-LUN I/O needs at least 2", count);
+        report_set_result(report, TEST_SKIP, msg);
+        iscsi_disconnect_target(sessions[0]);
+        iscsi_destroy_context(sessions[0]);
+        return TEST_SKIP;
+    }
+
+    /* Every session gets the same window size: the smallest LUN split count ways */
+    for (int i = 0; i < count; i++) {
+        uint32_t lun_block_size;
+
+        if (scsi_read_capacity(sessions[0], luns[i], &num_blocks, &lun_block_size) != 0) {
+            snprintf(msg, sizeof(msg), "Failed to get capacity of LUN %d", luns[i] & 0x3FFF);
+            report_set_result(report, TEST_ERROR, msg);
+            goto out;
+        }
+        if (block_size != 0 && lun_block_size != block_size) {
+            report_set_result(report, TEST_SKIP, "LUNs have different block sizes");
+            ret = TEST_SKIP;
+            goto out;
+        }
+        block_size = lun_block_size;
+        if (num_blocks < window_blocks) {
+            window_blocks = num_blocks;
+        }
+    }
+    window_blocks /= count;
+    window_blocks -= window_blocks % config->bench_io_blocks;
+    if (window_blocks < (uint64_t)config->bench_io_blocks) {
+        report_set_result(report, TEST_SKIP, "LUNs too small for one LBA window per session");
+        ret = TEST_SKIP;
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            sessions[i] = create_iscsi_context_for_test(config);
+            if (!sessions[i] || iscsi_connect_target(sessions[i], config) != 0) {
+                snprintf(msg, sizeof(msg), "Failed to connect session %d", i + 1);
+                report_set_result(report, TEST_ERROR, msg);
+                if (sessions[i]) iscsi_destroy_context(sessions[i]);
+                sessions[i] = NULL;
+                goto out;
+            }
+        }
+        if (bench_run_init(&shared[i], sessions[i], config->lun, block_size,
+                           (uint32_t)config->bench_io_blocks, i * window_blocks, window_blocks,
+                           0, MULTI_LUN_DEPTH, 12345 + i) != 0 ||
+            bench_run_init(&spread[i], sessions[i], luns[i], block_size,
+                           (uint32_t)config->bench_io_blocks, 0, window_blocks,
+                           0, MULTI_LUN_DEPTH, 54321 + i) != 0) {
+            report_set_result(report, TEST_ERROR, "Memory allocation failed");
+            goto out;
+        }
+        phase_runs[0][i] = &shared[i];
+        phase_runs[1][i] = &spread[i];
+    }
+
+    for (int p = 0; p < 2; p++) {
+        if (bench_phase_runs(config, report, phase_runs[p], count, MULTI_LUN_DEPTH, names[p],
+                             &results[p]) != 0) {
+            ret = TEST_FAIL;
+            goto out;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        spread_completed += spread[i].completed;
+    }
+
+    off = snprintf(msg, sizeof(msg),
+                   "%d sessions, %u KiB random writes, all/one LUN IOPS %.2f",
+                   count, (config->bench_io_blocks * block_size) / 1024,
+                   results[0].iops > 0 ? results[1].iops / results[0].iops : 0.0);
+    for (int p = 0; p < 2 && off < sizeof(msg); p++) {
+        off += snprintf(msg + off, sizeof(msg) - off,
+                        "\n       %-8s QD %d x%d: %9.0f IOPS %9.2f MB/s  p50 %.3fms  p99 %.3fms  p999 %.3fms",
+                        names[p], results[p].queue_depth, results[p].sessions, results[p].iops,
+                        results[p].mb_per_sec, results[p].p50_ms, results[p].p99_ms,
+                        results[p].p999_ms);
+        off = bench_append_server(msg, sizeof(msg), off, &results[p]);
+    }
+    /* Per-LUN share of the last phase, to show one LUN is not starved */
+    for (int i = 0; i < count && off < sizeof(msg); i++) {
+        off += snprintf(msg + off, sizeof(msg) - off, "%s LUN %d %.0f",
+                        i == 0 ? "\n       per LUN IOPS:" : ",", luns[i] & 0x3FFF,
+                        spread_completed > 0 ? results[1].iops * spread[i].completed / spread_completed : 0.0);
+    }
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    /* Destroy the contexts first: they complete outstanding tasks into our slots */
+    for (int i = 0; i < count; i++) {
+        if (!sessions[i]) {
+            continue;
+        }
+        if (ret == TEST_FAIL) {
+            iscsi_disconnect(sessions[i]);
+        } else {
+            iscsi_disconnect_target(sessions[i]);
+        }
+        iscsi_destroy_context(sessions[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        bench_run_free(&shared[i]);
+        bench_run_free(&spread[i]);
+    }
+    return ret;
+}
+
+#define LOGIN_MAX_THREADS BENCH_MAX_LOAD_THREADS
+#define LOGIN_MAX_STEPS 8
+#define LOGIN_VARIANTS 2
+
+/* One TP-014 login thread: log in and out back to back until the deadline */
+typedef struct {
+    test_config_t *config;      /* Config of the auth variant under test */
+    uint64_t duration_ns;
+    load_gate_t *gate;
+
+    latency_hist_t hist;        /* Connect-to-logged-in time of each login */
+    uint64_t logins;
+    int failed;
+    uint64_t elapsed_ns;
+    char error_msg[256];
+} login_thread_data_t;
+
+static void* login_thread_func(void *arg) {
+    login_thread_data_t *data = (login_thread_data_t *)arg;
+    uint64_t start, end_ns;
+    int go;
+
+    pthread_mutex_lock(&data->gate->lock);
+    data->gate->ready++;
+    pthread_cond_broadcast(&data->gate->cond);
+    while (data->gate->go == 0) {
+        pthread_cond_wait(&data->gate->cond, &data->gate->lock);
+    }
+    go = data->gate->go;
+    pthread_mutex_unlock(&data->gate->lock);
+    if (go < 0) {
+        return NULL;
+    }
+
+    start = latency_now_ns();
+    end_ns = start + data->duration_ns;
+    while (latency_now_ns() < end_ns) {
+        struct iscsi_context *iscsi = create_iscsi_context_for_test(data->config);
+        uint64_t login_start;
+
+        if (!iscsi) {
+            snprintf(data->error_msg, sizeof(data->error_msg), "Failed to create iSCSI context");
+            data->failed = 1;
+            break;
+        }
+        login_start = latency_now_ns();
+        if (iscsi_connect_target(iscsi, data->config) != 0) {
+            snprintf(data->error_msg, sizeof(data->error_msg), "%s", iscsi_get_error(iscsi));
+            data->failed = 1;
+            iscsi_destroy_context(iscsi);
+            break;
+        }
+        latency_hist_record(&data->hist, login_start, latency_now_ns());
+        data->logins++;
+        iscsi_disconnect_target(iscsi);
+        iscsi_destroy_context(iscsi);
+    }
+    data->elapsed_ns = latency_now_ns() - start;
+    return NULL;
+}
+
+/*
+ * Run one TP-014 step: num_threads threads logging in and out for the
+ * benchmark duration. Returns 0 when every thread ran, -1 if threads could
+ * not be created.
+ */
+static int run_login_step(test_config_t *variant, login_thread_data_t *thread_data,
+                          int num_threads, uint64_t duration_ns) {
+    pthread_t threads[LOGIN_MAX_THREADS];
+    load_gate_t gate;
+    int created = 0;
+
+    pthread_mutex_init(&gate.lock, NULL);
+    pthread_cond_init(&gate.cond, NULL);
+    gate.ready = 0;
+    gate.go = 0;
+
+    for (int i = 0; i < num_threads; i++) {
+        memset(&thread_data[i], 0, sizeof(thread_data[i]));
+        thread_data[i].config = variant;
+        thread_data[i].duration_ns = duration_ns;
+        thread_data[i].gate = &gate;
+        latency_hist_reset(&thread_data[i].hist);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, login_thread_func, &thread_data[i]) != 0) {
+            break;
+        }
+        created++;
+    }
+
+    pthread_mutex_lock(&gate.lock);
+    while (gate.ready < created) {
+        pthread_cond_wait(&gate.cond, &gate.lock);
+    }
+    gate.go = (created == num_threads) ? 1 : -1;
+    pthread_cond_broadcast(&gate.cond);
+    pthread_mutex_unlock(&gate.lock);
+
+    for (int i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&gate.cond);
+    pthread_mutex_destroy(&gate.lock);
+
+    return (created == num_threads) ? 0 : -1;
+}
+
+/* One login to check a variant is accepted before timing it */
+static int login_probe(test_config_t *variant, char *error, size_t size) {
+    struct iscsi_context *iscsi = create_iscsi_context_for_test(variant);
+
+    if (!iscsi) {
+        snprintf(error, size, "Failed to create iSCSI context");
+        return -1;
+    }
+    if (iscsi_connect_target(iscsi, variant) != 0) {
+        snprintf(error, size, "%s", iscsi_get_error(iscsi));
+        iscsi_destroy_context(iscsi);
+        return -1;
+    }
+    iscsi_disconnect_target(iscsi);
+    iscsi_destroy_context(iscsi);
+    return 0;
+}
+
+/*
+ * TP-014: Login Throughput
+ *
+ * Reconnect storms are bounded by how fast the target can take sessions
+ * through login. Each thread logs in and out back to back for the
+ * benchmark duration, at 1, 2, 4, ... up to load_threads threads, first
+ * without authentication and then with CHAP when credentials are
+ * configured. Reports complete login/logout cycles per second and the
+ * login latency percentiles (TCP connect through full feature phase, as
+ * iscsi_connect_target performs it): the TL-004 and TL-006 login loops,
+ * timed and scaled up. A variant the target refuses (no-auth logins
+ * against a CHAP-only target) is noted and skipped; a step where logins
+ * start failing is reported as the limit rather than a failure.
+ */
+static test_result_t test_login_throughput(struct iscsi_context *unused_iscsi,
+                                           test_config_t *config,
+                                           test_report_t *report) {
+    static const char *names[LOGIN_VARIANTS] = {"none", "CHAP"};
+    test_config_t variants[LOGIN_VARIANTS];
+    int enabled[LOGIN_VARIANTS] = {1, 0};
+    bench_result_t results[LOGIN_VARIANTS][LOGIN_MAX_STEPS];
+    int result_count[LOGIN_VARIANTS] = {0, 0};
+    char notes[LOGIN_VARIANTS][320];
+    int steps[LOGIN_MAX_STEPS];
+    int step_count = 0;
+    int max_threads = config->load_threads;
+    login_thread_data_t *thread_data;
+    uint64_t duration_ns;
+    latency_hist_t merged;
+    int measured = 0;
+    char msg[4096];
+    size_t off;
+
+    (void)unused_iscsi;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+    if (max_threads < 1 || max_threads > LOGIN_MAX_THREADS || config->bench_duration <= 0) {
+        report_set_result(report, TEST_SKIP, "Load generator parameters out of range");
+        return TEST_SKIP;
+    }
+    duration_ns = config->bench_duration * 1000000000ULL;
+
+    /* The same target and initiator, with and without CHAP credentials */
+    variants[0] = *config;
+    variants[0].auth_method = NULL;
+    variants[1] = *config;
+    if (config->auth_method && config->username && config->password &&
+        (strcmp(config->auth_method, "chap") == 0 || strcmp(config->auth_method, "mutual_chap") == 0)) {
+        enabled[1] = 1;
+    }
+
+    for (int t = 1; t < max_threads; t *= 2) {
+        steps[step_count++] = t;
+    }
+    steps[step_count++] = max_threads;
+
+    thread_data = calloc(max_threads, sizeof(login_thread_data_t));
+    if (!thread_data) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        return TEST_ERROR;
+    }
+
+    for (int v = 0; v < LOGIN_VARIANTS; v++) {
+        char error[256];
+
+        notes[v][0] = '\0';
+        if (!enabled[v]) {
+            continue;
+        }
+        if (login_probe(&variants[v], error, sizeof(error)) != 0) {
+            snprintf(notes[v], sizeof(notes[v]), "\n       %-4s: login rejected (%s)", names[v], error);
+            continue;
+        }
+
+        for (int step = 0; step < step_count; step++) {
+            bench_result_t *result = &results[v][result_count[v]];
+            uint64_t logins = 0, elapsed_ns = 0;
+            const char *first_error = NULL;
+
+            if (run_login_step(&variants[v], thread_data, steps[step], duration_ns) != 0) {
+                report_set_result(report, TEST_ERROR, "Failed to create login threads");
+                free(thread_data);
+                return TEST_ERROR;
+            }
+
+            latency_hist_reset(&merged);
+            for (int i = 0; i < steps[step]; i++) {
+                latency_hist_merge(&merged, &thread_data[i].hist);
+                logins += thread_data[i].logins;
+                if (thread_data[i].failed && !first_error) {
+                    first_error = thread_data[i].error_msg;
+                }
+                if (thread_data[i].elapsed_ns > elapsed_ns) {
+                    elapsed_ns = thread_data[i].elapsed_ns;
+                }
+            }
+            if (first_error) {
+                /* The target stopped accepting sessions; report the limit rather than fail */
+                snprintf(notes[v], sizeof(notes[v]), "\n       %-4s x%d: login failed (%s)",
+                         names[v], steps[step], first_error);
+                break;
+            }
+
+            memset(result, 0, sizeof(*result));
+            result->sessions = steps[step];
+            result->iops = elapsed_ns > 0 ? logins * 1e9 / elapsed_ns : 0.0;
+            result->p50_ms = latency_hist_percentile(&merged, 0.50) / 1e6;
+            result->p99_ms = latency_hist_percentile(&merged, 0.99) / 1e6;
+            result->p999_ms = latency_hist_percentile(&merged, 0.999) / 1e6;
+            latency_hist_merge(report->latency, &merged);
+            result_count[v]++;
+            measured++;
+        }
+    }
+    free(thread_data);
+
+    if (measured == 0) {
+        snprintf(msg, sizeof(msg), "No login step completed%s%s", notes[0], notes[1]);
+        report_set_result(report, TEST_FAIL, msg);
+        return TEST_FAIL;
+    }
+
+    off = snprintf(msg, sizeof(msg), "Login/logout cycles for %ds per step, up to %d threads",
+                   config->bench_duration, max_threads);
+    /* Single-thread cost of CHAP: its extra round trips plus the digest work */
+    if (result_count[0] > 0 && result_count[1] > 0 && results[0][0].p50_ms > 0) {
+        off += snprintf(msg + off, sizeof(msg) - off, ", CHAP/none p50 %.2f",
+                        results[1][0].p50_ms / results[0][0].p50_ms);
+    }
+    for (int v = 0; v < LOGIN_VARIANTS; v++) {
+        for (int i = 0; i < result_count[v] && off < sizeof(msg); i++) {
+            off += snprintf(msg + off, sizeof(msg) - off,
+                            "\n       %-4s x%-2d: %8.0f logins/s  p50 %.3fms  p99 %.3fms  p999 %.3fms",
+                            names[v], results[v][i].sessions, results[v][i].iops,
+                            results[v][i].p50_ms, results[v][i].p99_ms, results[v][i].p999_ms);
+        }
+        if (off < sizeof(msg)) {
+            off += snprintf(msg + off, sizeof(msg) - off, "%s", notes[v]);
+        }
+    }
+
+    report_set_result(report, TEST_PASS, msg);
+    return TEST_PASS;
+}
+
+#define ABORT_SET_TASKS 8
+#define ABORT_SET_EVERY 4           /* Every fourth round aborts a task set */
+#define ABORT_IDLE_ROUNDS 64
+
+/* The TP-015 raw connection and what its abort rounds measured */
+typedef struct {
+    iscsi_raw_conn_t conn;
+    int lun;
+    uint32_t lba;                   /* Target of the aborted writes; none should land */
+    uint32_t io_blocks;
+    uint32_t block_size;
+    uint64_t max_rounds;            /* 0 = until stop is set */
+    int stop;
+    uint64_t rounds;
+    latency_hist_t abort_hist;      /* ABORT TASK, one write outstanding */
+    latency_hist_t set_hist;        /* ABORT TASK SET, up to ABORT_SET_TASKS outstanding */
+    latency_hist_t nop_hist;        /* NOP-Out round trip after each abort */
+    int failed;
+    char error_msg[256];
+} abort_loop_t;
+
+/*
+ * One abort round: start WRITE(10)s with no data, wait for the target to
+ * ask for it, then abort them (one with ABORT TASK, or a batch with ABORT
+ * TASK SET every ABORT_SET_EVERY rounds) instead of sending it, and ping.
+ * Returns 0, or -1 with error_msg set.
+ */
+static int abort_round(abort_loop_t *a) {
+    uint8_t bhs[ABORT_SET_TASKS][48];
+    iscsi_raw_pdu_t pdus[ABORT_SET_TASKS];
+    int set = a->rounds % ABORT_SET_EVERY == ABORT_SET_EVERY - 1;
+    uint32_t count = 1, first_itt = 0, ref_cmd_sn = a->conn.cmd_sn;
+    uint64_t start, now;
+    int response;
+
+    if (set) {
+        count = iscsi_raw_window_available(&a->conn);
+        if (count > ABORT_SET_TASKS) count = ABORT_SET_TASKS;
+        if (count == 0) count = 1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t itt = iscsi_raw_build_write10(&a->conn, bhs[i], a->lun, a->lba,
+                                               a->io_blocks, a->block_size);
+
+        if (i == 0) {
+            first_itt = itt;
+        }
+        pdus[i].bhs = bhs[i];
+        pdus[i].data = NULL;
+        pdus[i].data_len = 0;
+    }
+    if (iscsi_raw_send_pdus(&a->conn, pdus, (int)count) != 0) {
+        snprintf(a->error_msg, sizeof(a->error_msg), "Sending WRITE(10) failed");
+        return -1;
+    }
+    /*
+     * Abort only once every write has its R2T sequence open on the target:
+     * R2Ts come in command order, so that is when the last write's first
+     * one arrives. Any more for a write longer than MaxBurstLength are
+     * skipped by iscsi_raw_task_mgmt.
+     */
+    for (;;) {
+        uint32_t itt, ttt, offset, length;
+
+        if (iscsi_raw_recv_r2t(&a->conn, &itt, &ttt, &offset, &length) != 0) {
+            snprintf(a->error_msg, sizeof(a->error_msg),
+                     "No R2T for %u WRITE(10)s (reject 0x%02x)",
+                     count, a->conn.last_reject_reason);
+            return -1;
+        }
+        if (itt == first_itt + count - 1) {
+            break;
+        }
+    }
+
+    start = latency_now_ns();
+    response = iscsi_raw_task_mgmt(&a->conn, set ? ISCSI_TMF_ABORT_TASK_SET : ISCSI_TMF_ABORT_TASK,
+                                   a->lun, first_itt, ref_cmd_sn);
+    now = latency_now_ns();
+    if (response != ISCSI_TMF_FUNCTION_COMPLETE) {
+        snprintf(a->error_msg, sizeof(a->error_msg),
+                 "%s of %u write(s) %s %d (reject 0x%02x)",
+                 set ? "ABORT TASK SET" : "ABORT TASK", count,
+                 response < 0 ? "failed" : "returned response", response,
+                 a->conn.last_reject_reason);
+        return -1;
+    }
+    latency_hist_record(set ? &a->set_hist : &a->abort_hist, start, now);
+
+    start = now;
+    if (iscsi_raw_nop_ping(&a->conn) != 0) {
+        snprintf(a->error_msg, sizeof(a->error_msg), "NOP-Out after an abort failed");
+        return -1;
+    }
+    latency_hist_record(&a->nop_hist, start, latency_now_ns());
+    a->rounds++;
+    return 0;
+}
+
+static void* abort_thread_func(void *arg) {
+    abort_loop_t *a = (abort_loop_t *)arg;
+
+    while (!__atomic_load_n(&a->stop, __ATOMIC_ACQUIRE) &&
+           (a->max_rounds == 0 || a->rounds < a->max_rounds)) {
+        if (abort_round(a) != 0) {
+            a->failed = 1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Append one "idle vs loaded" latency line to the TP-015 report */
+static size_t abort_append_line(char *msg, size_t size, size_t off, const char *name,
+                                const latency_hist_t *idle, const latency_hist_t *loaded) {
+    if (off >= size) {
+        return off;
+    }
+    return off + snprintf(msg + off, size - off,
+                          "\n       %-14s idle p50 %.3fms p99 %.3fms  loaded p50 %.3fms p99 %.3fms p999 %.3fms (x%llu)",
+                          name, latency_hist_percentile(idle, 0.50) / 1e6,
+                          latency_hist_percentile(idle, 0.99) / 1e6,
+                          latency_hist_percentile(loaded, 0.50) / 1e6,
+                          latency_hist_percentile(loaded, 0.99) / 1e6,
+                          latency_hist_percentile(loaded, 0.999) / 1e6,
+                          (unsigned long long)loaded->total);
+}
+
+/*
+ * TP-015: Abort Latency Under Load
+ *
+ * Failover and path-timeout handling hinge on how quickly a target gives
+ * up on commands. A raw session with InitialR2T=Yes and no immediate data
+ * starts WRITE(10)s on the last io_blocks of the LUN and, once the target
+ * has sent their R2Ts, aborts them instead of sending data: ABORT TASK
+ * for a single write, and every fourth round ABORT TASK SET for a batch.
+ * The rounds run first on an idle target, then for the benchmark duration
+ * against a libiscsi workload at load_queue_depth with load_read_percent
+ * reads on the rest of the LUN. Reports the abort and NOP-Out round-trip
+ * percentiles for both, and the load's IOPS. Finally it sends the data a
+ * late initiator would for an aborted write and checks that none of it
+ * reached the LUN and that the target never answered it.
+ */
+static test_result_t test_abort_latency(struct iscsi_context *unused_iscsi,
+                                        test_config_t *config,
+                                        test_report_t *report) {
+    iscsi_raw_params_t params = { 0, 1, 0, 0, 0, 0, 0, 0 };
+    struct iscsi_context *iscsi = NULL;
+    abort_loop_t *a;
+    latency_hist_t idle_abort, idle_set, idle_nop;
+    bench_run_t run;
+    bench_result_t load;
+    pthread_t thread;
+    uint64_t num_blocks;
+    uint32_t block_size, io_blocks, len;
+    uint32_t itt, ttt, offset, length, ref_cmd_sn;
+    int depth = config->load_queue_depth;
+    uint8_t *expected = NULL, *late = NULL;
+    test_result_t ret;
+    char msg[2048];
+    size_t off;
+
+    (void)unused_iscsi;
+    memset(&run, 0, sizeof(run));
+
+    ret = raw_bench_prepare(config, report, &num_blocks, &block_size);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+    if (depth < 1 || depth > BENCH_MAX_QUEUE_DEPTH) {
+        report_set_result(report, TEST_SKIP, "Load generator parameters out of range");
+        return TEST_SKIP;
+    }
+    if (config->bench_io_blocks <= 0 || config->bench_io_blocks > SWEEP_MAX_BLOCKS ||
+        num_blocks < 2ULL * config->bench_io_blocks) {
+        report_set_result(report, TEST_SKIP, "Device too small for benchmark I/O size");
+        return TEST_SKIP;
+    }
+    io_blocks = (uint32_t)config->bench_io_blocks;
+    len = io_blocks * block_size;
+
+    a = calloc(1, sizeof(*a));
+    expected = buffer_pool_get(len);
+    late = buffer_pool_get(len);
+    if (!a || !expected || !late) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        ret = TEST_ERROR;
+        goto out_free;
+    }
+    latency_hist_reset(&a->abort_hist);
+    latency_hist_reset(&a->set_hist);
+    latency_hist_reset(&a->nop_hist);
+    a->lun = config->lun;
+    a->lba = (uint32_t)(num_blocks - io_blocks);
+    a->io_blocks = io_blocks;
+    a->block_size = block_size;
+
+    if (raw_bench_login(&a->conn, config, &params) != 0) {
+        report_set_result(report, TEST_FAIL, "Raw session login failed");
+        ret = TEST_FAIL;
+        goto out_free;
+    }
+    iscsi_raw_set_timeout(&a->conn, config->timeout);
+    if (a->conn.immediate_data || a->conn.initial_r2t != 1) {
+        report_set_result(report, TEST_SKIP, "Target did not accept InitialR2T=Yes, ImmediateData=No");
+        ret = TEST_SKIP;
+        goto out_raw;
+    }
+
+    /* What the aborted writes' LBAs must still hold at the end */
+    generate_pattern(expected, len, "random", 15);
+    generate_pattern(late, len, "random", 1015);
+    if (iscsi_raw_write10(&a->conn, a->lun, a->lba, io_blocks, block_size, expected) != 0) {
+        report_set_result(report, TEST_FAIL, "WRITE(10) of the reference pattern failed");
+        ret = TEST_FAIL;
+        goto out_raw;
+    }
+
+    /* Idle: the abort rounds alone */
+    a->max_rounds = ABORT_IDLE_ROUNDS;
+    abort_thread_func(a);
+    if (a->failed) {
+        report_set_result(report, TEST_FAIL, a->error_msg);
+        ret = TEST_FAIL;
+        goto out_raw;
+    }
+    idle_abort = a->abort_hist;
+    idle_set = a->set_hist;
+    idle_nop = a->nop_hist;
+    latency_hist_reset(&a->abort_hist);
+    latency_hist_reset(&a->set_hist);
+    latency_hist_reset(&a->nop_hist);
+    a->rounds = 0;
+    a->max_rounds = 0;
+
+    /* Loaded: the same rounds from a thread while the workload runs here */
+    iscsi = create_iscsi_context_for_test(config);
+    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        ret = TEST_ERROR;
+        goto out_raw;
+    }
+    if (bench_run_init(&run, iscsi, config->lun, block_size, io_blocks, 0, a->lba,
+                       config->load_read_percent, depth, 54321) != 0) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        ret = TEST_ERROR;
+        goto out_raw;
+    }
+    if (pthread_create(&thread, NULL, abort_thread_func, a) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to create abort thread");
+        ret = TEST_ERROR;
+        goto out_raw;
+    }
+    ret = bench_phase(config, report, &run, depth, "abort load", &load) == 0 ? TEST_PASS : TEST_FAIL;
+    __atomic_store_n(&a->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    if (ret != TEST_PASS) {
+        goto out_raw;
+    }
+    if (a->failed) {
+        snprintf(msg, sizeof(msg), "Under QD %d load after %llu rounds: %s",
+                 depth, (unsigned long long)a->rounds, a->error_msg);
+        report_set_result(report, TEST_FAIL, msg);
+        ret = TEST_FAIL;
+        goto out_raw;
+    }
+    latency_hist_merge(report->latency, &a->abort_hist);
+    latency_hist_merge(report->latency, &a->set_hist);
+
+    /*
+     * A late initiator: abort a write, then send the data its first R2T
+     * asked for anyway. The target must drop it, so the read back (which
+     * fails on any PDU for another task) sees the reference pattern.
+     */
+    ref_cmd_sn = a->conn.cmd_sn;
+    {
+        uint8_t bhs[48];
+
+        itt = iscsi_raw_build_write10(&a->conn, bhs, a->lun, a->lba, io_blocks, block_size);
+        if (iscsi_raw_send_pdu(&a->conn, bhs, NULL, 0) != 0 ||
+            iscsi_raw_recv_r2t(&a->conn, &itt, &ttt, &offset, &length) != 0 ||
+            (uint64_t)offset + length > len) {
+            report_set_result(report, TEST_FAIL, "WRITE(10) for the late Data-Out check got no usable R2T");
+            ret = TEST_FAIL;
+            goto out_raw;
+        }
+    }
+    if (iscsi_raw_task_mgmt(&a->conn, ISCSI_TMF_ABORT_TASK, a->lun, itt, ref_cmd_sn) !=
+        ISCSI_TMF_FUNCTION_COMPLETE) {
+        report_set_result(report, TEST_FAIL, "ABORT TASK for the late Data-Out check failed");
+        ret = TEST_FAIL;
+        goto out_raw;
+    }
+    if (iscsi_raw_send_data_out(&a->conn, a->lun, itt, ttt, late, offset, length) != 0) {
+        report_set_result(report, TEST_FAIL, "Sending Data-Out for the aborted write failed");
+        ret = TEST_FAIL;
+        goto out_raw;
+    }
+    if (iscsi_raw_read10(&a->conn, a->lun, a->lba, io_blocks, block_size, late) != 0) {
+        report_set_result(report, TEST_FAIL,
+                          "Read back after a late Data-Out failed: the target answered the aborted write");
+        ret = TEST_FAIL;
+        goto out_raw;
+    }
+    if (memcmp(late, expected, len) != 0) {
+        report_set_result(report, TEST_FAIL, "Data-Out for an aborted WRITE(10) reached the LUN");
+        ret = TEST_FAIL;
+        goto out_raw;
+    }
+
+    off = snprintf(msg, sizeof(msg),
+                   "%u KiB writes aborted after their R2T; load QD %d, %d%% reads: %.0f IOPS (p99 %.3fms)",
+                   len / 1024, depth, config->load_read_percent, load.iops, load.p99_ms);
+    off = abort_append_line(msg, sizeof(msg), off, "ABORT TASK", &idle_abort, &a->abort_hist);
+    off = abort_append_line(msg, sizeof(msg), off, "ABORT TASK SET", &idle_set, &a->set_hist);
+    off = abort_append_line(msg, sizeof(msg), off, "NOP-Out", &idle_nop, &a->nop_hist);
+    if (off < sizeof(msg)) {
+        snprintf(msg + off, sizeof(msg) - off,
+                 "\n       late Data-Out for an aborted write was dropped");
+    }
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out_raw:
+    if (iscsi) {
+        /* Destroy the context first: it completes outstanding tasks into our slots */
+        if (ret == TEST_FAIL) {
+            iscsi_disconnect(iscsi);
+        } else {
+            iscsi_disconnect_target(iscsi);
+        }
+        iscsi_destroy_context(iscsi);
+    }
+    bench_run_free(&run);
+    iscsi_raw_close(&a->conn);
+out_free:
+    buffer_pool_put(late);
+    buffer_pool_put(expected);
+    free(a);
+    return ret;
+}
+
+/* Test definitions */
+static const test_def_t bench_tests[] = {
+    {"TP-001", "Async Random Read QD Sweep", "Benchmark Tests", test_qd_sweep_read, 0},
+    {"TP-002", "Async Random Write QD Sweep", "Benchmark Tests", test_qd_sweep_write, 0},
+    {"TP-003", "Multi-Session Load Scaling", "Benchmark Tests", test_multi_session_load, 0},
+    {"TP-004", "Transfer Size Sweep", "Benchmark Tests", test_transfer_size_sweep, 0},
+    {"TP-005", "Negotiation Parameter Matrix", "Benchmark Tests", test_negotiation_matrix, 0},
+    {"TP-006", "Digest Overhead", "Benchmark Tests", test_digest_overhead, 0},
+    {"TP-007", "Pipelined NOP-Out Throughput", "Benchmark Tests", test_pipelined_nop, 0},
+    {"TP-008", "CmdSN Window Saturation", "Benchmark Tests", test_cmdsn_window, 0},
+    {"TP-009", "Multi-Connection Session Throughput", "Benchmark Tests", test_mcs_throughput, 0},
+    {"TP-010", "Small Sequential Write Cache", "Benchmark Tests", test_write_cache_gain, 0},
+    {"TP-011", "Storage Backend Profile", "Benchmark Tests", test_backend_profile, 0},
+    {"TP-012", "High-LBA Random I/O", "Benchmark Tests", test_high_lba_random, 0},
+    {"TP-013", "Multi-LUN Parallel I/O", "Benchmark Tests", test_multi_lun_parallel, 0},
+    {"TP-014", "Login Throughput", "Benchmark Tests", test_login_throughput, 0},
+    {"TP-015", "Abort Latency Under Load", "Benchmark Tests", test_abort_latency, 0},
+};
+
+/* Listed in the build-time test table (see TEST_GROUPS in the Makefile) */
+const test_group_t bench_test_group = {
+    "bench", "Async queue-depth benchmarks", false,
+    bench_tests, sizeof(bench_tests) / sizeof(bench_tests[0])
+};
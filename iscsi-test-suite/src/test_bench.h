@@ -0,0 +1,9 @@
+#ifndef TEST_BENCH_H
+#define TEST_BENCH_H
+
+#include "test_framework.h"
+
+/* The benchmark tests, for the build-time test table */
+extern const test_group_t bench_test_group;
+
+#endif /* TEST_BENCH_H */
@@ -1,5 +1,6 @@
 #include "test_commands.h"
 #include "utils.h"
+#include "latency_histogram.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,23 +8,21 @@
 #include <iscsi/scsi-lowlevel.h>
 
 /* TC-001: INQUIRY Command */
-static test_result_t test_inquiry(struct iscsi_context *unused_iscsi,
+static test_result_t test_inquiry(struct iscsi_context *pooled_iscsi,
                                    test_config_t *config,
                                    test_report_t *report) {
     struct iscsi_context *iscsi;
     struct scsi_task *task;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
@@ -31,117 +30,104 @@ static test_result_t test_inquiry(struct iscsi_context *unused_iscsi,
     if (!task || task->status != SCSI_STATUS_GOOD) {
         report_set_result(report, TEST_FAIL, "INQUIRY command failed");
         if (task) scsi_free_scsi_task(task);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     scsi_free_scsi_task(task);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TC-002: TEST UNIT READY */
-static test_result_t test_unit_ready(struct iscsi_context *unused_iscsi,
+static test_result_t test_unit_ready(struct iscsi_context *pooled_iscsi,
                                       test_config_t *config,
                                       test_report_t *report) {
     struct iscsi_context *iscsi;
     struct scsi_task *task;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     task = iscsi_testunitready_sync(iscsi, config->lun);
     if (!task) {
         report_set_result(report, TEST_FAIL, "TEST UNIT READY failed");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     scsi_free_scsi_task(task);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TC-003: READ CAPACITY (10) */
-static test_result_t test_read_capacity10(struct iscsi_context *unused_iscsi,
+static test_result_t test_read_capacity10(struct iscsi_context *pooled_iscsi,
                                            test_config_t *config,
                                            test_report_t *report) {
     struct iscsi_context *iscsi;
     uint64_t num_blocks;
     uint32_t block_size;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_FAIL, "READ CAPACITY failed");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (num_blocks == 0 || block_size == 0) {
         report_set_result(report, TEST_FAIL, "Invalid capacity or block size");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TC-004: READ CAPACITY (16) */
-static test_result_t test_read_capacity16(struct iscsi_context *unused_iscsi,
+static test_result_t test_read_capacity16(struct iscsi_context *pooled_iscsi,
                                            test_config_t *config,
                                            test_report_t *report) {
     struct iscsi_context *iscsi;
     struct scsi_task *task;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
@@ -150,37 +136,33 @@ static test_result_t test_read_capacity16(struct iscsi_context *unused_iscsi,
         /* Some targets may not support READ CAPACITY(16) */
         report_set_result(report, TEST_SKIP, "READ CAPACITY(16) not supported");
         if (task) scsi_free_scsi_task(task);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_SKIP;
     }
 
     scsi_free_scsi_task(task);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TC-005: MODE SENSE */
-static test_result_t test_mode_sense(struct iscsi_context *unused_iscsi,
+static test_result_t test_mode_sense(struct iscsi_context *pooled_iscsi,
                                       test_config_t *config,
                                       test_report_t *report) {
     struct iscsi_context *iscsi;
     struct scsi_task *task;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
@@ -189,66 +171,89 @@ static test_result_t test_mode_sense(struct iscsi_context *unused_iscsi,
     if (!task || task->status != SCSI_STATUS_GOOD) {
         report_set_result(report, TEST_FAIL, "MODE SENSE(6) command failed");
         if (task) scsi_free_scsi_task(task);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     scsi_free_scsi_task(task);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TC-006: REQUEST SENSE */
-static test_result_t test_request_sense(struct iscsi_context *unused_iscsi,
+static test_result_t test_request_sense(struct iscsi_context *pooled_iscsi,
                                          test_config_t *config,
                                          test_report_t *report) {
     /* REQUEST SENSE doesn't have a dedicated sync function in libiscsi */
     /* The sense data is automatically retrieved on errors */
-    (void)unused_iscsi;
+    (void)pooled_iscsi;
     (void)config;
     report_set_result(report, TEST_SKIP, "REQUEST SENSE handled automatically by libiscsi");
     return TEST_SKIP;
 }
 
-/* TC-007: REPORT LUNS */
-static test_result_t test_report_luns(struct iscsi_context *unused_iscsi,
+#define REPORT_LUNS_MAX 1024
+
+/* Whether lun is one of the count LUNs in luns */
+static int lun_listed(const int *luns, int count, int lun) {
+    for (int i = 0; i < count; i++) {
+        if ((luns[i] & 0x3FFF) == (lun & 0x3FFF)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * TC-007: REPORT LUNS
+ *
+ * The list must be well-formed, hold no LUN twice, and include the LUN
+ * under test. A target may export any number of LUNs.
+ */
+static test_result_t test_report_luns(struct iscsi_context *pooled_iscsi,
                                        test_config_t *config,
                                        test_report_t *report) {
     struct iscsi_context *iscsi;
-    struct scsi_task *task;
+    int luns[REPORT_LUNS_MAX];
+    int count;
+    char msg[256];
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
-    task = iscsi_reportluns_sync(iscsi, 0, 16384);
-    if (!task || task->status != SCSI_STATUS_GOOD) {
+    count = scsi_report_luns(iscsi, luns, REPORT_LUNS_MAX);
+    test_session_release(pooled_iscsi, iscsi);
+    if (count < 0) {
         report_set_result(report, TEST_FAIL, "REPORT LUNS command failed");
-        if (task) scsi_free_scsi_task(task);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
         return TEST_FAIL;
     }
 
-    scsi_free_scsi_task(task);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    for (int i = 1; i < count; i++) {
+        if (lun_listed(luns, i, luns[i])) {
+            snprintf(msg, sizeof(msg), "LUN %d listed twice", luns[i] & 0x3FFF);
+            report_set_result(report, TEST_FAIL, msg);
+            return TEST_FAIL;
+        }
+    }
+    if (!lun_listed(luns, count, config->lun)) {
+        snprintf(msg, sizeof(msg), "LUN %d under test is not in the %d reported", config->lun, count);
+        report_set_result(report, TEST_FAIL, msg);
+        return TEST_FAIL;
+    }
 
-    report_set_result(report, TEST_PASS, NULL);
+    snprintf(msg, sizeof(msg), "%d LUN%s", count, count == 1 ? "" : "s");
+    report_set_result(report, TEST_PASS, msg);
     return TEST_PASS;
 }
 
@@ -270,24 +275,22 @@ static test_result_t test_report_luns(struct iscsi_context *unused_iscsi,
  * Both CHECK CONDITION (with any sense key) and explicit rejection are valid
  * responses per real-world iSCSI implementation behavior.
  */
-static test_result_t test_invalid_command(struct iscsi_context *unused_iscsi,
+static test_result_t test_invalid_command(struct iscsi_context *pooled_iscsi,
                                            test_config_t *config,
                                            test_report_t *report) {
     struct iscsi_context *iscsi;
     struct scsi_task *task;
     unsigned char cdb[6];
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
@@ -299,8 +302,7 @@ static test_result_t test_invalid_command(struct iscsi_context *unused_iscsi,
     task = scsi_create_task(6, cdb, SCSI_XFER_NONE, 0);
     if (!task) {
         report_set_result(report, TEST_ERROR, "Failed to create task");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -308,8 +310,7 @@ static test_result_t test_invalid_command(struct iscsi_context *unused_iscsi,
     task = iscsi_scsi_command_sync(iscsi, config->lun, task, NULL);
     if (!task) {
         report_set_result(report, TEST_ERROR, "Failed to execute command");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -321,8 +322,7 @@ static test_result_t test_invalid_command(struct iscsi_context *unused_iscsi,
         report_set_result(report, TEST_FAIL,
                          "Target incorrectly accepted invalid SCSI opcode 0xFF");
         scsi_free_scsi_task(task);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
@@ -344,42 +344,46 @@ static test_result_t test_invalid_command(struct iscsi_context *unused_iscsi,
     }
 
     scsi_free_scsi_task(task);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, msg);
     return TEST_PASS;
 }
 
 /* TC-009: Command to Invalid LUN */
-static test_result_t test_invalid_lun(struct iscsi_context *unused_iscsi,
+static test_result_t test_invalid_lun(struct iscsi_context *pooled_iscsi,
                                        test_config_t *config,
                                        test_report_t *report) {
     struct iscsi_context *iscsi;
     struct scsi_task *task;
-    uint64_t invalid_lun = 999; /* Highly unlikely to exist */
+    int luns[REPORT_LUNS_MAX];
+    int count;
+    int invalid_lun = 999;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
+    /* Use a LUN the target does not report, whatever it exports */
+    count = scsi_report_luns(iscsi, luns, REPORT_LUNS_MAX);
+    while (count > 0 && lun_listed(luns, count, invalid_lun)) {
+        invalid_lun++;
+    }
+
     /* Try to send INQUIRY to invalid LUN */
     task = iscsi_inquiry_sync(iscsi, invalid_lun, 0, 0, 255);
 
     if (!task) {
         report_set_result(report, TEST_ERROR, "Failed to send command to invalid LUN");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -387,35 +391,466 @@ static test_result_t test_invalid_lun(struct iscsi_context *unused_iscsi,
     if (task->status == SCSI_STATUS_GOOD) {
         report_set_result(report, TEST_FAIL, "Target accepted command to invalid LUN");
         scsi_free_scsi_task(task);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     scsi_free_scsi_task(task);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
-/* Test definitions */
-static test_def_t command_tests[] = {
-    {"TC-001", "INQUIRY Command", "SCSI Command Tests", test_inquiry},
-    {"TC-002", "TEST UNIT READY", "SCSI Command Tests", test_unit_ready},
-    {"TC-003", "READ CAPACITY (10)", "SCSI Command Tests", test_read_capacity10},
-    {"TC-004", "READ CAPACITY (16)", "SCSI Command Tests", test_read_capacity16},
-    {"TC-005", "MODE SENSE", "SCSI Command Tests", test_mode_sense},
-    {"TC-006", "REQUEST SENSE", "SCSI Command Tests", test_request_sense},
-    {"TC-007", "REPORT LUNS", "SCSI Command Tests", test_report_luns},
-    {"TC-008", "Invalid Command", "SCSI Command Tests", test_invalid_command},
-    {"TC-009", "Command to Invalid LUN", "SCSI Command Tests", test_invalid_lun},
-};
+/*
+ * TC-010: Caching Mode Page
+ *
+ * MODE SENSE(6) for page 0x08 must return a well-formed Caching page. The
+ * WCE bit says whether the target may hold completed writes in a volatile
+ * cache, which is what makes FUA and SYNCHRONIZE CACHE (TI-015, TI-016)
+ * matter. A target with no Caching page is skipped.
+ */
+static test_result_t test_caching_mode_page(struct iscsi_context *pooled_iscsi,
+                                            test_config_t *config,
+                                            test_report_t *report) {
+    struct iscsi_context *iscsi;
+    struct scsi_task *task;
+    const uint8_t *data, *page;
+    size_t len, page_off;
+    char msg[256];
+    test_result_t ret;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        return TEST_ERROR;
+    }
+
+    task = iscsi_modesense6_sync(iscsi, config->lun, 1, SCSI_MODESENSE_PC_CURRENT,
+                                 SCSI_MODEPAGE_CACHING, 0, 255);
+    if (!task || task->status != SCSI_STATUS_GOOD) {
+        report_set_result(report, TEST_FAIL, "MODE SENSE(6) for the Caching page failed");
+        ret = TEST_FAIL;
+        goto out;
+    }
+
+    /* Header: mode data length, medium type, device-specific, block descriptor length */
+    data = task->datain.data;
+    len = (size_t)task->datain.size;
+    if (len < 4 || (size_t)data[0] + 1 > len) {
+        report_set_result(report, TEST_FAIL, "MODE SENSE(6) header is truncated");
+        ret = TEST_FAIL;
+        goto out;
+    }
+    len = (size_t)data[0] + 1;
+    page_off = 4 + data[3];
+    if (page_off >= len) {
+        report_set_result(report, TEST_SKIP, "Target returned no Caching mode page");
+        ret = TEST_SKIP;
+        goto out;
+    }
+
+    page = data + page_off;
+    if ((page[0] & 0x3F) != SCSI_MODEPAGE_CACHING || page_off + 2 > len ||
+        page[1] < 0x12 || page_off + 2 + page[1] > len) {
+        snprintf(msg, sizeof(msg), "Malformed Caching page: code 0x%02x, length %u, %zu bytes returned",
+                 page[0] & 0x3F, page_off + 1 < len ? page[1] : 0, len);
+        report_set_result(report, TEST_FAIL, msg);
+        ret = TEST_FAIL;
+        goto out;
+    }
+
+    snprintf(msg, sizeof(msg), "WCE=%d RCD=%d, DPOFUA=%d",
+             (page[2] >> 2) & 1, page[2] & 1, (data[2] >> 4) & 1);
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    if (task) scsi_free_scsi_task(task);
+    test_session_release(pooled_iscsi, iscsi);
+    return ret;
+}
+
+/* Largest region TC-011/TC-012 write, so a coarse unmap granularity cannot run away */
+#define LBP_MAX_REGION_BYTES (16 * 1024 * 1024)
+
+/* One unit of the TC-011/TC-012 region: a whole number of unmap granules, at least 8 blocks */
+static uint32_t lbp_unit_blocks(const scsi_lbp_t *lbp) {
+    uint32_t gran = lbp->granularity ? lbp->granularity : 1;
+
+    return gran >= 8 ? gran : (8 + gran - 1) / gran * gran;
+}
+
+/*
+ * Check a four-unit region read back after units 1 and 2 were deallocated:
+ * units 0 and 3 must still match expect, and with LBPRZ the middle must be
+ * zeros. Returns 0, or -1 with the first mismatch described in msg.
+ */
+static int lbp_verify_region(const uint8_t *got, const uint8_t *expect, size_t unit_bytes,
+                             int lbprz, char *msg, size_t size) {
+    for (int unit = 0; unit < 4; unit++) {
+        const uint8_t *g = got + unit * unit_bytes;
+        int hole = unit == 1 || unit == 2;
+
+        if (!hole && memcmp(g, expect + unit * unit_bytes, unit_bytes) != 0) {
+            snprintf(msg, size, "Data outside the deallocated range changed (unit %d)", unit);
+            return -1;
+        }
+        for (size_t i = 0; hole && lbprz && i < unit_bytes; i++) {
+            if (g[i] != 0) {
+                snprintf(msg, size, "Deallocated block reads non-zero at byte %zu with LBPRZ=1",
+                         unit * unit_bytes + i);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Connect, read the provisioning pages and size the four-unit test region.
+ * Returns TEST_PASS with everything filled in, or the result to report.
+ */
+static test_result_t lbp_setup(struct iscsi_context *pooled_iscsi, test_config_t *config,
+                               test_report_t *report, struct iscsi_context **iscsi,
+                               scsi_lbp_t *lbp, uint32_t *unit, uint32_t *block_size) {
+    uint64_t num_blocks;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    *iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!*iscsi) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        return TEST_ERROR;
+    }
+
+    if (scsi_read_capacity(*iscsi, config->lun, &num_blocks, block_size) != 0 ||
+        scsi_read_lbp(*iscsi, config->lun, lbp) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to query capacity or VPD pages");
+        test_session_release(pooled_iscsi, *iscsi);
+        return TEST_ERROR;
+    }
+
+    *unit = lbp_unit_blocks(lbp);
+    if ((uint64_t)*unit * 4 > num_blocks ||
+        (uint64_t)*unit * 4 * *block_size > LBP_MAX_REGION_BYTES) {
+        report_set_result(report, TEST_SKIP, "Unmap granularity too large for the test region");
+        test_session_release(pooled_iscsi, *iscsi);
+        return TEST_SKIP;
+    }
+    return TEST_PASS;
+}
+
+/* TC-011: UNMAP */
+static test_result_t test_unmap(struct iscsi_context *pooled_iscsi,
+                                test_config_t *config,
+                                test_report_t *report) {
+    struct iscsi_context *iscsi;
+    struct scsi_task *task;
+    scsi_lbp_t lbp;
+    uint32_t unit, block_size;
+    uint8_t *pattern = NULL, *readback = NULL;
+    size_t unit_bytes;
+    char msg[256];
+    test_result_t ret;
+
+    ret = lbp_setup(pooled_iscsi, config, report, &iscsi, &lbp, &unit, &block_size);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+    if (!lbp.lbpu) {
+        report_set_result(report, TEST_SKIP, "Target does not advertise UNMAP (LBPU=0)");
+        test_session_release(pooled_iscsi, iscsi);
+        return TEST_SKIP;
+    }
+
+    /* A thin-provisioned LUN must say so in READ CAPACITY(16) too */
+    task = iscsi_readcapacity16_sync(iscsi, config->lun);
+    if (!task || task->status != SCSI_STATUS_GOOD || task->datain.size < 15 ||
+        !(task->datain.data[14] & 0x80)) {
+        report_set_result(report, TEST_FAIL, "LBPU is set but READ CAPACITY(16) LBPME is clear");
+        if (task) scsi_free_scsi_task(task);
+        test_session_release(pooled_iscsi, iscsi);
+        return TEST_FAIL;
+    }
+    scsi_free_scsi_task(task);
+
+    unit_bytes = (size_t)unit * block_size;
+    pattern = buffer_pool_get(4 * unit_bytes);
+    readback = buffer_pool_get(4 * unit_bytes);
+    if (!pattern || !readback) {
+        report_set_result(report, TEST_ERROR, "Failed to allocate buffers");
+        ret = TEST_ERROR;
+        goto out;
+    }
 
-/* Register all tests */
-void register_command_tests(void) {
-    for (size_t i = 0; i < sizeof(command_tests) / sizeof(command_tests[0]); i++) {
-        framework_register_test(&command_tests[i]);
+    generate_pattern(pattern, 4 * unit_bytes, "random", 11011);
+    if (scsi_write_blocks(iscsi, config->lun, 0, 4 * unit, block_size, pattern) != 0) {
+        report_set_result(report, TEST_FAIL, "Write of the test region failed");
+        ret = TEST_FAIL;
+        goto out;
+    }
+
+    if (scsi_unmap_blocks(iscsi, config->lun, unit, 2 * unit) != 0) {
+        report_set_result(report, TEST_FAIL, "UNMAP failed");
+        ret = TEST_FAIL;
+        goto out;
+    }
+
+    if (scsi_read_blocks(iscsi, config->lun, 0, 4 * unit, block_size, readback) != 0) {
+        report_set_result(report, TEST_FAIL, "Read after UNMAP failed");
+        ret = TEST_FAIL;
+        goto out;
+    }
+    if (lbp_verify_region(readback, pattern, unit_bytes, lbp.lbprz, msg, sizeof(msg)) != 0) {
+        report_set_result(report, TEST_FAIL, msg);
+        ret = TEST_FAIL;
+        goto out;
     }
+
+    snprintf(msg, sizeof(msg), "%u blocks unmapped%s; granularity %u, max %u descriptors",
+             2 * unit, lbp.lbprz ? " and read back as zeros" : "", lbp.granularity,
+             lbp.max_descriptors);
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    if (pattern) buffer_pool_put(pattern);
+    if (readback) buffer_pool_put(readback);
+    test_session_release(pooled_iscsi, iscsi);
+    return ret;
 }
+
+/* TC-012: WRITE SAME (16) with UNMAP */
+static test_result_t test_write_same_unmap(struct iscsi_context *pooled_iscsi,
+                                           test_config_t *config,
+                                           test_report_t *report) {
+    struct iscsi_context *iscsi;
+    scsi_lbp_t lbp;
+    uint32_t unit, block_size;
+    uint8_t *expect = NULL, *readback = NULL, *zeros = NULL;
+    size_t unit_bytes;
+    char msg[256];
+    test_result_t ret;
+
+    ret = lbp_setup(pooled_iscsi, config, report, &iscsi, &lbp, &unit, &block_size);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+    if (!lbp.lbpws) {
+        report_set_result(report, TEST_SKIP, "Target does not advertise WRITE SAME(16) with UNMAP (LBPWS=0)");
+        test_session_release(pooled_iscsi, iscsi);
+        return TEST_SKIP;
+    }
+
+    unit_bytes = (size_t)unit * block_size;
+    expect = buffer_pool_get(4 * unit_bytes);
+    readback = buffer_pool_get(4 * unit_bytes);
+    zeros = buffer_pool_get(block_size);
+    if (!expect || !readback || !zeros) {
+        report_set_result(report, TEST_ERROR, "Failed to allocate buffers");
+        ret = TEST_ERROR;
+        goto out;
+    }
+
+    /* One patterned block written over the whole region */
+    generate_pattern(expect, block_size, "random", 12012);
+    for (uint32_t i = 1; i < 4 * unit; i++) {
+        memcpy(expect + (size_t)i * block_size, expect, block_size);
+    }
+    if (scsi_write_same16(iscsi, config->lun, 0, 4 * unit, block_size, expect, 0) != 0 ||
+        scsi_read_blocks(iscsi, config->lun, 0, 4 * unit, block_size, readback) != 0) {
+        report_set_result(report, TEST_FAIL, "WRITE SAME(16) or its read-back failed");
+        ret = TEST_FAIL;
+        goto out;
+    }
+    if (memcmp(readback, expect, 4 * unit_bytes) != 0) {
+        report_set_result(report, TEST_FAIL, "WRITE SAME(16) did not repeat the block over the range");
+        ret = TEST_FAIL;
+        goto out;
+    }
+
+    /* A zero block with UNMAP set deallocates the middle two units */
+    memset(zeros, 0, block_size);
+    if (scsi_write_same16(iscsi, config->lun, unit, 2 * unit, block_size, zeros, 1) != 0 ||
+        scsi_read_blocks(iscsi, config->lun, 0, 4 * unit, block_size, readback) != 0) {
+        report_set_result(report, TEST_FAIL, "WRITE SAME(16) with UNMAP or its read-back failed");
+        ret = TEST_FAIL;
+        goto out;
+    }
+    /* Deallocated or written, the range must read as the zero block */
+    if (lbp_verify_region(readback, expect, unit_bytes, 1, msg, sizeof(msg)) != 0) {
+        report_set_result(report, TEST_FAIL, msg);
+        ret = TEST_FAIL;
+        goto out;
+    }
+
+    snprintf(msg, sizeof(msg), "%u blocks written, %u deallocated with a zero block",
+             4 * unit, 2 * unit);
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    if (expect) buffer_pool_put(expect);
+    if (readback) buffer_pool_put(readback);
+    if (zeros) buffer_pool_put(zeros);
+    test_session_release(pooled_iscsi, iscsi);
+    return ret;
+}
+
+/* Extents TC-013 cycles through; a discard trails its write by half of them */
+#define DISCARD_SLOTS 256
+
+/* TC-013: Discard-Heavy Throughput */
+static test_result_t test_discard_throughput(struct iscsi_context *pooled_iscsi,
+                                             test_config_t *config,
+                                             test_report_t *report) {
+    struct iscsi_context *iscsi;
+    scsi_lbp_t lbp;
+    uint64_t num_blocks, cycles = 0, start, end, trim_ns = 0;
+    uint32_t block_size, extent, slots;
+    uint8_t *buffer = NULL;
+    latency_hist_t write_hist, unmap_hist;
+    double seconds;
+    char msg[512];
+    test_result_t ret;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        return TEST_ERROR;
+    }
+
+    if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0 ||
+        scsi_read_lbp(iscsi, config->lun, &lbp) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to query capacity or VPD pages");
+        test_session_release(pooled_iscsi, iscsi);
+        return TEST_ERROR;
+    }
+    if (!lbp.lbpu) {
+        report_set_result(report, TEST_SKIP, "Target does not advertise UNMAP (LBPU=0)");
+        test_session_release(pooled_iscsi, iscsi);
+        return TEST_SKIP;
+    }
+
+    /* Extents of bench_io_blocks, rounded up to whole unmap granules */
+    extent = lbp.granularity ? lbp.granularity : 1;
+    extent = ((uint32_t)config->bench_io_blocks + extent - 1) / extent * extent;
+    slots = num_blocks / extent < DISCARD_SLOTS ? (uint32_t)(num_blocks / extent) : DISCARD_SLOTS;
+    if (slots < 2) {
+        report_set_result(report, TEST_SKIP, "LUN too small for the discard workload");
+        test_session_release(pooled_iscsi, iscsi);
+        return TEST_SKIP;
+    }
+
+    buffer = buffer_pool_get((size_t)extent * block_size);
+    if (!buffer) {
+        report_set_result(report, TEST_ERROR, "Failed to allocate buffer");
+        test_session_release(pooled_iscsi, iscsi);
+        return TEST_ERROR;
+    }
+    generate_pattern(buffer, (size_t)extent * block_size, "random", 13013);
+    latency_hist_reset(&write_hist);
+    latency_hist_reset(&unmap_hist);
+
+    /*
+     * Each cycle writes one extent and discards the one written half the
+     * slots ago, so every UNMAP frees data that is really there and the
+     * LUN never holds more than half the region.
+     */
+    start = latency_now_ns();
+    end = start + (uint64_t)config->bench_duration * 1000000000ULL;
+    do {
+        uint64_t lba = (uint64_t)(cycles % slots) * extent;
+        uint64_t old = (uint64_t)((cycles + slots / 2) % slots) * extent;
+        uint64_t t0 = latency_now_ns();
+
+        if (scsi_write_blocks(iscsi, config->lun, lba, extent, block_size, buffer) != 0) {
+            snprintf(msg, sizeof(msg), "Write failed at LBA %llu after %llu cycles",
+                     (unsigned long long)lba, (unsigned long long)cycles);
+            report_set_result(report, TEST_FAIL, msg);
+            ret = TEST_FAIL;
+            goto out;
+        }
+        latency_hist_record(&write_hist, t0, latency_now_ns());
+
+        t0 = latency_now_ns();
+        if (scsi_unmap_blocks(iscsi, config->lun, old, extent) != 0) {
+            snprintf(msg, sizeof(msg), "UNMAP failed at LBA %llu after %llu cycles",
+                     (unsigned long long)old, (unsigned long long)cycles);
+            report_set_result(report, TEST_FAIL, msg);
+            ret = TEST_FAIL;
+            goto out;
+        }
+        latency_hist_record(&unmap_hist, t0, latency_now_ns());
+        cycles++;
+    } while (latency_now_ns() < end);
+    seconds = (latency_now_ns() - start) / 1e9;
+
+    /* Then discard the whole region at once, as a filesystem trim would */
+    start = latency_now_ns();
+    if (scsi_unmap_blocks(iscsi, config->lun, 0, slots * extent) != 0) {
+        report_set_result(report, TEST_FAIL, "UNMAP of the whole region failed");
+        ret = TEST_FAIL;
+        goto out;
+    }
+    trim_ns = latency_now_ns() - start;
+
+    snprintf(msg, sizeof(msg),
+             "%llu write+UNMAP cycles of %u blocks in %.1fs"
+             "\n       write %.1f MB/s, p50 %.3fms p99 %.3fms"
+             "\n       UNMAP %.0f/s, p50 %.3fms p99 %.3fms"
+             "\n       trim of %u blocks %.3fms",
+             (unsigned long long)cycles, extent, seconds,
+             seconds > 0 ? cycles * extent * (double)block_size / seconds / 1e6 : 0.0,
+             latency_hist_percentile(&write_hist, 0.50) / 1e6,
+             latency_hist_percentile(&write_hist, 0.99) / 1e6,
+             seconds > 0 ? cycles / seconds : 0.0,
+             latency_hist_percentile(&unmap_hist, 0.50) / 1e6,
+             latency_hist_percentile(&unmap_hist, 0.99) / 1e6,
+             slots * extent, trim_ns / 1e6);
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    buffer_pool_put(buffer);
+    test_session_release(pooled_iscsi, iscsi);
+    return ret;
+}
+
+/* Test definitions */
+static const test_def_t command_tests[] = {
+    {"TC-001", "INQUIRY Command", "SCSI Command Tests", test_inquiry, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-002", "TEST UNIT READY", "SCSI Command Tests", test_unit_ready, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-003", "READ CAPACITY (10)", "SCSI Command Tests", test_read_capacity10, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-004", "READ CAPACITY (16)", "SCSI Command Tests", test_read_capacity16, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-005", "MODE SENSE", "SCSI Command Tests", test_mode_sense, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-006", "REQUEST SENSE", "SCSI Command Tests", test_request_sense, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-007", "REPORT LUNS", "SCSI Command Tests", test_report_luns, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-008", "Invalid Command", "SCSI Command Tests", test_invalid_command, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-009", "Command to Invalid LUN", "SCSI Command Tests", test_invalid_lun, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-010", "Caching Mode Page", "SCSI Command Tests", test_caching_mode_page, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-011", "UNMAP", "SCSI Command Tests", test_unmap, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TC-012", "WRITE SAME (16) with UNMAP", "SCSI Command Tests", test_write_same_unmap, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    /* Not parallel: a timed workload, and other tests' writes would skew it */
+    {"TC-013", "Discard-Heavy Throughput", "SCSI Command Tests", test_discard_throughput, TEST_FLAG_POOLED_SESSION},
+};
+
+/* Listed in the build-time test table (see TEST_GROUPS in the Makefile) */
+const test_group_t commands_test_group = {
+    "commands", "SCSI command tests", true,
+    command_tests, sizeof(command_tests) / sizeof(command_tests[0])
+};
@@ -3,7 +3,7 @@
 
 #include "test_framework.h"
 
-/* Register all SCSI command tests */
-void register_command_tests(void);
+/* The SCSI command tests, for the build-time test table */
+extern const test_group_t commands_test_group;
 
 #endif /* TEST_COMMANDS_H */
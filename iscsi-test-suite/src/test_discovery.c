@@ -1,6 +1,8 @@
 #include "test_discovery.h"
 #include "utils.h"
 #include "iscsi_pdu_helper.h"
+#include "crc32c.h"
+#include "latency_histogram.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -177,6 +179,30 @@ static test_result_t test_param_negotiation(struct iscsi_context *unused_iscsi,
     return TEST_PASS;
 }
 
+/*
+ * Send a prebuilt Login Request on a fresh connection and read back one
+ * framed response. Returns parse_login_response_status() of the response,
+ * or -1 if nothing well-formed came back.
+ */
+static int send_login_probe(test_config_t *config, const uint8_t *pdu, size_t pdu_size) {
+    iscsi_raw_conn_t conn;
+    uint8_t bhs[48];
+    const uint8_t *data;
+    uint32_t data_len;
+    int status = -1;
+
+    if (iscsi_raw_connect(&conn, config->portal) == 0) {
+        iscsi_raw_set_timeout(&conn, config->timeout);
+        if (iscsi_raw_send_bytes(&conn, pdu, pdu_size) == 0 &&
+            iscsi_raw_recv_pdu(&conn, bhs, &data, &data_len) == 0) {
+            status = parse_login_response_status(bhs, sizeof(bhs));
+        }
+    }
+
+    iscsi_raw_close(&conn);
+    return status;
+}
+
 /* TL-003: Invalid Parameter Values
  *
  * This test verifies that the target handles "invalid" parameter values gracefully.
@@ -201,18 +227,12 @@ static test_result_t test_invalid_params(struct iscsi_context *unused_iscsi,
                                           test_config_t *config,
                                           test_report_t *report) {
     uint8_t *pdu = NULL;
-    uint8_t *response = NULL;
     size_t pdu_size = 0;
-    size_t response_size = 0;
     int status;
     int accepted_count = 0;
     int rejected_count = 0;
     int error_count = 0;
     int test_count = 0;
-    char *host;
-    char *port_str;
-    int port = 3260;
-    char portal_copy[256];
     char msg[512];
 
     (void)unused_iscsi;
@@ -222,39 +242,17 @@ static test_result_t test_invalid_params(struct iscsi_context *unused_iscsi,
         return TEST_SKIP;
     }
 
-    /* Parse portal address (format: "host:port" or just "host") */
-    strncpy(portal_copy, config->portal, sizeof(portal_copy) - 1);
-    portal_copy[sizeof(portal_copy) - 1] = '\0';
-
-    host = portal_copy;
-    port_str = strchr(portal_copy, ':');
-    if (port_str) {
-        *port_str = '\0';
-        port_str++;
-        port = atoi(port_str);
-        if (port <= 0 || port > 65535) {
-            port = 3260;
-        }
-    }
-
     /* Test 1: MaxRecvDataSegmentLength=0 (TGTD accepts this) */
     test_count++;
     pdu = build_login_pdu_invalid_maxrecvdatasize(&pdu_size);
     if (pdu) {
-        response = send_pdu_and_recv_response(host, port, pdu, pdu_size, &response_size);
-        if (response) {
-            status = parse_login_response_status(response, response_size);
-            if (status == 1) {
-                /* Target accepted - TGTD-compatible behavior */
-                accepted_count++;
-            } else if (status == 0) {
-                /* Target rejected - also valid per RFC */
-                rejected_count++;
-            } else {
-                error_count++;
-            }
-            free(response);
-            response = NULL;
+        status = send_login_probe(config, pdu, pdu_size);
+        if (status == 1) {
+            /* Target accepted - TGTD-compatible behavior */
+            accepted_count++;
+        } else if (status == 0) {
+            /* Target rejected - also valid per RFC */
+            rejected_count++;
         } else {
             error_count++;
         }
@@ -268,18 +266,11 @@ static test_result_t test_invalid_params(struct iscsi_context *unused_iscsi,
     test_count++;
     pdu = build_login_pdu_invalid_maxconnections(&pdu_size);
     if (pdu) {
-        response = send_pdu_and_recv_response(host, port, pdu, pdu_size, &response_size);
-        if (response) {
-            status = parse_login_response_status(response, response_size);
-            if (status == 1) {
-                accepted_count++;
-            } else if (status == 0) {
-                rejected_count++;
-            } else {
-                error_count++;
-            }
-            free(response);
-            response = NULL;
+        status = send_login_probe(config, pdu, pdu_size);
+        if (status == 1) {
+            accepted_count++;
+        } else if (status == 0) {
+            rejected_count++;
         } else {
             error_count++;
         }
@@ -293,18 +284,11 @@ static test_result_t test_invalid_params(struct iscsi_context *unused_iscsi,
     test_count++;
     pdu = build_login_pdu_invalid_param_combo(&pdu_size);
     if (pdu) {
-        response = send_pdu_and_recv_response(host, port, pdu, pdu_size, &response_size);
-        if (response) {
-            status = parse_login_response_status(response, response_size);
-            if (status == 1) {
-                accepted_count++;
-            } else if (status == 0) {
-                rejected_count++;
-            } else {
-                error_count++;
-            }
-            free(response);
-            response = NULL;
+        status = send_login_probe(config, pdu, pdu_size);
+        if (status == 1) {
+            accepted_count++;
+        } else if (status == 0) {
+            rejected_count++;
         } else {
             error_count++;
         }
@@ -610,29 +594,570 @@ static test_result_t test_simultaneous_logins(struct iscsi_context *unused_iscsi
     }
 }
 
-/* Test definitions */
-static test_def_t discovery_tests[] = {
-    {"TD-001", "Basic Discovery", "Discovery Tests", test_basic_discovery},
-    {"TD-002", "Discovery With Authentication", "Discovery Tests", test_discovery_auth},
-    {"TD-003", "Discovery Without Credentials", "Discovery Tests", test_discovery_no_creds},
-    {"TD-004", "Target Redirection", "Discovery Tests", test_target_redirect},
-};
+/*
+ * Raw session with CRC32C digests offered as requested. Returns TEST_PASS
+ * when logged in, otherwise the result already set on the report.
+ */
+static test_result_t login_with_digests(iscsi_raw_conn_t *conn, test_config_t *config,
+                                        test_report_t *report, int header_digest,
+                                        int data_digest) {
+    iscsi_raw_params_t params = { -1, -1, 0, 0, 0, header_digest, data_digest, 0 };
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified in config");
+        return TEST_SKIP;
+    }
+    if (config->auth_method && strcmp(config->auth_method, "none") != 0) {
+        report_set_result(report, TEST_SKIP, "Digest tests use a raw session and require auth_method = none");
+        return TEST_SKIP;
+    }
 
-static test_def_t login_tests[] = {
-    {"TL-001", "Basic Login", "Login/Logout Tests", test_basic_login},
-    {"TL-002", "Parameter Negotiation", "Login/Logout Tests", test_param_negotiation},
-    {"TL-003", "Invalid Parameter Values", "Login/Logout Tests", test_invalid_params},
-    {"TL-004", "Multiple Login Attempts", "Login/Logout Tests", test_multiple_logins},
-    {"TL-005", "Login Timeout", "Login/Logout Tests", test_login_timeout},
-    {"TL-006", "Simultaneous Logins", "Login/Logout Tests", test_simultaneous_logins},
+    if (iscsi_raw_connect(conn, config->portal) != 0 ||
+        iscsi_raw_login(conn, "iqn.2024-12.com.test:initiator", config->iqn, &params) != 0) {
+        report_set_result(report, TEST_FAIL, "Login offering CRC32C digests failed");
+        iscsi_raw_close(conn);
+        return TEST_FAIL;
+    }
+    if ((header_digest && !conn->header_digest) || (data_digest && !conn->data_digest)) {
+        report_set_result(report, TEST_FAIL, "Target declined CRC32C digests");
+        iscsi_raw_close(conn);
+        return TEST_FAIL;
+    }
+    return TEST_PASS;
+}
+
+/* Check that a fresh session still logs in after a protocol error */
+static int target_still_serving(test_config_t *config) {
+    iscsi_raw_conn_t conn;
+    int ret;
+
+    if (iscsi_raw_connect(&conn, config->portal) != 0) {
+        return 0;
+    }
+    ret = iscsi_raw_login(&conn, "iqn.2024-12.com.test:initiator", config->iqn, NULL) == 0 &&
+          iscsi_raw_nop_ping(&conn) == 0;
+    iscsi_raw_close(&conn);
+    return ret;
+}
+
+/* TL-007: CRC32C Header and Data Digests */
+static test_result_t test_crc32c_digests(struct iscsi_context *unused_iscsi,
+                                         test_config_t *config,
+                                         test_report_t *report) {
+    /* One block, an odd count (padding-free but not a power of two) and a multi-PDU transfer */
+    static const uint32_t sizes[] = { 1, 17, 256 };
+    struct iscsi_context *iscsi;
+    iscsi_raw_conn_t conn;
+    uint32_t block_size;
+    uint64_t num_blocks;
+    uint8_t *write_buf, *read_buf;
+    test_result_t ret;
+    char msg[256];
+
+    (void)unused_iscsi;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified in config");
+        return TEST_SKIP;
+    }
+
+    /*
+     * libiscsi only implements header digests; check it interoperates and
+     * take the block size from the LUN while connected.
+     */
+    iscsi = create_iscsi_context_for_test(config);
+    if (!iscsi) {
+        report_set_result(report, TEST_ERROR, "Failed to create iSCSI context");
+        return TEST_ERROR;
+    }
+    iscsi_set_header_digest(iscsi, ISCSI_HEADER_DIGEST_CRC32C);
+    if (iscsi_connect_target(iscsi, config) != 0 ||
+        scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
+        snprintf(msg, sizeof(msg), "libiscsi session with HeaderDigest=CRC32C failed: %s",
+                 iscsi_get_error(iscsi));
+        report_set_result(report, TEST_FAIL, msg);
+        iscsi_destroy_context(iscsi);
+        return TEST_FAIL;
+    }
+    iscsi_disconnect_target(iscsi);
+    iscsi_destroy_context(iscsi);
+
+    ret = login_with_digests(&conn, config, report, 1, 1);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+
+    write_buf = buffer_pool_get(256 * block_size);
+    read_buf = buffer_pool_get(256 * block_size);
+    if (!write_buf || !read_buf) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        iscsi_raw_close(&conn);
+        return TEST_ERROR;
+    }
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        pattern_mismatch_t mismatch;
+
+        pattern_fill_blocks(write_buf, 0, sizes[i], block_size, i + 1, 0xd16e57);
+        if (iscsi_raw_write10(&conn, config->lun, 0, sizes[i], block_size, write_buf) != 0 ||
+            iscsi_raw_read10(&conn, config->lun, 0, sizes[i], block_size, read_buf) != 0) {
+            snprintf(msg, sizeof(msg), "%u-block I/O failed with digests (%llu digest errors, reject 0x%02x)",
+                     sizes[i], (unsigned long long)conn.digest_errors, conn.last_reject_reason);
+            report_set_result(report, TEST_FAIL, msg);
+            goto fail;
+        }
+        if (pattern_verify_blocks(read_buf, 0, sizes[i], block_size, i + 1, 0xd16e57, &mismatch) != 0) {
+            char detail[200];
+
+            pattern_format_mismatch(&mismatch, detail, sizeof(detail));
+            snprintf(msg, sizeof(msg), "Data mismatch with digests: %s", detail);
+            report_set_result(report, TEST_FAIL, msg);
+            goto fail;
+        }
+    }
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    iscsi_raw_close(&conn);
+
+    snprintf(msg, sizeof(msg), "Header and data digests verified (%s CRC32C)",
+             crc32c_hardware() ? "hardware" : "table");
+    report_set_result(report, TEST_PASS, msg);
+    return TEST_PASS;
+
+fail:
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    iscsi_raw_close(&conn);
+    return TEST_FAIL;
+}
+
+/* TL-008: Corrupted Header Digest */
+static test_result_t test_bad_header_digest(struct iscsi_context *unused_iscsi,
+                                            test_config_t *config,
+                                            test_report_t *report) {
+    iscsi_raw_conn_t conn;
+    test_result_t ret;
+    int answered;
+
+    (void)unused_iscsi;
+
+    ret = login_with_digests(&conn, config, report, 1, 0);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+
+    /*
+     * RFC 3720 Section 6.7: a header that fails its digest cannot be
+     * trusted to frame the rest of the stream, so the target must discard
+     * it or drop the connection. Either way the ping goes unanswered.
+     */
+    conn.corrupt_next_header_digest = 1;
+    iscsi_raw_set_timeout(&conn, config->timeout > 5 ? 5 : config->timeout);
+    answered = iscsi_raw_nop_ping(&conn) == 0;
+    iscsi_raw_close(&conn);
+
+    if (answered) {
+        report_set_result(report, TEST_FAIL, "Target answered a PDU with a corrupted header digest");
+        return TEST_FAIL;
+    }
+    if (!target_still_serving(config)) {
+        report_set_result(report, TEST_FAIL, "Target stopped accepting sessions after a header digest error");
+        return TEST_FAIL;
+    }
+
+    report_set_result(report, TEST_PASS, NULL);
+    return TEST_PASS;
+}
+
+/* TL-009: Corrupted Data Digest */
+static test_result_t test_bad_data_digest(struct iscsi_context *unused_iscsi,
+                                          test_config_t *config,
+                                          test_report_t *report) {
+    iscsi_raw_conn_t conn;
+    uint32_t block_size = config->block_size > 0 ? (uint32_t)config->block_size : 512;
+    uint8_t *buf;
+    test_result_t ret;
+    uint8_t reason;
+    int write_ret;
+    char msg[256];
+
+    (void)unused_iscsi;
+
+    ret = login_with_digests(&conn, config, report, 0, 1);
+    if (ret != TEST_PASS) {
+        return ret;
+    }
+
+    buf = buffer_pool_get(block_size);
+    if (!buf) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        iscsi_raw_close(&conn);
+        return TEST_ERROR;
+    }
+
+    /* A payload digest error must be answered with a Reject (reason 0x02) */
+    pattern_fill_blocks(buf, 0, 1, block_size, 1, 0xbad);
+    conn.corrupt_next_data_digest = 1;
+    iscsi_raw_set_timeout(&conn, config->timeout > 5 ? 5 : config->timeout);
+    write_ret = iscsi_raw_write10(&conn, config->lun, 0, 1, block_size, buf);
+    reason = conn.last_reject_reason;
+    buffer_pool_put(buf);
+    iscsi_raw_close(&conn);
+
+    if (write_ret == 0) {
+        report_set_result(report, TEST_FAIL, "Write with a corrupted data digest completed");
+        return TEST_FAIL;
+    }
+    if (reason != 0x02) {
+        snprintf(msg, sizeof(msg), "Expected Reject with Data-Digest-Error (0x02), got %s 0x%02x",
+                 reason ? "reason" : "no Reject,", reason);
+        report_set_result(report, TEST_FAIL, msg);
+        return TEST_FAIL;
+    }
+    if (!target_still_serving(config)) {
+        report_set_result(report, TEST_FAIL, "Target stopped accepting sessions after a data digest error");
+        return TEST_FAIL;
+    }
+
+    report_set_result(report, TEST_PASS, NULL);
+    return TEST_PASS;
+}
+
+/*
+ * TL-010 malformed PDU cases. Case n is generated from FUZZ_SEED + n alone,
+ * so a failure report names the one case needed to reproduce it.
+ */
+#define FUZZ_SEED 0x5eed0010u
+#define FUZZ_CHECK_INTERVAL 16
+#define FUZZ_MAX_PDU 1024
+
+typedef enum {
+    FUZZ_RANDOM_OPCODE,         /* Valid framing, any opcode */
+    FUZZ_FLIPPED_COMMAND,       /* READ(10) with bytes flipped outside the framing fields */
+    FUZZ_RANDOM_CDB,            /* SCSI Command with a random CDB, flags and length */
+    FUZZ_STRAY_DATA_OUT,        /* Data-Out for a task that does not exist */
+    FUZZ_BOGUS_AHS,             /* NOP-Out carrying garbage AHS */
+    FUZZ_GARBAGE_BHS,           /* Random BHS with zero AHS and data lengths */
+    FUZZ_TRUNCATED,             /* Header promises more data than is sent */
+    FUZZ_KIND_COUNT
+} fuzz_kind_t;
+
+static const char *fuzz_kind_name[FUZZ_KIND_COUNT] = {
+    "random opcode", "flipped command", "random CDB", "stray Data-Out",
+    "bogus AHS", "garbage BHS", "truncated PDU"
 };
 
-/* Register all tests */
-void register_discovery_tests(void) {
-    for (size_t i = 0; i < sizeof(discovery_tests) / sizeof(discovery_tests[0]); i++) {
-        framework_register_test(&discovery_tests[i]);
+static void fuzz_put32(uint8_t *buf, uint32_t value) {
+    buf[0] = (uint8_t)(value >> 24);
+    buf[1] = (uint8_t)(value >> 16);
+    buf[2] = (uint8_t)(value >> 8);
+    buf[3] = (uint8_t)value;
+}
+
+static void fuzz_put_dsl(uint8_t *bhs, uint32_t len) {
+    bhs[5] = (uint8_t)(len >> 16);
+    bhs[6] = (uint8_t)(len >> 8);
+    bhs[7] = (uint8_t)len;
+}
+
+/*
+ * Build case `kind` into wire (BHS, AHS, data and padding, no digests).
+ * Returns the number of bytes to send.
+ */
+static size_t fuzz_build_case(fuzz_kind_t kind, unsigned int *seed, const iscsi_raw_conn_t *conn,
+                              uint8_t *wire) {
+    uint8_t *bhs = wire;
+    size_t len = 48;
+
+    /* Start from a well-formed single-block READ(10) */
+    memset(bhs, 0, 48);
+    bhs[0] = 0x01;
+    bhs[1] = 0x80 | 0x40 | 0x01;
+    fuzz_put32(bhs + 16, 0x0f000000u | (conn->itt & 0xFFFFFF));
+    fuzz_put32(bhs + 20, 512);
+    fuzz_put32(bhs + 24, conn->cmd_sn);
+    fuzz_put32(bhs + 28, conn->exp_stat_sn);
+    bhs[32] = 0x28;
+    bhs[40] = 1;
+
+    switch (kind) {
+    case FUZZ_RANDOM_OPCODE:
+        bhs[0] = (uint8_t)(rand_r(seed) & 0x7F);
+        bhs[1] = (uint8_t)rand_r(seed);
+        break;
+
+    case FUZZ_FLIPPED_COMMAND: {
+        int flips = 1 + rand_r(seed) % 4;
+
+        for (int i = 0; i < flips; i++) {
+            int off = rand_r(seed) % 44;
+
+            off = off < 4 ? off : off + 4;      /* Keep TotalAHSLength and DSL intact */
+            bhs[off] ^= (uint8_t)(1 + rand_r(seed) % 255);
+        }
+        break;
+    }
+
+    case FUZZ_RANDOM_CDB:
+        bhs[1] = (uint8_t)(0x80 | (rand_r(seed) & 0x67));
+        fuzz_put32(bhs + 20, (uint32_t)rand_r(seed) % (1U << 20));
+        for (int i = 32; i < 48; i++) {
+            bhs[i] = (uint8_t)rand_r(seed);
+        }
+        break;
+
+    case FUZZ_STRAY_DATA_OUT: {
+        uint32_t dsl = 1 + (uint32_t)rand_r(seed) % 512;
+
+        bhs[0] = 0x05;
+        bhs[1] = rand_r(seed) % 2 ? 0x80 : 0;
+        fuzz_put32(bhs + 16, (uint32_t)rand_r(seed));
+        fuzz_put32(bhs + 20, (uint32_t)rand_r(seed));
+        fuzz_put32(bhs + 24, 0);
+        fuzz_put32(bhs + 36, (uint32_t)rand_r(seed) % 16);
+        fuzz_put32(bhs + 40, (uint32_t)rand_r(seed) % (1U << 20));
+        memset(bhs + 32, 0, 4);
+        memset(bhs + 44, 0, 4);
+        fuzz_put_dsl(bhs, dsl);
+        for (uint32_t i = 0; i < dsl; i++) {
+            wire[len + i] = (uint8_t)rand_r(seed);
+        }
+        memset(wire + len + dsl, 0, (4 - dsl % 4) % 4);
+        len += (dsl + 3) & ~3U;
+        break;
+    }
+
+    case FUZZ_BOGUS_AHS: {
+        int words = 1 + rand_r(seed) % 16;
+
+        memset(bhs + 20, 0, 28);
+        bhs[0] = 0x40;                          /* Immediate NOP-Out */
+        bhs[1] = 0x80;
+        fuzz_put32(bhs + 20, 0xFFFFFFFFu);
+        fuzz_put32(bhs + 24, conn->cmd_sn);
+        fuzz_put32(bhs + 28, conn->exp_stat_sn);
+        bhs[4] = (uint8_t)words;
+        for (int i = 0; i < words * 4; i++) {
+            wire[len + i] = (uint8_t)rand_r(seed);
+        }
+        len += (size_t)words * 4;
+        break;
+    }
+
+    case FUZZ_GARBAGE_BHS:
+        for (int i = 0; i < 48; i++) {
+            bhs[i] = (uint8_t)rand_r(seed);
+        }
+        memset(bhs + 4, 0, 4);
+        break;
+
+    case FUZZ_TRUNCATED: {
+        /* WRITE(10) with immediate data: the header claims more than follows */
+        uint32_t dsl = 64 + (uint32_t)rand_r(seed) % (FUZZ_MAX_PDU - 112);
+
+        bhs[1] = 0x80 | 0x20 | 0x01;
+        bhs[32] = 0x2a;
+        fuzz_put32(bhs + 20, 2048);
+        fuzz_put_dsl(bhs, dsl);
+        len += (uint32_t)rand_r(seed) % dsl;
+        memset(wire + 48, 0xA5, len - 48);
+        break;
+    }
+
+    default:
+        break;
+    }
+    return len;
+}
+
+/* TL-010: Malformed PDU Fuzzing */
+static test_result_t test_pdu_fuzzing(struct iscsi_context *unused_iscsi,
+                                      test_config_t *config,
+                                      test_report_t *report) {
+    int cases = config->stress_iterations > 0 ? config->stress_iterations : 100;
+    int timeout = config->timeout > 2 ? 2 : config->timeout;
+    int kind_answered[FUZZ_KIND_COUNT] = {0};
+    int answered = 0, rejected = 0, dropped = 0;
+    uint8_t wire[FUZZ_MAX_PDU];
+    char msg[512];
+
+    (void)unused_iscsi;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified in config");
+        return TEST_SKIP;
+    }
+    if (config->auth_method && strcmp(config->auth_method, "none") != 0) {
+        report_set_result(report, TEST_SKIP, "PDU fuzzing uses a raw session and requires auth_method = none");
+        return TEST_SKIP;
+    }
+
+    for (int n = 0; n < cases; n++) {
+        unsigned int seed = FUZZ_SEED + (unsigned int)n;
+        fuzz_kind_t kind = (fuzz_kind_t)(n % FUZZ_KIND_COUNT);
+        iscsi_raw_conn_t conn;
+        size_t len;
+
+        if (iscsi_raw_connect(&conn, config->portal) != 0 ||
+            iscsi_raw_login(&conn, "iqn.2024-12.com.test:initiator", config->iqn, NULL) != 0) {
+            snprintf(msg, sizeof(msg), "Login failed before fuzz case %d (%s, seed 0x%08x)",
+                     n, fuzz_kind_name[kind], seed);
+            report_set_result(report, TEST_FAIL, msg);
+            iscsi_raw_close(&conn);
+            return TEST_FAIL;
+        }
+        iscsi_raw_set_timeout(&conn, timeout);
+
+        len = fuzz_build_case(kind, &seed, &conn, wire);
+        if (iscsi_raw_send_bytes(&conn, wire, len) != 0) {
+            dropped++;
+        } else if (kind == FUZZ_TRUNCATED) {
+            /* Hang up mid-PDU: the target must give up on the rest */
+            dropped++;
+        } else if (iscsi_raw_nop_ping(&conn) == 0) {
+            answered++;
+            kind_answered[kind]++;
+            if (conn.last_reject_reason) {
+                rejected++;
+            }
+        } else {
+            dropped++;
+        }
+
+        /* Whatever the session's state now, drop it without logging out */
+        conn.full_feature = 0;
+        iscsi_raw_close(&conn);
+
+        if ((n + 1) % FUZZ_CHECK_INTERVAL == 0 || n + 1 == cases) {
+            if (!target_still_serving(config)) {
+                snprintf(msg, sizeof(msg),
+                         "Target stopped accepting sessions after fuzz cases %d-%d (seed 0x%08x + case)",
+                         n - n % FUZZ_CHECK_INTERVAL, n, FUZZ_SEED);
+                report_set_result(report, TEST_FAIL, msg);
+                return TEST_FAIL;
+            }
+        }
+    }
+
+    snprintf(msg, sizeof(msg),
+             "%d malformed PDUs: %d sessions resynchronised (%d with a Reject), %d dropped",
+             cases, answered, rejected, dropped);
+    if (config->verbosity >= 1) {
+        for (int k = 0; k < FUZZ_KIND_COUNT; k++) {
+            printf("    %-16s %d answered\n", fuzz_kind_name[k], kind_answered[k]);
+        }
+    }
+    report_set_result(report, TEST_PASS, msg);
+    return TEST_PASS;
+}
+
+/* Seconds TL-011 leaves its sessions idle before pinging them */
+#define IDLE_HOLD_SECONDS 2
+
+/* TL-011: Many Idle Sessions */
+static test_result_t test_idle_sessions(struct iscsi_context *unused_iscsi,
+                                        test_config_t *config,
+                                        test_report_t *report) {
+    int wanted = config->idle_sessions > 0 ? config->idle_sessions : 64;
+    iscsi_raw_conn_t *conns = NULL;
+    latency_hist_t *logins = NULL;
+    test_result_t result = TEST_PASS;
+    int opened = 0, answered = 0;
+    char msg[512];
+
+    (void)unused_iscsi;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified in config");
+        return TEST_SKIP;
+    }
+    if (config->auth_method && strcmp(config->auth_method, "none") != 0) {
+        report_set_result(report, TEST_SKIP, "Idle session test uses raw sessions and requires auth_method = none");
+        return TEST_SKIP;
+    }
+
+    conns = calloc((size_t)wanted, sizeof(*conns));
+    logins = calloc(1, sizeof(*logins));
+    if (!conns || !logins) {
+        report_set_result(report, TEST_ERROR, "Out of memory");
+        result = TEST_ERROR;
+        goto cleanup;
+    }
+    latency_hist_reset(logins);
+
+    /* Log in one after another, keeping every session open */
+    for (int i = 0; i < wanted; i++) {
+        uint64_t start = latency_now_ns();
+
+        if (iscsi_raw_connect(&conns[i], config->portal) != 0 ||
+            iscsi_raw_login(&conns[i], "iqn.2024-12.com.test:initiator", config->iqn, NULL) != 0) {
+            /* Most likely the target's connection limit */
+            iscsi_raw_close(&conns[i]);
+            break;
+        }
+        latency_hist_record(logins, start, latency_now_ns());
+        iscsi_raw_set_timeout(&conns[i], config->timeout);
+        opened++;
+    }
+    if (opened == 0) {
+        report_set_result(report, TEST_FAIL, "No session could log in");
+        result = TEST_FAIL;
+        goto cleanup;
+    }
+
+    /* Every session must still answer after sitting idle, newest first */
+    sleep(IDLE_HOLD_SECONDS);
+    for (int i = opened - 1; i >= 0; i--) {
+        if (iscsi_raw_nop_ping(&conns[i]) == 0) {
+            answered++;
+        }
     }
-    for (size_t i = 0; i < sizeof(login_tests) / sizeof(login_tests[0]); i++) {
-        framework_register_test(&login_tests[i]);
+
+    snprintf(msg, sizeof(msg),
+             "%d/%d sessions logged in (login p50 %.3f ms, p99 %.3f ms, max %.3f ms), "
+             "%d answered after %ds idle%s",
+             opened, wanted,
+             latency_hist_percentile(logins, 0.50) / 1e6,
+             latency_hist_percentile(logins, 0.99) / 1e6,
+             logins->max_ns / 1e6,
+             answered, IDLE_HOLD_SECONDS,
+             opened < wanted ? "; target refused the rest" : "");
+    result = answered == opened ? TEST_PASS : TEST_FAIL;
+    report_set_result(report, result, msg);
+
+cleanup:
+    for (int i = 0; i < opened; i++) {
+        iscsi_raw_close(&conns[i]);
     }
+    free(conns);
+    free(logins);
+    return result;
 }
+
+/* Test definitions */
+static const test_def_t discovery_tests[] = {
+    {"TD-001", "Basic Discovery", "Discovery Tests", test_basic_discovery, 0},
+    {"TD-002", "Discovery With Authentication", "Discovery Tests", test_discovery_auth, 0},
+    {"TD-003", "Discovery Without Credentials", "Discovery Tests", test_discovery_no_creds, 0},
+    {"TD-004", "Target Redirection", "Discovery Tests", test_target_redirect, 0},
+
+    {"TL-001", "Basic Login", "Login/Logout Tests", test_basic_login, 0},
+    {"TL-002", "Parameter Negotiation", "Login/Logout Tests", test_param_negotiation, 0},
+    {"TL-003", "Invalid Parameter Values", "Login/Logout Tests", test_invalid_params, 0},
+    {"TL-004", "Multiple Login Attempts", "Login/Logout Tests", test_multiple_logins, 0},
+    {"TL-005", "Login Timeout", "Login/Logout Tests", test_login_timeout, 0},
+    {"TL-006", "Simultaneous Logins", "Login/Logout Tests", test_simultaneous_logins, 0},
+    {"TL-007", "CRC32C Header and Data Digests", "Login/Logout Tests", test_crc32c_digests, 0},
+    {"TL-008", "Corrupted Header Digest", "Login/Logout Tests", test_bad_header_digest, 0},
+    {"TL-009", "Corrupted Data Digest", "Login/Logout Tests", test_bad_data_digest, 0},
+    {"TL-010", "Malformed PDU Fuzzing", "Login/Logout Tests", test_pdu_fuzzing, 0},
+    {"TL-011", "Many Idle Sessions", "Login/Logout Tests", test_idle_sessions, 0},
+};
+
+/* Listed in the build-time test table (see TEST_GROUPS in the Makefile) */
+const test_group_t discovery_test_group = {
+    "discovery", "Discovery and login tests", true,
+    discovery_tests, sizeof(discovery_tests) / sizeof(discovery_tests[0])
+};
@@ -3,7 +3,7 @@
 
 #include "test_framework.h"
 
-/* Register all discovery and login tests */
-void register_discovery_tests(void);
+/* The discovery and login tests, for the build-time test table */
+extern const test_group_t discovery_test_group;
 
 #endif /* TEST_DISCOVERY_H */
@@ -1,4 +1,7 @@
 #include "test_framework.h"
+#include "utils.h"
+#include <fnmatch.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,14 +11,28 @@
 /* Maximum number of tests */
 #define MAX_TESTS 256
 
-/* Global test registry */
-static test_def_t *test_registry[MAX_TESTS];
+/* Tests selected from test_groups for this run, in table order */
+static const test_def_t *selected_tests[MAX_TESTS];
 static int test_count = 0;
 
 /* Global test reports */
 static test_report_t **test_reports = NULL;
 static int report_count = 0;
 
+/* Logged-in sessions handed to tests flagged TEST_FLAG_POOLED_SESSION */
+#define MAX_POOLED_SESSIONS 64
+static struct iscsi_context *session_pool[MAX_POOLED_SESSIONS];
+static int session_pool_size = 0;
+
+/* Upper bound on -j; every worker needs its own pool slot */
+#define MAX_PARALLEL_JOBS MAX_POOLED_SESSIONS
+
+/* Start of the current run, used to name report files */
+static time_t run_start_time;
+
+/* Report of the test running on this thread, for helpers that record latency */
+static __thread test_report_t *current_report = NULL;
+
 /* Initialize test framework */
 void framework_init(void) {
     test_count = 0;
@@ -33,12 +50,72 @@ void framework_cleanup(void) {
         test_reports = NULL;
     }
     report_count = 0;
+    buffer_pool_destroy();
+}
+
+/* Whether id matches one of the comma-separated glob patterns in filter */
+static bool filter_matches(const char *filter, const char *id) {
+    char pattern[64];
+
+    while (*filter) {
+        size_t len = strcspn(filter, ",");
+
+        if (len > 0 && len < sizeof(pattern)) {
+            memcpy(pattern, filter, len);
+            pattern[len] = '\0';
+            if (fnmatch(pattern, id, 0) == 0) {
+                return true;
+            }
+        }
+        filter += len;
+        if (*filter == ',') {
+            filter++;
+        }
+    }
+    return false;
+}
+
+/*
+ * Pick the tests to run from the generated table. category is a group
+ * name or "all" (the groups marked in_all); NULL means "all" without a
+ * filter and every group with one, so a filter alone can pick any test.
+ * filter is a comma-separated list of globs matched against test IDs,
+ * e.g. "TC-011,TP-01*"; NULL selects every test in the chosen groups.
+ * Returns the number selected, or -1 for an unknown category.
+ */
+int framework_select_tests(const char *category, const char *filter) {
+    bool known = category == NULL || strcmp(category, "all") == 0;
+
+    test_count = 0;
+    for (size_t g = 0; g < test_group_count; g++) {
+        const test_group_t *group = test_groups[g];
+        bool selected;
+
+        if (category == NULL) {
+            selected = filter != NULL || group->in_all;
+        } else if (strcmp(category, "all") == 0) {
+            selected = group->in_all;
+        } else {
+            selected = strcmp(category, group->name) == 0;
+            known |= selected;
+        }
+        for (size_t i = 0; selected && i < group->count && test_count < MAX_TESTS; i++) {
+            if (!filter || filter_matches(filter, group->tests[i].test_id)) {
+                selected_tests[test_count++] = &group->tests[i];
+            }
+        }
+    }
+    return known ? test_count : -1;
 }
 
-/* Register a test */
-void framework_register_test(test_def_t *test) {
-    if (test_count < MAX_TESTS) {
-        test_registry[test_count++] = test;
+/* Print the selected tests, one per line, without running anything */
+void framework_list_tests(void) {
+    for (int i = 0; i < test_count; i++) {
+        const test_def_t *test = selected_tests[i];
+
+        printf("%-8s %-45s %s%s%s\n", test->test_id, test->test_name, test->category,
+               (test->flags & TEST_FLAG_POOLED_SESSION) ? "  pooled" : "",
+               (test->flags & TEST_FLAG_PARALLEL) ? "  parallel" : "");
     }
 }
 
@@ -63,6 +140,13 @@ test_report_t* report_create(const char *test_id, const char *test_name, const c
     report->message = NULL;
     report->duration_ms = 0.0;
 
+    /* Allocated up front so recording never allocates */
+    report->latency = calloc(1, sizeof(latency_hist_t));
+    if (!report->latency) {
+        free(report);
+        return NULL;
+    }
+
     return report;
 }
 
@@ -81,10 +165,41 @@ void report_free(test_report_t *report) {
         if (report->message) {
             free(report->message);
         }
+        free(report->latency);
         free(report);
     }
 }
 
+/* Get the report of the test currently running on this thread */
+test_report_t* framework_current_report(void) {
+    return current_report;
+}
+
+/* Record one operation that started at start_ns and just finished */
+void report_record_op(test_report_t *report, uint64_t start_ns, uint64_t bytes) {
+    if (report && report->latency) {
+        latency_hist_record(report->latency, start_ns, latency_now_ns());
+        report->bytes += bytes;
+    }
+}
+
+/* Format operation count, rate and latency percentiles (ms) into buf */
+static void format_latency(const latency_hist_t *hist, char *buf, size_t size) {
+    snprintf(buf, size,
+             "%llu ops, %.0f ops/s, latency ms min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f",
+             (unsigned long long)hist->total,
+             latency_hist_ops_per_sec(hist),
+             hist->min_ns / 1e6,
+             latency_hist_percentile(hist, 0.50) / 1e6,
+             latency_hist_percentile(hist, 0.90) / 1e6,
+             latency_hist_percentile(hist, 0.99) / 1e6,
+             hist->max_ns / 1e6);
+}
+
+static int report_has_latency(const test_report_t *report) {
+    return report->latency && report->latency->total > 0;
+}
+
 /* Convert result to string */
 const char* result_to_string(test_result_t result) {
     switch (result) {
@@ -123,14 +238,204 @@ static void print_test_result(test_report_t *report, int verbosity) {
     if (report->message && (verbosity > 0 || report->result == TEST_FAIL || report->result == TEST_ERROR)) {
         printf("    └─ %s\n", report->message);
     }
+
+    if (verbosity > 0 && report_has_latency(report)) {
+        char line[256];
+        format_latency(report->latency, line, sizeof(line));
+        printf("    └─ %s\n", line);
+    }
+}
+
+/* Get pooled session for a slot, logging in on first use. NULL if login fails. */
+static struct iscsi_context* pool_get(test_config_t *config, int slot) {
+    if (!session_pool[slot]) {
+        struct iscsi_context *iscsi = create_iscsi_context_for_test(config);
+        if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+            if (iscsi) iscsi_destroy_context(iscsi);
+            return NULL;
+        }
+        session_pool[slot] = iscsi;
+    }
+    return session_pool[slot];
+}
+
+/* Drop a pooled session; the next pooled test on this slot logs in again */
+static void pool_discard(int slot) {
+    if (session_pool[slot]) {
+        iscsi_disconnect_target(session_pool[slot]);
+        iscsi_destroy_context(session_pool[slot]);
+        session_pool[slot] = NULL;
+    }
+}
+
+/* Run one test on this thread, timing it into its report */
+static test_report_t* run_single_test(const test_def_t *test, test_config_t *config, int pool_slot) {
+    test_report_t *report = report_create(test->test_id, test->test_name, test->category);
+    if (!report) {
+        fprintf(stderr, "Failed to create test report\n");
+        return NULL;
+    }
+
+    /* Hand out a pooled session if the test accepts one */
+    struct iscsi_context *iscsi = NULL;
+    if (pool_slot >= 0) {
+        iscsi = pool_get(config, pool_slot);
+    }
+
+    current_report = report;
+    double start_time = get_time_ms();
+    test_result_t result = test->func(iscsi, config, report);
+    double end_time = get_time_ms();
+    current_report = NULL;
+
+    report->duration_ms = end_time - start_time;
+    if (report->result == TEST_ERROR) {
+        report->result = result;
+    }
+
+    /* A failed test may have left its session unusable; start the next one fresh */
+    if (iscsi && report->result != TEST_PASS && report->result != TEST_SKIP) {
+        pool_discard(pool_slot);
+    }
+
+    return report;
+}
+
+/* Count, print and store a finished test. Returns 1 if the run should stop. */
+static int finish_test(test_report_t *report, test_config_t *config, test_stats_t *stats,
+                       bool add_duration) {
+    stats->total++;
+    if (add_duration) {
+        stats->total_duration_ms += report->duration_ms;
+    }
+    switch (report->result) {
+        case TEST_PASS:  stats->passed++; break;
+        case TEST_FAIL:  stats->failed++; break;
+        case TEST_SKIP:  stats->skipped++; break;
+        case TEST_ERROR: stats->errors++; break;
+    }
+
+    print_test_result(report, config->verbosity);
+    test_reports[report_count++] = report;
+
+    return config->stop_on_fail && report->result == TEST_FAIL;
+}
+
+/* A run of consecutive TEST_FLAG_PARALLEL tests shared by the workers */
+typedef struct {
+    const test_def_t **tests;
+    test_report_t **reports;
+    int count;
+    int next;                   /* Next unclaimed test, under lock */
+    pthread_mutex_t lock;
+    test_config_t *config;
+    uint64_t window_blocks;
+} parallel_batch_t;
+
+typedef struct {
+    parallel_batch_t *batch;
+    int worker;
+} parallel_worker_t;
+
+/* Worker: claim tests until the batch is drained, all inside this worker's LBA window */
+static void* parallel_worker(void *arg) {
+    parallel_worker_t *w = arg;
+    parallel_batch_t *batch = w->batch;
+
+    scsi_set_lba_window((uint64_t)w->worker * batch->window_blocks, batch->window_blocks);
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int index = batch->next < batch->count ? batch->next++ : -1;
+        pthread_mutex_unlock(&batch->lock);
+        if (index < 0) {
+            break;
+        }
+
+        const test_def_t *test = batch->tests[index];
+        int pool_slot = (session_pool_size > 0 && (test->flags & TEST_FLAG_POOLED_SESSION)) ?
+                        w->worker : -1;
+        batch->reports[index] = run_single_test(test, batch->config, pool_slot);
+    }
+
+    scsi_set_lba_window(0, 0);
+    return NULL;
+}
+
+/*
+ * Blocks each worker may use. The configured window is shrunk so that
+ * jobs windows fit on the LUN; capacity is read once with a throwaway
+ * session. Returns 0 if the LUN cannot hold a block per worker.
+ */
+static uint64_t parallel_window_blocks(test_config_t *config, int jobs) {
+    uint64_t window = config->lba_window_blocks > 0 ? (uint64_t)config->lba_window_blocks : 65536;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    struct iscsi_context *iscsi = create_iscsi_context_for_test(config);
+
+    if (!iscsi) {
+        return window;
+    }
+    if (iscsi_connect_target(iscsi, config) == 0) {
+        if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) == 0 &&
+            num_blocks / jobs < window) {
+            window = num_blocks / jobs;
+        }
+        iscsi_disconnect_target(iscsi);
+    }
+    iscsi_destroy_context(iscsi);
+    return window;
+}
+
+/* Run tests[0..count) on up to jobs workers; reports come back in table order */
+static void run_parallel_batch(const test_def_t **tests, int count, test_config_t *config,
+                             int jobs, uint64_t window_blocks, test_report_t **reports) {
+    parallel_batch_t batch = {
+        .tests = tests, .reports = reports, .count = count, .next = 0,
+        .config = config, .window_blocks = window_blocks
+    };
+    parallel_worker_t workers[MAX_PARALLEL_JOBS];
+    pthread_t threads[MAX_PARALLEL_JOBS];
+    int started = 0;
+
+    if (jobs > count) {
+        jobs = count;
+    }
+    pthread_mutex_init(&batch.lock, NULL);
+
+    for (int w = 0; w < jobs; w++) {
+        workers[w].batch = &batch;
+        workers[w].worker = w;
+        if (pthread_create(&threads[w], NULL, parallel_worker, &workers[w]) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    /* No worker thread could be started; drain the batch on this thread */
+    if (started == 0) {
+        workers[0].batch = &batch;
+        workers[0].worker = 0;
+        parallel_worker(&workers[0]);
+    }
+    for (int w = 0; w < started; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    pthread_mutex_destroy(&batch.lock);
 }
 
 /* Run all registered tests */
 int framework_run_tests(test_config_t *config) {
-    struct iscsi_context *iscsi = NULL;
     const char *current_category = NULL;
+    int pooled_runs = 0;
+    int jobs = config->jobs > 1 ? config->jobs : 1;
+    uint64_t window_blocks = 0;
+    bool window_checked = false;
     test_stats_t stats = {0};
 
+    run_start_time = time(NULL);
+
     /* Allocate reports array */
     test_reports = calloc(test_count, sizeof(test_report_t *));
     if (!test_reports) {
@@ -144,11 +449,31 @@ int framework_run_tests(test_config_t *config) {
     if (config->iqn && strlen(config->iqn) > 0) {
         printf("IQN: %s\n", config->iqn);
     }
-    printf("LUN: %d\n\n", config->lun);
+    printf("LUN: %d\n", config->lun);
+
+    if (jobs > MAX_PARALLEL_JOBS) {
+        jobs = MAX_PARALLEL_JOBS;
+    }
+    if (jobs > 1) {
+        printf("Parallel jobs: %d\n", jobs);
+    }
+
+    /* Session pooling needs a target to log in to; each parallel worker owns a slot */
+    session_pool_size = 0;
+    if (config->session_pool > 0 && config->iqn && strlen(config->iqn) > 0) {
+        session_pool_size = config->session_pool < MAX_POOLED_SESSIONS ?
+                            config->session_pool : MAX_POOLED_SESSIONS;
+        if (session_pool_size < jobs) {
+            session_pool_size = jobs;
+        }
+        printf("Session pool: %d\n", session_pool_size);
+    }
+    printf("\n");
 
     /* Run each test */
-    for (int i = 0; i < test_count; i++) {
-        test_def_t *test = test_registry[i];
+    int stop = 0;
+    for (int i = 0; i < test_count && !stop; i++) {
+        const test_def_t *test = selected_tests[i];
 
         /* Print category header if changed */
         if (!current_category || strcmp(current_category, test->category) != 0) {
@@ -156,46 +481,77 @@ int framework_run_tests(test_config_t *config) {
             printf("\n[%s]\n", current_category);
         }
 
-        /* Create test report */
-        test_report_t *report = report_create(test->test_id, test->test_name, test->category);
-        if (!report) {
-            fprintf(stderr, "Failed to create test report\n");
-            continue;
+        /*
+         * Consecutive parallel-safe tests in this category run as one batch.
+         * Everything else (discovery, login, benchmarks) stays serial.
+         */
+        int batch_end = i;
+        if (jobs > 1 && (test->flags & TEST_FLAG_PARALLEL)) {
+            while (batch_end < test_count &&
+                   (selected_tests[batch_end]->flags & TEST_FLAG_PARALLEL) &&
+                   strcmp(selected_tests[batch_end]->category, current_category) == 0) {
+                batch_end++;
+            }
         }
 
-        /* Run the test */
-        double start_time = get_time_ms();
-        test_result_t result = test->func(iscsi, config, report);
-        double end_time = get_time_ms();
-
-        report->duration_ms = end_time - start_time;
-        if (report->result == TEST_ERROR) {
-            report->result = result;
+        if (batch_end - i > 1) {
+            int count = batch_end - i;
+
+            if (!window_checked) {
+                window_blocks = parallel_window_blocks(config, jobs);
+                window_checked = true;
+            }
+
+            if (window_blocks > 0) {
+                test_report_t **reports = calloc(count, sizeof(test_report_t *));
+                if (reports) {
+                    double start_time = get_time_ms();
+                    run_parallel_batch(&selected_tests[i], count, config, jobs,
+                                       window_blocks, reports);
+                    stats.total_duration_ms += get_time_ms() - start_time;
+
+                    /* Results are printed in table order once the batch is done */
+                    for (int j = 0; j < count; j++) {
+                        if (!reports[j]) {
+                            continue;
+                        }
+                        if (!stop && finish_test(reports[j], config, &stats, false)) {
+                            printf("\nStopping on first failure (stop_on_fail=true)\n");
+                            stop = 1;
+                        } else if (stop) {
+                            /* Already ran, but the run stopped before it; keep it out of the results */
+                            report_free(reports[j]);
+                        }
+                    }
+                    free(reports);
+                    i = batch_end - 1;
+                    continue;
+                }
+            }
+            /* No room for per-worker windows; fall back to running serially */
         }
 
-        /* Update statistics */
-        stats.total++;
-        stats.total_duration_ms += report->duration_ms;
-        switch (report->result) {
-            case TEST_PASS:  stats.passed++; break;
-            case TEST_FAIL:  stats.failed++; break;
-            case TEST_SKIP:  stats.skipped++; break;
-            case TEST_ERROR: stats.errors++; break;
+        int pool_slot = -1;
+        if (session_pool_size > 0 && (test->flags & TEST_FLAG_POOLED_SESSION)) {
+            pool_slot = pooled_runs++ % session_pool_size;
         }
 
-        /* Print result */
-        print_test_result(report, config->verbosity);
-
-        /* Store report */
-        test_reports[report_count++] = report;
+        test_report_t *report = run_single_test(test, config, pool_slot);
+        if (!report) {
+            continue;
+        }
 
-        /* Stop on failure if requested */
-        if (config->stop_on_fail && report->result == TEST_FAIL) {
+        if (finish_test(report, config, &stats, true)) {
             printf("\nStopping on first failure (stop_on_fail=true)\n");
-            break;
+            stop = 1;
         }
     }
 
+    /* Log out pooled sessions */
+    for (int i = 0; i < session_pool_size; i++) {
+        pool_discard(i);
+    }
+
     /* Print summary */
     framework_print_summary(&stats);
 
@@ -204,8 +560,15 @@ int framework_run_tests(test_config_t *config) {
         framework_generate_report(config, &stats);
     }
 
-    /* Return non-zero if any failures */
-    return (stats.failed > 0 || stats.errors > 0) ? 1 : 0;
+    /* Compare against a baseline run if requested */
+    int regressions = 0;
+    if (config->compare_baseline) {
+        regressions = framework_compare_baseline(config->compare_baseline,
+                                                 config->compare_tolerance);
+    }
+
+    /* Return non-zero if any failures or performance regressions */
+    return (stats.failed > 0 || stats.errors > 0 || regressions != 0) ? 1 : 0;
 }
 
 /* Print test summary */
@@ -214,24 +577,96 @@ void framework_print_summary(test_stats_t *stats) {
     printf("Results: %d passed, %d failed, %d skipped, %d errors\n",
            stats->passed, stats->failed, stats->skipped, stats->errors);
     printf("Duration: %.1f seconds\n", stats->total_duration_ms / 1000.0);
+
+    /* Per-operation latency table for tests that recorded any */
+    int header_printed = 0;
+    for (int i = 0; i < report_count; i++) {
+        const latency_hist_t *h = test_reports[i]->latency;
+
+        if (!report_has_latency(test_reports[i])) {
+            continue;
+        }
+        if (!header_printed) {
+            printf("\nOperation latency (ms):\n");
+            printf("  %-8s %10s %10s %9s %9s %9s %9s %9s\n",
+                   "Test", "Ops", "Ops/s", "Min", "P50", "P90", "P99", "Max");
+            header_printed = 1;
+        }
+        printf("  %-8s %10llu %10.0f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+               test_reports[i]->test_id,
+               (unsigned long long)h->total,
+               latency_hist_ops_per_sec(h),
+               h->min_ns / 1e6,
+               latency_hist_percentile(h, 0.50) / 1e6,
+               latency_hist_percentile(h, 0.90) / 1e6,
+               latency_hist_percentile(h, 0.99) / 1e6,
+               h->max_ns / 1e6);
+    }
 }
 
-/* Generate detailed report */
-void framework_generate_report(test_config_t *config, test_stats_t *stats) {
-    char filename[256];
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
+/* Build reports/test_report_YYYYMMDD_HHMMSS.<ext> from the run start time */
+static void report_filename(char *buf, size_t size, const char *ext) {
+    struct tm *t = localtime(&run_start_time);
 
-    snprintf(filename, sizeof(filename),
-             "reports/test_report_%04d%02d%02d_%02d%02d%02d.txt",
+    snprintf(buf, size,
+             "reports/test_report_%04d%02d%02d_%02d%02d%02d.%s",
              t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-             t->tm_hour, t->tm_min, t->tm_sec);
+             t->tm_hour, t->tm_min, t->tm_sec, ext);
+}
 
-    FILE *f = fopen(filename, "w");
-    if (!f) {
-        fprintf(stderr, "Failed to create report file: %s\n", filename);
+/* Throughput in MB/s over the span the recorded operations covered */
+static double report_mb_per_sec(const test_report_t *report) {
+    const latency_hist_t *h = report->latency;
+
+    if (!report_has_latency(report) || h->last_end_ns <= h->first_start_ns) {
+        return 0.0;
+    }
+    return report->bytes / ((h->last_end_ns - h->first_start_ns) / 1e9) / 1000000.0;
+}
+
+/* Write a JSON string literal */
+static void json_write_string(FILE *f, const char *str) {
+    fputc('"', f);
+    for (const unsigned char *p = (const unsigned char *)(str ? str : ""); *p; p++) {
+        switch (*p) {
+            case '"':  fputs("\\\"", f); break;
+            case '\\': fputs("\\\\", f); break;
+            case '\n': fputs("\\n", f); break;
+            case '\r': fputs("\\r", f); break;
+            case '\t': fputs("\\t", f); break;
+            default:
+                if (*p < 0x20) {
+                    fprintf(f, "\\u%04x", *p);
+                } else {
+                    fputc(*p, f);
+                }
+        }
+    }
+    fputc('"', f);
+}
+
+/* Write a CSV field, quoting it when needed */
+static void csv_write_field(FILE *f, const char *str) {
+    if (!str) {
         return;
     }
+    if (strpbrk(str, ",\"\r\n") == NULL) {
+        fputs(str, f);
+        return;
+    }
+    fputc('"', f);
+    for (const char *p = str; *p; p++) {
+        if (*p == '"') {
+            fputc('"', f);
+        }
+        fputc(*p, f);
+    }
+    fputc('"', f);
+}
+
+/* Human-readable report */
+static void write_text_report(FILE *f, test_config_t *config, test_stats_t *stats) {
+    struct tm *t = localtime(&run_start_time);
 
     fprintf(f, "iSCSI Target Test Suite - Detailed Report\n");
     fprintf(f, "==========================================\n");
@@ -265,6 +700,12 @@ void framework_generate_report(test_config_t *config, test_stats_t *stats) {
         if (report->message) {
             fprintf(f, "    Message: %s\n", report->message);
         }
+
+        if (report_has_latency(report)) {
+            char line[256];
+            format_latency(report->latency, line, sizeof(line));
+            fprintf(f, "    Operations: %s\n", line);
+        }
     }
 
     fprintf(f, "\n\nSummary:\n");
@@ -275,7 +716,223 @@ void framework_generate_report(test_config_t *config, test_stats_t *stats) {
     fprintf(f, "Skipped: %d\n", stats->skipped);
     fprintf(f, "Errors:  %d\n", stats->errors);
     fprintf(f, "Duration: %.1f seconds\n", stats->total_duration_ms / 1000.0);
+}
+
+/*
+ * JSON report. Each test object is written on a single line so the
+ * baseline reader in framework_compare_baseline() can stay line-based.
+ */
+static void write_json_report(FILE *f, test_config_t *config, test_stats_t *stats) {
+    char date[32];
+
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&run_start_time));
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"date\": \"%s\",\n", date);
+    fprintf(f, "  \"target\": {\"portal\": ");
+    json_write_string(f, config->portal);
+    fprintf(f, ", \"iqn\": ");
+    json_write_string(f, config->iqn);
+    fprintf(f, ", \"lun\": %d},\n", config->lun);
+    fprintf(f, "  \"summary\": {\"total\": %d, \"passed\": %d, \"failed\": %d, "
+               "\"skipped\": %d, \"errors\": %d, \"duration_ms\": %.3f},\n",
+            stats->total, stats->passed, stats->failed, stats->skipped, stats->errors,
+            stats->total_duration_ms);
+    fprintf(f, "  \"tests\": [\n");
+
+    for (int i = 0; i < report_count; i++) {
+        test_report_t *report = test_reports[i];
+        const latency_hist_t *h = report->latency;
+
+        fprintf(f, "    {\"id\": ");
+        json_write_string(f, report->test_id);
+        fprintf(f, ", \"name\": ");
+        json_write_string(f, report->test_name);
+        fprintf(f, ", \"category\": ");
+        json_write_string(f, report->category);
+        fprintf(f, ", \"result\": \"%s\", \"duration_ms\": %.3f",
+                result_to_string(report->result), report->duration_ms);
+        if (report_has_latency(report)) {
+            fprintf(f, ", \"ops\": %llu, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.3f, "
+                       "\"min_ms\": %.6f, \"p50_ms\": %.6f, \"p90_ms\": %.6f, "
+                       "\"p99_ms\": %.6f, \"max_ms\": %.6f",
+                    (unsigned long long)h->total,
+                    latency_hist_ops_per_sec(h),
+                    report_mb_per_sec(report),
+                    h->min_ns / 1e6,
+                    latency_hist_percentile(h, 0.50) / 1e6,
+                    latency_hist_percentile(h, 0.90) / 1e6,
+                    latency_hist_percentile(h, 0.99) / 1e6,
+                    h->max_ns / 1e6);
+        }
+        fprintf(f, ", \"message\": ");
+        if (report->message) {
+            json_write_string(f, report->message);
+        } else {
+            fprintf(f, "null");
+        }
+        fprintf(f, "}%s\n", (i + 1 < report_count) ? "," : "");
+    }
+
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+}
+
+/* CSV report: one row per test */
+static void write_csv_report(FILE *f) {
+    fprintf(f, "id,name,category,result,duration_ms,ops,ops_per_sec,mb_per_sec,"
+               "min_ms,p50_ms,p90_ms,p99_ms,max_ms,message\n");
+
+    for (int i = 0; i < report_count; i++) {
+        test_report_t *report = test_reports[i];
+        const latency_hist_t *h = report->latency;
+
+        csv_write_field(f, report->test_id);
+        fputc(',', f);
+        csv_write_field(f, report->test_name);
+        fputc(',', f);
+        csv_write_field(f, report->category);
+        fprintf(f, ",%s,%.3f", result_to_string(report->result), report->duration_ms);
+        if (report_has_latency(report)) {
+            fprintf(f, ",%llu,%.1f,%.3f,%.6f,%.6f,%.6f,%.6f,%.6f,",
+                    (unsigned long long)h->total,
+                    latency_hist_ops_per_sec(h),
+                    report_mb_per_sec(report),
+                    h->min_ns / 1e6,
+                    latency_hist_percentile(h, 0.50) / 1e6,
+                    latency_hist_percentile(h, 0.90) / 1e6,
+                    latency_hist_percentile(h, 0.99) / 1e6,
+                    h->max_ns / 1e6);
+        } else {
+            fprintf(f, ",,,,,,,,,");
+        }
+        csv_write_field(f, report->message);
+        fputc('\n', f);
+    }
+}
+
+/* Generate report files in the configured formats */
+void framework_generate_report(test_config_t *config, test_stats_t *stats) {
+    struct {
+        bool enabled;
+        const char *ext;
+    } formats[] = {
+        {config->report_text, "txt"},
+        {config->report_json, "json"},
+        {config->report_csv, "csv"},
+    };
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        char filename[256];
+        FILE *f;
+
+        if (!formats[i].enabled) {
+            continue;
+        }
+
+        report_filename(filename, sizeof(filename), formats[i].ext);
+        f = fopen(filename, "w");
+        if (!f) {
+            fprintf(stderr, "Failed to create report file: %s\n", filename);
+            continue;
+        }
+
+        if (strcmp(formats[i].ext, "json") == 0) {
+            write_json_report(f, config, stats);
+        } else if (strcmp(formats[i].ext, "csv") == 0) {
+            write_csv_report(f);
+        } else {
+            write_text_report(f, config, stats);
+        }
+
+        fclose(f);
+        printf("\nDetailed report saved to: %s\n", filename);
+    }
+}
+
+/* Find "key": in a single-line JSON object and return a pointer to its value */
+static const char* json_find_value(const char *line, const char *key) {
+    char pattern[64];
+    const char *p;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    p = strstr(line, pattern);
+    if (!p) {
+        return NULL;
+    }
+    p += strlen(pattern);
+    while (*p == ' ') p++;
+    return p;
+}
+
+/*
+ * Compare this run against a JSON report from an earlier run. A test
+ * regresses when its ops/sec drops, or its p99 latency rises, by more than
+ * tolerance_pct percent. Returns the number of regressions, or -1 if the
+ * baseline could not be read.
+ */
+int framework_compare_baseline(const char *path, double tolerance_pct) {
+    FILE *f = fopen(path, "r");
+    char line[8192];
+    double tol = tolerance_pct / 100.0;
+    int compared = 0;
+    int regressions = 0;
+
+    if (!f) {
+        fprintf(stderr, "Failed to open baseline report: %s\n", path);
+        return -1;
+    }
+
+    printf("\nPerformance comparison vs %s (tolerance %.1f%%):\n", path, tolerance_pct);
+
+    while (fgets(line, sizeof(line), f)) {
+        const char *id_val = json_find_value(line, "id");
+        const char *ops_val = json_find_value(line, "ops_per_sec");
+        const char *p99_val = json_find_value(line, "p99_ms");
+        char id[64];
+        size_t len = 0;
+        test_report_t *report = NULL;
+
+        if (!id_val || *id_val != '"' || !ops_val || !p99_val) {
+            continue;
+        }
+        for (id_val++; *id_val && *id_val != '"' && len < sizeof(id) - 1; id_val++) {
+            id[len++] = *id_val;
+        }
+        id[len] = '\0';
+
+        for (int i = 0; i < report_count; i++) {
+            if (strcmp(test_reports[i]->test_id, id) == 0) {
+                report = test_reports[i];
+                break;
+            }
+        }
+        if (!report || !report_has_latency(report)) {
+            continue;
+        }
+
+        double base_ops = atof(ops_val);
+        double base_p99 = atof(p99_val);
+        double cur_ops = latency_hist_ops_per_sec(report->latency);
+        double cur_p99 = latency_hist_percentile(report->latency, 0.99) / 1e6;
+        compared++;
+
+        if (base_ops > 0 && cur_ops < base_ops * (1.0 - tol)) {
+            printf("  %s: %sREGRESSION%s ops/s %.0f -> %.0f (%+.1f%%)\n",
+                   id, result_to_color(TEST_FAIL), "\033[0m",
+                   base_ops, cur_ops, (cur_ops / base_ops - 1.0) * 100.0);
+            regressions++;
+        }
+        if (base_p99 > 0 && cur_p99 > base_p99 * (1.0 + tol)) {
+            printf("  %s: %sREGRESSION%s p99 %.3fms -> %.3fms (%+.1f%%)\n",
+                   id, result_to_color(TEST_FAIL), "\033[0m",
+                   base_p99, cur_p99, (cur_p99 / base_p99 - 1.0) * 100.0);
+            regressions++;
+        }
+    }
 
     fclose(f);
-    printf("\nDetailed report saved to: %s\n", filename);
+
+    printf("  %d tests compared, %d regressions\n", compared, regressions);
+    return regressions;
 }
@@ -1,10 +1,21 @@
 #ifndef TEST_FRAMEWORK_H
 #define TEST_FRAMEWORK_H
 
+#include "latency_histogram.h"
 #include <iscsi/iscsi.h>
 #include <stdbool.h>
 #include <time.h>
 
+/* Maximum number of queue depths in a benchmark sweep */
+#define MAX_BENCH_QUEUE_DEPTHS 16
+
+/* Maximum number of values per parameter in the negotiation matrix */
+#define MAX_NEGOTIATION_VALUES 8
+
+/* Maximum number of CPUs in a load generator pinning list */
+#define MAX_LOAD_CPUS 64
+#define MAX_SOAK_BLOCK_SIZES 8
+
 /* Test result types */
 typedef enum {
     TEST_PASS,
@@ -21,6 +32,8 @@ typedef struct {
     test_result_t result;
     char *message;
     double duration_ms;
+    latency_hist_t *latency;    /* Per-operation latencies, excludes setup/teardown */
+    uint64_t bytes;             /* Data transferred by recorded operations */
 } test_report_t;
 
 /* Test configuration structure */
@@ -29,6 +42,7 @@ typedef struct {
     char *portal;
     char *iqn;
     int lun;
+    int header_digest;          /* enum iscsi_header_digest for libiscsi sessions */
 
     /* Authentication */
     char *auth_method;
@@ -42,13 +56,69 @@ typedef struct {
     int large_transfer_blocks;
     int timeout;
     int stress_iterations;
+    int lba_window_blocks;      /* Blocks per worker LBA window in parallel mode */
+    int idle_sessions;          /* Sessions TL-011 holds open at once */
+
+    /* Benchmark parameters */
+    int bench_queue_depths[MAX_BENCH_QUEUE_DEPTHS];
+    int bench_queue_depth_count;
+    int bench_duration;
+    int bench_io_blocks;
+    char *metrics_endpoint;     /* Target metrics "host:port", NULL = don't scrape */
+
+    /* Negotiation matrix (TP-005): byte values offered at login */
+    int neg_first_burst_lengths[MAX_NEGOTIATION_VALUES];
+    int neg_first_burst_count;
+    int neg_max_burst_lengths[MAX_NEGOTIATION_VALUES];
+    int neg_max_burst_count;
+    int neg_max_recv_dsls[MAX_NEGOTIATION_VALUES];
+    int neg_max_recv_dsl_count;
+    int neg_io_blocks;          /* Blocks per I/O in the matrix workload */
+
+    /* Multi-session load generator parameters */
+    int load_threads;
+    int load_sessions_per_thread;
+    int load_queue_depth;
+    int load_read_percent;
+    int load_cpus[MAX_LOAD_CPUS];
+    int load_cpu_count;
+
+    /* Soak parameters */
+    int soak_duration;          /* Seconds; 0 = run stress_iterations I/Os */
+    int soak_interval;          /* Seconds between interval stats */
+    int soak_read_percent;
+    int soak_block_sizes[MAX_SOAK_BLOCK_SIZES];     /* Blocks per I/O */
+    int soak_block_weights[MAX_SOAK_BLOCK_SIZES];   /* Relative share of each size */
+    int soak_block_size_count;
+    int soak_working_set;       /* Blocks the workload spreads over */
+    double soak_zipf_theta;
+    int soak_decay_percent;     /* Allowed IOPS drop from first to last interval */
+    bool soak_verify;
+
+    /* Trace replay parameters */
+    char *replay_file;          /* PDU trace written by the target */
+    double replay_speed;        /* 1 = recorded timing, 2 = twice as fast, 0 = max speed */
+    int replay_queue_depth;     /* Commands kept outstanding at most */
 
     /* Options */
     int verbosity;
     bool stop_on_fail;
     bool generate_report;
+    int session_pool;           /* Logged-in sessions shared by pooled tests, 0 = off */
+    int jobs;                   /* Parallel workers for TEST_FLAG_PARALLEL tests */
+    bool report_text;
+    bool report_json;
+    bool report_csv;
+
+    /* Performance regression check against a previous JSON report */
+    char *compare_baseline;
+    double compare_tolerance;   /* Percent */
 } test_config_t;
 
+/* Test definition flags */
+#define TEST_FLAG_POOLED_SESSION 0x1    /* Test may run on a shared, already logged-in session */
+#define TEST_FLAG_PARALLEL       0x2    /* Test may run concurrently with other parallel tests */
+
 /* Test function signature */
 typedef test_result_t (*test_func_t)(struct iscsi_context *iscsi,
                                       test_config_t *config,
@@ -60,8 +130,27 @@ typedef struct {
     const char *test_name;
     const char *category;
     test_func_t func;
+    unsigned int flags;
 } test_def_t;
 
+/*
+ * One module's tests. Each src/test_<name>.c defines a const
+ * <name>_test_group, and the Makefile generates test_groups[] from its
+ * TEST_GROUPS list, so the whole table is fixed at build time and nothing
+ * is registered at startup.
+ */
+typedef struct {
+    const char *name;           /* Category name -c selects it by */
+    const char *description;
+    bool in_all;                /* Run by the default 'all' category */
+    const test_def_t *tests;
+    size_t count;
+} test_group_t;
+
+/* Generated test table (obj/test_table.c), in run order */
+extern const test_group_t *const test_groups[];
+extern const size_t test_group_count;
+
 /* Global test statistics */
 typedef struct {
     int total;
@@ -75,16 +164,22 @@ typedef struct {
 /* Test framework functions */
 void framework_init(void);
 void framework_cleanup(void);
-void framework_register_test(test_def_t *test);
+int framework_select_tests(const char *category, const char *filter);
+void framework_list_tests(void);
 int framework_run_tests(test_config_t *config);
 void framework_print_summary(test_stats_t *stats);
 void framework_generate_report(test_config_t *config, test_stats_t *stats);
+int framework_compare_baseline(const char *path, double tolerance_pct);
 
 /* Helper functions for test reporting */
 test_report_t* report_create(const char *test_id, const char *test_name, const char *category);
 void report_set_result(test_report_t *report, test_result_t result, const char *message);
 void report_free(test_report_t *report);
 
+/* Per-operation latency recording */
+test_report_t* framework_current_report(void);
+void report_record_op(test_report_t *report, uint64_t start_ns, uint64_t bytes);
+
 /* Test result helpers */
 const char* result_to_string(test_result_t result);
 const char* result_to_color(test_result_t result);
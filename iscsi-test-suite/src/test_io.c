@@ -6,7 +6,7 @@
 #include <iscsi/scsi-lowlevel.h>
 
 /* TI-001: Single Block Read */
-static test_result_t test_single_block_read(struct iscsi_context *unused_iscsi,
+static test_result_t test_single_block_read(struct iscsi_context *pooled_iscsi,
                                               test_config_t *config,
                                               test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -14,36 +14,32 @@ static test_result_t test_single_block_read(struct iscsi_context *unused_iscsi,
     uint32_t block_size;
     uint8_t *write_buf, *read_buf;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     /* Get capacity */
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
-    write_buf = malloc(block_size);
-    read_buf = malloc(block_size);
+    write_buf = buffer_pool_get(block_size);
+    read_buf = buffer_pool_get(block_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -51,43 +47,39 @@ static test_result_t test_single_block_read(struct iscsi_context *unused_iscsi,
     generate_pattern(write_buf, block_size, "sequential", 12345);
     if (scsi_write_blocks(iscsi, config->lun, 0, 1, block_size, write_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Write failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     /* Read and verify */
     if (scsi_read_blocks(iscsi, config->lun, 0, 1, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Read failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (memcmp(write_buf, read_buf, block_size) != 0) {
         report_set_result(report, TEST_FAIL, "Data mismatch");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-002: Single Block Write */
-static test_result_t test_single_block_write(struct iscsi_context *unused_iscsi,
+static test_result_t test_single_block_write(struct iscsi_context *pooled_iscsi,
                                                test_config_t *config,
                                                test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -95,35 +87,31 @@ static test_result_t test_single_block_write(struct iscsi_context *unused_iscsi,
     uint32_t block_size;
     uint8_t *write_buf, *read_buf;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
-    write_buf = malloc(block_size);
-    read_buf = malloc(block_size);
+    write_buf = buffer_pool_get(block_size);
+    read_buf = buffer_pool_get(block_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -131,42 +119,38 @@ static test_result_t test_single_block_write(struct iscsi_context *unused_iscsi,
     generate_pattern(write_buf, block_size, "alternating", 54321);
     if (scsi_write_blocks(iscsi, config->lun, 10, 1, block_size, write_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Write failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (scsi_read_blocks(iscsi, config->lun, 10, 1, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Read failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (memcmp(write_buf, read_buf, block_size) != 0) {
         report_set_result(report, TEST_FAIL, "Data mismatch after write");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-013: Write-Read-Verify Pattern */
-static test_result_t test_write_read_verify(struct iscsi_context *unused_iscsi,
+static test_result_t test_write_read_verify(struct iscsi_context *pooled_iscsi,
                                               test_config_t *config,
                                               test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -176,35 +160,31 @@ static test_result_t test_write_read_verify(struct iscsi_context *unused_iscsi,
     const char *patterns[] = {"zero", "ones", "alternating", "random"};
     int num_patterns = sizeof(patterns) / sizeof(patterns[0]);
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
-    write_buf = malloc(block_size);
-    read_buf = malloc(block_size);
+    write_buf = buffer_pool_get(block_size);
+    read_buf = buffer_pool_get(block_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -216,10 +196,9 @@ static test_result_t test_write_read_verify(struct iscsi_context *unused_iscsi,
             char msg[256];
             snprintf(msg, sizeof(msg), "Write failed for pattern: %s", patterns[i]);
             report_set_result(report, TEST_FAIL, msg);
-            free(write_buf);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            buffer_pool_put(write_buf);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_FAIL;
         }
 
@@ -227,10 +206,9 @@ static test_result_t test_write_read_verify(struct iscsi_context *unused_iscsi,
             char msg[256];
             snprintf(msg, sizeof(msg), "Read failed for pattern: %s", patterns[i]);
             report_set_result(report, TEST_FAIL, msg);
-            free(write_buf);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            buffer_pool_put(write_buf);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_FAIL;
         }
 
@@ -238,25 +216,23 @@ static test_result_t test_write_read_verify(struct iscsi_context *unused_iscsi,
             char msg[256];
             snprintf(msg, sizeof(msg), "Data mismatch for pattern: %s", patterns[i]);
             report_set_result(report, TEST_FAIL, msg);
-            free(write_buf);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            buffer_pool_put(write_buf);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_FAIL;
         }
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-003: Multi-Block Sequential Read */
-static test_result_t test_multiblock_sequential_read(struct iscsi_context *unused_iscsi,
+static test_result_t test_multiblock_sequential_read(struct iscsi_context *pooled_iscsi,
                                                       test_config_t *config,
                                                       test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -265,36 +241,32 @@ static test_result_t test_multiblock_sequential_read(struct iscsi_context *unuse
     uint8_t *write_buf, *read_buf;
     const int num_test_blocks = 16;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     size_t total_size = block_size * num_test_blocks;
-    write_buf = malloc(total_size);
-    read_buf = malloc(total_size);
+    write_buf = buffer_pool_get(total_size);
+    read_buf = buffer_pool_get(total_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -302,43 +274,39 @@ static test_result_t test_multiblock_sequential_read(struct iscsi_context *unuse
     generate_pattern(write_buf, total_size, "sequential", 11111);
     if (scsi_write_blocks(iscsi, config->lun, 200, num_test_blocks, block_size, write_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Multi-block write failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     /* Read and verify */
     if (scsi_read_blocks(iscsi, config->lun, 200, num_test_blocks, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Multi-block read failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (memcmp(write_buf, read_buf, total_size) != 0) {
         report_set_result(report, TEST_FAIL, "Multi-block data mismatch");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-004: Multi-Block Sequential Write */
-static test_result_t test_multiblock_sequential_write(struct iscsi_context *unused_iscsi,
+static test_result_t test_multiblock_sequential_write(struct iscsi_context *pooled_iscsi,
                                                        test_config_t *config,
                                                        test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -347,36 +315,32 @@ static test_result_t test_multiblock_sequential_write(struct iscsi_context *unus
     uint8_t *write_buf, *read_buf;
     const int num_test_blocks = 32;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     size_t total_size = block_size * num_test_blocks;
-    write_buf = malloc(total_size);
-    read_buf = malloc(total_size);
+    write_buf = buffer_pool_get(total_size);
+    read_buf = buffer_pool_get(total_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -384,43 +348,39 @@ static test_result_t test_multiblock_sequential_write(struct iscsi_context *unus
     generate_pattern(write_buf, total_size, "alternating", 22222);
     if (scsi_write_blocks(iscsi, config->lun, 300, num_test_blocks, block_size, write_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Multi-block sequential write failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     /* Verify */
     if (scsi_read_blocks(iscsi, config->lun, 300, num_test_blocks, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Verification read failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (memcmp(write_buf, read_buf, total_size) != 0) {
         report_set_result(report, TEST_FAIL, "Data mismatch after multi-block write");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-005: Random Access Reads */
-static test_result_t test_random_access_reads(struct iscsi_context *unused_iscsi,
+static test_result_t test_random_access_reads(struct iscsi_context *pooled_iscsi,
                                                test_config_t *config,
                                                test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -430,35 +390,31 @@ static test_result_t test_random_access_reads(struct iscsi_context *unused_iscsi
     uint64_t test_lbas[] = {0, 10, 100, 500, 1000};
     int num_lbas = sizeof(test_lbas) / sizeof(test_lbas[0]);
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
-    write_buf = malloc(block_size);
-    read_buf = malloc(block_size);
+    write_buf = buffer_pool_get(block_size);
+    read_buf = buffer_pool_get(block_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -472,10 +428,9 @@ static test_result_t test_random_access_reads(struct iscsi_context *unused_iscsi
             char msg[256];
             snprintf(msg, sizeof(msg), "Random write failed at LBA %lu", (unsigned long)test_lbas[i]);
             report_set_result(report, TEST_FAIL, msg);
-            free(write_buf);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            buffer_pool_put(write_buf);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_FAIL;
         }
 
@@ -483,10 +438,9 @@ static test_result_t test_random_access_reads(struct iscsi_context *unused_iscsi
             char msg[256];
             snprintf(msg, sizeof(msg), "Random read failed at LBA %lu", (unsigned long)test_lbas[i]);
             report_set_result(report, TEST_FAIL, msg);
-            free(write_buf);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            buffer_pool_put(write_buf);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_FAIL;
         }
 
@@ -494,25 +448,23 @@ static test_result_t test_random_access_reads(struct iscsi_context *unused_iscsi
             char msg[256];
             snprintf(msg, sizeof(msg), "Data mismatch at LBA %lu", (unsigned long)test_lbas[i]);
             report_set_result(report, TEST_FAIL, msg);
-            free(write_buf);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            buffer_pool_put(write_buf);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_FAIL;
         }
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-006: Random Access Writes */
-static test_result_t test_random_access_writes(struct iscsi_context *unused_iscsi,
+static test_result_t test_random_access_writes(struct iscsi_context *pooled_iscsi,
                                                 test_config_t *config,
                                                 test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -522,46 +474,41 @@ static test_result_t test_random_access_writes(struct iscsi_context *unused_iscs
     uint64_t test_lbas[] = {1500, 750, 2000, 250, 1250};
     int num_lbas = sizeof(test_lbas) / sizeof(test_lbas[0]);
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     /* Allocate buffers */
-    read_buf = malloc(block_size);
+    read_buf = buffer_pool_get(block_size);
     for (int i = 0; i < num_lbas; i++) {
-        write_bufs[i] = malloc(block_size);
+        write_bufs[i] = buffer_pool_get(block_size);
         if (!write_bufs[i]) {
             report_set_result(report, TEST_ERROR, "Memory allocation failed");
-            for (int j = 0; j < i; j++) free(write_bufs[j]);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            for (int j = 0; j < i; j++) buffer_pool_put(write_bufs[j]);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_ERROR;
         }
     }
 
     if (!read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        for (int i = 0; i < num_lbas; i++) free(write_bufs[i]);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        for (int i = 0; i < num_lbas; i++) buffer_pool_put(write_bufs[i]);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -575,10 +522,9 @@ static test_result_t test_random_access_writes(struct iscsi_context *unused_iscs
             char msg[256];
             snprintf(msg, sizeof(msg), "Random write failed at LBA %lu", (unsigned long)test_lbas[i]);
             report_set_result(report, TEST_FAIL, msg);
-            for (int j = 0; j < num_lbas; j++) free(write_bufs[j]);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            for (int j = 0; j < num_lbas; j++) buffer_pool_put(write_bufs[j]);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_FAIL;
         }
     }
@@ -591,10 +537,9 @@ static test_result_t test_random_access_writes(struct iscsi_context *unused_iscs
             char msg[256];
             snprintf(msg, sizeof(msg), "Verification read failed at LBA %lu", (unsigned long)test_lbas[i]);
             report_set_result(report, TEST_FAIL, msg);
-            for (int j = 0; j < num_lbas; j++) free(write_bufs[j]);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            for (int j = 0; j < num_lbas; j++) buffer_pool_put(write_bufs[j]);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_FAIL;
         }
 
@@ -602,25 +547,23 @@ static test_result_t test_random_access_writes(struct iscsi_context *unused_iscs
             char msg[256];
             snprintf(msg, sizeof(msg), "Data mismatch at LBA %lu", (unsigned long)test_lbas[i]);
             report_set_result(report, TEST_FAIL, msg);
-            for (int j = 0; j < num_lbas; j++) free(write_bufs[j]);
-            free(read_buf);
-            iscsi_disconnect_target(iscsi);
-            iscsi_destroy_context(iscsi);
+            for (int j = 0; j < num_lbas; j++) buffer_pool_put(write_bufs[j]);
+            buffer_pool_put(read_buf);
+            test_session_release(pooled_iscsi, iscsi);
             return TEST_FAIL;
         }
     }
 
-    for (int i = 0; i < num_lbas; i++) free(write_bufs[i]);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    for (int i = 0; i < num_lbas; i++) buffer_pool_put(write_bufs[i]);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-007: Large Transfer Read */
-static test_result_t test_large_transfer_read(struct iscsi_context *unused_iscsi,
+static test_result_t test_large_transfer_read(struct iscsi_context *pooled_iscsi,
                                                test_config_t *config,
                                                test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -629,87 +572,82 @@ static test_result_t test_large_transfer_read(struct iscsi_context *unused_iscsi
     uint8_t *write_buf, *read_buf;
     const int num_test_blocks = 256; /* 256 blocks = potentially 128KB+ */
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     if (num_blocks < num_test_blocks + 1000) {
         report_set_result(report, TEST_SKIP, "Insufficient capacity for large transfer test");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_SKIP;
     }
 
     size_t total_size = block_size * num_test_blocks;
-    write_buf = malloc(total_size);
-    read_buf = malloc(total_size);
+    write_buf = buffer_pool_get(total_size);
+    read_buf = buffer_pool_get(total_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     /* Write large transfer */
-    generate_pattern(write_buf, total_size, "random", 55555);
+    pattern_fill_blocks(write_buf, 5000, num_test_blocks, block_size, 1, 55555);
     if (scsi_write_blocks(iscsi, config->lun, 5000, num_test_blocks, block_size, write_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Large transfer write failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     /* Read and verify */
     if (scsi_read_blocks(iscsi, config->lun, 5000, num_test_blocks, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Large transfer read failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    if (memcmp(write_buf, read_buf, total_size) != 0) {
-        report_set_result(report, TEST_FAIL, "Large transfer data mismatch");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+    pattern_mismatch_t mismatch;
+    if (pattern_verify_blocks(read_buf, 5000, num_test_blocks, block_size, 1, 55555, &mismatch) != 0) {
+        char msg[256], detail[160];
+        pattern_format_mismatch(&mismatch, detail, sizeof(detail));
+        snprintf(msg, sizeof(msg), "Large transfer data mismatch: %s", detail);
+        report_set_result(report, TEST_FAIL, msg);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-008: Large Transfer Write */
-static test_result_t test_large_transfer_write(struct iscsi_context *unused_iscsi,
+static test_result_t test_large_transfer_write(struct iscsi_context *pooled_iscsi,
                                                 test_config_t *config,
                                                 test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -718,103 +656,96 @@ static test_result_t test_large_transfer_write(struct iscsi_context *unused_iscs
     uint8_t *write_buf, *read_buf;
     const int num_test_blocks = 512; /* 512 blocks = potentially 256KB+ */
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     if (num_blocks < num_test_blocks + 6000) {
         report_set_result(report, TEST_SKIP, "Insufficient capacity for large write test");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_SKIP;
     }
 
     size_t total_size = block_size * num_test_blocks;
-    write_buf = malloc(total_size);
-    read_buf = malloc(total_size);
+    write_buf = buffer_pool_get(total_size);
+    read_buf = buffer_pool_get(total_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     /* Write large pattern */
-    generate_pattern(write_buf, total_size, "sequential", 66666);
+    pattern_fill_blocks(write_buf, 6000, num_test_blocks, block_size, 1, 66666);
     if (scsi_write_blocks(iscsi, config->lun, 6000, num_test_blocks, block_size, write_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Large write failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     /* Verify */
     if (scsi_read_blocks(iscsi, config->lun, 6000, num_test_blocks, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Verification read failed after large write");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    if (memcmp(write_buf, read_buf, total_size) != 0) {
-        report_set_result(report, TEST_FAIL, "Data mismatch after large write");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+    pattern_mismatch_t mismatch;
+    if (pattern_verify_blocks(read_buf, 6000, num_test_blocks, block_size, 1, 66666, &mismatch) != 0) {
+        char msg[256], detail[160];
+        pattern_format_mismatch(&mismatch, detail, sizeof(detail));
+        snprintf(msg, sizeof(msg), "Data mismatch after large write: %s", detail);
+        report_set_result(report, TEST_FAIL, msg);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-009: Zero-Length Transfer */
-static test_result_t test_zero_length_transfer(struct iscsi_context *unused_iscsi,
+static test_result_t test_zero_length_transfer(struct iscsi_context *pooled_iscsi,
                                                 test_config_t *config,
                                                 test_report_t *report) {
     struct iscsi_context *iscsi;
     struct scsi_task *task;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
@@ -825,21 +756,19 @@ static test_result_t test_zero_length_transfer(struct iscsi_context *unused_iscs
     if (!task || task->status != SCSI_STATUS_GOOD) {
         report_set_result(report, TEST_FAIL, "Zero-length transfer rejected");
         if (task) scsi_free_scsi_task(task);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     scsi_free_scsi_task(task);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-010: Maximum Transfer Size */
-static test_result_t test_maximum_transfer_size(struct iscsi_context *unused_iscsi,
+static test_result_t test_maximum_transfer_size(struct iscsi_context *pooled_iscsi,
                                                  test_config_t *config,
                                                  test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -850,43 +779,38 @@ static test_result_t test_maximum_transfer_size(struct iscsi_context *unused_isc
     /* With 512-byte blocks, this is 512 blocks */
     const int num_test_blocks = 512;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     if (num_blocks < num_test_blocks + 10000) {
         report_set_result(report, TEST_SKIP, "Insufficient capacity for max burst test");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_SKIP;
     }
 
     size_t total_size = block_size * num_test_blocks;
-    write_buf = malloc(total_size);
-    read_buf = malloc(total_size);
+    write_buf = buffer_pool_get(total_size);
+    read_buf = buffer_pool_get(total_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -894,43 +818,39 @@ static test_result_t test_maximum_transfer_size(struct iscsi_context *unused_isc
     generate_pattern(write_buf, total_size, "random", 10101);
     if (scsi_write_blocks(iscsi, config->lun, 10000, num_test_blocks, block_size, write_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Write at MaxBurstLength boundary failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     /* Read and verify */
     if (scsi_read_blocks(iscsi, config->lun, 10000, num_test_blocks, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Read at MaxBurstLength boundary failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (memcmp(write_buf, read_buf, total_size) != 0) {
         report_set_result(report, TEST_FAIL, "Data mismatch at MaxBurstLength boundary");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-011: Beyond Maximum Transfer */
-static test_result_t test_beyond_maximum_transfer(struct iscsi_context *unused_iscsi,
+static test_result_t test_beyond_maximum_transfer(struct iscsi_context *pooled_iscsi,
                                                    test_config_t *config,
                                                    test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -942,43 +862,38 @@ static test_result_t test_beyond_maximum_transfer(struct iscsi_context *unused_i
     /* This should trigger multi-sequence handling in libiscsi */
     const int num_test_blocks = 4096;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     if (num_blocks < num_test_blocks + 15000) {
         report_set_result(report, TEST_SKIP, "Insufficient capacity for beyond-max-burst test");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_SKIP;
     }
 
     size_t total_size = block_size * num_test_blocks;
-    write_buf = malloc(total_size);
-    read_buf = malloc(total_size);
+    write_buf = buffer_pool_get(total_size);
+    read_buf = buffer_pool_get(total_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -986,43 +901,39 @@ static test_result_t test_beyond_maximum_transfer(struct iscsi_context *unused_i
     generate_pattern(write_buf, total_size, "sequential", 20202);
     if (scsi_write_blocks(iscsi, config->lun, 15000, num_test_blocks, block_size, write_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Write beyond MaxBurstLength failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     /* Read and verify - should also be split into multiple sequences */
     if (scsi_read_blocks(iscsi, config->lun, 15000, num_test_blocks, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Read beyond MaxBurstLength failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (memcmp(write_buf, read_buf, total_size) != 0) {
         report_set_result(report, TEST_FAIL, "Data mismatch for beyond-MaxBurstLength transfer");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-012: Unaligned Access */
-static test_result_t test_unaligned_access(struct iscsi_context *unused_iscsi,
+static test_result_t test_unaligned_access(struct iscsi_context *pooled_iscsi,
                                             test_config_t *config,
                                             test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -1033,85 +944,76 @@ static test_result_t test_unaligned_access(struct iscsi_context *unused_iscsi,
     const int num_test_blocks = 7;
     const uint64_t start_lba = 1357;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     if (num_blocks < start_lba + num_test_blocks) {
         report_set_result(report, TEST_SKIP, "Insufficient capacity for unaligned access test");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_SKIP;
     }
 
     size_t total_size = block_size * num_test_blocks;
-    write_buf = malloc(total_size);
-    read_buf = malloc(total_size);
+    write_buf = buffer_pool_get(total_size);
+    read_buf = buffer_pool_get(total_size);
     if (!write_buf || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
     generate_pattern(write_buf, total_size, "alternating", 77777);
     if (scsi_write_blocks(iscsi, config->lun, start_lba, num_test_blocks, block_size, write_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Unaligned write failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (scsi_read_blocks(iscsi, config->lun, start_lba, num_test_blocks, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Unaligned read failed");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (memcmp(write_buf, read_buf, total_size) != 0) {
         report_set_result(report, TEST_FAIL, "Unaligned access data mismatch");
-        free(write_buf);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
 /* TI-014: Overwrite Test */
-static test_result_t test_overwrite(struct iscsi_context *unused_iscsi,
+static test_result_t test_overwrite(struct iscsi_context *pooled_iscsi,
                                      test_config_t *config,
                                      test_report_t *report) {
     struct iscsi_context *iscsi;
@@ -1119,37 +1021,33 @@ static test_result_t test_overwrite(struct iscsi_context *unused_iscsi,
     uint32_t block_size;
     uint8_t *write_buf1, *write_buf2, *read_buf;
 
-    (void)unused_iscsi;
 
     if (!config->iqn || strlen(config->iqn) == 0) {
         report_set_result(report, TEST_SKIP, "No IQN specified");
         return TEST_SKIP;
     }
 
-    iscsi = create_iscsi_context_for_test(config);
-    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
         report_set_result(report, TEST_ERROR, "Failed to connect");
-        if (iscsi) iscsi_destroy_context(iscsi);
         return TEST_ERROR;
     }
 
     if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
         report_set_result(report, TEST_ERROR, "Failed to get capacity");
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
-    write_buf1 = malloc(block_size);
-    write_buf2 = malloc(block_size);
-    read_buf = malloc(block_size);
+    write_buf1 = buffer_pool_get(block_size);
+    write_buf2 = buffer_pool_get(block_size);
+    read_buf = buffer_pool_get(block_size);
     if (!write_buf1 || !write_buf2 || !read_buf) {
         report_set_result(report, TEST_ERROR, "Memory allocation failed");
-        free(write_buf1);
-        free(write_buf2);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf1);
+        buffer_pool_put(write_buf2);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_ERROR;
     }
 
@@ -1157,11 +1055,10 @@ static test_result_t test_overwrite(struct iscsi_context *unused_iscsi,
     generate_pattern(write_buf1, block_size, "ones", 88888);
     if (scsi_write_blocks(iscsi, config->lun, 7000, 1, block_size, write_buf1) != 0) {
         report_set_result(report, TEST_FAIL, "Initial write failed");
-        free(write_buf1);
-        free(write_buf2);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf1);
+        buffer_pool_put(write_buf2);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
@@ -1169,77 +1066,380 @@ static test_result_t test_overwrite(struct iscsi_context *unused_iscsi,
     generate_pattern(write_buf2, block_size, "zero", 99999);
     if (scsi_write_blocks(iscsi, config->lun, 7000, 1, block_size, write_buf2) != 0) {
         report_set_result(report, TEST_FAIL, "Overwrite failed");
-        free(write_buf1);
-        free(write_buf2);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf1);
+        buffer_pool_put(write_buf2);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     /* Read and verify we get the second pattern, not the first */
     if (scsi_read_blocks(iscsi, config->lun, 7000, 1, block_size, read_buf) != 0) {
         report_set_result(report, TEST_FAIL, "Read after overwrite failed");
-        free(write_buf1);
-        free(write_buf2);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf1);
+        buffer_pool_put(write_buf2);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     if (memcmp(write_buf2, read_buf, block_size) != 0) {
         report_set_result(report, TEST_FAIL, "Overwrite did not replace data");
-        free(write_buf1);
-        free(write_buf2);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf1);
+        buffer_pool_put(write_buf2);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
     /* Make sure it's NOT the first pattern */
     if (memcmp(write_buf1, read_buf, block_size) == 0) {
         report_set_result(report, TEST_FAIL, "Overwrite failed - original data still present");
-        free(write_buf1);
-        free(write_buf2);
-        free(read_buf);
-        iscsi_disconnect_target(iscsi);
-        iscsi_destroy_context(iscsi);
+        buffer_pool_put(write_buf1);
+        buffer_pool_put(write_buf2);
+        buffer_pool_put(read_buf);
+        test_session_release(pooled_iscsi, iscsi);
         return TEST_FAIL;
     }
 
-    free(write_buf1);
-    free(write_buf2);
-    free(read_buf);
-    iscsi_disconnect_target(iscsi);
-    iscsi_destroy_context(iscsi);
+    buffer_pool_put(write_buf1);
+    buffer_pool_put(write_buf2);
+    buffer_pool_put(read_buf);
+    test_session_release(pooled_iscsi, iscsi);
 
     report_set_result(report, TEST_PASS, NULL);
     return TEST_PASS;
 }
 
-/* Test definitions */
-static test_def_t io_tests[] = {
-    {"TI-001", "Single Block Read", "I/O Operation Tests", test_single_block_read},
-    {"TI-002", "Single Block Write", "I/O Operation Tests", test_single_block_write},
-    {"TI-003", "Multi-Block Sequential Read", "I/O Operation Tests", test_multiblock_sequential_read},
-    {"TI-004", "Multi-Block Sequential Write", "I/O Operation Tests", test_multiblock_sequential_write},
-    {"TI-005", "Random Access Reads", "I/O Operation Tests", test_random_access_reads},
-    {"TI-006", "Random Access Writes", "I/O Operation Tests", test_random_access_writes},
-    {"TI-007", "Large Transfer Read", "I/O Operation Tests", test_large_transfer_read},
-    {"TI-008", "Large Transfer Write", "I/O Operation Tests", test_large_transfer_write},
-    {"TI-009", "Zero-Length Transfer", "I/O Operation Tests", test_zero_length_transfer},
-    {"TI-010", "Maximum Transfer Size", "I/O Operation Tests", test_maximum_transfer_size},
-    {"TI-011", "Beyond Maximum Transfer", "I/O Operation Tests", test_beyond_maximum_transfer},
-    {"TI-012", "Unaligned Access", "I/O Operation Tests", test_unaligned_access},
-    {"TI-013", "Write-Read-Verify Pattern", "I/O Operation Tests", test_write_read_verify},
-    {"TI-014", "Overwrite Test", "I/O Operation Tests", test_overwrite},
-};
+/* Verify blocks [first, first + count) of a read buffer that starts at base_lba */
+static int verify_range(const uint8_t *buf, uint64_t base_lba, uint64_t first, uint32_t count,
+                        uint32_t block_size, uint64_t generation, uint64_t seed,
+                        const char *what, test_report_t *report) {
+    pattern_mismatch_t mismatch;
+    char msg[256], detail[160];
+
+    if (pattern_verify_blocks(buf + (first - base_lba) * block_size, first, count, block_size,
+                              generation, seed, &mismatch) == 0) {
+        return 0;
+    }
+    pattern_format_mismatch(&mismatch, detail, sizeof(detail));
+    snprintf(msg, sizeof(msg), "%s: %s", what, detail);
+    report_set_result(report, TEST_FAIL, msg);
+    return -1;
+}
+
+/*
+ * TI-015: FUA Write
+ *
+ * Eight blocks are written one at a time without FUA, then the middle four
+ * are overwritten by a single WRITE(10) with FUA set. The read back must
+ * show the FUA data in the middle and the earlier writes either side: a
+ * write cache has to keep the older blocks that FUA did not touch.
+ */
+static test_result_t test_fua_write(struct iscsi_context *pooled_iscsi,
+                                    test_config_t *config,
+                                    test_report_t *report) {
+    struct iscsi_context *iscsi;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    uint8_t *buf = NULL;
+    const uint64_t lba = 8000;
+    const uint32_t count = 8;
+    test_result_t ret = TEST_FAIL;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        return TEST_ERROR;
+    }
+
+    if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        ret = TEST_ERROR;
+        goto out;
+    }
+    if (num_blocks < lba + count) {
+        report_set_result(report, TEST_SKIP, "Insufficient capacity for FUA test");
+        ret = TEST_SKIP;
+        goto out;
+    }
+
+    buf = buffer_pool_get((size_t)count * block_size);
+    if (!buf) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        ret = TEST_ERROR;
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        pattern_fill_blocks(buf, lba + i, 1, block_size, 1, 15015);
+        if (scsi_write_blocks(iscsi, config->lun, lba + i, 1, block_size, buf) != 0) {
+            report_set_result(report, TEST_FAIL, "Plain write failed");
+            goto out;
+        }
+    }
+
+    pattern_fill_blocks(buf, lba + 2, 4, block_size, 2, 15015);
+    if (scsi_write_blocks_fua(iscsi, config->lun, lba + 2, 4, block_size, buf) != 0) {
+        report_set_result(report, TEST_FAIL, "WRITE(10) with FUA failed");
+        goto out;
+    }
 
-/* Register all tests */
-void register_io_tests(void) {
-    for (size_t i = 0; i < sizeof(io_tests) / sizeof(io_tests[0]); i++) {
-        framework_register_test(&io_tests[i]);
+    if (scsi_read_blocks(iscsi, config->lun, lba, count, block_size, buf) != 0) {
+        report_set_result(report, TEST_FAIL, "Read after FUA write failed");
+        goto out;
+    }
+    if (verify_range(buf, lba, lba, 2, block_size, 1, 15015, "Blocks before the FUA write", report) != 0 ||
+        verify_range(buf, lba, lba + 2, 4, block_size, 2, 15015, "FUA blocks", report) != 0 ||
+        verify_range(buf, lba, lba + 6, 2, block_size, 1, 15015, "Blocks after the FUA write", report) != 0) {
+        goto out;
     }
+
+    report_set_result(report, TEST_PASS, NULL);
+    ret = TEST_PASS;
+
+out:
+    buffer_pool_put(buf);
+    test_session_release(pooled_iscsi, iscsi);
+    return ret;
 }
+
+/*
+ * TI-016: Synchronize Cache After Writes
+ *
+ * Small sequential writes are the case a write-back cache coalesces. 64
+ * single-block writes are followed by SYNCHRONIZE CACHE over their range,
+ * 16 of them are rewritten, and SYNCHRONIZE CACHE then covers the whole
+ * LUN. Both must return GOOD and every block must read back as last written.
+ */
+static test_result_t test_sync_cache_after_writes(struct iscsi_context *pooled_iscsi,
+                                                  test_config_t *config,
+                                                  test_report_t *report) {
+    struct iscsi_context *iscsi;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    uint8_t *buf = NULL;
+    const uint64_t lba = 9000;
+    const uint32_t count = 64;
+    test_result_t ret = TEST_FAIL;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        return TEST_ERROR;
+    }
+
+    if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        ret = TEST_ERROR;
+        goto out;
+    }
+    if (num_blocks < lba + count) {
+        report_set_result(report, TEST_SKIP, "Insufficient capacity for SYNCHRONIZE CACHE test");
+        ret = TEST_SKIP;
+        goto out;
+    }
+
+    buf = buffer_pool_get((size_t)count * block_size);
+    if (!buf) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        ret = TEST_ERROR;
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        pattern_fill_blocks(buf, lba + i, 1, block_size, 1, 16016);
+        if (scsi_write_blocks(iscsi, config->lun, lba + i, 1, block_size, buf) != 0) {
+            report_set_result(report, TEST_FAIL, "Sequential write failed");
+            goto out;
+        }
+    }
+    if (scsi_sync_cache(iscsi, config->lun, lba, count) != 0) {
+        report_set_result(report, TEST_FAIL, "SYNCHRONIZE CACHE(10) over the written range failed");
+        goto out;
+    }
+
+    for (uint32_t i = 24; i < 40; i++) {
+        pattern_fill_blocks(buf, lba + i, 1, block_size, 2, 16016);
+        if (scsi_write_blocks(iscsi, config->lun, lba + i, 1, block_size, buf) != 0) {
+            report_set_result(report, TEST_FAIL, "Rewrite failed");
+            goto out;
+        }
+    }
+    if (scsi_sync_cache(iscsi, config->lun, 0, 0) != 0) {
+        report_set_result(report, TEST_FAIL, "SYNCHRONIZE CACHE(10) over the whole LUN failed");
+        goto out;
+    }
+
+    if (scsi_read_blocks(iscsi, config->lun, lba, count, block_size, buf) != 0) {
+        report_set_result(report, TEST_FAIL, "Read after SYNCHRONIZE CACHE failed");
+        goto out;
+    }
+    if (verify_range(buf, lba, lba, 24, block_size, 1, 16016, "Synchronized blocks", report) != 0 ||
+        verify_range(buf, lba, lba + 24, 16, block_size, 2, 16016, "Rewritten blocks", report) != 0 ||
+        verify_range(buf, lba, lba + 40, 24, block_size, 1, 16016, "Synchronized blocks", report) != 0) {
+        goto out;
+    }
+
+    report_set_result(report, TEST_PASS, NULL);
+    ret = TEST_PASS;
+
+out:
+    buffer_pool_put(buf);
+    test_session_release(pooled_iscsi, iscsi);
+    return ret;
+}
+
+#define HIGH_LBA_BLOCKS 8
+#define HIGH_LBA_RANGES 4
+#define LBA_32BIT_LIMIT 0x100000000ULL
+
+/*
+ * TI-017: High LBA Access
+ *
+ * Writes, reads back and flushes the last blocks of the LUN. On LUNs past
+ * 2^32 blocks (2 TiB at 512 bytes) it also covers a transfer straddling
+ * LBA 2^32 and one far above it, which only 16-byte CDBs can address, and
+ * a block 2^32 below the high one. That low block is written first and
+ * checked last, so a target that drops the upper LBA bits and lands the
+ * high write on top of it is caught.
+ */
+static test_result_t test_high_lba_access(struct iscsi_context *pooled_iscsi,
+                                          test_config_t *config,
+                                          test_report_t *report) {
+    struct iscsi_context *iscsi;
+    uint64_t num_blocks;
+    uint32_t block_size;
+    uint8_t *buf = NULL;
+    uint64_t lbas[HIGH_LBA_RANGES];
+    const char *names[HIGH_LBA_RANGES];
+    int count = 0;
+    test_result_t ret = TEST_FAIL;
+    char msg[512];
+    size_t off;
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    iscsi = test_session_acquire(pooled_iscsi, config);
+    if (!iscsi) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        return TEST_ERROR;
+    }
+
+    if (scsi_read_capacity(iscsi, config->lun, &num_blocks, &block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        ret = TEST_ERROR;
+        goto out;
+    }
+    if (num_blocks < HIGH_LBA_BLOCKS) {
+        report_set_result(report, TEST_SKIP, "Insufficient capacity for high LBA test");
+        ret = TEST_SKIP;
+        goto out;
+    }
+
+    if (num_blocks >= LBA_32BIT_LIMIT + 2 * HIGH_LBA_BLOCKS) {
+        uint64_t high = (LBA_32BIT_LIMIT + num_blocks) / 2;
+
+        lbas[count] = high - LBA_32BIT_LIMIT;
+        names[count++] = "aliased low LBA";
+        lbas[count] = LBA_32BIT_LIMIT - HIGH_LBA_BLOCKS / 2;
+        names[count++] = "LBA 2^32 boundary";
+        lbas[count] = high;
+        names[count++] = "high LBA";
+    }
+    lbas[count] = num_blocks - HIGH_LBA_BLOCKS;
+    names[count++] = "last LBA";
+
+    buf = buffer_pool_get((size_t)HIGH_LBA_BLOCKS * block_size);
+    if (!buf) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        ret = TEST_ERROR;
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++) {
+        pattern_fill_blocks(buf, lbas[i], HIGH_LBA_BLOCKS, block_size, 1, 17017);
+        if (scsi_write_blocks(iscsi, config->lun, lbas[i], HIGH_LBA_BLOCKS, block_size, buf) != 0 ||
+            scsi_sync_cache(iscsi, config->lun, lbas[i], HIGH_LBA_BLOCKS) != 0) {
+            snprintf(msg, sizeof(msg), "Write or SYNCHRONIZE CACHE at %s %llu (%s CDB) failed: %s",
+                     names[i], (unsigned long long)lbas[i],
+                     scsi_use_cdb16(lbas[i], HIGH_LBA_BLOCKS) ? "16-byte" : "10-byte",
+                     iscsi_get_error(iscsi));
+            report_set_result(report, TEST_FAIL, msg);
+            goto out;
+        }
+    }
+
+    /* Read back only after every write, so an aliased write shows up */
+    for (int i = 0; i < count; i++) {
+        if (scsi_read_blocks(iscsi, config->lun, lbas[i], HIGH_LBA_BLOCKS, block_size, buf) != 0) {
+            snprintf(msg, sizeof(msg), "Read at %s %llu failed: %s", names[i],
+                     (unsigned long long)lbas[i], iscsi_get_error(iscsi));
+            report_set_result(report, TEST_FAIL, msg);
+            goto out;
+        }
+        if (verify_range(buf, lbas[i], lbas[i], HIGH_LBA_BLOCKS, block_size, 1, 17017,
+                         names[i], report) != 0) {
+            goto out;
+        }
+    }
+
+    off = snprintf(msg, sizeof(msg), "%llu blocks (%.2f TiB)", (unsigned long long)num_blocks,
+                   (double)num_blocks * block_size / (1024.0 * 1024 * 1024 * 1024));
+    if (count == 1 && off < sizeof(msg)) {
+        snprintf(msg + off, sizeof(msg) - off,
+                 "; under 2^32 blocks, so only the last LBA was checked");
+    } else if (off < sizeof(msg)) {
+        snprintf(msg + off, sizeof(msg) - off,
+                 "; verified across LBA 2^32 and at LBA %llu with 16-byte CDBs",
+                 (unsigned long long)lbas[2]);
+    }
+    report_set_result(report, TEST_PASS, msg);
+    ret = TEST_PASS;
+
+out:
+    buffer_pool_put(buf);
+    test_session_release(pooled_iscsi, iscsi);
+    return ret;
+}
+
+/* Test definitions */
+static const test_def_t io_tests[] = {
+    {"TI-001", "Single Block Read", "I/O Operation Tests", test_single_block_read, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-002", "Single Block Write", "I/O Operation Tests", test_single_block_write, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-003", "Multi-Block Sequential Read", "I/O Operation Tests", test_multiblock_sequential_read, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-004", "Multi-Block Sequential Write", "I/O Operation Tests", test_multiblock_sequential_write, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-005", "Random Access Reads", "I/O Operation Tests", test_random_access_reads, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-006", "Random Access Writes", "I/O Operation Tests", test_random_access_writes, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-007", "Large Transfer Read", "I/O Operation Tests", test_large_transfer_read, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-008", "Large Transfer Write", "I/O Operation Tests", test_large_transfer_write, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-009", "Zero-Length Transfer", "I/O Operation Tests", test_zero_length_transfer, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-010", "Maximum Transfer Size", "I/O Operation Tests", test_maximum_transfer_size, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-011", "Beyond Maximum Transfer", "I/O Operation Tests", test_beyond_maximum_transfer, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-012", "Unaligned Access", "I/O Operation Tests", test_unaligned_access, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-013", "Write-Read-Verify Pattern", "I/O Operation Tests", test_write_read_verify, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-014", "Overwrite Test", "I/O Operation Tests", test_overwrite, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-015", "FUA Write", "I/O Operation Tests", test_fua_write, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    {"TI-016", "Synchronize Cache After Writes", "I/O Operation Tests", test_sync_cache_after_writes, TEST_FLAG_POOLED_SESSION | TEST_FLAG_PARALLEL},
+    /* Not parallel: an LBA window would hide the top of the LUN */
+    {"TI-017", "High LBA Access", "I/O Operation Tests", test_high_lba_access, TEST_FLAG_POOLED_SESSION},
+};
+
+/* Listed in the build-time test table (see TEST_GROUPS in the Makefile) */
+const test_group_t io_test_group = {
+    "io", "I/O operation tests", true,
+    io_tests, sizeof(io_tests) / sizeof(io_tests[0])
+};
@@ -3,7 +3,7 @@
 
 #include "test_framework.h"
 
-/* Register all I/O operation tests */
-void register_io_tests(void);
+/* The I/O operation tests, for the build-time test table */
+extern const test_group_t io_test_group;
 
 #endif /* TEST_IO_H */
@@ -0,0 +1,517 @@
+#include "test_replay.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <iscsi/iscsi.h>
+#include <iscsi/scsi-lowlevel.h>
+
+/*
+ * Trace replay.
+ *
+ * The Rust target can record every PDU it reads or writes into a ring of
+ * 32-byte records (IscsiTargetBuilder::pdu_trace; the simple_target
+ * example saves it to $ISCSI_TRACE_FILE). TR-001 reads such a file and
+ * re-issues the SCSI commands the initiators sent - READ, WRITE,
+ * SYNCHRONIZE CACHE and TEST UNIT READY - on one session, either at their
+ * recorded times (scaled by [replay] speed) or back to back as fast as
+ * queue_depth allows. Commands from every traced connection are merged in
+ * time order. Writes carry a random pattern rather than the original data,
+ * which the trace does not keep.
+ *
+ * File layout (little-endian): "ISCSITRC", u16 version, u16 record size,
+ * u32 record count, then per record u64 ns timestamp, u64 LBA, u32 ITT,
+ * u32 data segment length, u32 blocks, u16 connection, u8 iSCSI opcode,
+ * u8 CDB opcode. See src/trace.rs in the target.
+ */
+
+#define REPLAY_MAGIC "ISCSITRC"
+#define REPLAY_VERSION 1
+#define REPLAY_HEADER_SIZE 16
+#define REPLAY_RECORD_SIZE 32
+#define REPLAY_MAX_QUEUE_DEPTH 256
+
+#define ISCSI_OP_SCSI_COMMAND 0x01
+
+typedef enum {
+    REPLAY_READ,
+    REPLAY_WRITE,
+    REPLAY_SYNC,
+    REPLAY_TUR
+} replay_kind_t;
+
+/* One command to re-issue */
+typedef struct {
+    uint64_t offset_ns;     /* Since the first replayed command */
+    uint64_t lba;
+    uint32_t blocks;
+    replay_kind_t kind;
+} replay_op_t;
+
+/* What the trace file held */
+typedef struct {
+    replay_op_t *ops;
+    size_t count;
+    uint64_t records;
+    uint64_t unsupported;   /* SCSI Commands with other CDBs */
+    uint64_t span_ns;       /* First to last replayed command */
+    int connections;
+} replay_trace_t;
+
+typedef struct replay_run replay_run_t;
+
+/* One outstanding command */
+typedef struct {
+    replay_run_t *run;
+    struct scsi_iovec iov;
+    uint64_t submit_ns;
+    uint64_t bytes;
+} replay_slot_t;
+
+struct replay_run {
+    struct iscsi_context *iscsi;
+    int lun;
+    uint32_t block_size;
+    uint8_t *read_buf;      /* Scratch sink shared by every read */
+    uint8_t *write_buf;     /* Shared source of every write */
+
+    replay_slot_t *slots;
+    int *free_slots;
+    int free_count;
+
+    int in_flight;
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t last_progress_ns;
+    latency_hist_t hist;
+};
+
+static uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static int compare_ops(const void *a, const void *b) {
+    const replay_op_t *x = a, *y = b;
+
+    return (x->offset_ns > y->offset_ns) - (x->offset_ns < y->offset_ns);
+}
+
+/*
+ * Read the replayable commands from a trace file, sorted by time. Returns
+ * 0 on success, -1 with a reason in err.
+ */
+static int replay_load(const char *path, replay_trace_t *trace, char *err, size_t err_size) {
+    static uint8_t seen[65536 / 8];
+    uint8_t header[REPLAY_HEADER_SIZE];
+    uint8_t rec[REPLAY_RECORD_SIZE];
+    uint64_t first_ns = UINT64_MAX;
+    uint32_t count;
+    FILE *f;
+
+    memset(trace, 0, sizeof(*trace));
+    memset(seen, 0, sizeof(seen));
+
+    f = fopen(path, "rb");
+    if (!f) {
+        snprintf(err, err_size, "Cannot open trace %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+        memcmp(header, REPLAY_MAGIC, 8) != 0) {
+        snprintf(err, err_size, "%s is not a PDU trace", path);
+        goto fail;
+    }
+    if (get_le16(header + 8) != REPLAY_VERSION || get_le16(header + 10) != REPLAY_RECORD_SIZE) {
+        snprintf(err, err_size, "Unsupported trace version %u with %u-byte records",
+                 get_le16(header + 8), get_le16(header + 10));
+        goto fail;
+    }
+
+    count = get_le32(header + 12);
+    trace->ops = malloc((count ? count : 1) * sizeof(replay_op_t));
+    if (!trace->ops) {
+        snprintf(err, err_size, "Memory allocation failed");
+        goto fail;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        replay_op_t *op = &trace->ops[trace->count];
+        uint16_t connection;
+
+        if (fread(rec, 1, sizeof(rec), f) != sizeof(rec)) {
+            snprintf(err, err_size, "Trace truncated at record %u of %u", i, count);
+            goto fail;
+        }
+        trace->records++;
+        if (rec[30] != ISCSI_OP_SCSI_COMMAND) {
+            continue;
+        }
+
+        switch (rec[31]) {
+            case 0x08: case 0x28: case 0x88: op->kind = REPLAY_READ; break;
+            case 0x0a: case 0x2a: case 0x8a: op->kind = REPLAY_WRITE; break;
+            case 0x35: case 0x91: op->kind = REPLAY_SYNC; break;
+            case 0x00: op->kind = REPLAY_TUR; break;
+            default:
+                trace->unsupported++;
+                continue;
+        }
+        op->offset_ns = get_le64(rec);
+        op->lba = get_le64(rec + 8);
+        op->blocks = get_le32(rec + 24);
+        if (op->offset_ns < first_ns) {
+            first_ns = op->offset_ns;
+        }
+
+        connection = get_le16(rec + 28);
+        if (!(seen[connection / 8] & (1 << (connection % 8)))) {
+            seen[connection / 8] |= 1 << (connection % 8);
+            trace->connections++;
+        }
+        trace->count++;
+    }
+    fclose(f);
+
+    for (size_t i = 0; i < trace->count; i++) {
+        trace->ops[i].offset_ns -= first_ns;
+    }
+    qsort(trace->ops, trace->count, sizeof(replay_op_t), compare_ops);
+    if (trace->count > 0) {
+        trace->span_ns = trace->ops[trace->count - 1].offset_ns;
+    }
+    return 0;
+
+fail:
+    fclose(f);
+    free(trace->ops);
+    trace->ops = NULL;
+    return -1;
+}
+
+static void replay_cb(struct iscsi_context *iscsi, int status,
+                      void *command_data, void *private_data) {
+    replay_slot_t *slot = private_data;
+    replay_run_t *run = slot->run;
+    struct scsi_task *task = command_data;
+    uint64_t now = latency_now_ns();
+
+    (void)iscsi;
+
+    run->in_flight--;
+    run->last_progress_ns = now;
+    run->free_slots[run->free_count++] = (int)(slot - run->slots);
+
+    if (status == SCSI_STATUS_GOOD) {
+        run->completed++;
+        run->bytes += slot->bytes;
+        latency_hist_record(&run->hist, slot->submit_ns, now);
+    } else {
+        run->errors++;
+    }
+
+    if (task) {
+        scsi_free_scsi_task(task);
+    }
+}
+
+/* Issue one command from a free slot. Returns 0 on success, -1 on failure. */
+static int replay_submit(replay_run_t *run, const replay_op_t *op) {
+    replay_slot_t *slot = &run->slots[run->free_slots[run->free_count - 1]];
+    uint32_t len = op->blocks * run->block_size;
+    int short_cdb = !scsi_use_cdb16(op->lba, op->blocks);
+    struct scsi_task *task = NULL;
+
+    switch (op->kind) {
+        case REPLAY_READ:
+            task = short_cdb ? scsi_cdb_read10((uint32_t)op->lba, len, run->block_size, 0, 0, 0, 0, 0)
+                             : scsi_cdb_read16(op->lba, len, run->block_size, 0, 0, 0, 0, 0);
+            slot->iov.iov_base = run->read_buf;
+            break;
+        case REPLAY_WRITE:
+            task = short_cdb ? scsi_cdb_write10((uint32_t)op->lba, len, run->block_size, 0, 0, 0, 0, 0)
+                             : scsi_cdb_write16(op->lba, len, run->block_size, 0, 0, 0, 0, 0);
+            slot->iov.iov_base = run->write_buf;
+            break;
+        case REPLAY_SYNC:
+            task = short_cdb ? scsi_cdb_synchronizecache10((int)op->lba, (int)op->blocks, 0, 0)
+                             : scsi_cdb_synchronizecache16(op->lba, op->blocks, 0, 0);
+            len = 0;
+            break;
+        case REPLAY_TUR:
+            task = scsi_cdb_testunitready();
+            len = 0;
+            break;
+    }
+    if (!task) {
+        return -1;
+    }
+
+    slot->iov.iov_len = len;
+    slot->bytes = len;
+    if (len > 0 && op->kind == REPLAY_READ) {
+        scsi_task_set_iov_in(task, &slot->iov, 1);
+    } else if (len > 0) {
+        scsi_task_set_iov_out(task, &slot->iov, 1);
+    }
+
+    slot->submit_ns = latency_now_ns();
+    if (iscsi_scsi_command_async(run->iscsi, run->lun, task, replay_cb, NULL, slot) != 0) {
+        scsi_free_scsi_task(task);
+        return -1;
+    }
+
+    /* A command into an empty queue restarts the stall clock */
+    if (run->in_flight == 0) {
+        run->last_progress_ns = slot->submit_ns;
+    }
+    run->free_count--;
+    run->in_flight++;
+    return 0;
+}
+
+/* TR-001: Trace Replay */
+static test_result_t test_trace_replay(struct iscsi_context *unused_iscsi,
+                                       test_config_t *config,
+                                       test_report_t *report) {
+    replay_trace_t trace;
+    replay_run_t run;
+    uint64_t num_blocks, max_bytes = 0, out_of_range = 0;
+    uint64_t start, elapsed, stall_ns, max_lag = 0, total_lag = 0;
+    double speed = config->replay_speed;
+    int depth = config->replay_queue_depth;
+    size_t kept = 0, next = 0;
+    uint64_t counts[4] = {0};
+    test_result_t result = TEST_PASS;
+    char msg[1024];
+
+    (void)unused_iscsi;
+
+    if (!config->replay_file || strlen(config->replay_file) == 0) {
+        report_set_result(report, TEST_SKIP, "No trace file (set [replay] trace_file or use --replay)");
+        return TEST_SKIP;
+    }
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    if (depth < 1) depth = 1;
+    if (depth > REPLAY_MAX_QUEUE_DEPTH) depth = REPLAY_MAX_QUEUE_DEPTH;
+
+    if (replay_load(config->replay_file, &trace, msg, sizeof(msg)) != 0) {
+        report_set_result(report, TEST_ERROR, msg);
+        return TEST_ERROR;
+    }
+    if (trace.count == 0) {
+        free(trace.ops);
+        report_set_result(report, TEST_SKIP, "Trace holds no replayable commands");
+        return TEST_SKIP;
+    }
+
+    memset(&run, 0, sizeof(run));
+    run.lun = config->lun;
+    run.iscsi = create_iscsi_context_for_test(config);
+    if (!run.iscsi) {
+        free(trace.ops);
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        return TEST_ERROR;
+    }
+    if (iscsi_connect_target(run.iscsi, config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        iscsi_destroy_context(run.iscsi);
+        free(trace.ops);
+        return TEST_ERROR;
+    }
+    if (scsi_read_capacity(run.iscsi, config->lun, &num_blocks, &run.block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        iscsi_disconnect_target(run.iscsi);
+        iscsi_destroy_context(run.iscsi);
+        free(trace.ops);
+        return TEST_ERROR;
+    }
+
+    /* Drop commands this LUN cannot hold; the rest size the shared buffers */
+    for (size_t i = 0; i < trace.count; i++) {
+        replay_op_t *op = &trace.ops[i];
+
+        if ((op->kind == REPLAY_READ || op->kind == REPLAY_WRITE) &&
+            (op->lba > num_blocks || op->blocks > num_blocks - op->lba)) {
+            out_of_range++;
+            continue;
+        }
+        if (op->kind == REPLAY_READ || op->kind == REPLAY_WRITE) {
+            uint64_t bytes = (uint64_t)op->blocks * run.block_size;
+            if (bytes > max_bytes) max_bytes = bytes;
+        }
+        trace.ops[kept++] = *op;
+    }
+    trace.count = kept;
+    if (max_bytes > 0xFFFFFFFFULL) {
+        report_set_result(report, TEST_SKIP, "Trace has transfers over 4 GiB");
+        iscsi_disconnect_target(run.iscsi);
+        iscsi_destroy_context(run.iscsi);
+        free(trace.ops);
+        return TEST_SKIP;
+    }
+
+    run.read_buf = buffer_pool_get(max_bytes ? max_bytes : 1);
+    run.write_buf = buffer_pool_get(max_bytes ? max_bytes : 1);
+    run.slots = calloc(depth, sizeof(replay_slot_t));
+    run.free_slots = calloc(depth, sizeof(int));
+    if (!run.read_buf || !run.write_buf || !run.slots || !run.free_slots) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        iscsi_disconnect_target(run.iscsi);
+        iscsi_destroy_context(run.iscsi);
+        result = TEST_ERROR;
+        goto out;
+    }
+    generate_pattern(run.write_buf, max_bytes, "random", 0x7265706cU);
+    for (int i = 0; i < depth; i++) {
+        run.slots[i].run = &run;
+        run.free_slots[i] = depth - 1 - i;
+    }
+    run.free_count = depth;
+    latency_hist_reset(&run.hist);
+    stall_ns = (uint64_t)(config->timeout > 0 ? config->timeout : 30) * 1000000000ULL;
+
+    if (config->verbosity >= 1) {
+        printf("    %zu commands from %d connection(s) over %.3fs, %s, queue depth %d\n",
+               trace.count, trace.connections, trace.span_ns / 1e9,
+               speed > 0 ? "timed" : "max speed", depth);
+    }
+
+    start = latency_now_ns();
+    while (next < trace.count || run.in_flight > 0) {
+        uint64_t now = latency_now_ns();
+        int timeout_ms = 100;
+        struct pollfd pfd;
+
+        /* Issue everything that is due while a slot is free */
+        while (next < trace.count && run.free_count > 0) {
+            uint64_t due = start + (uint64_t)(trace.ops[next].offset_ns / (speed > 0 ? speed : 1.0));
+
+            if (speed > 0 && now < due) {
+                uint64_t wait_ms = (due - now + 999999) / 1000000;
+                if (wait_ms < (uint64_t)timeout_ms) timeout_ms = (int)wait_ms;
+                break;
+            }
+            if (speed > 0) {
+                total_lag += now - due;
+                if (now - due > max_lag) max_lag = now - due;
+            }
+            if (replay_submit(&run, &trace.ops[next]) != 0) {
+                snprintf(msg, sizeof(msg), "Failed to issue command %zu: %s",
+                         next, iscsi_get_error(run.iscsi));
+                goto fail;
+            }
+            counts[trace.ops[next].kind]++;
+            next++;
+        }
+
+        if (run.in_flight > 0 && now - run.last_progress_ns > stall_ns) {
+            snprintf(msg, sizeof(msg), "No completion for %ds with %d commands outstanding",
+                     (int)(stall_ns / 1000000000ULL), run.in_flight);
+            goto fail;
+        }
+
+        pfd.fd = iscsi_get_fd(run.iscsi);
+        pfd.events = iscsi_which_events(run.iscsi);
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout_ms) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            snprintf(msg, sizeof(msg), "poll failed: %s", strerror(errno));
+            goto fail;
+        }
+        if (iscsi_service(run.iscsi, pfd.revents) < 0) {
+            snprintf(msg, sizeof(msg), "Event loop failed: %s", iscsi_get_error(run.iscsi));
+            goto fail;
+        }
+    }
+    elapsed = latency_now_ns() - start;
+
+    iscsi_disconnect_target(run.iscsi);
+    iscsi_destroy_context(run.iscsi);
+
+    if (report->latency) {
+        latency_hist_merge(report->latency, &run.hist);
+        report->bytes += run.bytes;
+    }
+
+    {
+        double secs = elapsed / 1e9;
+        int len = snprintf(msg, sizeof(msg),
+                           "%llu commands (%llu read, %llu write, %llu sync, %llu TUR) in %.3fs "
+                           "of a %.3fs trace, %.0f IOPS, %.2f MB/s, p50 %.3fms p99 %.3fms",
+                           (unsigned long long)run.completed,
+                           (unsigned long long)counts[REPLAY_READ],
+                           (unsigned long long)counts[REPLAY_WRITE],
+                           (unsigned long long)counts[REPLAY_SYNC],
+                           (unsigned long long)counts[REPLAY_TUR],
+                           secs, trace.span_ns / 1e9,
+                           secs > 0 ? run.completed / secs : 0.0,
+                           secs > 0 ? run.bytes / secs / 1000000.0 : 0.0,
+                           latency_hist_percentile(&run.hist, 0.50) / 1e6,
+                           latency_hist_percentile(&run.hist, 0.99) / 1e6);
+
+        if (speed > 0 && trace.count > 0 && len > 0 && (size_t)len < sizeof(msg)) {
+            len += snprintf(msg + len, sizeof(msg) - len, ", lag avg %.3fms max %.3fms",
+                            total_lag / (double)trace.count / 1e6, max_lag / 1e6);
+        }
+        if ((trace.unsupported || out_of_range) && len > 0 && (size_t)len < sizeof(msg)) {
+            snprintf(msg + len, sizeof(msg) - len, "; skipped %llu unsupported, %llu out of range",
+                     (unsigned long long)trace.unsupported, (unsigned long long)out_of_range);
+        }
+    }
+
+    if (run.errors > 0) {
+        char fail_msg[1200];
+
+        snprintf(fail_msg, sizeof(fail_msg), "%llu of %zu commands failed: %s",
+                 (unsigned long long)run.errors, trace.count, msg);
+        report_set_result(report, TEST_FAIL, fail_msg);
+        result = TEST_FAIL;
+    } else {
+        report_set_result(report, TEST_PASS, msg);
+    }
+    goto out;
+
+fail:
+    report_set_result(report, TEST_FAIL, msg);
+    result = TEST_FAIL;
+    /* Destroy the context first: it completes outstanding tasks into our slots */
+    iscsi_disconnect(run.iscsi);
+    iscsi_destroy_context(run.iscsi);
+
+out:
+    buffer_pool_put(run.read_buf);
+    buffer_pool_put(run.write_buf);
+    free(run.slots);
+    free(run.free_slots);
+    free(trace.ops);
+    return result;
+}
+
+/* Test registry */
+static const test_def_t replay_tests[] = {
+    {"TR-001", "Trace Replay", "Replay Tests", test_trace_replay, 0},
+};
+
+/* Listed in the build-time test table (see TEST_GROUPS in the Makefile) */
+const test_group_t replay_test_group = {
+    "replay", "Re-drive a captured PDU trace", false,
+    replay_tests, sizeof(replay_tests) / sizeof(replay_tests[0])
+};
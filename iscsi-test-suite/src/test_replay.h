@@ -0,0 +1,9 @@
+#ifndef TEST_REPLAY_H
+#define TEST_REPLAY_H
+
+#include "test_framework.h"
+
+/* The trace replay tests, for the build-time test table */
+extern const test_group_t replay_test_group;
+
+#endif /* TEST_REPLAY_H */
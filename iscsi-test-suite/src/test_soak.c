@@ -0,0 +1,437 @@
+#include "test_soak.h"
+#include "utils.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iscsi/iscsi.h>
+
+/*
+ * Soak tests.
+ *
+ * Each test runs a mixed read/write workload on one session, either for
+ * [soak] duration seconds or, when that is 0, for stress_iterations I/Os.
+ * I/O sizes are drawn from the configured block-size mix and LBAs from a
+ * sequential, uniform random or zipfian distribution over the working set.
+ *
+ * Writes carry block-tagged patterns and every read of a block written
+ * earlier in the run is verified against the generation last written
+ * there. Throughput and latency are printed every [soak] interval seconds;
+ * the test fails on I/O errors, data mismatches, any I/O slower than
+ * timeout, or when the last interval's IOPS has decayed more than
+ * decay_percent below the first.
+ */
+
+#define SOAK_SEED 0x50414bULL
+#define SOAK_ZIPF_MAX_SLOTS (1U << 22)     /* Bounds the O(n) zeta precompute */
+
+typedef enum {
+    SOAK_SEQUENTIAL,
+    SOAK_RANDOM,
+    SOAK_ZIPF
+} soak_dist_t;
+
+static const char *soak_dist_name[] = { "sequential", "random", "zipfian" };
+
+/* Zipfian rank generator (Gray et al., "Quickly Generating Billion-Record Synthetic Databases") */
+typedef struct {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    double half_pow_theta;
+} zipf_t;
+
+static void zipf_init(zipf_t *z, uint64_t n, double theta) {
+    double zeta2 = 1.0 + pow(0.5, theta);
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0.0;
+    for (uint64_t i = 1; i <= n; i++) {
+        z->zetan += 1.0 / pow((double)i, theta);
+    }
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+    z->half_pow_theta = pow(0.5, theta);
+}
+
+/* Rank in [0, n) for a uniform u in (0, 1); rank 0 is the hottest */
+static uint64_t zipf_next(const zipf_t *z, double u) {
+    double uz = u * z->zetan;
+    uint64_t rank;
+
+    if (z->n < 2 || uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + z->half_pow_theta) {
+        return 1;
+    }
+    rank = (uint64_t)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return rank < z->n ? rank : z->n - 1;
+}
+
+/* Workload state for one soak run */
+typedef struct {
+    struct iscsi_context *iscsi;
+    test_config_t *config;
+    soak_dist_t dist;
+    uint32_t block_size;
+    uint64_t working_set;       /* Blocks, starting at LBA 0 */
+    uint32_t max_blocks;        /* Largest I/O in the mix */
+    int total_weight;
+    unsigned int seed;
+
+    uint64_t cursor;            /* Next LBA for sequential runs */
+    zipf_t zipf;
+    uint64_t zipf_slot_blocks;  /* Blocks per zipf slot; slot ranks are scattered */
+
+    uint32_t *generations;      /* Last generation written per block, 0 = never */
+    uint32_t generation;
+    uint8_t *buffer;
+} soak_workload_t;
+
+/* Stats for the interval being accumulated */
+typedef struct {
+    latency_hist_t *hist;
+    uint64_t bytes;
+    uint64_t start_ns;
+    int full_intervals;
+    double first_iops;
+    double last_iops;
+    double min_iops;
+    double worst_p99_ms;
+} soak_intervals_t;
+
+static uint64_t soak_rand64(soak_workload_t *w) {
+    return ((uint64_t)rand_r(&w->seed) << 31) ^ (uint64_t)rand_r(&w->seed);
+}
+
+static double soak_uniform(soak_workload_t *w) {
+    return (rand_r(&w->seed) + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+/* Pick an I/O size from the weighted block-size mix */
+static uint32_t soak_pick_blocks(soak_workload_t *w) {
+    int r = rand_r(&w->seed) % w->total_weight;
+
+    for (int i = 0; i < w->config->soak_block_size_count; i++) {
+        r -= w->config->soak_block_weights[i];
+        if (r < 0) {
+            return (uint32_t)w->config->soak_block_sizes[i];
+        }
+    }
+    return (uint32_t)w->config->soak_block_sizes[0];
+}
+
+/* Pick the first LBA of an I/O of the given size */
+static uint64_t soak_next_lba(soak_workload_t *w, uint32_t blocks) {
+    uint64_t lba;
+
+    switch (w->dist) {
+        case SOAK_SEQUENTIAL:
+            if (w->cursor + blocks > w->working_set) {
+                w->cursor = 0;
+            }
+            lba = w->cursor;
+            w->cursor += blocks;
+            return lba;
+        case SOAK_ZIPF: {
+            /* Scatter ranks so the hot slots are not all at the start of the LUN */
+            uint64_t rank = zipf_next(&w->zipf, soak_uniform(w));
+            uint64_t slot = (rank * 2654435761ULL) % w->zipf.n;
+            lba = slot * w->zipf_slot_blocks;
+            break;
+        }
+        default:
+            lba = soak_rand64(w) % (w->working_set - blocks + 1);
+            break;
+    }
+
+    if (lba + blocks > w->working_set) {
+        lba = w->working_set - blocks;
+    }
+    return lba;
+}
+
+/* Close the current interval: print it and fold it into the run's trend */
+static void soak_end_interval(soak_intervals_t *iv, test_config_t *config, uint64_t run_start_ns,
+                              uint64_t now_ns, int full) {
+    double secs = (now_ns - iv->start_ns) / 1e9;
+    double iops = secs > 0 ? iv->hist->total / secs : 0.0;
+    double p99_ms = latency_hist_percentile(iv->hist, 0.99) / 1e6;
+
+    if (iv->hist->total == 0) {
+        return;
+    }
+
+    if (config->verbosity >= 1) {
+        printf("    [%6.0fs] %9.0f IOPS %9.2f MB/s  p50 %.3fms  p99 %.3fms  max %.3fms%s\n",
+               (now_ns - run_start_ns) / 1e9, iops, secs > 0 ? iv->bytes / secs / (1024 * 1024) : 0.0,
+               latency_hist_percentile(iv->hist, 0.50) / 1e6, p99_ms, iv->hist->max_ns / 1e6,
+               full ? "" : " (partial)");
+        fflush(stdout);
+    }
+
+    if (full) {
+        if (iv->full_intervals == 0) {
+            iv->first_iops = iops;
+            iv->min_iops = iops;
+        }
+        if (iops < iv->min_iops) {
+            iv->min_iops = iops;
+        }
+        iv->last_iops = iops;
+        iv->full_intervals++;
+    }
+    if (p99_ms > iv->worst_p99_ms) {
+        iv->worst_p99_ms = p99_ms;
+    }
+
+    latency_hist_reset(iv->hist);
+    iv->bytes = 0;
+    iv->start_ns = now_ns;
+}
+
+static test_result_t run_soak(test_config_t *config, test_report_t *report, soak_dist_t dist) {
+    soak_workload_t w;
+    soak_intervals_t iv;
+    uint64_t num_blocks;
+    uint64_t ops = 0, reads = 0, verified = 0, stalls = 0;
+    uint64_t run_start, end_ns = 0, interval_ns, stall_ns;
+    test_result_t result = TEST_PASS;
+    char msg[1024];
+
+    if (!config->iqn || strlen(config->iqn) == 0) {
+        report_set_result(report, TEST_SKIP, "No IQN specified");
+        return TEST_SKIP;
+    }
+
+    if (config->soak_block_size_count == 0 ||
+        (config->soak_duration <= 0 && config->stress_iterations <= 0)) {
+        report_set_result(report, TEST_SKIP, "Soak parameters not configured");
+        return TEST_SKIP;
+    }
+
+    memset(&w, 0, sizeof(w));
+    memset(&iv, 0, sizeof(iv));
+    w.config = config;
+    w.dist = dist;
+    w.seed = (unsigned int)(SOAK_SEED + dist);
+    for (int i = 0; i < config->soak_block_size_count; i++) {
+        w.total_weight += config->soak_block_weights[i];
+        if ((uint32_t)config->soak_block_sizes[i] > w.max_blocks) {
+            w.max_blocks = (uint32_t)config->soak_block_sizes[i];
+        }
+    }
+
+    w.iscsi = create_iscsi_context_for_test(config);
+    if (!w.iscsi) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        return TEST_ERROR;
+    }
+    /* A hung command should fail the soak, not hang it */
+    if (config->timeout > 0) {
+        iscsi_set_timeout(w.iscsi, config->timeout);
+    }
+    if (iscsi_connect_target(w.iscsi, config) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to connect");
+        iscsi_destroy_context(w.iscsi);
+        return TEST_ERROR;
+    }
+
+    if (scsi_read_capacity(w.iscsi, config->lun, &num_blocks, &w.block_size) != 0) {
+        report_set_result(report, TEST_ERROR, "Failed to get capacity");
+        iscsi_disconnect_target(w.iscsi);
+        iscsi_destroy_context(w.iscsi);
+        return TEST_ERROR;
+    }
+
+    /* The generation table costs 4 bytes per block; 2^32 blocks is past any sane soak */
+    w.working_set = config->soak_working_set > 0 ? (uint64_t)config->soak_working_set : num_blocks;
+    if (w.working_set > num_blocks) w.working_set = num_blocks;
+    if (w.working_set > 0xFFFFFFFFULL) w.working_set = 0xFFFFFFFFULL;
+
+    if (w.working_set < w.max_blocks || w.block_size < PATTERN_MIN_BLOCK_SIZE) {
+        report_set_result(report, TEST_SKIP, "Working set too small for soak block sizes");
+        iscsi_disconnect_target(w.iscsi);
+        iscsi_destroy_context(w.iscsi);
+        return TEST_SKIP;
+    }
+
+    if (dist == SOAK_ZIPF) {
+        double theta = config->soak_zipf_theta;
+
+        /* The generator needs 0 < theta < 1 */
+        if (theta <= 0.0) theta = 0.01;
+        if (theta >= 1.0) theta = 0.9999;
+
+        w.zipf_slot_blocks = w.max_blocks;
+        while (w.working_set / w.zipf_slot_blocks > SOAK_ZIPF_MAX_SLOTS) {
+            w.zipf_slot_blocks *= 2;
+        }
+        zipf_init(&w.zipf, w.working_set / w.zipf_slot_blocks, theta);
+    }
+
+    w.generations = calloc(w.working_set, sizeof(uint32_t));
+    w.buffer = buffer_pool_get((size_t)w.max_blocks * w.block_size);
+    iv.hist = calloc(1, sizeof(latency_hist_t));
+    if (!w.generations || !w.buffer || !iv.hist) {
+        report_set_result(report, TEST_ERROR, "Memory allocation failed");
+        result = TEST_ERROR;
+        goto out;
+    }
+
+    if (config->verbosity >= 1) {
+        printf("    %s soak over %llu blocks, %d%% reads, %s\n", soak_dist_name[dist],
+               (unsigned long long)w.working_set, config->soak_read_percent,
+               config->soak_duration > 0 ? "time-bounded" : "iteration-bounded");
+        fflush(stdout);
+    }
+
+    run_start = latency_now_ns();
+    if (config->soak_duration > 0) {
+        end_ns = run_start + config->soak_duration * 1000000000ULL;
+    }
+    interval_ns = (config->soak_interval > 0 ? config->soak_interval : 10) * 1000000000ULL;
+    stall_ns = config->timeout > 0 ? config->timeout * 1000000000ULL : 0;
+    iv.start_ns = run_start;
+
+    while (end_ns ? latency_now_ns() < end_ns : ops < (uint64_t)config->stress_iterations) {
+        uint32_t blocks = soak_pick_blocks(&w);
+        uint64_t lba = soak_next_lba(&w, blocks);
+        int is_read = (rand_r(&w.seed) % 100) < config->soak_read_percent;
+        uint32_t gen = 0;
+        uint64_t t0, t1;
+        int rc;
+
+        t0 = latency_now_ns();
+        if (is_read) {
+            rc = scsi_read_blocks(w.iscsi, config->lun, lba, blocks, w.block_size, w.buffer);
+        } else {
+            gen = ++w.generation;
+            pattern_fill_blocks(w.buffer, lba, blocks, w.block_size, gen, SOAK_SEED);
+            rc = scsi_write_blocks(w.iscsi, config->lun, lba, blocks, w.block_size, w.buffer);
+        }
+        t1 = latency_now_ns();
+
+        if (rc != 0) {
+            snprintf(msg, sizeof(msg), "%s of %u blocks at LBA %llu failed after %llu I/Os: %s",
+                     is_read ? "Read" : "Write", blocks, (unsigned long long)lba,
+                     (unsigned long long)ops, iscsi_get_error(w.iscsi));
+            report_set_result(report, TEST_FAIL, msg);
+            result = TEST_FAIL;
+            goto out;
+        }
+
+        latency_hist_record(iv.hist, t0, t1);
+        iv.bytes += (uint64_t)blocks * w.block_size;
+        if (stall_ns && t1 - t0 > stall_ns) {
+            stalls++;
+        }
+        ops++;
+
+        if (is_read) {
+            reads++;
+            for (uint32_t b = 0; config->soak_verify && b < blocks; b++) {
+                pattern_mismatch_t mismatch;
+                uint32_t expected = w.generations[lba + b];
+
+                if (expected == 0) {
+                    continue;
+                }
+                if (pattern_verify_blocks(w.buffer + (size_t)b * w.block_size, lba + b, 1,
+                                          w.block_size, expected, SOAK_SEED, &mismatch) != 0) {
+                    char detail[160];
+                    pattern_format_mismatch(&mismatch, detail, sizeof(detail));
+                    snprintf(msg, sizeof(msg), "Data mismatch after %llu I/Os: %s",
+                             (unsigned long long)ops, detail);
+                    report_set_result(report, TEST_FAIL, msg);
+                    result = TEST_FAIL;
+                    goto out;
+                }
+                verified++;
+            }
+        } else {
+            for (uint32_t b = 0; b < blocks; b++) {
+                w.generations[lba + b] = gen;
+            }
+        }
+
+        if (t1 - iv.start_ns >= interval_ns) {
+            soak_end_interval(&iv, config, run_start, t1, 1);
+        }
+    }
+    soak_end_interval(&iv, config, run_start, latency_now_ns(), 0);
+
+    snprintf(msg, sizeof(msg),
+             "%s, %llu I/Os (%llu reads), %llu blocks verified, %d intervals: "
+             "first %.0f IOPS, last %.0f, min %.0f; worst interval p99 %.3fms",
+             soak_dist_name[dist], (unsigned long long)ops, (unsigned long long)reads,
+             (unsigned long long)verified, iv.full_intervals, iv.first_iops, iv.last_iops,
+             iv.min_iops, iv.worst_p99_ms);
+
+    if (stalls > 0) {
+        size_t off = strlen(msg);
+        snprintf(msg + off, sizeof(msg) - off, "; %llu I/Os took longer than %ds",
+                 (unsigned long long)stalls, config->timeout);
+        result = TEST_FAIL;
+    }
+
+    /* Throughput decay: compare the last full interval with the first */
+    if (iv.full_intervals >= 2 && config->soak_decay_percent > 0 &&
+        iv.last_iops < iv.first_iops * (100 - config->soak_decay_percent) / 100.0) {
+        size_t off = strlen(msg);
+        snprintf(msg + off, sizeof(msg) - off, "; IOPS decayed %.0f%%",
+                 100.0 * (iv.first_iops - iv.last_iops) / iv.first_iops);
+        result = TEST_FAIL;
+    }
+
+    report_set_result(report, result, msg);
+
+out:
+    iscsi_disconnect_target(w.iscsi);
+    iscsi_destroy_context(w.iscsi);
+    free(w.generations);
+    buffer_pool_put(w.buffer);
+    free(iv.hist);
+    return result;
+}
+
+/* TS-001: Random Mixed Soak */
+static test_result_t test_soak_random(struct iscsi_context *unused_iscsi,
+                                      test_config_t *config,
+                                      test_report_t *report) {
+    (void)unused_iscsi;
+    return run_soak(config, report, SOAK_RANDOM);
+}
+
+/* TS-002: Sequential Mixed Soak */
+static test_result_t test_soak_sequential(struct iscsi_context *unused_iscsi,
+                                          test_config_t *config,
+                                          test_report_t *report) {
+    (void)unused_iscsi;
+    return run_soak(config, report, SOAK_SEQUENTIAL);
+}
+
+/* TS-003: Zipfian Hot-Spot Soak */
+static test_result_t test_soak_zipf(struct iscsi_context *unused_iscsi,
+                                    test_config_t *config,
+                                    test_report_t *report) {
+    (void)unused_iscsi;
+    return run_soak(config, report, SOAK_ZIPF);
+}
+
+/* Test definitions */
+static const test_def_t soak_tests[] = {
+    {"TS-001", "Random Mixed Soak", "Soak Tests", test_soak_random, 0},
+    {"TS-002", "Sequential Mixed Soak", "Soak Tests", test_soak_sequential, 0},
+    {"TS-003", "Zipfian Hot-Spot Soak", "Soak Tests", test_soak_zipf, 0},
+};
+
+/* Listed in the build-time test table (see TEST_GROUPS in the Makefile) */
+const test_group_t soak_test_group = {
+    "soak", "Long-running mixed workload soak tests", false,
+    soak_tests, sizeof(soak_tests) / sizeof(soak_tests[0])
+};
@@ -0,0 +1,9 @@
+#ifndef TEST_SOAK_H
+#define TEST_SOAK_H
+
+#include "test_framework.h"
+
+/* The soak tests, for the build-time test table */
+extern const test_group_t soak_test_group;
+
+#endif /* TEST_SOAK_H */
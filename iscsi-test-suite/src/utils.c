@@ -29,6 +29,115 @@ char* str_dup_safe(const char *str) {
     return strdup(str);
 }
 
+/* Parse a comma-separated list of integers in [min_val, max_val] */
+static int parse_int_list(const char *value, int *out, int max_count,
+                          int min_val, int max_val, const char *what) {
+    char buf[256];
+    char *saveptr = NULL;
+    char *tok;
+    int count = 0;
+
+    strncpy(buf, value, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (tok = strtok_r(buf, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        char *item = trim_whitespace(tok);
+        int v;
+
+        if (*item == '\0') {
+            continue;
+        }
+        v = atoi(item);
+        if (v < min_val || v > max_val) {
+            fprintf(stderr, "Warning: ignoring %s %d (must be %d..%d)\n",
+                    what, v, min_val, max_val);
+            continue;
+        }
+        if (count >= max_count) {
+            fprintf(stderr, "Warning: too many %s values, using first %d\n", what, max_count);
+            break;
+        }
+        out[count++] = v;
+    }
+
+    return count;
+}
+
+/* Parse a block-size mix: comma-separated "blocks[:weight]" entries, weight defaults to 1 */
+static int parse_block_mix(const char *value, int *blocks, int *weights, int max_count) {
+    char buf[256];
+    char *saveptr = NULL;
+    char *tok;
+    int count = 0;
+
+    strncpy(buf, value, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (tok = strtok_r(buf, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        char *item = trim_whitespace(tok);
+        char *colon = strchr(item, ':');
+        int b, w = 1;
+
+        if (*item == '\0') {
+            continue;
+        }
+        if (colon) {
+            *colon = '\0';
+            w = atoi(colon + 1);
+        }
+        b = atoi(item);
+        if (b < 1 || b > 65535 || w < 1) {
+            fprintf(stderr, "Warning: ignoring block size entry '%s'\n", item);
+            continue;
+        }
+        if (count >= max_count) {
+            fprintf(stderr, "Warning: too many block sizes, using first %d\n", max_count);
+            break;
+        }
+        blocks[count] = b;
+        weights[count] = w;
+        count++;
+    }
+
+    return count;
+}
+
+/* Set report file formats from a comma-separated list: text, json, csv, all */
+int config_set_report_format(test_config_t *config, const char *formats) {
+    char buf[128];
+    char *saveptr = NULL;
+    char *tok;
+    int ret = 0;
+
+    strncpy(buf, formats, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    config->report_text = false;
+    config->report_json = false;
+    config->report_csv = false;
+
+    for (tok = strtok_r(buf, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        char *item = trim_whitespace(tok);
+
+        if (strcmp(item, "text") == 0) {
+            config->report_text = true;
+        } else if (strcmp(item, "json") == 0) {
+            config->report_json = true;
+        } else if (strcmp(item, "csv") == 0) {
+            config->report_csv = true;
+        } else if (strcmp(item, "all") == 0) {
+            config->report_text = true;
+            config->report_json = true;
+            config->report_csv = true;
+        } else {
+            fprintf(stderr, "Warning: unknown report format '%s'\n", item);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
 /* Parse INI file */
 int config_parse_file(const char *filename, test_config_t *config) {
     FILE *f = fopen(filename, "r");
@@ -43,13 +152,59 @@ int config_parse_file(const char *filename, test_config_t *config) {
     /* Set defaults */
     memset(config, 0, sizeof(test_config_t));
     config->lun = 0;
+    config->header_digest = ISCSI_HEADER_DIGEST_NONE;
     config->block_size = 512;
     config->large_transfer_blocks = 1024;
     config->timeout = 30;
     config->stress_iterations = 100;
+    config->lba_window_blocks = 65536;
+    config->idle_sessions = 64;
+    config->bench_queue_depth_count = parse_int_list("1,2,4,8,16,32,64,128,256",
+                                                     config->bench_queue_depths,
+                                                     MAX_BENCH_QUEUE_DEPTHS, 1, 256,
+                                                     "queue depth");
+    config->bench_duration = 3;
+    config->bench_io_blocks = 8;
+    config->metrics_endpoint = NULL;
+    config->neg_first_burst_count = parse_int_list("65536,262144", config->neg_first_burst_lengths,
+                                                   MAX_NEGOTIATION_VALUES, 512, 16777215,
+                                                   "first burst length");
+    config->neg_max_burst_count = parse_int_list("262144,1048576", config->neg_max_burst_lengths,
+                                                 MAX_NEGOTIATION_VALUES, 512, 16777215,
+                                                 "max burst length");
+    config->neg_max_recv_dsl_count = parse_int_list("8192,262144", config->neg_max_recv_dsls,
+                                                    MAX_NEGOTIATION_VALUES, 512, 16777215,
+                                                    "max recv data segment length");
+    config->neg_io_blocks = 256;
+    config->load_threads = 4;
+    config->load_sessions_per_thread = 4;
+    config->load_queue_depth = 4;
+    config->load_read_percent = 70;
+    config->load_cpu_count = 0;
+    config->soak_duration = 0;
+    config->soak_interval = 10;
+    config->soak_read_percent = 70;
+    config->soak_block_size_count = parse_block_mix("1:20,8:60,64:15,256:5",
+                                                    config->soak_block_sizes,
+                                                    config->soak_block_weights,
+                                                    MAX_SOAK_BLOCK_SIZES);
+    config->soak_working_set = 65536;
+    config->soak_zipf_theta = 0.99;
+    config->soak_decay_percent = 50;
+    config->soak_verify = true;
+    config->replay_file = NULL;
+    config->replay_speed = 1.0;
+    config->replay_queue_depth = 64;
     config->verbosity = 1;
     config->stop_on_fail = false;
     config->generate_report = true;
+    config->session_pool = 0;
+    config->jobs = 1;
+    config->report_text = true;
+    config->report_json = false;
+    config->report_csv = false;
+    config->compare_baseline = NULL;
+    config->compare_tolerance = 10.0;
 
     while (fgets(line, sizeof(line), f)) {
         char *trimmed = trim_whitespace(line);
@@ -93,6 +248,19 @@ int config_parse_file(const char *filename, test_config_t *config) {
                 config->iqn = strdup(value);
             } else if (strcmp(key, "lun") == 0) {
                 config->lun = atoi(value);
+            } else if (strcmp(key, "header_digest") == 0) {
+                if (strcmp(value, "crc32c") == 0) {
+                    config->header_digest = ISCSI_HEADER_DIGEST_CRC32C;
+                } else if (strcmp(value, "crc32c_none") == 0) {
+                    config->header_digest = ISCSI_HEADER_DIGEST_CRC32C_NONE;
+                } else if (strcmp(value, "none_crc32c") == 0) {
+                    config->header_digest = ISCSI_HEADER_DIGEST_NONE_CRC32C;
+                } else if (strcmp(value, "none") == 0) {
+                    config->header_digest = ISCSI_HEADER_DIGEST_NONE;
+                } else {
+                    fprintf(stderr, "Warning: unknown header_digest '%s', using none\n", value);
+                    config->header_digest = ISCSI_HEADER_DIGEST_NONE;
+                }
             }
         } else if (strcmp(section, "authentication") == 0) {
             if (strcmp(key, "auth_method") == 0) {
@@ -115,6 +283,87 @@ int config_parse_file(const char *filename, test_config_t *config) {
                 config->timeout = atoi(value);
             } else if (strcmp(key, "stress_iterations") == 0) {
                 config->stress_iterations = atoi(value);
+            } else if (strcmp(key, "lba_window_blocks") == 0) {
+                config->lba_window_blocks = atoi(value);
+            } else if (strcmp(key, "idle_sessions") == 0) {
+                config->idle_sessions = atoi(value);
+            }
+        } else if (strcmp(section, "benchmark") == 0) {
+            if (strcmp(key, "queue_depths") == 0) {
+                config->bench_queue_depth_count = parse_int_list(value, config->bench_queue_depths,
+                                                                 MAX_BENCH_QUEUE_DEPTHS, 1, 256,
+                                                                 "queue depth");
+            } else if (strcmp(key, "duration") == 0) {
+                config->bench_duration = atoi(value);
+            } else if (strcmp(key, "io_blocks") == 0) {
+                config->bench_io_blocks = atoi(value);
+            } else if (strcmp(key, "first_burst_lengths") == 0) {
+                config->neg_first_burst_count = parse_int_list(value, config->neg_first_burst_lengths,
+                                                               MAX_NEGOTIATION_VALUES, 512, 16777215,
+                                                               "first burst length");
+            } else if (strcmp(key, "max_burst_lengths") == 0) {
+                config->neg_max_burst_count = parse_int_list(value, config->neg_max_burst_lengths,
+                                                             MAX_NEGOTIATION_VALUES, 512, 16777215,
+                                                             "max burst length");
+            } else if (strcmp(key, "max_recv_data_segment_lengths") == 0) {
+                config->neg_max_recv_dsl_count = parse_int_list(value, config->neg_max_recv_dsls,
+                                                                MAX_NEGOTIATION_VALUES, 512, 16777215,
+                                                                "max recv data segment length");
+            } else if (strcmp(key, "negotiation_io_blocks") == 0) {
+                config->neg_io_blocks = atoi(value);
+            } else if (strcmp(key, "threads") == 0) {
+                config->load_threads = atoi(value);
+            } else if (strcmp(key, "sessions_per_thread") == 0) {
+                config->load_sessions_per_thread = atoi(value);
+            } else if (strcmp(key, "session_queue_depth") == 0) {
+                config->load_queue_depth = atoi(value);
+            } else if (strcmp(key, "read_percent") == 0) {
+                config->load_read_percent = atoi(value);
+            } else if (strcmp(key, "cpu_list") == 0) {
+                config->load_cpu_count = parse_int_list(value, config->load_cpus,
+                                                        MAX_LOAD_CPUS, 0, 4095, "cpu");
+            } else if (strcmp(key, "metrics_endpoint") == 0) {
+                if (strlen(value) > 0) {
+                    free(config->metrics_endpoint);
+                    config->metrics_endpoint = strdup(value);
+                }
+            }
+        } else if (strcmp(section, "soak") == 0) {
+            if (strcmp(key, "duration") == 0) {
+                config->soak_duration = atoi(value);
+            } else if (strcmp(key, "interval") == 0) {
+                config->soak_interval = atoi(value);
+            } else if (strcmp(key, "read_percent") == 0) {
+                config->soak_read_percent = atoi(value);
+            } else if (strcmp(key, "block_sizes") == 0) {
+                config->soak_block_size_count = parse_block_mix(value, config->soak_block_sizes,
+                                                                config->soak_block_weights,
+                                                                MAX_SOAK_BLOCK_SIZES);
+            } else if (strcmp(key, "working_set") == 0) {
+                config->soak_working_set = atoi(value);
+            } else if (strcmp(key, "zipf_theta") == 0) {
+                config->soak_zipf_theta = atof(value);
+            } else if (strcmp(key, "decay_percent") == 0) {
+                config->soak_decay_percent = atoi(value);
+            } else if (strcmp(key, "verify") == 0) {
+                config->soak_verify = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+            }
+        } else if (strcmp(section, "replay") == 0) {
+            if (strcmp(key, "trace_file") == 0) {
+                if (strlen(value) > 0) {
+                    free(config->replay_file);
+                    config->replay_file = strdup(value);
+                }
+            } else if (strcmp(key, "speed") == 0) {
+                if (strcmp(value, "max") == 0) {
+                    config->replay_speed = 0.0;
+                } else if (strcmp(value, "original") == 0) {
+                    config->replay_speed = 1.0;
+                } else {
+                    config->replay_speed = atof(value);
+                }
+            } else if (strcmp(key, "queue_depth") == 0) {
+                config->replay_queue_depth = atoi(value);
             }
         } else if (strcmp(section, "options") == 0) {
             if (strcmp(key, "verbosity") == 0) {
@@ -123,6 +372,19 @@ int config_parse_file(const char *filename, test_config_t *config) {
                 config->stop_on_fail = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
             } else if (strcmp(key, "generate_report") == 0) {
                 config->generate_report = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+            } else if (strcmp(key, "session_pool") == 0) {
+                config->session_pool = atoi(value);
+            } else if (strcmp(key, "jobs") == 0) {
+                config->jobs = atoi(value);
+            } else if (strcmp(key, "report_format") == 0) {
+                config_set_report_format(config, value);
+            } else if (strcmp(key, "compare_baseline") == 0) {
+                if (strlen(value) > 0) {
+                    free(config->compare_baseline);
+                    config->compare_baseline = strdup(value);
+                }
+            } else if (strcmp(key, "compare_tolerance") == 0) {
+                config->compare_tolerance = atof(value);
             }
         }
     }
@@ -147,6 +409,9 @@ void config_free(test_config_t *config) {
     if (config->password) free(config->password);
     if (config->mutual_username) free(config->mutual_username);
     if (config->mutual_password) free(config->mutual_password);
+    if (config->compare_baseline) free(config->compare_baseline);
+    if (config->replay_file) free(config->replay_file);
+    if (config->metrics_endpoint) free(config->metrics_endpoint);
     memset(config, 0, sizeof(test_config_t));
 }
 
@@ -178,7 +443,7 @@ struct iscsi_context* create_iscsi_context_for_test(test_config_t *config) {
 
     iscsi_set_targetname(iscsi, iscsi_url->target);
     iscsi_set_session_type(iscsi, ISCSI_SESSION_NORMAL);
-    iscsi_set_header_digest(iscsi, ISCSI_HEADER_DIGEST_NONE);
+    iscsi_set_header_digest(iscsi, config->header_digest);
 
     /* Set authentication if configured */
     if (config->auth_method) {
@@ -231,48 +496,82 @@ void iscsi_disconnect_target(struct iscsi_context *iscsi) {
     }
 }
 
+/* Use the framework's pooled session if one was passed in, else log in a new one */
+struct iscsi_context* test_session_acquire(struct iscsi_context *pooled, test_config_t *config) {
+    struct iscsi_context *iscsi;
+
+    if (pooled) {
+        return pooled;
+    }
+
+    iscsi = create_iscsi_context_for_test(config);
+    if (!iscsi || iscsi_connect_target(iscsi, config) != 0) {
+        if (iscsi) iscsi_destroy_context(iscsi);
+        return NULL;
+    }
+    return iscsi;
+}
+
+/* Release a session from test_session_acquire; pooled sessions stay logged in */
+void test_session_release(struct iscsi_context *pooled, struct iscsi_context *iscsi) {
+    if (iscsi && iscsi != pooled) {
+        iscsi_disconnect_target(iscsi);
+        iscsi_destroy_context(iscsi);
+    }
+}
+
 /* Generate data pattern */
 void generate_pattern(uint8_t *buffer, size_t size, const char *pattern_type, uint32_t seed) {
-    if (strcmp(pattern_type, "zero") == 0) {
-        memset(buffer, 0x00, size);
-    } else if (strcmp(pattern_type, "ones") == 0) {
-        memset(buffer, 0xFF, size);
-    } else if (strcmp(pattern_type, "alternating") == 0) {
-        for (size_t i = 0; i < size; i++) {
-            buffer[i] = (i % 2) ? 0xAA : 0x55;
-        }
-    } else if (strcmp(pattern_type, "sequential") == 0) {
-        for (size_t i = 0; i < size; i++) {
-            buffer[i] = (uint8_t)(i & 0xFF);
-        }
-    } else if (strcmp(pattern_type, "random") == 0) {
-        srand(seed);
-        for (size_t i = 0; i < size; i++) {
-            buffer[i] = (uint8_t)(rand() & 0xFF);
-        }
-    } else {
-        /* Default: sequential */
-        for (size_t i = 0; i < size; i++) {
-            buffer[i] = (uint8_t)(i & 0xFF);
-        }
-    }
+    pattern_fill(buffer, size, pattern_type_from_name(pattern_type), seed);
 }
 
-/* Verify data pattern */
+/* Verify data pattern in place */
 int verify_pattern(const uint8_t *buffer, size_t size, const char *pattern_type, uint32_t seed) {
-    uint8_t *expected = malloc(size);
-    if (!expected) {
-        return -1;
+    return pattern_check(buffer, size, pattern_type_from_name(pattern_type), seed, NULL);
+}
+
+/* Per-thread LBA window; blocks == 0 means the whole LUN */
+static __thread uint64_t lba_window_base = 0;
+static __thread uint64_t lba_window_blocks = 0;
+
+/* Restrict this thread's block helpers to [base, base + blocks) */
+void scsi_set_lba_window(uint64_t base, uint64_t blocks) {
+    lba_window_base = base;
+    lba_window_blocks = blocks;
+}
+
+/* Big-endian field of a SCSI response */
+static uint64_t scsi_get_be(const unsigned char *buf, int bytes) {
+    uint64_t value = 0;
+
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | buf[i];
     }
+    return value;
+}
 
-    generate_pattern(expected, size, pattern_type, seed);
-    int result = memcmp(buffer, expected, size);
-    free(expected);
+/*
+ * READ CAPACITY(16) for LUNs of 2^32 blocks or more, whose last LBA does
+ * not fit READ CAPACITY(10). Returns 0 on success.
+ */
+static int scsi_read_capacity16(struct iscsi_context *iscsi, int lun, uint64_t *num_blocks,
+                                uint32_t *block_size) {
+    struct scsi_task *task;
+    int ret = -1;
 
-    return (result == 0) ? 0 : -1;
+    task = iscsi_readcapacity16_sync(iscsi, lun);
+    if (task && task->status == SCSI_STATUS_GOOD && task->datain.size >= 12) {
+        *num_blocks = scsi_get_be(task->datain.data, 8) + 1;
+        *block_size = (uint32_t)scsi_get_be(task->datain.data + 8, 4);
+        ret = 0;
+    }
+    if (task) {
+        scsi_free_scsi_task(task);
+    }
+    return ret;
 }
 
-/* Read capacity */
+/* Read capacity, falling back to READ CAPACITY(16) on LUNs of 2^32 blocks or more */
 int scsi_read_capacity(struct iscsi_context *iscsi, int lun, uint64_t *num_blocks, uint32_t *block_size) {
     struct scsi_task *task;
 
@@ -291,48 +590,241 @@ int scsi_read_capacity(struct iscsi_context *iscsi, int lun, uint64_t *num_block
     }
 
     unsigned char *buf = task->datain.data;
-    uint32_t last_lba = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
-    uint32_t blk_size = (buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
+    uint32_t last_lba = (uint32_t)scsi_get_be(buf, 4);
+    uint32_t blk_size = (uint32_t)scsi_get_be(buf + 4, 4);
 
     *num_blocks = (uint64_t)last_lba + 1;
     *block_size = blk_size;
-
     scsi_free_scsi_task(task);
+
+    /* 0xFFFFFFFF means the last LBA needs the 16-byte form */
+    if (last_lba == 0xFFFFFFFFU &&
+        scsi_read_capacity16(iscsi, lun, num_blocks, block_size) != 0) {
+        return -1;
+    }
+
+    /* Report only what is visible through this thread's window */
+    if (lba_window_blocks > 0) {
+        uint64_t remaining = *num_blocks > lba_window_base ? *num_blocks - lba_window_base : 0;
+        *num_blocks = remaining < lba_window_blocks ? remaining : lba_window_blocks;
+    }
     return 0;
 }
 
+int scsi_use_cdb16(uint64_t lba, uint32_t num_blocks) {
+    return lba + num_blocks > 0x100000000ULL || num_blocks > 0xFFFF;
+}
+
+/*
+ * READ/WRITE with the data phase bound to the caller's buffer via a single
+ * iovec. Data-In is placed straight into buffer (libiscsi never allocates
+ * task->datain, so there is no copy) and Data-Out is sent from it. The
+ * 10-byte CDBs are used where they reach, READ(16)/WRITE(16) otherwise.
+ * fua sets Force Unit Access on writes.
+ */
+static int scsi_rw_iov(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks,
+                       uint32_t block_size, uint8_t *buffer, int is_write, int fua) {
+    struct scsi_task *task;
+    struct scsi_iovec iov;
+    uint32_t len = num_blocks * block_size;
+    int cdb16 = scsi_use_cdb16(lba, num_blocks);
+    int ret = 0;
+
+    if (is_write) {
+        task = cdb16 ? scsi_cdb_write16(lba, len, block_size, 0, 0, fua, 0, 0)
+                     : scsi_cdb_write10((uint32_t)lba, len, block_size, 0, 0, fua, 0, 0);
+    } else {
+        task = cdb16 ? scsi_cdb_read16(lba, len, block_size, 0, 0, 0, 0, 0)
+                     : scsi_cdb_read10((uint32_t)lba, len, block_size, 0, 0, 0, 0, 0);
+    }
+    if (!task) {
+        return -1;
+    }
+
+    iov.iov_base = buffer;
+    iov.iov_len = len;
+    if (is_write) {
+        scsi_task_set_iov_out(task, &iov, 1);
+    } else {
+        scsi_task_set_iov_in(task, &iov, 1);
+    }
+
+    if (iscsi_scsi_command_sync(iscsi, lun, task, NULL) == NULL ||
+        task->status != SCSI_STATUS_GOOD) {
+        ret = -1;
+    } else if (!is_write && task->residual_status == SCSI_RESIDUAL_UNDERFLOW) {
+        /* Short read: part of the buffer was never filled */
+        ret = -1;
+    }
+
+    scsi_free_scsi_task(task);
+    return ret;
+}
+
 /* Read blocks */
 int scsi_read_blocks(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks,
                      uint32_t block_size, uint8_t *buffer) {
-    struct scsi_task *task;
+    uint64_t start_ns = latency_now_ns();
 
-    task = iscsi_read10_sync(iscsi, lun, lba, num_blocks * block_size, block_size, 0, 0, 0, 0, 0);
-    if (!task || task->status != SCSI_STATUS_GOOD) {
-        if (task) {
-            scsi_free_scsi_task(task);
-        }
+    if (scsi_rw_iov(iscsi, lun, lba + lba_window_base, num_blocks, block_size, buffer, 0, 0) != 0) {
         return -1;
     }
-
-    memcpy(buffer, task->datain.data, num_blocks * block_size);
-    scsi_free_scsi_task(task);
+    report_record_op(framework_current_report(), start_ns, (uint64_t)num_blocks * block_size);
     return 0;
 }
 
 /* Write blocks */
 int scsi_write_blocks(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks,
                       uint32_t block_size, const uint8_t *buffer) {
+    uint64_t start_ns = latency_now_ns();
+
+    if (scsi_rw_iov(iscsi, lun, lba + lba_window_base, num_blocks, block_size,
+                      (uint8_t *)buffer, 1, 0) != 0) {
+        return -1;
+    }
+    report_record_op(framework_current_report(), start_ns, (uint64_t)num_blocks * block_size);
+    return 0;
+}
+
+/* Write blocks with FUA: status comes back only once they are on stable storage */
+int scsi_write_blocks_fua(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks,
+                          uint32_t block_size, const uint8_t *buffer) {
+    uint64_t start_ns = latency_now_ns();
+
+    if (scsi_rw_iov(iscsi, lun, lba + lba_window_base, num_blocks, block_size,
+                      (uint8_t *)buffer, 1, 1) != 0) {
+        return -1;
+    }
+    report_record_op(framework_current_report(), start_ns, (uint64_t)num_blocks * block_size);
+    return 0;
+}
+
+/*
+ * SYNCHRONIZE CACHE over num_blocks from lba; num_blocks == 0 means to the
+ * end. The 16-byte form is used when the range does not fit the 10-byte one.
+ */
+int scsi_sync_cache(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks) {
     struct scsi_task *task;
+    uint64_t start = lba + lba_window_base;
+    int ret = 0;
 
-    task = iscsi_write10_sync(iscsi, lun, lba, (unsigned char *)buffer,
-                              num_blocks * block_size, block_size, 0, 0, 0, 0, 0);
+    if (scsi_use_cdb16(start, num_blocks)) {
+        task = iscsi_synchronizecache16_sync(iscsi, lun, start, num_blocks, 0, 0);
+    } else {
+        task = iscsi_synchronizecache10_sync(iscsi, lun, (int)start, (int)num_blocks, 0, 0);
+    }
     if (!task || task->status != SCSI_STATUS_GOOD) {
-        if (task) {
-            scsi_free_scsi_task(task);
+        ret = -1;
+    }
+    if (task) {
+        scsi_free_scsi_task(task);
+    }
+    return ret;
+}
+
+int scsi_report_luns(struct iscsi_context *iscsi, int *luns, int max) {
+    /* The 8-byte header and one 8-byte entry per LUN; 16 is the minimum */
+    int alloc_len = max > 1 ? 8 + 8 * max : 16;
+    struct scsi_task *task = iscsi_reportluns_sync(iscsi, 0, alloc_len);
+    int count = -1;
+
+    if (task && task->status == SCSI_STATUS_GOOD && task->datain.size >= 8) {
+        uint32_t listed = (uint32_t)scsi_get_be(task->datain.data, 4) / 8;
+
+        count = 0;
+        for (uint32_t i = 0; i < listed && count < max && 16 + 8 * (int)i <= task->datain.size; i++) {
+            luns[count++] = (int)scsi_get_be(task->datain.data + 8 + 8 * i, 2);
         }
-        return -1;
     }
+    if (task) {
+        scsi_free_scsi_task(task);
+    }
+    return count;
+}
+
+/* INQUIRY for a VPD page; NULL unless it comes back GOOD with at least min_len bytes */
+static struct scsi_task *scsi_inquiry_vpd(struct iscsi_context *iscsi, int lun, int page, int min_len) {
+    struct scsi_task *task = iscsi_inquiry_sync(iscsi, lun, 1, page, 255);
+
+    if (task && (task->status != SCSI_STATUS_GOOD || task->datain.size < min_len ||
+                 task->datain.data[1] != page)) {
+        scsi_free_scsi_task(task);
+        task = NULL;
+    }
+    return task;
+}
+
+int scsi_read_lbp(struct iscsi_context *iscsi, int lun, scsi_lbp_t *lbp) {
+    struct scsi_task *task;
+    int has_b0 = 0, has_b2 = 0;
 
+    memset(lbp, 0, sizeof(*lbp));
+    task = scsi_inquiry_vpd(iscsi, lun, 0x00, 4);
+    if (!task) {
+        return -1;
+    }
+    for (int i = 4; i < task->datain.size && i < 4 + task->datain.data[3]; i++) {
+        has_b0 |= task->datain.data[i] == 0xB0;
+        has_b2 |= task->datain.data[i] == 0xB2;
+    }
     scsi_free_scsi_task(task);
+
+    /* Logical Block Provisioning: LBPU, LBPWS and LBPRZ bits of byte 5 */
+    if (has_b2 && (task = scsi_inquiry_vpd(iscsi, lun, 0xB2, 8)) != NULL) {
+        lbp->lbpu = (task->datain.data[5] >> 7) & 1;
+        lbp->lbpws = (task->datain.data[5] >> 6) & 1;
+        lbp->lbprz = (task->datain.data[5] >> 2) & 1;
+        scsi_free_scsi_task(task);
+    }
+
+    /* Block Limits: maximum unmap descriptor count and optimal granularity */
+    if (has_b0 && (task = scsi_inquiry_vpd(iscsi, lun, 0xB0, 32)) != NULL) {
+        lbp->max_descriptors = (uint32_t)scsi_get_be(task->datain.data + 24, 4);
+        lbp->granularity = (uint32_t)scsi_get_be(task->datain.data + 28, 4);
+        scsi_free_scsi_task(task);
+    }
     return 0;
 }
+
+/* UNMAP one extent through this thread's LBA window */
+int scsi_unmap_blocks(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks) {
+    struct unmap_list list;
+    struct scsi_task *task;
+    uint64_t start_ns = latency_now_ns();
+    int ret = 0;
+
+    list.lba = lba + lba_window_base;
+    list.num = num_blocks;
+    task = iscsi_unmap_sync(iscsi, lun, 0, 0, &list, 1);
+    if (!task || task->status != SCSI_STATUS_GOOD) {
+        ret = -1;
+    }
+    if (task) {
+        scsi_free_scsi_task(task);
+    }
+    if (ret == 0) {
+        report_record_op(framework_current_report(), start_ns, 0);
+    }
+    return ret;
+}
+
+/* WRITE SAME(16) of one block over num_blocks; unmap sets the UNMAP bit */
+int scsi_write_same16(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks,
+                      uint32_t block_size, const uint8_t *block, int unmap) {
+    struct scsi_task *task;
+    uint64_t start_ns = latency_now_ns();
+    int ret = 0;
+
+    task = iscsi_writesame16_sync(iscsi, lun, lba + lba_window_base, (unsigned char *)block,
+                                  block_size, num_blocks, 0, unmap, 0, 0);
+    if (!task || task->status != SCSI_STATUS_GOOD) {
+        ret = -1;
+    }
+    if (task) {
+        scsi_free_scsi_task(task);
+    }
+    if (ret == 0) {
+        report_record_op(framework_current_report(), start_ns, 0);
+    }
+    return ret;
+}
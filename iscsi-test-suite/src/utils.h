@@ -2,28 +2,83 @@
 #define UTILS_H
 
 #include "test_framework.h"
+#include "data_pattern.h"
+#include "buffer_pool.h"
 #include <iscsi/iscsi.h>
 #include <stdint.h>
 
 /* Configuration file parsing */
 int config_parse_file(const char *filename, test_config_t *config);
 void config_free(test_config_t *config);
+int config_set_report_format(test_config_t *config, const char *formats);
 
 /* iSCSI connection helpers */
 struct iscsi_context* create_iscsi_context_for_test(test_config_t *config);
 int iscsi_connect_target(struct iscsi_context *iscsi, test_config_t *config);
 void iscsi_disconnect_target(struct iscsi_context *iscsi);
 
-/* Data pattern generation */
+/* Session helpers for tests that accept a pooled session */
+struct iscsi_context* test_session_acquire(struct iscsi_context *pooled, test_config_t *config);
+void test_session_release(struct iscsi_context *pooled, struct iscsi_context *iscsi);
+
+/* Data pattern generation; see data_pattern.h for block-tagged patterns */
 void generate_pattern(uint8_t *buffer, size_t size, const char *pattern_type, uint32_t seed);
 int verify_pattern(const uint8_t *buffer, size_t size, const char *pattern_type, uint32_t seed);
 
-/* SCSI helpers */
+/* SCSI helpers
+ *
+ * scsi_read_capacity, scsi_read_blocks, scsi_write_blocks(_fua) and
+ * scsi_sync_cache reach the whole LUN, switching to READ CAPACITY(16) and
+ * 16-byte CDBs past 2^32 blocks. They see the LUN through the calling
+ * thread's LBA window, if one is set: capacity is clipped to the window and
+ * LBAs are relative to its start. Parallel workers use this to keep write
+ * tests from overlapping.
+ */
+void scsi_set_lba_window(uint64_t base, uint64_t blocks);
 int scsi_read_capacity(struct iscsi_context *iscsi, int lun, uint64_t *num_blocks, uint32_t *block_size);
 int scsi_read_blocks(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks,
                      uint32_t block_size, uint8_t *buffer);
 int scsi_write_blocks(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks,
                       uint32_t block_size, const uint8_t *buffer);
+int scsi_write_blocks_fua(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks,
+                          uint32_t block_size, const uint8_t *buffer);
+int scsi_sync_cache(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks);
+
+/*
+ * LUNs the target reports, in its order, as the first two bytes of each
+ * REPORT LUNS entry: the value libiscsi takes as a LUN argument, which is
+ * the LUN number below 256. Stores at most max and returns how many were
+ * stored, or -1 on failure.
+ */
+int scsi_report_luns(struct iscsi_context *iscsi, int *luns, int max);
+
+/*
+ * Thin provisioning a LUN advertises: the Logical Block Provisioning VPD
+ * page's LBPU (UNMAP), LBPWS (WRITE SAME(16) with UNMAP) and LBPRZ
+ * (unmapped blocks read as zeros) bits, and the unmap limits from Block
+ * Limits. Pages the target does not list leave their fields 0.
+ */
+typedef struct {
+    int lbpu;
+    int lbpws;
+    int lbprz;
+    uint32_t max_descriptors;
+    uint32_t granularity;       /* Optimal unmap granularity in blocks, 0 = not reported */
+} scsi_lbp_t;
+
+int scsi_read_lbp(struct iscsi_context *iscsi, int lun, scsi_lbp_t *lbp);
+
+/* Deallocation, through the LBA window like the block helpers above */
+int scsi_unmap_blocks(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks);
+int scsi_write_same16(struct iscsi_context *iscsi, int lun, uint64_t lba, uint32_t num_blocks,
+                      uint32_t block_size, const uint8_t *block, int unmap);
+
+/*
+ * Whether a transfer needs a 16-byte CDB: READ(10)/WRITE(10) reach the
+ * first 2^32 blocks, 65535 at a time. The block helpers above choose for
+ * themselves; async callers building their own tasks use this.
+ */
+int scsi_use_cdb16(uint64_t lba, uint32_t num_blocks);
 
 /* String helpers */
 char* trim_whitespace(char *str);
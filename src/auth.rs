@@ -117,17 +117,12 @@ impl ChapAuthState {
     /// Calculate the expected CHAP response
     /// Response = MD5(identifier + secret + challenge)
     pub fn calculate_response(&self, secret: &str) -> Vec<u8> {
-        let mut data = Vec::new();
-        data.push(self.identifier);
-        data.extend_from_slice(secret.as_bytes());
-        data.extend_from_slice(&self.challenge);
-
-        md5::compute(&data).0.to_vec()
+        chap_response_digest(self.identifier, secret, &self.challenge).to_vec()
     }
 
     /// Validate a CHAP response
     pub fn validate_response(&self, response: &[u8], secret: &str) -> bool {
-        let expected = self.calculate_response(secret);
+        let expected = chap_response_digest(self.identifier, secret, &self.challenge);
 
         // Constant-time comparison to prevent timing attacks
         if response.len() != expected.len() {
@@ -145,7 +140,7 @@ impl ChapAuthState {
     /// Convert challenge to hex string for text parameter
     /// RFC 3720 requires the "0x" prefix for CHAP_C
     pub fn challenge_hex(&self) -> String {
-        format!("0x{}", hex::encode(&self.challenge))
+        ChapHex(&self.challenge).to_string()
     }
 
     /// Convert identifier to string
@@ -154,6 +149,50 @@ impl ChapAuthState {
     }
 }
 
+/// CHAP response digest: MD5(identifier + secret + challenge)
+///
+/// Hashes the pieces in turn, so no buffer is built for them.
+pub fn chap_response_digest(identifier: u8, secret: &str, challenge: &[u8]) -> [u8; 16] {
+    let mut context = md5::Context::new();
+    context.consume([identifier]);
+    context.consume(secret.as_bytes());
+    context.consume(challenge);
+    context.compute().0
+}
+
+/// Binary CHAP value formatted as "0x"-prefixed lowercase hex
+///
+/// Formats straight into the destination, e.g. a login data segment.
+pub struct ChapHex<'a>(pub &'a [u8]);
+
+impl std::fmt::Display for ChapHex<'_> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str("0x")?;
+        for b in self.0 {
+            write!(f, "{:02x}", b)?;
+        }
+        Ok(())
+    }
+}
+
+/// Decode a CHAP hex value (optional "0x" prefix) into `buf`
+///
+/// Returns the decoded bytes, which must fit in `buf`.
+pub fn decode_chap_hex<'b>(hex_str: &str, buf: &'b mut [u8]) -> ScsiResult<&'b [u8]> {
+    let cleaned = hex_str.strip_prefix("0x").unwrap_or(hex_str);
+    let len = cleaned.len() / 2;
+    if len > buf.len() {
+        return Err(IscsiError::Auth(format!(
+            "CHAP value too long: {} bytes (at most {})",
+            len, buf.len()
+        )));
+    }
+    hex::decode_to_slice(cleaned, &mut buf[..len]).map_err(|e| {
+        IscsiError::Auth(format!("Invalid CHAP hex: {}", e))
+    })?;
+    Ok(&buf[..len])
+}
+
 /// Parse CHAP response from hex string
 pub fn parse_chap_response(hex_str: &str) -> ScsiResult<Vec<u8>> {
     // Strip "0x" prefix if present
@@ -187,6 +226,26 @@ mod tests {
         assert!(!state.validate_response(&response, "wrongsecret"));
     }
 
+    #[test]
+    fn test_chap_hex_round_trip() {
+        let state = ChapAuthState::new(false);
+        let hex = state.challenge_hex();
+        assert_eq!(hex, format!("0x{}", hex::encode(&state.challenge)));
+
+        let mut buf = [0u8; 16];
+        assert_eq!(decode_chap_hex(&hex, &mut buf).unwrap(), &state.challenge[..]);
+        assert_eq!(decode_chap_hex("0a0B", &mut buf).unwrap(), &[0x0a, 0x0b]);
+        assert!(decode_chap_hex("0xzz", &mut buf).is_err());
+        assert!(decode_chap_hex("0xabc", &mut buf).is_err());
+        assert!(decode_chap_hex(&format!("0x{}", "00".repeat(17)), &mut buf).is_err());
+
+        // The streamed digest matches hashing the concatenated input
+        let mut data = vec![state.identifier];
+        data.extend_from_slice(b"secret");
+        data.extend_from_slice(&state.challenge);
+        assert_eq!(state.calculate_response("secret"), md5::compute(&data).0.to_vec());
+    }
+
     #[test]
     fn test_chap_challenge_generation() {
         let state1 = ChapAuthState::new(false);
@@ -0,0 +1,515 @@
+//! Ready-made storage backends
+//!
+//! `MemoryDevice` is a RAM disk built for concurrent access. Its storage is
+//! split into fixed-size stripes, each behind its own read-write lock, so
+//! I/O to different stripes never contends and reads of the same stripe
+//! share it. It reports `concurrent_writes()`, so the target never takes a
+//! device-wide lock for it.
+//!
+//! `SparseDevice` is a thin-provisioned RAM disk. Only chunks that have
+//! held non-zero data take memory; they sit in a B-tree keyed by chunk
+//! number, and a hole reads as zeros without any storage behind it. UNMAP
+//! and WRITE SAME with the UNMAP bit hand chunks back, so a mostly empty
+//! LUN costs little however large it is.
+
+use crate::error::{IscsiError, ScsiResult};
+use crate::scsi::ScsiBlockDevice;
+use std::collections::BTreeMap;
+use std::sync::RwLock;
+
+/// Default stripe size in bytes
+pub const DEFAULT_STRIPE_SIZE: usize = 256 * 1024;
+
+/// Default allocation chunk size of a `SparseDevice`, in bytes
+pub const DEFAULT_CHUNK_SIZE: usize = 64 * 1024;
+
+/// Stripe-locked in-memory block device
+pub struct MemoryDevice {
+    stripes: Vec<RwLock<Box<[u8]>>>,
+    stripe_size: usize,
+    size: usize,
+    block_size: u32,
+}
+
+impl MemoryDevice {
+    /// Create a zero-filled device of `size_bytes` (rounded down to whole blocks)
+    pub fn new(size_bytes: usize, block_size: u32) -> Self {
+        Self::with_stripe_size(size_bytes, block_size, DEFAULT_STRIPE_SIZE)
+    }
+
+    /// Create a device with a custom stripe size (rounded up to whole blocks)
+    ///
+    /// Smaller stripes let more writers run at once; larger ones mean fewer
+    /// lock operations per I/O.
+    pub fn with_stripe_size(size_bytes: usize, block_size: u32, stripe_size: usize) -> Self {
+        let block = block_size.max(1) as usize;
+        let size = size_bytes / block * block;
+        let stripe_size = stripe_size.max(1).div_ceil(block) * block;
+
+        let mut stripes = Vec::with_capacity(size.div_ceil(stripe_size));
+        let mut remaining = size;
+        while remaining > 0 {
+            let len = remaining.min(stripe_size);
+            stripes.push(RwLock::new(vec![0u8; len].into_boxed_slice()));
+            remaining -= len;
+        }
+
+        MemoryDevice {
+            stripes,
+            stripe_size,
+            size,
+            block_size,
+        }
+    }
+
+    /// Number of independently locked stripes
+    pub fn stripe_count(&self) -> usize {
+        self.stripes.len()
+    }
+
+    /// Byte offset of a transfer, after checking block size and bounds
+    fn offset(&self, lba: u64, len: usize, block_size: u32) -> ScsiResult<usize> {
+        byte_offset(lba, len, block_size, self.block_size, self.size as u64).map(|o| o as usize)
+    }
+
+    /// Split [offset, offset + len) into (stripe, offset in stripe, length) pieces
+    fn pieces(&self, offset: usize, len: usize) -> impl Iterator<Item = (usize, usize, usize)> + '_ {
+        let mut pos = offset;
+        let end = offset + len;
+        std::iter::from_fn(move || {
+            if pos >= end {
+                return None;
+            }
+            let stripe = pos / self.stripe_size;
+            let start = pos % self.stripe_size;
+            let n = (self.stripe_size - start).min(end - pos);
+            pos += n;
+            Some((stripe, start, n))
+        })
+    }
+
+    fn lock_error() -> IscsiError {
+        IscsiError::Scsi("Stripe lock poisoned".to_string())
+    }
+}
+
+impl ScsiBlockDevice for MemoryDevice {
+    fn read(&self, lba: u64, blocks: u32, block_size: u32) -> ScsiResult<Vec<u8>> {
+        let mut data = vec![0u8; blocks as usize * block_size as usize];
+        self.read_into(lba, blocks, block_size, &mut data)?;
+        Ok(data)
+    }
+
+    fn read_into(&self, lba: u64, blocks: u32, block_size: u32, buf: &mut [u8]) -> ScsiResult<()> {
+        let len = blocks as usize * block_size as usize;
+        if buf.len() != len {
+            return Err(IscsiError::Scsi(format!(
+                "read buffer is {} bytes, expected {}",
+                buf.len(),
+                len
+            )));
+        }
+        let offset = self.offset(lba, len, block_size)?;
+
+        let mut filled = 0;
+        for (stripe, start, n) in self.pieces(offset, len) {
+            let guard = self.stripes[stripe].read().map_err(|_| Self::lock_error())?;
+            buf[filled..filled + n].copy_from_slice(&guard[start..start + n]);
+            filled += n;
+        }
+        Ok(())
+    }
+
+    fn write(&mut self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        self.write_shared(lba, data, block_size)
+    }
+
+    fn capacity(&self) -> u64 {
+        (self.size / self.block_size.max(1) as usize) as u64
+    }
+
+    fn block_size(&self) -> u32 {
+        self.block_size
+    }
+
+    fn concurrent_writes(&self) -> bool {
+        true
+    }
+
+    fn write_shared(&self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        let offset = self.offset(lba, data.len(), block_size)?;
+
+        // Stripes hold whole blocks and are locked one at a time in
+        // ascending order, so no block tears and writers cannot deadlock
+        let mut consumed = 0;
+        for (stripe, start, n) in self.pieces(offset, data.len()) {
+            let mut guard = self.stripes[stripe].write().map_err(|_| Self::lock_error())?;
+            guard[start..start + n].copy_from_slice(&data[consumed..consumed + n]);
+            consumed += n;
+        }
+        Ok(())
+    }
+}
+
+/// Thin-provisioned in-memory block device
+///
+/// The chunk map's lock is held shared for reads and for writes to chunks
+/// that already exist, each of which also locks its chunk; allocating or
+/// freeing a chunk takes it exclusively. A write of zeros to a hole
+/// allocates nothing.
+pub struct SparseDevice {
+    chunks: RwLock<BTreeMap<u64, RwLock<Box<[u8]>>>>,
+    chunk_size: usize,
+    size: u64,
+    block_size: u32,
+}
+
+impl SparseDevice {
+    /// Create an empty device of `size_bytes` (rounded down to whole blocks)
+    pub fn new(size_bytes: u64, block_size: u32) -> Self {
+        Self::with_chunk_size(size_bytes, block_size, DEFAULT_CHUNK_SIZE)
+    }
+
+    /// Create a device with a custom chunk size (rounded up to whole blocks)
+    ///
+    /// Smaller chunks track sparse data more closely; larger ones mean a
+    /// smaller map.
+    pub fn with_chunk_size(size_bytes: u64, block_size: u32, chunk_size: usize) -> Self {
+        let block = block_size.max(1) as usize;
+        SparseDevice {
+            chunks: RwLock::new(BTreeMap::new()),
+            chunk_size: chunk_size.max(1).div_ceil(block) * block,
+            size: size_bytes / block as u64 * block as u64,
+            block_size,
+        }
+    }
+
+    /// Bytes of storage currently allocated
+    pub fn allocated_bytes(&self) -> u64 {
+        self.chunks.read().map(|c| c.len() as u64).unwrap_or(0) * self.chunk_size as u64
+    }
+
+    /// Split [offset, offset + len) into (chunk, offset in chunk, length) pieces
+    fn pieces(&self, offset: u64, len: usize) -> impl Iterator<Item = (u64, usize, usize)> + '_ {
+        let chunk_size = self.chunk_size as u64;
+        let mut pos = offset;
+        let end = offset + len as u64;
+        std::iter::from_fn(move || {
+            if pos >= end {
+                return None;
+            }
+            let start = (pos % chunk_size) as usize;
+            let n = (self.chunk_size - start).min((end - pos) as usize);
+            let piece = (pos / chunk_size, start, n);
+            pos += n as u64;
+            Some(piece)
+        })
+    }
+
+    fn lock_error() -> IscsiError {
+        IscsiError::Scsi("Chunk lock poisoned".to_string())
+    }
+}
+
+impl ScsiBlockDevice for SparseDevice {
+    fn read(&self, lba: u64, blocks: u32, block_size: u32) -> ScsiResult<Vec<u8>> {
+        let mut data = vec![0u8; blocks as usize * block_size as usize];
+        self.read_into(lba, blocks, block_size, &mut data)?;
+        Ok(data)
+    }
+
+    fn read_into(&self, lba: u64, blocks: u32, block_size: u32, buf: &mut [u8]) -> ScsiResult<()> {
+        let len = blocks as usize * block_size as usize;
+        if buf.len() != len {
+            return Err(IscsiError::Scsi(format!(
+                "read buffer is {} bytes, expected {}",
+                buf.len(),
+                len
+            )));
+        }
+        let offset = byte_offset(lba, len, block_size, self.block_size, self.size)?;
+
+        let chunks = self.chunks.read().map_err(|_| Self::lock_error())?;
+        let mut filled = 0;
+        for (index, start, n) in self.pieces(offset, len) {
+            let out = &mut buf[filled..filled + n];
+            match chunks.get(&index) {
+                Some(chunk) => {
+                    let guard = chunk.read().map_err(|_| Self::lock_error())?;
+                    out.copy_from_slice(&guard[start..start + n]);
+                }
+                None => out.fill(0),
+            }
+            filled += n;
+        }
+        Ok(())
+    }
+
+    fn write(&mut self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        self.write_shared(lba, data, block_size)
+    }
+
+    fn capacity(&self) -> u64 {
+        self.size / self.block_size.max(1) as u64
+    }
+
+    fn block_size(&self) -> u32 {
+        self.block_size
+    }
+
+    fn concurrent_writes(&self) -> bool {
+        true
+    }
+
+    fn write_shared(&self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        let offset = byte_offset(lba, data.len(), block_size, self.block_size, self.size)?;
+
+        // Existing chunks are written under the shared map lock; pieces that
+        // need a new chunk wait for the exclusive one
+        let mut missing = Vec::new();
+        {
+            let chunks = self.chunks.read().map_err(|_| Self::lock_error())?;
+            let mut consumed = 0;
+            for (index, start, n) in self.pieces(offset, data.len()) {
+                let piece = &data[consumed..consumed + n];
+                match chunks.get(&index) {
+                    Some(chunk) => {
+                        let mut guard = chunk.write().map_err(|_| Self::lock_error())?;
+                        guard[start..start + n].copy_from_slice(piece);
+                    }
+                    None if piece.iter().all(|&b| b == 0) => {}
+                    None => missing.push((index, start, consumed, n)),
+                }
+                consumed += n;
+            }
+        }
+        if missing.is_empty() {
+            return Ok(());
+        }
+
+        let mut chunks = self.chunks.write().map_err(|_| Self::lock_error())?;
+        for (index, start, consumed, n) in missing {
+            let chunk = chunks
+                .entry(index)
+                .or_insert_with(|| RwLock::new(vec![0u8; self.chunk_size].into_boxed_slice()));
+            let guard = chunk.get_mut().map_err(|_| Self::lock_error())?;
+            guard[start..start + n].copy_from_slice(&data[consumed..consumed + n]);
+        }
+        Ok(())
+    }
+
+    fn supports_unmap(&self) -> bool {
+        true
+    }
+
+    fn unmap_granularity(&self) -> u32 {
+        (self.chunk_size / self.block_size.max(1) as usize) as u32
+    }
+
+    fn unmap(&mut self, lba: u64, blocks: u64) -> ScsiResult<()> {
+        self.unmap_shared(lba, blocks)
+    }
+
+    fn unmap_shared(&self, lba: u64, blocks: u64) -> ScsiResult<()> {
+        let bs = self.block_size as u64;
+        let range = lba
+            .checked_add(blocks)
+            .filter(|&end| end <= self.capacity())
+            .map(|end| (lba * bs, end * bs));
+        let (start, end) = range.ok_or_else(|| {
+            IscsiError::Scsi(format!("unmap beyond device capacity: LBA {}, {} blocks", lba, blocks))
+        })?;
+        if start == end {
+            return Ok(());
+        }
+
+        let chunk_size = self.chunk_size as u64;
+        let mut chunks = self.chunks.write().map_err(|_| Self::lock_error())?;
+
+        // Chunks wholly inside the range are dropped
+        let whole = start.div_ceil(chunk_size)..end / chunk_size;
+        if whole.start < whole.end {
+            let doomed: Vec<u64> = chunks.range(whole.clone()).map(|(&index, _)| index).collect();
+            for index in doomed {
+                chunks.remove(&index);
+            }
+        }
+
+        // The partial chunks at either end are zeroed, and dropped if that
+        // leaves them empty
+        let first = start / chunk_size;
+        let last = (end - 1) / chunk_size;
+        for index in [first, last] {
+            if whole.contains(&index) {
+                continue;
+            }
+            let Some(chunk) = chunks.get_mut(&index) else {
+                continue;
+            };
+            let guard = chunk.get_mut().map_err(|_| Self::lock_error())?;
+            let base = index * chunk_size;
+            let from = (start.max(base) - base) as usize;
+            let to = (end.min(base + chunk_size) - base) as usize;
+            guard[from..to].fill(0);
+            if guard.iter().all(|&b| b == 0) {
+                chunks.remove(&index);
+            }
+        }
+        Ok(())
+    }
+
+    fn product_id(&self) -> &str {
+        "Sparse Disk     "
+    }
+}
+
+/// Byte offset of `len` bytes at `lba`, after checking the block size and device bounds
+pub(crate) fn byte_offset(
+    lba: u64,
+    len: usize,
+    block_size: u32,
+    device_block_size: u32,
+    device_size: u64,
+) -> ScsiResult<u64> {
+    if block_size != device_block_size {
+        return Err(IscsiError::Scsi(format!(
+            "block size mismatch: expected {}, got {}",
+            device_block_size, block_size
+        )));
+    }
+
+    let offset = lba
+        .checked_mul(block_size as u64)
+        .filter(|o| o.checked_add(len as u64).is_some_and(|end| end <= device_size))
+        .filter(|o| usize::try_from(*o).is_ok());
+    offset.ok_or_else(|| {
+        IscsiError::Scsi(format!(
+            "access beyond device capacity: LBA {}, {} bytes",
+            lba, len
+        ))
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Arc;
+    use std::thread;
+
+    #[test]
+    fn test_geometry() {
+        let device = MemoryDevice::with_stripe_size(10 * 512 + 100, 512, 1500);
+        assert_eq!(device.capacity(), 10);
+        // 1500 rounds up to 1536: three full stripes and a 512-byte tail
+        assert_eq!(device.stripe_count(), 4);
+        assert_eq!(device.read(9, 1, 512).unwrap().len(), 512);
+        assert!(device.concurrent_writes());
+    }
+
+    #[test]
+    fn test_roundtrip_across_stripes() {
+        let mut device = MemoryDevice::with_stripe_size(64 * 512, 512, 4 * 512);
+        let data: Vec<u8> = (0..10 * 512).map(|i| (i % 251) as u8).collect();
+
+        // Starts mid-stripe and spans three stripes
+        device.write(3, &data, 512).unwrap();
+        assert_eq!(device.read(3, 10, 512).unwrap(), data);
+        assert_eq!(device.read(0, 3, 512).unwrap(), vec![0u8; 3 * 512]);
+        assert_eq!(device.read(13, 1, 512).unwrap(), vec![0u8; 512]);
+
+        let mut buf = vec![0u8; 6 * 512];
+        device.read_into(5, 6, 512, &mut buf).unwrap();
+        assert_eq!(buf, data[2 * 512..8 * 512]);
+        assert!(device.read_into(5, 6, 512, &mut buf[..512]).is_err());
+    }
+
+    #[test]
+    fn test_bounds_and_block_size() {
+        let mut device = MemoryDevice::new(16 * 512, 512);
+        assert!(device.read(15, 1, 512).is_ok());
+        assert!(device.read(15, 2, 512).is_err());
+        assert!(device.read(u64::MAX, 1, 512).is_err());
+        assert!(device.write(16, &[0u8; 512], 512).is_err());
+        assert!(device.read(0, 1, 4096).is_err());
+    }
+
+    #[test]
+    fn test_concurrent_writers() {
+        let device = Arc::new(MemoryDevice::with_stripe_size(256 * 512, 512, 8 * 512));
+
+        let handles: Vec<_> = (0..8u8)
+            .map(|t| {
+                let device = Arc::clone(&device);
+                thread::spawn(move || {
+                    // Each thread owns 32 blocks, written 4 at a time
+                    for chunk in 0..8u64 {
+                        let lba = t as u64 * 32 + chunk * 4;
+                        device.write_shared(lba, &[t + 1; 4 * 512], 512).unwrap();
+                        assert_eq!(device.read(lba, 4, 512).unwrap(), vec![t + 1; 4 * 512]);
+                    }
+                })
+            })
+            .collect();
+        for handle in handles {
+            handle.join().unwrap();
+        }
+
+        for t in 0..8u8 {
+            assert_eq!(device.read(t as u64 * 32, 32, 512).unwrap(), vec![t + 1; 32 * 512]);
+        }
+    }
+
+    #[test]
+    fn test_sparse_allocates_on_demand() {
+        let mut device = SparseDevice::with_chunk_size(1 << 45, 512, 8 * 512);
+        assert_eq!(device.capacity(), 1u64 << 36);
+        assert_eq!(device.unmap_granularity(), 8);
+        assert_eq!(device.allocated_bytes(), 0);
+
+        // Holes read as zeros, and zeros written to a hole stay a hole
+        assert_eq!(device.read(device.capacity() - 4, 4, 512).unwrap(), vec![0u8; 4 * 512]);
+        device.write(100, &[0u8; 16 * 512], 512).unwrap();
+        assert_eq!(device.allocated_bytes(), 0);
+
+        // Spans chunks 0 and 1, starting mid-chunk
+        let data: Vec<u8> = (0..6 * 512).map(|i| (i % 251) as u8 + 1).collect();
+        device.write(5, &data, 512).unwrap();
+        assert_eq!(device.allocated_bytes(), 2 * 8 * 512);
+        assert_eq!(device.read(5, 6, 512).unwrap(), data);
+        assert_eq!(device.read(0, 5, 512).unwrap(), vec![0u8; 5 * 512]);
+
+        let high = (1u64 << 33) + 3;
+        device.write(high, &[0xAB; 512], 512).unwrap();
+        assert_eq!(device.read(high, 1, 512).unwrap(), vec![0xAB; 512]);
+        assert_eq!(device.allocated_bytes(), 3 * 8 * 512);
+
+        assert!(device.write(device.capacity(), &[1u8; 512], 512).is_err());
+        assert!(device.read(0, 1, 4096).is_err());
+    }
+
+    #[test]
+    fn test_sparse_unmap() {
+        let mut device = SparseDevice::with_chunk_size(64 * 512, 512, 8 * 512);
+        device.write(0, &[0x5A; 32 * 512], 512).unwrap();
+        assert_eq!(device.allocated_bytes(), 4 * 8 * 512);
+
+        // Blocks 4..20: chunk 1 goes, chunks 0 and 2 are zeroed in part
+        device.unmap(4, 16).unwrap();
+        assert_eq!(device.allocated_bytes(), 3 * 8 * 512);
+        assert_eq!(device.read(0, 4, 512).unwrap(), vec![0x5A; 4 * 512]);
+        assert_eq!(device.read(4, 16, 512).unwrap(), vec![0u8; 16 * 512]);
+        assert_eq!(device.read(20, 12, 512).unwrap(), vec![0x5A; 12 * 512]);
+
+        // Zeroing the rest of a chunk frees it
+        device.unmap(0, 4).unwrap();
+        assert_eq!(device.allocated_bytes(), 2 * 8 * 512);
+
+        device.unmap(0, 64).unwrap();
+        assert_eq!(device.allocated_bytes(), 0);
+        assert_eq!(device.read(0, 64, 512).unwrap(), vec![0u8; 64 * 512]);
+
+        device.unmap(10, 0).unwrap();
+        assert!(device.unmap(60, 5).is_err());
+        assert!(device.unmap(u64::MAX, 2).is_err());
+    }
+}
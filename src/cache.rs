@@ -0,0 +1,551 @@
+//! Write-back block cache
+//!
+//! `WriteBackCache` wraps another `ScsiBlockDevice` and keeps writes in
+//! memory as dirty extents. A write that overlaps or touches an extent is
+//! merged into it, so the many small Data-Out chunks of a sequential stream
+//! reach the backing device as a few large writes. Dirty data is written
+//! back on SYNCHRONIZE CACHE, when a write with FUA set completes, when the
+//! dirty total passes the configured limit, and when the cache is dropped.
+//! Reads always see the newest data; those of clean ranges share the
+//! dirty list's lock and go straight to the backing device.
+//!
+//! MODE SENSE reports the cache through the WCE bit of the Caching mode
+//! page. A cache built with `write_through` reports WCE=0 and passes every
+//! write straight to the backing device.
+
+use crate::error::{IscsiError, ScsiResult};
+use crate::scsi::ScsiBlockDevice;
+use std::collections::BTreeMap;
+use std::sync::{RwLock, RwLockReadGuard, RwLockWriteGuard};
+
+/// Default limit on dirty data before it is written back
+pub const DEFAULT_MAX_DIRTY_BYTES: usize = 8 * 1024 * 1024;
+
+/// Dirty data keyed by starting LBA
+///
+/// Extents never overlap or touch: a write next to an extent is merged
+/// into it, so at least one clean block separates any two of them.
+#[derive(Default)]
+struct Extents {
+    map: BTreeMap<u64, Vec<u8>>,
+    bytes: usize,
+}
+
+impl Extents {
+    /// Whether any dirty block lies in [lba, end)
+    fn overlaps(&self, lba: u64, end: u64, block_size: u64) -> bool {
+        if let Some((&start, data)) = self.map.range(..end).next_back() {
+            return start + data.len() as u64 / block_size > lba;
+        }
+        false
+    }
+
+    /// Cache `data` at `lba`, merging it with every extent it overlaps or touches
+    fn insert(&mut self, lba: u64, data: &[u8], block_size: u64) {
+        let end = lba + data.len() as u64 / block_size;
+        let from = self
+            .map
+            .range(..lba)
+            .next_back()
+            .filter(|(&start, v)| start + v.len() as u64 / block_size >= lba)
+            .map(|(&start, _)| start)
+            .unwrap_or(lba);
+
+        // Join the neighbours into one run. Gaps between them lie inside
+        // [lba, end), so the new data covers the zero fill below.
+        let mut run: Option<(u64, Vec<u8>)> = None;
+        while let Some(start) = self.map.range(from..=end).next().map(|(&start, _)| start) {
+            let extent = self.map.remove(&start).unwrap();
+            self.bytes -= extent.len();
+            run = Some(match run {
+                None => (start, extent),
+                Some((run_start, mut buf)) => {
+                    buf.resize(((start - run_start) * block_size) as usize, 0);
+                    buf.extend_from_slice(&extent);
+                    (run_start, buf)
+                }
+            });
+        }
+
+        let (start, buf) = match run {
+            Some((run_start, mut buf)) if run_start <= lba => {
+                let off = ((lba - run_start) * block_size) as usize;
+                if buf.len() < off + data.len() {
+                    buf.resize(off + data.len(), 0);
+                }
+                buf[off..off + data.len()].copy_from_slice(data);
+                (run_start, buf)
+            }
+            Some((run_start, buf)) => {
+                // The run starts inside the new data; keep only its tail
+                let off = ((run_start - lba) * block_size) as usize;
+                let mut merged = Vec::with_capacity(data.len().max(off + buf.len()));
+                merged.extend_from_slice(data);
+                if off + buf.len() > data.len() {
+                    merged.extend_from_slice(&buf[data.len() - off..]);
+                }
+                (lba, merged)
+            }
+            None => (lba, data.to_vec()),
+        };
+
+        self.bytes += buf.len();
+        self.map.insert(start, buf);
+    }
+
+    /// Copy the dirty blocks of [lba, lba + buf.len()) over `buf`
+    fn overlay(&self, lba: u64, buf: &mut [u8], block_size: u64) {
+        let end = lba + buf.len() as u64 / block_size;
+        let from = self
+            .map
+            .range(..=lba)
+            .next_back()
+            .map(|(&start, _)| start)
+            .unwrap_or(lba);
+
+        for (&start, data) in self.map.range(from..end) {
+            let extent_end = start + data.len() as u64 / block_size;
+            let lo = start.max(lba);
+            let hi = extent_end.min(end);
+            if lo >= hi {
+                continue;
+            }
+            let src = ((lo - start) * block_size) as usize;
+            let dst = ((lo - lba) * block_size) as usize;
+            let n = ((hi - lo) * block_size) as usize;
+            buf[dst..dst + n].copy_from_slice(&data[src..src + n]);
+        }
+    }
+}
+
+/// Write-back cache in front of a block device
+pub struct WriteBackCache<D: ScsiBlockDevice> {
+    inner: RwLock<D>,
+    inner_concurrent: bool,
+    inner_unmap: bool,
+    unmap_granularity: u32,
+    dirty: RwLock<Extents>,
+    max_dirty_bytes: usize,
+    enabled: bool,
+    block_size: u32,
+    capacity: u64,
+    vendor_id: String,
+    product_id: String,
+    product_rev: String,
+}
+
+impl<D: ScsiBlockDevice> WriteBackCache<D> {
+    /// Cache writes to `device`, writing back once more than `max_dirty_bytes` are dirty
+    pub fn new(device: D, max_dirty_bytes: usize) -> Self {
+        Self::with_enabled(device, max_dirty_bytes, true)
+    }
+
+    /// Pass every write straight to `device` and report WCE=0
+    pub fn write_through(device: D) -> Self {
+        Self::with_enabled(device, 0, false)
+    }
+
+    fn with_enabled(device: D, max_dirty_bytes: usize, enabled: bool) -> Self {
+        WriteBackCache {
+            inner_concurrent: device.concurrent_writes(),
+            inner_unmap: device.supports_unmap(),
+            unmap_granularity: device.unmap_granularity(),
+            block_size: device.block_size(),
+            capacity: device.capacity(),
+            vendor_id: device.vendor_id().to_string(),
+            product_id: device.product_id().to_string(),
+            product_rev: device.product_rev().to_string(),
+            inner: RwLock::new(device),
+            dirty: RwLock::new(Extents::default()),
+            max_dirty_bytes,
+            enabled,
+        }
+    }
+
+    /// Bytes written but not yet passed to the backing device
+    pub fn dirty_bytes(&self) -> usize {
+        self.dirty.read().map(|d| d.bytes).unwrap_or(0)
+    }
+
+    /// Number of separate dirty extents
+    pub fn dirty_extents(&self) -> usize {
+        self.dirty.read().map(|d| d.map.len()).unwrap_or(0)
+    }
+
+    /// Run `f` on the backing device, bypassing the cache
+    pub fn with_inner<R>(&self, f: impl FnOnce(&D) -> R) -> ScsiResult<R> {
+        let inner = self.inner.read().map_err(|_| Self::lock_error())?;
+        Ok(f(&inner))
+    }
+
+    fn lock_error() -> IscsiError {
+        IscsiError::Scsi("Cache lock poisoned".to_string())
+    }
+
+    fn read_dirty(&self) -> ScsiResult<RwLockReadGuard<'_, Extents>> {
+        self.dirty.read().map_err(|_| Self::lock_error())
+    }
+
+    fn write_dirty(&self) -> ScsiResult<RwLockWriteGuard<'_, Extents>> {
+        self.dirty.write().map_err(|_| Self::lock_error())
+    }
+
+    /// Check a transfer against the block size and capacity
+    fn check(&self, lba: u64, len: usize, block_size: u32) -> ScsiResult<()> {
+        if block_size != self.block_size || len % block_size.max(1) as usize != 0 {
+            return Err(IscsiError::Scsi(format!(
+                "block size mismatch: expected {}, got {} for {} bytes",
+                self.block_size, block_size, len
+            )));
+        }
+        let blocks = (len / block_size as usize) as u64;
+        if lba.checked_add(blocks).is_none_or(|end| end > self.capacity) {
+            return Err(IscsiError::Scsi(format!(
+                "access beyond device capacity: LBA {}, {} bytes",
+                lba, len
+            )));
+        }
+        Ok(())
+    }
+
+    fn write_inner(&self, lba: u64, data: &[u8]) -> ScsiResult<()> {
+        if self.inner_concurrent {
+            return self.inner.read().map_err(|_| Self::lock_error())?.write_shared(lba, data, self.block_size);
+        }
+        self.inner
+            .write()
+            .map_err(|_| Self::lock_error())?
+            .write(lba, data, self.block_size)
+    }
+
+    fn flush_inner(&self) -> ScsiResult<()> {
+        if self.inner_concurrent {
+            return self.inner.read().map_err(|_| Self::lock_error())?.flush_shared();
+        }
+        self.inner.write().map_err(|_| Self::lock_error())?.flush()
+    }
+
+    /// Write every dirty extent back in LBA order
+    ///
+    /// Runs with the dirty list write-locked, so readers never miss data
+    /// that is on its way to the device. An extent that fails stays dirty,
+    /// together with everything after it.
+    fn write_back(&self, dirty: &mut Extents) -> ScsiResult<()> {
+        while let Some((lba, data)) = dirty.map.pop_first() {
+            if let Err(e) = self.write_inner(lba, &data) {
+                dirty.map.insert(lba, data);
+                return Err(e);
+            }
+            dirty.bytes -= data.len();
+        }
+        Ok(())
+    }
+}
+
+impl<D: ScsiBlockDevice> ScsiBlockDevice for WriteBackCache<D> {
+    fn read(&self, lba: u64, blocks: u32, block_size: u32) -> ScsiResult<Vec<u8>> {
+        let mut data = vec![0u8; blocks as usize * block_size as usize];
+        self.read_into(lba, blocks, block_size, &mut data)?;
+        Ok(data)
+    }
+
+    fn read_into(&self, lba: u64, blocks: u32, block_size: u32, buf: &mut [u8]) -> ScsiResult<()> {
+        self.check(lba, buf.len(), block_size)?;
+        let bs = block_size as u64;
+        let read_inner = |buf: &mut [u8]| {
+            self.inner
+                .read()
+                .map_err(|_| Self::lock_error())?
+                .read_into(lba, blocks, block_size, buf)
+        };
+
+        if !self.enabled {
+            return read_inner(buf);
+        }
+
+        let dirty = self.read_dirty()?;
+        if !dirty.overlaps(lba, lba + blocks as u64, bs) {
+            // Clean range: the device is current, and later writes to it
+            // race with this read anyway
+            drop(dirty);
+            return read_inner(buf);
+        }
+        read_inner(buf)?;
+        dirty.overlay(lba, buf, bs);
+        Ok(())
+    }
+
+    fn write(&mut self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        self.write_shared(lba, data, block_size)
+    }
+
+    fn capacity(&self) -> u64 {
+        self.capacity
+    }
+
+    fn block_size(&self) -> u32 {
+        self.block_size
+    }
+
+    fn flush(&mut self) -> ScsiResult<()> {
+        self.flush_shared()
+    }
+
+    fn concurrent_writes(&self) -> bool {
+        true
+    }
+
+    fn write_shared(&self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        self.check(lba, data.len(), block_size)?;
+        if !self.enabled {
+            return self.write_inner(lba, data);
+        }
+
+        let mut dirty = self.write_dirty()?;
+        dirty.insert(lba, data, block_size as u64);
+        if dirty.bytes > self.max_dirty_bytes {
+            self.write_back(&mut dirty)?;
+        }
+        Ok(())
+    }
+
+    fn flush_shared(&self) -> ScsiResult<()> {
+        let mut dirty = self.write_dirty()?;
+        self.write_back(&mut dirty)?;
+        drop(dirty);
+        self.flush_inner()
+    }
+
+    fn write_cache_enabled(&self) -> bool {
+        self.enabled
+    }
+
+    fn supports_unmap(&self) -> bool {
+        self.inner_unmap
+    }
+
+    fn unmap_granularity(&self) -> u32 {
+        self.unmap_granularity
+    }
+
+    fn unmap(&mut self, lba: u64, blocks: u64) -> ScsiResult<()> {
+        self.unmap_shared(lba, blocks)
+    }
+
+    /// Write back everything dirty, then deallocate on the backing device
+    ///
+    /// Keeping the dirty list locked until the unmap is done stops a later
+    /// write-back from landing stale data in the hole.
+    fn unmap_shared(&self, lba: u64, blocks: u64) -> ScsiResult<()> {
+        let mut dirty = self.write_dirty()?;
+        self.write_back(&mut dirty)?;
+        if self.inner_concurrent {
+            return self.inner.read().map_err(|_| Self::lock_error())?.unmap_shared(lba, blocks);
+        }
+        self.inner.write().map_err(|_| Self::lock_error())?.unmap(lba, blocks)
+    }
+
+    fn vendor_id(&self) -> &str {
+        &self.vendor_id
+    }
+
+    fn product_id(&self) -> &str {
+        &self.product_id
+    }
+
+    fn product_rev(&self) -> &str {
+        &self.product_rev
+    }
+}
+
+impl<D: ScsiBlockDevice> Drop for WriteBackCache<D> {
+    fn drop(&mut self) {
+        if let Err(e) = self.flush_shared() {
+            log::error!("Write-back on drop failed, {} bytes lost: {}", self.dirty_bytes(), e);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::backend::{MemoryDevice, SparseDevice};
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::sync::Arc;
+
+    /// Backing device that outlives the cache and counts the writes it gets
+    #[derive(Clone)]
+    struct Counting {
+        device: Arc<MemoryDevice>,
+        writes: Arc<AtomicUsize>,
+        flushes: Arc<AtomicUsize>,
+    }
+
+    impl Counting {
+        fn new(blocks: usize) -> Self {
+            Counting {
+                device: Arc::new(MemoryDevice::new(blocks * 512, 512)),
+                writes: Arc::new(AtomicUsize::new(0)),
+                flushes: Arc::new(AtomicUsize::new(0)),
+            }
+        }
+    }
+
+    impl ScsiBlockDevice for Counting {
+        fn read(&self, lba: u64, blocks: u32, block_size: u32) -> ScsiResult<Vec<u8>> {
+            self.device.read(lba, blocks, block_size)
+        }
+
+        fn write(&mut self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+            self.writes.fetch_add(1, Ordering::SeqCst);
+            self.device.write_shared(lba, data, block_size)
+        }
+
+        fn capacity(&self) -> u64 {
+            self.device.capacity()
+        }
+
+        fn block_size(&self) -> u32 {
+            512
+        }
+
+        fn flush(&mut self) -> ScsiResult<()> {
+            self.flushes.fetch_add(1, Ordering::SeqCst);
+            Ok(())
+        }
+    }
+
+    #[test]
+    fn test_sequential_writes_coalesce() {
+        let backing = Counting::new(64);
+        let cache = WriteBackCache::new(backing.clone(), DEFAULT_MAX_DIRTY_BYTES);
+        assert!(cache.write_cache_enabled());
+
+        for lba in 8..24u64 {
+            cache.write_shared(lba, &[lba as u8; 512], 512).unwrap();
+        }
+        assert_eq!(cache.dirty_extents(), 1);
+        assert_eq!(cache.dirty_bytes(), 16 * 512);
+        assert_eq!(backing.writes.load(Ordering::SeqCst), 0);
+        assert_eq!(backing.device.read(8, 1, 512).unwrap(), vec![0u8; 512]);
+
+        // Reads see the cached data, partly dirty or not
+        let data = cache.read(6, 4, 512).unwrap();
+        assert_eq!(&data[..1024], &[0u8; 1024][..]);
+        assert_eq!(&data[1024..1536], &[8u8; 512][..]);
+        assert_eq!(&data[1536..], &[9u8; 512][..]);
+
+        cache.flush_shared().unwrap();
+        assert_eq!(cache.dirty_bytes(), 0);
+        assert_eq!(backing.writes.load(Ordering::SeqCst), 1);
+        assert_eq!(backing.flushes.load(Ordering::SeqCst), 1);
+        assert_eq!(backing.device.read(23, 1, 512).unwrap(), vec![23u8; 512]);
+    }
+
+    #[test]
+    fn test_merge_matches_model() {
+        let cache = WriteBackCache::new(Counting::new(128), usize::MAX);
+        let mut model = vec![0u8; 128 * 512];
+        let mut seed = 0x2545_F491u32;
+        let mut next = |n: u32| {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            seed % n
+        };
+
+        for round in 0..400u32 {
+            let lba = next(120) as u64;
+            let blocks = 1 + next(8) as usize;
+            let fill = (round % 251) as u8 + 1;
+            let start = lba as usize * 512;
+            model[start..start + blocks * 512].fill(fill);
+            cache.write_shared(lba, &vec![fill; blocks * 512], 512).unwrap();
+
+            // Extents stay disjoint and apart, and account for every byte
+            let dirty = cache.dirty.read().unwrap();
+            let mut prev_end = None;
+            let mut bytes = 0;
+            for (&s, v) in dirty.map.iter() {
+                assert!(prev_end.is_none_or(|end| s > end), "extents touch at {}", s);
+                prev_end = Some(s + v.len() as u64 / 512);
+                bytes += v.len();
+            }
+            assert_eq!(bytes, dirty.bytes);
+        }
+        assert_eq!(cache.read(0, 128, 512).unwrap(), model);
+
+        cache.flush_shared().unwrap();
+        assert_eq!(cache.with_inner(|d| d.read(0, 128, 512).unwrap()).unwrap(), model);
+    }
+
+    #[test]
+    fn test_write_back_when_full() {
+        let backing = Counting::new(64);
+        let cache = WriteBackCache::new(backing.clone(), 4 * 512);
+
+        // Separate extents, so nothing merges
+        for i in 0..4u64 {
+            cache.write_shared(i * 2, &[1u8; 512], 512).unwrap();
+        }
+        assert_eq!(cache.dirty_extents(), 4);
+        assert_eq!(backing.writes.load(Ordering::SeqCst), 0);
+
+        cache.write_shared(20, &[2u8; 512], 512).unwrap();
+        assert_eq!(cache.dirty_bytes(), 0);
+        assert_eq!(backing.writes.load(Ordering::SeqCst), 5);
+        // Passing the limit writes back without flushing the device
+        assert_eq!(backing.flushes.load(Ordering::SeqCst), 0);
+        assert_eq!(backing.device.read(20, 1, 512).unwrap(), vec![2u8; 512]);
+    }
+
+    #[test]
+    fn test_write_through() {
+        let backing = Counting::new(16);
+        let cache = WriteBackCache::write_through(backing.clone());
+        assert!(!cache.write_cache_enabled());
+
+        cache.write_shared(3, &[7u8; 1024], 512).unwrap();
+        assert_eq!(cache.dirty_bytes(), 0);
+        assert_eq!(backing.device.read(4, 1, 512).unwrap(), vec![7u8; 512]);
+    }
+
+    #[test]
+    fn test_drop_writes_back() {
+        let backing = Counting::new(16);
+        {
+            let mut cache = WriteBackCache::new(backing.clone(), DEFAULT_MAX_DIRTY_BYTES);
+            cache.write(5, &[9u8; 512], 512).unwrap();
+            assert_eq!(backing.device.read(5, 1, 512).unwrap(), vec![0u8; 512]);
+        }
+        assert_eq!(backing.device.read(5, 1, 512).unwrap(), vec![9u8; 512]);
+        assert_eq!(backing.flushes.load(Ordering::SeqCst), 1);
+    }
+
+    #[test]
+    fn test_bounds() {
+        let cache = WriteBackCache::new(Counting::new(16), DEFAULT_MAX_DIRTY_BYTES);
+        assert!(cache.write_shared(16, &[0u8; 512], 512).is_err());
+        assert!(cache.write_shared(15, &[0u8; 1024], 512).is_err());
+        assert!(cache.write_shared(0, &[0u8; 100], 512).is_err());
+        assert!(cache.write_shared(0, &[0u8; 4096], 4096).is_err());
+        assert!(cache.read(u64::MAX, 1, 512).is_err());
+        assert_eq!(cache.dirty_bytes(), 0);
+    }
+
+    #[test]
+    fn test_unmap_after_dirty_writes() {
+        let cache = WriteBackCache::new(SparseDevice::with_chunk_size(64 * 512, 512, 8 * 512), DEFAULT_MAX_DIRTY_BYTES);
+        assert!(cache.supports_unmap());
+        assert_eq!(cache.unmap_granularity(), 8);
+
+        cache.write_shared(0, &[9u8; 16 * 512], 512).unwrap();
+        cache.unmap_shared(8, 8).unwrap();
+        assert_eq!(cache.dirty_bytes(), 0);
+        assert_eq!(cache.read(0, 8, 512).unwrap(), vec![9u8; 8 * 512]);
+        assert_eq!(cache.read(8, 8, 512).unwrap(), vec![0u8; 8 * 512]);
+        assert_eq!(cache.with_inner(|d| d.allocated_bytes()).unwrap(), 8 * 512);
+
+        assert!(!WriteBackCache::new(Counting::new(16), DEFAULT_MAX_DIRTY_BYTES).supports_unmap());
+    }
+}
@@ -56,6 +56,9 @@ use std::io::{Read, Write};
 use std::net::TcpStream;
 use std::time::Duration;
 
+/// CmdSN of a session's first command, carried in its Login Requests
+const FIRST_CMD_SN: u32 = 1;
+
 /// iSCSI Client for connecting to targets and sending/receiving PDUs
 ///
 /// The client maintains a TCP connection to the target and handles
@@ -187,6 +190,8 @@ impl IscsiClient {
         pdu.itt = self.cmd_sn; // Use cmd_sn as itt
         pdu.specific[0] = 0; // Version max
         pdu.specific[1] = 0; // Version active
+        // CmdSN: the session's first, which the target expects next
+        pdu.specific[4..8].copy_from_slice(&FIRST_CMD_SN.to_be_bytes());
         pdu.data = params.into_bytes();
 
         // Send login request
@@ -235,8 +240,17 @@ impl IscsiClient {
             ]);
         }
 
-        // Increment cmd_sn for next command
+        // Increment cmd_sn for next command, then catch up with the
+        // target's ExpCmdSN (specific[8:12]) once logged in
         self.cmd_sn = self.cmd_sn.wrapping_add(1);
+        if transit && nsg == flags::NSG_FULL_FEATURE {
+            self.cmd_sn = u32::from_be_bytes([
+                response.specific[8],
+                response.specific[9],
+                response.specific[10],
+                response.specific[11],
+            ]);
+        }
 
         Ok(())
     }
@@ -514,17 +528,12 @@ impl IscsiClient {
         // Create SCSI command PDU
         let mut pdu = IscsiPdu::new();
         pdu.opcode = opcode::SCSI_COMMAND;
-        pdu.flags = flags::FINAL | flags::WRITE; // Mark as final
+        pdu.flags = flags::FINAL; // Mark as final
         pdu.itt = self.cmd_sn;
         pdu.lun = 0; // LUN 0
 
-        // CDB length in bytes 28-31 (high byte), command in 32-47
-        pdu.specific[0] = (cdb.len() as u8) & 0x0F;
-        pdu.specific[1] = 0; // Attribute
-        pdu.specific[4] = (cdb.len() as u8) & 0xFF; // CDB length
-
-        // Copy CDB into specific field
-        let cdb_start = 16;
+        // CDB in bytes 32-47
+        let cdb_start = 12;
         if cdb.len() <= 16 {
             pdu.specific[cdb_start..cdb_start + cdb.len()].copy_from_slice(cdb);
         } else {
@@ -540,11 +549,13 @@ impl IscsiClient {
             pdu.flags |= flags::WRITE;
         }
 
-        // Set sequence numbers
-        // CmdSN: specific[20:24]
-        // ExpStatSN: specific[24:28]
-        pdu.specific[20..24].copy_from_slice(&self.cmd_sn.to_be_bytes());
-        pdu.specific[24..28].copy_from_slice(&self.exp_stat_sn.to_be_bytes());
+        // Set expected data length and sequence numbers
+        // Expected Data Transfer Length: specific[0:4]
+        // CmdSN: specific[4:8]
+        // ExpStatSN: specific[8:12]
+        pdu.specific[0..4].copy_from_slice(&(pdu.data.len() as u32).to_be_bytes());
+        pdu.specific[4..8].copy_from_slice(&self.cmd_sn.to_be_bytes());
+        pdu.specific[8..12].copy_from_slice(&self.exp_stat_sn.to_be_bytes());
 
         // Send command
         self.send_pdu(&pdu)?;
@@ -564,8 +575,8 @@ impl IscsiClient {
         pdu.itt = self.cmd_sn;
 
         // Set sequence numbers
-        pdu.specific[20..24].copy_from_slice(&self.cmd_sn.to_be_bytes());
-        pdu.specific[24..28].copy_from_slice(&self.exp_stat_sn.to_be_bytes());
+        pdu.specific[4..8].copy_from_slice(&self.cmd_sn.to_be_bytes());
+        pdu.specific[8..12].copy_from_slice(&self.exp_stat_sn.to_be_bytes());
 
         self.send_pdu(&pdu)?;
         let _response = self.recv_pdu()?;
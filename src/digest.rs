@@ -0,0 +1,208 @@
+//! CRC32C header and data digests
+//!
+//! iSCSI protects headers and data segments with CRC32C (Castagnoli,
+//! RFC 3720 Section 12.1, test vectors in Appendix B.4). The checksum runs
+//! on the SSE4.2 `crc32` instruction on x86_64 and the ARMv8 CRC extension
+//! on aarch64 when the CPU has them, and on a slicing-by-8 table otherwise.
+//! The digest is sent least significant byte first.
+
+/// Size of a header or data digest on the wire
+pub const DIGEST_SIZE: usize = 4;
+
+/// CRC32C polynomial, bit-reflected
+const POLY: u32 = 0x82F6_3B78;
+
+/// Slicing-by-8 tables: `TABLES[k][b]` is the CRC of byte `b` followed by `k` zero bytes
+static TABLES: [[u32; 256]; 8] = build_tables();
+
+const fn build_tables() -> [[u32; 256]; 8] {
+    let mut tables = [[0u32; 256]; 8];
+    let mut i = 0;
+    while i < 256 {
+        let mut crc = i as u32;
+        let mut bit = 0;
+        while bit < 8 {
+            crc = if crc & 1 != 0 { (crc >> 1) ^ POLY } else { crc >> 1 };
+            bit += 1;
+        }
+        tables[0][i] = crc;
+        i += 1;
+    }
+
+    let mut k = 1;
+    while k < 8 {
+        let mut i = 0;
+        while i < 256 {
+            let prev = tables[k - 1][i];
+            tables[k][i] = (prev >> 8) ^ tables[0][(prev & 0xFF) as usize];
+            i += 1;
+        }
+        k += 1;
+    }
+    tables
+}
+
+/// CRC32C of `data`
+pub fn crc32c(data: &[u8]) -> u32 {
+    crc32c_append(0, data)
+}
+
+/// Continue a CRC32C over more data: `crc32c_append(crc32c(a), b) == crc32c(a ++ b)`
+pub fn crc32c_append(crc: u32, data: &[u8]) -> u32 {
+    !update(!crc, data)
+}
+
+/// Digest bytes as they appear on the wire
+pub fn to_wire(crc: u32) -> [u8; DIGEST_SIZE] {
+    crc.to_le_bytes()
+}
+
+/// Read a digest off the wire
+pub fn from_wire(bytes: &[u8]) -> u32 {
+    u32::from_le_bytes([bytes[0], bytes[1], bytes[2], bytes[3]])
+}
+
+/// Whether the hardware CRC32C path is in use
+pub fn hardware_accelerated() -> bool {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if std::is_x86_feature_detected!("sse4.2") {
+            return true;
+        }
+    }
+    #[cfg(target_arch = "aarch64")]
+    {
+        if std::arch::is_aarch64_feature_detected!("crc") {
+            return true;
+        }
+    }
+    false
+}
+
+/// Raw (non-inverted) CRC update, dispatching to the fastest available path
+fn update(state: u32, data: &[u8]) -> u32 {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if std::is_x86_feature_detected!("sse4.2") {
+            // SAFETY: the CPU supports SSE4.2, checked above
+            return unsafe { update_sse42(state, data) };
+        }
+    }
+    #[cfg(target_arch = "aarch64")]
+    {
+        if std::arch::is_aarch64_feature_detected!("crc") {
+            // SAFETY: the CPU supports the CRC extension, checked above
+            return unsafe { update_armv8(state, data) };
+        }
+    }
+    update_table(state, data)
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "sse4.2")]
+unsafe fn update_sse42(state: u32, data: &[u8]) -> u32 {
+    use std::arch::x86_64::{_mm_crc32_u64, _mm_crc32_u8};
+
+    let mut chunks = data.chunks_exact(8);
+    let mut crc = state as u64;
+    for chunk in &mut chunks {
+        let word = u64::from_le_bytes(chunk.try_into().unwrap());
+        crc = _mm_crc32_u64(crc, word);
+    }
+
+    let mut crc = crc as u32;
+    for &byte in chunks.remainder() {
+        crc = _mm_crc32_u8(crc, byte);
+    }
+    crc
+}
+
+#[cfg(target_arch = "aarch64")]
+#[target_feature(enable = "crc")]
+unsafe fn update_armv8(state: u32, data: &[u8]) -> u32 {
+    use std::arch::aarch64::{__crc32cb, __crc32cd};
+
+    let mut chunks = data.chunks_exact(8);
+    let mut crc = state;
+    for chunk in &mut chunks {
+        let word = u64::from_le_bytes(chunk.try_into().unwrap());
+        crc = __crc32cd(crc, word);
+    }
+    for &byte in chunks.remainder() {
+        crc = __crc32cb(crc, byte);
+    }
+    crc
+}
+
+/// Portable slicing-by-8 implementation
+fn update_table(state: u32, data: &[u8]) -> u32 {
+    let mut chunks = data.chunks_exact(8);
+    let mut crc = state;
+    for chunk in &mut chunks {
+        let lo = crc ^ u32::from_le_bytes([chunk[0], chunk[1], chunk[2], chunk[3]]);
+        crc = TABLES[7][(lo & 0xFF) as usize]
+            ^ TABLES[6][((lo >> 8) & 0xFF) as usize]
+            ^ TABLES[5][((lo >> 16) & 0xFF) as usize]
+            ^ TABLES[4][(lo >> 24) as usize]
+            ^ TABLES[3][chunk[4] as usize]
+            ^ TABLES[2][chunk[5] as usize]
+            ^ TABLES[1][chunk[6] as usize]
+            ^ TABLES[0][chunk[7] as usize];
+    }
+    for &byte in chunks.remainder() {
+        crc = (crc >> 8) ^ TABLES[0][((crc ^ byte as u32) & 0xFF) as usize];
+    }
+    crc
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn table_crc32c(data: &[u8]) -> u32 {
+        !update_table(!0, data)
+    }
+
+    #[test]
+    fn test_rfc3720_vectors() {
+        // RFC 3720 Appendix B.4
+        let zeros = [0u8; 32];
+        let ones = [0xFFu8; 32];
+        let incrementing: Vec<u8> = (0..32).collect();
+        let decrementing: Vec<u8> = (0..32).rev().collect();
+
+        assert_eq!(crc32c(&zeros), 0x8A91_36AA);
+        assert_eq!(crc32c(&ones), 0x62A8_AB43);
+        assert_eq!(crc32c(&incrementing), 0x46DD_794E);
+        assert_eq!(crc32c(&decrementing), 0x113F_DB5C);
+        assert_eq!(to_wire(crc32c(&zeros)), [0xAA, 0x36, 0x91, 0x8A]);
+    }
+
+    #[test]
+    fn test_check_value() {
+        assert_eq!(crc32c(b"123456789"), 0xE306_9283);
+        assert_eq!(table_crc32c(b"123456789"), 0xE306_9283);
+        assert_eq!(crc32c(&[]), 0);
+    }
+
+    #[test]
+    fn test_table_matches_dispatch() {
+        let data: Vec<u8> = (0..1031u32).map(|i| (i.wrapping_mul(2654435761) >> 13) as u8).collect();
+        for len in [0, 1, 7, 8, 9, 48, 52, 511, 1031] {
+            assert_eq!(crc32c(&data[..len]), table_crc32c(&data[..len]), "length {}", len);
+        }
+    }
+
+    #[test]
+    fn test_append() {
+        let data = b"iSCSI header and data digests";
+        let (a, b) = data.split_at(11);
+        assert_eq!(crc32c_append(crc32c(a), b), crc32c(data));
+    }
+
+    #[test]
+    fn test_wire_roundtrip() {
+        let crc = crc32c(b"digest");
+        assert_eq!(from_wire(&to_wire(crc)), crc);
+    }
+}
@@ -0,0 +1,194 @@
+//! Event-driven connection handling
+//!
+//! One poller thread owns the listener and every idle connection, and a
+//! fixed pool of workers runs the PDUs. When a connection's socket becomes
+//! readable the poller hands it to a worker, which serves the PDUs that
+//! are waiting and then gives the connection back and re-arms its socket.
+//! Workers read without blocking: a PDU that arrives in pieces stays with
+//! its connection and is finished once more of it is readable, so a slow
+//! initiator never holds a worker.
+//! An idle session therefore costs a socket and its session state rather
+//! than a thread and its stack. A connection holding commands parked for
+//! CmdSN order is also handed to a worker every `REORDER_POLL_INTERVAL`,
+//! to run them once the session reaches them; no worker ever waits for
+//! another connection.
+
+use crate::error::{IscsiError, ScsiResult};
+use crate::metrics::TargetMetrics;
+use crate::scsi::ScsiBlockDevice;
+use crate::session::REORDER_POLL_INTERVAL;
+use crate::target::{accept_ready, Connection, ConnectionContext, LISTENER};
+use mio::unix::SourceFd;
+use mio::{Events, Interest, Poll, Registry, Token};
+use std::collections::{HashMap, HashSet};
+use std::os::fd::AsRawFd;
+use std::sync::atomic::Ordering;
+use std::sync::mpsc::{self, Receiver};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// How often the poller re-checks the running flag
+const POLL_INTERVAL: Duration = Duration::from_millis(100);
+
+/// PDUs a worker serves from one connection before yielding to others
+const PDUS_PER_TURN: usize = 64;
+
+/// Connections waiting for input; one a worker holds is absent
+type IdleConnections<D> = Mutex<HashMap<Token, Connection<D>>>;
+
+/// Connections with commands parked for CmdSN order
+type ParkedConnections = Mutex<HashSet<Token>>;
+
+/// A readable connection and when the poller queued it
+type Job<D> = (Token, Connection<D>, Instant);
+
+/// Serve connections from `listener` with `workers` threads until the target stops
+pub(crate) fn run<D: ScsiBlockDevice + 'static>(
+    mut listener: mio::net::TcpListener,
+    ctx: Arc<ConnectionContext<D>>,
+    workers: usize,
+) -> ScsiResult<()> {
+    let mut poll = Poll::new().map_err(IscsiError::Io)?;
+    let registry = Arc::new(poll.registry().try_clone().map_err(IscsiError::Io)?);
+    registry
+        .register(&mut listener, LISTENER, Interest::READABLE)
+        .map_err(IscsiError::Io)?;
+
+    let idle: Arc<IdleConnections<D>> = Arc::new(Mutex::new(HashMap::new()));
+    let parked: Arc<ParkedConnections> = Arc::new(Mutex::new(HashSet::new()));
+    let (jobs, queue) = mpsc::channel::<Job<D>>();
+    let queue = Arc::new(Mutex::new(queue));
+
+    let mut handles = Vec::with_capacity(workers);
+    for i in 0..workers {
+        let queue = Arc::clone(&queue);
+        let idle = Arc::clone(&idle);
+        let parked = Arc::clone(&parked);
+        let registry = Arc::clone(&registry);
+        let metrics = Arc::clone(&ctx.metrics);
+        let handle = thread::Builder::new()
+            .name(format!("iscsi-worker-{}", i))
+            .spawn(move || worker(&queue, &idle, &parked, &registry, &metrics))
+            .map_err(IscsiError::Io)?;
+        handles.push(handle);
+    }
+
+    let mut events = Events::with_capacity(1024);
+    let mut next_token = LISTENER.0 + 1;
+
+    while ctx.running.load(Ordering::SeqCst) {
+        let timeout = if parked.lock().unwrap().is_empty() { POLL_INTERVAL } else { REORDER_POLL_INTERVAL };
+        match poll.poll(&mut events, Some(timeout)) {
+            Ok(()) => {}
+            Err(ref e) if e.kind() == std::io::ErrorKind::Interrupted => continue,
+            Err(e) => return Err(IscsiError::Io(e)),
+        }
+
+        for event in events.iter() {
+            if event.token() == LISTENER {
+                accept_ready(&listener, &ctx, true, |conn| {
+                    let token = Token(next_token);
+                    next_token += 1;
+                    let fd = conn.stream().as_raw_fd();
+
+                    // Park it before registering so its first event finds it
+                    idle.lock().unwrap().insert(token, conn);
+                    if let Err(e) = registry.register(&mut SourceFd(&fd), token, Interest::READABLE) {
+                        log::error!("Failed to watch connection: {}", e);
+                        idle.lock().unwrap().remove(&token);
+                    }
+                });
+                continue;
+            }
+
+            // Absent means a worker holds it; the worker re-arms it when done
+            let conn = idle.lock().unwrap().remove(&event.token());
+            if let Some(conn) = conn {
+                if jobs.send((event.token(), conn, Instant::now())).is_err() {
+                    return Err(IscsiError::Protocol("Worker pool exited".to_string()));
+                }
+            }
+        }
+
+        // Give connections with parked commands a turn to run them. One a
+        // worker holds is skipped; the worker lists it again if need be.
+        let waiting = std::mem::take(&mut *parked.lock().unwrap());
+        for token in waiting {
+            let conn = idle.lock().unwrap().remove(&token);
+            if let Some(conn) = conn {
+                if jobs.send((token, conn, Instant::now())).is_err() {
+                    return Err(IscsiError::Protocol("Worker pool exited".to_string()));
+                }
+            }
+        }
+    }
+
+    // Workers exit once the queue is closed and drained; idle connections
+    // close as they are dropped
+    drop(jobs);
+    for handle in handles {
+        let _ = handle.join();
+    }
+    idle.lock().unwrap().clear();
+    Ok(())
+}
+
+/// Serve connections handed over by the poller until the queue closes
+fn worker<D: ScsiBlockDevice>(
+    queue: &Mutex<Receiver<Job<D>>>,
+    idle: &IdleConnections<D>,
+    parked: &ParkedConnections,
+    registry: &Registry,
+    metrics: &TargetMetrics,
+) {
+    loop {
+        let job = queue.lock().unwrap().recv();
+        let Ok((token, mut conn, queued)) = job else {
+            return;
+        };
+        metrics.queue_wait.record(queued.elapsed());
+
+        // Serve every PDU that is already waiting. Readiness can be stale,
+        // so check before each read rather than blocking on an empty socket.
+        let mut served = 0;
+        let open = loop {
+            if served == PDUS_PER_TURN || !conn.is_readable() {
+                // Also run parked commands when there was no input
+                match conn.run_parked() {
+                    Ok(()) => break true,
+                    Err(e) => {
+                        log::debug!("Connection error: {}", e);
+                        break false;
+                    }
+                }
+            }
+            match conn.step() {
+                Ok(true) => served += 1,
+                Ok(false) => break false,
+                Err(e) => {
+                    log::debug!("Connection error: {}", e);
+                    break false;
+                }
+            }
+        };
+
+        let fd = conn.stream().as_raw_fd();
+        if !open {
+            let _ = registry.deregister(&mut SourceFd(&fd));
+            continue;
+        }
+
+        // Re-arming reports input that arrived while the worker held it.
+        // List it as parked only once it is idle, so the poller finds it.
+        let has_parked = conn.has_parked();
+        idle.lock().unwrap().insert(token, conn);
+        if has_parked {
+            parked.lock().unwrap().insert(token);
+        }
+        if let Err(e) = registry.reregister(&mut SourceFd(&fd), token, Interest::READABLE) {
+            log::error!("Failed to re-arm connection: {}", e);
+            idle.lock().unwrap().remove(&token);
+        }
+    }
+}
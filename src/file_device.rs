@@ -0,0 +1,564 @@
+//! File-backed storage backends
+//!
+//! `MmapDevice` maps a file or block device into memory. Reads copy
+//! straight from the page cache into the outgoing Data-In PDU, with no
+//! read syscall and no intermediate buffer, and writes land in the page
+//! cache until SYNCHRONIZE CACHE (or a FUA write) calls `msync`.
+//!
+//! `DirectDevice` opens the file with `O_DIRECT`, bypassing the page cache
+//! so the numbers reflect the storage itself. Transfers go through
+//! page-aligned buffers; ranges that are not aligned are read, patched
+//! and written back whole.
+//!
+//! Both report `concurrent_writes()`. Like `MemoryDevice`, they lock
+//! 256 KiB stripes rather than the whole device, so I/O from different
+//! sessions runs in parallel unless it touches the same stripe.
+
+use crate::backend::{byte_offset, DEFAULT_STRIPE_SIZE};
+use crate::error::{IscsiError, ScsiResult};
+use crate::scsi::ScsiBlockDevice;
+use std::fs::{File, OpenOptions};
+use std::io::{Seek, SeekFrom};
+use std::ops::Range;
+use std::path::Path;
+use std::sync::{RwLock, RwLockReadGuard, RwLockWriteGuard};
+
+#[cfg(target_os = "linux")]
+use std::alloc::{self, Layout};
+#[cfg(target_os = "linux")]
+use std::os::unix::fs::{FileExt, OpenOptionsExt};
+#[cfg(target_os = "linux")]
+use std::sync::Mutex;
+
+/// Per-stripe locks over a byte range that lives outside them
+///
+/// Every I/O locks the stripes it touches in ascending order, so a command
+/// never sees half of a concurrent write and writers cannot deadlock.
+struct RangeLocks {
+    locks: Vec<RwLock<()>>,
+    stripe_size: usize,
+}
+
+impl RangeLocks {
+    fn new(size: u64, stripe_size: usize) -> Self {
+        let count = size.div_ceil(stripe_size as u64).max(1) as usize;
+        RangeLocks {
+            locks: (0..count).map(|_| RwLock::new(())).collect(),
+            stripe_size,
+        }
+    }
+
+    fn span(&self, offset: u64, len: usize) -> Range<usize> {
+        let first = (offset / self.stripe_size as u64) as usize;
+        let last = ((offset + len.max(1) as u64 - 1) / self.stripe_size as u64) as usize;
+        first..last + 1
+    }
+
+    fn read(&self, offset: u64, len: usize) -> ScsiResult<Vec<RwLockReadGuard<'_, ()>>> {
+        self.locks[self.span(offset, len)]
+            .iter()
+            .map(|lock| lock.read().map_err(|_| lock_error()))
+            .collect()
+    }
+
+    fn write(&self, offset: u64, len: usize) -> ScsiResult<Vec<RwLockWriteGuard<'_, ()>>> {
+        self.locks[self.span(offset, len)]
+            .iter()
+            .map(|lock| lock.write().map_err(|_| lock_error()))
+            .collect()
+    }
+}
+
+fn lock_error() -> IscsiError {
+    IscsiError::Scsi("Stripe lock poisoned".to_string())
+}
+
+/// Size of a file or block device in bytes
+///
+/// Seeking to the end works for both; a block device's metadata length is 0.
+fn file_size(file: &File) -> ScsiResult<u64> {
+    let mut file = file;
+    Ok(file.seek(SeekFrom::End(0))?)
+}
+
+fn check_buffer(buf: &[u8], blocks: u32, block_size: u32) -> ScsiResult<()> {
+    let len = blocks as usize * block_size as usize;
+    if buf.len() != len {
+        return Err(IscsiError::Scsi(format!(
+            "read buffer is {} bytes, expected {}",
+            buf.len(),
+            len
+        )));
+    }
+    Ok(())
+}
+
+fn open_options(path: &Path, size_bytes: Option<u64>) -> ScsiResult<File> {
+    let file = OpenOptions::new()
+        .read(true)
+        .write(true)
+        .create(size_bytes.is_some())
+        .truncate(false)
+        .open(path)?;
+    if let Some(size) = size_bytes {
+        if file_size(&file)? < size {
+            file.set_len(size)?;
+        }
+    }
+    Ok(file)
+}
+
+/// Block device backed by a shared memory mapping of a file
+///
+/// The file must not be truncated by anyone else while the device is open:
+/// touching a mapped page past the end of the file raises SIGBUS.
+pub struct MmapDevice {
+    map: *mut u8,
+    size: usize,
+    block_size: u32,
+    locks: RangeLocks,
+    _file: File,
+}
+
+// The mapping is only touched under `locks`, like MemoryDevice's stripes
+unsafe impl Send for MmapDevice {}
+unsafe impl Sync for MmapDevice {}
+
+impl MmapDevice {
+    /// Map an existing file or block device; its size is rounded down to whole blocks
+    pub fn open<P: AsRef<Path>>(path: P, block_size: u32) -> ScsiResult<Self> {
+        Self::with_file(open_options(path.as_ref(), None)?, block_size)
+    }
+
+    /// Map `path`, creating it or growing it to `size_bytes` first if it is smaller
+    pub fn create<P: AsRef<Path>>(path: P, size_bytes: u64, block_size: u32) -> ScsiResult<Self> {
+        Self::with_file(open_options(path.as_ref(), Some(size_bytes))?, block_size)
+    }
+
+    fn with_file(file: File, block_size: u32) -> ScsiResult<Self> {
+        use std::os::unix::io::AsRawFd;
+
+        let block = block_size.max(1) as u64;
+        let size = usize::try_from(file_size(&file)? / block * block)
+            .map_err(|_| IscsiError::Config("File too large to map".to_string()))?;
+        if size == 0 {
+            return Err(IscsiError::Config(
+                "Cannot map a file smaller than one block".to_string(),
+            ));
+        }
+
+        // SAFETY: a fresh shared mapping of an open descriptor; the result is checked
+        let map = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                size,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if map == libc::MAP_FAILED {
+            return Err(std::io::Error::last_os_error().into());
+        }
+
+        Ok(MmapDevice {
+            map: map as *mut u8,
+            size,
+            block_size,
+            locks: RangeLocks::new(size as u64, DEFAULT_STRIPE_SIZE),
+            _file: file,
+        })
+    }
+
+    fn offset(&self, lba: u64, len: usize, block_size: u32) -> ScsiResult<usize> {
+        byte_offset(lba, len, block_size, self.block_size, self.size as u64).map(|o| o as usize)
+    }
+}
+
+impl Drop for MmapDevice {
+    fn drop(&mut self) {
+        // SAFETY: map/size came from a successful mmap and nothing borrows it any more
+        unsafe {
+            libc::munmap(self.map as *mut libc::c_void, self.size);
+        }
+    }
+}
+
+impl ScsiBlockDevice for MmapDevice {
+    fn read(&self, lba: u64, blocks: u32, block_size: u32) -> ScsiResult<Vec<u8>> {
+        let mut data = vec![0u8; blocks as usize * block_size as usize];
+        self.read_into(lba, blocks, block_size, &mut data)?;
+        Ok(data)
+    }
+
+    fn read_into(&self, lba: u64, blocks: u32, block_size: u32, buf: &mut [u8]) -> ScsiResult<()> {
+        check_buffer(buf, blocks, block_size)?;
+        let offset = self.offset(lba, buf.len(), block_size)?;
+
+        let _guards = self.locks.read(offset as u64, buf.len())?;
+        // SAFETY: offset + len is within the mapping, and no writer holds these stripes
+        let src = unsafe { std::slice::from_raw_parts(self.map.add(offset), buf.len()) };
+        buf.copy_from_slice(src);
+        Ok(())
+    }
+
+    fn write(&mut self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        self.write_shared(lba, data, block_size)
+    }
+
+    fn capacity(&self) -> u64 {
+        (self.size / self.block_size.max(1) as usize) as u64
+    }
+
+    fn block_size(&self) -> u32 {
+        self.block_size
+    }
+
+    fn flush(&mut self) -> ScsiResult<()> {
+        self.flush_shared()
+    }
+
+    fn concurrent_writes(&self) -> bool {
+        true
+    }
+
+    fn write_shared(&self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        let offset = self.offset(lba, data.len(), block_size)?;
+
+        let _guards = self.locks.write(offset as u64, data.len())?;
+        // SAFETY: offset + len is within the mapping and we hold its stripes exclusively
+        let dst = unsafe { std::slice::from_raw_parts_mut(self.map.add(offset), data.len()) };
+        dst.copy_from_slice(data);
+        Ok(())
+    }
+
+    fn flush_shared(&self) -> ScsiResult<()> {
+        // SAFETY: msync only reads the page tables of a live mapping
+        if unsafe { libc::msync(self.map as *mut libc::c_void, self.size, libc::MS_SYNC) } != 0 {
+            return Err(std::io::Error::last_os_error().into());
+        }
+        Ok(())
+    }
+
+    fn write_cache_enabled(&self) -> bool {
+        // Writes sit in the page cache until msync
+        true
+    }
+
+    fn product_id(&self) -> &str {
+        "Mapped File     "
+    }
+}
+
+/// Alignment of `DirectDevice` offsets, lengths and buffers
+///
+/// 4 KiB satisfies O_DIRECT on both 512-byte and 4K-native storage.
+#[cfg(target_os = "linux")]
+pub const DIRECT_ALIGNMENT: usize = 4096;
+
+/// Bounce buffers kept for reuse by a `DirectDevice`
+#[cfg(target_os = "linux")]
+const DIRECT_POOLED_BUFFERS: usize = 32;
+
+/// Heap buffer aligned to `DIRECT_ALIGNMENT`
+#[cfg(target_os = "linux")]
+struct AlignedBuffer {
+    ptr: *mut u8,
+    len: usize,
+}
+
+#[cfg(target_os = "linux")]
+unsafe impl Send for AlignedBuffer {}
+
+#[cfg(target_os = "linux")]
+impl AlignedBuffer {
+    fn new(len: usize) -> Self {
+        let len = len.max(DIRECT_ALIGNMENT);
+        let layout = Self::layout(len);
+        // SAFETY: layout has a non-zero size
+        let ptr = unsafe { alloc::alloc_zeroed(layout) };
+        if ptr.is_null() {
+            alloc::handle_alloc_error(layout);
+        }
+        AlignedBuffer { ptr, len }
+    }
+
+    fn layout(len: usize) -> Layout {
+        Layout::from_size_align(len, DIRECT_ALIGNMENT).expect("aligned buffer layout")
+    }
+
+    fn as_mut_slice(&mut self, len: usize) -> &mut [u8] {
+        // SAFETY: len <= self.len, and we hold the only reference to the allocation
+        unsafe { std::slice::from_raw_parts_mut(self.ptr, len) }
+    }
+}
+
+#[cfg(target_os = "linux")]
+impl Drop for AlignedBuffer {
+    fn drop(&mut self) {
+        // SAFETY: ptr was allocated with exactly this layout
+        unsafe { alloc::dealloc(self.ptr, Self::layout(self.len)) }
+    }
+}
+
+/// Block device on a file or block device opened with `O_DIRECT`
+#[cfg(target_os = "linux")]
+pub struct DirectDevice {
+    file: File,
+    size: u64,
+    block_size: u32,
+    locks: RangeLocks,
+    buffers: Mutex<Vec<AlignedBuffer>>,
+}
+
+#[cfg(target_os = "linux")]
+impl DirectDevice {
+    /// Open an existing file or block device; its size is rounded down to whole 4 KiB
+    pub fn open<P: AsRef<Path>>(path: P, block_size: u32) -> ScsiResult<Self> {
+        Self::with_file(Self::open_direct(path.as_ref(), None)?, block_size)
+    }
+
+    /// Open `path`, creating it or growing it to `size_bytes` first if it is smaller
+    pub fn create<P: AsRef<Path>>(path: P, size_bytes: u64, block_size: u32) -> ScsiResult<Self> {
+        let size = size_bytes.div_ceil(DIRECT_ALIGNMENT as u64) * DIRECT_ALIGNMENT as u64;
+        Self::with_file(Self::open_direct(path.as_ref(), Some(size))?, block_size)
+    }
+
+    fn open_direct(path: &Path, size_bytes: Option<u64>) -> ScsiResult<File> {
+        // Size the file through the page cache, then reopen it uncached
+        drop(open_options(path, size_bytes)?);
+        Ok(OpenOptions::new()
+            .read(true)
+            .write(true)
+            .custom_flags(libc::O_DIRECT)
+            .open(path)?)
+    }
+
+    fn with_file(file: File, block_size: u32) -> ScsiResult<Self> {
+        if block_size == 0 || block_size % 512 != 0 {
+            return Err(IscsiError::Config(format!(
+                "O_DIRECT needs a block size that is a multiple of 512, got {}",
+                block_size
+            )));
+        }
+        // Whole aligned units, so the read-modify-write of the last block stays in the file
+        let align = DIRECT_ALIGNMENT.max(block_size as usize) as u64;
+        let size = file_size(&file)? / align * align;
+        if size == 0 {
+            return Err(IscsiError::Config(format!(
+                "O_DIRECT device must hold at least {} bytes",
+                align
+            )));
+        }
+
+        Ok(DirectDevice {
+            file,
+            size,
+            block_size,
+            locks: RangeLocks::new(size, DEFAULT_STRIPE_SIZE),
+            buffers: Mutex::new(Vec::new()),
+        })
+    }
+
+    fn offset(&self, lba: u64, len: usize, block_size: u32) -> ScsiResult<u64> {
+        byte_offset(lba, len, block_size, self.block_size, self.size)
+    }
+
+    /// [offset, offset + len) widened to aligned boundaries
+    fn aligned(offset: u64, len: usize) -> (u64, usize) {
+        let align = DIRECT_ALIGNMENT as u64;
+        let start = offset / align * align;
+        let end = (offset + len as u64).div_ceil(align) * align;
+        (start, (end - start) as usize)
+    }
+
+    fn is_aligned(offset: u64, buf: &[u8]) -> bool {
+        offset % DIRECT_ALIGNMENT as u64 == 0
+            && buf.len() % DIRECT_ALIGNMENT == 0
+            && buf.as_ptr() as usize % DIRECT_ALIGNMENT == 0
+    }
+
+    /// Take a pooled buffer of at least `len` bytes, or allocate one
+    fn take_buffer(&self, len: usize) -> AlignedBuffer {
+        let mut pool = self.buffers.lock().unwrap_or_else(|e| e.into_inner());
+        match pool.iter().position(|b| b.len >= len) {
+            Some(i) => pool.swap_remove(i),
+            None => AlignedBuffer::new(len),
+        }
+    }
+
+    fn put_buffer(&self, buffer: AlignedBuffer) {
+        let mut pool = self.buffers.lock().unwrap_or_else(|e| e.into_inner());
+        if pool.len() < DIRECT_POOLED_BUFFERS {
+            pool.push(buffer);
+        }
+    }
+}
+
+#[cfg(target_os = "linux")]
+impl ScsiBlockDevice for DirectDevice {
+    fn read(&self, lba: u64, blocks: u32, block_size: u32) -> ScsiResult<Vec<u8>> {
+        let mut data = vec![0u8; blocks as usize * block_size as usize];
+        self.read_into(lba, blocks, block_size, &mut data)?;
+        Ok(data)
+    }
+
+    fn read_into(&self, lba: u64, blocks: u32, block_size: u32, buf: &mut [u8]) -> ScsiResult<()> {
+        check_buffer(buf, blocks, block_size)?;
+        let offset = self.offset(lba, buf.len(), block_size)?;
+        let (start, len) = Self::aligned(offset, buf.len());
+
+        let _guards = self.locks.read(start, len)?;
+        if Self::is_aligned(offset, buf) {
+            self.file.read_exact_at(buf, offset)?;
+            return Ok(());
+        }
+
+        let mut bounce = self.take_buffer(len);
+        let result = self.file.read_exact_at(bounce.as_mut_slice(len), start);
+        if result.is_ok() {
+            let skip = (offset - start) as usize;
+            buf.copy_from_slice(&bounce.as_mut_slice(len)[skip..skip + buf.len()]);
+        }
+        self.put_buffer(bounce);
+        Ok(result?)
+    }
+
+    fn write(&mut self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        self.write_shared(lba, data, block_size)
+    }
+
+    fn capacity(&self) -> u64 {
+        self.size / self.block_size as u64
+    }
+
+    fn block_size(&self) -> u32 {
+        self.block_size
+    }
+
+    fn flush(&mut self) -> ScsiResult<()> {
+        self.flush_shared()
+    }
+
+    fn concurrent_writes(&self) -> bool {
+        true
+    }
+
+    fn write_shared(&self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        let offset = self.offset(lba, data.len(), block_size)?;
+        let (start, len) = Self::aligned(offset, data.len());
+
+        // The whole aligned range: a read-modify-write must not race a neighbour's write
+        let _guards = self.locks.write(start, len)?;
+        if Self::is_aligned(offset, data) {
+            self.file.write_all_at(data, offset)?;
+            return Ok(());
+        }
+
+        let mut bounce = self.take_buffer(len);
+        let skip = (offset - start) as usize;
+        let result = (|| -> ScsiResult<()> {
+            let chunk = bounce.as_mut_slice(len);
+            if skip != 0 || data.len() != len {
+                // Only the partial units at either end need their old contents
+                let head = start;
+                let tail = start + len as u64 - DIRECT_ALIGNMENT as u64;
+                self.file.read_exact_at(&mut chunk[..DIRECT_ALIGNMENT], head)?;
+                if tail != head {
+                    self.file
+                        .read_exact_at(&mut chunk[len - DIRECT_ALIGNMENT..], tail)?;
+                }
+            }
+            chunk[skip..skip + data.len()].copy_from_slice(data);
+            self.file.write_all_at(chunk, start)?;
+            Ok(())
+        })();
+        self.put_buffer(bounce);
+        result
+    }
+
+    fn flush_shared(&self) -> ScsiResult<()> {
+        // Writes bypass the page cache but may still sit in the drive's cache
+        Ok(self.file.sync_data()?)
+    }
+
+    fn write_cache_enabled(&self) -> bool {
+        true
+    }
+
+    fn product_id(&self) -> &str {
+        "Direct File     "
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::path::PathBuf;
+
+    fn temp_path(name: &str) -> PathBuf {
+        std::env::temp_dir().join(format!("iscsi-{}-{}.img", name, std::process::id()))
+    }
+
+    #[test]
+    fn test_mmap_roundtrip_and_persistence() {
+        let path = temp_path("mmap");
+        let data: Vec<u8> = (0..10 * 512).map(|i| (i % 251) as u8).collect();
+        {
+            let mut device = MmapDevice::create(&path, 1024 * 512, 512).unwrap();
+            assert_eq!(device.capacity(), 1024);
+            assert!(device.concurrent_writes());
+            assert!(device.write_cache_enabled());
+
+            // Spans the first stripe boundary
+            let lba = (DEFAULT_STRIPE_SIZE / 512 - 3) as u64;
+            device.write(lba, &data, 512).unwrap();
+            assert_eq!(device.read(lba, 10, 512).unwrap(), data);
+            device.write(7, &data[..512], 512).unwrap();
+            device.flush().unwrap();
+            assert!(device.read(1024, 1, 512).is_err());
+            assert!(device.read(0, 1, 4096).is_err());
+        }
+
+        let device = MmapDevice::open(&path, 512).unwrap();
+        let mut buf = vec![0u8; 512];
+        device.read_into(7, 1, 512, &mut buf).unwrap();
+        assert_eq!(buf, data[..512]);
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[cfg(target_os = "linux")]
+    #[test]
+    fn test_direct_unaligned_roundtrip() {
+        let path = temp_path("direct");
+        let mut device = match DirectDevice::create(&path, 1024 * 512, 512) {
+            Ok(device) => device,
+            Err(IscsiError::Io(e)) if e.kind() == std::io::ErrorKind::InvalidInput => {
+                // tmpfs and some other filesystems refuse O_DIRECT
+                let _ = std::fs::remove_file(&path);
+                return;
+            }
+            Err(e) => panic!("{}", e),
+        };
+        assert_eq!(device.capacity(), 1024);
+
+        // Misaligned start and length: read-modify-write of both end units
+        let data: Vec<u8> = (0..11 * 512).map(|i| (i % 253) as u8).collect();
+        device.write(3, &data, 512).unwrap();
+        assert_eq!(device.read(3, 11, 512).unwrap(), data);
+        assert_eq!(device.read(0, 3, 512).unwrap(), vec![0u8; 3 * 512]);
+        assert_eq!(device.read(14, 2, 512).unwrap(), vec![0u8; 2 * 512]);
+
+        // Aligned transfer into an aligned buffer skips the bounce buffer
+        let mut aligned = AlignedBuffer::new(4096);
+        device.write(8, &[0xA5; 4096], 512).unwrap();
+        device.read_into(8, 8, 512, aligned.as_mut_slice(4096)).unwrap();
+        assert_eq!(aligned.as_mut_slice(4096), &[0xA5; 4096][..]);
+
+        device.flush().unwrap();
+        assert!(device.read(1023, 2, 512).is_err());
+        drop(device);
+        std::fs::remove_file(&path).unwrap();
+    }
+}
@@ -47,18 +47,35 @@
 //! ```
 
 pub mod auth;
+pub mod backend;
+pub mod cache;
 pub mod client;
+pub mod digest;
 pub mod error;
+#[cfg(unix)]
+pub mod file_device;
+pub mod metrics;
+#[cfg(unix)]
+mod event_loop;
 pub mod pdu;
 pub mod scsi;
 pub mod session;
 pub mod target;
+pub mod trace;
 
 pub use auth::{AuthConfig, ChapCredentials};
+pub use backend::{MemoryDevice, SparseDevice};
+pub use cache::WriteBackCache;
 pub use client::IscsiClient;
 pub use error::{IscsiError, ScsiResult};
+#[cfg(target_os = "linux")]
+pub use file_device::DirectDevice;
+#[cfg(unix)]
+pub use file_device::MmapDevice;
+pub use metrics::TargetMetrics;
 pub use scsi::ScsiBlockDevice;
-pub use target::{IscsiTarget, IscsiTargetBuilder};
+pub use target::{ConnectionModel, IscsiTarget, IscsiTargetBuilder};
+pub use trace::PduTrace;
 
 /// Version of this library
 pub const VERSION: &str = env!("CARGO_PKG_VERSION");
@@ -0,0 +1,396 @@
+//! Target metrics
+//!
+//! `TargetMetrics` counts what the target does on its hot paths: PDUs by
+//! opcode in each direction, SCSI commands by operation code, data bytes
+//! moved, and histograms of device read, write and flush latency, device
+//! lock wait and (in the event-driven model) how long a readable
+//! connection waits for a worker. Every update is a relaxed atomic add, so
+//! recording never takes a lock.
+//!
+//! `IscsiTarget::metrics` reads them directly. With
+//! `IscsiTargetBuilder::metrics_addr` set, the target also serves them in
+//! the Prometheus text format at `GET /metrics`.
+
+use crate::error::{IscsiError, ScsiResult};
+use crate::pdu::{opcode, IscsiPdu};
+use mio::{Events, Interest, Poll, Token};
+use std::fmt::Write as _;
+use std::io::{Read, Write};
+use std::net::TcpStream;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
+
+/// Number of histogram buckets; bucket `i` holds durations in [2^i, 2^(i+1)) ns
+pub const HISTOGRAM_BUCKETS: usize = 40;
+
+/// First bucket written out as its own `le` bound (2^10 ns, about 1 µs)
+const FIRST_EXPORTED_BUCKET: usize = 10;
+
+/// How often the metrics endpoint re-checks the running flag
+const POLL_INTERVAL: Duration = Duration::from_millis(100);
+
+/// Longest a scraper may take to send its request
+const REQUEST_TIMEOUT: Duration = Duration::from_secs(2);
+
+/// Lock-free latency histogram with power-of-two buckets
+pub struct LatencyHistogram {
+    buckets: [AtomicU64; HISTOGRAM_BUCKETS],
+    count: AtomicU64,
+    sum_ns: AtomicU64,
+}
+
+impl Default for LatencyHistogram {
+    fn default() -> Self {
+        LatencyHistogram {
+            buckets: std::array::from_fn(|_| AtomicU64::new(0)),
+            count: AtomicU64::new(0),
+            sum_ns: AtomicU64::new(0),
+        }
+    }
+}
+
+impl LatencyHistogram {
+    /// Add one sample
+    pub fn record(&self, elapsed: Duration) {
+        let ns = elapsed.as_nanos().min(u64::MAX as u128) as u64;
+        let bucket = (63 - ns.max(1).leading_zeros() as usize).min(HISTOGRAM_BUCKETS - 1);
+        self.buckets[bucket].fetch_add(1, Ordering::Relaxed);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.sum_ns.fetch_add(ns, Ordering::Relaxed);
+    }
+
+    /// Number of samples
+    pub fn count(&self) -> u64 {
+        self.count.load(Ordering::Relaxed)
+    }
+
+    /// Sum of all samples
+    pub fn sum(&self) -> Duration {
+        Duration::from_nanos(self.sum_ns.load(Ordering::Relaxed))
+    }
+
+    /// Mean sample, or zero with no samples
+    pub fn mean(&self) -> Duration {
+        match self.count() {
+            0 => Duration::ZERO,
+            n => Duration::from_nanos(self.sum_ns.load(Ordering::Relaxed) / n),
+        }
+    }
+
+    /// Upper bound of the bucket holding quantile `q` (0.0..=1.0)
+    pub fn quantile(&self, q: f64) -> Duration {
+        let counts = self.bucket_counts();
+        let total: u64 = counts.iter().sum();
+        if total == 0 {
+            return Duration::ZERO;
+        }
+
+        let rank = ((q.clamp(0.0, 1.0) * total as f64).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (bucket, count) in counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Duration::from_nanos(bucket_upper_ns(bucket));
+            }
+        }
+        Duration::from_nanos(bucket_upper_ns(HISTOGRAM_BUCKETS - 1))
+    }
+
+    /// Samples in each bucket
+    pub fn bucket_counts(&self) -> [u64; HISTOGRAM_BUCKETS] {
+        std::array::from_fn(|i| self.buckets[i].load(Ordering::Relaxed))
+    }
+
+    /// Write as a Prometheus histogram in seconds
+    fn render(&self, out: &mut String, name: &str, help: &str) {
+        let counts = self.bucket_counts();
+        let _ = writeln!(out, "# HELP {} {}", name, help);
+        let _ = writeln!(out, "# TYPE {} histogram", name);
+
+        let mut cumulative: u64 = counts[..FIRST_EXPORTED_BUCKET].iter().sum();
+        for (bucket, count) in counts.iter().enumerate().skip(FIRST_EXPORTED_BUCKET) {
+            cumulative += count;
+            let le = bucket_upper_ns(bucket) as f64 / 1e9;
+            let _ = writeln!(out, "{}_bucket{{le=\"{}\"}} {}", name, le, cumulative);
+        }
+        let _ = writeln!(out, "{}_bucket{{le=\"+Inf\"}} {}", name, self.count());
+        let _ = writeln!(out, "{}_sum {}", name, self.sum().as_secs_f64());
+        let _ = writeln!(out, "{}_count {}", name, self.count());
+    }
+}
+
+/// Exclusive upper bound of a bucket in nanoseconds
+fn bucket_upper_ns(bucket: usize) -> u64 {
+    1u64 << (bucket + 1)
+}
+
+/// Counters and histograms for one target
+pub struct TargetMetrics {
+    pdus_in: [AtomicU64; 64],
+    pdus_out: [AtomicU64; 64],
+    scsi_commands: [AtomicU64; 256],
+    bytes_in: AtomicU64,
+    bytes_out: AtomicU64,
+    /// Device read calls
+    pub device_read: LatencyHistogram,
+    /// Device write calls
+    pub device_write: LatencyHistogram,
+    /// Device flushes (SYNCHRONIZE CACHE and FUA writes)
+    pub device_flush: LatencyHistogram,
+    /// Device unmaps (UNMAP and WRITE SAME with UNMAP)
+    pub device_unmap: LatencyHistogram,
+    /// Waiting for the device lock
+    pub lock_wait: LatencyHistogram,
+    /// A readable connection waiting for a worker (event-driven model)
+    pub queue_wait: LatencyHistogram,
+}
+
+impl Default for TargetMetrics {
+    fn default() -> Self {
+        TargetMetrics {
+            pdus_in: std::array::from_fn(|_| AtomicU64::new(0)),
+            pdus_out: std::array::from_fn(|_| AtomicU64::new(0)),
+            scsi_commands: std::array::from_fn(|_| AtomicU64::new(0)),
+            bytes_in: AtomicU64::new(0),
+            bytes_out: AtomicU64::new(0),
+            device_read: LatencyHistogram::default(),
+            device_write: LatencyHistogram::default(),
+            device_flush: LatencyHistogram::default(),
+            device_unmap: LatencyHistogram::default(),
+            lock_wait: LatencyHistogram::default(),
+            queue_wait: LatencyHistogram::default(),
+        }
+    }
+}
+
+impl TargetMetrics {
+    /// Count a PDU read from an initiator
+    pub(crate) fn pdu_received(&self, pdu: &IscsiPdu) {
+        self.pdus_in[(pdu.opcode & 0x3F) as usize].fetch_add(1, Ordering::Relaxed);
+        self.bytes_in.fetch_add(pdu.data_length as u64, Ordering::Relaxed);
+        if pdu.opcode == opcode::SCSI_COMMAND {
+            self.scsi_commands[pdu.specific[12] as usize].fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Count a PDU sent to an initiator
+    pub(crate) fn pdu_sent(&self, pdu: &IscsiPdu) {
+        self.pdus_out[(pdu.opcode & 0x3F) as usize].fetch_add(1, Ordering::Relaxed);
+        self.bytes_out.fetch_add(pdu.data_length as u64, Ordering::Relaxed);
+    }
+
+    /// PDUs received with iSCSI opcode `opcode`
+    pub fn pdus_received(&self, opcode: u8) -> u64 {
+        self.pdus_in[(opcode & 0x3F) as usize].load(Ordering::Relaxed)
+    }
+
+    /// PDUs sent with iSCSI opcode `opcode`
+    pub fn pdus_sent(&self, opcode: u8) -> u64 {
+        self.pdus_out[(opcode & 0x3F) as usize].load(Ordering::Relaxed)
+    }
+
+    /// SCSI commands received with CDB operation code `operation`
+    pub fn scsi_commands(&self, operation: u8) -> u64 {
+        self.scsi_commands[operation as usize].load(Ordering::Relaxed)
+    }
+
+    /// R2Ts sent
+    pub fn r2ts(&self) -> u64 {
+        self.pdus_sent(opcode::R2T)
+    }
+
+    /// Data segment bytes received
+    pub fn bytes_received(&self) -> u64 {
+        self.bytes_in.load(Ordering::Relaxed)
+    }
+
+    /// Data segment bytes sent
+    pub fn bytes_sent(&self) -> u64 {
+        self.bytes_out.load(Ordering::Relaxed)
+    }
+
+    /// Everything in the Prometheus text exposition format
+    pub fn render_prometheus(&self) -> String {
+        let mut out = String::new();
+        render_counters(&mut out, "iscsi_target_pdus_received_total",
+            "PDUs received by iSCSI opcode", "opcode", &self.pdus_in);
+        render_counters(&mut out, "iscsi_target_pdus_sent_total",
+            "PDUs sent by iSCSI opcode", "opcode", &self.pdus_out);
+        render_counters(&mut out, "iscsi_target_scsi_commands_total",
+            "SCSI commands by CDB operation code", "operation", &self.scsi_commands);
+
+        for (name, help, value) in [
+            ("iscsi_target_data_received_bytes_total", "Data segment bytes received", self.bytes_received()),
+            ("iscsi_target_data_sent_bytes_total", "Data segment bytes sent", self.bytes_sent()),
+            ("iscsi_target_r2t_total", "R2T PDUs sent", self.r2ts()),
+        ] {
+            let _ = writeln!(out, "# HELP {} {}", name, help);
+            let _ = writeln!(out, "# TYPE {} counter", name);
+            let _ = writeln!(out, "{} {}", name, value);
+        }
+
+        self.device_read.render(&mut out, "iscsi_target_device_read_seconds", "Device read latency");
+        self.device_write.render(&mut out, "iscsi_target_device_write_seconds", "Device write latency");
+        self.device_flush.render(&mut out, "iscsi_target_device_flush_seconds", "Device flush latency");
+        self.device_unmap.render(&mut out, "iscsi_target_device_unmap_seconds", "Device unmap latency");
+        self.lock_wait.render(&mut out, "iscsi_target_lock_wait_seconds", "Time spent waiting for the device lock");
+        self.queue_wait.render(&mut out, "iscsi_target_queue_wait_seconds",
+            "Time a readable connection waited for a worker");
+        out
+    }
+}
+
+/// Write the non-zero entries of a counter array, labelled by index in hex
+fn render_counters(out: &mut String, name: &str, help: &str, label: &str, counters: &[AtomicU64]) {
+    let _ = writeln!(out, "# HELP {} {}", name, help);
+    let _ = writeln!(out, "# TYPE {} counter", name);
+    for (index, counter) in counters.iter().enumerate() {
+        let value = counter.load(Ordering::Relaxed);
+        if value > 0 {
+            let _ = writeln!(out, "{}{{{}=\"0x{:02x}\"}} {}", name, label, index, value);
+        }
+    }
+}
+
+/// Serve `GET /metrics` on `listener` until `running` clears
+pub(crate) fn serve(
+    listener: std::net::TcpListener,
+    metrics: Arc<TargetMetrics>,
+    running: Arc<AtomicBool>,
+) -> ScsiResult<()> {
+    const LISTENER: Token = Token(0);
+
+    listener.set_nonblocking(true).map_err(IscsiError::Io)?;
+    let mut listener = mio::net::TcpListener::from_std(listener);
+    let mut poll = Poll::new().map_err(IscsiError::Io)?;
+    poll.registry()
+        .register(&mut listener, LISTENER, Interest::READABLE)
+        .map_err(IscsiError::Io)?;
+    let mut events = Events::with_capacity(16);
+
+    while running.load(Ordering::SeqCst) {
+        match poll.poll(&mut events, Some(POLL_INTERVAL)) {
+            Ok(()) => {}
+            Err(ref e) if e.kind() == std::io::ErrorKind::Interrupted => continue,
+            Err(e) => return Err(IscsiError::Io(e)),
+        }
+
+        loop {
+            match listener.accept() {
+                Ok((stream, _)) => {
+                    if let Err(e) = answer(TcpStream::from(stream), &metrics) {
+                        log::debug!("Metrics request failed: {}", e);
+                    }
+                }
+                Err(ref e) if e.kind() == std::io::ErrorKind::WouldBlock => break,
+                Err(ref e) if e.kind() == std::io::ErrorKind::Interrupted => continue,
+                Err(e) => {
+                    log::error!("Metrics accept error: {}", e);
+                    break;
+                }
+            }
+        }
+    }
+    Ok(())
+}
+
+/// Answer one HTTP request
+fn answer(mut stream: TcpStream, metrics: &TargetMetrics) -> std::io::Result<()> {
+    stream.set_nonblocking(false)?;
+    stream.set_read_timeout(Some(REQUEST_TIMEOUT))?;
+    stream.set_write_timeout(Some(REQUEST_TIMEOUT))?;
+
+    // Only the request line matters; stop at the end of the headers
+    let mut request = Vec::with_capacity(512);
+    let mut chunk = [0u8; 512];
+    while !request.windows(4).any(|w| w == b"\r\n\r\n") && request.len() < 8192 {
+        let n = stream.read(&mut chunk)?;
+        if n == 0 {
+            break;
+        }
+        request.extend_from_slice(&chunk[..n]);
+    }
+
+    let line = request.split(|&b| b == b'\r').next().unwrap_or_default();
+    let mut parts = line.split(|&b| b == b' ');
+    let (method, path) = (parts.next().unwrap_or_default(), parts.next().unwrap_or_default());
+
+    let (status, body) = if method == b"GET" && (path == b"/metrics" || path.starts_with(b"/metrics?")) {
+        ("200 OK", metrics.render_prometheus())
+    } else {
+        ("404 Not Found", "Not found\n".to_string())
+    };
+    write!(
+        stream,
+        "HTTP/1.1 {}\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+        status,
+        body.len(),
+        body
+    )?;
+    stream.flush()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_histogram_buckets() {
+        let hist = LatencyHistogram::default();
+        assert_eq!(hist.quantile(0.5), Duration::ZERO);
+
+        for _ in 0..90 {
+            hist.record(Duration::from_nanos(1500)); // bucket 10: [1024, 2048)
+        }
+        for _ in 0..10 {
+            hist.record(Duration::from_micros(100)); // bucket 16: [65536, 131072)
+        }
+        hist.record(Duration::ZERO);
+
+        assert_eq!(hist.count(), 101);
+        assert_eq!(hist.sum(), Duration::from_nanos(90 * 1500 + 10 * 100_000));
+        assert_eq!(hist.quantile(0.5), Duration::from_nanos(2048));
+        assert_eq!(hist.quantile(0.99), Duration::from_nanos(131_072));
+        assert_eq!(hist.bucket_counts()[0], 1);
+    }
+
+    #[test]
+    fn test_pdu_counters() {
+        let metrics = TargetMetrics::default();
+        let mut pdu = IscsiPdu::new();
+        pdu.opcode = opcode::SCSI_COMMAND;
+        pdu.data_length = 512;
+        pdu.specific[12] = 0x2a;
+        metrics.pdu_received(&pdu);
+
+        pdu.opcode = opcode::R2T;
+        pdu.data_length = 0;
+        metrics.pdu_sent(&pdu);
+
+        assert_eq!(metrics.pdus_received(opcode::SCSI_COMMAND), 1);
+        assert_eq!(metrics.scsi_commands(0x2a), 1);
+        assert_eq!(metrics.r2ts(), 1);
+        assert_eq!((metrics.bytes_received(), metrics.bytes_sent()), (512, 0));
+    }
+
+    #[test]
+    fn test_prometheus_text() {
+        let metrics = TargetMetrics::default();
+        let mut pdu = IscsiPdu::new();
+        pdu.opcode = opcode::NOP_OUT;
+        metrics.pdu_received(&pdu);
+        metrics.device_read.record(Duration::from_nanos(100));
+        metrics.device_read.record(Duration::from_micros(3));
+
+        let text = metrics.render_prometheus();
+        assert!(text.contains("iscsi_target_pdus_received_total{opcode=\"0x00\"} 1\n"));
+        assert!(!text.contains("opcode=\"0x01\""));
+        assert!(text.contains("# TYPE iscsi_target_device_read_seconds histogram\n"));
+        // The 100 ns sample falls below the first exported bound
+        assert!(text.contains("iscsi_target_device_read_seconds_bucket{le=\"0.000002048\"} 1\n"));
+        assert!(text.contains("iscsi_target_device_read_seconds_bucket{le=\"0.000004096\"} 2\n"));
+        assert!(text.contains("iscsi_target_device_read_seconds_bucket{le=\"+Inf\"} 2\n"));
+        assert!(text.contains("iscsi_target_device_read_seconds_count 2\n"));
+    }
+}
@@ -7,8 +7,7 @@
 #![allow(clippy::too_many_arguments)]
 
 use crate::error::{IscsiError, ScsiResult};
-use byteorder::{BigEndian, ByteOrder, ReadBytesExt, WriteBytesExt};
-use std::io::Cursor;
+use byteorder::{BigEndian, ByteOrder};
 
 /// BHS (Basic Header Segment) size in bytes
 pub const BHS_SIZE: usize = 48;
@@ -185,40 +184,12 @@ impl IscsiPdu {
             )));
         }
 
-        let mut cursor = Cursor::new(buf);
-
-        // Byte 0: Immediate flag (bit 6) and Opcode (bits 0-5)
-        let byte0 = cursor.read_u8().map_err(IscsiError::Io)?;
-        let immediate = (byte0 & 0x40) != 0;
-        let opcode = byte0 & 0x3F;
-
-        // Byte 1: Flags (opcode-specific)
-        let flags = cursor.read_u8().map_err(IscsiError::Io)?;
-
-        // Bytes 2-3: For Login Request, this is version info; for others, reserved
-        let version_or_reserved = cursor.read_u16::<BigEndian>().map_err(IscsiError::Io)?;
-
-        // Byte 4: Total AHS Length (4-byte units)
-        let ahs_length = cursor.read_u8().map_err(IscsiError::Io)?;
-
-        // Bytes 5-7: Data Segment Length (3 bytes, big-endian)
-        let ds_len_high = cursor.read_u8().map_err(IscsiError::Io)? as u32;
-        let ds_len_low = cursor.read_u16::<BigEndian>().map_err(IscsiError::Io)? as u32;
-        let data_length = (ds_len_high << 16) | ds_len_low;
-
-        // Bytes 8-15: LUN
-        let lun = cursor.read_u64::<BigEndian>().map_err(IscsiError::Io)?;
-
-        // Bytes 16-19: Initiator Task Tag
-        let itt = cursor.read_u32::<BigEndian>().map_err(IscsiError::Io)?;
-
-        // Bytes 20-47: Opcode-specific fields
-        let mut specific = [0u8; 28];
-        std::io::Read::read_exact(&mut cursor, &mut specific).map_err(IscsiError::Io)?;
+        let bhs: &[u8; BHS_SIZE] = buf[..BHS_SIZE].try_into().unwrap();
+        let ahs_bytes = (bhs[4] as usize) * 4;
+        let data_length = BigEndian::read_u24(&bhs[5..8]) as usize;
 
         // Calculate total expected length (BHS + AHS + data + padding)
-        let ahs_bytes = (ahs_length as usize) * 4;
-        let padded_data_len = (data_length as usize).div_ceil(4) * 4; // Pad to 4-byte boundary
+        let padded_data_len = data_length.div_ceil(4) * 4; // Pad to 4-byte boundary
         let total_len = BHS_SIZE + ahs_bytes + padded_data_len;
 
         if buf.len() < total_len {
@@ -234,20 +205,39 @@ impl IscsiPdu {
 
         // Extract data segment (skip AHS for now)
         let data_start = BHS_SIZE + ahs_bytes;
-        let data = buf[data_start..data_start + data_length as usize].to_vec();
-
-        Ok(IscsiPdu {
-            opcode,
-            immediate,
-            flags,
-            version_or_reserved,
-            ahs_length,
-            data_length,
-            lun,
-            itt,
+        let data = buf[data_start..data_start + data_length].to_vec();
+
+        Ok(Self::from_header(bhs, data))
+    }
+
+    /// Build a PDU from its BHS and an already-read data segment
+    ///
+    /// `data` becomes the PDU's data as is, without the padding, so a
+    /// receive buffer can be handed over without copying.
+    pub fn from_header(bhs: &[u8; BHS_SIZE], data: Vec<u8>) -> Self {
+        let mut specific = [0u8; 28];
+        specific.copy_from_slice(&bhs[20..48]);
+
+        IscsiPdu {
+            // Byte 0: Immediate flag (bit 6) and Opcode (bits 0-5)
+            opcode: bhs[0] & 0x3F,
+            immediate: (bhs[0] & 0x40) != 0,
+            // Byte 1: Flags (opcode-specific)
+            flags: bhs[1],
+            // Bytes 2-3: For Login Request, this is version info; for others, reserved
+            version_or_reserved: BigEndian::read_u16(&bhs[2..4]),
+            // Byte 4: Total AHS Length (4-byte units)
+            ahs_length: bhs[4],
+            // Bytes 5-7: Data Segment Length (3 bytes, big-endian)
+            data_length: BigEndian::read_u24(&bhs[5..8]),
+            // Bytes 8-15: LUN
+            lun: BigEndian::read_u64(&bhs[8..16]),
+            // Bytes 16-19: Initiator Task Tag
+            itt: BigEndian::read_u32(&bhs[16..20]),
+            // Bytes 20-47: Opcode-specific fields
             specific,
             data,
-        })
+        }
     }
 
     /// Serialize PDU to bytes
@@ -257,70 +247,72 @@ impl IscsiPdu {
         let total_len = BHS_SIZE + ahs_bytes + padded_data_len;
 
         let mut buf = Vec::with_capacity(total_len);
+        buf.extend_from_slice(&self.header_bytes());
+
+        // AHS (if any) - not implemented yet, sent as zeros
+        buf.resize(BHS_SIZE + ahs_bytes, 0);
+
+        // Data segment, padded to a 4-byte boundary
+        buf.extend_from_slice(&self.data);
+        buf.resize(total_len, 0);
+
+        buf
+    }
+
+    /// Serialize just the 48-byte BHS
+    ///
+    /// The data segment length is taken from `data`, so a writer can send
+    /// this header followed by `data` and padding without building the
+    /// whole PDU in one buffer.
+    pub fn header_bytes(&self) -> [u8; BHS_SIZE] {
+        let mut buf = [0u8; BHS_SIZE];
 
         // Byte 0: Immediate flag and Opcode
-        let byte0 = (if self.immediate { 0x40 } else { 0 }) | (self.opcode & 0x3F);
-        buf.push(byte0);
+        buf[0] = (if self.immediate { 0x40 } else { 0 }) | (self.opcode & 0x3F);
 
         // Byte 1: Flags
-        buf.push(self.flags);
+        buf[1] = self.flags;
 
         // Bytes 2-3: Reserved (opcode-specific)
         // Special case for SCSI Response: bytes 2-3 are Response and Status
         // Special case for SCSI Data-In: byte 3 is Status if S bit is set
         // Special case for Login Request/Response: bytes 2-3 are version info
         if self.opcode == opcode::SCSI_RESPONSE {
-            buf.push(self.specific[0]); // Response (byte 2)
-            buf.push(self.specific[1]); // Status (byte 3)
+            buf[2] = self.specific[0]; // Response (byte 2)
+            buf[3] = self.specific[1]; // Status (byte 3)
         } else if self.opcode == opcode::SCSI_DATA_IN && (self.flags & 0x01) != 0 {
-            buf.push(0); // Reserved (byte 2)
-            buf.push(self.specific[27]); // Status (byte 3) if S bit is set
-        } else if self.opcode == opcode::LOGIN_REQUEST || self.opcode == opcode::LOGIN_RESPONSE {
-            // Write version_or_reserved for Login PDUs
-            buf.push((self.version_or_reserved >> 8) as u8); // High byte (version-max or active version)
-            buf.push((self.version_or_reserved & 0xFF) as u8); // Low byte (version-min or reserved)
-        } else {
-            buf.push(0);
-            buf.push(0);
+            buf[3] = self.specific[27]; // Status (byte 3) if S bit is set
+        } else if self.opcode == opcode::LOGIN_REQUEST || self.opcode == opcode::LOGIN_RESPONSE
+            || self.opcode == opcode::REJECT || self.opcode == opcode::TASK_MANAGEMENT_RESPONSE {
+            // Write version_or_reserved for Login PDUs (Reject and Task
+            // Management Response: byte 2 is the reason or response)
+            BigEndian::write_u16(&mut buf[2..4], self.version_or_reserved);
         }
 
         // Byte 4: Total AHS Length
-        buf.push(self.ahs_length);
+        buf[4] = self.ahs_length;
 
         // Bytes 5-7: Data Segment Length (3 bytes, big-endian)
-        let data_len = self.data.len() as u32;
-        buf.push(((data_len >> 16) & 0xFF) as u8);
-        buf.write_u16::<BigEndian>((data_len & 0xFFFF) as u16).unwrap();
+        BigEndian::write_u24(&mut buf[5..8], self.data.len() as u32);
 
         // Bytes 8-15: LUN field
         // According to RFC 3720, LUN is only in:
         // - SCSI Command PDU
         // - SCSI Data-Out PDU
         // - Task Management Function PDU
+        // Login Request/Response carry ISID and TSIH here instead.
         // All other PDUs should have reserved/0 in this field
-        let write_lun = matches!(self.opcode, opcode::SCSI_COMMAND | opcode::SCSI_DATA_OUT | opcode::TASK_MANAGEMENT_REQUEST);
+        let write_lun = matches!(self.opcode, opcode::SCSI_COMMAND | opcode::SCSI_DATA_OUT | opcode::TASK_MANAGEMENT_REQUEST
+            | opcode::LOGIN_REQUEST | opcode::LOGIN_RESPONSE);
         if write_lun {
-            buf.write_u64::<BigEndian>(self.lun).unwrap();
-        } else {
-            // For other PDU types (including SCSI Response), this field is reserved and should be 0
-            buf.write_u64::<BigEndian>(0).unwrap();
+            BigEndian::write_u64(&mut buf[8..16], self.lun);
         }
 
         // Bytes 16-19: Initiator Task Tag
-        buf.write_u32::<BigEndian>(self.itt).unwrap();
+        BigEndian::write_u32(&mut buf[16..20], self.itt);
 
         // Bytes 20-47: Opcode-specific fields
-        buf.extend_from_slice(&self.specific);
-
-        // AHS (if any) - not implemented yet, would go here
-
-        // Data segment
-        buf.extend_from_slice(&self.data);
-
-        // Pad to 4-byte boundary
-        while buf.len() < total_len {
-            buf.push(0);
-        }
+        buf[20..48].copy_from_slice(&self.specific);
 
         buf
     }
@@ -407,6 +399,16 @@ impl IscsiPdu {
 
     /// Parse Login Request fields
     pub fn parse_login_request(&self) -> ScsiResult<LoginRequest> {
+        let mut login = self.parse_login_header()?;
+        login.parameters = parse_text_parameters(&self.data)?;
+        Ok(login)
+    }
+
+    /// Parse Login Request header fields, leaving `parameters` empty
+    ///
+    /// The login path reads the text parameters in place with
+    /// [`text_parameters`] rather than copying them out.
+    pub fn parse_login_header(&self) -> ScsiResult<LoginRequest> {
         if self.opcode != opcode::LOGIN_REQUEST {
             return Err(IscsiError::InvalidPdu(format!(
                 "Expected Login Request opcode 0x03, got 0x{:02x}",
@@ -444,7 +446,7 @@ impl IscsiPdu {
             nsg,
             version_max,
             version_min,
-            parameters: parse_text_parameters(&self.data)?,
+            parameters: Vec::new(),
         })
     }
 
@@ -907,6 +909,176 @@ pub struct LogoutRequest {
     pub exp_stat_sn: u32,
 }
 
+// ============================================================================
+// Task Management Function PDU helpers
+// ============================================================================
+
+/// Task management function codes (RFC 3720 Section 10.5.1)
+pub mod tmf_function {
+    pub const ABORT_TASK: u8 = 1;
+    pub const ABORT_TASK_SET: u8 = 2;
+    pub const CLEAR_ACA: u8 = 3;
+    pub const CLEAR_TASK_SET: u8 = 4;
+    pub const LOGICAL_UNIT_RESET: u8 = 5;
+    pub const TARGET_WARM_RESET: u8 = 6;
+    pub const TARGET_COLD_RESET: u8 = 7;
+    pub const TASK_REASSIGN: u8 = 8;
+}
+
+/// Task management response codes (RFC 3720 Section 10.6.1)
+pub mod tmf_response {
+    pub const FUNCTION_COMPLETE: u8 = 0;
+    pub const TASK_DOES_NOT_EXIST: u8 = 1;
+    pub const LUN_DOES_NOT_EXIST: u8 = 2;
+    pub const TASK_STILL_ALLEGIANT: u8 = 3;
+    pub const TASK_REASSIGNMENT_NOT_SUPPORTED: u8 = 4;
+    pub const FUNCTION_NOT_SUPPORTED: u8 = 5;
+    pub const AUTHORIZATION_FAILED: u8 = 6;
+    pub const FUNCTION_REJECTED: u8 = 255;
+}
+
+impl IscsiPdu {
+    /// Create an immediate Task Management Function Request PDU
+    ///
+    /// `referenced_task_tag` and `ref_cmd_sn` name the task for ABORT TASK;
+    /// pass 0xFFFFFFFF and 0 for the other functions.
+    pub fn task_management_request(
+        function: u8,
+        lun: u64,
+        itt: u32,
+        referenced_task_tag: u32,
+        cmd_sn: u32,
+        exp_stat_sn: u32,
+        ref_cmd_sn: u32,
+    ) -> Self {
+        let mut pdu = IscsiPdu::new();
+        pdu.opcode = opcode::TASK_MANAGEMENT_REQUEST;
+        pdu.immediate = true;
+        pdu.flags = flags::FINAL | (function & 0x7F);
+        pdu.lun = lun;
+        pdu.itt = itt;
+
+        // Referenced Task Tag
+        pdu.specific[0..4].copy_from_slice(&referenced_task_tag.to_be_bytes());
+        // CmdSN
+        pdu.specific[4..8].copy_from_slice(&cmd_sn.to_be_bytes());
+        // ExpStatSN
+        pdu.specific[8..12].copy_from_slice(&exp_stat_sn.to_be_bytes());
+        // RefCmdSN
+        pdu.specific[12..16].copy_from_slice(&ref_cmd_sn.to_be_bytes());
+
+        pdu
+    }
+
+    /// Parse Task Management Function Request
+    pub fn parse_task_management_request(&self) -> ScsiResult<TaskManagementRequest> {
+        if self.opcode != opcode::TASK_MANAGEMENT_REQUEST {
+            return Err(IscsiError::InvalidPdu(format!(
+                "Expected Task Management Request opcode 0x02, got 0x{:02x}",
+                self.opcode
+            )));
+        }
+
+        Ok(TaskManagementRequest {
+            itt: self.itt,
+            function: self.flags & 0x7F,
+            lun: self.lun,
+            referenced_task_tag: BigEndian::read_u32(&self.specific[0..4]),
+            cmd_sn: BigEndian::read_u32(&self.specific[4..8]),
+            exp_stat_sn: BigEndian::read_u32(&self.specific[8..12]),
+            ref_cmd_sn: BigEndian::read_u32(&self.specific[12..16]),
+        })
+    }
+
+    /// Create a Task Management Function Response PDU
+    pub fn task_management_response(
+        itt: u32,
+        stat_sn: u32,
+        exp_cmd_sn: u32,
+        max_cmd_sn: u32,
+        response: u8,
+    ) -> Self {
+        let mut pdu = IscsiPdu::new();
+        pdu.opcode = opcode::TASK_MANAGEMENT_RESPONSE;
+        pdu.flags = flags::FINAL;
+        // Response code is BHS byte 2
+        pdu.version_or_reserved = (response as u16) << 8;
+        pdu.itt = itt;
+
+        // StatSN
+        pdu.specific[4..8].copy_from_slice(&stat_sn.to_be_bytes());
+        // ExpCmdSN
+        pdu.specific[8..12].copy_from_slice(&exp_cmd_sn.to_be_bytes());
+        // MaxCmdSN
+        pdu.specific[12..16].copy_from_slice(&max_cmd_sn.to_be_bytes());
+
+        pdu
+    }
+}
+
+/// Parsed Task Management Function Request
+#[derive(Debug, Clone)]
+pub struct TaskManagementRequest {
+    pub itt: u32,
+    pub function: u8,
+    pub lun: u64,
+    pub referenced_task_tag: u32,
+    pub cmd_sn: u32,
+    pub exp_stat_sn: u32,
+    pub ref_cmd_sn: u32,
+}
+
+// ============================================================================
+// Reject PDU helpers
+// ============================================================================
+
+/// Reject reason codes (RFC 3720 Section 10.17.1)
+pub mod reject_reason {
+    pub const DATA_DIGEST_ERROR: u8 = 0x02;
+    pub const SNACK_REJECT: u8 = 0x03;
+    pub const PROTOCOL_ERROR: u8 = 0x04;
+    pub const COMMAND_NOT_SUPPORTED: u8 = 0x05;
+    pub const IMMEDIATE_COMMAND_REJECT: u8 = 0x06;
+    pub const TASK_IN_PROGRESS: u8 = 0x07;
+    pub const INVALID_DATA_ACK: u8 = 0x08;
+    pub const INVALID_PDU_FIELD: u8 = 0x09;
+    pub const OUT_OF_RESOURCES: u8 = 0x0A;
+    pub const NEGOTIATION_RESET: u8 = 0x0B;
+    pub const WAITING_FOR_LOGOUT: u8 = 0x0C;
+}
+
+impl IscsiPdu {
+    /// Create a Reject PDU carrying the header of the rejected PDU
+    ///
+    /// RFC 3720 Section 10.17
+    pub fn reject(
+        reason: u8,
+        stat_sn: u32,
+        exp_cmd_sn: u32,
+        max_cmd_sn: u32,
+        rejected_header: &[u8; BHS_SIZE],
+    ) -> Self {
+        let mut pdu = IscsiPdu::new();
+        pdu.opcode = opcode::REJECT;
+        pdu.flags = flags::FINAL;
+        pdu.version_or_reserved = (reason as u16) << 8;
+        pdu.itt = 0xFFFF_FFFF;
+
+        // StatSN
+        pdu.specific[4..8].copy_from_slice(&stat_sn.to_be_bytes());
+        // ExpCmdSN
+        pdu.specific[8..12].copy_from_slice(&exp_cmd_sn.to_be_bytes());
+        // MaxCmdSN
+        pdu.specific[12..16].copy_from_slice(&max_cmd_sn.to_be_bytes());
+
+        // Data segment: the complete header of the rejected PDU
+        pdu.data = rejected_header.to_vec();
+        pdu.data_length = BHS_SIZE as u32;
+
+        pdu
+    }
+}
+
 // ============================================================================
 // Text Request/Response PDU helpers
 // ============================================================================
@@ -1014,14 +1186,31 @@ pub fn parse_text_parameters(data: &[u8]) -> ScsiResult<Vec<(String, String)>> {
 pub fn serialize_text_parameters(params: &[(String, String)]) -> Vec<u8> {
     let mut data = Vec::new();
     for (key, value) in params {
-        data.extend_from_slice(key.as_bytes());
-        data.push(b'=');
-        data.extend_from_slice(value.as_bytes());
-        data.push(0);
+        push_text_parameter(&mut data, key, value);
     }
     data
 }
 
+/// Iterate iSCSI text parameters in place, without copying them
+///
+/// Yields borrowed (key, value) pairs in wire order. Entries that are
+/// empty, lack an '=' or are not valid UTF-8 are skipped.
+pub fn text_parameters(data: &[u8]) -> impl Iterator<Item = (&str, &str)> {
+    data.split(|&b| b == 0)
+        .filter_map(|chunk| std::str::from_utf8(chunk).ok()?.split_once('='))
+}
+
+/// Append one null-terminated key=value pair to a data segment
+pub fn push_text_parameter(data: &mut Vec<u8>, key: &str, value: impl std::fmt::Display) {
+    use std::io::Write;
+
+    data.extend_from_slice(key.as_bytes());
+    data.push(b'=');
+    // Writing into a Vec cannot fail
+    let _ = write!(data, "{}", value);
+    data.push(0);
+}
+
 // ============================================================================
 // Unit Tests
 // ============================================================================
@@ -1102,6 +1291,19 @@ mod tests {
         assert_eq!(data, b"Key1=Value1\0Key2=Value2\0");
     }
 
+    #[test]
+    fn test_text_parameters_borrowed() {
+        let data = b"Key1=Value1\0\0NoEquals\0Key2=a=b\0\xFF=bad\0Key3=";
+        let params: Vec<_> = text_parameters(data).collect();
+        assert_eq!(params, vec![("Key1", "Value1"), ("Key2", "a=b"), ("Key3", "")]);
+        assert_eq!(text_parameters(b"").count(), 0);
+
+        let mut out = Vec::new();
+        push_text_parameter(&mut out, "MaxBurstLength", 262144u32);
+        push_text_parameter(&mut out, "InitialR2T", "Yes");
+        assert_eq!(out, b"MaxBurstLength=262144\0InitialR2T=Yes\0");
+    }
+
     #[test]
     fn test_login_response_creation() {
         let isid = [0x00, 0x02, 0x3D, 0x00, 0x00, 0x00];
@@ -1197,6 +1399,24 @@ mod tests {
         assert_eq!(pdu.specific[0], logout_response::SUCCESS);
     }
 
+    #[test]
+    fn test_reject_creation() {
+        let mut header = [0u8; BHS_SIZE];
+        header[0] = opcode::SCSI_DATA_OUT;
+        header[16..20].copy_from_slice(&7u32.to_be_bytes());
+
+        let pdu = IscsiPdu::reject(reject_reason::DATA_DIGEST_ERROR, 5, 10, 20, &header);
+        let bytes = pdu.to_bytes();
+
+        assert_eq!(bytes[0], opcode::REJECT);
+        assert_eq!(bytes[1], flags::FINAL);
+        assert_eq!(bytes[2], reject_reason::DATA_DIGEST_ERROR);
+        assert_eq!(BigEndian::read_u32(&bytes[16..20]), 0xFFFF_FFFF);
+        assert_eq!(BigEndian::read_u32(&bytes[24..28]), 5);
+        assert_eq!(pdu.data_length, 48);
+        assert_eq!(&bytes[BHS_SIZE..], &header[..]);
+    }
+
     #[test]
     fn test_opcode_names() {
         let mut pdu = IscsiPdu::new();
@@ -22,6 +22,25 @@ pub trait ScsiBlockDevice: Send + Sync {
     /// Vector containing the requested data (length = blocks * block_size)
     fn read(&self, lba: u64, blocks: u32, block_size: u32) -> ScsiResult<Vec<u8>>;
 
+    /// Read blocks into a caller-supplied buffer
+    ///
+    /// `buf` is exactly `blocks * block_size` bytes. The target serves
+    /// READ(10)/READ(16) by calling this once per Data-In PDU with the PDU's
+    /// own data segment, so a backend that overrides it fills outgoing PDUs
+    /// directly. The default calls `read` and copies the result.
+    fn read_into(&self, lba: u64, blocks: u32, block_size: u32, buf: &mut [u8]) -> ScsiResult<()> {
+        let data = self.read(lba, blocks, block_size)?;
+        if data.len() != buf.len() {
+            return Err(IscsiError::Scsi(format!(
+                "read returned {} bytes, expected {}",
+                data.len(),
+                buf.len()
+            )));
+        }
+        buf.copy_from_slice(&data);
+        Ok(())
+    }
+
     /// Write blocks to the device
     ///
     /// # Arguments
@@ -42,6 +61,67 @@ pub trait ScsiBlockDevice: Send + Sync {
         Ok(())
     }
 
+    /// Whether the target may call `write_shared` and `flush_shared`
+    ///
+    /// The target keeps the device behind a read-write lock. Reads from all
+    /// sessions share it, but `write` and `flush` need `&mut self`, so each
+    /// one takes the lock exclusively and stalls every other session. A
+    /// backend that synchronises internally (for example with per-stripe
+    /// locks) returns true, and its writes then run alongside reads and
+    /// other writes. Checked once, when the target is built.
+    fn concurrent_writes(&self) -> bool {
+        false
+    }
+
+    /// Write blocks through a shared reference; used when `concurrent_writes` is true
+    ///
+    /// Calls can run at the same time as each other and as `read`, so the
+    /// backend must serialise overlapping ranges itself.
+    fn write_shared(&self, _lba: u64, _data: &[u8], _block_size: u32) -> ScsiResult<()> {
+        Err(IscsiError::Scsi("Device does not support concurrent writes".to_string()))
+    }
+
+    /// Flush through a shared reference; used when `concurrent_writes` is true
+    fn flush_shared(&self) -> ScsiResult<()> {
+        Ok(())
+    }
+
+    /// Whether completed writes may sit in a volatile cache until a flush
+    ///
+    /// MODE SENSE reports this as the WCE bit of the Caching mode page. The
+    /// target flushes after every WRITE with FUA set and on SYNCHRONIZE
+    /// CACHE whatever this returns.
+    fn write_cache_enabled(&self) -> bool {
+        false
+    }
+
+    /// Whether the device can deallocate blocks
+    ///
+    /// When true the target accepts UNMAP and WRITE SAME(16) with the UNMAP
+    /// bit, and advertises thin provisioning: the Logical Block Provisioning
+    /// VPD page, LBPME in READ CAPACITY(16) and the unmap limits in Block
+    /// Limits. Deallocated blocks must read back as zeros (LBPRZ).
+    fn supports_unmap(&self) -> bool {
+        false
+    }
+
+    /// Blocks per allocation unit, reported as the optimal unmap granularity
+    ///
+    /// Unmapping less than a whole unit only zeroes it.
+    fn unmap_granularity(&self) -> u32 {
+        1
+    }
+
+    /// Deallocate `blocks` blocks from `lba`; they read as zeros afterwards
+    fn unmap(&mut self, _lba: u64, _blocks: u64) -> ScsiResult<()> {
+        Err(IscsiError::Scsi("Device does not support unmap".to_string()))
+    }
+
+    /// Deallocate through a shared reference; used when `concurrent_writes` is true
+    fn unmap_shared(&self, _lba: u64, _blocks: u64) -> ScsiResult<()> {
+        Err(IscsiError::Scsi("Device does not support unmap".to_string()))
+    }
+
     /// Get vendor identification (8 chars max)
     fn vendor_id(&self) -> &str {
         "ISCSI   "
@@ -58,6 +138,78 @@ pub trait ScsiBlockDevice: Send + Sync {
     }
 }
 
+/// Boxed devices forward everything, so one target can export LUNs with
+/// different backends as `Box<dyn ScsiBlockDevice>`.
+impl<T: ScsiBlockDevice + ?Sized> ScsiBlockDevice for Box<T> {
+    fn read(&self, lba: u64, blocks: u32, block_size: u32) -> ScsiResult<Vec<u8>> {
+        (**self).read(lba, blocks, block_size)
+    }
+
+    fn read_into(&self, lba: u64, blocks: u32, block_size: u32, buf: &mut [u8]) -> ScsiResult<()> {
+        (**self).read_into(lba, blocks, block_size, buf)
+    }
+
+    fn write(&mut self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        (**self).write(lba, data, block_size)
+    }
+
+    fn capacity(&self) -> u64 {
+        (**self).capacity()
+    }
+
+    fn block_size(&self) -> u32 {
+        (**self).block_size()
+    }
+
+    fn flush(&mut self) -> ScsiResult<()> {
+        (**self).flush()
+    }
+
+    fn concurrent_writes(&self) -> bool {
+        (**self).concurrent_writes()
+    }
+
+    fn write_shared(&self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        (**self).write_shared(lba, data, block_size)
+    }
+
+    fn flush_shared(&self) -> ScsiResult<()> {
+        (**self).flush_shared()
+    }
+
+    fn write_cache_enabled(&self) -> bool {
+        (**self).write_cache_enabled()
+    }
+
+    fn supports_unmap(&self) -> bool {
+        (**self).supports_unmap()
+    }
+
+    fn unmap_granularity(&self) -> u32 {
+        (**self).unmap_granularity()
+    }
+
+    fn unmap(&mut self, lba: u64, blocks: u64) -> ScsiResult<()> {
+        (**self).unmap(lba, blocks)
+    }
+
+    fn unmap_shared(&self, lba: u64, blocks: u64) -> ScsiResult<()> {
+        (**self).unmap_shared(lba, blocks)
+    }
+
+    fn vendor_id(&self) -> &str {
+        (**self).vendor_id()
+    }
+
+    fn product_id(&self) -> &str {
+        (**self).product_id()
+    }
+
+    fn product_rev(&self) -> &str {
+        (**self).product_rev()
+    }
+}
+
 /// SCSI command opcodes (subset needed for basic block storage)
 #[repr(u8)]
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -72,11 +224,13 @@ pub enum ScsiOpcode {
     Write10 = 0x2A,
     Verify10 = 0x2F,
     SynchronizeCache10 = 0x35,
+    Unmap = 0x42,
     ModeSense10 = 0x5A,
     Read16 = 0x88,
     Write16 = 0x8A,
     Verify16 = 0x8F,
     SynchronizeCache16 = 0x91,
+    WriteSame16 = 0x93,
     ServiceActionIn16 = 0x9E, // READ CAPACITY 16 uses this
     ReportLuns = 0xA0,
 }
@@ -94,11 +248,13 @@ impl ScsiOpcode {
             0x2A => Some(ScsiOpcode::Write10),
             0x2F => Some(ScsiOpcode::Verify10),
             0x35 => Some(ScsiOpcode::SynchronizeCache10),
+            0x42 => Some(ScsiOpcode::Unmap),
             0x5A => Some(ScsiOpcode::ModeSense10),
             0x88 => Some(ScsiOpcode::Read16),
             0x8A => Some(ScsiOpcode::Write16),
             0x8F => Some(ScsiOpcode::Verify16),
             0x91 => Some(ScsiOpcode::SynchronizeCache16),
+            0x93 => Some(ScsiOpcode::WriteSame16),
             0x9E => Some(ScsiOpcode::ServiceActionIn16),
             0xA0 => Some(ScsiOpcode::ReportLuns),
             _ => None,
@@ -144,6 +300,7 @@ pub mod asc {
     pub const LBA_OUT_OF_RANGE: u8 = 0x21;
     pub const INVALID_FIELD_IN_CDB: u8 = 0x24;
     pub const LOGICAL_UNIT_NOT_SUPPORTED: u8 = 0x25;
+    pub const INVALID_FIELD_IN_PARAMETER_LIST: u8 = 0x26;
     pub const WRITE_PROTECTED: u8 = 0x27;
     pub const POWER_ON_RESET: u8 = 0x29;
     pub const MEDIUM_NOT_PRESENT: u8 = 0x3A;
@@ -208,6 +365,22 @@ impl SenseData {
             .with_info(lba)
     }
 
+    /// Create sense data for a CDB field the device does not accept
+    pub fn invalid_field_in_cdb() -> Self {
+        SenseData::new(sense_key::ILLEGAL_REQUEST, asc::INVALID_FIELD_IN_CDB, 0)
+    }
+
+    /// Create sense data for a bad field in a command's parameter list
+    pub fn invalid_field_in_parameter_list() -> Self {
+        SenseData::new(sense_key::ILLEGAL_REQUEST, asc::INVALID_FIELD_IN_PARAMETER_LIST, 0)
+    }
+
+    /// Create the unit attention a reset leaves for other initiators;
+    /// `ascq` is 0x03 after a LUN reset and 0x00 after a target reset
+    pub fn reset_occurred(ascq: u8) -> Self {
+        SenseData::new(sense_key::UNIT_ATTENTION, asc::POWER_ON_RESET, ascq)
+    }
+
     /// Create sense data for medium error
     pub fn medium_error() -> Self {
         SenseData::new(sense_key::MEDIUM_ERROR, 0x11, 0x00) // Unrecovered read error
@@ -259,15 +432,50 @@ impl ScsiResponse {
     }
 }
 
+/// Most block descriptors one UNMAP may carry, reported in Block Limits
+pub const MAX_UNMAP_DESCRIPTORS: usize = 256;
+
+/// Most blocks one WRITE SAME may cover, reported in Block Limits
+pub const MAX_WRITE_SAME_BLOCKS: u32 = 1 << 20;
+
+/// UNMAP parameter list header size; each block descriptor is 16 bytes
+const UNMAP_HEADER_LEN: usize = 8;
+
+/// Caching mode page code (SBC-3 Section 6.4.5)
+const CACHING_MODE_PAGE: u8 = 0x08;
+
+/// DPOFUA bit of the mode parameter header's device-specific parameter
+const DEVICE_SPECIFIC_DPOFUA: u8 = 0x10;
+
+/// Highest LUN the flat space addressing method can express (SAM-5 Section 4.7.7)
+pub const MAX_LUN: u16 = 0x3FFF;
+
 /// SCSI Command Handler
 pub struct ScsiHandler;
 
 impl ScsiHandler {
     /// Handle a SCSI command and return response
+    ///
+    /// The device is answered for as LUN 0, the only logical unit.
     pub fn handle_command(
         cdb: &[u8],
         device: &dyn ScsiBlockDevice,
         write_data: Option<&[u8]>,
+    ) -> ScsiResult<ScsiResponse> {
+        Self::handle_lun_command(cdb, device, write_data, 0, &[0])
+    }
+
+    /// Handle a SCSI command addressed to `lun` of a target exporting `luns`
+    ///
+    /// REPORT LUNS lists `luns`, and the serial number and device
+    /// identifier in the VPD pages are derived from `lun` so an initiator
+    /// sees each logical unit as a distinct device.
+    pub fn handle_lun_command(
+        cdb: &[u8],
+        device: &dyn ScsiBlockDevice,
+        write_data: Option<&[u8]>,
+        lun: u16,
+        luns: &[u16],
     ) -> ScsiResult<ScsiResponse> {
         if cdb.is_empty() {
             return Ok(ScsiResponse::check_condition(SenseData::invalid_command()));
@@ -280,20 +488,22 @@ impl ScsiHandler {
 
         match ScsiOpcode::from_u8(opcode) {
             Some(ScsiOpcode::TestUnitReady) => Self::handle_test_unit_ready(),
-            Some(ScsiOpcode::Inquiry) => Self::handle_inquiry(cdb, device),
+            Some(ScsiOpcode::Inquiry) => Self::handle_inquiry(cdb, device, lun),
             Some(ScsiOpcode::ReadCapacity10) => Self::handle_read_capacity_10(device),
             Some(ScsiOpcode::ServiceActionIn16) => Self::handle_service_action_in_16(cdb, device),
             Some(ScsiOpcode::Read10) => Self::handle_read_10(cdb, device),
             Some(ScsiOpcode::Read16) => Self::handle_read_16(cdb, device),
             Some(ScsiOpcode::Write10) => Self::handle_write_10(cdb, device, write_data),
             Some(ScsiOpcode::Write16) => Self::handle_write_16(cdb, device, write_data),
-            Some(ScsiOpcode::ModeSense6) => Self::handle_mode_sense_6(cdb),
-            Some(ScsiOpcode::ModeSense10) => Self::handle_mode_sense_10(cdb),
+            Some(ScsiOpcode::ModeSense6) => Self::handle_mode_sense_6(cdb, device),
+            Some(ScsiOpcode::ModeSense10) => Self::handle_mode_sense_10(cdb, device),
             Some(ScsiOpcode::RequestSense) => Self::handle_request_sense(cdb),
             Some(ScsiOpcode::SynchronizeCache10) | Some(ScsiOpcode::SynchronizeCache16) => {
                 Self::handle_synchronize_cache(device)
             }
-            Some(ScsiOpcode::ReportLuns) => Self::handle_report_luns(cdb),
+            Some(ScsiOpcode::ReportLuns) => Self::handle_report_luns(cdb, luns),
+            Some(ScsiOpcode::Unmap) => Self::handle_unmap(cdb, device, write_data),
+            Some(ScsiOpcode::WriteSame16) => Self::handle_write_same_16(cdb, device, write_data),
             Some(ScsiOpcode::StartStopUnit) => Self::handle_start_stop_unit(cdb),
             Some(ScsiOpcode::Verify10) | Some(ScsiOpcode::Verify16) => {
                 // VERIFY without BYTCHK just checks the medium - always succeed
@@ -313,7 +523,7 @@ impl ScsiHandler {
     }
 
     /// Handle INQUIRY (0x12)
-    fn handle_inquiry(cdb: &[u8], device: &dyn ScsiBlockDevice) -> ScsiResult<ScsiResponse> {
+    fn handle_inquiry(cdb: &[u8], device: &dyn ScsiBlockDevice, lun: u16) -> ScsiResult<ScsiResponse> {
         if cdb.len() < 6 {
             return Ok(ScsiResponse::check_condition(SenseData::invalid_command()));
         }
@@ -324,7 +534,7 @@ impl ScsiHandler {
 
         if evpd != 0 {
             // VPD page request
-            return Self::handle_inquiry_vpd(page_code, alloc_len, device);
+            return Self::handle_inquiry_vpd(page_code, alloc_len, device, lun);
         }
 
         // Standard INQUIRY response (36 bytes minimum)
@@ -388,19 +598,23 @@ impl ScsiHandler {
     }
 
     /// Handle INQUIRY VPD pages
-    fn handle_inquiry_vpd(page_code: u8, alloc_len: usize, _device: &dyn ScsiBlockDevice) -> ScsiResult<ScsiResponse> {
+    fn handle_inquiry_vpd(page_code: u8, alloc_len: usize, device: &dyn ScsiBlockDevice, lun: u16) -> ScsiResult<ScsiResponse> {
         match page_code {
             0x00 => {
                 // Supported VPD pages
                 let mut data = vec![0x00, 0x00, 0x00, 4]; // Device type, page code, reserved, page length
                 data.extend_from_slice(&[0x00, 0x80, 0x83, 0xB0]); // Supported pages
+                if device.supports_unmap() {
+                    data.push(0xB2);
+                }
+                data[3] = (data.len() - 4) as u8;
                 data.truncate(alloc_len.min(data.len()));
                 Ok(ScsiResponse::good(data))
             }
             0x80 => {
                 // Unit Serial Number
                 let mut data = vec![0x00, 0x80, 0x00, 16]; // Device type, page code, reserved, page length
-                data.extend_from_slice(b"ISCSI00000000001"); // 16-char serial
+                data.extend_from_slice(format!("ISCSI{:011}", lun as u32 + 1).as_bytes()); // 16-char serial
                 data.truncate(alloc_len.min(data.len()));
                 Ok(ScsiResponse::good(data))
             }
@@ -409,10 +623,12 @@ impl ScsiHandler {
                 let mut data = vec![0x00, 0x83, 0x00, 0x00]; // Header
 
                 // NAA descriptor
-                let naa_desc = [
+                let mut naa_desc = [
                     0x01, 0x03, 0x00, 0x08, // Code set=binary, type=NAA, length=8
                     0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, // NAA-6 identifier
                 ];
+                // Low bytes of the identifier number the logical unit
+                BigEndian::write_u16(&mut naa_desc[10..12], lun + 1);
                 data.extend_from_slice(&naa_desc);
 
                 // Update page length
@@ -435,6 +651,29 @@ impl ScsiHandler {
                 // Optimal transfer length
                 BigEndian::write_u32(&mut data[12..16], 128); // 128 blocks optimal
 
+                // Maximum WRITE SAME length (in blocks)
+                BigEndian::write_u64(&mut data[36..44], MAX_WRITE_SAME_BLOCKS as u64);
+
+                if device.supports_unmap() {
+                    // WSNZ: WRITE SAME with zero blocks is rejected
+                    data[4] = 0x01;
+                    // Maximum unmap LBA count (no limit) and block descriptor count
+                    BigEndian::write_u32(&mut data[20..24], 0xFFFF_FFFF);
+                    BigEndian::write_u32(&mut data[24..28], MAX_UNMAP_DESCRIPTORS as u32);
+                    // Optimal unmap granularity
+                    BigEndian::write_u32(&mut data[28..32], device.unmap_granularity());
+                }
+
+                data.truncate(alloc_len.min(data.len()));
+                Ok(ScsiResponse::good(data))
+            }
+            0xB2 if device.supports_unmap() => {
+                // Logical Block Provisioning
+                let mut data = vec![0x00, 0xB2, 0x00, 4, 0, 0, 0, 0];
+                // LBPU: UNMAP, LBPWS: WRITE SAME(16) with UNMAP, LBPRZ: unmapped blocks read zeros
+                data[5] = 0x80 | 0x40 | 0x04;
+                // Provisioning type: thin
+                data[6] = 0x02;
                 data.truncate(alloc_len.min(data.len()));
                 Ok(ScsiResponse::good(data))
             }
@@ -494,6 +733,11 @@ impl ScsiHandler {
         // Block size (4 bytes)
         BigEndian::write_u32(&mut data[8..12], block_size);
 
+        // LBPME: thin provisioned; LBPRZ: unmapped blocks read as zeros
+        if device.supports_unmap() {
+            data[14] = 0x80 | 0x40;
+        }
+
         // Truncate to allocation length
         data.truncate(alloc_len.min(data.len()));
 
@@ -648,52 +892,70 @@ impl ScsiHandler {
     }
 
     /// Handle MODE SENSE (6) - 0x1A
-    fn handle_mode_sense_6(cdb: &[u8]) -> ScsiResult<ScsiResponse> {
+    fn handle_mode_sense_6(cdb: &[u8], device: &dyn ScsiBlockDevice) -> ScsiResult<ScsiResponse> {
         if cdb.len() < 6 {
             return Ok(ScsiResponse::check_condition(SenseData::invalid_command()));
         }
 
+        let page_control = cdb[2] >> 6;
         let page_code = cdb[2] & 0x3F;
         let alloc_len = cdb[4] as usize;
 
-        // Return minimal mode parameter header
+        // Mode parameter header, then any pages
         let mut data = vec![0u8; 4];
-        data[0] = 3; // Mode data length (excluding this byte)
         data[1] = 0; // Medium type
-        data[2] = 0; // Device-specific parameter (not write protected)
+        data[2] = DEVICE_SPECIFIC_DPOFUA; // Not write protected, DPO and FUA supported
         data[3] = 0; // Block descriptor length
-
-        // Add page data if requested
-        if page_code == 0x3F {
-            // Return all pages - just return header for now
-        }
+        data.extend_from_slice(&Self::mode_pages(page_code, page_control, device));
+        data[0] = (data.len() - 1) as u8; // Mode data length (excluding this byte)
 
         data.truncate(alloc_len.min(data.len()));
         Ok(ScsiResponse::good(data))
     }
 
     /// Handle MODE SENSE (10) - 0x5A
-    fn handle_mode_sense_10(cdb: &[u8]) -> ScsiResult<ScsiResponse> {
+    fn handle_mode_sense_10(cdb: &[u8], device: &dyn ScsiBlockDevice) -> ScsiResult<ScsiResponse> {
         if cdb.len() < 10 {
             return Ok(ScsiResponse::check_condition(SenseData::invalid_command()));
         }
 
-        let _page_code = cdb[2] & 0x3F;
+        let page_control = cdb[2] >> 6;
+        let page_code = cdb[2] & 0x3F;
         let alloc_len = BigEndian::read_u16(&cdb[7..9]) as usize;
 
-        // Return minimal mode parameter header (8 bytes for MODE SENSE 10)
+        // Mode parameter header (8 bytes for MODE SENSE 10), then any pages
         let mut data = vec![0u8; 8];
-        BigEndian::write_u16(&mut data[0..2], 6); // Mode data length
         data[2] = 0; // Medium type
-        data[3] = 0; // Device-specific parameter
+        data[3] = DEVICE_SPECIFIC_DPOFUA; // Device-specific parameter
         data[4] = 0; // Reserved
         data[5] = 0; // Reserved
         BigEndian::write_u16(&mut data[6..8], 0); // Block descriptor length
+        data.extend_from_slice(&Self::mode_pages(page_code, page_control, device));
+        let mode_data_len = (data.len() - 2) as u16;
+        BigEndian::write_u16(&mut data[0..2], mode_data_len);
 
         data.truncate(alloc_len.min(data.len()));
         Ok(ScsiResponse::good(data))
     }
 
+    /// Mode pages for `page_code`; 0x3F returns all of them
+    ///
+    /// Only the Caching page (0x08) is implemented. MODE SELECT is not, so
+    /// the changeable-values form (page control 1) reports no changeable bits.
+    fn mode_pages(page_code: u8, page_control: u8, device: &dyn ScsiBlockDevice) -> Vec<u8> {
+        let mut pages = Vec::new();
+        if page_code == CACHING_MODE_PAGE || page_code == 0x3F {
+            let mut page = [0u8; 20];
+            page[0] = CACHING_MODE_PAGE;
+            page[1] = 0x12; // Page length
+            if page_control != 1 && device.write_cache_enabled() {
+                page[2] |= 0x04; // WCE; RCD stays clear, reads are always cached
+            }
+            pages.extend_from_slice(&page);
+        }
+        pages
+    }
+
     /// Handle REQUEST SENSE - 0x03
     fn handle_request_sense(cdb: &[u8]) -> ScsiResult<ScsiResponse> {
         if cdb.len() < 6 {
@@ -717,19 +979,90 @@ impl ScsiHandler {
         Ok(ScsiResponse::good_no_data())
     }
 
+    /// Handle UNMAP - 0x42
+    ///
+    /// Validates the CDB and, once it has arrived, the parameter list. As
+    /// with WRITE, the target does the deallocation itself.
+    fn handle_unmap(
+        cdb: &[u8],
+        device: &dyn ScsiBlockDevice,
+        parameters: Option<&[u8]>,
+    ) -> ScsiResult<ScsiResponse> {
+        if cdb.len() < 10 || !device.supports_unmap() {
+            return Ok(ScsiResponse::check_condition(SenseData::invalid_command()));
+        }
+
+        // ANCHOR: anchored blocks are not supported
+        let param_len = BigEndian::read_u16(&cdb[7..9]) as usize;
+        if cdb[1] & 0x01 != 0 || param_len > UNMAP_HEADER_LEN + 16 * MAX_UNMAP_DESCRIPTORS {
+            return Ok(ScsiResponse::check_condition(SenseData::invalid_field_in_cdb()));
+        }
+
+        match parameters.map(|data| Self::parse_unmap_parameters(data, device.capacity())) {
+            Some(Err(sense)) => Ok(ScsiResponse::check_condition(sense)),
+            _ => Ok(ScsiResponse::good_no_data()),
+        }
+    }
+
+    /// Handle WRITE SAME (16) - 0x93
+    ///
+    /// Validates the CDB and the single block of data; the target writes
+    /// it, or deallocates the range when the UNMAP bit is set and the block
+    /// is all zeros.
+    fn handle_write_same_16(
+        cdb: &[u8],
+        device: &dyn ScsiBlockDevice,
+        write_data: Option<&[u8]>,
+    ) -> ScsiResult<ScsiResponse> {
+        let (lba, blocks, unmap) = match Self::parse_write_same16_cdb(cdb) {
+            Some(parsed) => parsed,
+            None => return Ok(ScsiResponse::check_condition(SenseData::invalid_command())),
+        };
+
+        // ANCHOR is not supported, WSNZ rules out a zero block count, and
+        // the block count may not exceed the advertised maximum
+        if cdb[1] & 0x10 != 0
+            || blocks == 0
+            || blocks > MAX_WRITE_SAME_BLOCKS
+            || (unmap && !device.supports_unmap())
+        {
+            return Ok(ScsiResponse::check_condition(SenseData::invalid_field_in_cdb()));
+        }
+
+        if lba.checked_add(blocks as u64).is_none_or(|end| end > device.capacity()) {
+            return Ok(ScsiResponse::check_condition(
+                SenseData::lba_out_of_range((lba & 0xFFFF_FFFF) as u32)
+            ));
+        }
+
+        let expected_len = Self::parameter_data_length(cdb, device.block_size()).unwrap_or(0);
+        if let Some(data) = write_data {
+            if data.len() < expected_len {
+                log::debug!("WRITE SAME data too short: got {}, need {}", data.len(), expected_len);
+                return Ok(ScsiResponse::check_condition(
+                    SenseData::invalid_field_in_parameter_list()
+                ));
+            }
+        }
+
+        Ok(ScsiResponse::good_no_data())
+    }
+
     /// Handle REPORT LUNS - 0xA0
-    fn handle_report_luns(cdb: &[u8]) -> ScsiResult<ScsiResponse> {
+    fn handle_report_luns(cdb: &[u8], luns: &[u16]) -> ScsiResult<ScsiResponse> {
         if cdb.len() < 12 {
             return Ok(ScsiResponse::check_condition(SenseData::invalid_command()));
         }
 
         let alloc_len = BigEndian::read_u32(&cdb[6..10]) as usize;
 
-        // Report LUN 0 only
-        let mut data = vec![0u8; 16];
-        BigEndian::write_u32(&mut data[0..4], 8); // LUN list length (1 LUN * 8 bytes)
+        // 8-byte header, then one 8-byte entry per LUN
+        let mut data = vec![0u8; 8 + luns.len() * 8];
+        BigEndian::write_u32(&mut data[0..4], (luns.len() * 8) as u32); // LUN list length
         // data[4..8] reserved
-        // data[8..16] = LUN 0 (all zeros)
+        for (entry, &lun) in data[8..].chunks_exact_mut(8).zip(luns) {
+            BigEndian::write_u64(entry, Self::encode_lun(lun));
+        }
 
         data.truncate(alloc_len.min(data.len()));
         Ok(ScsiResponse::good(data))
@@ -741,6 +1074,28 @@ impl ScsiHandler {
         Ok(ScsiResponse::good_no_data())
     }
 
+    /// LUN number of an 8-byte LUN field from a PDU header
+    ///
+    /// Accepts single-level peripheral device (LUN < 256) and flat space
+    /// addresses. Some initiators put LUNs above 255 in the peripheral
+    /// method's bus field; that lands on the same number as flat space.
+    /// Anything else, including hierarchical addresses, is None.
+    pub fn decode_lun(lun: u64) -> Option<u16> {
+        let bytes = lun.to_be_bytes();
+        if bytes[0] >> 6 > 1 || bytes[2..].iter().any(|&b| b != 0) {
+            return None;
+        }
+        Some((((bytes[0] & 0x3F) as u16) << 8) | bytes[1] as u16)
+    }
+
+    /// 8-byte LUN field for `lun`, as REPORT LUNS lists it
+    ///
+    /// Peripheral device addressing below 256, flat space above.
+    pub fn encode_lun(lun: u16) -> u64 {
+        let field = if lun < 256 { lun } else { 0x4000 | (lun & MAX_LUN) };
+        (field as u64) << 48
+    }
+
     /// Parse LBA and transfer length from READ/WRITE 10 CDB
     pub fn parse_rw10_cdb(cdb: &[u8]) -> Option<(u64, u32)> {
         if cdb.len() < 10 {
@@ -760,6 +1115,57 @@ impl ScsiHandler {
         let length = BigEndian::read_u32(&cdb[10..14]);
         Some((lba, length))
     }
+
+    /// Parse LBA, block count and the UNMAP bit from a WRITE SAME 16 CDB
+    pub fn parse_write_same16_cdb(cdb: &[u8]) -> Option<(u64, u32, bool)> {
+        let (lba, blocks) = Self::parse_rw16_cdb(cdb)?;
+        Some((lba, blocks, cdb[1] & 0x08 != 0))
+    }
+
+    /// Data-Out bytes an UNMAP or WRITE SAME 16 carries
+    ///
+    /// These only make sense once their data is complete, so the target
+    /// collects it before running them. None for every other command.
+    pub fn parameter_data_length(cdb: &[u8], block_size: u32) -> Option<usize> {
+        match *cdb.first()? {
+            0x42 if cdb.len() >= 10 => Some(BigEndian::read_u16(&cdb[7..9]) as usize),
+            // NDOB: no data-out buffer, the block is zeros
+            0x93 if cdb.len() >= 16 => Some(if cdb[1] & 0x01 != 0 { 0 } else { block_size as usize }),
+            _ => None,
+        }
+    }
+
+    /// Block descriptors of an UNMAP parameter list as (LBA, block count)
+    ///
+    /// A truncated trailing descriptor is ignored. Descriptors past the
+    /// capacity, or more of them than Block Limits allows, are rejected.
+    pub fn parse_unmap_parameters(data: &[u8], capacity: u64) -> Result<Vec<(u64, u32)>, SenseData> {
+        if data.is_empty() {
+            return Ok(Vec::new());
+        }
+        if data.len() < UNMAP_HEADER_LEN {
+            return Err(SenseData::invalid_field_in_parameter_list());
+        }
+
+        let descriptor_len = (BigEndian::read_u16(&data[2..4]) as usize).min(data.len() - UNMAP_HEADER_LEN);
+        let count = descriptor_len / 16;
+        if count > MAX_UNMAP_DESCRIPTORS {
+            return Err(SenseData::invalid_field_in_parameter_list());
+        }
+
+        let mut extents = Vec::with_capacity(count);
+        for descriptor in data[UNMAP_HEADER_LEN..UNMAP_HEADER_LEN + count * 16].chunks_exact(16) {
+            let lba = BigEndian::read_u64(&descriptor[0..8]);
+            let blocks = BigEndian::read_u32(&descriptor[8..12]);
+            if lba.checked_add(blocks as u64).is_none_or(|end| end > capacity) {
+                return Err(SenseData::lba_out_of_range((lba & 0xFFFF_FFFF) as u32));
+            }
+            if blocks > 0 {
+                extents.push((lba, blocks));
+            }
+        }
+        Ok(extents)
+    }
 }
 
 // ============================================================================
@@ -864,6 +1270,108 @@ mod tests {
         assert_eq!(block_size, 512);
     }
 
+    #[test]
+    fn test_thin_provisioning_pages() {
+        let sparse = crate::backend::SparseDevice::with_chunk_size(1000 * 512, 512, 8 * 512);
+        let thick = MockDevice::new(1000, 512);
+        let vpd = |page: u8, device: &dyn ScsiBlockDevice| {
+            ScsiHandler::handle_command(&[0x12, 0x01, page, 0, 255, 0], device, None).unwrap()
+        };
+
+        assert_eq!(vpd(0x00, &sparse).data[4..], [0x00, 0x80, 0x83, 0xB0, 0xB2]);
+        assert_eq!(vpd(0x00, &thick).data[4..], [0x00, 0x80, 0x83, 0xB0]);
+
+        let lbp = vpd(0xB2, &sparse).data;
+        assert_eq!(lbp[1], 0xB2);
+        assert_eq!(lbp[5], 0xC4); // LBPU, LBPWS, LBPRZ
+        assert_eq!(lbp[6] & 0x07, 0x02); // Thin provisioned
+        assert_eq!(vpd(0xB2, &thick).status, scsi_status::CHECK_CONDITION);
+
+        let limits = vpd(0xB0, &sparse).data;
+        assert_eq!(BigEndian::read_u32(&limits[24..28]), MAX_UNMAP_DESCRIPTORS as u32);
+        assert_eq!(BigEndian::read_u32(&limits[28..32]), 8);
+        assert_eq!(BigEndian::read_u32(&vpd(0xB0, &thick).data[24..28]), 0);
+        assert_eq!(BigEndian::read_u64(&limits[36..44]), MAX_WRITE_SAME_BLOCKS as u64);
+        assert_eq!(BigEndian::read_u64(&vpd(0xB0, &thick).data[36..44]), MAX_WRITE_SAME_BLOCKS as u64);
+
+        let cdb = [0x9E, 0x10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0];
+        assert_eq!(ScsiHandler::handle_command(&cdb, &sparse, None).unwrap().data[14], 0xC0);
+        assert_eq!(ScsiHandler::handle_command(&cdb, &thick, None).unwrap().data[14], 0);
+    }
+
+    #[test]
+    fn test_unmap_validation() {
+        let sparse = crate::backend::SparseDevice::new(1000 * 512, 512);
+        let unmap_cdb = |flags: u8, len: u16| {
+            let mut cdb = [0x42, flags, 0, 0, 0, 0, 0, 0, 0, 0];
+            cdb[7..9].copy_from_slice(&len.to_be_bytes());
+            cdb
+        };
+        let status = |cdb: &[u8], device: &dyn ScsiBlockDevice, data: Option<&[u8]>| {
+            ScsiHandler::handle_command(cdb, device, data).unwrap().status
+        };
+
+        assert_eq!(ScsiHandler::parameter_data_length(&unmap_cdb(0, 40), 512), Some(40));
+        assert_eq!(status(&unmap_cdb(0, 40), &sparse, None), scsi_status::GOOD);
+        assert_eq!(status(&unmap_cdb(0, 40), &MockDevice::new(1000, 512), None), scsi_status::CHECK_CONDITION);
+        assert_eq!(status(&unmap_cdb(0x01, 40), &sparse, None), scsi_status::CHECK_CONDITION);
+        assert_eq!(status(&unmap_cdb(0, 8 + 16 * 257), &sparse, None), scsi_status::CHECK_CONDITION);
+
+        // Two descriptors and a truncated third
+        let mut list = vec![0u8; 8 + 16 * 2 + 8];
+        BigEndian::write_u16(&mut list[2..4], 48);
+        BigEndian::write_u64(&mut list[8..16], 10);
+        BigEndian::write_u32(&mut list[16..20], 5);
+        BigEndian::write_u64(&mut list[24..32], 990);
+        BigEndian::write_u32(&mut list[32..36], 10);
+        assert_eq!(ScsiHandler::parse_unmap_parameters(&list, 1000).unwrap(), vec![(10, 5), (990, 10)]);
+        assert_eq!(status(&unmap_cdb(0, list.len() as u16), &sparse, Some(&list)), scsi_status::GOOD);
+
+        BigEndian::write_u32(&mut list[32..36], 11);
+        assert!(ScsiHandler::parse_unmap_parameters(&list, 1000).is_err());
+        assert_eq!(status(&unmap_cdb(0, list.len() as u16), &sparse, Some(&list)), scsi_status::CHECK_CONDITION);
+        assert!(ScsiHandler::parse_unmap_parameters(&list[..4], 1000).is_err());
+        assert!(ScsiHandler::parse_unmap_parameters(&[], 1000).unwrap().is_empty());
+    }
+
+    #[test]
+    fn test_write_same_16_validation() {
+        let sparse = crate::backend::SparseDevice::new(1000 * 512, 512);
+        let thick = MockDevice::new(1000, 512);
+        let write_same = |flags: u8, lba: u64, blocks: u32| {
+            let mut cdb = [0u8; 16];
+            cdb[0] = 0x93;
+            cdb[1] = flags;
+            cdb[2..10].copy_from_slice(&lba.to_be_bytes());
+            cdb[10..14].copy_from_slice(&blocks.to_be_bytes());
+            cdb
+        };
+        let status = |cdb: &[u8], device: &dyn ScsiBlockDevice| {
+            ScsiHandler::handle_command(cdb, device, None).unwrap().status
+        };
+
+        assert_eq!(ScsiHandler::parse_write_same16_cdb(&write_same(0x08, 7, 9)), Some((7, 9, true)));
+        assert_eq!(ScsiHandler::parameter_data_length(&write_same(0x08, 0, 1), 512), Some(512));
+        assert_eq!(ScsiHandler::parameter_data_length(&write_same(0x09, 0, 1), 512), Some(0));
+
+        assert_eq!(status(&write_same(0x08, 0, 1000), &sparse), scsi_status::GOOD);
+        assert_eq!(status(&write_same(0, 0, 1000), &thick), scsi_status::GOOD);
+        assert_eq!(status(&write_same(0x08, 0, 1), &thick), scsi_status::CHECK_CONDITION);
+        assert_eq!(status(&write_same(0, 0, 0), &sparse), scsi_status::CHECK_CONDITION);
+        assert_eq!(status(&write_same(0, 999, 2), &sparse), scsi_status::CHECK_CONDITION);
+        assert_eq!(status(&write_same(0x10, 0, 1), &sparse), scsi_status::CHECK_CONDITION);
+
+        let over_limit = ScsiHandler::handle_command(
+            &write_same(0, 0, MAX_WRITE_SAME_BLOCKS + 1), &sparse, None
+        ).unwrap();
+        assert_eq!(over_limit.status, scsi_status::CHECK_CONDITION);
+        assert_eq!(over_limit.sense.unwrap().asc, asc::INVALID_FIELD_IN_CDB);
+
+        let short = ScsiHandler::handle_command(&write_same(0, 0, 1), &sparse, Some(&[0u8; 100])).unwrap();
+        assert_eq!(short.status, scsi_status::CHECK_CONDITION);
+        assert_eq!(short.sense.unwrap().asc, asc::INVALID_FIELD_IN_PARAMETER_LIST);
+    }
+
     #[test]
     fn test_read_10() {
         let device = MockDevice::new(1000, 512);
@@ -909,6 +1417,38 @@ mod tests {
         assert_eq!(response.data.len(), 16);
     }
 
+    #[test]
+    fn test_report_multiple_luns() {
+        let device = MockDevice::new(1000, 512);
+        let cdb = [0xA0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0];
+        let response = ScsiHandler::handle_lun_command(&cdb, &device, None, 0, &[0, 1, 300]).unwrap();
+        assert_eq!(response.data.len(), 32);
+        assert_eq!(BigEndian::read_u32(&response.data[0..4]), 24);
+        assert_eq!(&response.data[16..24], &[0, 1, 0, 0, 0, 0, 0, 0]);
+        assert_eq!(&response.data[24..32], &[0x41, 0x2C, 0, 0, 0, 0, 0, 0]);
+
+        // Each LUN has its own serial number and identifier
+        let serial = |lun| {
+            let cdb = [0x12, 0x01, 0x80, 0, 255, 0];
+            ScsiHandler::handle_lun_command(&cdb, &device, None, lun, &[0, 1]).unwrap().data
+        };
+        assert_eq!(&serial(0)[4..], b"ISCSI00000000001");
+        assert_eq!(&serial(1)[4..], b"ISCSI00000000002");
+    }
+
+    #[test]
+    fn test_lun_encoding() {
+        for lun in [0, 1, 255, 256, 1000, MAX_LUN] {
+            assert_eq!(ScsiHandler::decode_lun(ScsiHandler::encode_lun(lun)), Some(lun));
+        }
+        assert_eq!(ScsiHandler::decode_lun(0), Some(0));
+        // Peripheral method with a bus number, as some initiators send LUN 256
+        assert_eq!(ScsiHandler::decode_lun(0x0100 << 48), Some(256));
+        // Second-level addressing and the logical unit method are not supported
+        assert_eq!(ScsiHandler::decode_lun(0x0001_0001 << 32), None);
+        assert_eq!(ScsiHandler::decode_lun(0x8000 << 48), None);
+    }
+
     #[test]
     fn test_request_sense() {
         let device = MockDevice::new(1000, 512);
@@ -918,6 +1458,38 @@ mod tests {
         assert_eq!(response.data.len(), 18);
     }
 
+    #[test]
+    fn test_mode_sense_caching_page() {
+        let device = MockDevice::new(1000, 512);
+        let cdb = [0x1A, 0, 0x08, 0, 255, 0];
+        let data = ScsiHandler::handle_command(&cdb, &device, None).unwrap().data;
+        assert_eq!(data.len(), 24);
+        assert_eq!(data[0], 23);
+        assert_eq!(data[2] & 0x10, 0x10); // DPOFUA
+        assert_eq!(&data[4..6], &[0x08, 0x12]);
+        assert_eq!(data[6] & 0x04, 0); // No volatile cache
+
+        let cached = crate::cache::WriteBackCache::new(MockDevice::new(1000, 512), 4096);
+        let data = ScsiHandler::handle_command(&cdb, &cached, None).unwrap().data;
+        assert_eq!(data[6] & 0x04, 0x04);
+
+        // WCE cannot be changed
+        let changeable = [0x1A, 0, 0x48, 0, 255, 0];
+        let data = ScsiHandler::handle_command(&changeable, &cached, None).unwrap().data;
+        assert_eq!(data[6] & 0x04, 0);
+
+        let cdb10 = [0x5A, 0, 0x3F, 0, 0, 0, 0, 0, 255, 0];
+        let data = ScsiHandler::handle_command(&cdb10, &cached, None).unwrap().data;
+        assert_eq!(data.len(), 28);
+        assert_eq!(BigEndian::read_u16(&data[0..2]), 26);
+        assert_eq!(data[8], 0x08);
+        assert_eq!(data[10] & 0x04, 0x04);
+
+        // Pages the device does not have come back as a bare header
+        let other = [0x1A, 0, 0x0A, 0, 255, 0];
+        assert_eq!(ScsiHandler::handle_command(&other, &cached, None).unwrap().data.len(), 4);
+    }
+
     #[test]
     fn test_synchronize_cache() {
         let device = MockDevice::new(1000, 512);
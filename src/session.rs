@@ -5,8 +5,35 @@
 
 use crate::auth::{AuthConfig, ChapAuthState};
 use crate::error::{IscsiError, ScsiResult};
-use crate::pdu::{self, IscsiPdu, LoginRequest, serialize_text_parameters};
+use crate::pdu::{self, IscsiPdu, LoginRequest};
+use crate::scsi::SenseData;
 use std::collections::HashMap;
+use std::sync::atomic::{AtomicBool, AtomicU16, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+
+/// How long a parked command waits for an earlier CmdSN still in flight on
+/// another connection of its session before the session is failed
+///
+/// A CmdSN inside the window may not be skipped (RFC 3720 Section
+/// 3.2.2.1), and error recovery level 0 cannot ask for it again, so the
+/// gap stays open until the command arrives or this runs out.
+pub const CMD_ORDER_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// How often a connection with parked commands checks whether the session
+/// has reached them
+pub const REORDER_POLL_INTERVAL: Duration = Duration::from_millis(1);
+
+/// What to do with a command once its CmdSN has been checked
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum CmdOrder {
+    /// Its turn, or nothing else can deliver the CmdSNs before it: run it
+    Run,
+    /// Held in the session's reorder queue until the CmdSNs before it arrive
+    Parked,
+    /// Outside the command window: ignore it (RFC 3720 Section 3.2.2.1)
+    OutOfWindow,
+}
 
 /// Session state machine states (RFC 3720 Section 5)
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -50,6 +77,8 @@ pub struct SessionParams {
     pub max_xmit_data_segment_length: u32,
 
     // Session parameters
+    /// Maximum connections per session (target's limit until negotiated)
+    pub max_connections: u16,
     /// Maximum burst length for unsolicited data (default: 262144)
     pub max_burst_length: u32,
     /// First burst length for unsolicited data (default: 65536)
@@ -90,6 +119,8 @@ pub struct SessionParams {
     // Validation tracking
     /// Invalid session type received (for error reporting)
     pub(crate) invalid_session_type: Option<String>,
+    /// Whether the initiator offered MaxConnections (otherwise it stays 1)
+    pub(crate) max_connections_offered: bool,
 }
 
 /// Digest type for header/data
@@ -107,6 +138,7 @@ impl Default for SessionParams {
         SessionParams {
             max_recv_data_segment_length: 8192,
             max_xmit_data_segment_length: 8192,
+            max_connections: 1,
             max_burst_length: 262144,
             first_burst_length: 65536,
             default_time2wait: 2,
@@ -124,6 +156,7 @@ impl Default for SessionParams {
             target_alias: String::new(),
             initiator_alias: String::new(),
             invalid_session_type: None,
+            max_connections_offered: false,
         }
     }
 }
@@ -145,6 +178,85 @@ pub struct PendingWrite {
     pub r2t_sn: u32,
     /// LUN for this command
     pub lun: u64,
+    /// CmdSN of the command, matched against ABORT TASK's RefCmdSN
+    pub cmd_sn: u32,
+    /// Force Unit Access: flush before reporting status
+    pub fua: bool,
+    /// Set for UNMAP and WRITE SAME, whose data is collected rather than written
+    pub parameters: Option<ParameterData>,
+}
+
+/// Data-Out for a command that only runs once all of it has arrived
+#[derive(Debug, Clone)]
+pub struct ParameterData {
+    /// The command's CDB
+    pub cdb: [u8; 16],
+    /// The expected data, filled in by buffer offset
+    pub data: Vec<u8>,
+}
+
+/// Longest CHAP_C the target will answer in mutual CHAP (RFC 3720 allows
+/// challenges up to 1024 bytes)
+const MAX_CHAP_CHALLENGE_LEN: usize = 1024;
+
+/// Room for a normal session's final login response parameters, so they
+/// are written without regrowing the data segment
+const FINAL_LOGIN_RESPONSE_CAPACITY: usize = 512;
+
+/// Keys of one Login Request that the target acts on beyond negotiation,
+/// borrowed from its data segment
+///
+/// Filled in a single pass over the parameters; as with a lookup, the first
+/// occurrence of a key wins.
+#[derive(Debug, Default)]
+struct LoginKeys<'a> {
+    /// Number of key=value pairs in the PDU
+    count: usize,
+    initiator_name: bool,
+    target_name: Option<&'a str>,
+    auth_method: Option<&'a str>,
+    chap_a: Option<&'a str>,
+    chap_i: Option<&'a str>,
+    chap_c: Option<&'a str>,
+    chap_n: Option<&'a str>,
+    chap_r: Option<&'a str>,
+    /// Keys a discovery session echoes back on its final response
+    max_recv_data_segment_length: bool,
+    header_digest: bool,
+    data_digest: bool,
+}
+
+impl<'a> LoginKeys<'a> {
+    fn note(&mut self, key: &str, value: &'a str) {
+        self.count += 1;
+        let slot = match key {
+            "InitiatorName" => {
+                self.initiator_name = true;
+                return;
+            }
+            "MaxRecvDataSegmentLength" => {
+                self.max_recv_data_segment_length = true;
+                return;
+            }
+            "HeaderDigest" => {
+                self.header_digest = true;
+                return;
+            }
+            "DataDigest" => {
+                self.data_digest = true;
+                return;
+            }
+            "TargetName" => &mut self.target_name,
+            "AuthMethod" => &mut self.auth_method,
+            "CHAP_A" => &mut self.chap_a,
+            "CHAP_I" => &mut self.chap_i,
+            "CHAP_C" => &mut self.chap_c,
+            "CHAP_N" => &mut self.chap_n,
+            "CHAP_R" => &mut self.chap_r,
+            _ => return,
+        };
+        slot.get_or_insert(value);
+    }
 }
 
 /// iSCSI Session
@@ -182,6 +294,10 @@ pub struct IscsiSession {
     // Command tracking
     /// Pending write commands indexed by ITT (Initiator Task Tag)
     pub pending_writes: HashMap<u32, PendingWrite>,
+    /// Commands this connection has in the session's reorder queue
+    parked_commands: usize,
+    /// Task bookkeeping for TMFs when the session has no `core`
+    tasks: TaskSet,
     /// Next Target Transfer Tag (incremented for each new R2T sequence)
     pub next_ttt: u32,
     /// Latest sense data to be returned by REQUEST SENSE
@@ -198,6 +314,11 @@ pub struct IscsiSession {
     pub chap_completed: bool,
     /// Access Control List - allowed initiator IQNs (None = allow all)
     pub allowed_initiators: Option<Vec<String>>,
+
+    // Multiple connections per session
+    /// State shared with the session's other connections (normal sessions
+    /// in full feature phase, and connections logging in to join one)
+    pub core: Option<Arc<SessionCore>>,
 }
 
 impl Default for IscsiSession {
@@ -222,6 +343,8 @@ impl IscsiSession {
             current_stage: 0,
             next_stage: 0,
             pending_writes: HashMap::new(),
+            parked_commands: 0,
+            tasks: TaskSet::default(),
             next_ttt: 1, // TTT 0 is reserved for unsolicited data
             last_sense_data: None,
             auth_config: AuthConfig::None,
@@ -229,6 +352,7 @@ impl IscsiSession {
             target_chap_state: None,
             chap_completed: false,
             allowed_initiators: None,
+            core: None,
         }
     }
 
@@ -281,20 +405,14 @@ impl IscsiSession {
     }
 
     /// Handle CHAP authentication during security negotiation
-    /// Returns (success, response_params)
-    fn handle_chap_auth(&mut self, login_params: &[(String, String)]) -> ScsiResult<(bool, Vec<(String, String)>)> {
-        use crate::auth::parse_chap_response;
+    ///
+    /// Appends any parameters to send back to `out` and returns whether
+    /// authentication is complete.
+    fn handle_chap_auth(&mut self, keys: &LoginKeys<'_>, out: &mut Vec<u8>) -> ScsiResult<bool> {
+        use crate::auth::{chap_response_digest, decode_chap_hex, ChapHex};
 
         // Check if initiator requested CHAP (may be "CHAP" or "CHAP,None" etc.)
-        log::debug!("handle_chap_auth called with {} parameters", login_params.len());
-        for (k, v) in login_params.iter() {
-            log::debug!("  Login param: {}={}", k, v);
-        }
-
-        let auth_method = login_params.iter()
-            .find(|(k, _)| k == "AuthMethod")
-            .map(|(_, v)| v.as_str());
-
+        let auth_method = keys.auth_method;
         log::debug!("AuthMethod parameter: {:?}", auth_method);
 
         // Check if CHAP is in the list of methods
@@ -307,25 +425,22 @@ impl IscsiSession {
                 // Only echo back AuthMethod=None if initiator sent AuthMethod in this PDU
                 // This allows state transitions on subsequent PDUs that don't include AuthMethod
                 if auth_method.is_some() {
-                    Ok((true, vec![("AuthMethod".to_string(), "None".to_string())]))
-                } else {
-                    Ok((true, vec![]))
+                    pdu::push_text_parameter(out, "AuthMethod", "None");
                 }
+                Ok(true)
             }
             AuthConfig::Chap { credentials } | AuthConfig::MutualChap { target_credentials: credentials, .. } => {
                 // CHAP is required
 
                 // Handle empty transit request after CHAP completes (Mutual CHAP only)
                 // RFC 3720: After Mutual CHAP, initiator sends empty request with Transit=true
-                if self.chap_completed && login_params.is_empty() {
+                if self.chap_completed && keys.count == 0 {
                     log::debug!("CHAP already completed, allowing empty transit request for phase transition");
-                    return Ok((true, vec![]));
+                    return Ok(true);
                 }
 
                 // Check if initiator has selected an algorithm
-                let chap_a = login_params.iter()
-                    .find(|(k, _)| k == "CHAP_A")
-                    .map(|(_, v)| v.as_str());
+                let chap_a = keys.chap_a;
 
                 // Allow CHAP continuation even if AuthMethod is not in current PDU
                 // (only the first Login PDU contains AuthMethod)
@@ -334,36 +449,25 @@ impl IscsiSession {
                 if supports_chap || chap_in_progress {
                     if chap_a.is_none() && self.chap_state.is_none() {
                         // Step 1: Acknowledge CHAP (initiator will request algorithm list next)
-                        let params = vec![
-                            ("TargetPortalGroupTag".to_string(), "1".to_string()),
-                            ("AuthMethod".to_string(), "CHAP".to_string()),
-                        ];
+                        pdu::push_text_parameter(out, "TargetPortalGroupTag", 1);
+                        pdu::push_text_parameter(out, "AuthMethod", "CHAP");
                         log::debug!("Acknowledging CHAP authentication method");
-                        Ok((false, params))
+                        Ok(false)
                     } else if chap_a.is_some() && self.chap_state.is_none() {
                         // Step 2: Initiator requested algorithm (sends CHAP_A=5), send challenge
                         let chap_state = ChapAuthState::new(false);
-                        let params = vec![
-                            ("CHAP_A".to_string(), "5".to_string()), // Confirm MD5
-                            ("CHAP_I".to_string(), chap_state.identifier_str()),
-                            ("CHAP_C".to_string(), chap_state.challenge_hex()),
-                        ];
+                        pdu::push_text_parameter(out, "CHAP_A", 5); // Confirm MD5
+                        pdu::push_text_parameter(out, "CHAP_I", chap_state.identifier);
+                        pdu::push_text_parameter(out, "CHAP_C", ChapHex(&chap_state.challenge));
 
                         // For mutual CHAP, we'll handle target auth after validating initiator
                         self.chap_state = Some(chap_state);
 
                         log::debug!("Sending CHAP challenge to initiator");
-                        Ok((false, params)) // Not authenticated yet
+                        Ok(false) // Not authenticated yet
                     } else if self.chap_state.is_some() {
                         // Second step: Validate initiator response
-                        let chap_n = login_params.iter()
-                            .find(|(k, _)| k == "CHAP_N")
-                            .map(|(_, v)| v.as_str());
-                        let chap_r = login_params.iter()
-                            .find(|(k, _)| k == "CHAP_R")
-                            .map(|(_, v)| v.as_str());
-
-                        if let (Some(username), Some(response_hex)) = (chap_n, chap_r) {
+                        if let (Some(username), Some(response_hex)) = (keys.chap_n, keys.chap_r) {
                             // Validate username
                             if username != credentials.username {
                                 log::warn!("CHAP authentication failed: unknown user '{}' (expected '{}')",
@@ -374,11 +478,13 @@ impl IscsiSession {
                                 )));
                             }
 
-                            // Parse and validate response
-                            let response = parse_chap_response(response_hex)?;
+                            // Parse and validate response; anything longer than
+                            // an MD5 digest cannot match
+                            let mut response_buf = [0u8; 16];
+                            let response = decode_chap_hex(response_hex, &mut response_buf)?;
                             let chap_state = self.chap_state.as_ref().unwrap();
 
-                            if chap_state.validate_response(&response, &credentials.secret) {
+                            if chap_state.validate_response(response, &credentials.secret) {
                                 log::info!("CHAP authentication successful for user '{}'", username);
 
                                 // TODO: Add ACL (Access Control List) check here to return AUTHORIZATION_FAILURE
@@ -394,14 +500,7 @@ impl IscsiSession {
                                 if let AuthConfig::MutualChap { initiator_credentials, .. } = &self.auth_config {
                                     // In mutual CHAP, initiator may send a challenge to target
                                     // Check if initiator sent CHAP_I and CHAP_C (target auth)
-                                    let target_chap_i = login_params.iter()
-                                        .find(|(k, _)| k == "CHAP_I")
-                                        .map(|(_, v)| v.as_str());
-                                    let target_chap_c = login_params.iter()
-                                        .find(|(k, _)| k == "CHAP_C")
-                                        .map(|(_, v)| v.as_str());
-
-                                    if let (Some(chap_i), Some(chap_c_hex)) = (target_chap_i, target_chap_c) {
+                                    if let (Some(chap_i), Some(chap_c_hex)) = (keys.chap_i, keys.chap_c) {
                                         // Initiator is challenging us - respond with initiator's credentials
                                         // (target proves its identity using credentials the initiator expects)
                                         log::debug!("Mutual CHAP: Received challenge from initiator (I={}, C={})", chap_i, &chap_c_hex[..20.min(chap_c_hex.len())]);
@@ -410,27 +509,16 @@ impl IscsiSession {
                                         let identifier = chap_i.parse::<u8>().map_err(|e|
                                             IscsiError::Auth(format!("Invalid CHAP_I: {}", e)))?;
 
-                                        // Remove "0x" prefix if present
-                                        let chap_c_clean = chap_c_hex.strip_prefix("0x").unwrap_or(chap_c_hex);
-                                        let challenge = hex::decode(chap_c_clean).map_err(|e|
-                                            IscsiError::Auth(format!("Invalid CHAP_C hex: {}", e)))?;
+                                        let mut challenge_buf = [0u8; MAX_CHAP_CHALLENGE_LEN];
+                                        let challenge = decode_chap_hex(chap_c_hex, &mut challenge_buf)?;
 
                                         // Calculate target's response using initiator_credentials
                                         // (these are the credentials the initiator expects from the target)
-                                        let mut data = Vec::new();
-                                        data.push(identifier);
-                                        data.extend_from_slice(initiator_credentials.secret.as_bytes());
-                                        data.extend_from_slice(&challenge);
-                                        let target_response = md5::compute(&data).0.to_vec();
-
-                                        let response_hex = format!("0x{}", target_response.iter()
-                                            .map(|b| format!("{:02x}", b))
-                                            .collect::<String>());
+                                        let target_response = chap_response_digest(
+                                            identifier, &initiator_credentials.secret, challenge);
 
-                                        let params = vec![
-                                            ("CHAP_N".to_string(), initiator_credentials.username.clone()),
-                                            ("CHAP_R".to_string(), response_hex),
-                                        ];
+                                        pdu::push_text_parameter(out, "CHAP_N", &initiator_credentials.username);
+                                        pdu::push_text_parameter(out, "CHAP_R", ChapHex(&target_response));
 
                                         log::info!("Mutual CHAP: Both parties authenticated successfully");
 
@@ -439,14 +527,14 @@ impl IscsiSession {
                                         self.chap_state = None;
                                         self.chap_completed = true;
 
-                                        return Ok((true, params)); // Send target's response and complete auth
+                                        return Ok(true); // Send target's response and complete auth
                                     }
                                 }
 
                                 // Clear CHAP state after successful one-way CHAP
                                 self.chap_state = None;
                                 self.chap_completed = true;
-                                Ok((true, vec![])) // Authenticated successfully (one-way CHAP)
+                                Ok(true) // Authenticated successfully (one-way CHAP)
                             } else {
                                 log::warn!("CHAP authentication failed: invalid password/secret for user '{}'", username);
                                 Err(IscsiError::Auth(format!(
@@ -511,6 +599,13 @@ impl IscsiSession {
                     self.params.max_xmit_data_segment_length = v;
                 }
             }
+            "MaxConnections" => {
+                if let Ok(v) = value.parse::<u16>() {
+                    // 0 is out of range; treat it as the default of 1
+                    self.params.max_connections = v.max(1).min(self.params.max_connections);
+                    self.params.max_connections_offered = true;
+                }
+            }
             "MaxBurstLength" => {
                 if let Ok(v) = value.parse::<u32>() {
                     self.params.max_burst_length = v.min(self.params.max_burst_length);
@@ -582,82 +677,57 @@ impl IscsiSession {
 
     /// Generate target response parameters for login
     pub fn generate_response_params(&self) -> Vec<(String, String)> {
-        let mut params = Vec::new();
+        let mut data = Vec::new();
+        self.write_response_params(&mut data);
+        pdu::text_parameters(&data)
+            .map(|(k, v)| (k.to_string(), v.to_string()))
+            .collect()
+    }
+
+    /// Append the target's final-login response parameters to a data segment
+    pub fn write_response_params(&self, out: &mut Vec<u8>) {
+        fn yes_no(value: bool) -> &'static str {
+            if value { "Yes" } else { "No" }
+        }
+        fn digest(value: DigestType) -> &'static str {
+            match value {
+                DigestType::None => "None",
+                DigestType::CRC32C => "CRC32C",
+            }
+        }
 
         // Note: SessionType and TargetName are declarative (initiator-only) and should NOT be echoed back
         // Only send TargetAlias if configured
-        if self.session_type == SessionType::Normal {
-            if !self.params.target_alias.is_empty() {
-                params.push(("TargetAlias".to_string(), self.params.target_alias.clone()));
-            }
+        if self.session_type == SessionType::Normal && !self.params.target_alias.is_empty() {
+            pdu::push_text_parameter(out, "TargetAlias", &self.params.target_alias);
         }
 
         // Negotiated parameters
-        params.push((
-            "MaxRecvDataSegmentLength".to_string(),
-            self.params.max_recv_data_segment_length.to_string(),
-        ));
-        params.push((
-            "MaxBurstLength".to_string(),
-            self.params.max_burst_length.to_string(),
-        ));
-        params.push((
-            "FirstBurstLength".to_string(),
-            self.params.first_burst_length.to_string(),
-        ));
-        params.push((
-            "DefaultTime2Wait".to_string(),
-            self.params.default_time2wait.to_string(),
-        ));
-        params.push((
-            "DefaultTime2Retain".to_string(),
-            self.params.default_time2retain.to_string(),
-        ));
-        params.push((
-            "MaxOutstandingR2T".to_string(),
-            self.params.max_outstanding_r2t.to_string(),
-        ));
-        params.push((
-            "DataPDUInOrder".to_string(),
-            if self.params.data_pdu_in_order { "Yes" } else { "No" }.to_string(),
-        ));
-        params.push((
-            "DataSequenceInOrder".to_string(),
-            if self.params.data_sequence_in_order { "Yes" } else { "No" }.to_string(),
-        ));
-        params.push((
-            "ErrorRecoveryLevel".to_string(),
-            self.params.error_recovery_level.to_string(),
-        ));
-        params.push((
-            "ImmediateData".to_string(),
-            if self.params.immediate_data { "Yes" } else { "No" }.to_string(),
-        ));
-        params.push((
-            "InitialR2T".to_string(),
-            if self.params.initial_r2t { "Yes" } else { "No" }.to_string(),
-        ));
-        params.push((
-            "HeaderDigest".to_string(),
-            match self.params.header_digest {
-                DigestType::None => "None",
-                DigestType::CRC32C => "CRC32C",
-            }.to_string(),
-        ));
-        params.push((
-            "DataDigest".to_string(),
-            match self.params.data_digest {
-                DigestType::None => "None",
-                DigestType::CRC32C => "CRC32C",
-            }.to_string(),
-        ));
-
-        params
+        pdu::push_text_parameter(out, "MaxRecvDataSegmentLength", self.params.max_recv_data_segment_length);
+        if self.params.max_connections_offered {
+            pdu::push_text_parameter(out, "MaxConnections", self.params.max_connections);
+        }
+        pdu::push_text_parameter(out, "MaxBurstLength", self.params.max_burst_length);
+        pdu::push_text_parameter(out, "FirstBurstLength", self.params.first_burst_length);
+        pdu::push_text_parameter(out, "DefaultTime2Wait", self.params.default_time2wait);
+        pdu::push_text_parameter(out, "DefaultTime2Retain", self.params.default_time2retain);
+        pdu::push_text_parameter(out, "MaxOutstandingR2T", self.params.max_outstanding_r2t);
+        pdu::push_text_parameter(out, "DataPDUInOrder", yes_no(self.params.data_pdu_in_order));
+        pdu::push_text_parameter(out, "DataSequenceInOrder", yes_no(self.params.data_sequence_in_order));
+        pdu::push_text_parameter(out, "ErrorRecoveryLevel", self.params.error_recovery_level);
+        pdu::push_text_parameter(out, "ImmediateData", yes_no(self.params.immediate_data));
+        pdu::push_text_parameter(out, "InitialR2T", yes_no(self.params.initial_r2t));
+        pdu::push_text_parameter(out, "HeaderDigest", digest(self.params.header_digest));
+        pdu::push_text_parameter(out, "DataDigest", digest(self.params.data_digest));
     }
 
     /// Process a login request and generate response
+    ///
+    /// Parameters are read in place from the PDU's data segment and the
+    /// response is written straight into its own, so the only allocations
+    /// are that segment and the strings the session keeps.
     pub fn process_login(&mut self, pdu: &IscsiPdu, target_name: &str) -> ScsiResult<IscsiPdu> {
-        let login = pdu.parse_login_request()?;
+        let login = pdu.parse_login_header()?;
 
         // Check iSCSI version compatibility - RFC 3720 Section 11.12
         // Target supports version 0x00 (RFC 3720)
@@ -677,17 +747,20 @@ impl IscsiSession {
             self.exp_cmd_sn = login.cmd_sn;
             self.max_cmd_sn = login.cmd_sn + 1;
             self.params.target_name = target_name.to_string();
+            // A connection joining a session uses the session's window
+            self.sync_cmd_window();
         }
 
         // Apply parameters from this login PDU
-        log::debug!("Received {} login parameters: {:?}", login.parameters.len(), login.parameters);
-        for (key, value) in &login.parameters {
+        log::debug!("Received login parameters: {:?}", String::from_utf8_lossy(&pdu.data));
+        let mut keys = LoginKeys::default();
+        for (key, value) in pdu::text_parameters(&pdu.data) {
             self.apply_initiator_param(key, value);
+            keys.note(key, value);
         }
 
         // Validate required parameters - RFC 3720 Section 12
-        let has_initiator_name = login.parameters.iter()
-            .any(|(k, _)| k == "InitiatorName");
+        let has_initiator_name = keys.initiator_name;
 
         // InitiatorName is required, but only if we haven't already received it
         // iscsiadm sends it in the first login PDU, then sends follow-up PDUs without it
@@ -702,9 +775,7 @@ impl IscsiSession {
 
         // Validate target name for normal sessions
         if self.session_type == SessionType::Normal {
-            let requested_target = login.parameters.iter()
-                .find(|(k, _)| k == "TargetName")
-                .map(|(_, v)| v.as_str());
+            let requested_target = keys.target_name;
 
             // TargetName is required for normal sessions, but only on the first login PDU
             // After that, iscsiadm (and other initiators) may send login PDUs without TargetName
@@ -752,8 +823,9 @@ impl IscsiSession {
         // IMPORTANT: Check auth BEFORE deciding whether to honor transit request
         let auth_complete = if login.csg == 0 {
             // Handle auth errors by returning login reject PDU instead of propagating error
-            let (auth_success, auth_params) = match self.handle_chap_auth(&login.parameters) {
-                Ok((success, params)) => (success, params),
+            let mut auth_data = Vec::new();
+            let auth_success = match self.handle_chap_auth(&keys, &mut auth_data) {
+                Ok(success) => success,
                 Err(e) => {
                     // Auth error - send login reject with AUTH_FAILURE status
                     log::warn!("Login rejected: {}", e);
@@ -765,15 +837,12 @@ impl IscsiSession {
                 }
             };
 
-            log::debug!("After handle_chap_auth: auth_success={}, auth_params={:?}", auth_success, auth_params);
+            log::debug!("After handle_chap_auth: auth_success={}, auth_params={:?}",
+                auth_success, String::from_utf8_lossy(&auth_data));
 
             // If authentication in progress, send CHAP parameters and stay in security negotiation
             // OR if mutual CHAP completed successfully and we need to send target's response
-            if !auth_params.is_empty() {
-                // Send CHAP challenge/response
-                let response_data = serialize_text_parameters(&auth_params);
-
-                log::debug!("Sending {} auth parameters: {:?}", auth_params.len(), auth_params);
+            if !auth_data.is_empty() {
 
                 self.stat_sn = self.stat_sn.wrapping_add(1);
 
@@ -795,7 +864,7 @@ impl IscsiSession {
                     nsg, // NSG: depends on whether auth is complete
                     transit, // transit: depends on whether auth is complete
                     pdu.itt,
-                    response_data,
+                    auth_data,
                 ));
             }
 
@@ -849,18 +918,20 @@ impl IscsiSession {
                 (0, 3) => {
                     // Security → Full Feature Phase
                     self.state = SessionState::FullFeaturePhase;
-                    // Only assign TSIH for Normal sessions, not Discovery
-                    if self.session_type == SessionType::Normal {
-                        self.tsih = self.generate_tsih();
+                    // Only assign TSIH for Normal sessions, not Discovery;
+                    // a connection joining a session already has its TSIH
+                    if self.session_type == SessionType::Normal && self.tsih == 0 {
+                        self.tsih = generate_tsih();
                     }
                     (login.csg, login.nsg, true) // Echo back the transition
                 }
                 (1, 3) => {
                     // Login Op Neg → Full Feature Phase
                     self.state = SessionState::FullFeaturePhase;
-                    // Only assign TSIH for Normal sessions, not Discovery
-                    if self.session_type == SessionType::Normal {
-                        self.tsih = self.generate_tsih();
+                    // Only assign TSIH for Normal sessions, not Discovery;
+                    // a connection joining a session already has its TSIH
+                    if self.session_type == SessionType::Normal && self.tsih == 0 {
+                        self.tsih = generate_tsih();
                     }
                     (login.csg, login.nsg, true) // Echo back the transition
                 }
@@ -877,41 +948,34 @@ impl IscsiSession {
         log::debug!("Response: CSG={}, NSG={}, Transit={}", response_csg, response_nsg, response_transit);
 
         // Generate response parameters
-        let response_params = if response_transit && response_nsg == 3 {
+        let mut response_data = Vec::new();
+        if response_transit && response_nsg == 3 {
             // Final login response
             if self.session_type == SessionType::Discovery {
                 // Discovery sessions - only echo back operational parameters
-                let mut params = vec![];
+
+                // Digests are always declined here; keep the connection in step
+                self.params.header_digest = DigestType::None;
+                self.params.data_digest = DigestType::None;
 
                 // Include operational parameters that were negotiated
-                for (key, _value) in &login.parameters {
-                    match key.as_str() {
-                        "MaxRecvDataSegmentLength" => {
-                            params.push(("MaxRecvDataSegmentLength".to_string(),
-                                        self.params.max_recv_data_segment_length.to_string()));
-                        }
-                        "HeaderDigest" => {
-                            params.push(("HeaderDigest".to_string(), "None".to_string()));
-                        }
-                        "DataDigest" => {
-                            params.push(("DataDigest".to_string(), "None".to_string()));
-                        }
-                        _ => {}
-                    }
+                if keys.max_recv_data_segment_length {
+                    pdu::push_text_parameter(&mut response_data, "MaxRecvDataSegmentLength",
+                                             self.params.max_recv_data_segment_length);
+                }
+                if keys.header_digest {
+                    pdu::push_text_parameter(&mut response_data, "HeaderDigest", "None");
+                }
+                if keys.data_digest {
+                    pdu::push_text_parameter(&mut response_data, "DataDigest", "None");
                 }
-                params
             } else {
                 // Normal sessions get full parameter negotiation
-                self.generate_response_params()
+                response_data.reserve(FINAL_LOGIN_RESPONSE_CAPACITY);
+                self.write_response_params(&mut response_data);
             }
-        } else {
-            // Intermediate response
-            vec![]
-        };
-
-        let response_data = serialize_text_parameters(&response_params);
+        }
 
-        log::debug!("Sending {} response parameters: {:?}", response_params.len(), response_params);
         log::debug!("Response data ({} bytes): {:?}", response_data.len(), String::from_utf8_lossy(&response_data));
 
         // Increment stat_sn for this response
@@ -1019,6 +1083,15 @@ impl IscsiSession {
         )
     }
 
+    /// Create a login reject for a connection that cannot join the session it names
+    ///
+    /// `detail` is SESSION_DOES_NOT_EXIST (0x0A) when no session matches the
+    /// TSIH, ISID and InitiatorName, or TOO_MANY_CONNECTIONS (0x06) when the
+    /// session already has its negotiated MaxConnections.
+    pub fn create_join_reject(&self, itt: u32, detail: u8) -> ScsiResult<IscsiPdu> {
+        self.create_login_reject(itt, pdu::login_status::INITIATOR_ERROR, detail)
+    }
+
     /// Create a login reject for resource exhaustion - RFC 3720: OUT_OF_RESOURCES (0x0302)
     ///
     /// This is used when the target cannot process the login due to resource constraints
@@ -1032,14 +1105,33 @@ impl IscsiSession {
         )
     }
 
-    /// Generate a unique TSIH
-    fn generate_tsih(&self) -> u16 {
-        // Simple TSIH generation - in production, would be globally unique
-        use std::time::{SystemTime, UNIX_EPOCH};
-        let duration = SystemTime::now()
-            .duration_since(UNIX_EPOCH)
-            .unwrap_or_default();
-        ((duration.as_millis() & 0xFFFF) as u16).max(1)
+    /// MaxConnections in effect: RFC 3720 keeps it at 1 unless the initiator offers more
+    pub fn negotiated_max_connections(&self) -> u16 {
+        if self.params.max_connections_offered {
+            self.params.max_connections
+        } else {
+            1
+        }
+    }
+
+    /// Make this connection part of the session behind `core`
+    ///
+    /// Called on the first Login PDU of a connection that names an existing
+    /// TSIH; the connection then takes its CmdSN window from the session.
+    pub fn join(&mut self, core: Arc<SessionCore>) {
+        self.tsih = core.tsih;
+        self.core = Some(core);
+        self.sync_cmd_window();
+    }
+
+    /// Refresh ExpCmdSN/MaxCmdSN from the session's shared window
+    ///
+    /// Other connections advance the window, so responses on this one must
+    /// pick up their progress to keep the initiator's window open.
+    pub fn sync_cmd_window(&mut self) {
+        if let Some(core) = &self.core {
+            (self.exp_cmd_sn, self.max_cmd_sn) = core.cmd_window();
+        }
     }
 
     /// Check if session is in full feature phase
@@ -1060,17 +1152,84 @@ impl IscsiSession {
     }
 
     /// Validate and update CmdSN from incoming PDU
+    ///
+    /// Returns false for a CmdSN outside the window, which the caller must
+    /// ignore. An in-window CmdSN ahead of its turn is recorded and runs
+    /// at once; SCSI commands use `order_command`, which holds them back.
     pub fn validate_cmd_sn(&mut self, cmd_sn: u32) -> bool {
-        // Check if CmdSN is within window
-        let in_window = Self::sn_in_window(cmd_sn, self.exp_cmd_sn, self.max_cmd_sn);
+        self.check_cmd_sn(cmd_sn, None) != CmdOrder::OutOfWindow
+    }
+
+    /// Deliver a SCSI command in CmdSN order
+    ///
+    /// When the session has other connections, a command that arrives ahead
+    /// of its turn is parked in the session's reorder queue rather than
+    /// waited for: `next_parked_command` hands it back once the earlier
+    /// CmdSNs have arrived, and fails the session if they have not within
+    /// `CMD_ORDER_TIMEOUT`.
+    pub fn order_command(&mut self, cmd_sn: u32, pdu: &IscsiPdu) -> CmdOrder {
+        let order = self.check_cmd_sn(cmd_sn, Some(pdu));
+        if order == CmdOrder::Parked {
+            self.parked_commands += 1;
+        }
+        order
+    }
+
+    fn check_cmd_sn(&mut self, cmd_sn: u32, pdu: Option<&IscsiPdu>) -> CmdOrder {
+        if let Some(core) = &self.core {
+            let (order, exp_cmd_sn, max_cmd_sn) = core.deliver(cmd_sn, pdu.map(|pdu| (self.cid, pdu)));
+            self.exp_cmd_sn = exp_cmd_sn;
+            self.max_cmd_sn = max_cmd_sn;
+            return order;
+        }
 
-        if in_window && cmd_sn == self.exp_cmd_sn {
+        // Check if CmdSN is within window
+        if !Self::sn_in_window(cmd_sn, self.exp_cmd_sn, self.max_cmd_sn) {
+            return CmdOrder::OutOfWindow;
+        }
+        if cmd_sn == self.exp_cmd_sn {
             // Expected command - advance window
             self.exp_cmd_sn = self.exp_cmd_sn.wrapping_add(1);
             self.max_cmd_sn = self.max_cmd_sn.wrapping_add(1);
         }
+        CmdOrder::Run
+    }
 
-        in_window
+    /// Whether this connection has commands in the reorder queue
+    pub fn has_parked_commands(&self) -> bool {
+        self.parked_commands > 0
+    }
+
+    /// Take this connection's parked command whose turn has come
+    ///
+    /// Returns the command followed by any Data-Out that arrived for it
+    /// while it was parked, with the CmdSN already delivered. Fails once the
+    /// session has given up on a missing CmdSN.
+    pub fn next_parked_command(&mut self) -> ScsiResult<Option<Vec<IscsiPdu>>> {
+        let Some(core) = self.core.as_ref().filter(|_| self.parked_commands > 0) else {
+            return Ok(None);
+        };
+        let Some(pdus) = core.take_ready(self.cid, CMD_ORDER_TIMEOUT)? else {
+            return Ok(None);
+        };
+        self.parked_commands -= 1;
+        self.sync_cmd_window();
+        Ok(Some(pdus))
+    }
+
+    /// Whether the session this connection belongs to has been failed
+    pub fn session_failed(&self) -> bool {
+        self.core.as_ref().is_some_and(|core| core.is_failed())
+    }
+
+    /// Hold Data-Out for a parked command until the command runs
+    ///
+    /// Returns false when no command of this connection with `itt` is parked.
+    pub fn park_data_out(&self, itt: u32, pdu: &IscsiPdu) -> bool {
+        match &self.core {
+            Some(core) if self.parked_commands > 0 => core.park_data_out(self.cid, itt, pdu),
+            _ => false,
+        }
     }
 
     /// Check if a sequence number is within the command window
@@ -1081,6 +1240,112 @@ impl IscsiSession {
         diff_exp >= 0 && diff_max >= 0
     }
 
+    /// Run `f` on the session's tasks, which every connection shares
+    fn with_tasks<R>(&mut self, f: impl FnOnce(&mut TaskSet) -> R) -> R {
+        match &self.core {
+            Some(core) => f(&mut core.tasks.lock().unwrap()),
+            None => f(&mut self.tasks),
+        }
+    }
+
+    /// Track a command waiting for Data-Out, so TMFs on any connection of
+    /// the session can find it
+    pub fn add_pending_write(&mut self, itt: u32, pending: PendingWrite) {
+        let task = TaskRef { cid: self.cid, lun: pending.lun, cmd_sn: pending.cmd_sn };
+        self.with_tasks(|tasks| tasks.pending.insert(itt, task));
+        self.pending_writes.insert(itt, pending);
+    }
+
+    /// Stop tracking a command once its last Data-Out has arrived
+    pub fn finish_pending_write(&mut self, itt: u32) -> Option<PendingWrite> {
+        let pending = self.pending_writes.remove(&itt)?;
+        self.with_tasks(|tasks| tasks.pending.remove(&itt));
+        Some(pending)
+    }
+
+    /// Forget the commands of this connection that a TMF aborted, so their
+    /// remaining Data-Out is discarded
+    pub fn drop_aborted_writes(&mut self) {
+        let cid = self.cid;
+        for itt in self.with_tasks(|tasks| tasks.aborted.remove(&cid)).unwrap_or_default() {
+            self.pending_writes.remove(&itt);
+        }
+    }
+
+    /// ABORT TASK (RFC 3720 Section 10.5.1): end the task `itt` if it is
+    /// still waiting for Data-Out on any connection of the session
+    ///
+    /// `lun` and `ref_cmd_sn` are the TMF's LUN and the task's CmdSN, which
+    /// must match the task; `cmd_sn` is the TMF's own. Returns the TMF
+    /// response code.
+    pub fn abort_task(&mut self, itt: u32, lun: u64, ref_cmd_sn: u32, cmd_sn: u32) -> u8 {
+        use crate::scsi::ScsiHandler;
+
+        self.sync_cmd_window();
+        let (exp_cmd_sn, max_cmd_sn) = (self.exp_cmd_sn, self.max_cmd_sn);
+        let response = self.with_tasks(|tasks| {
+            if let Some(task) = tasks.pending.get(&itt) {
+                if ScsiHandler::decode_lun(task.lun) != ScsiHandler::decode_lun(lun) || task.cmd_sn != ref_cmd_sn {
+                    log::debug!("ABORT TASK: ITT=0x{:08x} does not match LUN 0x{:016x}, RefCmdSN {}", itt, lun, ref_cmd_sn);
+                    return pdu::tmf_response::TASK_DOES_NOT_EXIST;
+                }
+                tasks.abort(itt);
+                log::debug!("ABORT TASK: aborted ITT=0x{:08x}", itt);
+                return pdu::tmf_response::FUNCTION_COMPLETE;
+            }
+
+            // A task no connection holds: if its CmdSN is still in the
+            // window and precedes the TMF, it has not run yet (it may be
+            // parked, or not have arrived), so drop it when it does.
+            // Completed tasks have fallen out of the window.
+            let before_tmf = (cmd_sn.wrapping_sub(ref_cmd_sn) as i32) > 0;
+            if before_tmf && Self::sn_in_window(ref_cmd_sn, exp_cmd_sn, max_cmd_sn) {
+                tasks.abort_not_run(ref_cmd_sn, itt, exp_cmd_sn, max_cmd_sn);
+                log::debug!("ABORT TASK: ITT=0x{:08x} (CmdSN {}) aborted before it ran", itt, ref_cmd_sn);
+                return pdu::tmf_response::FUNCTION_COMPLETE;
+            }
+            pdu::tmf_response::TASK_DOES_NOT_EXIST
+        });
+        self.drop_aborted_writes();
+        response
+    }
+
+    /// Whether the command `itt` with `cmd_sn` was aborted before it ran,
+    /// in which case it must be dropped without a response
+    ///
+    /// Call once the command's CmdSN has been delivered, so its slot in the
+    /// window is used up either way.
+    pub fn take_aborted(&mut self, cmd_sn: u32, itt: u32) -> bool {
+        self.with_tasks(|tasks| {
+            if tasks.not_run.get(&cmd_sn) != Some(&itt) {
+                return false;
+            }
+            tasks.not_run.remove(&cmd_sn);
+            true
+        })
+    }
+
+    /// End every task on `lun`, or on any LUN when `lun` is None, for ABORT
+    /// TASK SET, CLEAR TASK SET and the resets
+    ///
+    /// Reaches the commands waiting for Data-Out on every connection of the
+    /// session and those parked for CmdSN order. No status is sent for an
+    /// aborted task, and Data-Out still arriving for it is discarded.
+    /// Returns the number of tasks aborted.
+    pub fn abort_tasks(&mut self, lun: Option<u16>) -> usize {
+        let aborted = match &self.core {
+            Some(core) => core.abort_tasks(lun),
+            None => self.tasks.abort_pending(lun),
+        };
+        self.drop_aborted_writes();
+        aborted
+    }
+
+    /// Take the unit attention a reset on another session left for `lun`
+    pub fn take_unit_attention(&mut self, lun: u16) -> Option<SenseData> {
+        self.with_tasks(|tasks| tasks.unit_attention.remove(&lun))
+    }
+
     /// Process logout request
     pub fn process_logout(&mut self, pdu: &IscsiPdu) -> ScsiResult<IscsiPdu> {
         let logout = pdu.parse_logout_request()?;
@@ -1098,6 +1363,17 @@ impl IscsiSession {
         ))
     }
 
+    /// Reject a PDU, returning its header to the initiator (e.g. on a data digest error)
+    pub fn create_reject(&mut self, reason: u8, rejected_header: &[u8; pdu::BHS_SIZE]) -> IscsiPdu {
+        IscsiPdu::reject(
+            reason,
+            self.next_stat_sn(),
+            self.exp_cmd_sn,
+            self.max_cmd_sn,
+            rejected_header,
+        )
+    }
+
     /// Process NOP-Out (ping) request
     pub fn process_nop_out(&mut self, pdu: &IscsiPdu) -> ScsiResult<IscsiPdu> {
         let nop = pdu.parse_nop_out()?;
@@ -1167,6 +1443,396 @@ impl IscsiConnection {
     }
 }
 
+/// Next TSIH to hand out; unique across the process until it wraps
+static NEXT_TSIH: AtomicU16 = AtomicU16::new(1);
+
+/// Generate a TSIH (never 0, which means "new session" on the wire)
+fn generate_tsih() -> u16 {
+    loop {
+        let tsih = NEXT_TSIH.fetch_add(1, Ordering::Relaxed);
+        if tsih != 0 {
+            return tsih;
+        }
+    }
+}
+
+/// A command waiting in the reorder queue for the CmdSNs before it
+#[derive(Debug)]
+struct ParkedCommand {
+    /// Connection it arrived on, which runs it and answers it
+    cid: u16,
+    since: Instant,
+    /// The command, then any Data-Out received for it since
+    pdus: Vec<IscsiPdu>,
+}
+
+/// CmdSN window of a session
+#[derive(Debug)]
+struct CmdWindow {
+    exp_cmd_sn: u32,
+    max_cmd_sn: u32,
+    /// In-window CmdSNs already delivered ahead of `exp_cmd_sn`
+    ahead: Vec<u32>,
+    /// Reorder queue: in-window commands not yet delivered, by CmdSN
+    parked: HashMap<u32, ParkedCommand>,
+    /// Commands each connection may have outstanding
+    per_connection: u32,
+    /// Slots to give back as commands complete, so a window that grew
+    /// for a connection narrows again without MaxCmdSN ever going back
+    shrink: u32,
+}
+
+impl CmdWindow {
+    fn advance(&mut self) {
+        self.exp_cmd_sn = self.exp_cmd_sn.wrapping_add(1);
+        if self.shrink > 0 {
+            self.shrink -= 1;
+        } else {
+            self.max_cmd_sn = self.max_cmd_sn.wrapping_add(1);
+        }
+    }
+
+    /// Widen the window for a connection joining the session
+    fn grow(&mut self) {
+        let reclaimed = self.shrink.min(self.per_connection);
+        self.shrink -= reclaimed;
+        self.max_cmd_sn = self.max_cmd_sn.wrapping_add(self.per_connection - reclaimed);
+    }
+
+    /// Record `cmd_sn` as delivered and slide past every CmdSN now complete
+    fn deliver(&mut self, cmd_sn: u32) {
+        if cmd_sn != self.exp_cmd_sn {
+            if !self.ahead.contains(&cmd_sn) {
+                self.ahead.push(cmd_sn);
+            }
+            return;
+        }
+        self.advance();
+        while let Some(i) = self.ahead.iter().position(|&sn| sn == self.exp_cmd_sn) {
+            self.ahead.swap_remove(i);
+            self.advance();
+        }
+    }
+}
+
+/// A command waiting for Data-Out on one of a session's connections
+#[derive(Debug, Clone, Copy)]
+struct TaskRef {
+    cid: u16,
+    lun: u64,
+    cmd_sn: u32,
+}
+
+/// What a TMF needs to find a session's tasks on any of its connections
+#[derive(Debug, Clone, Default)]
+struct TaskSet {
+    /// Commands waiting for Data-Out, by ITT
+    pending: HashMap<u32, TaskRef>,
+    /// Aborted commands that were waiting for Data-Out, by the connection
+    /// that holds them, which drops them before its next Data-Out
+    aborted: HashMap<u16, Vec<u32>>,
+    /// Commands aborted before they ran: ITT by CmdSN
+    not_run: HashMap<u32, u32>,
+    /// Unit attentions left by a reset from another session, by LUN
+    unit_attention: HashMap<u16, SenseData>,
+}
+
+impl TaskSet {
+    /// Abort the command `itt` waiting for Data-Out
+    fn abort(&mut self, itt: u32) {
+        if let Some(task) = self.pending.remove(&itt) {
+            self.aborted.entry(task.cid).or_default().push(itt);
+        }
+    }
+
+    /// Abort the commands waiting for Data-Out on `lun`, or on any LUN
+    fn abort_pending(&mut self, lun: Option<u16>) -> usize {
+        let itts: Vec<u32> = self.pending.iter()
+            .filter(|(_, task)| on_lun(task.lun, lun))
+            .map(|(&itt, _)| itt)
+            .collect();
+        for &itt in &itts {
+            self.abort(itt);
+        }
+        itts.len()
+    }
+
+    /// Record a command aborted before it ran, forgetting those whose
+    /// CmdSN has left the window
+    fn abort_not_run(&mut self, cmd_sn: u32, itt: u32, exp_cmd_sn: u32, max_cmd_sn: u32) {
+        self.not_run.retain(|&sn, _| IscsiSession::sn_in_window(sn, exp_cmd_sn, max_cmd_sn));
+        self.not_run.insert(cmd_sn, itt);
+    }
+}
+
+/// Whether a PDU's LUN field names `lun`; None matches every LUN
+fn on_lun(field: u64, lun: Option<u16>) -> bool {
+    lun.is_none() || crate::scsi::ScsiHandler::decode_lun(field) == lun
+}
+
+/// State shared by every connection of one normal session (RFC 3720 Section 3.4)
+///
+/// Connections keep their own StatSN and login state; the CmdSN window is
+/// session-wide, so it lives here. The window is as wide per connection as
+/// the leading connection's was at login, so every connection can keep
+/// the same number of commands outstanding.
+#[derive(Debug)]
+pub struct SessionCore {
+    /// Target Session Identifying Handle
+    pub tsih: u16,
+    /// Initiator Session ID
+    pub isid: [u8; 6],
+    /// Initiator that owns the session
+    pub initiator_name: String,
+    /// Negotiated MaxConnections
+    pub max_connections: u16,
+    connections: AtomicU16,
+    window: Mutex<CmdWindow>,
+    /// Set once a missing CmdSN has kept the session waiting too long;
+    /// every connection then closes
+    failed: AtomicBool,
+    tasks: Mutex<TaskSet>,
+}
+
+impl SessionCore {
+    /// Shared state for `session`, counting it as the first connection
+    pub fn new(session: &IscsiSession) -> Self {
+        SessionCore {
+            tsih: session.tsih,
+            isid: session.isid,
+            initiator_name: session.params.initiator_name.clone(),
+            max_connections: session.negotiated_max_connections(),
+            connections: AtomicU16::new(1),
+            window: Mutex::new(CmdWindow {
+                exp_cmd_sn: session.exp_cmd_sn,
+                max_cmd_sn: session.max_cmd_sn,
+                ahead: Vec::new(),
+                parked: HashMap::new(),
+                per_connection: session.max_cmd_sn.wrapping_sub(session.exp_cmd_sn).wrapping_add(1).max(1),
+                shrink: 0,
+            }),
+            failed: AtomicBool::new(false),
+            tasks: Mutex::new(TaskSet::default()),
+        }
+    }
+
+    /// Number of connections in the session
+    pub fn connection_count(&self) -> u16 {
+        self.connections.load(Ordering::SeqCst)
+    }
+
+    /// Whether the session has been failed, so its connections must close
+    pub fn is_failed(&self) -> bool {
+        self.failed.load(Ordering::SeqCst)
+    }
+
+    /// Current (ExpCmdSN, MaxCmdSN)
+    pub fn cmd_window(&self) -> (u32, u32) {
+        let window = self.window.lock().unwrap();
+        (window.exp_cmd_sn, window.max_cmd_sn)
+    }
+
+    /// Deliver a command's CmdSN in session order
+    ///
+    /// With `park` set (the connection's CID and the command), a command
+    /// ahead of its turn while other connections may still deliver the
+    /// CmdSNs before it goes in the reorder queue rather than running.
+    /// Returns what to do with it, and the window afterwards.
+    fn deliver(&self, cmd_sn: u32, park: Option<(u16, &IscsiPdu)>) -> (CmdOrder, u32, u32) {
+        let mut window = self.window.lock().unwrap();
+
+        let order = if !IscsiSession::sn_in_window(cmd_sn, window.exp_cmd_sn, window.max_cmd_sn) {
+            CmdOrder::OutOfWindow
+        } else if let Some((cid, pdu)) = park.filter(|_| cmd_sn != window.exp_cmd_sn && self.connection_count() > 1) {
+            window.parked.insert(cmd_sn, ParkedCommand { cid, since: Instant::now(), pdus: vec![pdu.clone()] });
+            CmdOrder::Parked
+        } else {
+            window.deliver(cmd_sn);
+            CmdOrder::Run
+        };
+        (order, window.exp_cmd_sn, window.max_cmd_sn)
+    }
+
+    /// Take connection `cid`'s parked command if the window has reached it
+    ///
+    /// The gap before the parked commands stays open however long it takes
+    /// to fill; once a parked command has waited `timeout` for it, the
+    /// session is failed instead.
+    fn take_ready(&self, cid: u16, timeout: Duration) -> ScsiResult<Option<Vec<IscsiPdu>>> {
+        let mut window = self.window.lock().unwrap();
+        let cmd_sn = window.exp_cmd_sn;
+
+        if self.is_failed() {
+            return Err(IscsiError::Session(format!("Session failed waiting for CmdSN {}", cmd_sn)));
+        }
+        let Some(parked) = window.parked.get(&cmd_sn) else {
+            let waited = window.parked.values().map(|parked| parked.since.elapsed()).max();
+            if waited.is_some_and(|waited| waited >= timeout) {
+                self.failed.store(true, Ordering::SeqCst);
+                return Err(IscsiError::Session(format!(
+                    "CmdSN {} did not arrive within {:?}, failing the session", cmd_sn, timeout
+                )));
+            }
+            return Ok(None);
+        };
+        if parked.cid != cid {
+            return Ok(None);
+        }
+        let parked = window.parked.remove(&cmd_sn).map(|parked| parked.pdus);
+        window.deliver(cmd_sn);
+        Ok(parked)
+    }
+
+    /// Queue Data-Out behind connection `cid`'s parked command `itt`
+    fn park_data_out(&self, cid: u16, itt: u32, pdu: &IscsiPdu) -> bool {
+        let mut window = self.window.lock().unwrap();
+        match window.parked.values_mut().find(|p| p.cid == cid && p.pdus[0].itt == itt) {
+            Some(parked) => {
+                parked.pdus.push(pdu.clone());
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// Forget the parked commands and waiting tasks of a connection that
+    /// is closing
+    pub fn drop_connection(&self, cid: u16) {
+        self.window.lock().unwrap().parked.retain(|_, parked| parked.cid != cid);
+        let mut tasks = self.tasks.lock().unwrap();
+        tasks.pending.retain(|_, task| task.cid != cid);
+        tasks.aborted.remove(&cid);
+    }
+
+    /// Abort every task of the session on `lun`, or on any LUN: those
+    /// waiting for Data-Out on any connection and those parked
+    ///
+    /// A parked command keeps its place in CmdSN order and is dropped when
+    /// its turn comes, so the commands after it are not held up.
+    fn abort_tasks(&self, lun: Option<u16>) -> usize {
+        let window = self.window.lock().unwrap();
+        let mut tasks = self.tasks.lock().unwrap();
+        let mut aborted = tasks.abort_pending(lun);
+        for (&cmd_sn, parked) in window.parked.iter().filter(|(_, parked)| on_lun(parked.pdus[0].lun, lun)) {
+            tasks.abort_not_run(cmd_sn, parked.pdus[0].itt, window.exp_cmd_sn, window.max_cmd_sn);
+            aborted += 1;
+        }
+        aborted
+    }
+
+    /// Abort the session's tasks on `luns` for a reset received on another
+    /// session, and leave each LUN a unit attention with `sense`
+    fn reset(&self, luns: &[u16], sense: &SenseData) -> usize {
+        let mut aborted = 0;
+        for &lun in luns {
+            aborted += self.abort_tasks(Some(lun));
+        }
+        let mut tasks = self.tasks.lock().unwrap();
+        for &lun in luns {
+            tasks.unit_attention.insert(lun, sense.clone());
+        }
+        aborted
+    }
+
+    /// Count another connection, unless the session is full or closing
+    fn add_connection(&self) -> bool {
+        let added = self.connections
+            .fetch_update(Ordering::SeqCst, Ordering::SeqCst, |n| {
+                (n > 0 && n < self.max_connections).then_some(n + 1)
+            })
+            .is_ok();
+        if added {
+            self.window.lock().unwrap().grow();
+        }
+        added
+    }
+
+    /// Stop counting a connection; returns how many remain
+    fn remove_connection(&self) -> u16 {
+        let remaining = self.connections.fetch_sub(1, Ordering::SeqCst) - 1;
+        if remaining > 0 {
+            let mut window = self.window.lock().unwrap();
+            window.shrink += window.per_connection;
+        }
+        remaining
+    }
+}
+
+/// Every normal session in full feature phase, by TSIH
+///
+/// Lets a login that names a TSIH add its connection to that session.
+#[derive(Debug, Default)]
+pub struct SessionTable {
+    sessions: Mutex<HashMap<u16, Arc<SessionCore>>>,
+}
+
+impl SessionTable {
+    /// Create an empty table
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Register a session whose leading connection just completed login
+    pub fn register(&self, session: &IscsiSession) -> Arc<SessionCore> {
+        let core = Arc::new(SessionCore::new(session));
+        let previous = self.sessions.lock().unwrap().insert(core.tsih, Arc::clone(&core));
+        if previous.is_some() {
+            log::warn!("TSIH {} reused while still registered", core.tsih);
+        }
+        core
+    }
+
+    /// LUN RESET and the target resets: abort the tasks every session but
+    /// `tsih`, the one the TMF came on, has on `luns`, and leave each of
+    /// those sessions a unit attention with `sense`
+    ///
+    /// Returns the number of tasks aborted.
+    pub fn reset_others(&self, tsih: u16, luns: &[u16], sense: &SenseData) -> usize {
+        let others: Vec<Arc<SessionCore>> = self.sessions.lock().unwrap()
+            .values()
+            .filter(|core| core.tsih != tsih)
+            .cloned()
+            .collect();
+        others.iter().map(|core| core.reset(luns, sense)).sum()
+    }
+
+    /// Add a connection to session `tsih`
+    ///
+    /// On failure returns the login status detail to reject with:
+    /// SESSION_DOES_NOT_EXIST or TOO_MANY_CONNECTIONS.
+    pub fn attach(&self, tsih: u16, isid: [u8; 6]) -> Result<Arc<SessionCore>, u8> {
+        let sessions = self.sessions.lock().unwrap();
+        let core = match sessions.get(&tsih) {
+            Some(core) if core.isid == isid => core,
+            _ => return Err(0x0A), // SESSION_DOES_NOT_EXIST (0x020A)
+        };
+        if !core.add_connection() {
+            return Err(0x06); // TOO_MANY_CONNECTIONS (0x0206)
+        }
+        Ok(Arc::clone(core))
+    }
+
+    /// Remove a connection; returns true if it was the session's last
+    pub fn detach(&self, core: &SessionCore) -> bool {
+        let mut sessions = self.sessions.lock().unwrap();
+        let remaining = core.remove_connection();
+        if remaining == 0 && sessions.get(&core.tsih).is_some_and(|c| std::ptr::eq(&**c, core)) {
+            sessions.remove(&core.tsih);
+        }
+        remaining == 0
+    }
+
+    /// Number of registered sessions
+    pub fn len(&self) -> usize {
+        self.sessions.lock().unwrap().len()
+    }
+
+    /// Whether no sessions are registered
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
 // ============================================================================
 // Unit Tests
 // ============================================================================
@@ -1174,6 +1840,7 @@ impl IscsiConnection {
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::pdu::serialize_text_parameters;
 
     #[test]
     fn test_session_new() {
@@ -1352,4 +2019,192 @@ mod tests {
         session.apply_initiator_param("HeaderDigest", "None,CRC32C");
         assert_eq!(session.params.header_digest, DigestType::CRC32C);
     }
+
+    #[test]
+    fn test_max_connections_negotiation() {
+        let mut session = IscsiSession::new();
+        session.params.max_connections = 4;
+        // Not offered: RFC 3720 default of one connection
+        assert_eq!(session.negotiated_max_connections(), 1);
+        assert!(!session.generate_response_params().iter().any(|(k, _)| k == "MaxConnections"));
+
+        session.apply_initiator_param("MaxConnections", "8");
+        assert_eq!(session.negotiated_max_connections(), 4);
+        assert!(session.generate_response_params().iter().any(|(k, v)| k == "MaxConnections" && v == "4"));
+
+        session.apply_initiator_param("MaxConnections", "0");
+        assert_eq!(session.negotiated_max_connections(), 1);
+    }
+
+    #[test]
+    fn test_chap_login_exchange() {
+        use crate::auth::{ChapCredentials, ChapHex};
+
+        fn login(session: &mut IscsiSession, csg: u8, nsg: u8, transit: bool, data: &[u8]) -> IscsiPdu {
+            let pdu = IscsiPdu::login_request([0x80, 0, 0, 0, 0, 1], 0, 0, 1, 0, csg, nsg, transit, data.to_vec());
+            session.process_login(&pdu, "iqn.test:target").unwrap()
+        }
+
+        let mut session = IscsiSession::new();
+        session.set_auth_config(AuthConfig::Chap {
+            credentials: ChapCredentials::new("user", "secret"),
+        });
+
+        let response = login(&mut session, 0, 1, false,
+            b"InitiatorName=iqn.test:init\0TargetName=iqn.test:target\0SessionType=Normal\0AuthMethod=CHAP,None\0");
+        assert_eq!(response.data, b"TargetPortalGroupTag=1\0AuthMethod=CHAP\0");
+
+        let response = login(&mut session, 0, 1, false, b"CHAP_A=5\0");
+        let challenge: Vec<_> = pdu::text_parameters(&response.data).collect();
+        assert_eq!(challenge[0], ("CHAP_A", "5"));
+        let state = session.chap_state.clone().unwrap();
+        assert_eq!(challenge[1].1, state.identifier.to_string());
+        assert_eq!(challenge[2].1, state.challenge_hex());
+
+        // A wrong secret is rejected with AUTH_FAILURE
+        let mut rejected = session.clone();
+        let bad = format!("CHAP_N=user\0CHAP_R={}\0", ChapHex(&state.calculate_response("wrong")));
+        let response = login(&mut rejected, 0, 1, true, bad.as_bytes());
+        assert_eq!(response.specific[16..18], [pdu::login_status::INITIATOR_ERROR, 0x01]);
+
+        let good = format!("CHAP_N=user\0CHAP_R={}\0", ChapHex(&state.calculate_response("secret")));
+        let response = login(&mut session, 0, 1, true, good.as_bytes());
+        assert!(session.chap_completed);
+        assert!(response.data.is_empty());
+
+        let response = login(&mut session, 1, 3, true, b"MaxRecvDataSegmentLength=65536\0");
+        assert_eq!(session.state, SessionState::FullFeaturePhase);
+        assert_eq!(response.data, serialize_text_parameters(&session.generate_response_params()));
+    }
+
+    fn joinable_session(tsih: u16, max_connections: u16) -> IscsiSession {
+        let mut session = IscsiSession::new();
+        session.tsih = tsih;
+        session.isid = [0x80, 0, 0, 0, 0, 1];
+        session.params.initiator_name = "iqn.2025-12.test:mcs".to_string();
+        session.params.max_connections = max_connections;
+        session.apply_initiator_param("MaxConnections", &max_connections.to_string());
+        session.exp_cmd_sn = 10;
+        session.max_cmd_sn = 13;
+        session
+    }
+
+    #[test]
+    fn test_session_table_attach_detach() {
+        let table = SessionTable::new();
+        let leading = joinable_session(7, 2);
+        let core = table.register(&leading);
+        assert_eq!(table.len(), 1);
+
+        assert_eq!(table.attach(8, leading.isid).unwrap_err(), 0x0A);
+        assert_eq!(table.attach(7, [0u8; 6]).unwrap_err(), 0x0A);
+
+        let second = table.attach(7, leading.isid).unwrap();
+        assert_eq!(second.connection_count(), 2);
+        assert_eq!(table.attach(7, leading.isid).unwrap_err(), 0x06);
+
+        let mut joined = IscsiSession::new();
+        joined.join(Arc::clone(&second));
+        // The window widens by the leading connection's four slots
+        assert_eq!((joined.tsih, joined.exp_cmd_sn, joined.max_cmd_sn), (7, 10, 17));
+
+        // The session outlives its leading connection
+        assert!(!table.detach(&core));
+        assert_eq!(table.len(), 1);
+        assert!(table.detach(&second));
+        assert!(table.is_empty());
+
+        // A closed session cannot be rejoined through a stale handle
+        assert!(!core.add_connection());
+    }
+
+    #[test]
+    fn test_shared_cmd_sn_ordering() {
+        let table = SessionTable::new();
+        let core = table.register(&joinable_session(9, 2));
+        let joined = table.attach(9, core.isid).unwrap();
+
+        let mut first = IscsiSession::new();
+        first.core = Some(Arc::clone(&core));
+        let mut second = IscsiSession::new();
+        second.cid = 1;
+        second.join(joined);
+
+        let command = |itt: u32| {
+            let mut pdu = IscsiPdu::new();
+            pdu.opcode = pdu::opcode::SCSI_COMMAND;
+            pdu.itt = itt;
+            pdu
+        };
+        let mut data_out = IscsiPdu::new();
+        data_out.opcode = pdu::opcode::SCSI_DATA_OUT;
+        data_out.itt = 0x11;
+
+        // CmdSN 11 arrives on one connection before 10 arrives on the
+        // other, and is parked with its Data-Out rather than run first
+        assert_eq!(second.order_command(11, &command(0x11)), CmdOrder::Parked);
+        assert!(second.has_parked_commands());
+        assert!(second.park_data_out(0x11, &data_out));
+        assert!(!second.park_data_out(0x12, &data_out));
+        assert!(second.next_parked_command().unwrap().is_none());
+
+        assert_eq!(first.order_command(10, &command(0x10)), CmdOrder::Run);
+        assert!(first.next_parked_command().unwrap().is_none());
+        let pdus = second.next_parked_command().unwrap().unwrap();
+        assert_eq!(pdus.iter().map(|p| p.opcode).collect::<Vec<_>>(),
+            vec![pdu::opcode::SCSI_COMMAND, pdu::opcode::SCSI_DATA_OUT]);
+        assert!(!second.has_parked_commands());
+        assert_eq!((second.exp_cmd_sn, second.max_cmd_sn), (12, 19));
+
+        first.sync_cmd_window();
+        assert_eq!((first.exp_cmd_sn, first.max_cmd_sn), (12, 19));
+
+        // Out of window
+        assert!(!first.validate_cmd_sn(20));
+        assert_eq!(first.order_command(20, &command(0x20)), CmdOrder::OutOfWindow);
+
+        // A CmdSN late on the other connection keeps the gap open until
+        // it arrives
+        assert_eq!(first.order_command(13, &command(0x13)), CmdOrder::Parked);
+        assert!(first.next_parked_command().unwrap().is_none());
+        assert_eq!(second.order_command(12, &command(0x12)), CmdOrder::Run);
+        assert_eq!(first.next_parked_command().unwrap().unwrap()[0].itt, 0x13);
+        assert_eq!((first.exp_cmd_sn, first.max_cmd_sn), (14, 21));
+
+        // A closing connection's parked commands go with it
+        assert_eq!(second.order_command(15, &command(0x15)), CmdOrder::Parked);
+        core.drop_connection(second.cid);
+        assert_eq!(first.order_command(14, &command(0x14)), CmdOrder::Run);
+        assert_eq!((first.exp_cmd_sn, first.max_cmd_sn), (15, 22));
+
+        // With the second connection gone the window narrows back to four
+        // slots as commands complete, and MaxCmdSN never goes backwards
+        table.detach(&core);
+        for sn in 15..25 {
+            assert!(first.validate_cmd_sn(sn));
+            assert!(first.max_cmd_sn >= 22);
+        }
+        assert_eq!((first.exp_cmd_sn, first.max_cmd_sn), (25, 28));
+    }
+
+    #[test]
+    fn test_missing_cmd_sn_fails_session() {
+        let table = SessionTable::new();
+        let core = table.register(&joinable_session(10, 2));
+        table.attach(10, core.isid).unwrap();
+        let mut session = IscsiSession::new();
+        session.join(Arc::clone(&core));
+
+        let mut pdu = IscsiPdu::new();
+        pdu.opcode = pdu::opcode::SCSI_COMMAND;
+        assert_eq!(session.order_command(11, &pdu), CmdOrder::Parked);
+        assert!(core.take_ready(session.cid, CMD_ORDER_TIMEOUT).unwrap().is_none());
+        assert!(!session.session_failed());
+
+        // CmdSN 10 never comes: the session fails rather than skip it
+        assert!(core.take_ready(session.cid, Duration::ZERO).is_err());
+        assert!(session.session_failed());
+        assert!(session.next_parked_command().is_err());
+        assert_eq!(core.cmd_window().0, 10);
+    }
 }
@@ -2,26 +2,56 @@
 //!
 //! This module provides the main server structure, TCP listener, and connection handling.
 
+use crate::digest;
 use crate::error::{IscsiError, ScsiResult};
-use crate::pdu::{self, IscsiPdu, BHS_SIZE, opcode, flags, scsi_status, serialize_text_parameters};
+use crate::metrics::TargetMetrics;
+use crate::pdu::{self, IscsiPdu, BHS_SIZE, opcode, scsi_status, serialize_text_parameters};
 use crate::scsi::{ScsiBlockDevice, ScsiHandler, ScsiResponse};
-use crate::session::{IscsiSession, PendingWrite, SessionState};
+use crate::session::{CmdOrder, DigestType, IscsiSession, ParameterData, PendingWrite, SessionState, SessionTable, SessionType, REORDER_POLL_INTERVAL};
+use crate::trace::PduTrace;
 use byteorder::{BigEndian, ByteOrder};
-use std::io::{Read, Write};
-use std::net::{TcpListener, TcpStream, Shutdown};
-use std::sync::{Arc, Mutex, atomic::{AtomicBool, Ordering}};
+use std::collections::BTreeMap;
+use std::io::{IoSlice, Read, Write};
+use mio::{Events, Interest, Poll, Token};
+use std::net::{Shutdown, SocketAddr, TcpListener, TcpStream};
+use std::os::fd::AsRawFd;
+use std::sync::{Arc, RwLock, RwLockReadGuard, atomic::{AtomicBool, AtomicU16, Ordering}};
 use std::thread;
-use std::time::Duration;
+use std::time::{Duration, Instant};
 
 /// Default iSCSI port
 pub const ISCSI_PORT: u16 = 3260;
 
+/// How often accept loops re-check the running flag
+const ACCEPT_POLL_INTERVAL: Duration = Duration::from_millis(100);
+
+/// Default MaxConnections the target offers per session, the RFC 3720 default
+pub const DEFAULT_MAX_CONNECTIONS_PER_SESSION: u16 = 1;
+
+/// Token of the listening socket in an accept loop's poll
+pub(crate) const LISTENER: Token = Token(0);
+
+/// How the target schedules connections
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum ConnectionModel {
+    /// One OS thread per connection, blocking on its socket (default)
+    #[default]
+    ThreadPerConnection,
+    /// One poller thread watches every connection and hands those with
+    /// input to a fixed pool of `workers` threads, so idle sessions hold
+    /// no thread (Unix only)
+    EventDriven {
+        /// Number of worker threads
+        workers: usize,
+    },
+}
+
 /// iSCSI target server
 pub struct IscsiTarget<D: ScsiBlockDevice> {
     bind_addr: String,
     target_name: String,
     target_alias: String,
-    device: Arc<Mutex<D>>,
+    luns: Arc<LunTable<D>>,
     running: Arc<AtomicBool>,
     shutting_down: Arc<AtomicBool>,
     auth_config: crate::auth::AuthConfig,
@@ -29,7 +59,12 @@ pub struct IscsiTarget<D: ScsiBlockDevice> {
     active_connections: Arc<std::sync::atomic::AtomicUsize>,
     max_sessions: u32,
     active_sessions: Arc<std::sync::atomic::AtomicUsize>,
+    max_connections_per_session: u16,
     allowed_initiators: Option<Vec<String>>,
+    connection_model: ConnectionModel,
+    trace: Option<Arc<PduTrace>>,
+    metrics: Arc<TargetMetrics>,
+    metrics_addr: Option<String>,
 }
 
 impl<D: ScsiBlockDevice + Send + 'static> IscsiTarget<D> {
@@ -48,81 +83,65 @@ impl<D: ScsiBlockDevice + Send + 'static> IscsiTarget<D> {
         let listener = TcpListener::bind(&self.bind_addr)
             .map_err(IscsiError::Io)?;
 
-        // Set non-blocking for graceful shutdown checking
+        // Non-blocking so accept loops can also check for shutdown
         listener.set_nonblocking(true)
             .map_err(IscsiError::Io)?;
 
-        self.running.store(true, Ordering::SeqCst);
-
-        log::info!("iSCSI target listening on {}", self.bind_addr);
+        // Bind the metrics endpoint first so a bad address fails the start
+        let metrics_listener = match &self.metrics_addr {
+            Some(addr) => Some(TcpListener::bind(addr).map_err(IscsiError::Io)?),
+            None => None,
+        };
 
-        while self.running.load(Ordering::SeqCst) {
-            match listener.accept() {
-                Ok((stream, addr)) => {
-                    log::info!("New connection from {}", addr);
+        self.running.store(true, Ordering::SeqCst);
 
-                    // Check connection limit
-                    let current = self.active_connections.fetch_add(1, Ordering::SeqCst);
-                    if current >= self.max_connections as usize {
-                        log::warn!("Connection rejected from {}: too many connections ({}/{})",
-                            addr, current + 1, self.max_connections);
-                        self.active_connections.fetch_sub(1, Ordering::SeqCst);
+        let metrics_server = metrics_listener.map(|listener| {
+            log::info!("Serving metrics on http://{}/metrics",
+                listener.local_addr().map(|a| a.to_string()).unwrap_or_default());
+            let metrics = Arc::clone(&self.metrics);
+            let running = Arc::clone(&self.running);
+            thread::spawn(move || crate::metrics::serve(listener, metrics, running))
+        });
 
-                        // Send TOO_MANY_CONNECTIONS reject and close
-                        let _ = send_connection_limit_reject(stream);
-                        continue;
-                    }
+        log::info!("iSCSI target listening on {} ({:?})", self.bind_addr, self.connection_model);
+
+        let ctx = Arc::new(ConnectionContext {
+            luns: Arc::clone(&self.luns),
+            target_name: self.target_name.clone(),
+            target_alias: self.target_alias.clone(),
+            auth_config: self.auth_config.clone(),
+            running: Arc::clone(&self.running),
+            shutting_down: Arc::clone(&self.shutting_down),
+            max_connections: self.max_connections,
+            active_connections: Arc::clone(&self.active_connections),
+            max_sessions: self.max_sessions,
+            active_sessions: Arc::clone(&self.active_sessions),
+            max_connections_per_session: self.max_connections_per_session,
+            sessions: SessionTable::new(),
+            allowed_initiators: self.allowed_initiators.clone(),
+            trace: self.trace.clone(),
+            next_connection: AtomicU16::new(0),
+            metrics: Arc::clone(&self.metrics),
+        });
+        let listener = mio::net::TcpListener::from_std(listener);
+
+        let result = match self.connection_model {
+            ConnectionModel::ThreadPerConnection => run_thread_per_connection(listener, ctx),
+            #[cfg(unix)]
+            ConnectionModel::EventDriven { workers } => crate::event_loop::run(listener, ctx, workers),
+            #[cfg(not(unix))]
+            ConnectionModel::EventDriven { .. } => {
+                Err(IscsiError::Config("Event-driven connections need a Unix platform".to_string()))
+            }
+        };
 
-                    log::debug!("Accepted connection from {} ({}/{} active)",
-                        addr, current + 1, self.max_connections);
-
-                    let device = Arc::clone(&self.device);
-                    let target_name = self.target_name.clone();
-                    let target_alias = self.target_alias.clone();
-                    let auth_config = self.auth_config.clone();
-                    let running = Arc::clone(&self.running);
-                    let shutting_down = Arc::clone(&self.shutting_down);
-                    let active_connections = Arc::clone(&self.active_connections);
-                    let max_sessions = self.max_sessions;
-                    let active_sessions = Arc::clone(&self.active_sessions);
-                    let allowed_initiators = self.allowed_initiators.clone();
-
-                    thread::spawn(move || {
-                        let session_entered = handle_connection(
-                            stream,
-                            device,
-                            &target_name,
-                            &target_alias,
-                            auth_config,
-                            running,
-                            shutting_down,
-                            max_sessions,
-                            Arc::clone(&active_sessions),
-                            allowed_initiators,
-                        ).unwrap_or(false); // Returns true if session was established
-
-                        log::info!("Connection closed from {}", addr);
-
-                        // Decrement connection count
-                        let prev = active_connections.fetch_sub(1, Ordering::SeqCst);
-                        log::debug!("Connection count: {} -> {}", prev, prev - 1);
-
-                        // Decrement session count if a session was established
-                        if session_entered {
-                            let prev = active_sessions.fetch_sub(1, Ordering::SeqCst);
-                            log::debug!("Session count: {} -> {}", prev, prev - 1);
-                        }
-                    });
-                }
-                Err(ref e) if e.kind() == std::io::ErrorKind::WouldBlock => {
-                    // No connection available, sleep briefly and retry
-                    thread::sleep(Duration::from_millis(100));
-                }
-                Err(e) => {
-                    log::error!("Accept error: {}", e);
-                }
+        if let Some(server) = metrics_server {
+            self.running.store(false, Ordering::SeqCst);
+            if let Ok(Err(e)) = server.join() {
+                log::error!("Metrics endpoint failed: {}", e);
             }
         }
+        result?;
 
         log::info!("iSCSI target shutting down");
         Ok(())
@@ -170,6 +189,18 @@ impl<D: ScsiBlockDevice + Send + 'static> IscsiTarget<D> {
     pub fn is_shutting_down(&self) -> bool {
         self.shutting_down.load(Ordering::SeqCst)
     }
+
+    /// Counters and latency histograms for this target
+    pub fn metrics(&self) -> &TargetMetrics {
+        &self.metrics
+    }
+
+    /// The PDU trace, if one was enabled with `IscsiTargetBuilder::pdu_trace`
+    ///
+    /// It can be saved with `PduTrace::write_to` while the target runs.
+    pub fn pdu_trace(&self) -> Option<&PduTrace> {
+        self.trace.as_deref()
+    }
 }
 
 /// Send TOO_MANY_CONNECTIONS reject to a new connection
@@ -186,7 +217,7 @@ fn send_connection_limit_reject(mut stream: TcpStream) -> ScsiResult<()> {
         // Create login reject with TOO_MANY_CONNECTIONS (0x0206)
         let session = crate::session::IscsiSession::new();
         if let Ok(reject_pdu) = session.create_too_many_connections_reject(itt) {
-            let _ = write_pdu(&mut stream, &reject_pdu);
+            let _ = PduStream::new(&mut stream).write_pdu(&reject_pdu, Digests::default());
         }
     }
 
@@ -195,187 +226,833 @@ fn send_connection_limit_reject(mut stream: TcpStream) -> ScsiResult<()> {
     Ok(())
 }
 
-/// Handle a single iSCSI connection
-fn handle_connection<D: ScsiBlockDevice>(
-    mut stream: TcpStream,
-    device: Arc<Mutex<D>>,
-    target_name: &str,
-    target_alias: &str,
+/// Target state every connection shares
+pub(crate) struct ConnectionContext<D> {
+    luns: Arc<LunTable<D>>,
+    target_name: String,
+    target_alias: String,
     auth_config: crate::auth::AuthConfig,
-    running: Arc<AtomicBool>,
+    pub(crate) running: Arc<AtomicBool>,
     shutting_down: Arc<AtomicBool>,
+    max_connections: u32,
+    active_connections: Arc<std::sync::atomic::AtomicUsize>,
     max_sessions: u32,
     active_sessions: Arc<std::sync::atomic::AtomicUsize>,
+    max_connections_per_session: u16,
+    /// Normal sessions by TSIH, for connections joining them
+    sessions: SessionTable,
     allowed_initiators: Option<Vec<String>>,
-) -> ScsiResult<bool> {
-    // Get the local address that the client connected to
-    let local_addr = stream.local_addr().map_err(IscsiError::Io)?;
-    // Set blocking mode and timeouts for the connection
-    stream.set_nonblocking(false).map_err(IscsiError::Io)?;
-    // During login phase, use a shorter timeout to detect stalled logins quickly
-    // This prevents resource leaks from clients that initiate login but never complete it
-    stream.set_read_timeout(Some(Duration::from_secs(5))).map_err(IscsiError::Io)?;
-    stream.set_write_timeout(Some(Duration::from_secs(5))).map_err(IscsiError::Io)?;
-
-    let mut session = IscsiSession::new();
-    session.params.target_name = target_name.to_string();
-    session.params.target_alias = target_alias.to_string();
-    session.set_auth_config(auth_config);
-    session.set_allowed_initiators(allowed_initiators.clone());
-
-    // Track whether this connection established a full session
-    let mut session_entered = false;
-
-    // Main connection loop
-    while running.load(Ordering::SeqCst) {
+    trace: Option<Arc<PduTrace>>,
+    /// Source of connection numbers in the trace
+    next_connection: AtomicU16,
+    pub(crate) metrics: Arc<TargetMetrics>,
+}
+
+/// Accept loop for `ConnectionModel::ThreadPerConnection`
+///
+/// The listener is polled rather than slept on, so a new connection is
+/// accepted as soon as it arrives.
+fn run_thread_per_connection<D: ScsiBlockDevice + 'static>(
+    mut listener: mio::net::TcpListener,
+    ctx: Arc<ConnectionContext<D>>,
+) -> ScsiResult<()> {
+    let mut poll = Poll::new().map_err(IscsiError::Io)?;
+    poll.registry()
+        .register(&mut listener, LISTENER, Interest::READABLE)
+        .map_err(IscsiError::Io)?;
+    let mut events = Events::with_capacity(16);
+
+    while ctx.running.load(Ordering::SeqCst) {
+        match poll.poll(&mut events, Some(ACCEPT_POLL_INTERVAL)) {
+            Ok(()) => {}
+            Err(ref e) if e.kind() == std::io::ErrorKind::Interrupted => continue,
+            Err(e) => return Err(IscsiError::Io(e)),
+        }
+
+        accept_ready(&listener, &ctx, false, |mut conn| {
+            thread::spawn(move || while let Ok(true) = conn.step() {});
+        });
+    }
+    Ok(())
+}
+
+/// Accept every pending connection and pass each admitted one to `serve`
+///
+/// Connections over the limit get TOO_MANY_CONNECTIONS from a short-lived
+/// thread, so a slow initiator cannot stall the accept loop.
+pub(crate) fn accept_ready<D: ScsiBlockDevice + 'static>(
+    listener: &mio::net::TcpListener,
+    ctx: &Arc<ConnectionContext<D>>,
+    multiplexed: bool,
+    mut serve: impl FnMut(Connection<D>),
+) {
+    loop {
+        let (stream, addr) = match listener.accept() {
+            Ok(accepted) => accepted,
+            Err(ref e) if e.kind() == std::io::ErrorKind::WouldBlock => return,
+            Err(ref e) if e.kind() == std::io::ErrorKind::Interrupted => continue,
+            Err(e) => {
+                log::error!("Accept error: {}", e);
+                return;
+            }
+        };
+        let stream = TcpStream::from(stream);
+        log::info!("New connection from {}", addr);
+
+        // Check connection limit
+        let current = ctx.active_connections.fetch_add(1, Ordering::SeqCst);
+        if current >= ctx.max_connections as usize {
+            log::warn!("Connection rejected from {}: too many connections ({}/{})",
+                addr, current + 1, ctx.max_connections);
+            ctx.active_connections.fetch_sub(1, Ordering::SeqCst);
+
+            // Send TOO_MANY_CONNECTIONS reject and close
+            thread::spawn(move || send_connection_limit_reject(stream));
+            continue;
+        }
+
+        log::debug!("Accepted connection from {} ({}/{} active)",
+            addr, current + 1, ctx.max_connections);
+
+        match Connection::new(stream, addr, Arc::clone(ctx), multiplexed) {
+            Ok(conn) => serve(conn),
+            Err(e) => {
+                log::error!("Failed to set up connection from {}: {}", addr, e);
+                ctx.active_connections.fetch_sub(1, Ordering::SeqCst);
+            }
+        }
+    }
+}
+
+/// One initiator connection and its session
+///
+/// The connection and session counts are released when it is dropped.
+pub(crate) struct Connection<D> {
+    ctx: Arc<ConnectionContext<D>>,
+    conn: PduStream<TcpStream>,
+    session: IscsiSession,
+    target_address: String,
+    peer: SocketAddr,
+    /// Whether this connection established a full session
+    session_entered: bool,
+    /// Set when a poller waits for input. Reads then never block: a PDU
+    /// that arrives in pieces is kept and finished on a later readiness
+    /// event, and the short login timeouts stay in full feature phase.
+    multiplexed: bool,
+    /// Connection number in the PDU trace
+    trace_id: u16,
+}
+
+impl<D: ScsiBlockDevice> Connection<D> {
+    fn new(stream: TcpStream, peer: SocketAddr, ctx: Arc<ConnectionContext<D>>, multiplexed: bool) -> ScsiResult<Self> {
+        // Get the local address that the client connected to
+        let target_address = stream.local_addr().map_err(IscsiError::Io)?.to_string();
+        // Set blocking mode and timeouts for the connection
+        stream.set_nonblocking(false).map_err(IscsiError::Io)?;
+        stream.set_nodelay(true).map_err(IscsiError::Io)?;
+        // During login phase, use a shorter timeout to detect stalled logins quickly
+        // This prevents resource leaks from clients that initiate login but never complete it
+        stream.set_read_timeout(Some(Duration::from_secs(5))).map_err(IscsiError::Io)?;
+        stream.set_write_timeout(Some(Duration::from_secs(5))).map_err(IscsiError::Io)?;
+
+        let mut session = IscsiSession::new();
+        session.params.target_name = ctx.target_name.clone();
+        session.params.target_alias = ctx.target_alias.clone();
+        session.set_auth_config(ctx.auth_config.clone());
+        session.set_allowed_initiators(ctx.allowed_initiators.clone());
+        session.params.max_connections = ctx.max_connections_per_session;
+        let trace_id = ctx.next_connection.fetch_add(1, Ordering::Relaxed);
+
+        Ok(Connection {
+            ctx,
+            conn: PduStream::new(stream),
+            session,
+            target_address,
+            peer,
+            session_entered: false,
+            multiplexed,
+            trace_id,
+        })
+    }
+
+    pub(crate) fn stream(&self) -> &TcpStream {
+        &self.conn.stream
+    }
+
+    /// Whether `step` would find input (or end of stream) without waiting
+    pub(crate) fn is_readable(&self) -> bool {
+        let stream = &self.conn.stream;
+        if stream.set_nonblocking(true).is_err() {
+            return true;
+        }
+        let mut byte = [0u8; 1];
+        let readable = !matches!(stream.peek(&mut byte), Err(ref e) if e.kind() == std::io::ErrorKind::WouldBlock);
+        let _ = stream.set_nonblocking(false);
+        readable
+    }
+
+    /// Wait up to `timeout` for input; true if some (or an error) is waiting
+    fn wait_readable(&self, timeout: Duration) -> bool {
+        let mut fd = libc::pollfd { fd: self.conn.stream.as_raw_fd(), events: libc::POLLIN, revents: 0 };
+        // SAFETY: fd is a single valid pollfd for the duration of the call
+        unsafe { libc::poll(&mut fd, 1, timeout.as_millis() as libc::c_int) != 0 }
+    }
+
+    /// Read the next PDU, without blocking when multiplexed
+    fn read_pdu(&mut self, digests: Digests) -> ScsiResult<ReceivedPdu> {
+        if !self.multiplexed {
+            return self.conn.read_pdu(digests);
+        }
+        self.conn.stream.set_nonblocking(true).map_err(IscsiError::Io)?;
+        let received = self.conn.read_pdu(digests);
+        self.conn.stream.set_nonblocking(false).map_err(IscsiError::Io)?;
+        received
+    }
+
+    /// Whether commands of this connection wait in the session's reorder queue
+    pub(crate) fn has_parked(&self) -> bool {
+        self.session.has_parked_commands()
+    }
+
+    /// Run the parked commands the session's CmdSN window has reached
+    pub(crate) fn run_parked(&mut self) -> ScsiResult<()> {
+        let digests = Digests::from_session(&self.session);
+        while let Some(pdus) = self.session.next_parked_command()? {
+            let mut response = run_scsi_command(&mut self.session, &pdus[0], &self.ctx.luns)?;
+            for data_out in &pdus[1..] {
+                response.extend(handle_scsi_data_out(&mut self.session, data_out, &self.ctx.luns)?);
+            }
+            self.send_responses(&response, digests)?;
+        }
+        Ok(())
+    }
+
+    /// Send response PDUs in one batch
+    fn send_responses(&mut self, response: &[IscsiPdu], digests: Digests) -> ScsiResult<()> {
+        for resp_pdu in response {
+            log::debug!("Sending PDU: {} (opcode 0x{:02x})", resp_pdu.opcode_name(), resp_pdu.opcode);
+            self.ctx.metrics.pdu_sent(resp_pdu);
+            if let Some(trace) = &self.ctx.trace {
+                trace.record(self.trace_id, resp_pdu);
+            }
+        }
+        self.conn.write_pdus(response, digests)
+    }
+
+    /// Read one PDU and send its responses
+    ///
+    /// Returns false once the connection should close.
+    pub(crate) fn step(&mut self) -> ScsiResult<bool> {
+        if !self.ctx.running.load(Ordering::SeqCst) {
+            return Ok(false);
+        }
+        if self.session.session_failed() {
+            log::warn!("Session TSIH {} failed, closing connection CID {}", self.session.tsih, self.session.cid);
+            return Ok(false);
+        }
+
+        // Parked commands run once the session reaches them; while some
+        // wait, poll for input rather than block on it. A multiplexed
+        // connection goes back to the poller, which checks on it instead.
+        self.run_parked()?;
+        if !self.multiplexed {
+            while self.has_parked() && !self.wait_readable(REORDER_POLL_INTERVAL) {
+                if !self.ctx.running.load(Ordering::SeqCst) {
+                    return Ok(false);
+                }
+                self.run_parked()?;
+            }
+        }
+
         // Read PDU from stream
-        let pdu = match read_pdu(&mut stream) {
-            Ok(pdu) => pdu,
+        let digests = Digests::from_session(&self.session);
+        let received = self.read_pdu(digests);
+        let session = &mut self.session;
+        let ctx = &*self.ctx;
+        let pdu = match received {
+            Ok(ReceivedPdu::Pdu(pdu)) => pdu,
+            Ok(ReceivedPdu::DataDigestError(bhs)) => {
+                // RFC 3720 Section 6.7: reject and discard; the initiator recovers the task
+                log::warn!("Data digest error on opcode 0x{:02x}, rejecting PDU", bhs[0] & 0x3F);
+                let reject = session.create_reject(pdu::reject_reason::DATA_DIGEST_ERROR, &bhs);
+                self.send_responses(std::slice::from_ref(&reject), digests)?;
+                return Ok(true);
+            }
             Err(IscsiError::Io(ref e)) if e.kind() == std::io::ErrorKind::UnexpectedEof => {
                 log::debug!("Connection closed by initiator");
-                break;
+                return Ok(false);
             }
             Err(IscsiError::Io(ref e)) if e.kind() == std::io::ErrorKind::WouldBlock => {
-                continue;
+                // Linux reports a read timeout as WouldBlock; on a multiplexed
+                // connection the rest of the PDU has not arrived yet. Either
+                // way the read resumes where it stopped.
+                return Ok(true);
             }
             Err(IscsiError::Io(ref e)) if e.kind() == std::io::ErrorKind::TimedOut => {
                 log::debug!("Connection timeout, closing");
-                break;
+                return Ok(false);
             }
             Err(e) => {
                 log::error!("Error reading PDU: {}", e);
-                break;
+                return Ok(false);
             }
         };
 
         log::debug!("Received PDU: {} (opcode 0x{:02x})", pdu.opcode_name(), pdu.opcode);
+        ctx.metrics.pdu_received(&pdu);
+        if let Some(trace) = &ctx.trace {
+            trace.record(self.trace_id, &pdu);
+        }
 
         // Process PDU based on session state
-        let target_address = local_addr.to_string();
         let prev_state = session.state.clone();
         let response = match session.state {
             SessionState::Free | SessionState::SecurityNegotiation | SessionState::LoginOperationalNegotiation => {
-                handle_login_phase(&mut session, &pdu, target_name, &target_address, &shutting_down, max_sessions, &active_sessions)?
+                handle_login_phase(session, &pdu, ctx, &self.target_address)?
             }
             SessionState::FullFeaturePhase => {
-                handle_full_feature_phase(&mut session, &pdu, &device, target_name, &target_address)?
+                handle_full_feature_phase(session, &pdu, &ctx.luns, &ctx.sessions, &ctx.target_name, &self.target_address)?
             }
             SessionState::Logout => {
                 log::info!("Session logout complete");
-                break;
+                return Ok(false);
             }
             SessionState::Failed => {
                 log::error!("Session in failed state");
-                break;
+                return Ok(false);
             }
         };
 
         // Adjust timeout when transitioning to FullFeaturePhase
         if prev_state != SessionState::FullFeaturePhase && session.state == SessionState::FullFeaturePhase {
-            log::info!("Session entered FullFeaturePhase, increasing timeout");
-            stream.set_read_timeout(Some(Duration::from_secs(300))).ok();
-            stream.set_write_timeout(Some(Duration::from_secs(30))).ok();
+            if !self.multiplexed {
+                log::info!("Session entered FullFeaturePhase, increasing timeout");
+                self.conn.stream.set_read_timeout(Some(Duration::from_secs(300))).ok();
+                self.conn.stream.set_write_timeout(Some(Duration::from_secs(30))).ok();
+            }
 
-            // Track that a session was established and increment counter
-            session_entered = true;
-            let count = active_sessions.fetch_add(1, Ordering::SeqCst);
-            log::debug!("Session count: {} -> {}", count, count + 1);
-        }
+            if let Some(core) = &session.core {
+                // Added to an existing session, which is already counted
+                log::info!("Connection CID {} joined session TSIH {} ({}/{} connections)",
+                    session.cid, core.tsih, core.connection_count(), core.max_connections);
+            } else {
+                if session.session_type == SessionType::Normal {
+                    session.core = Some(ctx.sessions.register(session));
+                }
 
-        // Send response(s)
-        for resp_pdu in response {
-            log::debug!("Sending PDU: {} (opcode 0x{:02x})", resp_pdu.opcode_name(), resp_pdu.opcode);
-            write_pdu(&mut stream, &resp_pdu)?;
+                // Track that a session was established and increment counter
+                self.session_entered = true;
+                let count = ctx.active_sessions.fetch_add(1, Ordering::SeqCst);
+                log::debug!("Session count: {} -> {}", count, count + 1);
+            }
         }
 
-        // If we've transitioned to Logout state, break immediately after sending response
+        // Send response(s) in one batch. Digests start after the final Login
+        // Response, so use the state the PDU was received in rather than the new one.
+        self.send_responses(&response, digests)?;
+        self.conn.recycle(pdu.data);
+
+        // If we've transitioned to Logout state, stop immediately after sending response
         // This prevents blocking on the next read_pdu() call with a long timeout
+        let session = &self.session;
         if matches!(session.state, SessionState::Logout | SessionState::Failed) {
             log::info!("Session ending (state: {:?})", session.state);
-            break;
+            return Ok(false);
         }
+        Ok(true)
     }
+}
 
-    // Clean shutdown
-    let _ = stream.shutdown(Shutdown::Both);
-    Ok(session_entered)
+impl<D> Drop for Connection<D> {
+    fn drop(&mut self) {
+        // Clean shutdown
+        let _ = self.conn.stream.shutdown(Shutdown::Both);
+        log::info!("Connection closed from {}", self.peer);
+
+        // Decrement connection count
+        let prev = self.ctx.active_connections.fetch_sub(1, Ordering::SeqCst);
+        log::debug!("Connection count: {} -> {}", prev, prev - 1);
+
+        // Decrement session count if a session was established. A session
+        // with several connections ends when the last one closes.
+        let session_ended = match self.session.core.take() {
+            Some(core) => leave_session(&self.ctx.sessions, &core, &self.session),
+            None => self.session_entered,
+        };
+        if session_ended {
+            let prev = self.ctx.active_sessions.fetch_sub(1, Ordering::SeqCst);
+            log::debug!("Session count: {} -> {}", prev, prev - 1);
+        }
+    }
+}
+
+/// Logical units the target exports
+///
+/// Each LUN has its own device behind its own lock, so commands to
+/// different LUNs never wait for each other.
+struct LunTable<D> {
+    devices: BTreeMap<u16, SharedDevice<D>>,
+    /// LUN numbers in ascending order, as REPORT LUNS lists them
+    numbers: Vec<u16>,
+}
+
+impl<D: ScsiBlockDevice> LunTable<D> {
+    fn new(devices: Vec<(u16, D)>, metrics: &Arc<TargetMetrics>) -> Self {
+        let devices: BTreeMap<u16, SharedDevice<D>> = devices
+            .into_iter()
+            .map(|(lun, device)| (lun, SharedDevice::new(device, Arc::clone(metrics))))
+            .collect();
+        let numbers = devices.keys().copied().collect();
+        LunTable { devices, numbers }
+    }
+
+    /// Device and number of the LUN a PDU's LUN field addresses
+    fn get(&self, lun: u64) -> Option<(u16, &SharedDevice<D>)> {
+        let number = ScsiHandler::decode_lun(lun)?;
+        self.devices.get(&number).map(|device| (number, device))
+    }
+}
+
+/// Backing device of one LUN, shared by every connection
+///
+/// Reads and other non-mutating commands hold the lock shared, so sessions
+/// run them in parallel. Writes and flushes take it exclusively unless the
+/// device reports `concurrent_writes()`, in which case they go through
+/// `write_shared`/`flush_shared` under the shared lock as well.
+struct SharedDevice<D> {
+    inner: RwLock<D>,
+    concurrent_writes: bool,
+    block_size: u32,
+    metrics: Arc<TargetMetrics>,
+}
+
+impl<D: ScsiBlockDevice> SharedDevice<D> {
+    fn new(device: D, metrics: Arc<TargetMetrics>) -> Self {
+        let concurrent_writes = device.concurrent_writes();
+        let block_size = device.block_size();
+        log::debug!("Device writes: {}", if concurrent_writes { "concurrent" } else { "exclusive" });
+        SharedDevice {
+            inner: RwLock::new(device),
+            concurrent_writes,
+            block_size,
+            metrics,
+        }
+    }
+
+    fn block_size(&self) -> u32 {
+        self.block_size
+    }
+
+    fn read(&self) -> ScsiResult<RwLockReadGuard<'_, D>> {
+        let start = Instant::now();
+        let guard = self.inner.read().map_err(|_| IscsiError::Scsi("Device lock poisoned".to_string()));
+        self.metrics.lock_wait.record(start.elapsed());
+        guard
+    }
+
+    /// Read into `buf` through a guard from `read`
+    fn read_into(&self, device: &D, lba: u64, buf: &mut [u8]) -> ScsiResult<()> {
+        let start = Instant::now();
+        let result = device.read_into(lba, (buf.len() / self.block_size as usize) as u32, self.block_size, buf);
+        self.metrics.device_read.record(start.elapsed());
+        result
+    }
+
+    fn write(&self, lba: u64, data: &[u8], block_size: u32) -> ScsiResult<()> {
+        self.mutate(
+            &self.metrics.device_write,
+            |device| device.write_shared(lba, data, block_size),
+            |device| device.write(lba, data, block_size),
+        )
+    }
+
+    fn flush(&self) -> ScsiResult<()> {
+        self.mutate(&self.metrics.device_flush, |device| device.flush_shared(), |device| device.flush())
+    }
+
+    fn unmap(&self, lba: u64, blocks: u64) -> ScsiResult<()> {
+        self.mutate(
+            &self.metrics.device_unmap,
+            |device| device.unmap_shared(lba, blocks),
+            |device| device.unmap(lba, blocks),
+        )
+    }
+
+    /// Run a write or flush, through the shared lock when the device allows it
+    fn mutate(
+        &self,
+        latency: &crate::metrics::LatencyHistogram,
+        shared: impl FnOnce(&D) -> ScsiResult<()>,
+        exclusive: impl FnOnce(&mut D) -> ScsiResult<()>,
+    ) -> ScsiResult<()> {
+        if self.concurrent_writes {
+            let guard = self.read()?;
+            let start = Instant::now();
+            let result = shared(&guard);
+            latency.record(start.elapsed());
+            return result;
+        }
+
+        let start = Instant::now();
+        let mut guard = self.inner
+            .write()
+            .map_err(|_| IscsiError::Scsi("Device lock poisoned".to_string()))?;
+        self.metrics.lock_wait.record(start.elapsed());
+        let start = Instant::now();
+        let result = exclusive(&mut guard);
+        latency.record(start.elapsed());
+        result
+    }
+}
+
+/// Digests negotiated for a connection; both are off until full feature phase
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+struct Digests {
+    header: bool,
+    data: bool,
+}
+
+impl Digests {
+    fn from_session(session: &IscsiSession) -> Self {
+        if session.state != SessionState::FullFeaturePhase {
+            return Digests::default();
+        }
+        Digests {
+            header: session.params.header_digest == DigestType::CRC32C,
+            data: session.params.data_digest == DigestType::CRC32C,
+        }
+    }
+}
+
+/// A PDU read off the wire
+enum ReceivedPdu {
+    Pdu(IscsiPdu),
+    /// The data segment failed its digest; the header is kept for the Reject
+    DataDigestError([u8; BHS_SIZE]),
+}
+
+/// Most slices passed to one `write_vectored` call (Linux IOV_MAX)
+const MAX_IOVECS: usize = 1024;
+
+/// Slices per PDU: header, AHS, header digest, data, padding, data digest
+const IOVECS_PER_PDU: usize = 6;
+
+/// Zeros for AHS placeholders (at most 255 words) and data padding
+static ZEROS: [u8; 255 * 4] = [0u8; 255 * 4];
+
+/// Serialized header and digests of a PDU waiting to be sent
+#[derive(Clone, Copy)]
+struct WireHeader {
+    bhs: [u8; BHS_SIZE],
+    header_digest: [u8; digest::DIGEST_SIZE],
+    data_digest: [u8; digest::DIGEST_SIZE],
+}
+
+/// Part of a PDU being received
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum RxStage {
+    Bhs,
+    Ahs,
+    HeaderDigest,
+    Data,
+    DataDigest,
+}
+
+/// Progress through the PDU being received
+///
+/// Kept when input runs out part way through (a non-blocking socket, or a
+/// read timeout), so the next `read_pdu` carries on where this one stopped.
+struct RxState {
+    stage: RxStage,
+    /// Bytes of the current stage read so far
+    filled: usize,
+    bhs: [u8; BHS_SIZE],
+    digest: [u8; digest::DIGEST_SIZE],
+    /// Padded data segment, which becomes the PDU's `data`
+    data: Vec<u8>,
 }
 
-/// Read a PDU from the TCP stream
-fn read_pdu(stream: &mut TcpStream) -> ScsiResult<IscsiPdu> {
-    // Read 48-byte BHS
-    let mut bhs = [0u8; BHS_SIZE];
-    stream.read_exact(&mut bhs).map_err(IscsiError::Io)?;
+impl RxState {
+    fn new() -> Self {
+        RxState {
+            stage: RxStage::Bhs,
+            filled: 0,
+            bhs: [0u8; BHS_SIZE],
+            digest: [0u8; digest::DIGEST_SIZE],
+            data: Vec::new(),
+        }
+    }
+
+    fn next(&mut self, stage: RxStage) {
+        self.stage = stage;
+        self.filled = 0;
+    }
+}
 
-    // Parse AHS length and data segment length from BHS
-    let ahs_length = bhs[4] as usize * 4;
-    let data_length = ((bhs[5] as u32) << 16) | ((bhs[6] as u32) << 8) | (bhs[7] as u32);
-    let padded_data_len = (data_length as usize).div_ceil(4) * 4;
+/// PDU framing for one connection
+///
+/// Buffers are kept across PDUs: the data segment of each received PDU is
+/// read straight into a recycled buffer that becomes the PDU's `data`, and
+/// responses go out with one vectored write per batch without copying
+/// header and data into one buffer.
+struct PduStream<S> {
+    stream: S,
+    /// Receive buffer handed back by `recycle`
+    spare: Vec<u8>,
+    /// AHS of the PDU being received; only read for the header digest
+    ahs: Vec<u8>,
+    /// The PDU being received
+    rx: RxState,
+    /// Headers of the PDUs being sent
+    headers: Vec<WireHeader>,
+}
 
-    // Read remaining data (AHS + data segment + padding)
-    let total_len = BHS_SIZE + ahs_length + padded_data_len;
-    let mut full_pdu = vec![0u8; total_len];
-    full_pdu[..BHS_SIZE].copy_from_slice(&bhs);
+impl<S: Read + Write> PduStream<S> {
+    fn new(stream: S) -> Self {
+        PduStream {
+            stream,
+            spare: Vec::new(),
+            ahs: Vec::new(),
+            rx: RxState::new(),
+            headers: Vec::new(),
+        }
+    }
 
-    if total_len > BHS_SIZE {
-        stream.read_exact(&mut full_pdu[BHS_SIZE..]).map_err(IscsiError::Io)?;
+    /// Hand a processed PDU's data back for the next read
+    fn recycle(&mut self, data: Vec<u8>) {
+        if data.capacity() > self.spare.capacity() {
+            self.spare = data;
+        }
     }
 
-    let pdu = IscsiPdu::from_bytes(&full_pdu)?;
+    /// Read a PDU, checking any negotiated digests
+    ///
+    /// An error of kind WouldBlock (or TimedOut) leaves a partly read PDU
+    /// in place; calling again once more input is waiting finishes it.
+    fn read_pdu(&mut self, digests: Digests) -> ScsiResult<ReceivedPdu> {
+        let PduStream { stream, spare, ahs, rx, .. } = self;
+        let mut data_digest_ok = true;
+        loop {
+            match rx.stage {
+                RxStage::Bhs => {
+                    fill(stream, &mut rx.bhs, &mut rx.filled)?;
+                    // AHS and data segment lengths come from the BHS; data
+                    // and padding go straight into the buffer the PDU will own
+                    ahs.clear();
+                    ahs.resize(rx.bhs[4] as usize * 4, 0);
+                    rx.data = std::mem::take(spare);
+                    rx.data.clear();
+                    rx.data.resize((BigEndian::read_u24(&rx.bhs[5..8]) as usize).div_ceil(4) * 4, 0);
+                    rx.next(RxStage::Ahs);
+                }
+                RxStage::Ahs => {
+                    fill(stream, ahs, &mut rx.filled)?;
+                    rx.next(if digests.header { RxStage::HeaderDigest } else { RxStage::Data });
+                }
+                RxStage::HeaderDigest => {
+                    fill(stream, &mut rx.digest, &mut rx.filled)?;
+                    let crc = digest::crc32c_append(digest::crc32c(&rx.bhs), ahs);
+                    if digest::from_wire(&rx.digest) != crc {
+                        // Header fields can't be trusted, so the PDU can't be skipped: drop the connection
+                        return Err(IscsiError::Protocol("Header digest error".to_string()));
+                    }
+                    rx.next(RxStage::Data);
+                }
+                RxStage::Data => {
+                    fill(stream, &mut rx.data, &mut rx.filled)?;
+                    if digests.data && !rx.data.is_empty() {
+                        rx.next(RxStage::DataDigest);
+                    } else {
+                        break;
+                    }
+                }
+                RxStage::DataDigest => {
+                    fill(stream, &mut rx.digest, &mut rx.filled)?;
+                    data_digest_ok = digest::from_wire(&rx.digest) == digest::crc32c(&rx.data);
+                    break;
+                }
+            }
+        }
+        rx.next(RxStage::Bhs);
+
+        let bhs = rx.bhs;
+        let mut data = std::mem::take(&mut rx.data);
+        data.truncate(BigEndian::read_u24(&bhs[5..8]) as usize);
+
+        if log::log_enabled!(log::Level::Debug) {
+            log_header("Received", &bhs);
+        }
+
+        if !data_digest_ok {
+            *spare = data;
+            return Ok(ReceivedPdu::DataDigestError(bhs));
+        }
+
+        Ok(ReceivedPdu::Pdu(IscsiPdu::from_header(&bhs, data)))
+    }
 
-    // Log received PDU header details
-    if full_pdu.len() >= 48 {
-        log::debug!("Received PDU header hex: {}", full_pdu[0..48].iter().map(|b| format!("{:02x}", b)).collect::<Vec<_>>().join(" "));
-        log::debug!("  [0] Opcode: 0x{:02x}", full_pdu[0]);
-        log::debug!("  [1] Flags: 0x{:02x}", full_pdu[1]);
-        log::debug!("  [5-7] DataSegmentLength: {} bytes", (full_pdu[5] as u32) << 16 | (full_pdu[6] as u32) << 8 | full_pdu[7] as u32);
+    /// Write a PDU, appending any negotiated digests
+    fn write_pdu(&mut self, pdu: &IscsiPdu, digests: Digests) -> ScsiResult<()> {
+        self.write_pdus(std::slice::from_ref(pdu), digests)
     }
 
-    Ok(pdu)
+    /// Write a set of PDUs with as few system calls as possible
+    ///
+    /// PDUs are gathered into vectored writes of up to `MAX_IOVECS`
+    /// slices, and the stream is flushed once at the end.
+    fn write_pdus(&mut self, pdus: &[IscsiPdu], digests: Digests) -> ScsiResult<()> {
+        self.headers.clear();
+        for pdu in pdus {
+            let bhs = pdu.header_bytes();
+            let ahs = &ZEROS[..pdu.ahs_length as usize * 4];
+            let pad = &ZEROS[..pdu.data.len().div_ceil(4) * 4 - pdu.data.len()];
+
+            let mut header = WireHeader {
+                bhs,
+                header_digest: [0u8; digest::DIGEST_SIZE],
+                data_digest: [0u8; digest::DIGEST_SIZE],
+            };
+            if digests.header {
+                let crc = digest::crc32c_append(digest::crc32c(&bhs), ahs);
+                header.header_digest = digest::to_wire(crc);
+            }
+            // The data digest covers the padded data segment
+            if digests.data && !pdu.data.is_empty() {
+                let crc = digest::crc32c_append(digest::crc32c(&pdu.data), pad);
+                header.data_digest = digest::to_wire(crc);
+            }
+            if log::log_enabled!(log::Level::Debug) {
+                log_header("Sending", &bhs);
+            }
+            self.headers.push(header);
+        }
+
+        let mut slices = [IoSlice::new(&[]); MAX_IOVECS];
+        for (headers, pdus) in self
+            .headers
+            .chunks(MAX_IOVECS / IOVECS_PER_PDU)
+            .zip(pdus.chunks(MAX_IOVECS / IOVECS_PER_PDU))
+        {
+            let mut count = 0;
+            for (header, pdu) in headers.iter().zip(pdus) {
+                let pad = pdu.data.len().div_ceil(4) * 4 - pdu.data.len();
+                push_slice(&mut slices, &mut count, &header.bhs);
+                push_slice(&mut slices, &mut count, &ZEROS[..pdu.ahs_length as usize * 4]);
+                if digests.header {
+                    push_slice(&mut slices, &mut count, &header.header_digest);
+                }
+                push_slice(&mut slices, &mut count, &pdu.data);
+                push_slice(&mut slices, &mut count, &ZEROS[..pad]);
+                if digests.data && !pdu.data.is_empty() {
+                    push_slice(&mut slices, &mut count, &header.data_digest);
+                }
+            }
+            write_all_vectored(&mut self.stream, &mut slices[..count]).map_err(IscsiError::Io)?;
+        }
+
+        self.stream.flush().map_err(IscsiError::Io)?;
+        Ok(())
+    }
 }
 
-/// Write a PDU to the TCP stream
-fn write_pdu(stream: &mut TcpStream, pdu: &IscsiPdu) -> ScsiResult<()> {
-    let bytes = pdu.to_bytes();
+/// Read into `buf` until it is full, counting progress in `filled` so a
+/// read that runs out of input can be resumed
+fn fill<R: Read>(stream: &mut R, buf: &mut [u8], filled: &mut usize) -> ScsiResult<()> {
+    while *filled < buf.len() {
+        match stream.read(&mut buf[*filled..]) {
+            Ok(0) => return Err(IscsiError::Io(std::io::ErrorKind::UnexpectedEof.into())),
+            Ok(n) => *filled += n,
+            Err(ref e) if e.kind() == std::io::ErrorKind::Interrupted => {}
+            Err(e) => return Err(IscsiError::Io(e)),
+        }
+    }
+    Ok(())
+}
 
-    // Log PDU header in detail
-    if bytes.len() >= 48 {
-        log::debug!("PDU Header hex: {}", bytes[0..48].iter().map(|b| format!("{:02x}", b)).collect::<Vec<_>>().join(" "));
-        log::debug!("  [0] Opcode: 0x{:02x}", bytes[0]);
-        log::debug!("  [1] Flags: 0x{:02x}", bytes[1]);
-        log::debug!("  [5-7] DataSegmentLength: {} bytes", (bytes[5] as u32) << 16 | (bytes[6] as u32) << 8 | bytes[7] as u32);
-        log::debug!("  Data segment ({} bytes): {:?}", bytes.len() - 48, String::from_utf8_lossy(&bytes[48..]));
+/// Append a non-empty slice to a vectored write
+fn push_slice<'a>(slices: &mut [IoSlice<'a>], count: &mut usize, slice: &'a [u8]) {
+    if !slice.is_empty() {
+        slices[*count] = IoSlice::new(slice);
+        *count += 1;
     }
+}
 
-    stream.write_all(&bytes).map_err(IscsiError::Io)?;
-    stream.flush().map_err(IscsiError::Io)?;
+/// `write_all` for a list of slices
+fn write_all_vectored<W: Write>(stream: &mut W, mut slices: &mut [IoSlice<'_>]) -> std::io::Result<()> {
+    while !slices.is_empty() {
+        match stream.write_vectored(slices) {
+            Ok(0) => {
+                return Err(std::io::Error::new(std::io::ErrorKind::WriteZero, "failed to write whole PDU"));
+            }
+            Ok(n) => IoSlice::advance_slices(&mut slices, n),
+            Err(e) if e.kind() == std::io::ErrorKind::Interrupted => {}
+            Err(e) => return Err(e),
+        }
+    }
     Ok(())
 }
 
+/// Log a PDU header in detail; callers check the log level first
+fn log_header(direction: &str, bhs: &[u8; BHS_SIZE]) {
+    log::debug!("{} PDU header hex: {}", direction, Hex(bhs));
+    log::debug!("  [0] Opcode: 0x{:02x}", bhs[0]);
+    log::debug!("  [1] Flags: 0x{:02x}", bhs[1]);
+    log::debug!("  [5-7] DataSegmentLength: {} bytes", BigEndian::read_u24(&bhs[5..8]));
+}
+
+/// Space-separated hex dump, formatted without allocating
+struct Hex<'a>(&'a [u8]);
+
+impl std::fmt::Display for Hex<'_> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        for (i, byte) in self.0.iter().enumerate() {
+            if i > 0 {
+                f.write_str(" ")?;
+            }
+            write!(f, "{:02x}", byte)?;
+        }
+        Ok(())
+    }
+}
+
 /// Handle PDUs during login phase
-fn handle_login_phase(
+fn handle_login_phase<D>(
     session: &mut IscsiSession,
     pdu: &IscsiPdu,
-    target_name: &str,
+    ctx: &ConnectionContext<D>,
     target_address: &str,
-    shutting_down: &Arc<AtomicBool>,
-    max_sessions: u32,
-    active_sessions: &Arc<std::sync::atomic::AtomicUsize>,
 ) -> ScsiResult<Vec<IscsiPdu>> {
+    let target_name = ctx.target_name.as_str();
+    let max_sessions = ctx.max_sessions;
     match pdu.opcode {
         opcode::LOGIN_REQUEST => {
             // Check if target is shutting down - reject new login attempts
-            if shutting_down.load(Ordering::SeqCst) && session.state == SessionState::Free {
+            if ctx.shutting_down.load(Ordering::SeqCst) && session.state == SessionState::Free {
                 log::warn!("Login rejected: target is shutting down");
                 let response = session.create_shutdown_reject(pdu.itt)?;
                 return Ok(vec![response]);
             }
 
+            // A nonzero TSIH adds this connection to an existing session (MC/S)
+            let lun = pdu.lun.to_be_bytes();
+            let tsih = BigEndian::read_u16(&lun[6..8]);
+            if session.state == SessionState::Free && session.core.is_none() && tsih != 0 {
+                let mut isid = [0u8; 6];
+                isid.copy_from_slice(&lun[0..6]);
+                match ctx.sessions.attach(tsih, isid) {
+                    Ok(core) => session.join(core),
+                    Err(detail) => {
+                        log::warn!("Login rejected: cannot add connection to session TSIH {} (status 0x02{:02x})", tsih, detail);
+                        return session.create_join_reject(pdu.itt, detail).map(|r| vec![r]);
+                    }
+                }
+            }
+
             // Check session limit - reject if at capacity
             // Note: We check before processing login, but actual session count is incremented
             // only when entering FullFeaturePhase (see handle_connection)
-            if session.state == SessionState::Free {
-                let current_sessions = active_sessions.load(Ordering::SeqCst);
+            if session.state == SessionState::Free && session.core.is_none() {
+                let current_sessions = ctx.active_sessions.load(Ordering::SeqCst);
                 log::debug!(
                     "Session limit check: current={}, max={}, state={:?}",
                     current_sessions, max_sessions, session.state
@@ -391,6 +1068,19 @@ fn handle_login_phase(
             }
 
             let response = session.process_login(pdu, target_name)?;
+
+            // The joining initiator must be the one that owns the session
+            let foreign = session.core.as_ref().is_some_and(|core| {
+                !session.params.initiator_name.is_empty() && session.params.initiator_name != core.initiator_name
+            });
+            if foreign {
+                log::warn!("Login rejected: initiator '{}' does not own session TSIH {}", session.params.initiator_name, tsih);
+                if let Some(core) = session.core.take() {
+                    leave_session(&ctx.sessions, &core, session);
+                }
+                session.tsih = 0;
+                return session.create_join_reject(pdu.itt, 0x0A).map(|r| vec![r]);
+            }
             Ok(vec![response])
         }
         opcode::TEXT_REQUEST => {
@@ -409,20 +1099,33 @@ fn handle_login_phase(
     }
 }
 
+/// Remove a connection from its session; returns true if it was the last one
+fn leave_session(sessions: &SessionTable, core: &crate::session::SessionCore, session: &IscsiSession) -> bool {
+    core.drop_connection(session.cid);
+    let last = sessions.detach(core);
+    log::debug!("Connection CID {} left session TSIH {}{}", session.cid, core.tsih,
+        if last { ", session closed" } else { "" });
+    last
+}
+
 /// Handle PDUs during full feature phase
 fn handle_full_feature_phase<D: ScsiBlockDevice>(
     session: &mut IscsiSession,
     pdu: &IscsiPdu,
-    device: &Arc<Mutex<D>>,
+    luns: &LunTable<D>,
+    sessions: &SessionTable,
     target_name: &str,
     target_address: &str,
 ) -> ScsiResult<Vec<IscsiPdu>> {
+    // Pick up CmdSN progress made on the session's other connections
+    session.sync_cmd_window();
+
     match pdu.opcode {
         opcode::SCSI_COMMAND => {
-            handle_scsi_command(session, pdu, device)
+            handle_scsi_command(session, pdu, luns)
         }
         opcode::SCSI_DATA_OUT => {
-            handle_scsi_data_out(session, pdu, device)
+            handle_scsi_data_out(session, pdu, luns)
         }
         opcode::NOP_OUT => {
             let response = session.process_nop_out(pdu)?;
@@ -436,7 +1139,7 @@ fn handle_full_feature_phase<D: ScsiBlockDevice>(
             handle_text_request(session, pdu, target_name, target_address)
         }
         opcode::TASK_MANAGEMENT_REQUEST => {
-            handle_task_management(session, pdu)
+            handle_task_management(session, pdu, luns, sessions)
         }
         _ => {
             log::warn!("Unsupported opcode 0x{:02x} in full feature phase", pdu.opcode);
@@ -445,24 +1148,53 @@ fn handle_full_feature_phase<D: ScsiBlockDevice>(
     }
 }
 
-/// Handle SCSI Command PDU
+/// Handle SCSI Command PDU: run it in CmdSN order
 fn handle_scsi_command<D: ScsiBlockDevice>(
     session: &mut IscsiSession,
     pdu: &IscsiPdu,
-    device: &Arc<Mutex<D>>,
+    luns: &LunTable<D>,
+) -> ScsiResult<Vec<IscsiPdu>> {
+    // Immediate commands are not held to CmdSN order (RFC 3720 Section 3.2.2.1)
+    let cmd_sn = BigEndian::read_u32(&pdu.specific[4..8]);
+    if !pdu.immediate {
+        match session.order_command(cmd_sn, pdu) {
+            CmdOrder::Run => {}
+            CmdOrder::Parked => {
+                log::debug!("CmdSN {} parked until ExpCmdSN {} reaches it", cmd_sn, session.exp_cmd_sn);
+                return Ok(vec![]);
+            }
+            CmdOrder::OutOfWindow => {
+                log::warn!("Ignoring CmdSN {} outside the window {}..={}", cmd_sn, session.exp_cmd_sn, session.max_cmd_sn);
+                return Ok(vec![]);
+            }
+        }
+    }
+    run_scsi_command(session, pdu, luns)
+}
+
+/// Run a SCSI command whose CmdSN has been delivered
+fn run_scsi_command<D: ScsiBlockDevice>(
+    session: &mut IscsiSession,
+    pdu: &IscsiPdu,
+    luns: &LunTable<D>,
 ) -> ScsiResult<Vec<IscsiPdu>> {
     let cmd = pdu.parse_scsi_command()?;
+    let cmd_sn = BigEndian::read_u32(&pdu.specific[4..8]);
+
+    // ABORT TASK may have ended the command before it arrived
+    if session.take_aborted(cmd_sn, cmd.itt) {
+        log::debug!("Dropping ITT=0x{:08x} (CmdSN {}), aborted before it arrived", cmd.itt, cmd_sn);
+        return Ok(vec![]);
+    }
 
-    log::warn!(
+    log::debug!(
         "SCSI Command: CDB[0]=0x{:02x}, LUN=0x{:016x}, ITT=0x{:08x}, ExpLen={}, read={}, write={}, final={}, data_len={}",
         cmd.cdb[0], cmd.lun, cmd.itt, cmd.expected_data_length, cmd.read, cmd.write, cmd.final_flag, pdu.data.len()
     );
 
-    // Validate LUN - only LUN 0 is supported
-    // iSCSI LUNs are encoded per RFC 3720 section 3.4.6.1
-    // For simplicity, we check if the raw LUN value is 0
-    // LUN 0 is always encoded as 0x0000000000000000 regardless of addressing method
-    if cmd.lun != 0 {
+    // The LUN field is an 8-byte SAM LUN (RFC 3720 section 3.4.6.1);
+    // anything that does not name an exported LUN is rejected
+    let Some((lun, device)) = luns.get(cmd.lun) else {
         log::warn!("Command 0x{:02x} to invalid LUN: 0x{:016x}", cmd.cdb[0], cmd.lun);
         let sense = crate::scsi::SenseData::new(
             crate::scsi::sense_key::ILLEGAL_REQUEST,
@@ -479,19 +1211,43 @@ fn handle_scsi_command<D: ScsiBlockDevice>(
             0,
             Some(&sense.to_bytes()),
         )]);
-    }
-
-    // Validate command sequence number
-    let cmd_sn = BigEndian::read_u32(&pdu.specific[4..8]);
-    if !session.validate_cmd_sn(cmd_sn) {
-        log::warn!("Invalid CmdSN: {}, expected: {}", cmd_sn, session.exp_cmd_sn);
-    }
+    };
 
     // Check command type
     let opcode = cmd.cdb[0];
     log::debug!("Processing SCSI opcode 0x{:02x}", opcode);
+
+    // A reset from another session leaves a unit attention, reported to the
+    // next command other than INQUIRY and REPORT LUNS; REQUEST SENSE
+    // returns it as its sense data
+    if !matches!(opcode, 0x12 | 0xA0) {
+        if let Some(sense) = session.take_unit_attention(lun) {
+            session.last_sense_data = Some(sense.to_bytes());
+            if opcode != 0x03 {
+                log::debug!("Reporting unit attention on LUN {} to ITT=0x{:08x}", lun, cmd.itt);
+                return Ok(vec![IscsiPdu::scsi_response(
+                    cmd.itt,
+                    session.next_stat_sn(),
+                    session.exp_cmd_sn,
+                    session.max_cmd_sn,
+                    pdu::scsi_status::CHECK_CONDITION,
+                    0,
+                    0,
+                    Some(&sense.to_bytes()),
+                )]);
+            }
+        }
+    }
     let is_sync_cache = opcode == 0x35 || opcode == 0x91;
     let is_write_cmd = matches!(opcode, 0x0a | 0x2a | 0x8a);
+    // WRITE(10)/WRITE(16) byte 1 bit 3; WRITE(6) has no FUA bit
+    let fua = matches!(opcode, 0x2a | 0x8a) && cmd.cdb[1] & 0x08 != 0;
+
+    // UNMAP and WRITE SAME(16) carry a parameter list or a single block,
+    // which is collected whole before the command runs
+    if let Some(expected) = ScsiHandler::parameter_data_length(&cmd.cdb, device.block_size()) {
+        return start_parameter_command(session, &cmd, pdu, device, expected);
+    }
 
     // Handle WRITE commands separately (they use immediate data or Data-Out PDUs)
     if is_write_cmd {
@@ -529,11 +1285,7 @@ fn handle_scsi_command<D: ScsiBlockDevice>(
         };
 
         if transfer_length > 0 {
-            let device_guard = device.lock().map_err(|_| {
-                IscsiError::Scsi("Device lock poisoned".to_string())
-            })?;
-            let block_size = device_guard.block_size();
-            drop(device_guard);
+            let block_size = device.block_size();
 
             let expected_data_len = transfer_length as usize * block_size as usize;
             let bytes_received = pdu.data.len() as u32;
@@ -545,12 +1297,7 @@ fn handle_scsi_command<D: ScsiBlockDevice>(
                     cmd.itt, lba, pdu.data.len(), expected_data_len
                 );
 
-                let mut device_guard = device.lock().map_err(|_| {
-                    IscsiError::Scsi("Device lock poisoned".to_string())
-                })?;
-
-                let write_result = device_guard.write(lba, &pdu.data, block_size);
-                drop(device_guard);
+                let write_result = device.write(lba, &pdu.data, block_size);
 
                 if let Err(e) = write_result {
                     log::error!("Write failed: {}", e);
@@ -574,15 +1321,16 @@ fn handle_scsi_command<D: ScsiBlockDevice>(
                     "Write complete: ITT=0x{:08x}, {} bytes written",
                     cmd.itt, bytes_received
                 );
+                let (status, sense) = complete_write(device, fua);
                 return Ok(vec![IscsiPdu::scsi_response(
                     cmd.itt,
                     session.next_stat_sn(),
                     session.exp_cmd_sn,
                     session.max_cmd_sn,
-                    pdu::scsi_status::GOOD,
+                    status,
                     0,
                     0,
-                    None,
+                    sense.as_deref(),
                 )]);
             }
 
@@ -595,57 +1343,22 @@ fn handle_scsi_command<D: ScsiBlockDevice>(
                 cmd.itt, ttt, bytes_received, remaining_bytes, expected_data_len
             );
 
-            // Store pending write
-            session.pending_writes.insert(cmd.itt, PendingWrite {
+            let (responses, r2t_sn) = r2t_pdus(session, cmd.lun, cmd.itt, ttt, bytes_received, expected_data_len as u32);
+
+            // Store pending write with the next R2T sequence number
+            session.add_pending_write(cmd.itt, PendingWrite {
                 lba,
                 transfer_length,
                 block_size,
                 bytes_received,
                 ttt,
-                r2t_sn: 0,
+                r2t_sn,
                 lun: cmd.lun,
+                cmd_sn,
+                fua,
+                parameters: None,
             });
 
-            // Send R2T to request the remaining data
-            // RFC 3720: R2T requests data starting at buffer_offset (bytes already received)
-            // with desired_data_transfer_length being the remaining bytes needed
-            // We may need to send multiple R2Ts if remaining data > MaxBurstLength
-            let max_burst = session.params.max_burst_length;
-            let mut responses = Vec::new();
-            let mut offset = bytes_received;
-            let mut r2t_sn = 0u32;
-
-            while offset < expected_data_len as u32 {
-                let remaining = expected_data_len as u32 - offset;
-                let request_len = remaining.min(max_burst);
-
-                log::debug!(
-                    "Sending R2T: ITT=0x{:08x}, TTT=0x{:08x}, R2TSN={}, offset={}, len={}",
-                    cmd.itt, ttt, r2t_sn, offset, request_len
-                );
-
-                let r2t = IscsiPdu::r2t(
-                    cmd.lun,
-                    cmd.itt,
-                    ttt,
-                    session.stat_sn, // StatSN is not incremented for R2T
-                    session.exp_cmd_sn,
-                    session.max_cmd_sn,
-                    r2t_sn,
-                    offset,
-                    request_len,
-                );
-                responses.push(r2t);
-
-                offset += request_len;
-                r2t_sn += 1;
-            }
-
-            // Update pending write with next R2T sequence number
-            if let Some(pending) = session.pending_writes.get_mut(&cmd.itt) {
-                pending.r2t_sn = r2t_sn;
-            }
-
             return Ok(responses);
         }
 
@@ -693,22 +1406,39 @@ fn handle_scsi_command<D: ScsiBlockDevice>(
             ScsiResponse::good(data)
         }
     } else if is_sync_cache {
-        // SYNCHRONIZE CACHE needs mutable access to call flush()
-        let mut device_guard = device.lock().map_err(|_| {
-            IscsiError::Scsi("Device lock poisoned".to_string())
-        })?;
-
         log::debug!("Calling flush() for SYNCHRONIZE CACHE command");
-        device_guard.flush()?;
-
-        ScsiResponse::good_no_data()
+        match device.flush() {
+            Ok(()) => ScsiResponse::good_no_data(),
+            Err(e) => {
+                log::error!("Flush failed: {}", e);
+                ScsiResponse::check_condition(crate::scsi::SenseData::medium_error())
+            }
+        }
     } else {
-        // Other commands use immutable access
-        let device_guard = device.lock().map_err(|_| {
-            IscsiError::Scsi("Device lock poisoned".to_string())
-        })?;
-
-        let resp = ScsiHandler::handle_command(&cmd.cdb, &*device_guard, None)?;
+        // Other commands only read, so sessions run them in parallel
+        let device_guard = device.read()?;
+
+        // READ(10)/READ(16) fill their Data-In PDUs straight from the device.
+        // Segments stay block-aligned so each one is a whole-block read.
+        let block_size = device.block_size() as usize;
+        let direct_seg = session.params.max_xmit_data_segment_length as usize / block_size * block_size;
+        let direct = if cmd.read { direct_read_extent(&cmd.cdb, device_guard.capacity()) } else { None };
+
+        let resp = match direct {
+            Some((lba, blocks)) if direct_seg > 0 => {
+                let fill = |offset: usize, buf: &mut [u8]| {
+                    device.read_into(&device_guard, lba + (offset / block_size) as u64, buf)
+                };
+                match data_in_pdus(session, cmd.itt, blocks as usize * block_size, direct_seg, pdu::scsi_status::GOOD, fill) {
+                    Ok(responses) => return Ok(responses),
+                    Err(e) => {
+                        log::warn!("READ of {} blocks at LBA {} failed: {}", blocks, lba, e);
+                        ScsiResponse::check_condition(crate::scsi::SenseData::medium_error())
+                    }
+                }
+            }
+            _ => ScsiHandler::handle_lun_command(&cmd.cdb, &*device_guard, None, lun, &luns.numbers)?,
+        };
 
         if !resp.data.is_empty() {
             log::debug!("SCSI command returned {} bytes, first 16: {:02x?}",
@@ -724,43 +1454,12 @@ fn handle_scsi_command<D: ScsiBlockDevice>(
     if cmd.read && !response.data.is_empty() {
         // Send data with Data-In PDU(s)
         let max_data_seg = session.params.max_xmit_data_segment_length as usize;
-        let mut offset = 0u32;
-        let mut data_sn = 0u32;
-
-        log::debug!("Large read: total_data={} bytes, max_data_seg={} bytes, will send {} PDUs",
-                    response.data.len(), max_data_seg, (response.data.len() + max_data_seg - 1) / max_data_seg);
-
-        while offset < response.data.len() as u32 {
-            let remaining = response.data.len() - offset as usize;
-            let chunk_size = remaining.min(max_data_seg);
-            let is_final = offset as usize + chunk_size >= response.data.len();
-
-            let chunk = response.data[offset as usize..offset as usize + chunk_size].to_vec();
-
-            log::debug!("Sending Data-In PDU: offset={}, chunk_size={}, is_final={}, data_sn={}, first 16 bytes: {:02x?}",
-                        offset, chunk_size, is_final, data_sn, &chunk[..chunk.len().min(16)]);
-
-            // StatSN should only be incremented for the final PDU (with F and S bits set)
-            // For non-final PDUs, StatSN is reserved and set to 0
-            let pdu_stat_sn = if is_final { session.next_stat_sn() } else { 0 };
-
-            let data_in = IscsiPdu::scsi_data_in(
-                cmd.itt,
-                0xFFFF_FFFF, // TTT
-                pdu_stat_sn,
-                session.exp_cmd_sn,
-                session.max_cmd_sn,
-                data_sn,
-                offset,
-                chunk,
-                is_final,
-                if is_final { Some(response.status) } else { None },
-            );
-
-            responses.push(data_in);
-            offset += chunk_size as u32;
-            data_sn += 1;
-        }
+        let data = &response.data;
+        let fill = |offset: usize, buf: &mut [u8]| {
+            buf.copy_from_slice(&data[offset..offset + buf.len()]);
+            Ok(())
+        };
+        responses = data_in_pdus(session, cmd.itt, data.len(), max_data_seg, response.status, fill)?;
     } else {
         // No data or write command - send SCSI Response
         let sense_data = response.sense.as_ref().map(|s| s.to_bytes());
@@ -809,11 +1508,268 @@ fn handle_scsi_command<D: ScsiBlockDevice>(
     Ok(responses)
 }
 
+/// LBA and block count of a READ(10)/READ(16) that can go straight to Data-In
+///
+/// Zero-length and out-of-range reads return None and go through the SCSI
+/// handler, which builds their status.
+fn direct_read_extent(cdb: &[u8], capacity: u64) -> Option<(u64, u32)> {
+    let (lba, blocks) = match *cdb.first()? {
+        0x28 => ScsiHandler::parse_rw10_cdb(cdb)?,
+        0x88 => ScsiHandler::parse_rw16_cdb(cdb)?,
+        _ => return None,
+    };
+    let end = lba.checked_add(blocks as u64)?;
+    (blocks > 0 && end <= capacity).then_some((lba, blocks))
+}
+
+/// Split `total` bytes of read data into Data-In PDUs of at most `max_data_seg` bytes
+///
+/// `fill(offset, buf)` writes the bytes at `offset` into each PDU's data
+/// segment. Status goes in the final PDU, which is the only one to take a
+/// StatSN. If `fill` fails, no StatSN is consumed.
+fn data_in_pdus(
+    session: &mut IscsiSession,
+    itt: u32,
+    total: usize,
+    max_data_seg: usize,
+    status: u8,
+    mut fill: impl FnMut(usize, &mut [u8]) -> ScsiResult<()>,
+) -> ScsiResult<Vec<IscsiPdu>> {
+    let mut responses = Vec::with_capacity(total.div_ceil(max_data_seg));
+    let mut offset = 0usize;
+    let mut data_sn = 0u32;
+
+    log::debug!("Large read: total_data={} bytes, max_data_seg={} bytes, will send {} PDUs",
+                total, max_data_seg, total.div_ceil(max_data_seg));
+
+    while offset < total {
+        let chunk_size = (total - offset).min(max_data_seg);
+        let is_final = offset + chunk_size >= total;
+
+        let mut chunk = vec![0u8; chunk_size];
+        fill(offset, &mut chunk)?;
+
+        log::debug!("Sending Data-In PDU: offset={}, chunk_size={}, is_final={}, data_sn={}, first 16 bytes: {:02x?}",
+                    offset, chunk_size, is_final, data_sn, &chunk[..chunk.len().min(16)]);
+
+        // StatSN should only be incremented for the final PDU (with F and S bits set)
+        // For non-final PDUs, StatSN is reserved and set to 0
+        let pdu_stat_sn = if is_final { session.next_stat_sn() } else { 0 };
+
+        responses.push(IscsiPdu::scsi_data_in(
+            itt,
+            0xFFFF_FFFF, // TTT
+            pdu_stat_sn,
+            session.exp_cmd_sn,
+            session.max_cmd_sn,
+            data_sn,
+            offset as u32,
+            chunk,
+            is_final,
+            if is_final { Some(status) } else { None },
+        ));
+        offset += chunk_size;
+        data_sn += 1;
+    }
+
+    Ok(responses)
+}
+
+/// Status for a write whose data has all been written
+///
+/// With FUA set the data must be on stable storage before GOOD is sent,
+/// so the device is flushed first; for a write-back cache that writes back
+/// everything dirty, this command's blocks included.
+fn complete_write<D: ScsiBlockDevice>(device: &SharedDevice<D>, fua: bool) -> (u8, Option<Vec<u8>>) {
+    if !fua {
+        return (scsi_status::GOOD, None);
+    }
+    match device.flush() {
+        Ok(()) => (scsi_status::GOOD, None),
+        Err(e) => {
+            log::error!("FUA flush failed: {}", e);
+            (scsi_status::CHECK_CONDITION, Some(crate::scsi::SenseData::medium_error().to_bytes()))
+        }
+    }
+}
+
+/// R2Ts asking for bytes [offset, total) of a command's data
+///
+/// RFC 3720: each R2T asks for at most MaxBurstLength bytes, starting
+/// where the data already received ends. Returns the PDUs and the next
+/// R2TSN.
+fn r2t_pdus(session: &IscsiSession, lun: u64, itt: u32, ttt: u32, mut offset: u32, total: u32) -> (Vec<IscsiPdu>, u32) {
+    let max_burst = session.params.max_burst_length;
+    let mut responses = Vec::new();
+    let mut r2t_sn = 0u32;
+
+    while offset < total {
+        let request_len = (total - offset).min(max_burst);
+
+        log::debug!(
+            "Sending R2T: ITT=0x{:08x}, TTT=0x{:08x}, R2TSN={}, offset={}, len={}",
+            itt, ttt, r2t_sn, offset, request_len
+        );
+
+        responses.push(IscsiPdu::r2t(
+            lun,
+            itt,
+            ttt,
+            session.stat_sn, // StatSN is not incremented for R2T
+            session.exp_cmd_sn,
+            session.max_cmd_sn,
+            r2t_sn,
+            offset,
+            request_len,
+        ));
+
+        offset += request_len;
+        r2t_sn += 1;
+    }
+
+    (responses, r2t_sn)
+}
+
+/// Start an UNMAP or WRITE SAME(16), collecting `expected` bytes of data
+///
+/// The CDB is checked before any data is asked for. With all the data in
+/// hand, from immediate data or none being needed, the command runs at
+/// once; otherwise R2Ts ask for the rest.
+fn start_parameter_command<D: ScsiBlockDevice>(
+    session: &mut IscsiSession,
+    cmd: &pdu::ScsiCommandPdu,
+    pdu: &IscsiPdu,
+    device: &SharedDevice<D>,
+    expected: usize,
+) -> ScsiResult<Vec<IscsiPdu>> {
+    let checked = ScsiHandler::handle_command(&cmd.cdb, &*device.read()?, None)?;
+    if checked.status != scsi_status::GOOD {
+        let sense = checked.sense.map(|s| s.to_bytes());
+        return Ok(vec![IscsiPdu::scsi_response(
+            cmd.itt,
+            session.next_stat_sn(),
+            session.exp_cmd_sn,
+            session.max_cmd_sn,
+            checked.status,
+            0,
+            0,
+            sense.as_deref(),
+        )]);
+    }
+
+    let mut data = vec![0u8; expected];
+    let received = pdu.data.len().min(expected);
+    data[..received].copy_from_slice(&pdu.data[..received]);
+    if received == expected {
+        return run_parameter_command(session, cmd.itt, &cmd.cdb, &data, device);
+    }
+
+    let ttt = session.next_target_transfer_tag();
+    let (responses, r2t_sn) = r2t_pdus(session, cmd.lun, cmd.itt, ttt, received as u32, expected as u32);
+    session.add_pending_write(cmd.itt, PendingWrite {
+        lba: 0,
+        transfer_length: 0,
+        block_size: device.block_size(),
+        bytes_received: received as u32,
+        ttt,
+        r2t_sn,
+        lun: cmd.lun,
+        cmd_sn: BigEndian::read_u32(&pdu.specific[4..8]),
+        fua: false,
+        parameters: Some(ParameterData { cdb: cmd.cdb, data }),
+    });
+    Ok(responses)
+}
+
+/// Run an UNMAP or WRITE SAME(16) whose data has all arrived
+///
+/// The handler validates the data; the deallocation or the repeated
+/// write then goes through the device like any other write.
+fn run_parameter_command<D: ScsiBlockDevice>(
+    session: &mut IscsiSession,
+    itt: u32,
+    cdb: &[u8],
+    data: &[u8],
+    device: &SharedDevice<D>,
+) -> ScsiResult<Vec<IscsiPdu>> {
+    let (checked, capacity, unmap_supported) = {
+        let guard = device.read()?;
+        (ScsiHandler::handle_command(cdb, &*guard, Some(data))?, guard.capacity(), guard.supports_unmap())
+    };
+
+    let (status, sense) = if checked.status != scsi_status::GOOD {
+        (checked.status, checked.sense)
+    } else {
+        let result = if cdb[0] == 0x42 {
+            ScsiHandler::parse_unmap_parameters(data, capacity)
+                .unwrap_or_default()
+                .into_iter()
+                .try_for_each(|(lba, blocks)| device.unmap(lba, blocks as u64))
+        } else {
+            write_same(device, cdb, data, unmap_supported)
+        };
+        match result {
+            Ok(()) => (scsi_status::GOOD, None),
+            Err(e) => {
+                log::error!("Command 0x{:02x} failed: {}", cdb[0], e);
+                (scsi_status::CHECK_CONDITION, Some(crate::scsi::SenseData::medium_error()))
+            }
+        }
+    };
+
+    let sense = sense.map(|s| s.to_bytes());
+    Ok(vec![IscsiPdu::scsi_response(
+        itt,
+        session.next_stat_sn(),
+        session.exp_cmd_sn,
+        session.max_cmd_sn,
+        status,
+        0,
+        0,
+        sense.as_deref(),
+    )])
+}
+
+/// Largest buffer WRITE SAME fills before handing it to the device
+const WRITE_SAME_BATCH_BYTES: usize = 1024 * 1024;
+
+/// Write one block over a WRITE SAME(16) range, or deallocate the range
+///
+/// With the UNMAP bit set, a block of zeros (or none at all, NDOB)
+/// deallocates, since unmapped blocks read back as zeros. Any other block
+/// is written out in batches of copies.
+fn write_same<D: ScsiBlockDevice>(device: &SharedDevice<D>, cdb: &[u8], data: &[u8], unmap_supported: bool) -> ScsiResult<()> {
+    let (lba, blocks, unmap) = ScsiHandler::parse_write_same16_cdb(cdb)
+        .ok_or_else(|| IscsiError::Scsi("WRITE SAME(16) CDB too short".to_string()))?;
+    let block_size = device.block_size() as usize;
+    let block = &data[..data.len().min(block_size)];
+    let zeros = block.iter().all(|&b| b == 0);
+
+    if unmap && unmap_supported && zeros {
+        return device.unmap(lba, blocks as u64);
+    }
+
+    let batch_blocks = (WRITE_SAME_BATCH_BYTES / block_size).clamp(1, blocks as usize);
+    let batch = if zeros {
+        vec![0u8; batch_blocks * block_size]
+    } else {
+        block.repeat(batch_blocks)
+    };
+
+    let mut done = 0u64;
+    while done < blocks as u64 {
+        let n = (blocks as u64 - done).min(batch_blocks as u64) as usize;
+        device.write(lba + done, &batch[..n * block_size], block_size as u32)?;
+        done += n as u64;
+    }
+    Ok(())
+}
+
 /// Handle SCSI Data-Out PDU (write data from initiator)
 fn handle_scsi_data_out<D: ScsiBlockDevice>(
     session: &mut IscsiSession,
     pdu: &IscsiPdu,
-    device: &Arc<Mutex<D>>,
+    luns: &LunTable<D>,
 ) -> ScsiResult<Vec<IscsiPdu>> {
     let data_out = pdu.parse_scsi_data_out()?;
 
@@ -822,18 +1778,51 @@ fn handle_scsi_data_out<D: ScsiBlockDevice>(
         data_out.itt, data_out.ttt, data_out.data_sn, data_out.buffer_offset, data_out.data.len(), data_out.final_flag
     );
 
-    // Look up the pending write command
+    // Look up the pending write command, unless a TMF has aborted it
+    session.drop_aborted_writes();
     let pending_write = session.pending_writes.get_mut(&data_out.itt);
 
     if pending_write.is_none() {
-        log::warn!("Received Data-Out for unknown ITT=0x{:08x}", data_out.itt);
+        // Its command may be parked for CmdSN order
+        if session.park_data_out(data_out.itt, pdu) {
+            return Ok(vec![]);
+        }
+        log::warn!("Received Data-Out for unknown or aborted ITT=0x{:08x}", data_out.itt);
         return Ok(vec![]);
     }
 
     let pending = pending_write.unwrap();
+    // The command was checked against the table, so its LUN is there
+    let Some((_, device)) = luns.get(pending.lun) else {
+        log::warn!("Data-Out for ITT=0x{:08x} to unknown LUN 0x{:016x}", data_out.itt, pending.lun);
+        return Ok(vec![]);
+    };
+
+    // Parameter data is buffered until the command can run
+    if let Some(parameters) = pending.parameters.as_mut() {
+        let offset = data_out.buffer_offset as usize;
+        let end = offset + data_out.data.len();
+        if end > parameters.data.len() {
+            log::warn!("Data-Out past the expected {} bytes for ITT=0x{:08x}", parameters.data.len(), data_out.itt);
+            return Ok(vec![]);
+        }
+        parameters.data[offset..end].copy_from_slice(&data_out.data);
+        pending.bytes_received = pending.bytes_received.max(end as u32);
+        if (pending.bytes_received as usize) < parameters.data.len() {
+            return Ok(vec![]);
+        }
+
+        let parameters = session.finish_pending_write(data_out.itt).and_then(|p| p.parameters);
+        return match parameters {
+            Some(p) => run_parameter_command(session, data_out.itt, &p.cdb, &p.data, device),
+            None => Ok(vec![]),
+        };
+    }
+
     let block_size = pending.block_size;
     let transfer_length = pending.transfer_length;
     let base_lba = pending.lba;
+    let fua = pending.fua;
     let total_expected = transfer_length * block_size;
 
     // Calculate the LBA for this chunk based on buffer_offset
@@ -846,12 +1835,7 @@ fn handle_scsi_data_out<D: ScsiBlockDevice>(
     );
 
     // Write the data
-    let mut device_guard = device.lock().map_err(|_| {
-        IscsiError::Scsi("Device lock poisoned".to_string())
-    })?;
-
-    let write_result = device_guard.write(lba, &data_out.data, block_size);
-    drop(device_guard);
+    let write_result = device.write(lba, &data_out.data, block_size);
 
     // Update bytes received - track the highest offset written
     // This handles out-of-order Data-Out PDUs correctly
@@ -885,7 +1869,12 @@ fn handle_scsi_data_out<D: ScsiBlockDevice>(
         );
 
         // Remove the pending write
-        session.pending_writes.remove(&data_out.itt);
+        session.finish_pending_write(data_out.itt);
+        let (status, sense) = if status == scsi_status::GOOD {
+            complete_write(device, fua)
+        } else {
+            (status, sense)
+        };
 
         let response = IscsiPdu::scsi_response(
             data_out.itt,
@@ -901,7 +1890,7 @@ fn handle_scsi_data_out<D: ScsiBlockDevice>(
         Ok(vec![response])
     } else if status != scsi_status::GOOD {
         // Error occurred - remove pending write and send error response
-        session.pending_writes.remove(&data_out.itt);
+        session.finish_pending_write(data_out.itt);
 
         let response = IscsiPdu::scsi_response(
             data_out.itt,
@@ -961,32 +1950,77 @@ fn handle_text_request(
 }
 
 /// Handle Task Management Request
-fn handle_task_management(
+///
+/// Commands run to completion before the connection reads its next PDU,
+/// and a read's Data-In is built and sent in one go, so there is no Data-In
+/// stream left to cancel. The tasks still in flight when a TMF arrives are
+/// writes waiting for Data-Out, on any connection of the session, and
+/// commands parked for CmdSN order. Aborting a write drops its R2T
+/// sequence: no status is sent for it and late Data-Out for it is
+/// discarded. LUN RESET and the target resets also reach other sessions.
+fn handle_task_management<D: ScsiBlockDevice>(
     session: &mut IscsiSession,
     pdu: &IscsiPdu,
+    luns: &LunTable<D>,
+    sessions: &SessionTable,
 ) -> ScsiResult<Vec<IscsiPdu>> {
-    // For now, just acknowledge task management requests
-    // A full implementation would handle ABORT TASK, LUN RESET, etc.
-
-    let function = pdu.flags & 0x7F;
-    log::debug!("Task Management: function={}", function);
-
-    // Build response
-    let mut response = IscsiPdu::new();
-    response.opcode = opcode::TASK_MANAGEMENT_RESPONSE;
-    response.flags = flags::FINAL;
-    response.itt = pdu.itt;
-
-    // Response code: function complete
-    response.specific[0] = 0x00;
-    // StatSN
-    response.specific[4..8].copy_from_slice(&session.next_stat_sn().to_be_bytes());
-    // ExpCmdSN
-    response.specific[8..12].copy_from_slice(&session.exp_cmd_sn.to_be_bytes());
-    // MaxCmdSN
-    response.specific[12..16].copy_from_slice(&session.max_cmd_sn.to_be_bytes());
+    use crate::pdu::{tmf_function, tmf_response};
 
-    Ok(vec![response])
+    let tmf = pdu.parse_task_management_request()?;
+    log::debug!(
+        "Task Management: function={}, LUN=0x{:016x}, ITT=0x{:08x}, RTT=0x{:08x}, RefCmdSN={}",
+        tmf.function, tmf.lun, tmf.itt, tmf.referenced_task_tag, tmf.ref_cmd_sn
+    );
+
+    // Initiators normally send TMFs immediate; a queued one takes a CmdSN
+    if !pdu.immediate && !session.validate_cmd_sn(tmf.cmd_sn) {
+        log::warn!("Ignoring TMF with CmdSN {} outside the window {}..={}",
+            tmf.cmd_sn, session.exp_cmd_sn, session.max_cmd_sn);
+        return Ok(vec![]);
+    }
+
+    let response = match tmf.function {
+        tmf_function::ABORT_TASK => {
+            session.abort_task(tmf.referenced_task_tag, tmf.lun, tmf.ref_cmd_sn, tmf.cmd_sn)
+        }
+        tmf_function::ABORT_TASK_SET | tmf_function::CLEAR_TASK_SET | tmf_function::LOGICAL_UNIT_RESET => {
+            match luns.get(tmf.lun) {
+                Some((lun, _)) => {
+                    let mut aborted = session.abort_tasks(Some(lun));
+                    // A reset also ends other initiators' tasks, and tells them so
+                    if tmf.function == tmf_function::LOGICAL_UNIT_RESET {
+                        aborted += sessions.reset_others(session.tsih, &[lun], &crate::scsi::SenseData::reset_occurred(0x03));
+                    }
+                    log::debug!("Task Management: aborted {} task(s) on LUN {}", aborted, lun);
+                    tmf_response::FUNCTION_COMPLETE
+                }
+                None => tmf_response::LUN_DOES_NOT_EXIST,
+            }
+        }
+        tmf_function::TARGET_WARM_RESET | tmf_function::TARGET_COLD_RESET => {
+            let aborted = session.abort_tasks(None)
+                + sessions.reset_others(session.tsih, &luns.numbers, &crate::scsi::SenseData::reset_occurred(0x00));
+            log::debug!("Task Management: aborted {} task(s) on all LUNs", aborted);
+            tmf_response::FUNCTION_COMPLETE
+        }
+        // Error recovery level 0: connections cannot take over tasks
+        tmf_function::TASK_REASSIGN => tmf_response::TASK_REASSIGNMENT_NOT_SUPPORTED,
+        // CLEAR ACA needs NACA, which the target does not support
+        _ => tmf_response::FUNCTION_NOT_SUPPORTED,
+    };
+
+    // A cold reset ends the connection once the response is out
+    if tmf.function == tmf_function::TARGET_COLD_RESET {
+        session.state = SessionState::Logout;
+    }
+
+    Ok(vec![IscsiPdu::task_management_response(
+        tmf.itt,
+        session.next_stat_sn(),
+        session.exp_cmd_sn,
+        session.max_cmd_sn,
+        response,
+    )])
 }
 
 /// Builder for configuring an iSCSI target
@@ -997,8 +2031,13 @@ pub struct IscsiTargetBuilder<D: ScsiBlockDevice> {
     auth_config: crate::auth::AuthConfig,
     max_connections: Option<u32>,
     max_sessions: Option<u32>,
+    max_connections_per_session: u16,
     allowed_initiators: Option<Vec<String>>,
-    _phantom: std::marker::PhantomData<D>,
+    connection_model: ConnectionModel,
+    trace_capacity: usize,
+    metrics_addr: Option<String>,
+    /// LUNs beyond the one `build` exports as LUN 0
+    luns: Vec<(u16, D)>,
 }
 
 impl<D: ScsiBlockDevice> IscsiTargetBuilder<D> {
@@ -1010,8 +2049,12 @@ impl<D: ScsiBlockDevice> IscsiTargetBuilder<D> {
             auth_config: crate::auth::AuthConfig::None,
             max_connections: None,
             max_sessions: None,
+            max_connections_per_session: DEFAULT_MAX_CONNECTIONS_PER_SESSION,
             allowed_initiators: None,
-            _phantom: std::marker::PhantomData,
+            connection_model: ConnectionModel::default(),
+            trace_capacity: 0,
+            metrics_addr: None,
+            luns: Vec::new(),
         }
     }
 
@@ -1056,6 +2099,16 @@ impl<D: ScsiBlockDevice> IscsiTargetBuilder<D> {
         self
     }
 
+    /// Set the MaxConnections offered per session (default: 1)
+    ///
+    /// Initiators that offer MaxConnections get the lower of the two values
+    /// and may add that many connections to a session by logging in with its
+    /// TSIH; the rest get the RFC 3720 default of one connection.
+    pub fn max_connections_per_session(mut self, max: u16) -> Self {
+        self.max_connections_per_session = max;
+        self
+    }
+
     /// Set Access Control List - allowed initiator IQNs (default: allow all)
     ///
     /// When set, only the specified initiator IQNs will be allowed to access the target.
@@ -1066,7 +2119,43 @@ impl<D: ScsiBlockDevice> IscsiTargetBuilder<D> {
         self
     }
 
-    /// Build the target with the specified storage device
+    /// Set how connections are scheduled (default: one thread per connection)
+    ///
+    /// `ConnectionModel::EventDriven` suits many mostly idle sessions: they
+    /// wait in a single poller instead of each holding a thread.
+    pub fn connection_model(mut self, model: ConnectionModel) -> Self {
+        self.connection_model = model;
+        self
+    }
+
+    /// Keep a trace of the last `records` PDUs (default: 0, no trace)
+    ///
+    /// Each record takes 40 bytes of memory and is made without taking a
+    /// lock. See `IscsiTarget::pdu_trace` and the `trace` module.
+    pub fn pdu_trace(mut self, records: usize) -> Self {
+        self.trace_capacity = records;
+        self
+    }
+
+    /// Serve metrics in the Prometheus text format at `http://<addr>/metrics`
+    /// (default: no endpoint; `IscsiTarget::metrics` works either way)
+    pub fn metrics_addr(mut self, addr: &str) -> Self {
+        self.metrics_addr = Some(addr.to_string());
+        self
+    }
+
+    /// Export `device` as LUN `lun` alongside the one passed to `build`
+    ///
+    /// Every LUN gets its own lock, so I/O to one never waits for another.
+    /// LUNs need not be contiguous; they must be unique, at most
+    /// `scsi::MAX_LUN`, and not 0, which `build` takes. To mix backends,
+    /// build a target of `Box<dyn ScsiBlockDevice>`.
+    pub fn lun(mut self, lun: u16, device: D) -> Self {
+        self.luns.push((lun, device));
+        self
+    }
+
+    /// Build the target with the specified storage device as LUN 0
     pub fn build(self, device: D) -> ScsiResult<IscsiTarget<D>> {
         let bind_addr = self.bind_addr.unwrap_or_else(|| format!("0.0.0.0:{}", ISCSI_PORT));
         let target_name = self.target_name.unwrap_or_else(|| {
@@ -1081,14 +2170,39 @@ impl<D: ScsiBlockDevice> IscsiTargetBuilder<D> {
             ));
         }
 
+        if let ConnectionModel::EventDriven { workers } = self.connection_model {
+            if workers == 0 {
+                return Err(IscsiError::Config("EventDriven needs at least one worker".to_string()));
+            }
+            if cfg!(not(unix)) {
+                return Err(IscsiError::Config("Event-driven connections need a Unix platform".to_string()));
+            }
+        }
+
+        if self.max_connections_per_session == 0 {
+            return Err(IscsiError::Config("max_connections_per_session must be at least 1".to_string()));
+        }
+
+        let mut luns = vec![(0, device)];
+        for (lun, device) in self.luns {
+            if lun > crate::scsi::MAX_LUN {
+                return Err(IscsiError::Config(format!("LUN {} is above the maximum of {}", lun, crate::scsi::MAX_LUN)));
+            }
+            if luns.iter().any(|&(n, _)| n == lun) {
+                return Err(IscsiError::Config(format!("LUN {} is exported twice", lun)));
+            }
+            luns.push((lun, device));
+        }
+
         let max_connections = self.max_connections.unwrap_or(16);
         let max_sessions = self.max_sessions.unwrap_or(256);
+        let metrics = Arc::new(TargetMetrics::default());
 
         Ok(IscsiTarget {
             bind_addr,
             target_name,
             target_alias,
-            device: Arc::new(Mutex::new(device)),
+            luns: Arc::new(LunTable::new(luns, &metrics)),
             running: Arc::new(AtomicBool::new(false)),
             shutting_down: Arc::new(AtomicBool::new(false)),
             auth_config: self.auth_config,
@@ -1096,7 +2210,12 @@ impl<D: ScsiBlockDevice> IscsiTargetBuilder<D> {
             active_connections: Arc::new(std::sync::atomic::AtomicUsize::new(0)),
             max_sessions,
             active_sessions: Arc::new(std::sync::atomic::AtomicUsize::new(0)),
+            max_connections_per_session: self.max_connections_per_session,
             allowed_initiators: self.allowed_initiators,
+            connection_model: self.connection_model,
+            trace: (self.trace_capacity > 0).then(|| Arc::new(PduTrace::new(self.trace_capacity))),
+            metrics,
+            metrics_addr: self.metrics_addr,
         })
     }
 }
@@ -1108,6 +2227,7 @@ impl<D: ScsiBlockDevice> IscsiTargetBuilder<D> {
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::pdu::flags;
 
     /// Mock device for testing
     struct MockDevice {
@@ -1220,4 +2340,974 @@ mod tests {
         assert_eq!(parsed.flags, flags::FINAL);
         assert_eq!(parsed.itt, 0x12345678);
     }
-}
+
+    /// In-memory stream: reads come from `input`, writes land in `output`
+    struct Loopback {
+        input: std::io::Cursor<Vec<u8>>,
+        output: Vec<u8>,
+    }
+
+    impl Loopback {
+        fn new(input: Vec<u8>) -> Self {
+            Loopback { input: std::io::Cursor::new(input), output: Vec::new() }
+        }
+    }
+
+    impl Read for Loopback {
+        fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+            self.input.read(buf)
+        }
+    }
+
+    impl Write for Loopback {
+        fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+            self.output.write(buf)
+        }
+
+        fn flush(&mut self) -> std::io::Result<()> {
+            Ok(())
+        }
+    }
+
+    fn data_in(itt: u32, data: Vec<u8>) -> IscsiPdu {
+        let mut pdu = IscsiPdu::new();
+        pdu.opcode = opcode::SCSI_DATA_IN;
+        pdu.itt = itt;
+        pdu.data = data;
+        pdu
+    }
+
+    #[test]
+    fn test_write_pdus_layout() {
+        let both = Digests { header: true, data: true };
+        let pdus = [data_in(1, vec![1, 2, 3, 4, 5]), IscsiPdu::new()];
+        let mut conn = PduStream::new(Loopback::new(Vec::new()));
+        conn.write_pdus(&pdus, both).unwrap();
+
+        let bytes = pdus[0].to_bytes();
+        let wire = &conn.stream.output;
+        // BHS, header digest, padded data, data digest; then BHS and header digest only
+        assert_eq!(wire.len(), (BHS_SIZE + 4 + 8 + 4) + (BHS_SIZE + 4));
+        assert_eq!(&wire[..BHS_SIZE], &bytes[..BHS_SIZE]);
+        assert_eq!(digest::from_wire(&wire[BHS_SIZE..BHS_SIZE + 4]), digest::crc32c(&bytes[..BHS_SIZE]));
+        assert_eq!(&wire[BHS_SIZE + 4..BHS_SIZE + 12], &bytes[BHS_SIZE..]);
+        // Data digest covers the padding too
+        assert_eq!(digest::from_wire(&wire[BHS_SIZE + 12..BHS_SIZE + 16]), digest::crc32c(&bytes[BHS_SIZE..]));
+
+        let mut plain = PduStream::new(Loopback::new(Vec::new()));
+        plain.write_pdu(&pdus[0], Digests::default()).unwrap();
+        assert_eq!(plain.stream.output, bytes);
+    }
+
+    #[test]
+    fn test_pdu_stream_roundtrip() {
+        let both = Digests { header: true, data: true };
+        let pdus: Vec<IscsiPdu> = (0..300).map(|i| data_in(i, vec![i as u8; (i % 7) as usize])).collect();
+        let mut writer = PduStream::new(Loopback::new(Vec::new()));
+        writer.write_pdus(&pdus, both).unwrap();
+
+        let mut reader = PduStream::new(Loopback::new(writer.stream.output));
+        for expected in &pdus {
+            let pdu = match reader.read_pdu(both).unwrap() {
+                ReceivedPdu::Pdu(pdu) => pdu,
+                ReceivedPdu::DataDigestError(_) => panic!("unexpected data digest error"),
+            };
+            assert_eq!(pdu.itt, expected.itt);
+            assert_eq!(pdu.data, expected.data);
+            assert_eq!(pdu.data_length as usize, expected.data.len());
+            reader.recycle(pdu.data);
+        }
+    }
+
+    /// Input that arrives a few bytes at a time, with nothing waiting in between
+    struct Trickle {
+        input: std::io::Cursor<Vec<u8>>,
+        waiting: bool,
+    }
+
+    impl Read for Trickle {
+        fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+            self.waiting = !self.waiting;
+            if !self.waiting {
+                return Err(std::io::ErrorKind::WouldBlock.into());
+            }
+            let len = buf.len().min(5);
+            self.input.read(&mut buf[..len])
+        }
+    }
+
+    impl Write for Trickle {
+        fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+            Ok(buf.len())
+        }
+
+        fn flush(&mut self) -> std::io::Result<()> {
+            Ok(())
+        }
+    }
+
+    #[test]
+    fn test_read_pdu_resumes_partial_input() {
+        let both = Digests { header: true, data: true };
+        let pdus = [data_in(1, vec![0x11; 13]), data_in(2, Vec::new()), data_in(3, vec![0x33; 64])];
+        let mut writer = PduStream::new(Loopback::new(Vec::new()));
+        writer.write_pdus(&pdus, both).unwrap();
+
+        let mut reader = PduStream::new(Trickle { input: std::io::Cursor::new(writer.stream.output), waiting: false });
+        for expected in &pdus {
+            let mut stops = 0;
+            let pdu = loop {
+                match reader.read_pdu(both) {
+                    Ok(ReceivedPdu::Pdu(pdu)) => break pdu,
+                    Err(IscsiError::Io(ref e)) if e.kind() == std::io::ErrorKind::WouldBlock => stops += 1,
+                    _ => panic!("PDU not resumed intact"),
+                }
+            };
+            assert!(stops > 1);
+            assert_eq!(pdu.itt, expected.itt);
+            assert_eq!(pdu.data, expected.data);
+            reader.recycle(pdu.data);
+        }
+    }
+
+    #[test]
+    fn test_read_pdu_digest_errors() {
+        let both = Digests { header: true, data: true };
+        let mut writer = PduStream::new(Loopback::new(Vec::new()));
+        writer.write_pdu(&data_in(7, vec![0xAA; 16]), both).unwrap();
+        let good = writer.stream.output;
+
+        let mut bad_data = good.clone();
+        bad_data[BHS_SIZE + 4] ^= 0xFF;
+        let mut reader = PduStream::new(Loopback::new(bad_data));
+        match reader.read_pdu(both).unwrap() {
+            ReceivedPdu::DataDigestError(bhs) => assert_eq!(bhs[..], good[..BHS_SIZE]),
+            ReceivedPdu::Pdu(_) => panic!("corrupt data segment accepted"),
+        }
+
+        let mut bad_header = good;
+        bad_header[16] ^= 0xFF;
+        let mut reader = PduStream::new(Loopback::new(bad_header));
+        assert!(matches!(reader.read_pdu(both), Err(IscsiError::Protocol(_))));
+    }
+
+    #[test]
+    fn test_direct_read_extent() {
+        let read10 = [0x28, 0, 0, 0, 0, 10, 0, 0, 4, 0];
+        assert_eq!(direct_read_extent(&read10, 100), Some((10, 4)));
+        assert_eq!(direct_read_extent(&read10, 13), None);
+
+        let mut read16 = [0u8; 16];
+        read16[0] = 0x88;
+        read16[9] = 2;
+        read16[13] = 8;
+        assert_eq!(direct_read_extent(&read16, 100), Some((2, 8)));
+
+        // Zero-length reads and other opcodes go through the handler
+        assert_eq!(direct_read_extent(&[0x28, 0, 0, 0, 0, 0, 0, 0, 0, 0], 100), None);
+        assert_eq!(direct_read_extent(&[0x2A, 0, 0, 0, 0, 0, 0, 0, 1, 0], 100), None);
+    }
+
+    #[test]
+    fn test_data_in_pdus() {
+        let mut session = IscsiSession::new();
+        let data: Vec<u8> = (0..2500u32).map(|i| i as u8).collect();
+        let fill = |offset: usize, buf: &mut [u8]| {
+            buf.copy_from_slice(&data[offset..offset + buf.len()]);
+            Ok(())
+        };
+        let stat_sn = session.stat_sn;
+        let pdus = data_in_pdus(&mut session, 9, data.len(), 1024, scsi_status::GOOD, fill).unwrap();
+
+        assert_eq!(pdus.len(), 3);
+        assert_eq!(pdus.iter().map(|p| p.data.len()).collect::<Vec<_>>(), vec![1024, 1024, 452]);
+        assert_eq!(pdus.iter().flat_map(|p| p.data.iter().copied()).collect::<Vec<_>>(), data);
+        // Only the final PDU carries status and takes a StatSN
+        assert_eq!(session.stat_sn, stat_sn.wrapping_add(1));
+        assert_eq!(pdus[2].flags & 0x01, 0x01);
+        assert_eq!(pdus[0].flags & 0x01, 0);
+
+        // A failed fill consumes no StatSN
+        let fail = |offset: usize, _: &mut [u8]| {
+            if offset > 0 { Err(IscsiError::Scsi("medium".into())) } else { Ok(()) }
+        };
+        assert!(data_in_pdus(&mut session, 10, 4096, 1024, scsi_status::GOOD, fail).is_err());
+        assert_eq!(session.stat_sn, stat_sn.wrapping_add(1));
+    }
+
+    /// WRITE(10) of `data` at `lba` with all of it as immediate data
+    fn write10(itt: u32, lba: u32, blocks: u16, fua: bool, data: Vec<u8>) -> IscsiPdu {
+        let mut cmd = IscsiPdu::new();
+        cmd.opcode = opcode::SCSI_COMMAND;
+        cmd.flags = flags::FINAL | flags::WRITE;
+        cmd.itt = itt;
+        cmd.specific[0..4].copy_from_slice(&(blocks as u32 * 512).to_be_bytes());
+        cmd.specific[4..8].copy_from_slice(&itt.to_be_bytes());
+        let cdb = &mut cmd.specific[12..22];
+        cdb[0] = 0x2a;
+        cdb[1] = if fua { 0x08 } else { 0 };
+        cdb[2..6].copy_from_slice(&lba.to_be_bytes());
+        cdb[7..9].copy_from_slice(&blocks.to_be_bytes());
+        cmd.data_length = data.len() as u32;
+        cmd.data = data;
+        cmd
+    }
+
+    #[test]
+    fn test_fua_write_flushes_cache() {
+        use crate::backend::MemoryDevice;
+        use crate::cache::{WriteBackCache, DEFAULT_MAX_DIRTY_BYTES};
+
+        let luns = LunTable::new(
+            vec![(0, WriteBackCache::new(MemoryDevice::new(64 * 512, 512), DEFAULT_MAX_DIRTY_BYTES))],
+            &Arc::default(),
+        );
+        let device = &luns.devices[&0];
+        let dirty = || device.read().unwrap().dirty_bytes();
+        let mut session = IscsiSession::new();
+
+        // A plain write stays in the cache
+        let pdus = handle_scsi_command(&mut session, &write10(1, 4, 1, false, vec![1; 512]), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(dirty(), 512);
+
+        // FUA with immediate data: everything dirty is written back first
+        let pdus = handle_scsi_command(&mut session, &write10(2, 5, 1, true, vec![2; 512]), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(dirty(), 0);
+        let on_disk = device.read().unwrap().with_inner(|d| d.read(4, 2, 512).unwrap()).unwrap();
+        assert_eq!(on_disk, [vec![1; 512], vec![2; 512]].concat());
+
+        // FUA through R2T: the flush waits for the last Data-Out
+        let pdus = handle_scsi_command(&mut session, &write10(3, 8, 2, true, vec![3; 512]), &luns).unwrap();
+        assert_eq!(pdus[0].opcode, opcode::R2T);
+        let ttt = BigEndian::read_u32(&pdus[0].specific[0..4]);
+        assert_eq!(dirty(), 512);
+
+        let mut data_out = IscsiPdu::new();
+        data_out.opcode = opcode::SCSI_DATA_OUT;
+        data_out.flags = flags::FINAL;
+        data_out.itt = 3;
+        data_out.specific[0..4].copy_from_slice(&ttt.to_be_bytes());
+        data_out.specific[20..24].copy_from_slice(&512u32.to_be_bytes());
+        data_out.data = vec![4; 512];
+        data_out.data_length = 512;
+        let pdus = handle_scsi_data_out(&mut session, &data_out, &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(dirty(), 0);
+
+        // SYNCHRONIZE CACHE(10) writes back plain writes too
+        handle_scsi_command(&mut session, &write10(4, 20, 1, false, vec![5; 512]), &luns).unwrap();
+        let mut sync = IscsiPdu::new();
+        sync.opcode = opcode::SCSI_COMMAND;
+        sync.flags = flags::FINAL;
+        sync.itt = 5;
+        sync.specific[4..8].copy_from_slice(&5u32.to_be_bytes());
+        sync.specific[12] = 0x35;
+        let pdus = handle_scsi_command(&mut session, &sync, &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(dirty(), 0);
+    }
+
+    /// A SCSI command PDU with `data` as immediate data
+    fn scsi_command(itt: u32, cdb: &[u8], expected: u32, data: Vec<u8>) -> IscsiPdu {
+        let mut cmd = IscsiPdu::new();
+        cmd.opcode = opcode::SCSI_COMMAND;
+        cmd.flags = flags::FINAL | flags::WRITE;
+        cmd.itt = itt;
+        cmd.specific[0..4].copy_from_slice(&expected.to_be_bytes());
+        cmd.specific[4..8].copy_from_slice(&itt.to_be_bytes());
+        cmd.specific[12..12 + cdb.len()].copy_from_slice(cdb);
+        cmd.data_length = data.len() as u32;
+        cmd.data = data;
+        cmd
+    }
+
+    fn write_same16(lba: u64, blocks: u32, flags: u8) -> [u8; 16] {
+        let mut cdb = [0u8; 16];
+        cdb[0] = 0x93;
+        cdb[1] = flags;
+        cdb[2..10].copy_from_slice(&lba.to_be_bytes());
+        cdb[10..14].copy_from_slice(&blocks.to_be_bytes());
+        cdb
+    }
+
+    #[test]
+    fn test_unmap_and_write_same() {
+        use crate::backend::SparseDevice;
+
+        let luns = LunTable::new(vec![(0, SparseDevice::with_chunk_size(1024 * 512, 512, 8 * 512))], &Arc::default());
+        let device = &luns.devices[&0];
+        let allocated = || device.read().unwrap().allocated_bytes();
+        let read = |lba: u64, blocks: u32| device.read().unwrap().read(lba, blocks, 512).unwrap();
+        let mut session = IscsiSession::new();
+
+        let pdus = handle_scsi_command(&mut session, &write10(1, 0, 32, false, vec![7; 32 * 512]), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(allocated(), 32 * 512);
+
+        // UNMAP with its parameter list as immediate data: blocks 8..24
+        let mut list = vec![0u8; 24];
+        list[2..4].copy_from_slice(&16u16.to_be_bytes());
+        list[8..16].copy_from_slice(&8u64.to_be_bytes());
+        list[16..20].copy_from_slice(&16u32.to_be_bytes());
+        let cdb = [0x42, 0, 0, 0, 0, 0, 0, 0, 24, 0];
+        let pdus = handle_scsi_command(&mut session, &scsi_command(2, &cdb, 24, list.clone()), &luns).unwrap();
+        assert_eq!(pdus[0].opcode, opcode::SCSI_RESPONSE);
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(allocated(), 16 * 512);
+        assert_eq!(read(8, 16), vec![0u8; 16 * 512]);
+        assert_eq!(read(24, 8), vec![7u8; 8 * 512]);
+
+        // Without immediate data the list arrives after an R2T
+        list[8..16].copy_from_slice(&24u64.to_be_bytes());
+        list[16..20].copy_from_slice(&8u32.to_be_bytes());
+        let pdus = handle_scsi_command(&mut session, &scsi_command(3, &cdb, 24, Vec::new()), &luns).unwrap();
+        assert_eq!(pdus[0].opcode, opcode::R2T);
+        let ttt = BigEndian::read_u32(&pdus[0].specific[0..4]);
+        let mut data_out = IscsiPdu::new();
+        data_out.opcode = opcode::SCSI_DATA_OUT;
+        data_out.flags = flags::FINAL;
+        data_out.itt = 3;
+        data_out.specific[0..4].copy_from_slice(&ttt.to_be_bytes());
+        data_out.data_length = 24;
+        data_out.data = list;
+        let pdus = handle_scsi_data_out(&mut session, &data_out, &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert!(session.pending_writes.is_empty());
+        assert_eq!(allocated(), 8 * 512);
+
+        // WRITE SAME(16) of a pattern block fills the range
+        let pdus = handle_scsi_command(&mut session, &scsi_command(4, &write_same16(100, 20, 0), 512, vec![3; 512]), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(read(100, 20), vec![3u8; 20 * 512]);
+
+        // With UNMAP and a zero block, or NDOB, it deallocates
+        let pdus = handle_scsi_command(&mut session, &scsi_command(5, &write_same16(96, 16, 0x08), 512, vec![0; 512]), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(read(96, 24), [vec![0u8; 16 * 512], vec![3u8; 8 * 512]].concat());
+        let pdus = handle_scsi_command(&mut session, &scsi_command(6, &write_same16(0, 1024, 0x09), 0, Vec::new()), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(allocated(), 0);
+
+        // A device without unmap support rejects UNMAP before asking for data
+        let thick = LunTable::new(vec![(0, MockDevice::new(64, 512))], &Arc::default());
+        let pdus = handle_scsi_command(&mut session, &scsi_command(7, &cdb, 24, Vec::new()), &thick).unwrap();
+        assert_eq!(pdus[0].opcode, opcode::SCSI_RESPONSE);
+        assert_eq!(pdus[0].specific[1], scsi_status::CHECK_CONDITION);
+        assert!(session.pending_writes.is_empty());
+    }
+
+    #[test]
+    fn test_multiple_luns() {
+        use crate::backend::{MemoryDevice, SparseDevice};
+
+        // Different backends behind one target, at non-contiguous LUNs
+        let devices: Vec<(u16, Box<dyn ScsiBlockDevice>)> = vec![
+            (0, Box::new(MockDevice::new(64, 512))),
+            (5, Box::new(MemoryDevice::new(64 * 512, 512))),
+            (300, Box::new(SparseDevice::new(64 * 512, 512))),
+        ];
+        let luns = LunTable::new(devices, &Arc::default());
+        let mut session = IscsiSession::new();
+        let to_lun = |mut pdu: IscsiPdu, lun: u16| {
+            pdu.lun = ScsiHandler::encode_lun(lun);
+            pdu
+        };
+
+        // REPORT LUNS lists them all, whichever LUN it is sent to
+        let report = [0xA0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0];
+        let mut report = to_lun(scsi_command(1, &report, 256, Vec::new()), 5);
+        report.flags = flags::FINAL | flags::READ;
+        let pdus = handle_scsi_command(&mut session, &report, &luns).unwrap();
+        assert_eq!(BigEndian::read_u32(&pdus[0].data[0..4]), 24);
+        assert_eq!(&pdus[0].data[16..18], &[0, 5]);
+        assert_eq!(&pdus[0].data[24..26], &[0x41, 0x2C]);
+
+        // A write to one LUN goes to that LUN's device only, and does not
+        // wait for a lock another LUN holds
+        let busy = luns.devices[&0].inner.write().unwrap();
+        let pdus = handle_scsi_command(&mut session, &to_lun(write10(2, 3, 1, false, vec![9; 512]), 300), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        drop(busy);
+        assert_eq!(luns.devices[&300].read().unwrap().read(3, 1, 512).unwrap(), vec![9; 512]);
+        assert_eq!(luns.devices[&5].read().unwrap().read(3, 1, 512).unwrap(), vec![0; 512]);
+
+        // LUNs that are not exported are rejected
+        let pdus = handle_scsi_command(&mut session, &to_lun(write10(3, 3, 1, false, vec![9; 512]), 4), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::CHECK_CONDITION);
+    }
+
+    #[test]
+    fn test_task_management_aborts_writes() {
+        use crate::backend::MemoryDevice;
+        use crate::pdu::{tmf_function, tmf_response};
+
+        let luns = LunTable::new(
+            vec![(0, MemoryDevice::new(64 * 512, 512)), (5, MemoryDevice::new(64 * 512, 512))],
+            &Arc::default(),
+        );
+        let mut session = IscsiSession::new();
+        let mut tmf_itt = 100;
+        let mut tmf = |session: &mut IscsiSession, function: u8, lun: u16, rtt: u32, ref_cmd_sn: u32| {
+            tmf_itt += 1;
+            let request = IscsiPdu::task_management_request(
+                function, ScsiHandler::encode_lun(lun), tmf_itt, rtt, session.exp_cmd_sn, 0, ref_cmd_sn);
+            let pdus = handle_full_feature_phase(session, &request, &luns, &SessionTable::new(), "iqn.test:target", "127.0.0.1:3260").unwrap();
+            assert_eq!(pdus.len(), 1);
+            assert_eq!(pdus[0].opcode, opcode::TASK_MANAGEMENT_RESPONSE);
+            assert_eq!(pdus[0].itt, tmf_itt);
+            pdus[0].header_bytes()[2]
+        };
+        // A write without immediate data waits for Data-Out after its R2T
+        let start_write = |session: &mut IscsiSession, itt: u32, lun: u16| {
+            let mut cmd = write10(itt, 0, 2, false, Vec::new());
+            cmd.lun = ScsiHandler::encode_lun(lun);
+            let pdus = handle_scsi_command(session, &cmd, &luns).unwrap();
+            assert_eq!(pdus[0].opcode, opcode::R2T);
+            BigEndian::read_u32(&pdus[0].specific[0..4])
+        };
+
+        // ABORT TASK drops the R2T sequence; late Data-Out is discarded.
+        // The task must match the TMF's LUN and RefCmdSN.
+        let ttt = start_write(&mut session, 1, 0);
+        assert_eq!(tmf(&mut session, tmf_function::ABORT_TASK, 5, 1, 1), tmf_response::TASK_DOES_NOT_EXIST);
+        assert_eq!(tmf(&mut session, tmf_function::ABORT_TASK, 0, 1, 2), tmf_response::TASK_DOES_NOT_EXIST);
+        assert!(session.pending_writes.contains_key(&1));
+        assert_eq!(tmf(&mut session, tmf_function::ABORT_TASK, 0, 1, 1), tmf_response::FUNCTION_COMPLETE);
+        assert!(session.pending_writes.is_empty());
+        let mut data_out = IscsiPdu::new();
+        data_out.opcode = opcode::SCSI_DATA_OUT;
+        data_out.flags = flags::FINAL;
+        data_out.itt = 1;
+        data_out.specific[0..4].copy_from_slice(&ttt.to_be_bytes());
+        data_out.data = vec![7; 1024];
+        data_out.data_length = 1024;
+        assert!(handle_scsi_data_out(&mut session, &data_out, &luns).unwrap().is_empty());
+        assert_eq!(luns.devices[&0].read().unwrap().read(0, 2, 512).unwrap(), vec![0; 1024]);
+
+        // The task is gone, and its CmdSN has left the window
+        assert_eq!(tmf(&mut session, tmf_function::ABORT_TASK, 0, 1, 1), tmf_response::TASK_DOES_NOT_EXIST);
+        // A command still in the window, ahead of the TMF, that never
+        // arrived counts as aborted
+        let missing = session.exp_cmd_sn;
+        assert_eq!(session.abort_task(99, 0, missing, missing.wrapping_add(1)), tmf_response::FUNCTION_COMPLETE);
+        assert_eq!(session.abort_task(99, 0, missing, missing), tmf_response::TASK_DOES_NOT_EXIST);
+
+        // ABORT TASK SET and LUN RESET only touch their own LUN
+        start_write(&mut session, 2, 0);
+        start_write(&mut session, 3, 0);
+        start_write(&mut session, 4, 5);
+        assert_eq!(tmf(&mut session, tmf_function::ABORT_TASK_SET, 0, 0xFFFF_FFFF, 0), tmf_response::FUNCTION_COMPLETE);
+        assert_eq!(session.pending_writes.keys().copied().collect::<Vec<_>>(), vec![4]);
+        assert_eq!(tmf(&mut session, tmf_function::LOGICAL_UNIT_RESET, 7, 0xFFFF_FFFF, 0), tmf_response::LUN_DOES_NOT_EXIST);
+        assert_eq!(tmf(&mut session, tmf_function::LOGICAL_UNIT_RESET, 5, 0xFFFF_FFFF, 0), tmf_response::FUNCTION_COMPLETE);
+        assert!(session.pending_writes.is_empty());
+
+        // Functions the target cannot perform say so
+        assert_eq!(tmf(&mut session, tmf_function::TASK_REASSIGN, 0, 1, 1), tmf_response::TASK_REASSIGNMENT_NOT_SUPPORTED);
+        assert_eq!(tmf(&mut session, tmf_function::CLEAR_ACA, 0, 0xFFFF_FFFF, 0), tmf_response::FUNCTION_NOT_SUPPORTED);
+        assert_eq!(session.state, SessionState::Free);
+        assert_eq!(tmf(&mut session, tmf_function::TARGET_COLD_RESET, 0, 0xFFFF_FFFF, 0), tmf_response::FUNCTION_COMPLETE);
+        assert_eq!(session.state, SessionState::Logout);
+    }
+
+    #[test]
+    fn test_task_management_reaches_every_connection_and_session() {
+        use crate::backend::MemoryDevice;
+        use crate::pdu::{tmf_function, tmf_response};
+
+        let luns = LunTable::new(vec![(0, MemoryDevice::new(64 * 512, 512))], &Arc::default());
+        let sessions = SessionTable::new();
+        let login = |tsih: u16| {
+            let mut session = IscsiSession::new();
+            session.tsih = tsih;
+            session.isid = [0x80, 0, 0, 0, 0, tsih as u8];
+            session.params.max_connections = 2;
+            session.params.max_connections_offered = true;
+            session.max_cmd_sn = session.exp_cmd_sn + 15;
+            session.core = Some(sessions.register(&session));
+            session
+        };
+        // Session 1 has two connections, session 2 one
+        let mut first = login(1);
+        let mut second = IscsiSession::new();
+        second.cid = 1;
+        second.join(sessions.attach(1, first.isid).unwrap());
+        let mut other = login(2);
+
+        let tmf = |session: &mut IscsiSession, function: u8, rtt: u32, ref_cmd_sn: u32| {
+            let request = IscsiPdu::task_management_request(function, 0, 0x100, rtt, session.exp_cmd_sn, 0, ref_cmd_sn);
+            let pdus = handle_full_feature_phase(session, &request, &luns, &sessions, "iqn.test:target", "127.0.0.1:3260").unwrap();
+            pdus[0].header_bytes()[2]
+        };
+        let command = |itt: u32, cmd_sn: u32, cdb: &[u8]| {
+            let mut cmd = scsi_command(itt, cdb, 512, Vec::new());
+            cmd.specific[4..8].copy_from_slice(&cmd_sn.to_be_bytes());
+            cmd
+        };
+        let write_cdb = [0x2a, 0, 0, 0, 0, 0, 0, 0, 1, 0];
+        // Data-Out for a write whose R2T went out; nothing answers an aborted one
+        let data_out = |session: &mut IscsiSession, itt: u32, r2t: &IscsiPdu| {
+            let mut data_out = IscsiPdu::new();
+            data_out.opcode = opcode::SCSI_DATA_OUT;
+            data_out.flags = flags::FINAL;
+            data_out.itt = itt;
+            data_out.specific[0..4].copy_from_slice(&r2t.specific[0..4]);
+            data_out.data = vec![7; 512];
+            data_out.data_length = 512;
+            handle_scsi_data_out(session, &data_out, &luns).unwrap()
+        };
+
+        // ABORT TASK on one connection ends a write waiting on the other
+        let r2t = handle_scsi_command(&mut second, &command(0x10, 1, &write_cdb), &luns).unwrap().remove(0);
+        assert_eq!(r2t.opcode, opcode::R2T);
+        assert_eq!(tmf(&mut first, tmf_function::ABORT_TASK, 0x10, 2), tmf_response::TASK_DOES_NOT_EXIST);
+        assert_eq!(tmf(&mut first, tmf_function::ABORT_TASK, 0x10, 1), tmf_response::FUNCTION_COMPLETE);
+        assert!(data_out(&mut second, 0x10, &r2t).is_empty());
+        assert!(second.pending_writes.is_empty());
+
+        // ABORT TASK SET reaches a command parked for CmdSN order, which
+        // gives up its CmdSN without running
+        assert_eq!(handle_scsi_command(&mut second, &command(0x11, 3, &write_cdb), &luns).unwrap().len(), 0);
+        assert_eq!(tmf(&mut first, tmf_function::ABORT_TASK_SET, 0xFFFF_FFFF, 0), tmf_response::FUNCTION_COMPLETE);
+        let pdus = handle_scsi_command(&mut first, &command(0x12, 2, &[0u8; 6]), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        let parked = second.next_parked_command().unwrap().unwrap();
+        assert!(run_scsi_command(&mut second, &parked[0], &luns).unwrap().is_empty());
+        assert_eq!(first.core.as_ref().unwrap().cmd_window().0, 4);
+
+        // LUN RESET also ends other sessions' tasks, and leaves them a unit
+        // attention; the session that sent it gets none
+        let r2t = handle_scsi_command(&mut other, &command(0x20, 1, &write_cdb), &luns).unwrap().remove(0);
+        assert_eq!(tmf(&mut first, tmf_function::LOGICAL_UNIT_RESET, 0xFFFF_FFFF, 0), tmf_response::FUNCTION_COMPLETE);
+        assert!(data_out(&mut other, 0x20, &r2t).is_empty());
+        let pdus = handle_scsi_command(&mut other, &command(0x21, 2, &[0u8; 6]), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::CHECK_CONDITION);
+        assert_eq!((pdus[0].data[2], pdus[0].data[12], pdus[0].data[13]), (0x06, 0x29, 0x03));
+        let pdus = handle_scsi_command(&mut other, &command(0x22, 3, &[0u8; 6]), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        let pdus = handle_scsi_command(&mut first, &command(0x13, 4, &[0u8; 6]), &luns).unwrap();
+        assert_eq!(pdus[0].specific[1], scsi_status::GOOD);
+        assert_eq!(luns.devices[&0].read().unwrap().read(0, 1, 512).unwrap(), vec![0; 512]);
+    }
+
+    #[test]
+    fn test_abort_task_before_command_arrives() {
+        use crate::backend::MemoryDevice;
+        use crate::pdu::{tmf_function, tmf_response};
+
+        let luns = LunTable::new(vec![(0, MemoryDevice::new(64 * 512, 512))], &Arc::default());
+        let mut session = IscsiSession::new();
+        session.max_cmd_sn = session.exp_cmd_sn.wrapping_add(7);
+        let first = session.exp_cmd_sn;
+
+        // The initiator has issued CmdSN N and N+1 and aborts N+1 before
+        // the target has seen either
+        let request = IscsiPdu::task_management_request(
+            tmf_function::ABORT_TASK, 0, 100, first + 1, first + 2, 0, first + 1);
+        let pdus = handle_full_feature_phase(&mut session, &request, &luns, &SessionTable::new(), "iqn.test:target", "127.0.0.1:3260").unwrap();
+        assert_eq!(pdus[0].header_bytes()[2], tmf_response::FUNCTION_COMPLETE);
+
+        // CmdSN N runs as usual
+        let pdus = handle_scsi_command(&mut session, &write10(first, 0, 1, false, vec![1; 512]), &luns).unwrap();
+        assert_eq!(pdus.len(), 1);
+        assert_eq!(pdus[0].opcode, opcode::SCSI_RESPONSE);
+
+        // The aborted N+1 uses up its CmdSN but is not run or answered
+        let aborted = write10(first + 1, 1, 1, false, vec![7; 512]);
+        assert!(handle_scsi_command(&mut session, &aborted, &luns).unwrap().is_empty());
+        assert_eq!(session.exp_cmd_sn, first + 2);
+        assert!(session.pending_writes.is_empty());
+        let written = luns.devices[&0].read().unwrap().read(0, 2, 512).unwrap();
+        assert_eq!(written[..512], [1; 512]);
+        assert_eq!(written[512..], [0; 512]);
+    }
+
+    #[test]
+    fn test_builder_luns() {
+        let target = IscsiTarget::builder()
+            .lun(2, MockDevice::new(10, 512))
+            .build(MockDevice::new(20, 512))
+            .unwrap();
+        assert_eq!(target.luns.numbers, vec![0, 2]);
+
+        let duplicate = IscsiTarget::builder().lun(0, MockDevice::new(10, 512)).build(MockDevice::new(20, 512));
+        assert!(duplicate.is_err());
+        let too_high = IscsiTarget::builder().lun(0x4000, MockDevice::new(10, 512)).build(MockDevice::new(20, 512));
+        assert!(too_high.is_err());
+    }
+
+    /// Log `sessions` initiators in together, run a command on each, then log them out
+    fn run_login_burst(addr: &str, model: ConnectionModel, sessions: usize) {
+        let target = Arc::new(
+            IscsiTarget::builder()
+                .bind_addr(addr)
+                .target_name("iqn.2025-12.test:burst")
+                .max_connections(sessions as u32)
+                .connection_model(model)
+                .build(MockDevice::new(64, 512))
+                .unwrap(),
+        );
+        let server = {
+            let target = Arc::clone(&target);
+            thread::spawn(move || target.run())
+        };
+
+        let mut clients = Vec::new();
+        for i in 0..sessions {
+            let mut client = (0..50)
+                .find_map(|_| crate::IscsiClient::connect(addr).ok().or_else(|| {
+                    thread::sleep(Duration::from_millis(20));
+                    None
+                }))
+                .expect("target did not start listening");
+            client.login(&format!("iqn.2025-12.test:init{}", i), "iqn.2025-12.test:burst").unwrap();
+            clients.push(client);
+        }
+        assert_eq!(target.active_session_count(), sessions);
+
+        // Every session, idle or not, still answers
+        for client in clients.iter_mut().rev() {
+            let response = client.send_scsi_command(&[0x00, 0, 0, 0, 0, 0], None).unwrap();
+            assert_eq!(response.opcode, opcode::SCSI_RESPONSE);
+        }
+        for mut client in clients {
+            client.logout().unwrap();
+        }
+
+        for _ in 0..100 {
+            if target.active_connection_count() == 0 {
+                break;
+            }
+            thread::sleep(Duration::from_millis(10));
+        }
+        assert_eq!(target.active_connection_count(), 0);
+        assert_eq!(target.active_session_count(), 0);
+
+        target.stop();
+        server.join().unwrap().unwrap();
+    }
+
+    #[test]
+    fn test_thread_per_connection_logins() {
+        run_login_burst("127.0.0.1:43261", ConnectionModel::ThreadPerConnection, 8);
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn test_event_driven_logins() {
+        // Many more sessions than workers
+        run_login_burst("127.0.0.1:43262", ConnectionModel::EventDriven { workers: 2 }, 32);
+    }
+
+    #[test]
+    fn test_event_driven_needs_workers() {
+        let result = IscsiTarget::builder()
+            .connection_model(ConnectionModel::EventDriven { workers: 0 })
+            .build(MockDevice::new(64, 512));
+        assert!(result.is_err());
+    }
+
+    /// One-PDU login straight to full feature phase, returning the response
+    fn mcs_login(stream: &mut PduStream<TcpStream>, isid: [u8; 6], tsih: u16, cid: u16) -> IscsiPdu {
+        mcs_login_request(stream, isid, tsih, cid);
+        recv(stream)
+    }
+
+    fn mcs_login_request<S: Read + Write>(stream: &mut PduStream<S>, isid: [u8; 6], tsih: u16, cid: u16) {
+        let mut lun = [0u8; 8];
+        lun[..6].copy_from_slice(&isid);
+        lun[6..].copy_from_slice(&tsih.to_be_bytes());
+
+        let mut login = IscsiPdu::new();
+        login.opcode = opcode::LOGIN_REQUEST;
+        login.immediate = true;
+        login.flags = flags::TRANSIT | (1 << 2) | 3;
+        login.lun = u64::from_be_bytes(lun);
+        login.itt = cid as u32;
+        login.specific[0..2].copy_from_slice(&cid.to_be_bytes());
+        login.specific[4..8].copy_from_slice(&1u32.to_be_bytes());
+        login.data = serialize_text_parameters(&[
+            ("InitiatorName".to_string(), "iqn.2025-12.test:mcs".to_string()),
+            ("TargetName".to_string(), "iqn.2025-12.test:mcs-target".to_string()),
+            ("SessionType".to_string(), "Normal".to_string()),
+            ("MaxConnections".to_string(), "4".to_string()),
+        ]);
+        stream.write_pdu(&login, Digests::default()).unwrap();
+    }
+
+    fn recv(stream: &mut PduStream<TcpStream>) -> IscsiPdu {
+        match stream.read_pdu(Digests::default()).unwrap() {
+            ReceivedPdu::Pdu(pdu) => pdu,
+            ReceivedPdu::DataDigestError(_) => panic!("unexpected data digest error"),
+        }
+    }
+
+    fn test_unit_ready(stream: &mut PduStream<TcpStream>, cmd_sn: u32) {
+        let mut cmd = IscsiPdu::new();
+        cmd.opcode = opcode::SCSI_COMMAND;
+        cmd.flags = flags::FINAL;
+        cmd.itt = cmd_sn;
+        cmd.specific[4..8].copy_from_slice(&cmd_sn.to_be_bytes());
+        stream.write_pdu(&cmd, Digests::default()).unwrap();
+    }
+
+    #[test]
+    fn test_pdu_trace() {
+        let addr = "127.0.0.1:43264";
+        let target = Arc::new(
+            IscsiTarget::builder()
+                .bind_addr(addr)
+                .target_name("iqn.2025-12.test:mcs-target")
+                .pdu_trace(256)
+                .build(MockDevice::new(64, 512))
+                .unwrap(),
+        );
+        let server = {
+            let target = Arc::clone(&target);
+            thread::spawn(move || target.run())
+        };
+        let stream = (0..50)
+            .find_map(|_| TcpStream::connect(addr).ok().or_else(|| {
+                thread::sleep(Duration::from_millis(20));
+                None
+            }))
+            .expect("target did not start listening");
+        stream.set_read_timeout(Some(Duration::from_secs(5))).unwrap();
+        let mut stream = PduStream::new(stream);
+        mcs_login(&mut stream, [0x80, 0, 0, 0, 0, 2], 0, 0);
+
+        // READ(10) of 2 blocks at LBA 5
+        let mut read = IscsiPdu::new();
+        read.opcode = opcode::SCSI_COMMAND;
+        read.flags = flags::FINAL | flags::READ;
+        read.itt = 0x77;
+        read.specific[0..4].copy_from_slice(&1024u32.to_be_bytes());
+        read.specific[4..8].copy_from_slice(&1u32.to_be_bytes());
+        read.specific[12..22].copy_from_slice(&[0x28, 0, 0, 0, 0, 5, 0, 0, 2, 0]);
+        stream.write_pdu(&read, Digests::default()).unwrap();
+        // Data-In with the S bit carries the status
+        loop {
+            let pdu = recv(&mut stream);
+            if pdu.opcode == opcode::SCSI_RESPONSE || pdu.flags & 0x01 != 0 {
+                break;
+            }
+        }
+
+        drop(stream);
+        target.stop();
+        server.join().unwrap().unwrap();
+
+        let records = target.pdu_trace().unwrap().snapshot();
+        assert_eq!(records[0].opcode, opcode::LOGIN_REQUEST);
+        assert_eq!(records[1].opcode, opcode::LOGIN_RESPONSE);
+        assert!(records.windows(2).all(|w| w[0].timestamp_ns <= w[1].timestamp_ns));
+
+        let command = records.iter().find(|r| r.opcode == opcode::SCSI_COMMAND).unwrap();
+        assert_eq!((command.itt, command.cdb_opcode, command.lba, command.blocks), (0x77, 0x28, 5, 2));
+        let data_in: u32 = records
+            .iter()
+            .filter(|r| r.opcode == opcode::SCSI_DATA_IN && r.itt == 0x77)
+            .map(|r| r.data_length)
+            .sum();
+        assert_eq!(data_in, 1024);
+    }
+
+    #[test]
+    fn test_metrics_endpoint() {
+        let addr = "127.0.0.1:43265";
+        let metrics_addr = "127.0.0.1:43266";
+        let target = Arc::new(
+            IscsiTarget::builder()
+                .bind_addr(addr)
+                .target_name("iqn.2025-12.test:mcs-target")
+                .metrics_addr(metrics_addr)
+                .build(MockDevice::new(64, 512))
+                .unwrap(),
+        );
+        let server = {
+            let target = Arc::clone(&target);
+            thread::spawn(move || target.run())
+        };
+        let stream = (0..50)
+            .find_map(|_| TcpStream::connect(addr).ok().or_else(|| {
+                thread::sleep(Duration::from_millis(20));
+                None
+            }))
+            .expect("target did not start listening");
+        stream.set_read_timeout(Some(Duration::from_secs(5))).unwrap();
+        let mut stream = PduStream::new(stream);
+        mcs_login(&mut stream, [0x80, 0, 0, 0, 0, 3], 0, 0);
+        test_unit_ready(&mut stream, 1);
+        recv(&mut stream);
+
+        let metrics = target.metrics();
+        assert_eq!(metrics.pdus_received(opcode::LOGIN_REQUEST), 1);
+        assert_eq!(metrics.pdus_sent(opcode::SCSI_RESPONSE), 1);
+        assert_eq!(metrics.scsi_commands(0x00), 1);
+
+        let mut http = TcpStream::connect(metrics_addr).unwrap();
+        http.write_all(b"GET /metrics HTTP/1.1\r\nHost: test\r\n\r\n").unwrap();
+        let mut reply = String::new();
+        http.read_to_string(&mut reply).unwrap();
+        assert!(reply.starts_with("HTTP/1.1 200 OK\r\n"));
+        assert!(reply.contains("iscsi_target_scsi_commands_total{operation=\"0x00\"} 1\n"));
+        assert!(reply.contains("iscsi_target_pdus_sent_total{opcode=\"0x23\"} 1\n"));
+
+        let mut http = TcpStream::connect(metrics_addr).unwrap();
+        http.write_all(b"GET / HTTP/1.1\r\n\r\n").unwrap();
+        let mut reply = String::new();
+        http.read_to_string(&mut reply).unwrap();
+        assert!(reply.starts_with("HTTP/1.1 404"));
+
+        drop(stream);
+        target.stop();
+        server.join().unwrap().unwrap();
+    }
+
+    fn run_connections_join_session(addr: &str, model: ConnectionModel) {
+        let target = Arc::new(
+            IscsiTarget::builder()
+                .bind_addr(addr)
+                .target_name("iqn.2025-12.test:mcs-target")
+                .max_connections_per_session(2)
+                .connection_model(model)
+                .build(MockDevice::new(64, 512))
+                .unwrap(),
+        );
+        let server = {
+            let target = Arc::clone(&target);
+            thread::spawn(move || target.run())
+        };
+        let connect = || {
+            let stream = (0..50)
+                .find_map(|_| TcpStream::connect(addr).ok().or_else(|| {
+                    thread::sleep(Duration::from_millis(20));
+                    None
+                }))
+                .expect("target did not start listening");
+            stream.set_read_timeout(Some(Duration::from_secs(5))).unwrap();
+            PduStream::new(stream)
+        };
+        let status = |pdu: &IscsiPdu| (pdu.specific[16], pdu.specific[17]);
+        let tsih_of = |pdu: &IscsiPdu| (pdu.lun & 0xFFFF) as u16;
+        let isid = [0x80, 0x12, 0x34, 0x56, 0x78, 0x9a];
+
+        let mut leading = connect();
+        let response = mcs_login(&mut leading, isid, 0, 0);
+        assert_eq!(status(&response), (0, 0));
+        let tsih = tsih_of(&response);
+        assert_ne!(tsih, 0);
+        assert!(String::from_utf8_lossy(&response.data).contains("MaxConnections=2"));
+
+        let mut second = connect();
+        let response = mcs_login(&mut second, isid, tsih, 1);
+        assert_eq!(status(&response), (0, 0));
+        assert_eq!(tsih_of(&response), tsih);
+
+        // Over MaxConnections, and a TSIH with the wrong ISID
+        let mut third = connect();
+        assert_eq!(status(&mcs_login(&mut third, isid, tsih, 2)), (0x02, 0x06));
+        let mut stranger = connect();
+        assert_eq!(status(&mcs_login(&mut stranger, [0x80, 0, 0, 0, 0, 1], tsih, 0)), (0x02, 0x0A));
+        drop((third, stranger));
+        assert_eq!(target.active_session_count(), 1);
+
+        // CmdSN 2 on the second connection is parked until CmdSN 1 arrives
+        // on the first, well inside CMD_ORDER_TIMEOUT
+        test_unit_ready(&mut second, 2);
+        thread::sleep(Duration::from_millis(20));
+        let started = Instant::now();
+        test_unit_ready(&mut leading, 1);
+        recv(&mut leading);
+        let response = recv(&mut second);
+        assert_eq!(response.opcode, opcode::SCSI_RESPONSE);
+        assert_eq!(BigEndian::read_u32(&response.specific[8..12]), 3); // ExpCmdSN
+        assert!(started.elapsed() < crate::session::CMD_ORDER_TIMEOUT);
+
+        // A CmdSN that has fallen out of the window is ignored, not run
+        test_unit_ready(&mut leading, 1);
+        test_unit_ready(&mut leading, 3);
+        let response = recv(&mut leading);
+        assert_eq!(response.itt, 3);
+
+        // The session lasts until its last connection closes
+        drop(leading);
+        thread::sleep(Duration::from_millis(100));
+        assert_eq!(target.active_session_count(), 1);
+        drop(second);
+        for _ in 0..100 {
+            if target.active_session_count() == 0 {
+                break;
+            }
+            thread::sleep(Duration::from_millis(10));
+        }
+        assert_eq!(target.active_session_count(), 0);
+
+        target.stop();
+        server.join().unwrap().unwrap();
+    }
+
+    #[test]
+    fn test_connections_join_session() {
+        run_connections_join_session("127.0.0.1:43263", ConnectionModel::ThreadPerConnection);
+    }
+
+    #[test]
+    fn test_event_driven_connections_join_session() {
+        run_connections_join_session("127.0.0.1:43267", ConnectionModel::EventDriven { workers: 1 });
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn test_event_driven_slow_pdu_does_not_hold_worker() {
+        let addr = "127.0.0.1:43268";
+        let target = Arc::new(
+            IscsiTarget::builder()
+                .bind_addr(addr)
+                .target_name("iqn.2025-12.test:mcs-target")
+                .connection_model(ConnectionModel::EventDriven { workers: 1 })
+                .build(MockDevice::new(64, 512))
+                .unwrap(),
+        );
+        let server = {
+            let target = Arc::clone(&target);
+            thread::spawn(move || target.run())
+        };
+        let connect = || {
+            let stream = (0..50)
+                .find_map(|_| TcpStream::connect(addr).ok().or_else(|| {
+                    thread::sleep(Duration::from_millis(20));
+                    None
+                }))
+                .expect("target did not start listening");
+            stream.set_read_timeout(Some(Duration::from_secs(10))).unwrap();
+            PduStream::new(stream)
+        };
+
+        // One initiator sends its login a piece at a time
+        let mut login = PduStream::new(Loopback::new(Vec::new()));
+        mcs_login_request(&mut login, [0x80, 0, 0, 0, 0, 1], 0, 0);
+        let bytes = login.stream.output;
+        let mut slow = connect();
+        slow.stream.write_all(&bytes[..20]).unwrap();
+        thread::sleep(Duration::from_millis(100));
+
+        // The only worker is still free for another initiator
+        let started = Instant::now();
+        let mut fast = connect();
+        assert_eq!(mcs_login(&mut fast, [0x80, 0, 0, 0, 0, 2], 0, 0).opcode, opcode::LOGIN_RESPONSE);
+        assert!(started.elapsed() < Duration::from_secs(2));
+
+        // and the slow PDU is finished, not dropped, once the rest arrives
+        slow.stream.write_all(&bytes[20..BHS_SIZE]).unwrap();
+        thread::sleep(Duration::from_millis(100));
+        slow.stream.write_all(&bytes[BHS_SIZE..]).unwrap();
+        assert_eq!(recv(&mut slow).opcode, opcode::LOGIN_RESPONSE);
+
+        drop((slow, fast));
+        target.stop();
+        server.join().unwrap().unwrap();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,418 @@
+//! PDU trace capture
+//!
+//! `PduTrace` is a fixed-size ring of compact records, one for each PDU the
+//! target reads or writes. Recording takes no lock: a writer claims the
+//! next slot with one atomic add and publishes it through the slot's
+//! sequence number, so connections on different threads never wait for
+//! each other. Once the ring is full the oldest records are overwritten.
+//!
+//! `PduTrace::write_to` saves a snapshot in the binary format below, which
+//! the test suite's replay category reads to re-drive the recorded
+//! initiator workload. All fields are little-endian.
+//!
+//! Header (16 bytes): magic `ISCSITRC`, u16 version, u16 record size,
+//! u32 record count. Each record (32 bytes):
+//!
+//! | Offset | Type | Field                                                  |
+//! |--------|------|--------------------------------------------------------|
+//! | 0      | u64  | nanoseconds since the trace was created                |
+//! | 8      | u64  | starting LBA of a SCSI Command, else 0                 |
+//! | 16     | u32  | Initiator Task Tag                                     |
+//! | 20     | u32  | data segment length                                    |
+//! | 24     | u32  | transfer length in blocks of a SCSI Command, else 0    |
+//! | 28     | u16  | connection number, in the order connections arrived    |
+//! | 30     | u8   | iSCSI opcode; below 0x20 the initiator sent it         |
+//! | 31     | u8   | CDB operation code of a SCSI Command, else 0           |
+
+use crate::error::{IscsiError, ScsiResult};
+use crate::pdu::{opcode, IscsiPdu};
+use crate::scsi::ScsiHandler;
+use std::io::{Read, Write};
+use std::sync::atomic::{fence, AtomicU64, Ordering};
+use std::time::Instant;
+
+/// File magic
+pub const TRACE_MAGIC: [u8; 8] = *b"ISCSITRC";
+
+/// File format version
+pub const TRACE_VERSION: u16 = 1;
+
+/// Size of the file header in bytes
+pub const HEADER_SIZE: usize = 16;
+
+/// Size of one record in bytes
+pub const RECORD_SIZE: usize = 32;
+
+/// One traced PDU
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct TraceRecord {
+    /// Nanoseconds since the trace was created
+    pub timestamp_ns: u64,
+    /// Starting LBA of a SCSI Command
+    pub lba: u64,
+    /// Initiator Task Tag
+    pub itt: u32,
+    /// Data segment length in bytes
+    pub data_length: u32,
+    /// Transfer length in blocks of a SCSI Command
+    pub blocks: u32,
+    /// Connection number
+    pub connection: u16,
+    /// iSCSI opcode
+    pub opcode: u8,
+    /// CDB operation code of a SCSI Command
+    pub cdb_opcode: u8,
+}
+
+impl TraceRecord {
+    /// Summarise a PDU
+    pub fn from_pdu(pdu: &IscsiPdu, connection: u16, timestamp_ns: u64) -> Self {
+        let mut record = TraceRecord {
+            timestamp_ns,
+            itt: pdu.itt,
+            data_length: pdu.data_length,
+            connection,
+            opcode: pdu.opcode,
+            ..Default::default()
+        };
+        if pdu.opcode == opcode::SCSI_COMMAND {
+            let cdb = &pdu.specific[12..28];
+            record.cdb_opcode = cdb[0];
+            (record.lba, record.blocks) = cdb_extent(cdb);
+        }
+        record
+    }
+
+    /// Whether the initiator sent this PDU
+    pub fn from_initiator(&self) -> bool {
+        self.opcode < opcode::NOP_IN
+    }
+
+    /// Encode in the file format
+    pub fn to_bytes(&self) -> [u8; RECORD_SIZE] {
+        let mut bytes = [0u8; RECORD_SIZE];
+        bytes[0..8].copy_from_slice(&self.timestamp_ns.to_le_bytes());
+        bytes[8..16].copy_from_slice(&self.lba.to_le_bytes());
+        bytes[16..20].copy_from_slice(&self.itt.to_le_bytes());
+        bytes[20..24].copy_from_slice(&self.data_length.to_le_bytes());
+        bytes[24..28].copy_from_slice(&self.blocks.to_le_bytes());
+        bytes[28..30].copy_from_slice(&self.connection.to_le_bytes());
+        bytes[30] = self.opcode;
+        bytes[31] = self.cdb_opcode;
+        bytes
+    }
+
+    /// Decode from the file format
+    pub fn from_bytes(bytes: &[u8; RECORD_SIZE]) -> Self {
+        let u32_at = |i: usize| u32::from_le_bytes(bytes[i..i + 4].try_into().unwrap());
+        let u64_at = |i: usize| u64::from_le_bytes(bytes[i..i + 8].try_into().unwrap());
+        TraceRecord {
+            timestamp_ns: u64_at(0),
+            lba: u64_at(8),
+            itt: u32_at(16),
+            data_length: u32_at(20),
+            blocks: u32_at(24),
+            connection: u16::from_le_bytes([bytes[28], bytes[29]]),
+            opcode: bytes[30],
+            cdb_opcode: bytes[31],
+        }
+    }
+
+    /// Pack into the four words of a ring slot
+    fn to_words(self) -> [u64; 4] {
+        [
+            self.timestamp_ns,
+            self.lba,
+            self.itt as u64 | (self.data_length as u64) << 32,
+            self.blocks as u64
+                | (self.connection as u64) << 32
+                | (self.opcode as u64) << 48
+                | (self.cdb_opcode as u64) << 56,
+        ]
+    }
+
+    fn from_words(words: [u64; 4]) -> Self {
+        TraceRecord {
+            timestamp_ns: words[0],
+            lba: words[1],
+            itt: words[2] as u32,
+            data_length: (words[2] >> 32) as u32,
+            blocks: words[3] as u32,
+            connection: (words[3] >> 32) as u16,
+            opcode: (words[3] >> 48) as u8,
+            cdb_opcode: (words[3] >> 56) as u8,
+        }
+    }
+}
+
+/// LBA and block count of the block commands a replay re-issues
+fn cdb_extent(cdb: &[u8]) -> (u64, u32) {
+    match cdb[0] {
+        // READ(6) / WRITE(6): a length of 0 means 256 blocks
+        0x08 | 0x0a => {
+            let lba = ((cdb[1] as u64 & 0x1f) << 16) | (cdb[2] as u64) << 8 | cdb[3] as u64;
+            let blocks = if cdb[4] == 0 { 256 } else { cdb[4] as u32 };
+            (lba, blocks)
+        }
+        // READ(10) / WRITE(10) / SYNCHRONIZE CACHE(10)
+        0x28 | 0x2a | 0x35 => ScsiHandler::parse_rw10_cdb(cdb).unwrap_or_default(),
+        // READ(16) / WRITE(16) / SYNCHRONIZE CACHE(16)
+        0x88 | 0x8a | 0x91 => ScsiHandler::parse_rw16_cdb(cdb).unwrap_or_default(),
+        _ => (0, 0),
+    }
+}
+
+/// One ring slot, published through `seq`
+///
+/// `seq` is 0 while the slot is being written and otherwise one more than
+/// the index of the record it holds.
+struct Slot {
+    seq: AtomicU64,
+    words: [AtomicU64; 4],
+}
+
+/// Lock-free ring of PDU trace records
+pub struct PduTrace {
+    slots: Box<[Slot]>,
+    /// Index of the next record; also the number ever recorded
+    next: AtomicU64,
+    epoch: Instant,
+}
+
+impl PduTrace {
+    /// Create a ring that keeps the last `capacity` records (at least one)
+    pub fn new(capacity: usize) -> Self {
+        let slots = (0..capacity.max(1))
+            .map(|_| Slot {
+                seq: AtomicU64::new(0),
+                words: Default::default(),
+            })
+            .collect();
+        PduTrace {
+            slots,
+            next: AtomicU64::new(0),
+            epoch: Instant::now(),
+        }
+    }
+
+    /// Number of records the ring holds
+    pub fn capacity(&self) -> usize {
+        self.slots.len()
+    }
+
+    /// Number of records ever made, including overwritten ones
+    pub fn recorded(&self) -> u64 {
+        self.next.load(Ordering::Relaxed)
+    }
+
+    /// Record a PDU read or written on connection `connection`
+    pub fn record(&self, connection: u16, pdu: &IscsiPdu) {
+        let now = self.epoch.elapsed().as_nanos() as u64;
+        self.push(TraceRecord::from_pdu(pdu, connection, now));
+    }
+
+    /// Append a record, overwriting the oldest once the ring is full
+    ///
+    /// A record can only tear if the ring wraps all the way round while a
+    /// single write is in progress.
+    pub fn push(&self, record: TraceRecord) {
+        let index = self.next.fetch_add(1, Ordering::Relaxed);
+        let slot = &self.slots[(index % self.slots.len() as u64) as usize];
+
+        slot.seq.store(0, Ordering::Relaxed);
+        fence(Ordering::Release);
+        for (word, value) in slot.words.iter().zip(record.to_words()) {
+            word.store(value, Ordering::Relaxed);
+        }
+        slot.seq.store(index + 1, Ordering::Release);
+    }
+
+    /// Copy out the records in the ring, oldest first
+    ///
+    /// Records still being written are left out.
+    pub fn snapshot(&self) -> Vec<TraceRecord> {
+        let next = self.next.load(Ordering::Acquire);
+        let first = next.saturating_sub(self.slots.len() as u64);
+
+        let mut records = Vec::with_capacity((next - first) as usize);
+        for index in first..next {
+            let slot = &self.slots[(index % self.slots.len() as u64) as usize];
+            let seq = slot.seq.load(Ordering::Acquire);
+            let words = [0, 1, 2, 3].map(|i| slot.words[i].load(Ordering::Relaxed));
+            fence(Ordering::Acquire);
+            if seq == index + 1 && slot.seq.load(Ordering::Relaxed) == seq {
+                records.push(TraceRecord::from_words(words));
+            }
+        }
+        records
+    }
+
+    /// Write a snapshot in the trace file format, returning the record count
+    pub fn write_to<W: Write>(&self, writer: W) -> ScsiResult<usize> {
+        let records = self.snapshot();
+        write_records(writer, &records)?;
+        Ok(records.len())
+    }
+}
+
+/// Write `records` in the trace file format
+pub fn write_records<W: Write>(mut writer: W, records: &[TraceRecord]) -> ScsiResult<()> {
+    let mut header = [0u8; HEADER_SIZE];
+    header[0..8].copy_from_slice(&TRACE_MAGIC);
+    header[8..10].copy_from_slice(&TRACE_VERSION.to_le_bytes());
+    header[10..12].copy_from_slice(&(RECORD_SIZE as u16).to_le_bytes());
+    header[12..16].copy_from_slice(&(records.len() as u32).to_le_bytes());
+    writer.write_all(&header).map_err(IscsiError::Io)?;
+
+    for record in records {
+        writer.write_all(&record.to_bytes()).map_err(IscsiError::Io)?;
+    }
+    writer.flush().map_err(IscsiError::Io)
+}
+
+/// Read records in the trace file format
+pub fn read_records<R: Read>(mut reader: R) -> ScsiResult<Vec<TraceRecord>> {
+    let mut header = [0u8; HEADER_SIZE];
+    reader.read_exact(&mut header).map_err(IscsiError::Io)?;
+    if header[0..8] != TRACE_MAGIC {
+        return Err(invalid_data("not a PDU trace file".to_string()));
+    }
+    let version = u16::from_le_bytes([header[8], header[9]]);
+    let record_size = u16::from_le_bytes([header[10], header[11]]) as usize;
+    if version != TRACE_VERSION || record_size != RECORD_SIZE {
+        return Err(invalid_data(format!(
+            "unsupported trace version {} with {}-byte records",
+            version, record_size
+        )));
+    }
+
+    let count = u32::from_le_bytes(header[12..16].try_into().unwrap()) as usize;
+    let mut records = Vec::with_capacity(count.min(1 << 20));
+    let mut bytes = [0u8; RECORD_SIZE];
+    for _ in 0..count {
+        reader.read_exact(&mut bytes).map_err(IscsiError::Io)?;
+        records.push(TraceRecord::from_bytes(&bytes));
+    }
+    Ok(records)
+}
+
+fn invalid_data(message: String) -> IscsiError {
+    IscsiError::Io(std::io::Error::new(std::io::ErrorKind::InvalidData, message))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Arc;
+    use std::thread;
+
+    fn record(itt: u32) -> TraceRecord {
+        TraceRecord {
+            timestamp_ns: itt as u64 * 1000,
+            itt,
+            opcode: opcode::NOP_OUT,
+            ..Default::default()
+        }
+    }
+
+    #[test]
+    fn test_record_from_scsi_command() {
+        let mut pdu = IscsiPdu::new();
+        pdu.opcode = opcode::SCSI_COMMAND;
+        pdu.itt = 0x1234;
+        pdu.data_length = 4096;
+        // WRITE(10), LBA 0x01020304, 8 blocks
+        pdu.specific[12..22].copy_from_slice(&[0x2a, 0, 1, 2, 3, 4, 0, 0, 8, 0]);
+
+        let r = TraceRecord::from_pdu(&pdu, 3, 77);
+        assert_eq!((r.lba, r.blocks, r.cdb_opcode), (0x0102_0304, 8, 0x2a));
+        assert_eq!((r.itt, r.data_length, r.connection, r.timestamp_ns), (0x1234, 4096, 3, 77));
+        assert!(r.from_initiator());
+
+        pdu.opcode = opcode::SCSI_DATA_IN;
+        let r = TraceRecord::from_pdu(&pdu, 3, 78);
+        assert_eq!((r.lba, r.blocks, r.cdb_opcode), (0, 0, 0));
+        assert!(!r.from_initiator());
+
+        // READ(6) with a transfer length of 0 moves 256 blocks
+        assert_eq!(cdb_extent(&[0x08, 0x21, 0x00, 0x10, 0, 0]), (0x01_0010, 256));
+    }
+
+    #[test]
+    fn test_encoding_roundtrip() {
+        let r = TraceRecord {
+            timestamp_ns: u64::MAX - 1,
+            lba: 0x0102_0304_0506_0708,
+            itt: 0xdead_beef,
+            data_length: 0x00ff_ffff,
+            blocks: 0x8000_0001,
+            connection: 0xfffe,
+            opcode: 0x21,
+            cdb_opcode: 0x8a,
+        };
+        assert_eq!(TraceRecord::from_bytes(&r.to_bytes()), r);
+        assert_eq!(TraceRecord::from_words(r.to_words()), r);
+    }
+
+    #[test]
+    fn test_ring_keeps_newest() {
+        let trace = PduTrace::new(4);
+        assert!(trace.snapshot().is_empty());
+
+        for itt in 0..3 {
+            trace.push(record(itt));
+        }
+        let itts: Vec<u32> = trace.snapshot().iter().map(|r| r.itt).collect();
+        assert_eq!(itts, vec![0, 1, 2]);
+
+        for itt in 3..10 {
+            trace.push(record(itt));
+        }
+        let itts: Vec<u32> = trace.snapshot().iter().map(|r| r.itt).collect();
+        assert_eq!(itts, vec![6, 7, 8, 9]);
+        assert_eq!(trace.recorded(), 10);
+    }
+
+    #[test]
+    fn test_file_roundtrip() {
+        let trace = PduTrace::new(8);
+        for itt in 0..5 {
+            trace.push(record(itt));
+        }
+
+        let mut file = Vec::new();
+        assert_eq!(trace.write_to(&mut file).unwrap(), 5);
+        assert_eq!(file.len(), HEADER_SIZE + 5 * RECORD_SIZE);
+        assert_eq!(read_records(&file[..]).unwrap(), trace.snapshot());
+
+        file[0] = b'X';
+        assert!(read_records(&file[..]).is_err());
+    }
+
+    #[test]
+    fn test_concurrent_recording() {
+        let trace = Arc::new(PduTrace::new(64));
+        let handles: Vec<_> = (0..4u16)
+            .map(|connection| {
+                let trace = Arc::clone(&trace);
+                thread::spawn(move || {
+                    for itt in 0..100 {
+                        trace.push(TraceRecord { connection, itt, ..record(itt) });
+                    }
+                })
+            })
+            .collect();
+        for handle in handles {
+            handle.join().unwrap();
+        }
+
+        // Every surviving record is whole
+        let records = trace.snapshot();
+        assert_eq!(records.len(), 64);
+        assert_eq!(trace.recorded(), 400);
+        for r in records {
+            assert!(r.connection < 4);
+            assert_eq!(r.timestamp_ns, r.itt as u64 * 1000);
+        }
+    }
+}